@@ -0,0 +1,130 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_BRANCH_AND_BOUND_MATCHER_H_
+#define SQUIRREL_2D_LOCALIZER_BRANCH_AND_BOUND_MATCHER_H_
+
+#include "squirrel_2d_localizer/endpoint_types.h"
+#include "squirrel_2d_localizer/grid_map.h"
+#include "squirrel_2d_localizer/likelihood_field_pyramid.h"
+#include "squirrel_2d_localizer/se2_types.h"
+
+#include <vector>
+
+namespace squirrel_2d_localizer {
+
+// Branch-and-bound scan matcher over the whole map or a window of it.
+// Translations are searched on the grid cells and orientations on a fixed
+// angular step. Blocks of translations are scored against the coarse levels
+// of a likelihood pyramid first, and only the blocks whose bound beats the
+// best score are refined.
+class BranchAndBoundMatcher {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    double angular_step;  // Zero selects it from the map resolution.
+    double min_score;     // Minimum mean (rescaled) score of a match.
+  };
+
+ public:
+  BranchAndBoundMatcher() : params_(Params::defaultParams()) {}
+  BranchAndBoundMatcher(const Params& params) : params_(params) {}
+  virtual ~BranchAndBoundMatcher() {}
+
+  // Find the best pose for endpoints given in the robot frame. Returns false
+  // if no pose scores at least min_score.
+  bool match(
+      const GridMap& grid_map, const LikelihoodFieldPyramid& pyramid,
+      const EndPoints2f& endpoints, Pose2d* pose, double* score) const;
+  // Find the best pose within linear_window and angular_window of an initial
+  // pose. The best cell and orientation are refined by the vertex of the
+  // parabola through the scores of their neighbours. Returns false if no
+  // pose scores at least min_score.
+  bool matchInWindow(
+      const GridMap& grid_map, const LikelihoodFieldPyramid& pyramid,
+      const EndPoints2f& endpoints, const Pose2d& initial_pose,
+      double linear_window, double angular_window, Pose2d* pose,
+      double* score) const;
+
+  // Parameters read/write utilities.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ protected:
+  Params params_;
+
+ private:
+  // Block of translations [i, i + 2^level) x [j, j + 2^level) at a given
+  // orientation.
+  struct Candidate {
+    int angle, i, j;
+    float score;
+  };
+
+  // Rasterized endpoints of each orientation, for the translation of the
+  // first cell.
+  struct Rasterization {
+    int nbeams, nangles;
+    std::vector<int> e_i, e_j;
+  };
+
+  // Translations [min_i, max_i) x [min_j, max_j) of a search.
+  struct Window {
+    int min_i, min_j, max_i, max_j;
+  };
+
+  // Angular step such that the farthest endpoint moves by about one cell,
+  // unless set by the parameters.
+  double angularStep(
+      const GridMap& grid_map, const EndPoints2f& endpoints) const;
+  void rasterize(
+      const GridMap& grid_map, const EndPoints2f& endpoints,
+      double first_angle, double angular_step, int nangles,
+      Rasterization* raster) const;
+
+  static void sortCandidates(std::vector<Candidate>* candidates);
+  void scoreCandidate(
+      const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+      int level, Candidate* candidate) const;
+  // Search all of the orientations and the translations of a window from
+  // the blocks of a level. False if none scores at least min_score.
+  bool searchWindow(
+      const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+      const Window& window, int top_level, Candidate* best) const;
+  void search(
+      const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+      const Window& window, int level, std::vector<Candidate>* candidates,
+      Candidate* best) const;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_BRANCH_AND_BOUND_MATCHER_H_ */
@@ -31,20 +31,45 @@
 
 #include "squirrel_2d_localizer/math_types.h"
 
+#include <vector>
+
 namespace squirrel_2d_localizer {
 namespace convolution {
 
-// Compute image convultion using a Gaussian kernel in 2D.
+// Compute image convultion using a Gaussian kernel in 2D. The convolution is
+// separable, and both passes run over contiguous columns. Large kernels are
+// approximated by a recursive filter, so the runtime does not depend on
+// sigma.
 void computeGaussianConvolution2d(
     double sigma, double resolution, const Eigen::MatrixXd& matrix,
     Eigen::MatrixXd* output);
 
+// Radius, in pixels, beyond which a cell does not affect the convolution.
+int gaussianKernelRadius(double sigma, double resolution);
+
 namespace __internal {
 
+// Pixel sigma above which the recursive approximation is used.
+constexpr double kRecursiveFilterMinPixelSigma = 8.;
+
+// Sampled Gaussian kernel with the given pixel sigma, truncated at 5 sigma.
+std::vector<double> computeGaussianKernel(double pixel_sigma);
+
+// Convolve every column of the matrix with a precomputed Gaussian kernel.
+void computeGaussianConvolutionColumns(
+    const std::vector<double>& kernel, const Eigen::MatrixXd& matrix,
+    Eigen::MatrixXd* output);
+
+// Convolve every column of the matrix with a Young-van Vliet recursive
+// Gaussian filter. The output is scaled by the mass of the sampled kernel.
+void computeRecursiveGaussianConvolutionColumns(
+    double pixel_sigma, double scale, const Eigen::MatrixXd& matrix,
+    Eigen::MatrixXd* output);
+
 // Compute image convultion using a Gaussian kernel in 1D.
 void computeGaussianConvolution1d(
-    double sigma, double resolution, const Eigen::VectorXd& vector,
-    Eigen::VectorXd* output);
+    const std::vector<double>& kernel, const double* input, int size,
+    double* output);
 
 }  // namespace __internal
 }  // namespace convolution
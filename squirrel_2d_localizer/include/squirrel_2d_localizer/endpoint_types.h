@@ -31,10 +31,34 @@
 
 #include "squirrel_2d_localizer/math_types.h"
 
+#include <vector>
+
 namespace squirrel_2d_localizer {
 
 typedef Eigen::Vector2d EndPoint2d;
 
+// Structure-of-arrays container of endpoints in single precision, so that
+// batched transforms over all beams can be vectorized.
+struct EndPoints2f {
+  void clear() {
+    x.clear();
+    y.clear();
+  }
+  void reserve(size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+  }
+  void push_back(const EndPoint2d& e) { push_back(e[0], e[1]); }
+  void push_back(double ex, double ey) {
+    x.push_back(static_cast<float>(ex));
+    y.push_back(static_cast<float>(ey));
+  }
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+
+  std::vector<float> x, y;
+};
+
 }  // namespace squirrel_2d_localizer
 
 #endif /* SQUIRREL_2D_LOCALIZER_ENDPOINT_TYPES_H_ */
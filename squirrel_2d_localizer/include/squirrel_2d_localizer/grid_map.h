@@ -33,12 +33,25 @@
 #include "squirrel_2d_localizer/math_types.h"
 #include "squirrel_2d_localizer/se2_types.h"
 
+#include <cstdint>
 #include <vector>
 
 namespace squirrel_2d_localizer {
 
 class GridMap {
  public:
+  // Occupancy percentages, stored row major so that cells along the x axis
+  // are contiguous.
+  typedef Eigen::Matrix<
+      uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> OccupancyMatrix;
+
+  // Block of cells in the map message order: (x, y) is the bottom left cell
+  // of the block and its rows start from the bottom.
+  struct Patch {
+    int x, y, width, height;
+    std::vector<signed char> data;
+  };
+
   class Params {
    public:
     static Params defaultParams();
@@ -57,19 +70,37 @@ class GridMap {
   // Initialize the gridmap.
   void initialize(const std::vector<signed char>& data);
 
+  // Overwrite the cells of a patch, clipped to the map.
+  void update(const Patch& patch);
+  // Smallest patch holding all the cells of data (the whole map, in message
+  // order) that differ from the map. False when no cell differs.
+  bool difference(const std::vector<signed char>& data, Patch* patch) const;
+  // Map indices of the k-th cell of a patch.
+  void patchCellToIndices(const Patch& patch, int k, int* i, int* j) const {
+    *i = params_.height - 1 - (patch.y + k / patch.width);
+    *j = patch.x + k % patch.width;
+  }
+
   // Rasterization and size utilities.
   void pointToIndices(const EndPoint2d& e, int* i, int* j) const;
+  void indicesToPoint(int i, int j, EndPoint2d* e) const;
   bool inside(int i, int j) const;
   void boundingBox(
       double* min_x, double* max_x, double* min_y, double* max_y) const;
 
   // Access the gridmap.
-  double operator()(int i, int j) const { return occupancy_map_(i, j); };
-  double at(int i, int j) const { return occupancy_map_(i, j); }
-  operator const Eigen::MatrixXd&() const { return occupancy_map_; }
+  double operator()(int i, int j) const { return at(i, j); };
+  double at(int i, int j) const { return occupancy_map_(i, j) * 0.01; }
+  const OccupancyMatrix& occupancy() const { return occupancy_map_; }
+
+  // Occupancy probabilities as a dense matrix (allocates).
+  Eigen::MatrixXd occupancyMatrix() const;
 
   // Query uknown free space (for resampling).
-  bool unknown(int i, int j) const { return !!unknown_space_(i, j); }
+  bool unknown(int i, int j) const {
+    const size_t px = i * params_.width + j;
+    return (unknown_space_[px >> 6] >> (px & 63)) & 1;
+  }
 
   // Parameters read/write utilities.
   inline const Params& params() const { return params_; }
@@ -82,8 +113,10 @@ class GridMap {
   Params params_;
 
  private:
-  Eigen::MatrixXd occupancy_map_;
-  Eigen::MatrixXi unknown_space_;
+  void setCell(int i, int j, signed char value);
+
+  OccupancyMatrix occupancy_map_;
+  std::vector<uint64_t> unknown_space_;
 };
 
 }  // namespace squirrel_2d_localizer
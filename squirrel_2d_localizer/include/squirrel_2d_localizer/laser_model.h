@@ -35,8 +35,6 @@
 #include "squirrel_2d_localizer/particle_types.h"
 #include "squirrel_2d_localizer/se2_types.h"
 
-#include <Eigen/StdVector>
-
 #include <cmath>
 #include <mutex>
 #include <vector>
@@ -49,10 +47,23 @@ class LaserModel {
    public:
     static Params defaultParams();
 
+    bool log_likelihood;
     double endpoints_min_distance;
+    int max_beams;
     double range_min, range_max;
     double angle_min, angle_max;
     Pose2d tf_r2l;
+    double health_inlier_ratio;
+  };
+
+  // Health of a weighted measurement: fraction of the beams of the best
+  // particle hitting the likelihood field at least health_inlier_ratio times
+  // the uniform hit, and entropy of the weights normalized to [0, 1].
+  struct Health {
+    Health() : nbeams(0), inlier_fraction(0.), weight_entropy(0.) {}
+
+    int nbeams;
+    double inlier_fraction, weight_entropy;
   };
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
@@ -62,12 +73,26 @@ class LaserModel {
   LaserModel(const Params& params) : params_(params) {}
   virtual ~LaserModel() {}
 
-  // Compute the particle likelihood.
+  // Compute the particle likelihood. Particles are weighted in parallel, and
+  // the beam endpoints of each particle are transformed as a batch. With
+  // log_likelihood enabled the beam likelihoods are summed in log-domain.
+  // With max_beams set, at most that many beams are used (see selectBeams).
+  // The health of the measurement is computed from the same endpoints and
+  // weights, if requested.
+  void computeParticlesLikelihood(
+      const GridMap& grid_map,
+      const LatentModelLikelihoodField& likelihood_field,
+      const std::vector<float>& measurement, ParticleSet* particles,
+      Health* health = nullptr);
   void computeParticlesLikelihood(
       const GridMap& grid_map,
       const LatentModelLikelihoodField& likelihood_field,
       const std::vector<float>& measurement, std::vector<Particle>* particles);
 
+  // Compute the effective endpoints of a measurement in the robot frame.
+  void computeEndPoints(
+      const std::vector<float>& measurement, EndPoints2f* endpoints);
+
   // Paramters read/write utilities.
   inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
@@ -79,9 +104,34 @@ class LaserModel {
  private:
   // Compute the effective reading used in the localizer.
   void prepareLaserReadings(const std::vector<float>& measurement);
+  // Keep max_beams of the effective readings: they are split into as many
+  // angular strata, and from each one the endpoint with the steepest
+  // log-likelihood gradient at the mean particle pose is kept. Endpoints on
+  // long uniform walls have flat gradients along the wall and lose to
+  // corners and edges.
+  void selectBeams(
+      const GridMap& grid_map,
+      const LatentModelLikelihoodField& likelihood_field,
+      const ParticleSet& particles);
+  // Health of the weighted particles from their log-likelihoods, computed
+  // before the weights are normalized.
+  void computeHealth(
+      const GridMap& grid_map,
+      const LatentModelLikelihoodField& likelihood_field,
+      const ParticleSet& particles, const double* log_weights,
+      Health* health) const;
+
+  // Unit beam directions in the robot frame, cached per laser configuration.
+  bool beamsTableValid(size_t nbeams) const;
+  void computeBeamsTable(size_t nbeams);
+
+  EndPoints2f eff_measurement_;
+  // Log-likelihoods of the particles for the health, without log_likelihood.
+  std::vector<double> health_log_weights_;
 
-  std::vector<EndPoint2d, Eigen::aligned_allocator<EndPoint2d>>
-      eff_measurement_;
+  std::vector<double> beams_dir_x_, beams_dir_y_;
+  double beams_table_angle_min_, beams_table_angle_max_;
+  Pose2d beams_table_tf_r2l_;
 
   mutable std::mutex mtx_;
 };
@@ -0,0 +1,132 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_LATENCY_HISTOGRAM_H_
+#define SQUIRREL_2D_LOCALIZER_LATENCY_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+namespace squirrel_2d_localizer {
+
+// Lock-free histogram of latencies. Bins are logarithmic, four per octave,
+// from 1us to about a minute, so recording is a single relaxed increment.
+class LatencyHistogram {
+ public:
+  static constexpr int kNumBins = 104;
+
+  // Copy of the bin counts. The difference of two snapshots is the histogram
+  // of the latencies recorded in between.
+  class Snapshot {
+   public:
+    Snapshot() { bins.fill(0); }
+
+    uint64_t count() const {
+      uint64_t count = 0;
+      for (uint64_t bin : bins)
+        count += bin;
+      return count;
+    }
+
+    // Upper bound of the bin of the p-th quantile, in seconds.
+    double percentile(double p) const {
+      const uint64_t n = count();
+      if (n == 0)
+        return 0.;
+      const uint64_t rank = std::max<uint64_t>(1, std::ceil(p * n));
+      uint64_t cum_count  = 0;
+      for (int k = 0; k < kNumBins; ++k)
+        if ((cum_count += bins[k]) >= rank)
+          return upperBound(k);
+      return upperBound(kNumBins - 1);
+    }
+
+    Snapshot operator-(const Snapshot& other) const {
+      Snapshot diff;
+      for (int k = 0; k < kNumBins; ++k)
+        diff.bins[k] = bins[k] - other.bins[k];
+      return diff;
+    }
+
+    std::array<uint64_t, kNumBins> bins;
+  };
+
+ public:
+  LatencyHistogram() {
+    for (std::atomic<uint64_t>& bin : bins_)
+      bin.store(0, std::memory_order_relaxed);
+  }
+
+  void record(double seconds) {
+    bins_[bin(seconds)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Snapshot snapshot() const {
+    Snapshot snapshot;
+    for (int k = 0; k < kNumBins; ++k)
+      snapshot.bins[k] = bins_[k].load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+  static double upperBound(int k) { return 1e-6 * std::exp2(0.25 * (k + 1)); }
+
+ private:
+  static int bin(double seconds) {
+    if (seconds <= 1e-6)
+      return 0;
+    const int k = static_cast<int>(4. * std::log2(1e6 * seconds));
+    return std::min(k, kNumBins - 1);
+  }
+
+  std::array<std::atomic<uint64_t>, kNumBins> bins_;
+};
+
+// Record the lifetime of the scope in a histogram (monotonic clock).
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(LatencyHistogram* histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    histogram_->record(
+        std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+  }
+
+ private:
+  LatencyHistogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_LATENCY_HISTOGRAM_H_ */
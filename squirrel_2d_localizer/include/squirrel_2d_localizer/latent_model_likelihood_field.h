@@ -31,6 +31,12 @@
 
 #include "squirrel_2d_localizer/grid_map.h"
 #include "squirrel_2d_localizer/se2_types.h"
+#include "squirrel_2d_localizer/tile_cache.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
 
 namespace squirrel_2d_localizer {
 
@@ -42,21 +48,82 @@ class LatentModelLikelihoodField {
     
     double uniform_hit;
     double observation_sigma;
+    std::string cache_filename;
+    bool compact_storage;
+    int tile_size;
+    int max_resident_tiles;
+  };
+
+  // Likelihoods of a block of the map, at rows [row, row + rows) and columns
+  // [col, col + cols) of the map.
+  struct Update {
+    int row, col;
+    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+        likelihoods;
   };
 
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
   
  public:
-  LatentModelLikelihoodField() : params_(Params::defaultParams()) {}
-  LatentModelLikelihoodField(const Params& params) : params_(params) {};
+  LatentModelLikelihoodField()
+      : LatentModelLikelihoodField(Params::defaultParams()) {}
+  LatentModelLikelihoodField(const Params& params)
+      : params_(params),
+        likelihood_data_(nullptr),
+        log_likelihood_data_(nullptr),
+        quantized_data_(nullptr),
+        likelihood_cache_rows_(0),
+        likelihood_cache_cols_(0),
+        tile_shift_(0),
+        tile_mask_(0),
+        tiles_per_row_(0) {}
   virtual ~LatentModelLikelihoodField() {}
 
-  // Initialize the likelihood fields.
+  // Initialize the likelihood fields. If a cache file is given, the fields
+  // are memory-mapped from it when its key matches the map and the
+  // parameters. Otherwise they are computed and the cache file is rewritten.
   void initialize(const GridMap& occupancy_gridmap);
 
+  // Whether the fields have been loaded from the cache file.
+  bool fromCache() const { return mapped_cache_ != nullptr; }
+
+  // With a tile size and a cache file, the fields are served from the file in
+  // a tile-major layout and only the tiles in use are kept in memory.
+  bool tiled() const { return tile_cache_ != nullptr; }
+  const TileCache* tileCache() const { return tile_cache_.get(); }
+  // Fault in the tiles of the map rows [row0, row1] and columns [col0, col1],
+  // releasing the least recently used ones beyond the budget.
+  void prefetch(int row0, int row1, int col0, int col1);
+
+  // Reconvolve the region of the map affected by a patch, i.e. the patch
+  // dilated by the kernel radius, as if the patch was applied to the map.
+  // The fields are left untouched, so this can run alongside the lookups.
+  bool computeUpdate(
+      const GridMap& occupancy_gridmap, const GridMap::Patch& patch,
+      Update* update) const;
+  // Write a region computed by computeUpdate into the fields. Quantized
+  // fields keep their quantization tables.
+  void applyUpdate(const Update& update);
+
   // Compute the likelihood value.
   double likelihood(int i, int j) const;
 
+  // Branch-free likelihood lookup: indices are clamped onto the one cell wide
+  // border of the cache, which holds the uniform hit value.
+  inline double likelihoodClamped(int i, int j) const {
+    const size_t k = clampedIndex(i, j);
+    return quantized_data_ ? quantized_likelihood_[quantized_data_[k]]
+                           : likelihood_data_[k];
+  }
+
+  // Log-likelihood counterparts of the lookups above.
+  double logLikelihood(int i, int j) const;
+  inline double logLikelihoodClamped(int i, int j) const {
+    const size_t k = clampedIndex(i, j);
+    return quantized_data_ ? quantized_log_likelihood_[quantized_data_[k]]
+                           : log_likelihood_data_[k];
+  }
+
   // Paramters read/write utilites.
   inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
@@ -66,11 +133,52 @@ class LatentModelLikelihoodField {
   Params params_;
 
  private:
+  typedef Eigen::Matrix<
+      double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> CacheMatrix;
+  typedef Eigen::Matrix<
+      uint8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+      QuantizedCacheMatrix;
+
   bool inside(int i, int j) const;
 
+  // Index in the padded cache, either row major or tile major.
+  inline size_t clampedIndex(int i, int j) const {
+    i = std::min(std::max(i + 1, 0), likelihood_cache_rows_ + 1);
+    j = std::min(std::max(j + 1, 0), likelihood_cache_cols_ + 1);
+    if (tile_shift_ == 0)
+      return static_cast<size_t>(i) * (likelihood_cache_cols_ + 2) + j;
+    const size_t tile =
+        (i >> tile_shift_) * tiles_per_row_ + (j >> tile_shift_);
+    return (tile << (2 * tile_shift_)) + ((i & tile_mask_) << tile_shift_) +
+           (j & tile_mask_);
+  }
+
+  // Tile size (log2) from the parameters, 0 when not tiled.
+  int tileShift() const;
+
+  // Quantize the log-likelihoods uniformly on 8 bits.
+  void quantize(const CacheMatrix& likelihoods);
+  uint8_t quantizeValue(double likelihood) const;
+  void computeQuantizationTables(double log_min, double log_step);
+
+  // Cache file utilities.
+  uint64_t computeCacheKey(const GridMap& occupancy_gridmap) const;
+  bool loadCache(uint64_t key, size_t rows, size_t cols);
+  bool saveCache(uint64_t key) const;
+  // Copy the memory-mapped fields into the in-memory caches.
+  void detachCache();
+
  private:
-  Eigen::MatrixXd likelihood_cache_;
+  CacheMatrix likelihood_cache_, log_likelihood_cache_;
+  QuantizedCacheMatrix quantized_cache_;
+  double quantized_likelihood_[256], quantized_log_likelihood_[256];
+  double quantization_log_min_, quantization_log_step_;
+  std::shared_ptr<const void> mapped_cache_;
+  const double *likelihood_data_, *log_likelihood_data_;
+  const uint8_t* quantized_data_;
   int likelihood_cache_rows_, likelihood_cache_cols_;
+  int tile_shift_, tile_mask_, tiles_per_row_;
+  std::unique_ptr<TileCache> tile_cache_;
 };
 
 }  // namespace squirrel_2d_localizer
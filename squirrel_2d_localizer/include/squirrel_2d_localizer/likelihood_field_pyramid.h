@@ -0,0 +1,95 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_LIKELIHOOD_FIELD_PYRAMID_H_
+#define SQUIRREL_2D_LOCALIZER_LIKELIHOOD_FIELD_PYRAMID_H_
+
+#include "squirrel_2d_localizer/grid_map.h"
+#include "squirrel_2d_localizer/latent_model_likelihood_field.h"
+
+#include <vector>
+
+namespace squirrel_2d_localizer {
+
+// Max-pooled levels of the likelihood field. Level k stores, for each cell,
+// the maximum over the 2^k x 2^k block of cells starting at it, so that
+// summing a level over the beam endpoints upper bounds the score of all the
+// translations in the block. Scores are log-likelihoods rescaled to [0, 1],
+// with 0 being the uniform hit.
+class LikelihoodFieldPyramid {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    int num_levels;
+  };
+
+ public:
+  LikelihoodFieldPyramid() : params_(Params::defaultParams()) {}
+  LikelihoodFieldPyramid(const Params& params) : params_(params) {}
+  virtual ~LikelihoodFieldPyramid() {}
+
+  // Build the levels from an initialized likelihood field.
+  void initialize(
+      const GridMap& grid_map,
+      const LatentModelLikelihoodField& likelihood_field);
+
+  // Score upper bound of the block [i, i + 2^level) x [j, j + 2^level).
+  inline float score(int level, int i, int j) const {
+    const Level& l = levels_[level];
+    i += l.offset;
+    j += l.offset;
+    if (i < 0 || i >= l.rows || j < 0 || j >= l.cols)
+      return 0.f;
+    return l.data[static_cast<size_t>(i) * l.cols + j];
+  }
+
+  inline int numLevels() const { return levels_.size(); }
+
+  // Parameters read/write utilities.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ protected:
+  Params params_;
+
+ private:
+  // Level k covers the cells [-2^k + 1, height) x [-2^k + 1, width).
+  struct Level {
+    int offset, rows, cols;
+    std::vector<float> data;
+  };
+
+  std::vector<Level> levels_;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_LIKELIHOOD_FIELD_PYRAMID_H_ */
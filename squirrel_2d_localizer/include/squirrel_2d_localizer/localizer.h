@@ -29,17 +29,48 @@
 #ifndef SQUIRREL_2D_LOCALIZER_LOCALIZER_H_
 #define SQUIRREL_2D_LOCALIZER_LOCALIZER_H_
 
+#include "squirrel_2d_localizer/branch_and_bound_matcher.h"
 #include "squirrel_2d_localizer/grid_map.h"
 #include "squirrel_2d_localizer/laser_model.h"
+#include "squirrel_2d_localizer/latency_histogram.h"
 #include "squirrel_2d_localizer/latent_model_likelihood_field.h"
+#include "squirrel_2d_localizer/likelihood_field_pyramid.h"
 #include "squirrel_2d_localizer/motion_model.h"
+#include "squirrel_2d_localizer/random_numbers.h"
+#include "squirrel_2d_localizer/resampling.h"
+#include "squirrel_2d_localizer/seqlock.h"
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 
 namespace squirrel_2d_localizer {
 
 class Localizer {
  public:
+  // Pose estimate, published after every update, with the health of its
+  // measurement.
+  struct Estimate {
+    Estimate() : covariance(Eigen::Matrix3d::Zero()) {}
+
+    Pose2d pose;
+    Eigen::Matrix3d covariance;
+    LaserModel::Health health;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+  };
+
+  // Latencies of the stages of the filter update, and the number of updates
+  // performed, skipped because the robot did not move enough, or whose
+  // estimate was refined by scan matching.
+  struct Timings {
+    Timings() : num_updates(0), num_skipped_updates(0), num_refinements(0) {}
+
+    LatencyHistogram proposal, likelihood, resampling, statistics, refinement,
+        update;
+    std::atomic<uint64_t> num_updates, num_skipped_updates, num_refinements;
+  };
+
   class Params {
    public:
     static Params defaultParams();
@@ -47,13 +78,37 @@ class Localizer {
     int num_particles;
     double min_lin_update, min_ang_update;
     double init_stddev_x, init_stddev_y, init_stddev_a;
+    resampling::Scheme resampling_scheme;
+    bool adaptive_sampling;
+    resampling::KLDSamplingParams kld_sampling;
+    double free_space_max_occupancy;
+    int global_localization_oversampling;
+    bool branch_and_bound_relocalization;
+    LikelihoodFieldPyramid::Params pyramid;
+    BranchAndBoundMatcher::Params matcher;
+    bool scan_matching_refinement;
+    int refinement_pyramid_levels;
+    double refinement_lin_window, refinement_ang_window;
+    double refinement_min_score;
+    double refinement_stddev_xy, refinement_stddev_a;
+    double recovery_radius_xy, recovery_radius_a;
+    int recovery_num_particles;
   };
 
  public:
-  Localizer() : params_(Params::defaultParams()) {}
-  Localizer(const Params& params) : params_(params) {}
+  Localizer() : Localizer(Params::defaultParams()) {}
+  Localizer(const Params& params) : params_(params) {
+    seed(random_numbers::randomSeed());
+  }
   virtual ~Localizer() {}
 
+  // Reseed all the random streams of the filter (motion noise, resampling,
+  // initialization and global localization). Two localizers with the same
+  // seed fed with the same data give bit-identical estimates, regardless of
+  // the number of threads.
+  void seed(uint64_t seed);
+  inline uint64_t seed() const { return seed_; }
+
   // Initialize the localizer.
   void initialize(
       std::unique_ptr<GridMap>& map,
@@ -64,16 +119,48 @@ class Localizer {
   // Update the localizer.
   void resetPose(const Pose2d& init_pose = Pose2d(0., 0., 0.));
   void resetParticles(const std::vector<Particle>& particles);
+  // Distribute the particles over the free space, sampling from the free
+  // cells index. When a scan is given, global_localization_oversampling
+  // times as many candidates are weighted and the best ones are kept.
+  bool globalLocalization(const std::vector<float>& scan);
+  // Match the scan against the whole map with branch-and-bound, and seed the
+  // particles around the best pose. The likelihood pyramid is built on the
+  // first call.
+  bool relocalize(const std::vector<float>& scan);
+  // Relocalize within recovery_radius_xy and recovery_radius_a of a pose:
+  // recovery_num_particles candidates are sampled on the free cells of the
+  // region and weighted against the scan with the current particles, and
+  // the best ones are kept.
+  bool recoverAround(const Pose2d& pose, const std::vector<float>& scan);
   bool updateNumParticles(int num_new_particles);
+  // Apply a patch to the map. Only the affected region of the likelihood
+  // field is reconvolved, without holding the update guard, and then written
+  // in while holding it.
+  bool updateMap(const GridMap::Patch& patch);
+  // Swap the map and the likelihood field with the ones of another floor,
+  // which get the previous ones back, and reset the particles around the
+  // initial pose. Nothing is recomputed but the free cells index.
+  void switchMap(
+      std::unique_ptr<GridMap>* map,
+      std::unique_ptr<LatentModelLikelihoodField>* likelihood_field,
+      const Pose2d& init_pose);
+  // When scan_matching_refinement is set, the estimate of each update is
+  // fused with the best match of the scan within a window around it. The
+  // particles are left untouched.
   bool updateFilter(
       const Transform2d& motion, const std::vector<float>& scan,
       const Transform2d& extra_correction = Pose2d(0., 0., 0.),
       bool force_update = false);
 
-  // Get Particle filter's stuff.
-  const std::vector<Particle>& particles() const { return particles_; }
-  const Pose2d& pose() const { return pose_; }
-  const Eigen::Matrix3d& covariance() const { return covariance_; }
+  // Get Particle filter's stuff. These are snapshots of the last update, so
+  // they never wait for an update in progress.
+  std::shared_ptr<const std::vector<Particle>> particles() const;
+  Estimate estimate() const { return estimate_.load(); }
+  Pose2d pose() const { return estimate_.load().pose; }
+  Eigen::Matrix3d covariance() const { return estimate_.load().covariance; }
+
+  // Get the stage timings, safe to read while updating.
+  const Timings& timings() const { return timings_; }
 
   // Get the update guard.
   std::mutex& mutex() const { return mtx_; }
@@ -84,7 +171,7 @@ class Localizer {
   inline MotionModel* motionModel() { return motion_model_.get(); }
 
   // Parameters read/write utilities.
-  inline const Params& params() const { params_; }
+  inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
   inline Params& params() { return params_; }
 
@@ -99,13 +186,54 @@ class Localizer {
   std::unique_ptr<LaserModel> laser_model_;
   std::unique_ptr<MotionModel> motion_model_;
 
-  std::vector<Particle> particles_;
+  resampling::Resampler resampler_;
+
+  // Engines of the initialization, guarded by the update guard, and of the
+  // global localization, guarded by the map guard.
+  uint64_t seed_;
+  std::mt19937_64 init_rnd_eng_, global_rnd_eng_;
+
+  // Fault in the tiles of the likelihood field around the particles, within
+  // the laser range.
+  void prefetchLikelihoodField();
+
+  // Flat (row major) indices of the free cells of the map.
+  void indexFreeCells();
+  std::vector<int> free_cells_;
+
+  std::unique_ptr<LikelihoodFieldPyramid> pyramid_;
+
+  // Fuse the estimate with the match of the scan around it, as a measurement
+  // with the refinement standard deviations. The pyramid of the refinement
+  // is guarded by the update guard. It is rebuilt by the map changes outside
+  // of the update guard, and built by the first call only if the refinement
+  // was disabled meanwhile or its levels changed.
+  bool refineEstimate(const std::vector<float>& scan);
+  std::unique_ptr<LikelihoodFieldPyramid> refinement_pyramid_;
+
+  // Pyramid of the refinement of a map, null without refinement.
+  std::unique_ptr<LikelihoodFieldPyramid> buildRefinementPyramid(
+      const GridMap& map,
+      const LatentModelLikelihoodField& likelihood_field) const;
+
+  ParticleSet particles_;
   Pose2d pose_;
   Eigen::Matrix3d covariance_;
+  LaserModel::Health health_;
 
   double cum_lin_motion_, cum_ang_motion_;
 
-  mutable std::mutex mtx_;
+  Timings timings_;
+
+  // Lock-free copies of the estimate and the particles for the readers.
+  void publishSnapshot();
+
+  SeqLock<Estimate> estimate_;
+  std::shared_ptr<const std::vector<Particle>> particles_snapshot_;
+
+  // The map guard serializes the map updates and the global localization,
+  // and is always acquired before the update guard.
+  mutable std::mutex mtx_, snapshot_mtx_, map_mtx_;
 };
 
 }  // namespace squirrel_2d_localizer
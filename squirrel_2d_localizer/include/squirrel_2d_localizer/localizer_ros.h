@@ -31,8 +31,12 @@
 
 #include "squirrel_2d_localizer/MonteCarloLocalizationConfig.h"
 #include "squirrel_2d_localizer/extras/twist_correction_ros.h"
+#include "squirrel_2d_localizer/latency_histogram.h"
 #include "squirrel_2d_localizer/localizer.h"
+#include "squirrel_2d_localizer/map_registry.h"
+#include "squirrel_2d_localizer/ring_buffer.h"
 
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 
 #include <dynamic_reconfigure/server.h>
@@ -42,15 +46,27 @@
 #include <tf/transform_listener.h>
 
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <nav_msgs/OccupancyGrid.h>
 #include <nav_msgs/Odometry.h>
 #include <sensor_msgs/LaserScan.h>
+#include <squirrel_2d_localizer/LocalizationHealth.h>
+#include <squirrel_2d_localizer/SwitchMap.h>
 #include <squirrel_2d_localizer_msgs/GlobalLocalization.h>
+#include <std_msgs/String.h>
 
 #include <message_filters/cache.h>
 #include <message_filters/subscriber.h>
 
+#include <squirrel_threading/trace_publisher.h>
+
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 namespace squirrel_2d_localizer {
 
@@ -67,32 +83,66 @@ class LocalizerROS {
   void reconfigureCallback(
       MonteCarloLocalizationConfig& config, uint32_t level);
   void laserCallback(const sensor_msgs::LaserScan::ConstPtr& msg);
+  // Filter update for a single scan, and the pipelined update loop.
+  void processScan(const sensor_msgs::LaserScan::ConstPtr& msg);
+  void filterLoop();
   void initialPoseCallback(
       const geometry_msgs::PoseWithCovarianceStamped::ConstPtr& msg);
   bool globalLocalizationCallback(
       squirrel_2d_localizer_msgs::GlobalLocalization::Request& req,
       squirrel_2d_localizer_msgs::GlobalLocalization::Response& res);
+  // Floor transitions: the maps are loaded ahead with preload_map, and the
+  // active one is announced on active_map after every switch.
+  bool switchMapCallback(
+      squirrel_2d_localizer::SwitchMap::Request& req,
+      squirrel_2d_localizer::SwitchMap::Response& res);
+  void preloadMapCallback(const std_msgs::String::ConstPtr& msg);
+  void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& msg);
+  void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& msg);
+  void updateMap(const GridMap::Patch& patch);
 
   // Query odometry.
   bool lookupOdometry(
       const ros::Time& stamp, const ros::Duration& timeout,
       tf::StampedTransform* tf_o2r);
 
+  // Refresh the map to odometry transform after an update.
+  void updateMapToOdom();
+
+  // Check the health of the last update and publish it. After
+  // recovery_degraded_updates degraded updates in a row, the particles are
+  // relocalized around the last good pose.
+  void monitorHealth(const ros::Time& stamp, const std::vector<float>& scan);
+  void resetHealth();
+
   // Publish topics.
   void publishTransform(const ros::Time& stamp);
-  void publishParticles(const ros::Time& stamp);
+  // The particles are skipped without subscribers and beyond the max rate,
+  // unless forced.
+  void publishParticles(const ros::Time& stamp, bool force = false);
   void publishPoseWithCovariance(const ros::Time& stamp);
+  // Publish the stage latencies since the last call on /diagnostics.
+  void publishDiagnostics(const ros::Time& stamp);
+
+  // Fill particles_indexes_ with the particles to publish, at most
+  // particles_max_size_ of them.
+  void decimateParticles(const std::vector<Particle>& particles);
 
  private:
   std::unique_ptr<Localizer> localizer_;
 
   tf::StampedTransform tf_m2r_, tf_o2r_;
+  SeqLock<tf::Transform> tf_m2o_;
   tf::TransformListener tfl_;
   tf::TransformBroadcaster tfb_, extra_tfb_;
 
   ros::ServiceServer gloc_srv_;
-  ros::Publisher pose_pub_, particles_pub_;
+  ros::Publisher pose_pub_, particles_pub_, num_particles_pub_;
+  ros::Publisher compact_particles_pub_;
+  ros::Publisher processed_scans_pub_, dropped_scans_pub_, diagnostics_pub_;
+  ros::Publisher health_pub_;
   ros::Subscriber scan_sub_, initpose_sub_;
+  sensor_msgs::LaserScan::ConstPtr last_scan_;
 
   bool use_last_pose_;
   double init_x_, init_y_, init_a_;
@@ -112,6 +162,57 @@ class LocalizerROS {
   bool update_laser_params_;
 
   mutable std::mutex update_mtx_;
+
+  // Published particle set, decimated by weight.
+  enum class Decimation { TOP_K = 0, STRATIFIED = 1 };
+  Decimation particles_decimation_;
+  int particles_max_size_;
+  double particles_max_rate_;
+  bool compact_particles_;
+  ros::Time last_particles_stamp_;
+  std::vector<size_t> particles_indexes_;
+  std::mt19937_64 particles_rnd_eng_;
+  std::mutex particles_mtx_;
+
+  // Replay mode: fixed seed and initial pose, every scan is processed in
+  // order.
+  bool replay_;
+
+  bool pipelined_;
+  std::unique_ptr<RingBuffer<sensor_msgs::LaserScan::ConstPtr>> scan_buffer_;
+  std::thread filter_thread_;
+  std::atomic<uint64_t> processed_scans_, dropped_scans_;
+
+  LatencyHistogram tf_lookup_latency_, scan_latency_;
+  double diagnostics_period_;
+  ros::Time last_diagnostics_stamp_;
+  std::vector<LatencyHistogram::Snapshot> last_latencies_;
+  uint64_t last_num_updates_, last_num_skipped_updates_,
+      last_num_refinements_, last_dropped_scans_, last_num_recoveries_;
+
+  // Health monitor, guarded by the update mutex. The last good pose is kept
+  // as a vector, so that it needs no alignment.
+  double health_min_inlier_fraction_, health_min_weight_entropy_;
+  int recovery_degraded_updates_, degraded_updates_;
+  bool has_good_pose_;
+  Eigen::Vector3d last_good_pose_;
+  std::atomic<bool> degraded_;
+  std::atomic<uint64_t> num_recoveries_;
+  std::unique_ptr<squirrel_threading::tracing::TracePublisher> trace_publisher_;
+
+  // Maps of the other floors, with their likelihood fields.
+  std::unique_ptr<MapRegistry> map_registry_;
+  std::string active_map_;
+  ros::ServiceServer switch_map_srv_;
+  ros::Subscriber preload_map_sub_;
+  ros::Publisher active_map_pub_;
+
+  // Map updates are served by their own spinner, so that reconvolving the
+  // likelihood field never delays the scans.
+  bool map_updates_;
+  ros::CallbackQueue map_queue_;
+  std::unique_ptr<ros::AsyncSpinner> map_spinner_;
+  ros::Subscriber map_sub_, map_update_sub_;
 };
 
 }  // namespace squirrel_2d_localizer
@@ -0,0 +1,56 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_MAP_IO_H_
+#define SQUIRREL_2D_LOCALIZER_MAP_IO_H_
+
+#include "squirrel_2d_localizer/grid_map.h"
+
+#include <string>
+#include <vector>
+
+namespace squirrel_2d_localizer {
+namespace map_io {
+
+// Load a map in the map_server format (a yaml description and a PGM image)
+// without ROS. The data is converted as map_server does in trinary mode:
+// rows start from the bottom of the image, cells are 100 (occupied),
+// 0 (free) or -1 (unknown).
+bool loadMap(
+    const std::string& yaml_filename, GridMap::Params* params,
+    std::vector<signed char>* data);
+
+// Load a binary (P5) PGM image, in top-down row order.
+bool loadPGM(
+    const std::string& filename, size_t* width, size_t* height,
+    std::vector<unsigned char>* pixels);
+
+}  // namespace map_io
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_MAP_IO_H_ */
@@ -0,0 +1,121 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_MAP_REGISTRY_H_
+#define SQUIRREL_2D_LOCALIZER_MAP_REGISTRY_H_
+
+#include "squirrel_2d_localizer/grid_map.h"
+#include "squirrel_2d_localizer/latent_model_likelihood_field.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace squirrel_2d_localizer {
+
+// Maps of the floors the robot can localize on, each with its likelihood
+// field. The maps are loaded from their map_server files the first time they
+// are used, and their fields from their cache files, so they are only
+// convolved once. Up to max_resident_maps of them are kept in memory, the
+// least recently used ones are released first. The active map is owned by
+// the localizer: it is acquired from the registry and released back to it
+// when switching to another floor.
+class MapRegistry {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    int max_resident_maps;
+  };
+
+  // Map and likelihood field of a floor.
+  struct Floor {
+    std::unique_ptr<GridMap> map;
+    std::unique_ptr<LatentModelLikelihoodField> likelihood_field;
+  };
+
+ public:
+  MapRegistry(
+      const Params& params,
+      const LatentModelLikelihoodField::Params& likelihood_field_params)
+      : params_(params), likelihood_field_params_(likelihood_field_params) {}
+  virtual ~MapRegistry() {}
+
+  // Register a floor, by its map in the map_server format and the cache file
+  // of its likelihood field. Without a cache file the field is convolved
+  // every time the map is loaded.
+  void addMap(
+      const std::string& name, const std::string& map_filename,
+      const std::string& cache_filename);
+  bool contains(const std::string& name) const;
+
+  // Take the floor out of the registry, loading it when not resident. Fails
+  // when the floor is unknown, in use or its map cannot be loaded.
+  bool acquire(const std::string& name, Floor* floor);
+  // Give a floor back as the most recently used one, then enforce the
+  // budget. Floors that were not registered are kept while resident.
+  void release(const std::string& name, Floor* floor);
+  // Load a floor ahead of its use, e.g. while the elevator is moving.
+  bool preload(const std::string& name);
+
+  int numResidentMaps() const;
+
+  // Paramters read/write utilites.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ protected:
+  Params params_;
+
+ private:
+  struct Entry {
+    Entry() : in_use(false) {}
+
+    std::string map_filename, cache_filename;
+    Floor floor;
+    bool in_use;
+  };
+
+  bool load(Entry* entry) const;
+  void touch(const std::string& name);
+  void enforceBudget();
+
+  LatentModelLikelihoodField::Params likelihood_field_params_;
+  std::map<std::string, Entry> entries_;
+  // Resident floors, the most recently used at the front.
+  std::list<std::string> lru_;
+  mutable std::mutex mtx_;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_MAP_REGISTRY_H_ */
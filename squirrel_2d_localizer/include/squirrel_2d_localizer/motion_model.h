@@ -31,11 +31,13 @@
 
 #include "squirrel_2d_localizer/math_types.h"
 #include "squirrel_2d_localizer/particle_types.h"
+#include "squirrel_2d_localizer/random_numbers.h"
 #include "squirrel_2d_localizer/se2_types.h"
 
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
-#include <mutex>
-#include <random>
 
 namespace squirrel_2d_localizer {
 
@@ -50,14 +52,24 @@ class MotionModel {
   };
 
  public:
-  MotionModel() : params_(Params::defaultParams()), rnd_eng_(std::rand()) {}
-  MotionModel(const Params& params) : params_(params), rnd_eng_(std::rand()) {}
+  MotionModel() : MotionModel(Params::defaultParams()) {}
+  MotionModel(const Params& params)
+      : params_(params),
+        generator_(random_numbers::randomSeed()),
+        counter_(0) {}
   virtual ~MotionModel() {}
 
-  // Sample from the proposal distribution.
+  // Sample from the proposal distribution. The noise of all the particles is
+  // drawn at once from a disjoint range of counters of the generator, so that
+  // concurrent calls need no lock.
+  void sampleProposal(
+      const Transform2d& motion, ParticleSet* particles) const;
   void sampleProposal(
       const Transform2d& motion, std::vector<Particle>* particles) const;
 
+  // Reseed the noise generator, for reproducible proposals.
+  void seed(uint64_t seed);
+
   inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
   inline Params& params() { return params_; }
@@ -66,8 +78,8 @@ class MotionModel {
   Params params_;
 
  private:
-  mutable std::mt19937 rnd_eng_;
-  mutable std::mutex mtx_;
+  random_numbers::Philox4x32 generator_;
+  mutable std::atomic<uint64_t> counter_;
 };
 
 }  // namespace squirrel_2d_localizer
@@ -34,6 +34,7 @@
 
 #include <angles/angles.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <vector>
@@ -49,6 +50,84 @@ struct Particle {
   double weight;
 };
 
+// Structure-of-arrays particle set. Poses are stored as contiguous x, y and
+// heading arrays, along with the cosine and sine of the headings, so that
+// the filter stages can be vectorized over the particles. Whoever writes the
+// headings keeps the cosines and sines up to date.
+struct ParticleSet {
+  ParticleSet() {}
+  explicit ParticleSet(const std::vector<Particle>& particles) {
+    fromParticles(particles);
+  }
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+
+  void clear() { resize(0); }
+  void reserve(size_t n) {
+    x.reserve(n);
+    y.reserve(n);
+    a.reserve(n);
+    cos_a.reserve(n);
+    sin_a.reserve(n);
+    weight.reserve(n);
+  }
+  void resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    a.resize(n);
+    cos_a.resize(n);
+    sin_a.resize(n);
+    weight.resize(n);
+  }
+  void swap(ParticleSet& other) {
+    x.swap(other.x);
+    y.swap(other.y);
+    a.swap(other.a);
+    cos_a.swap(other.cos_a);
+    sin_a.swap(other.sin_a);
+    weight.swap(other.weight);
+  }
+
+  void push_back(const Pose2d& pose, double w) {
+    x.push_back(pose[0]);
+    y.push_back(pose[1]);
+    a.push_back(pose[2]);
+    cos_a.push_back(std::cos(pose[2]));
+    sin_a.push_back(std::sin(pose[2]));
+    weight.push_back(w);
+  }
+
+  Pose2d pose(size_t i) const { return Pose2d(x[i], y[i], a[i]); }
+  void setPose(size_t i, const Pose2d& pose) {
+    x[i]     = pose[0];
+    y[i]     = pose[1];
+    a[i]     = pose[2];
+    cos_a[i] = std::cos(pose[2]);
+    sin_a[i] = std::sin(pose[2]);
+  }
+
+  // Conversions from/to the array-of-structures representation.
+  void fromParticles(const std::vector<Particle>& particles) {
+    resize(particles.size());
+    for (size_t i = 0; i < particles.size(); ++i) {
+      setPose(i, particles[i].pose);
+      weight[i] = particles[i].weight;
+    }
+  }
+  void toParticles(std::vector<Particle>* particles) const {
+    particles->resize(size());
+    for (size_t i = 0; i < size(); ++i) {
+      (*particles)[i].pose   = pose(i);
+      (*particles)[i].weight = weight[i];
+    }
+  }
+
+  std::vector<double> x, y, a;
+  std::vector<double> cos_a, sin_a;
+  std::vector<double> weight;
+};
+
 namespace particles {
 
 inline double computeTotalWeight(const std::vector<Particle>& particles) {
@@ -58,6 +137,13 @@ inline double computeTotalWeight(const std::vector<Particle>& particles) {
   return tot_weight;
 }
 
+inline double computeTotalWeight(const ParticleSet& particles) {
+  double tot_weight = 0.;
+  for (size_t i = 0; i < particles.size(); ++i)
+    tot_weight += particles.weight[i];
+  return tot_weight;
+}
+
 inline void setPoses(
     const std::vector<Pose2d> poses, std::vector<Particle>* particles) {
   assert(poses.size() == particles->size());
@@ -77,6 +163,37 @@ inline void setWeight(double weight, std::vector<Particle>* particles) {
     particle.weight = weight;
 }
 
+// Normalize the weights to sum up to one.
+inline void normalizeWeights(std::vector<Particle>* particles) {
+  const double tot_weight = computeTotalWeight(*particles);
+  if (tot_weight <= 0.)
+    return setWeight(1. / particles->size(), particles);
+  for (auto& particle : *particles)
+    particle.weight /= tot_weight;
+}
+
+// Turn log-weights into weights. The maximum is subtracted first to avoid
+// underflows.
+inline void normalizeLogWeights(std::vector<Particle>* particles) {
+  if (particles->empty())
+    return;
+  double max_log_weight = (*particles)[0].weight;
+  for (const auto& particle : *particles)
+    max_log_weight = std::max(max_log_weight, particle.weight);
+  for (auto& particle : *particles)
+    particle.weight = std::exp(particle.weight - max_log_weight);
+}
+
+inline void normalizeLogWeights(ParticleSet* particles) {
+  if (particles->empty())
+    return;
+  std::vector<double>& weights = particles->weight;
+  const double max_log_weight =
+      *std::max_element(weights.begin(), weights.end());
+  for (size_t i = 0; i < weights.size(); ++i)
+    weights[i] = std::exp(weights[i] - max_log_weight);
+}
+
 inline void computeMeanAndCovariance(
     const std::vector<Particle>& particles, Pose2d* mean,
     Eigen::Matrix3d* covariance) {
@@ -115,6 +232,48 @@ inline void computeMeanAndCovariance(
   (*covariance)(2, 2) = cov22;
 }
 
+// Same as above, using the cached cosines and sines of the headings. The
+// first pass only accumulates, the second one needs the mean heading.
+inline void computeMeanAndCovariance(
+    const ParticleSet& particles, Pose2d* mean, Eigen::Matrix3d* covariance) {
+  const size_t nparticles = particles.size();
+  const double* x         = particles.x.data();
+  const double* y         = particles.y.data();
+  const double* a         = particles.a.data();
+  const double* w         = particles.weight.data();
+  double mean_x = 0., mean_y = 0., mean_c = 0., mean_s = 0., sq_tot_w = 0.;
+  for (size_t i = 0; i < nparticles; ++i) {
+    mean_x += w[i] * x[i];
+    mean_y += w[i] * y[i];
+    mean_c += w[i] * particles.cos_a[i];
+    mean_s += w[i] * particles.sin_a[i];
+    sq_tot_w += w[i] * w[i];
+  }
+  const double mean_a = std::atan2(mean_s, mean_c);
+  const double unbias = 1 - sq_tot_w;
+  double cov00 = 0., cov01 = 0., cov02 = 0., cov11 = 0., cov12 = 0., cov22 = 0.;
+  for (size_t i = 0; i < nparticles; ++i) {
+    const double dx = x[i] - mean_x;
+    const double dy = y[i] - mean_y;
+    const double da = angles::normalize_angle(a[i] - mean_a);
+    cov00 += w[i] * dx * dx;
+    cov01 += w[i] * dx * dy;
+    cov02 += w[i] * dx * da;
+    cov11 += w[i] * dy * dy;
+    cov12 += w[i] * dy * da;
+    cov22 += w[i] * da * da;
+  }
+  // Update mean.
+  *mean = Pose2d(mean_x, mean_y, mean_a);
+  // Update covariance.
+  (*covariance)(0, 0) = cov00 / unbias;
+  (*covariance)(0, 1) = (*covariance)(1, 0) = cov01 / unbias;
+  (*covariance)(0, 2) = (*covariance)(2, 0) = cov02 / unbias;
+  (*covariance)(1, 1) = cov11 / unbias;
+  (*covariance)(1, 2) = (*covariance)(2, 1) = cov12 / unbias;
+  (*covariance)(2, 2) = cov22 / unbias;
+}
+
 }  // namespace particles
 }  // namespace squirrel_2d_localizer
 
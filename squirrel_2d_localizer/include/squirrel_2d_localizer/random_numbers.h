@@ -0,0 +1,135 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_RANDOM_NUMBERS_H_
+#define SQUIRREL_2D_LOCALIZER_RANDOM_NUMBERS_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+namespace squirrel_2d_localizer {
+namespace random_numbers {
+
+// Philox4x32-10 counter-based generator (Salmon et al., 2011). Each (key,
+// counter) pair maps to four independent 32 bit words, so that any number
+// of threads can draw from disjoint counters without sharing any state, and
+// the sequence only depends on the seed.
+class Philox4x32 {
+ public:
+  explicit Philox4x32(uint64_t seed)
+      : key0_(static_cast<uint32_t>(seed)),
+        key1_(static_cast<uint32_t>(seed >> 32)) {}
+
+  // Generate the block of the given counter.
+  inline void operator()(
+      uint64_t counter, uint32_t stream, uint32_t* out) const {
+    uint32_t c0 = static_cast<uint32_t>(counter);
+    uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+    uint32_t c2 = stream, c3 = 0;
+    uint32_t k0 = key0_, k1 = key1_;
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+      const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+      c0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+      c1 = static_cast<uint32_t>(p1);
+      c2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+      c3 = static_cast<uint32_t>(p0);
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+  }
+
+ private:
+  uint32_t key0_, key1_;
+};
+
+// Uniform double in [0, 1) with 53 bits of precision.
+inline double toUniform(uint32_t hi, uint32_t lo) {
+  return ((hi >> 5) * 67108864. + (lo >> 6)) * (1. / 9007199254740992.);
+}
+
+// Fill an array with standard normal samples, using one Philox block per
+// Box-Muller pair. Sample k only depends on the seed, the stream and
+// counter + k / 2, so the array is filled in parallel.
+inline void fillStandardNormal(
+    const Philox4x32& generator, uint64_t counter, uint32_t stream, size_t n,
+    double* out) {
+  const long npairs = (n + 1) / 2;
+#pragma omp parallel for default(shared) schedule(static)
+  for (long k = 0; k < npairs; ++k) {
+    uint32_t block[4];
+    generator(counter + k, stream, block);
+    const double u1 = 1. - toUniform(block[0], block[1]);  // (0, 1]
+    const double u2 = toUniform(block[2], block[3]);
+    const double r  = std::sqrt(-2. * std::log(u1));
+    out[2 * k]      = r * std::cos(2. * M_PI * u2);
+    if (2 * k + 1 < static_cast<long>(n))
+      out[2 * k + 1] = r * std::sin(2. * M_PI * u2);
+  }
+}
+
+// Streams of the components of the localizer. Every component draws from its
+// own generator, derived from the seed of the localizer, so that its samples
+// do not depend on how often the others are called.
+enum class Stream : uint32_t {
+  MOTION              = 1,
+  RESAMPLING          = 2,
+  INITIALIZATION      = 3,
+  GLOBAL_LOCALIZATION = 4,
+  DECIMATION          = 5
+};
+
+// Seed of the generator of a stream.
+inline uint64_t streamSeed(uint64_t seed, Stream stream) {
+  const Philox4x32 generator(seed);
+  uint32_t block[4];
+  generator(0, static_cast<uint32_t>(stream), block);
+  return (static_cast<uint64_t>(block[0]) << 32) | block[1];
+}
+
+// Engine of a stream, for the sequential samplers.
+inline std::mt19937_64 streamEngine(uint64_t seed, Stream stream) {
+  return std::mt19937_64(streamSeed(seed, stream));
+}
+
+// Seed from the entropy of the system, for the runs which are not replayed.
+inline uint64_t randomSeed() {
+  std::random_device device;
+  return (static_cast<uint64_t>(device()) << 32) | device();
+}
+
+}  // namespace random_numbers
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_RANDOM_NUMBERS_H_ */
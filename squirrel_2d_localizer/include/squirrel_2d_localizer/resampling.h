@@ -30,24 +30,96 @@
 #define SQUIRREL_2D_LOCALIZER_RESAMPLING_H_
 
 #include "squirrel_2d_localizer/particle_types.h"
+#include "squirrel_2d_localizer/random_numbers.h"
 
-#include <mutex>
+#include <cstdint>
+#include <random>
+#include <unordered_set>
+#include <vector>
 
 namespace squirrel_2d_localizer {
 namespace resampling {
 
+// Selectable low-variance resampling schemes.
+enum class Scheme { SYSTEMATIC = 0, STRATIFIED = 1, RESIDUAL = 2 };
+
+// Parameters of the adaptive (KLD) sampling.
+struct KLDSamplingParams {
+  static KLDSamplingParams defaultParams();
+
+  int min_particles, max_particles;
+  double error_bound, upper_quantile;
+  double bin_size_xy, bin_size_a;
+};
+
+// Resampler with persistent storage. The resampled set is written into a
+// back buffer which is then swapped with the particles, so that no memory is
+// allocated once the buffers reached their steady state size.
+class Resampler {
+ public:
+  Resampler() : rnd_eng_(random_numbers::randomSeed()) {}
+  virtual ~Resampler() {}
+
+  // Reseed the sampling engine, for reproducible resampling.
+  inline void seed(uint64_t seed) { rnd_eng_.seed(seed); }
+
+  // Importance sampling with the given scheme.
+  void importanceSampling(Scheme scheme, ParticleSet* particles);
+  void importanceSampling(Scheme scheme, std::vector<Particle>* particles);
+
+  // Adaptive importance sampling via KLD-sampling (Fox, 2003). Particles are
+  // drawn until their number bounds the KL-divergence between the sample
+  // based and the true posterior, discretized over an (x, y, a) histogram.
+  void kldSampling(const KLDSamplingParams& params, ParticleSet* particles);
+  void kldSampling(
+      const KLDSamplingParams& params, std::vector<Particle>* particles);
+
+ private:
+  // Fill indexes_ with the resampled particle indexes.
+  void computeIndexes(Scheme scheme, const std::vector<double>& weights);
+  void systematicIndexes(const std::vector<double>& weights);
+  void stratifiedIndexes(const std::vector<double>& weights);
+  void residualIndexes(const std::vector<double>& weights);
+  void kldIndexes(
+      const KLDSamplingParams& params, const ParticleSet& particles);
+
+  // Gather indexes_ into the back buffer and swap it with the particles.
+  void swapBuffers(ParticleSet* particles);
+
+ private:
+  ParticleSet buffer_;
+  std::vector<size_t> indexes_;
+  std::vector<double> cum_weights_, residuals_;
+  std::unordered_set<int64_t> bins_;
+
+  std::mt19937_64 rnd_eng_;
+};
+
 // Importance sampling via roulette sampling (courtesy of Rainer Kuemmerle).
 void importanceSampling(std::vector<Particle>* particles);
 
+// Adaptive importance sampling via KLD-sampling.
+void importanceSampling(
+    const KLDSamplingParams& params, std::vector<Particle>* particles);
+
 // Uniform upsampling of particles.
-void uniformUpsample(int nparticles_add, std::vector<Particle>* particles);
+void uniformUpsample(
+    int nparticles_add, std::mt19937_64* rnd_eng,
+    std::vector<Particle>* particles);
 
 // Uniform dawnsampling of particles.
-void uniformDownsample(int nparticles_remove, std::vector<Particle>* particles);
+void uniformDownsample(
+    int nparticles_remove, std::mt19937_64* rnd_eng,
+    std::vector<Particle>* particles);
 
 namespace __internal {
 
-static std::mutex resampling_mtx_;
+// Number of particles required by KLD-sampling for k non-empty bins.
+size_t kldSamplingBound(size_t k, double error_bound, double upper_quantile);
+
+// Histogram bin of a pose used by KLD-sampling.
+int64_t kldSamplingBin(
+    const Pose2d& pose, double bin_size_xy, double bin_size_a);
 
 }  // namespace __internal
 }  // namespace resampling
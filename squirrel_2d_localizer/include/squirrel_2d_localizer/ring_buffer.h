@@ -0,0 +1,97 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_RING_BUFFER_H_
+#define SQUIRREL_2D_LOCALIZER_RING_BUFFER_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+namespace squirrel_2d_localizer {
+
+// Bounded multi-producer/multi-consumer ring buffer. When full, the oldest
+// element is overwritten, so that consumers always get the freshest data.
+template <typename T>
+class RingBuffer {
+ public:
+  explicit RingBuffer(size_t capacity = 1)
+      : buffer_(std::max<size_t>(capacity, 1)),
+        head_(0),
+        size_(0),
+        closed_(false) {}
+
+  // Enqueue an element. Returns false if the oldest element was dropped.
+  bool push(const T& value) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    const bool full = size_ == buffer_.size();
+    buffer_[(head_ + size_) % buffer_.size()] = value;
+    if (full)
+      head_ = (head_ + 1) % buffer_.size();
+    else
+      ++size_;
+    lock.unlock();
+    cv_.notify_one();
+    return !full;
+  }
+
+  // Dequeue an element, waiting until one is available. Returns false once the
+  // buffer has been closed.
+  bool pop(T* value) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this] { return closed_ || size_ > 0; });
+    if (closed_)
+      return false;
+    *value         = buffer_[head_];
+    buffer_[head_] = T();
+    head_          = (head_ + 1) % buffer_.size();
+    --size_;
+    return true;
+  }
+
+  // Wake up and release all the consumers.
+  void close() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    closed_ = true;
+    lock.unlock();
+    cv_.notify_all();
+  }
+
+ private:
+  std::vector<T> buffer_;
+  size_t head_, size_;
+  bool closed_;
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_RING_BUFFER_H_ */
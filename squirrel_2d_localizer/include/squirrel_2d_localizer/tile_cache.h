@@ -0,0 +1,79 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_2D_LOCALIZER_TILE_CACHE_H_
+#define SQUIRREL_2D_LOCALIZER_TILE_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <vector>
+
+namespace squirrel_2d_localizer {
+
+// Residency of the tiles of memory-mapped, tile-major arrays. The pages of
+// the tiles in use are faulted in ahead with madvise(MADV_WILLNEED), and the
+// least recently used tiles beyond the budget are released with
+// madvise(MADV_DONTNEED). Tiles that have been written are pinned, since
+// releasing the pages of a private mapping would discard the changes.
+class TileCache {
+ public:
+  TileCache(int tile_rows, int tile_cols, int max_resident_tiles);
+  virtual ~TileCache() {}
+
+  // Register an array of tile_rows x tile_cols tiles of tile_bytes each.
+  void addArray(const void* data, size_t tile_bytes);
+
+  // Fault in the tiles [tile_row0, tile_row1] x [tile_col0, tile_col1] and
+  // mark them as the most recently used, then enforce the budget.
+  void touch(int tile_row0, int tile_row1, int tile_col0, int tile_col1);
+  // Keep a tile resident for good.
+  void pin(int tile_row, int tile_col);
+
+  inline int numResidentTiles() const { return lru_.size() + num_pinned_; }
+  inline int tileRows() const { return tile_rows_; }
+  inline int tileCols() const { return tile_cols_; }
+
+ private:
+  enum class State : char { RELEASED, RESIDENT, PINNED };
+
+  void advise(int tile, bool will_need) const;
+
+  int tile_rows_, tile_cols_, max_resident_tiles_;
+  std::vector<const char*> arrays_;
+  std::vector<size_t> tile_bytes_;
+
+  // Resident tiles, the most recently used at the front.
+  std::list<int> lru_;
+  std::vector<std::list<int>::iterator> lru_position_;
+  std::vector<State> state_;
+  int num_pinned_;
+};
+
+}  // namespace squirrel_2d_localizer
+
+#endif /* SQUIRREL_2D_LOCALIZER_TILE_CACHE_H_ */
@@ -0,0 +1,245 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Benchmark of the core components of the localizer, without ROS. Maps are
+// given as map_server yaml files, scans are synthesized by ray-casting from
+// random free poses, and the latency of each stage of the filter update is
+// reported across particle and beam counts.
+//
+// Usage:
+//   squirrel_2d_localizer_bench [--particles 250,1000,4000]
+//       [--beams 181,541,1081] [--iterations 50] map.yaml [map.yaml ...]
+
+#include "squirrel_2d_localizer/grid_map.h"
+#include "squirrel_2d_localizer/laser_model.h"
+#include "squirrel_2d_localizer/latent_model_likelihood_field.h"
+#include "squirrel_2d_localizer/map_io.h"
+#include "squirrel_2d_localizer/motion_model.h"
+#include "squirrel_2d_localizer/particle_types.h"
+#include "squirrel_2d_localizer/resampling.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace squirrel_2d_localizer;
+
+namespace {
+
+struct Options {
+  std::vector<std::string> maps;
+  std::vector<int> particles = {250, 1000, 4000};
+  std::vector<int> beams     = {181, 541, 1081};
+  int iterations             = 50;
+  double range_max           = 8.;
+};
+
+std::vector<int> parseList(const char* arg) {
+  std::vector<int> values;
+  std::istringstream iss(arg);
+  for (std::string value; std::getline(iss, value, ',');)
+    values.push_back(std::atoi(value.c_str()));
+  return values;
+}
+
+bool parseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+      options->particles = parseList(argv[++i]);
+    else if (std::strcmp(argv[i], "--beams") == 0 && i + 1 < argc)
+      options->beams = parseList(argv[++i]);
+    else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+      options->iterations = std::max(1, std::atoi(argv[++i]));
+    else if (argv[i][0] == '-')
+      return false;
+    else
+      options->maps.push_back(argv[i]);
+  }
+  return !options->maps.empty();
+}
+
+double elapsedMicroseconds(
+    const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+bool occupied(const GridMap& map, int i, int j) {
+  return map.inside(i, j) && !map.unknown(i, j) && map.at(i, j) > 0.5;
+}
+
+// Uniform pose in the free space of the map.
+Pose2d randomFreePose(const GridMap& map, std::mt19937* rnd_eng) {
+  double min_x, max_x, min_y, max_y;
+  map.boundingBox(&min_x, &max_x, &min_y, &max_y);
+  std::uniform_real_distribution<double> rand_x(min_x, max_x),
+      rand_y(min_y, max_y), rand_a(-M_PI, M_PI);
+  for (int i, j;;) {
+    const Pose2d pose(rand_x(*rnd_eng), rand_y(*rnd_eng), rand_a(*rnd_eng));
+    map.pointToIndices(pose.translation(), &i, &j);
+    if (map.inside(i, j) && !map.unknown(i, j) && map.at(i, j) < 0.25)
+      return pose;
+  }
+}
+
+// Ray-cast a scan, marching at half the map resolution.
+std::vector<float> rayCast(
+    const GridMap& map, const LaserModel::Params& laser, const Pose2d& pose,
+    int nbeams) {
+  const Pose2d laser_pose = pose * laser.tf_r2l;
+  const double step       = 0.5 * map.params().resolution;
+  const double increment  = (laser.angle_max - laser.angle_min) / (nbeams - 1);
+  std::vector<float> scan(nbeams, laser.range_max + 1.);
+  for (int b = 0; b < nbeams; ++b) {
+    const double angle = laser_pose[2] + laser.angle_min + b * increment;
+    const double c = std::cos(angle), s = std::sin(angle);
+    for (double range = laser.range_min; range < laser.range_max;
+         range += step) {
+      int i, j;
+      map.pointToIndices(
+          EndPoint2d(
+              laser_pose[0] + range * c, laser_pose[1] + range * s),
+          &i, &j);
+      if (occupied(map, i, j)) {
+        scan[b] = range;
+        break;
+      }
+    }
+  }
+  return scan;
+}
+
+void runBenchmark(
+    const Options& options, const std::string& map_name, const GridMap& map,
+    const LatentModelLikelihoodField& likelihood_field) {
+  std::mt19937 rnd_eng(42);
+  std::normal_distribution<double> randn(0., 1.);
+  for (int nbeams : options.beams) {
+    LaserModel laser_model;
+    LaserModel::Params& laser_params    = laser_model.params();
+    laser_params.endpoints_min_distance = 0.;
+    laser_params.range_max              = options.range_max;
+    laser_params.angle_min              = -0.75 * M_PI;
+    laser_params.angle_max              = 0.75 * M_PI;
+    laser_params.tf_r2l                 = Pose2d(0.1, 0., 0.);
+    for (int nparticles : options.particles) {
+      MotionModel motion_model;
+      motion_model.seed(42);
+      resampling::Resampler resampler;
+      resampler.seed(42);
+      double motion_us = 0., laser_us = 0., resampling_us = 0., stats_us = 0.;
+      for (int k = 0; k < options.iterations; ++k) {
+        // Particles around a random pose, and the scan seen from there.
+        const Pose2d pose = randomFreePose(map, &rnd_eng);
+        const std::vector<float> scan =
+            rayCast(map, laser_params, pose, nbeams);
+        ParticleSet particles;
+        particles.reserve(nparticles);
+        for (int n = 0; n < nparticles; ++n)
+          particles.push_back(
+              Pose2d(
+                  pose[0] + 0.3 * randn(rnd_eng),
+                  pose[1] + 0.3 * randn(rnd_eng),
+                  pose[2] + 0.2 * randn(rnd_eng)),
+              1. / nparticles);
+        // Time the stages of an update.
+        auto start = std::chrono::steady_clock::now();
+        motion_model.sampleProposal(Pose2d(0.1, 0., 0.05), &particles);
+        motion_us += elapsedMicroseconds(start);
+        start = std::chrono::steady_clock::now();
+        laser_model.computeParticlesLikelihood(
+            map, likelihood_field, scan, &particles);
+        laser_us += elapsedMicroseconds(start);
+        start = std::chrono::steady_clock::now();
+        resampler.importanceSampling(
+            resampling::Scheme::SYSTEMATIC, &particles);
+        resampling_us += elapsedMicroseconds(start);
+        start = std::chrono::steady_clock::now();
+        Pose2d mean;
+        Eigen::Matrix3d covariance;
+        particles::computeMeanAndCovariance(particles, &mean, &covariance);
+        stats_us += elapsedMicroseconds(start);
+      }
+      const double n = options.iterations;
+      const double update_us =
+          (motion_us + laser_us + resampling_us + stats_us) / n;
+      std::printf(
+          "%-24s %9d %6d %10.1f %10.1f %10.1f %10.1f %10.1f %9.1f\n",
+          map_name.c_str(), nparticles, nbeams, motion_us / n, laser_us / n,
+          resampling_us / n, stats_us / n, update_us, 1e6 / update_us);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    std::fprintf(
+        stderr,
+        "Usage: %s [--particles N,...] [--beams N,...] [--iterations N] "
+        "map.yaml [map.yaml ...]\n",
+        argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::printf(
+      "%-24s %9s %6s %10s %10s %10s %10s %10s %9s\n", "map", "particles",
+      "beams", "motion[us]", "laser[us]", "resamp[us]", "stats[us]",
+      "update[us]", "scans/s");
+  for (const std::string& map_filename : options.maps) {
+    GridMap::Params map_params;
+    std::vector<signed char> data;
+    if (!map_io::loadMap(map_filename, &map_params, &data)) {
+      std::fprintf(stderr, "Unable to load %s.\n", map_filename.c_str());
+      continue;
+    }
+    GridMap map(map_params);
+    map.initialize(data);
+    LatentModelLikelihoodField likelihood_field;
+    likelihood_field.params().observation_sigma = 0.1;
+    likelihood_field.params().uniform_hit       = 0.25;
+    const auto start = std::chrono::steady_clock::now();
+    likelihood_field.initialize(map);
+    const std::string map_name =
+        map_filename.substr(map_filename.find_last_of('/') + 1);
+    std::printf(
+        "# %s: %zu x %zu cells, likelihood field in %.1f ms\n",
+        map_name.c_str(), map_params.width, map_params.height,
+        elapsedMicroseconds(start) * 1e-3);
+    runBenchmark(options, map_name, map, likelihood_field);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_2d_localizer/branch_and_bound_matcher.h"
+
+#include <angles/angles.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_2d_localizer {
+
+namespace {
+
+// Offset in [-0.5, 0.5] of the vertex of the parabola through the scores of
+// a maximum and of its neighbours, 0 if they are not concave.
+double parabolicPeak(double prev, double center, double next) {
+  const double curvature = prev - 2. * center + next;
+  if (curvature >= 0.)
+    return 0.;
+  return std::max(-0.5, std::min(0.5, 0.5 * (prev - next) / curvature));
+}
+
+}  // namespace
+
+bool BranchAndBoundMatcher::match(
+    const GridMap& grid_map, const LikelihoodFieldPyramid& pyramid,
+    const EndPoints2f& endpoints, Pose2d* pose, double* score) const {
+  if (endpoints.size() == 0 || pyramid.numLevels() == 0)
+    return false;
+  const int h      = grid_map.params().height;
+  const int w      = grid_map.params().width;
+  const double res = grid_map.params().resolution;
+  double angular_step = angularStep(grid_map, endpoints);
+  const int nangles   = std::ceil(2. * M_PI / angular_step);
+  angular_step        = 2. * M_PI / nangles;
+  Rasterization raster;
+  rasterize(grid_map, endpoints, -M_PI, angular_step, nangles, &raster);
+  Candidate best;
+  if (!searchWindow(
+          pyramid, raster, Window{0, 0, h, w}, pyramid.numLevels() - 1, &best))
+    return false;
+  EndPoint2d origin;
+  grid_map.indicesToPoint(0, 0, &origin);
+  *pose = Pose2d(
+      origin[0] + best.j * res, origin[1] - best.i * res,
+      angles::normalize_angle(-M_PI + best.angle * angular_step));
+  *score = best.score;
+  return true;
+}
+
+bool BranchAndBoundMatcher::matchInWindow(
+    const GridMap& grid_map, const LikelihoodFieldPyramid& pyramid,
+    const EndPoints2f& endpoints, const Pose2d& initial_pose,
+    double linear_window, double angular_window, Pose2d* pose,
+    double* score) const {
+  if (endpoints.size() == 0 || pyramid.numLevels() == 0)
+    return false;
+  const int h      = grid_map.params().height;
+  const int w      = grid_map.params().width;
+  const double res = grid_map.params().resolution;
+  // Orientations centered on the initial one.
+  const double angular_step = angularStep(grid_map, endpoints);
+  const int half_nangles =
+      std::ceil(std::max(0., angular_window) / angular_step);
+  const int nangles        = 2 * half_nangles + 1;
+  const double first_angle = initial_pose[2] - half_nangles * angular_step;
+  Rasterization raster;
+  rasterize(grid_map, endpoints, first_angle, angular_step, nangles, &raster);
+  // Translations centered on the cell of the initial pose.
+  int ci, cj;
+  grid_map.pointToIndices(initial_pose.translation(), &ci, &cj);
+  const int radius = std::max<int>(1, std::ceil(linear_window / res));
+  const Window window{std::max(0, ci - radius), std::max(0, cj - radius),
+                      std::min(h, ci + radius + 1),
+                      std::min(w, cj + radius + 1)};
+  if (window.min_i >= window.max_i || window.min_j >= window.max_j)
+    return false;
+  // Coarsest level whose blocks still fit in the window.
+  int top_level = 0;
+  while (top_level + 1 < pyramid.numLevels() &&
+         (2 << top_level) <= 2 * radius + 1)
+    ++top_level;
+  Candidate best;
+  if (!searchWindow(pyramid, raster, window, top_level, &best))
+    return false;
+  // Sub-cell refinement from the scores of the neighbours of the best pose.
+  auto neighbour_score = [&](int da, int di, int dj) {
+    Candidate neighbour{best.angle + da, best.i + di, best.j + dj, 0.f};
+    scoreCandidate(pyramid, raster, 0, &neighbour);
+    return static_cast<double>(neighbour.score);
+  };
+  const double di = parabolicPeak(
+      neighbour_score(0, -1, 0), best.score, neighbour_score(0, 1, 0));
+  const double dj = parabolicPeak(
+      neighbour_score(0, 0, -1), best.score, neighbour_score(0, 0, 1));
+  double da = 0.;
+  if (best.angle > 0 && best.angle + 1 < nangles)
+    da = parabolicPeak(
+        neighbour_score(-1, 0, 0), best.score, neighbour_score(1, 0, 0));
+  EndPoint2d origin;
+  grid_map.indicesToPoint(0, 0, &origin);
+  *pose = Pose2d(
+      origin[0] + (best.j + dj) * res, origin[1] - (best.i + di) * res,
+      angles::normalize_angle(first_angle + (best.angle + da) * angular_step));
+  *score = best.score;
+  return true;
+}
+
+double BranchAndBoundMatcher::angularStep(
+    const GridMap& grid_map, const EndPoints2f& endpoints) const {
+  if (params_.angular_step > 0.)
+    return params_.angular_step;
+  const double res = grid_map.params().resolution;
+  double max_range = res;
+  for (size_t b = 0; b < endpoints.size(); ++b)
+    max_range = std::max<double>(
+        max_range, std::hypot(endpoints.x[b], endpoints.y[b]));
+  return std::acos(1. - 0.5 * (res * res) / (max_range * max_range));
+}
+
+void BranchAndBoundMatcher::rasterize(
+    const GridMap& grid_map, const EndPoints2f& endpoints,
+    double first_angle, double angular_step, int nangles,
+    Rasterization* raster) const {
+  const int nbeams = endpoints.size();
+  // Rasterize the endpoints, with the robot in the center of the cell (0, 0).
+  EndPoint2d origin;
+  grid_map.indicesToPoint(0, 0, &origin);
+  raster->nbeams  = nbeams;
+  raster->nangles = nangles;
+  raster->e_i.resize(nangles * nbeams);
+  raster->e_j.resize(nangles * nbeams);
+#pragma omp parallel for default(shared)
+  for (int a = 0; a < nangles; ++a) {
+    const double c = std::cos(first_angle + a * angular_step);
+    const double s = std::sin(first_angle + a * angular_step);
+    for (int b = 0; b < nbeams; ++b) {
+      const EndPoint2d e(
+          origin[0] + c * endpoints.x[b] - s * endpoints.y[b],
+          origin[1] + s * endpoints.x[b] + c * endpoints.y[b]);
+      grid_map.pointToIndices(
+          e, &raster->e_i[a * nbeams + b], &raster->e_j[a * nbeams + b]);
+    }
+  }
+}
+
+void BranchAndBoundMatcher::sortCandidates(
+    std::vector<Candidate>* candidates) {
+  std::sort(
+      candidates->begin(), candidates->end(),
+      [](const Candidate& lhs, const Candidate& rhs) {
+        return lhs.score > rhs.score;
+      });
+}
+
+void BranchAndBoundMatcher::scoreCandidate(
+    const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+    int level, Candidate* candidate) const {
+  const int* e_i = raster.e_i.data() + candidate->angle * raster.nbeams;
+  const int* e_j = raster.e_j.data() + candidate->angle * raster.nbeams;
+  float score    = 0.f;
+  for (int b = 0; b < raster.nbeams; ++b)
+    score += pyramid.score(level, e_i[b] + candidate->i, e_j[b] + candidate->j);
+  candidate->score = score / raster.nbeams;
+}
+
+bool BranchAndBoundMatcher::searchWindow(
+    const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+    const Window& window, int top_level, Candidate* best) const {
+  // Score the blocks of the top level.
+  const int top_step = 1 << top_level;
+  std::vector<Candidate> roots;
+  for (int a = 0; a < raster.nangles; ++a)
+    for (int i = window.min_i; i < window.max_i; i += top_step)
+      for (int j = window.min_j; j < window.max_j; j += top_step)
+        roots.push_back(Candidate{a, i, j, 0.f});
+#pragma omp parallel for default(shared) schedule(dynamic, 64)
+  for (size_t k = 0; k < roots.size(); ++k)
+    scoreCandidate(pyramid, raster, top_level, &roots[k]);
+  sortCandidates(&roots);
+  // Refine depth first, best blocks first.
+  *best = Candidate{-1, 0, 0, static_cast<float>(params_.min_score)};
+  search(pyramid, raster, window, top_level, &roots, best);
+  return best->angle >= 0;
+}
+
+void BranchAndBoundMatcher::search(
+    const LikelihoodFieldPyramid& pyramid, const Rasterization& raster,
+    const Window& window, int level, std::vector<Candidate>* candidates,
+    Candidate* best) const {
+  for (const Candidate& candidate : *candidates) {
+    // Candidates are sorted, so none of the remaining ones can do better.
+    if (candidate.score <= best->score)
+      break;
+    if (level == 0) {
+      *best = candidate;
+      break;
+    }
+    // Split the block in four, within the window.
+    const int half = 1 << (level - 1);
+    std::vector<Candidate> children;
+    children.reserve(4);
+    for (int di = 0; di <= half; di += half)
+      for (int dj = 0; dj <= half; dj += half) {
+        Candidate child{
+            candidate.angle, candidate.i + di, candidate.j + dj, 0.f};
+        if (child.i >= window.max_i || child.j >= window.max_j)
+          continue;
+        scoreCandidate(pyramid, raster, level - 1, &child);
+        children.push_back(child);
+      }
+    sortCandidates(&children);
+    search(pyramid, raster, window, level - 1, &children, best);
+  }
+}
+
+BranchAndBoundMatcher::Params BranchAndBoundMatcher::Params::defaultParams() {
+  Params params;
+  params.angular_step = 0.;
+  params.min_score    = 0.5;
+  return params;
+}
+
+}  // namespace squirrel_2d_localizer
@@ -28,8 +28,9 @@
 
 #include "squirrel_2d_localizer/convolution.h"
 
+#include <algorithm>
 #include <cmath>
-#include <iostream>
+#include <numeric>
 
 namespace squirrel_2d_localizer {
 namespace convolution {
@@ -37,43 +38,118 @@ namespace convolution {
 void computeGaussianConvolution2d(
     double sigma, double resolution, const Eigen::MatrixXd& matrix,
     Eigen::MatrixXd* output) {
-#pragma omp parallel for default(shared)
-  for (size_t i = 0; i < matrix.rows(); ++i) {
-    Eigen::VectorXd output_row = Eigen::VectorXd::Zero(output->row(i).size());
-    __internal::computeGaussianConvolution1d(
-        sigma, resolution, matrix.row(i), &output_row);
-    output->row(i) = output_row;
-  }
-#pragma omp parallel for default(shared)
-  for (size_t j = 0; j < matrix.cols(); ++j) {
-    Eigen::VectorXd output_col = Eigen::VectorXd::Zero(output->col(j).size());
-    __internal::computeGaussianConvolution1d(
-        sigma, resolution, output->col(j), &output_col);
-    output->col(j) = output_col;
-  }
+  const double pixel_sigma = sigma / resolution;
+  const std::vector<double>& kernel =
+      __internal::computeGaussianKernel(pixel_sigma);
+  const bool recursive =
+      pixel_sigma > __internal::kRecursiveFilterMinPixelSigma;
+  const double scale = std::accumulate(kernel.begin(), kernel.end(), 0.);
+  // Columns are contiguous in memory, thus the row pass is performed on the
+  // transposed matrix.
+  Eigen::MatrixXd columns_pass(matrix.rows(), matrix.cols());
+  if (recursive)
+    __internal::computeRecursiveGaussianConvolutionColumns(
+        pixel_sigma, scale, matrix, &columns_pass);
+  else
+    __internal::computeGaussianConvolutionColumns(
+        kernel, matrix, &columns_pass);
+  const Eigen::MatrixXd columns_pass_t = columns_pass.transpose();
+  Eigen::MatrixXd rows_pass_t(columns_pass_t.rows(), columns_pass_t.cols());
+  if (recursive)
+    __internal::computeRecursiveGaussianConvolutionColumns(
+        pixel_sigma, scale, columns_pass_t, &rows_pass_t);
+  else
+    __internal::computeGaussianConvolutionColumns(
+        kernel, columns_pass_t, &rows_pass_t);
+  *output = rows_pass_t.transpose();
+}
+
+int gaussianKernelRadius(double sigma, double resolution) {
+  // The tails of the recursive filter decay exponentially, hence slower.
+  const double pixel_sigma = sigma / resolution;
+  return (pixel_sigma > __internal::kRecursiveFilterMinPixelSigma ? 8 : 5) *
+         pixel_sigma;
 }
 
 namespace __internal {
 
-void computeGaussianConvolution1d(
-    double sigma, double resolution, const Eigen::VectorXd& vector,
-    Eigen::VectorXd* output) {
-  const int vsize = vector.size();
-  if (vsize < 1)
-    return;
-  const double pixel_sigma   = sigma / resolution;
+std::vector<double> computeGaussianKernel(double pixel_sigma) {
   const double normalization = 1 / std::sqrt(2 * pixel_sigma * M_PI);
   const int radius           = 5 * pixel_sigma;
-  for (int i = 0; i < vsize; ++i) {
-    const int min_index = std::max(0, i - radius);
-    const int max_index = std::min(vsize, i + radius);
-    for (int j = min_index; j < max_index; ++j) {
-      const double d = (i - j) / pixel_sigma;
-      (*output)(j) += vector(i) * normalization * std::exp(-0.5 * d * d);
+  std::vector<double> kernel(2 * radius + 1);
+  for (int d = -radius; d <= radius; ++d) {
+    const double x     = d / pixel_sigma;
+    kernel[d + radius] = normalization * std::exp(-0.5 * x * x);
+  }
+  return kernel;
+}
+
+void computeGaussianConvolutionColumns(
+    const std::vector<double>& kernel, const Eigen::MatrixXd& matrix,
+    Eigen::MatrixXd* output) {
+  const int rows = matrix.rows();
+#pragma omp parallel for default(shared)
+  for (int j = 0; j < matrix.cols(); ++j)
+    computeGaussianConvolution1d(
+        kernel, matrix.col(j).data(), rows, output->col(j).data());
+}
+
+void computeRecursiveGaussianConvolutionColumns(
+    double pixel_sigma, double scale, const Eigen::MatrixXd& matrix,
+    Eigen::MatrixXd* output) {
+  // Filter coefficients (Young and van Vliet, 1995).
+  const double q =
+      pixel_sigma >= 2.5
+          ? 0.98711 * pixel_sigma - 0.96330
+          : 3.97156 - 4.14554 * std::sqrt(1. - 0.26891 * pixel_sigma);
+  const double q2 = q * q, q3 = q2 * q;
+  const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  const double b1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+  const double b2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+  const double b3 = (0.422205 * q3) / b0;
+  const double B  = 1. - (b1 + b2 + b3);
+  // Zero padding, so that the borders match the truncated kernel.
+  const int rows    = matrix.rows();
+  const int padding = std::ceil(3 * pixel_sigma) + 3;
+  const int size    = rows + 2 * padding;
+#pragma omp parallel default(shared)
+  {
+    std::vector<double> buffer(size);
+#pragma omp for
+    for (int j = 0; j < matrix.cols(); ++j) {
+      std::fill(buffer.begin(), buffer.end(), 0.);
+      std::copy(
+          matrix.col(j).data(), matrix.col(j).data() + rows,
+          buffer.begin() + padding);
+      // Causal pass.
+      for (int i = 3; i < size; ++i)
+        buffer[i] = B * buffer[i] + b1 * buffer[i - 1] + b2 * buffer[i - 2] +
+                    b3 * buffer[i - 3];
+      // Anti-causal pass.
+      for (int i = size - 4; i >= 0; --i)
+        buffer[i] = B * buffer[i] + b1 * buffer[i + 1] + b2 * buffer[i + 2] +
+                    b3 * buffer[i + 3];
+      double* column = output->col(j).data();
+      for (int i = 0; i < rows; ++i)
+        column[i] = scale * buffer[i + padding];
     }
   }
 }
 
+void computeGaussianConvolution1d(
+    const std::vector<double>& kernel, const double* input, int size,
+    double* output) {
+  const int radius = kernel.size() / 2;
+  for (int i = 0; i < size; ++i) {
+    const int min_d = std::max(-radius, -i);
+    const int max_d = std::min(radius, size - 1 - i);
+    double value    = 0.;
+    for (int d = min_d; d <= max_d; ++d)
+      value += kernel[d + radius] * input[i + d];
+    output[i] = value;
+  }
+}
+
 }  // namespace __internal
 }  // namespace convolution
 }  // namespace squirrel_2d_localizer
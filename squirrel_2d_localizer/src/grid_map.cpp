@@ -28,6 +28,7 @@
 
 #include "squirrel_2d_localizer/grid_map.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace squirrel_2d_localizer {
@@ -36,22 +37,74 @@ GridMap::GridMap(const Params& params) : params_(params) {
   const size_t h = params_.height;
   const size_t w = params_.width;
   occupancy_map_.resize(h, w);
-  unknown_space_.resize(h, w);
+  unknown_space_.assign((h * w + 63) / 64, 0);
 }
 
 void GridMap::initialize(const std::vector<signed char>& data) {
   assert(params_.height * params_.width == data.size());
-  const double normalizer = 1. / 100.;
-#pragma omp parallel for default(shared)
+  std::fill(unknown_space_.begin(), unknown_space_.end(), 0);
+  // Map rows are flipped, so that the first row is the top of the map.
   for (size_t px = 0; px < data.size(); ++px) {
-    const size_t i        = params_.height - 1 - px / params_.width;
-    const size_t j        = px % params_.width;
-    const int pixel_value = static_cast<int>(data[px]);
-    occupancy_map_(i, j) = pixel_value >= 0 ? pixel_value * normalizer : 0.;
-    unknown_space_(i, j) = pixel_value >= 0 ? 0 : 1;
+    const size_t i = params_.height - 1 - px / params_.width;
+    const size_t j = px % params_.width;
+    setCell(i, j, data[px]);
   }
 }
 
+void GridMap::update(const Patch& patch) {
+  for (int k = 0, i, j; k < static_cast<int>(patch.data.size()); ++k) {
+    patchCellToIndices(patch, k, &i, &j);
+    if (inside(i, j))
+      setCell(i, j, patch.data[k]);
+  }
+}
+
+bool GridMap::difference(
+    const std::vector<signed char>& data, Patch* patch) const {
+  assert(params_.height * params_.width == data.size());
+  const int h = params_.height, w = params_.width;
+  int min_x = w, max_x = -1, min_y = h, max_y = -1;
+  for (int y = 0; y < h; ++y)
+    for (int x = 0; x < w; ++x) {
+      const int i           = h - 1 - y;
+      const int pixel_value = static_cast<int>(data[y * w + x]);
+      if ((pixel_value < 0) != unknown(i, x) ||
+          (pixel_value >= 0 && occupancy_map_(i, x) != pixel_value)) {
+        min_x = std::min(min_x, x);
+        max_x = std::max(max_x, x);
+        min_y = std::min(min_y, y);
+        max_y = std::max(max_y, y);
+      }
+    }
+  if (max_x < 0)
+    return false;
+  patch->x      = min_x;
+  patch->y      = min_y;
+  patch->width  = max_x - min_x + 1;
+  patch->height = max_y - min_y + 1;
+  patch->data.resize(patch->width * patch->height);
+  for (int y = 0; y < patch->height; ++y)
+    std::copy(
+        data.begin() + (min_y + y) * w + min_x,
+        data.begin() + (min_y + y) * w + max_x + 1,
+        patch->data.begin() + y * patch->width);
+  return true;
+}
+
+void GridMap::setCell(int i, int j, signed char value) {
+  const int pixel_value = static_cast<int>(value);
+  const size_t cell     = i * params_.width + j;
+  occupancy_map_(i, j)  = pixel_value >= 0 ? pixel_value : 0;
+  if (pixel_value < 0)
+    unknown_space_[cell >> 6] |= uint64_t(1) << (cell & 63);
+  else
+    unknown_space_[cell >> 6] &= ~(uint64_t(1) << (cell & 63));
+}
+
+Eigen::MatrixXd GridMap::occupancyMatrix() const {
+  return occupancy_map_.cast<double>() * 0.01;
+}
+
 void GridMap::pointToIndices(const EndPoint2d& e, int* i, int* j) const {
   const double x = e[0] - params_.origin[0];
   const double y = e[1] - params_.origin[1];
@@ -59,6 +112,12 @@ void GridMap::pointToIndices(const EndPoint2d& e, int* i, int* j) const {
   *j             = std::floor(x / params_.resolution);
 }
 
+void GridMap::indicesToPoint(int i, int j, EndPoint2d* e) const {
+  // Cell center.
+  (*e)[0] = params_.origin[0] + (j + 0.5) * params_.resolution;
+  (*e)[1] = params_.origin[1] + (params_.height - i - 0.5) * params_.resolution;
+}
+
 bool GridMap::inside(int i, int j) const {
   return (i >= 0 && i < params_.height) && (j >= 0 && j < params_.width);
 }
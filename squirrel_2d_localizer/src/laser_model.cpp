@@ -28,6 +28,7 @@
 
 #include "squirrel_2d_localizer/laser_model.h"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <thread>
@@ -36,57 +37,250 @@ namespace squirrel_2d_localizer {
 
 void LaserModel::computeParticlesLikelihood(
     const GridMap& grid_map, const LatentModelLikelihoodField& likelihood_field,
-    const std::vector<float>& measurement, std::vector<Particle>* particles) {
+    const std::vector<float>& measurement, ParticleSet* particles,
+    Health* health) {
   std::unique_lock<std::mutex> lock(mtx_);
   prepareLaserReadings(measurement);
-  int e_i, e_j;
-  for (size_t i = 0; i < particles->size(); ++i) {
-    const Pose2d& pose = particles->at(i).pose;
-    double weight      = 1.;
-    for (size_t j = 0; j < eff_measurement_.size(); ++j) {
-      const EndPoint2d& beam_endpoint = eff_measurement_[j];
-      const EndPoint2d& e =
-          pose.rotation() * beam_endpoint + pose.translation();
-      grid_map.pointToIndices(e, &e_i, &e_j);
-      weight *= likelihood_field.likelihood(e_i, e_j);
+  if (params_.max_beams > 0 &&
+      static_cast<int>(eff_measurement_.size()) > params_.max_beams)
+    selectBeams(grid_map, likelihood_field, *particles);
+  const GridMap::Params& map_params = grid_map.params();
+  const float inv_resolution        = 1. / map_params.resolution;
+  const float origin_x              = map_params.origin[0];
+  const float origin_y              = map_params.origin[1];
+  const int last_row                = map_params.height - 1;
+  const int nbeams                  = eff_measurement_.size();
+  const int nparticles              = particles->size();
+  const float* beams_x              = eff_measurement_.x.data();
+  const float* beams_y              = eff_measurement_.y.data();
+  const double* particles_x         = particles->x.data();
+  const double* particles_y         = particles->y.data();
+  const double* particles_c         = particles->cos_a.data();
+  const double* particles_s         = particles->sin_a.data();
+  double* weights                   = particles->weight.data();
+  // The health is computed in log-domain, the linear weights underflow.
+  double* log_weights = nullptr;
+  if (params_.log_likelihood) {
+    log_weights = weights;
+  } else if (health) {
+    health_log_weights_.resize(nparticles);
+    log_weights = health_log_weights_.data();
+  }
+#pragma omp parallel default(shared)
+  {
+    std::vector<int> e_i(nbeams), e_j(nbeams);
+#pragma omp for schedule(static)
+    for (int k = 0; k < nparticles; ++k) {
+      // Particle pose in grid coordinates.
+      const float c  = inv_resolution * particles_c[k];
+      const float s  = inv_resolution * particles_s[k];
+      const float tx = inv_resolution * (particles_x[k] - origin_x);
+      const float ty = inv_resolution * (particles_y[k] - origin_y);
+      // Rasterize all the endpoints at once.
+      for (int b = 0; b < nbeams; ++b) {
+        const float ex = c * beams_x[b] - s * beams_y[b] + tx;
+        const float ey = s * beams_x[b] + c * beams_y[b] + ty;
+        e_i[b]         = last_row - static_cast<int>(std::floor(ey));
+        e_j[b]         = static_cast<int>(std::floor(ex));
+      }
+      if (params_.log_likelihood) {
+        double log_weight = 0.;
+        for (int b = 0; b < nbeams; ++b)
+          log_weight += likelihood_field.logLikelihoodClamped(e_i[b], e_j[b]);
+        weights[k] = log_weight;
+      } else {
+        // The log-weight of the health is summed in the same pass.
+        double weight = 1., log_weight = 0.;
+        for (int b = 0; b < nbeams; ++b) {
+          weight *= likelihood_field.likelihoodClamped(e_i[b], e_j[b]);
+          if (log_weights)
+            log_weight +=
+                likelihood_field.logLikelihoodClamped(e_i[b], e_j[b]);
+        }
+        weights[k] = weight;
+        if (log_weights)
+          log_weights[k] = log_weight;
+      }
     }
-    particles->at(i).weight = weight;
   }
+  if (health)
+    computeHealth(
+        grid_map, likelihood_field, *particles, log_weights, health);
+  if (params_.log_likelihood)
+    particles::normalizeLogWeights(particles);
+}
+
+void LaserModel::computeParticlesLikelihood(
+    const GridMap& grid_map, const LatentModelLikelihoodField& likelihood_field,
+    const std::vector<float>& measurement, std::vector<Particle>* particles) {
+  ParticleSet particle_set(*particles);
+  computeParticlesLikelihood(
+      grid_map, likelihood_field, measurement, &particle_set);
+  particle_set.toParticles(particles);
+}
+
+void LaserModel::computeEndPoints(
+    const std::vector<float>& measurement, EndPoints2f* endpoints) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  prepareLaserReadings(measurement);
+  *endpoints = eff_measurement_;
 }
 
 void LaserModel::prepareLaserReadings(const std::vector<float>& measurement) {
   eff_measurement_.clear();
   if (measurement.empty())
     return;
-  const double fov = params_.angle_max - params_.angle_min;
-  const double angle_increment = fov / (measurement.size() - 1);
+  if (!beamsTableValid(measurement.size()))
+    computeBeamsTable(measurement.size());
   const double sq_min_endpoint_dist =
       std::pow(params_.endpoints_min_distance, 2);
-  EndPoint2d last_endpoint({-std::numeric_limits<double>::max(), 0.});
+  const double laser_x = params_.tf_r2l[0];
+  const double laser_y = params_.tf_r2l[1];
+  double last_x = -std::numeric_limits<double>::max(), last_y = 0.;
   for (size_t i = 0; i < measurement.size(); ++i) {
-    const float ray        = measurement[i];
-    const double ray_angle = params_.angle_min + i * angle_increment;
+    const float ray = measurement[i];
     if (!std::isfinite(ray) || ray < params_.range_min ||
         ray > params_.range_max)
       continue;
-    EndPoint2d next_endpoint =
-        ray * EndPoint2d(std::cos(ray_angle), std::sin(ray_angle));
-    if ((last_endpoint - next_endpoint).squaredNorm() < sq_min_endpoint_dist)
+    const double x  = laser_x + ray * beams_dir_x_[i];
+    const double y  = laser_y + ray * beams_dir_y_[i];
+    const double dx = x - last_x, dy = y - last_y;
+    if (dx * dx + dy * dy < sq_min_endpoint_dist)
+      continue;
+    eff_measurement_.push_back(x, y);
+    last_x = x;
+    last_y = y;
+  }
+}
+
+void LaserModel::selectBeams(
+    const GridMap& grid_map, const LatentModelLikelihoodField& likelihood_field,
+    const ParticleSet& particles) {
+  if (particles.empty())
+    return;
+  // Mean particle pose.
+  const int nparticles = particles.size();
+  double mean_x = 0., mean_y = 0., mean_c = 0., mean_s = 0.;
+  for (int k = 0; k < nparticles; ++k) {
+    mean_x += particles.x[k];
+    mean_y += particles.y[k];
+    mean_c += particles.cos_a[k];
+    mean_s += particles.sin_a[k];
+  }
+  const double norm = std::hypot(mean_c, mean_s);
+  const double c    = norm > 0. ? mean_c / norm : 1.;
+  const double s    = norm > 0. ? mean_s / norm : 0.;
+  mean_x /= nparticles;
+  mean_y /= nparticles;
+  // Score the endpoints by the squared gradient of the log-likelihood.
+  const int nbeams = eff_measurement_.size();
+  std::vector<double> scores(nbeams);
+  for (int b = 0; b < nbeams; ++b) {
+    int i, j;
+    const float bx = eff_measurement_.x[b], by = eff_measurement_.y[b];
+    grid_map.pointToIndices(
+        EndPoint2d(c * bx - s * by + mean_x, s * bx + c * by + mean_y), &i,
+        &j);
+    const double di = likelihood_field.logLikelihoodClamped(i + 1, j) -
+                      likelihood_field.logLikelihoodClamped(i - 1, j);
+    const double dj = likelihood_field.logLikelihoodClamped(i, j + 1) -
+                      likelihood_field.logLikelihoodClamped(i, j - 1);
+    scores[b] = di * di + dj * dj;
+  }
+  // Best endpoint of each stratum, keeping the angular order.
+  EndPoints2f selected;
+  selected.reserve(params_.max_beams);
+  for (int k = 0; k < params_.max_beams; ++k) {
+    const int first = static_cast<long>(k) * nbeams / params_.max_beams;
+    const int last  = static_cast<long>(k + 1) * nbeams / params_.max_beams;
+    const int best =
+        std::max_element(scores.begin() + first, scores.begin() + last) -
+        scores.begin();
+    selected.push_back(eff_measurement_.x[best], eff_measurement_.y[best]);
+  }
+  eff_measurement_ = selected;
+}
+
+void LaserModel::computeHealth(
+    const GridMap& grid_map, const LatentModelLikelihoodField& likelihood_field,
+    const ParticleSet& particles, const double* log_weights,
+    Health* health) const {
+  *health              = Health();
+  const int nbeams     = eff_measurement_.size();
+  const int nparticles = particles.size();
+  health->nbeams       = nbeams;
+  if (nbeams == 0 || nparticles == 0)
+    return;
+  // Weights relative to the best one, from the log-likelihoods.
+  const int best =
+      std::max_element(log_weights, log_weights + nparticles) - log_weights;
+  double tot_weight = 0., tot_weight_log_weight = 0.;
+  for (int k = 0; k < nparticles; ++k) {
+    const double weight = std::exp(log_weights[k] - log_weights[best]);
+    if (weight <= 0.)
       continue;
-    eff_measurement_.emplace_back(
-        params_.tf_r2l.rotation() * next_endpoint +
-        params_.tf_r2l.translation());
-    last_endpoint = next_endpoint;
+    tot_weight += weight;
+    tot_weight_log_weight += weight * std::log(weight);
+  }
+  // H = log(W) - sum(w log w) / W, for the weights w summing to W.
+  if (nparticles > 1 && tot_weight > 0.)
+    health->weight_entropy = std::max(
+        0., (std::log(tot_weight) - tot_weight_log_weight / tot_weight) /
+                std::log(nparticles));
+  // Beams of the best particle matching the likelihood field.
+  const double min_likelihood =
+      params_.health_inlier_ratio * likelihood_field.likelihood(-1, -1);
+  const double c = particles.cos_a[best], s = particles.sin_a[best];
+  int ninliers = 0;
+  for (int b = 0; b < nbeams; ++b) {
+    const float bx = eff_measurement_.x[b], by = eff_measurement_.y[b];
+    int i, j;
+    grid_map.pointToIndices(
+        EndPoint2d(
+            c * bx - s * by + particles.x[best],
+            s * bx + c * by + particles.y[best]),
+        &i, &j);
+    if (likelihood_field.likelihoodClamped(i, j) >= min_likelihood)
+      ++ninliers;
+  }
+  health->inlier_fraction = static_cast<double>(ninliers) / nbeams;
+}
+
+bool LaserModel::beamsTableValid(size_t nbeams) const {
+  return beams_dir_x_.size() == nbeams &&
+         beams_table_angle_min_ == params_.angle_min &&
+         beams_table_angle_max_ == params_.angle_max &&
+         beams_table_tf_r2l_[0] == params_.tf_r2l[0] &&
+         beams_table_tf_r2l_[1] == params_.tf_r2l[1] &&
+         beams_table_tf_r2l_[2] == params_.tf_r2l[2];
+}
+
+void LaserModel::computeBeamsTable(size_t nbeams) {
+  const double fov             = params_.angle_max - params_.angle_min;
+  const double angle_increment = nbeams > 1 ? fov / (nbeams - 1) : 0.;
+  beams_dir_x_.resize(nbeams);
+  beams_dir_y_.resize(nbeams);
+  for (size_t i = 0; i < nbeams; ++i) {
+    const double ray_angle =
+        params_.tf_r2l[2] + params_.angle_min + i * angle_increment;
+    beams_dir_x_[i] = std::cos(ray_angle);
+    beams_dir_y_[i] = std::sin(ray_angle);
   }
+  beams_table_angle_min_ = params_.angle_min;
+  beams_table_angle_max_ = params_.angle_max;
+  beams_table_tf_r2l_    = params_.tf_r2l;
 }
 
 LaserModel::Params LaserModel::Params::defaultParams() {
   Params params;
+  params.log_likelihood         = true;
   params.endpoints_min_distance = 0.5;
+  params.max_beams              = 0;
   params.range_min              = 0.;
   params.range_max              = 6.;
   params.angle_min              = -0.5 * M_PI;
   params.angle_max              = 0.5 * M_PI;
+  params.health_inlier_ratio    = 2.;
   return params;
 }
 
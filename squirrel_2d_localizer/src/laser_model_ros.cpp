@@ -46,7 +46,10 @@ void LaserModelROS::initialize() {
 
 void LaserModelROS::reconfigureCallback(
     LaserModelConfig& config, uint32_t level) {
+  params_.log_likelihood         = config.log_likelihood;
   params_.endpoints_min_distance = config.beams_min_distance;
+  params_.max_beams              = config.max_beams;
+  params_.health_inlier_ratio    = config.health_inlier_ratio;
 }
 
 }  // namespace squirrel_2d_localizer
@@ -32,36 +32,427 @@
 #include "squirrel_2d_localizer/latent_model_likelihood_field.h"
 #include "squirrel_2d_localizer/convolution.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
 namespace squirrel_2d_localizer {
+namespace {
+
+// Header of the likelihood field cache file. It is followed either by the
+// padded likelihood and log-likelihood caches, or by the quantized cache when
+// compact storage is used, stored row major. Tiled caches are stored tile
+// major instead, from a page aligned offset.
+struct CacheHeader {
+  char magic[8];
+  uint64_t key;
+  int64_t rows, cols;
+  int64_t compact;
+  double log_min, log_step;
+  int64_t tile_size;
+};
+
+const char kCacheMagic[8] = {'S', '2', 'D', 'L', 'F', 'C', '0', '3'};
+
+// Offset of the tiled data in the cache file.
+constexpr size_t kTiledDataOffset = 4096;
+
+// Write a padded row major matrix tile by tile, filling with the given
+// value past its borders.
+template <typename Scalar, typename Matrix>
+void writeTiles(
+    const Matrix& matrix, int tile_size, Scalar fill, std::ofstream* fout) {
+  std::vector<Scalar> tile(tile_size * tile_size);
+  for (int r = 0; r < matrix.rows(); r += tile_size)
+    for (int c = 0; c < matrix.cols(); c += tile_size) {
+      std::fill(tile.begin(), tile.end(), fill);
+      for (int i = r; i < std::min<int>(r + tile_size, matrix.rows()); ++i)
+        for (int j = c; j < std::min<int>(c + tile_size, matrix.cols()); ++j)
+          tile[(i - r) * tile_size + j - c] = matrix(i, j);
+      fout->write(
+          reinterpret_cast<const char*>(tile.data()),
+          tile.size() * sizeof(Scalar));
+    }
+}
+
+// FNV-1a hash.
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  return hash;
+}
+
+}  // namespace
 
 void LatentModelLikelihoodField::initialize(const GridMap& occupancy_gridmap) {
-  const size_t h    = occupancy_gridmap.params().height;
-  const size_t w    = occupancy_gridmap.params().width;
-  const double res  = occupancy_gridmap.params().resolution;
-  likelihood_cache_ = Eigen::MatrixXd::Zero(h, w);
+  const size_t h   = occupancy_gridmap.params().height;
+  const size_t w   = occupancy_gridmap.params().width;
+  const double res = occupancy_gridmap.params().resolution;
+  likelihood_cache_rows_ = h;
+  likelihood_cache_cols_ = w;
+  likelihood_cache_.resize(0, 0);
+  log_likelihood_cache_.resize(0, 0);
+  quantized_cache_.resize(0, 0);
+  quantized_data_        = nullptr;
+  quantization_log_min_  = 0.;
+  quantization_log_step_ = 0.;
+  tile_shift_            = 0;
+  tile_cache_.reset();
+  // Try to map the precomputed fields.
+  const uint64_t key = computeCacheKey(occupancy_gridmap);
+  mapped_cache_.reset();
+  if (!params_.cache_filename.empty() && loadCache(key, h + 2, w + 2))
+    return;
+  Eigen::MatrixXd convolution = Eigen::MatrixXd::Zero(h, w);
   // Compute Gaussian convolution on the map.
   convolution::computeGaussianConvolution2d(
-      params_.observation_sigma, res, occupancy_gridmap, &likelihood_cache_);
-  // Add the uniform distribution.
-  likelihood_cache_ += params_.uniform_hit * Eigen::MatrixXd::Ones(h, w);
+      params_.observation_sigma, res, occupancy_gridmap.occupancyMatrix(),
+      &convolution);
+  // Add the uniform distribution, and pad the cache with a border of uniform
+  // hits for the clamped lookups.
+  CacheMatrix likelihoods =
+      CacheMatrix::Constant(h + 2, w + 2, params_.uniform_hit);
+  likelihoods.block(1, 1, h, w) += convolution;
+  if (params_.compact_storage) {
+    quantize(likelihoods);
+  } else {
+    // Precompute the log-likelihoods.
+    likelihood_cache_.swap(likelihoods);
+    log_likelihood_cache_ = likelihood_cache_.array().log().matrix();
+    likelihood_data_      = likelihood_cache_.data();
+    log_likelihood_data_  = log_likelihood_cache_.data();
+  }
+  // Store the fields for the next startup. Tiled fields are then served
+  // from the file rather than held in memory.
+  if (!params_.cache_filename.empty() && saveCache(key) && tileShift() > 0 &&
+      loadCache(key, h + 2, w + 2)) {
+    likelihood_cache_.resize(0, 0);
+    log_likelihood_cache_.resize(0, 0);
+    quantized_cache_.resize(0, 0);
+  }
+}
+
+bool LatentModelLikelihoodField::computeUpdate(
+    const GridMap& occupancy_gridmap, const GridMap::Patch& patch,
+    Update* update) const {
+  const int h      = occupancy_gridmap.params().height;
+  const int w      = occupancy_gridmap.params().width;
+  const double res = occupancy_gridmap.params().resolution;
+  const int radius =
+      convolution::gaussianKernelRadius(params_.observation_sigma, res);
+  // Rows and columns of the patch in the map.
+  const int patch_row = h - patch.y - patch.height;
+  const int patch_col = patch.x;
+  // The output region is the patch dilated by the kernel radius, and its
+  // convolution depends on the patch dilated by twice the radius.
+  const int out_row0 = std::max(patch_row - radius, 0);
+  const int out_row1 = std::min(patch_row + patch.height + radius, h);
+  const int out_col0 = std::max(patch_col - radius, 0);
+  const int out_col1 = std::min(patch_col + patch.width + radius, w);
+  if (out_row0 >= out_row1 || out_col0 >= out_col1)
+    return false;
+  const int in_row0 = std::max(patch_row - 2 * radius, 0);
+  const int in_row1 = std::min(patch_row + patch.height + 2 * radius, h);
+  const int in_col0 = std::max(patch_col - 2 * radius, 0);
+  const int in_col1 = std::min(patch_col + patch.width + 2 * radius, w);
+  // Updated occupancy of the input region.
+  Eigen::MatrixXd occupancy =
+      occupancy_gridmap.occupancy()
+          .block(in_row0, in_col0, in_row1 - in_row0, in_col1 - in_col0)
+          .cast<double>() *
+      0.01;
+  for (int k = 0, i, j; k < static_cast<int>(patch.data.size()); ++k) {
+    occupancy_gridmap.patchCellToIndices(patch, k, &i, &j);
+    if (occupancy_gridmap.inside(i, j))
+      occupancy(i - in_row0, j - in_col0) =
+          std::max(static_cast<int>(patch.data[k]), 0) * 0.01;
+  }
+  Eigen::MatrixXd convolution(occupancy.rows(), occupancy.cols());
+  convolution::computeGaussianConvolution2d(
+      params_.observation_sigma, res, occupancy, &convolution);
+  update->row = out_row0;
+  update->col = out_col0;
+  update->likelihoods =
+      convolution
+          .block(
+              out_row0 - in_row0, out_col0 - in_col0, out_row1 - out_row0,
+              out_col1 - out_col0)
+          .array() +
+      params_.uniform_hit;
+  return true;
+}
+
+void LatentModelLikelihoodField::applyUpdate(const Update& update) {
+  if (mapped_cache_ && !tiled())
+    detachCache();
+  const int rows = update.likelihoods.rows();
+  const int cols = update.likelihoods.cols();
+  // The fields are either held in memory or mapped privately and writable
+  // (tiled), so they can be written in place.
+  uint8_t* quantized_data = const_cast<uint8_t*>(quantized_data_);
+  double* likelihood_data = const_cast<double*>(likelihood_data_);
+  double* log_likelihood_data = const_cast<double*>(log_likelihood_data_);
+  for (int i = 0; i < rows; ++i)
+    for (int j = 0; j < cols; ++j) {
+      const size_t k          = clampedIndex(update.row + i, update.col + j);
+      const double likelihood = update.likelihoods(i, j);
+      if (quantized_data) {
+        quantized_data[k] = quantizeValue(likelihood);
+      } else {
+        likelihood_data[k]     = likelihood;
+        log_likelihood_data[k] = std::log(likelihood);
+      }
+    }
+  // Written tiles must stay resident. Tile indices are on the padded cache.
+  if (tiled())
+    for (int r = (update.row + 1) >> tile_shift_;
+         r <= (update.row + rows) >> tile_shift_; ++r)
+      for (int c = (update.col + 1) >> tile_shift_;
+           c <= (update.col + cols) >> tile_shift_; ++c)
+        tile_cache_->pin(r, c);
+}
+
+void LatentModelLikelihoodField::prefetch(
+    int row0, int row1, int col0, int col1) {
+  if (!tiled())
+    return;
+  tile_cache_->touch(
+      (std::max(row0, -1) + 1) >> tile_shift_,
+      (std::max(row1, -1) + 1) >> tile_shift_,
+      (std::max(col0, -1) + 1) >> tile_shift_,
+      (std::max(col1, -1) + 1) >> tile_shift_);
+}
+
+int LatentModelLikelihoodField::tileShift() const {
+  if (params_.tile_size <= 0)
+    return 0;
+  // Power of two sizes, with tiles spanning whole pages.
+  int shift = 6;
+  while (shift < 12 && (1 << shift) < params_.tile_size)
+    ++shift;
+  return shift;
 }
 
 double LatentModelLikelihoodField::likelihood(int i, int j) const {
   if (inside(i, j))
-    return likelihood_cache_(i, j);
+    return likelihoodClamped(i, j);
   return params_.uniform_hit;
 }
 
+double LatentModelLikelihoodField::logLikelihood(int i, int j) const {
+  if (inside(i, j))
+    return logLikelihoodClamped(i, j);
+  return std::log(params_.uniform_hit);
+}
+
 bool LatentModelLikelihoodField::inside(int i, int j) const {
-  return i >= 0 && i < likelihood_cache_.rows() && j >= 0 &&
-         j < likelihood_cache_.cols();
+  return i >= 0 && i < likelihood_cache_rows_ && j >= 0 &&
+         j < likelihood_cache_cols_;
+}
+
+void LatentModelLikelihoodField::quantize(const CacheMatrix& likelihoods) {
+  // The uniform hit is the smallest likelihood and is mapped exactly to 0,
+  // so that the border and the free space stay exact.
+  const double log_min  = std::log(params_.uniform_hit);
+  const double log_max  = std::log(likelihoods.maxCoeff());
+  const double log_step = (log_max - log_min) / 255.;
+  computeQuantizationTables(log_min, log_step);
+  quantized_cache_.resize(likelihoods.rows(), likelihoods.cols());
+#pragma omp parallel for default(shared)
+  for (int i = 0; i < likelihoods.rows(); ++i)
+    for (int j = 0; j < likelihoods.cols(); ++j)
+      quantized_cache_(i, j) = quantizeValue(likelihoods(i, j));
+  quantized_data_ = quantized_cache_.data();
+}
+
+uint8_t LatentModelLikelihoodField::quantizeValue(double likelihood) const {
+  if (quantization_log_step_ <= 0.)
+    return 0;
+  const double q =
+      (std::log(likelihood) - quantization_log_min_) / quantization_log_step_;
+  return static_cast<uint8_t>(std::min(std::max(std::round(q), 0.), 255.));
+}
+
+void LatentModelLikelihoodField::computeQuantizationTables(
+    double log_min, double log_step) {
+  quantization_log_min_  = log_min;
+  quantization_log_step_ = log_step;
+  for (int q = 0; q < 256; ++q) {
+    quantized_log_likelihood_[q] = log_min + q * log_step;
+    quantized_likelihood_[q]     = std::exp(quantized_log_likelihood_[q]);
+  }
+}
+
+uint64_t LatentModelLikelihoodField::computeCacheKey(
+    const GridMap& occupancy_gridmap) const {
+  const GridMap::OccupancyMatrix& occupancy = occupancy_gridmap.occupancy();
+  const GridMap::Params& map_params         = occupancy_gridmap.params();
+  const int64_t size[3] = {
+      occupancy.rows(), occupancy.cols(), params_.compact_storage};
+  const double values[3] = {
+      map_params.resolution, params_.observation_sigma, params_.uniform_hit};
+  uint64_t key = 14695981039346656037ULL;
+  key          = hashBytes(size, sizeof(size), key);
+  key          = hashBytes(values, sizeof(values), key);
+  key          = hashBytes(occupancy.data(), occupancy.size(), key);
+  return key;
+}
+
+bool LatentModelLikelihoodField::loadCache(
+    uint64_t key, size_t rows, size_t cols) {
+  const int fd = open(params_.cache_filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  // Tiles cover the padded cache, rounding it up to whole tiles.
+  const int shift          = tileShift();
+  const size_t tile_rows   = shift > 0 ? ((rows - 1) >> shift) + 1 : 0;
+  const size_t tile_cols   = shift > 0 ? ((cols - 1) >> shift) + 1 : 0;
+  const size_t num_cells   = shift > 0
+                                 ? (tile_rows * tile_cols) << (2 * shift)
+                                 : rows * cols;
+  const size_t data_offset = shift > 0 ? kTiledDataOffset : sizeof(CacheHeader);
+  const size_t data_size   = params_.compact_storage
+                                 ? num_cells * sizeof(uint8_t)
+                                 : 2 * num_cells * sizeof(double);
+  const size_t file_size = data_offset + data_size;
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) != file_size) {
+    close(fd);
+    return false;
+  }
+  // Tiled caches are mapped privately and writable, so that map updates can
+  // be written in place without touching the file.
+  void* addr =
+      shift > 0
+          ? mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+          : mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return false;
+  std::shared_ptr<const void> mapping(addr, [file_size](const void* p) {
+    munmap(const_cast<void*>(p), file_size);
+  });
+  const CacheHeader* header = static_cast<const CacheHeader*>(addr);
+  if (std::memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header->key != key || header->rows != static_cast<int64_t>(rows) ||
+      header->cols != static_cast<int64_t>(cols) ||
+      header->compact != params_.compact_storage ||
+      header->tile_size != (shift > 0 ? 1 << shift : 0))
+    return false;
+  // Zero-copy views on the mapped data.
+  const char* data = static_cast<const char*>(addr) + data_offset;
+  if (params_.compact_storage) {
+    computeQuantizationTables(header->log_min, header->log_step);
+    quantized_data_ = reinterpret_cast<const uint8_t*>(data);
+  } else {
+    likelihood_data_     = reinterpret_cast<const double*>(data);
+    log_likelihood_data_ = likelihood_data_ + num_cells;
+  }
+  tile_shift_ = shift;
+  if (shift > 0) {
+    tile_mask_     = (1 << shift) - 1;
+    tiles_per_row_ = tile_cols;
+    tile_cache_.reset(
+        new TileCache(tile_rows, tile_cols, params_.max_resident_tiles));
+    const size_t tile_cells = size_t(1) << (2 * shift);
+    if (params_.compact_storage) {
+      tile_cache_->addArray(quantized_data_, tile_cells * sizeof(uint8_t));
+    } else {
+      tile_cache_->addArray(likelihood_data_, tile_cells * sizeof(double));
+      tile_cache_->addArray(log_likelihood_data_, tile_cells * sizeof(double));
+    }
+  }
+  mapped_cache_ = mapping;
+  return true;
+}
+
+bool LatentModelLikelihoodField::saveCache(uint64_t key) const {
+  // Write a temporary file first, so that the cache is replaced atomically.
+  const std::string tmp_filename = params_.cache_filename + ".tmp";
+  std::ofstream fout(tmp_filename.c_str(), std::ios::binary);
+  if (!fout.is_open())
+    return false;
+  const int shift = tileShift();
+  CacheHeader header;
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.key       = key;
+  header.rows      = likelihood_cache_rows_ + 2;
+  header.cols      = likelihood_cache_cols_ + 2;
+  header.compact   = params_.compact_storage;
+  header.log_min   = quantization_log_min_;
+  header.log_step  = quantization_log_step_;
+  header.tile_size = shift > 0 ? 1 << shift : 0;
+  fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (shift > 0) {
+    const std::vector<char> padding(kTiledDataOffset - sizeof(header), 0);
+    fout.write(padding.data(), padding.size());
+    const int tile_size = 1 << shift;
+    if (params_.compact_storage) {
+      writeTiles<uint8_t>(quantized_cache_, tile_size, 0, &fout);
+    } else {
+      writeTiles<double>(
+          likelihood_cache_, tile_size, params_.uniform_hit, &fout);
+      writeTiles<double>(
+          log_likelihood_cache_, tile_size, std::log(params_.uniform_hit),
+          &fout);
+    }
+  } else if (params_.compact_storage) {
+    fout.write(
+        reinterpret_cast<const char*>(quantized_cache_.data()),
+        quantized_cache_.size());
+  } else {
+    const std::streamsize data_size =
+        likelihood_cache_.size() * sizeof(double);
+    fout.write(
+        reinterpret_cast<const char*>(likelihood_cache_.data()), data_size);
+    fout.write(
+        reinterpret_cast<const char*>(log_likelihood_cache_.data()),
+        data_size);
+  }
+  fout.close();
+  if (!fout.good()) {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+  return std::rename(tmp_filename.c_str(), params_.cache_filename.c_str()) == 0;
+}
+
+void LatentModelLikelihoodField::detachCache() {
+  const int rows = likelihood_cache_rows_ + 2;
+  const int cols = likelihood_cache_cols_ + 2;
+  if (quantized_data_) {
+    quantized_cache_ =
+        Eigen::Map<const QuantizedCacheMatrix>(quantized_data_, rows, cols);
+    quantized_data_ = quantized_cache_.data();
+  } else {
+    likelihood_cache_ =
+        Eigen::Map<const CacheMatrix>(likelihood_data_, rows, cols);
+    log_likelihood_cache_ =
+        Eigen::Map<const CacheMatrix>(log_likelihood_data_, rows, cols);
+    likelihood_data_     = likelihood_cache_.data();
+    log_likelihood_data_ = log_likelihood_cache_.data();
+  }
+  mapped_cache_.reset();
 }
 
 LatentModelLikelihoodField::Params
     LatentModelLikelihoodField::Params::defaultParams() {
   Params params;
-  params.uniform_hit       = 0.1;
-  params.observation_sigma = 1.0;
+  params.uniform_hit        = 0.1;
+  params.observation_sigma  = 1.0;
+  params.cache_filename     = "";
+  params.compact_storage    = false;
+  params.tile_size          = 0;
+  params.max_resident_tiles = 64;
   return params;
 }
 
@@ -45,6 +45,10 @@ void LatentModelLikelihoodFieldROS::init() {
   ros::NodeHandle pnh("~/latent_model_likelihood_field");
   pnh.param<double>("uniform_hit", params_.uniform_hit, 0.25);
   pnh.param<double>("observation_sigma", params_.observation_sigma, 0.1);
+  pnh.param<std::string>("cache_file", params_.cache_filename, "");
+  pnh.param<bool>("compact_storage", params_.compact_storage, false);
+  pnh.param<int>("tile_size", params_.tile_size, 0);
+  pnh.param<int>("max_resident_tiles", params_.max_resident_tiles, 64);
 }
 
 }  // namespace squirrel_2d_localizer
@@ -0,0 +1,91 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_2d_localizer/likelihood_field_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_2d_localizer {
+
+void LikelihoodFieldPyramid::initialize(
+    const GridMap& grid_map,
+    const LatentModelLikelihoodField& likelihood_field) {
+  const int h = grid_map.params().height;
+  const int w = grid_map.params().width;
+  levels_.clear();
+  levels_.resize(std::max(1, params_.num_levels));
+  // Finest level: rescaled log-likelihoods.
+  const double log_min = likelihood_field.logLikelihood(-1, -1);
+  double log_max       = log_min;
+  for (int i = 0; i < h; ++i)
+    for (int j = 0; j < w; ++j)
+      log_max = std::max(log_max, likelihood_field.logLikelihoodClamped(i, j));
+  const double normalizer = log_max > log_min ? 1. / (log_max - log_min) : 0.;
+  Level& finest = levels_[0];
+  finest.offset = 0;
+  finest.rows   = h;
+  finest.cols   = w;
+  finest.data.resize(static_cast<size_t>(h) * w);
+#pragma omp parallel for default(shared)
+  for (int i = 0; i < h; ++i)
+    for (int j = 0; j < w; ++j)
+      finest.data[static_cast<size_t>(i) * w + j] =
+          (likelihood_field.logLikelihoodClamped(i, j) - log_min) * normalizer;
+  // Coarser levels: the block of level k is made of four blocks of level
+  // k - 1.
+  for (int k = 1; k < numLevels(); ++k) {
+    const int half = 1 << (k - 1);
+    Level& level   = levels_[k];
+    level.offset   = 2 * half - 1;
+    level.rows     = h + level.offset;
+    level.cols     = w + level.offset;
+    level.data.resize(static_cast<size_t>(level.rows) * level.cols);
+#pragma omp parallel for default(shared)
+    for (int r = 0; r < level.rows; ++r) {
+      const int i = r - level.offset;
+      for (int c = 0; c < level.cols; ++c) {
+        const int j = c - level.offset;
+        const float top =
+            std::max(score(k - 1, i, j), score(k - 1, i, j + half));
+        const float bottom = std::max(
+            score(k - 1, i + half, j), score(k - 1, i + half, j + half));
+        level.data[static_cast<size_t>(r) * level.cols + c] =
+            std::max(top, bottom);
+      }
+    }
+  }
+}
+
+LikelihoodFieldPyramid::Params LikelihoodFieldPyramid::Params::defaultParams() {
+  Params params;
+  params.num_levels = 7;
+  return params;
+}
+
+}  // namespace squirrel_2d_localizer
@@ -29,6 +29,10 @@
 #include "squirrel_2d_localizer/localizer.h"
 #include "squirrel_2d_localizer/resampling.h"
 
+#include <squirrel_threading/tracing.h>
+
+#include <algorithm>
+#include <cmath>
 #include <random>
 #include <thread>
 #include <utility>
@@ -44,43 +48,205 @@ void Localizer::initialize(
   likelihood_field_ = std::move(likelihood_field);
   laser_model_      = std::move(laser_model);
   motion_model_     = std::move(motion_model);
+  motion_model_->seed(
+      random_numbers::streamSeed(seed_, random_numbers::Stream::MOTION));
+  // Index the free space for global localization.
+  indexFreeCells();
+  refinement_pyramid_ = buildRefinementPyramid(*map_, *likelihood_field_);
+}
+
+void Localizer::seed(uint64_t seed) {
+  std::unique_lock<std::mutex> map_lock(map_mtx_);
+  std::unique_lock<std::mutex> lock(mtx_);
+  using random_numbers::Stream;
+  seed_ = seed;
+  resampler_.seed(random_numbers::streamSeed(seed, Stream::RESAMPLING));
+  init_rnd_eng_ = random_numbers::streamEngine(seed, Stream::INITIALIZATION);
+  global_rnd_eng_ =
+      random_numbers::streamEngine(seed, Stream::GLOBAL_LOCALIZATION);
+  if (motion_model_)
+    motion_model_->seed(random_numbers::streamSeed(seed, Stream::MOTION));
+}
+
+void Localizer::prefetchLikelihoodField() {
+  if (!likelihood_field_->tiled() || particles_.empty())
+    return;
+  const double range = laser_model_->params().range_max;
+  const auto x = std::minmax_element(particles_.x.begin(), particles_.x.end());
+  const auto y = std::minmax_element(particles_.y.begin(), particles_.y.end());
+  // Rows grow downwards, i.e. from the largest y.
+  int row0, row1, col0, col1;
+  map_->pointToIndices(
+      EndPoint2d(*x.first - range, *y.second + range), &row0, &col0);
+  map_->pointToIndices(
+      EndPoint2d(*x.second + range, *y.first - range), &row1, &col1);
+  likelihood_field_->prefetch(row0, row1, col0, col1);
+}
+
+void Localizer::indexFreeCells() {
+  free_cells_.clear();
+  const int h = map_->params().height;
+  const int w = map_->params().width;
+  for (int i = 0; i < h; ++i)
+    for (int j = 0; j < w; ++j)
+      if (!map_->unknown(i, j) &&
+          map_->at(i, j) <= params_.free_space_max_occupancy)
+        free_cells_.push_back(i * w + j);
 }
 
 void Localizer::resetPose(const Pose2d& init_pose) {
   std::unique_lock<std::mutex> lock(mtx_);
-  std::mt19937 rnd_eng(std::rand());
+  std::mt19937_64& rnd_eng = init_rnd_eng_;
   std::normal_distribution<double> randn(0., 1.);
   if (!particles_.empty())
     particles_.clear();
   particles_.reserve(params_.num_particles);
-  particles_.emplace_back(init_pose, 1.);
+  particles_.push_back(init_pose, 1.);
   for (size_t i = 1; i < params_.num_particles; ++i) {
     const double x = init_pose[0] + params_.init_stddev_x * randn(rnd_eng);
     const double y = init_pose[1] + params_.init_stddev_y * randn(rnd_eng);
     const double a = init_pose[2] + params_.init_stddev_a * randn(rnd_eng);
-    particles_.emplace_back(Pose2d(x, y, a), 0.);
+    particles_.push_back(Pose2d(x, y, a), 0.);
   }
   pose_       = init_pose;
-  covariance_ = Eigen::Matrix3d();
+  covariance_ = Eigen::Matrix3d::Zero();
   covariance_(0, 0) = params_.init_stddev_x;
   covariance_(1, 1) = params_.init_stddev_y;
   covariance_(2, 2) = params_.init_stddev_a;
   // reset cummulative motion
   cum_lin_motion_ = 0.;
   cum_ang_motion_ = 0.;
+  publishSnapshot();
 }
 
 void Localizer::resetParticles(const std::vector<Particle>& particles) {
   std::unique_lock<std::mutex> lock(mtx_);
   // Reset particle set.
-  if (!particles_.empty())
-    particles_.clear();
-  particles_ = particles;
+  particles_.fromParticles(particles);
   // Update pose and covariance.
   particles::computeMeanAndCovariance(particles_, &pose_, &covariance_);
   // reset cummulative motion.
   cum_lin_motion_ = 0.;
   cum_ang_motion_ = 0.;
+  publishSnapshot();
+}
+
+bool Localizer::globalLocalization(const std::vector<float>& scan) {
+  if (params_.branch_and_bound_relocalization && !scan.empty() &&
+      relocalize(scan))
+    return true;
+  std::unique_lock<std::mutex> map_lock(map_mtx_);
+  if (free_cells_.empty())
+    return false;
+  const int nparticles = params_.num_particles;
+  const int oversampling =
+      scan.empty() ? 1 : std::max(1, params_.global_localization_oversampling);
+  // Sample the candidates uniformly over the free cells.
+  const int w      = map_->params().width;
+  const double res = map_->params().resolution;
+  std::mt19937_64& rnd_eng = global_rnd_eng_;
+  std::uniform_int_distribution<size_t> rand_cell(0, free_cells_.size() - 1);
+  std::uniform_real_distribution<double> rand_offset(-0.5 * res, 0.5 * res),
+      rand_a(-M_PI, M_PI);
+  std::vector<Particle> candidates;
+  candidates.reserve(nparticles * oversampling);
+  for (int k = 0; k < nparticles * oversampling; ++k) {
+    const int cell = free_cells_[rand_cell(rnd_eng)];
+    EndPoint2d e;
+    map_->indicesToPoint(cell / w, cell % w, &e);
+    const Pose2d candidate_pose(
+        e[0] + rand_offset(rnd_eng), e[1] + rand_offset(rnd_eng),
+        rand_a(rnd_eng));
+    candidates.emplace_back(candidate_pose, 1. / nparticles);
+  }
+  // Weight the candidates and keep the best ones.
+  if (oversampling > 1) {
+    laser_model_->computeParticlesLikelihood(
+        *map_, *likelihood_field_, scan, &candidates);
+    std::nth_element(
+        candidates.begin(), candidates.begin() + nparticles, candidates.end(),
+        [](const Particle& lhs, const Particle& rhs) {
+          return lhs.weight > rhs.weight;
+        });
+    candidates.resize(nparticles);
+    particles::normalizeWeights(&candidates);
+  }
+  resetParticles(candidates);
+  return true;
+}
+
+bool Localizer::relocalize(const std::vector<float>& scan) {
+  std::unique_lock<std::mutex> map_lock(map_mtx_);
+  if (!pyramid_ ||
+      pyramid_->params().num_levels != params_.pyramid.num_levels) {
+    pyramid_.reset(new LikelihoodFieldPyramid(params_.pyramid));
+    pyramid_->initialize(*map_, *likelihood_field_);
+  }
+  EndPoints2f endpoints;
+  laser_model_->computeEndPoints(scan, &endpoints);
+  Pose2d best_pose;
+  double best_score;
+  const BranchAndBoundMatcher matcher(params_.matcher);
+  if (!matcher.match(*map_, *pyramid_, endpoints, &best_pose, &best_score))
+    return false;
+  // Seed the particles around the match.
+  std::mt19937_64& rnd_eng = global_rnd_eng_;
+  std::normal_distribution<double> randn(0., 1.);
+  std::vector<Particle> new_particles;
+  new_particles.reserve(params_.num_particles);
+  new_particles.emplace_back(best_pose, 1. / params_.num_particles);
+  for (int i = 1; i < params_.num_particles; ++i) {
+    const double x = best_pose[0] + params_.init_stddev_x * randn(rnd_eng);
+    const double y = best_pose[1] + params_.init_stddev_y * randn(rnd_eng);
+    const double a = best_pose[2] + params_.init_stddev_a * randn(rnd_eng);
+    new_particles.emplace_back(Pose2d(x, y, a), 1. / params_.num_particles);
+  }
+  resetParticles(new_particles);
+  return true;
+}
+
+bool Localizer::recoverAround(
+    const Pose2d& pose, const std::vector<float>& scan) {
+  std::unique_lock<std::mutex> map_lock(map_mtx_);
+  std::vector<Particle> candidates(*particles());
+  const size_t nparticles = candidates.size();
+  if (scan.empty() || nparticles == 0)
+    return false;
+  // Sample the candidates uniformly over the free cells of the region.
+  std::mt19937_64& rnd_eng = global_rnd_eng_;
+  std::uniform_real_distribution<double> rand_unit(0., 1.),
+      rand_a(-params_.recovery_radius_a, params_.recovery_radius_a);
+  const int ninjected = params_.recovery_num_particles;
+  for (int k = 0, trials = 0; k < ninjected && trials < 10 * ninjected;
+       ++trials) {
+    const double r =
+        params_.recovery_radius_xy * std::sqrt(rand_unit(rnd_eng));
+    const double t = 2. * M_PI * rand_unit(rnd_eng);
+    const Pose2d candidate_pose(
+        pose[0] + r * std::cos(t), pose[1] + r * std::sin(t),
+        angles::normalize_angle(pose[2] + rand_a(rnd_eng)));
+    int i, j;
+    map_->pointToIndices(candidate_pose.translation(), &i, &j);
+    if (!map_->inside(i, j) || map_->unknown(i, j) ||
+        map_->at(i, j) > params_.free_space_max_occupancy)
+      continue;
+    candidates.emplace_back(candidate_pose, 0.);
+    ++k;
+  }
+  if (candidates.size() == nparticles)
+    return false;
+  // Weight the candidates and keep the best ones.
+  laser_model_->computeParticlesLikelihood(
+      *map_, *likelihood_field_, scan, &candidates);
+  std::nth_element(
+      candidates.begin(), candidates.begin() + nparticles, candidates.end(),
+      [](const Particle& lhs, const Particle& rhs) {
+        return lhs.weight > rhs.weight;
+      });
+  candidates.resize(nparticles);
+  particles::normalizeWeights(&candidates);
+  resetParticles(candidates);
+  return true;
 }
 
 bool Localizer::updateNumParticles(int new_particles_num) {
@@ -89,15 +255,67 @@ bool Localizer::updateNumParticles(int new_particles_num) {
   if (particles_.empty() || nparticles == new_particles_num)
     return true;
   const int nparticles_diff = std::abs(nparticles - new_particles_num);
+  std::vector<Particle> particles;
+  particles_.toParticles(&particles);
   // Add new particles.
   if (nparticles < new_particles_num)
-    resampling::uniformUpsample(nparticles_diff, &particles_);
+    resampling::uniformUpsample(nparticles_diff, &init_rnd_eng_, &particles);
   // Remove random particles particles.
   if (nparticles > new_particles_num)
-    resampling::uniformDownsample(nparticles_diff, &particles_);
+    resampling::uniformDownsample(
+        nparticles_diff, &init_rnd_eng_, &particles);
+  particles_.fromParticles(particles);
+  publishSnapshot();
+  return true;
+}
+
+bool Localizer::updateMap(const GridMap::Patch& patch) {
+  std::unique_lock<std::mutex> map_lock(map_mtx_);
+  LatentModelLikelihoodField::Update update;
+  if (!likelihood_field_->computeUpdate(*map_, patch, &update))
+    return false;
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    map_->update(patch);
+    likelihood_field_->applyUpdate(update);
+  }
+  // The refinement pyramid is rebuilt without the update guard, the map is
+  // only changed under the map guard. Until it is swapped in, the refinement
+  // matches the scans against the previous map.
+  std::unique_ptr<LikelihoodFieldPyramid> refinement_pyramid =
+      buildRefinementPyramid(*map_, *likelihood_field_);
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    refinement_pyramid_.swap(refinement_pyramid);
+  }
+  // Global localization structures are only read under the map guard.
+  indexFreeCells();
+  pyramid_.reset();
   return true;
 }
 
+void Localizer::switchMap(
+    std::unique_ptr<GridMap>* map,
+    std::unique_ptr<LatentModelLikelihoodField>* likelihood_field,
+    const Pose2d& init_pose) {
+  {
+    std::unique_lock<std::mutex> map_lock(map_mtx_);
+    // The refinement pyramid of the new map is built before taking the
+    // update guard.
+    std::unique_ptr<LikelihoodFieldPyramid> refinement_pyramid =
+        buildRefinementPyramid(**map, **likelihood_field);
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      map_.swap(*map);
+      likelihood_field_.swap(*likelihood_field);
+      refinement_pyramid_.swap(refinement_pyramid);
+    }
+    indexFreeCells();
+    pyramid_.reset();
+  }
+  resetPose(init_pose);
+}
+
 bool Localizer::updateFilter(
     const Transform2d& motion, const std::vector<float>& scan,
     const Transform2d& extra_correction, bool force_update) {
@@ -105,24 +323,142 @@ bool Localizer::updateFilter(
   cum_lin_motion_ += motion.translation().norm();
   cum_ang_motion_ += std::abs(angles::normalize_angle(motion[2]));
   if (cum_lin_motion_ < params_.min_lin_update &&
-      cum_ang_motion_ < params_.min_ang_update && !force_update)
+      cum_ang_motion_ < params_.min_ang_update && !force_update) {
+    timings_.num_skipped_updates.fetch_add(1, std::memory_order_relaxed);
     return false;
-  motion_model_->sampleProposal(motion, &particles_);
-  laser_model_->computeParticlesLikelihood(
-      *map_, *likelihood_field_, scan, &particles_);
-  resampling::importanceSampling(&particles_);
-  particles::computeMeanAndCovariance(particles_, &pose_, &covariance_);
+  }
+  ScopedTimer update_timer(&timings_.update);
+  SQUIRREL_TRACE_SCOPE("localizer_2d/update_filter");
+  {
+    ScopedTimer timer(&timings_.proposal);
+    SQUIRREL_TRACE_SCOPE("localizer_2d/proposal");
+    motion_model_->sampleProposal(motion, &particles_);
+  }
+  {
+    ScopedTimer timer(&timings_.likelihood);
+    SQUIRREL_TRACE_SCOPE("localizer_2d/likelihood");
+    prefetchLikelihoodField();
+    laser_model_->computeParticlesLikelihood(
+        *map_, *likelihood_field_, scan, &particles_, &health_);
+  }
+  {
+    ScopedTimer timer(&timings_.resampling);
+    SQUIRREL_TRACE_SCOPE("localizer_2d/resampling");
+    if (params_.adaptive_sampling)
+      resampler_.kldSampling(params_.kld_sampling, &particles_);
+    else
+      resampler_.importanceSampling(params_.resampling_scheme, &particles_);
+  }
+  {
+    ScopedTimer timer(&timings_.statistics);
+    SQUIRREL_TRACE_SCOPE("localizer_2d/statistics");
+    particles::computeMeanAndCovariance(particles_, &pose_, &covariance_);
+  }
+  if (params_.scan_matching_refinement) {
+    ScopedTimer timer(&timings_.refinement);
+    SQUIRREL_TRACE_SCOPE("localizer_2d/refinement");
+    if (refineEstimate(scan))
+      timings_.num_refinements.fetch_add(1, std::memory_order_relaxed);
+  }
   pose_ *= extra_correction;
   cum_lin_motion_ = 0.;
   cum_ang_motion_ = 0.;
+  publishSnapshot();
+  timings_.num_updates.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+std::unique_ptr<LikelihoodFieldPyramid> Localizer::buildRefinementPyramid(
+    const GridMap& map,
+    const LatentModelLikelihoodField& likelihood_field) const {
+  std::unique_ptr<LikelihoodFieldPyramid> pyramid;
+  if (!params_.scan_matching_refinement)
+    return pyramid;
+  LikelihoodFieldPyramid::Params pyramid_params;
+  pyramid_params.num_levels = params_.refinement_pyramid_levels;
+  pyramid.reset(new LikelihoodFieldPyramid(pyramid_params));
+  pyramid->initialize(map, likelihood_field);
+  return pyramid;
+}
+
+bool Localizer::refineEstimate(const std::vector<float>& scan) {
+  if (!refinement_pyramid_ || refinement_pyramid_->params().num_levels !=
+                                  params_.refinement_pyramid_levels)
+    refinement_pyramid_ = buildRefinementPyramid(*map_, *likelihood_field_);
+  EndPoints2f endpoints;
+  laser_model_->computeEndPoints(scan, &endpoints);
+  BranchAndBoundMatcher::Params matcher_params = params_.matcher;
+  matcher_params.min_score = params_.refinement_min_score;
+  const BranchAndBoundMatcher matcher(matcher_params);
+  Pose2d match;
+  double score;
+  if (!matcher.matchInWindow(
+          *map_, *refinement_pyramid_, endpoints, pose_,
+          params_.refinement_lin_window, params_.refinement_ang_window, &match,
+          &score))
+    return false;
+  // Kalman update of the estimate with the match as a direct measurement.
+  Eigen::Vector3d innovation = match.toVector() - pose_.toVector();
+  innovation[2] = angles::normalize_angle(innovation[2]);
+  Eigen::Matrix3d R = Eigen::Matrix3d::Zero();
+  R(0, 0)           = std::pow(params_.refinement_stddev_xy, 2);
+  R(1, 1)           = std::pow(params_.refinement_stddev_xy, 2);
+  R(2, 2)           = std::pow(params_.refinement_stddev_a, 2);
+  const Eigen::Matrix3d K = covariance_ * (covariance_ + R).inverse();
+  Eigen::Vector3d refined = pose_.toVector() + K * innovation;
+  refined[2]              = angles::normalize_angle(refined[2]);
+  pose_.fromVector(refined);
+  covariance_ = (Eigen::Matrix3d::Identity() - K) * covariance_;
+  covariance_ = 0.5 * (covariance_ + covariance_.transpose()).eval();
   return true;
 }
 
+std::shared_ptr<const std::vector<Particle>> Localizer::particles() const {
+  std::unique_lock<std::mutex> lock(snapshot_mtx_);
+  if (!particles_snapshot_)
+    return std::make_shared<const std::vector<Particle>>();
+  return particles_snapshot_;
+}
+
+void Localizer::publishSnapshot() {
+  Estimate estimate;
+  estimate.pose       = pose_;
+  estimate.covariance = covariance_;
+  estimate.health     = health_;
+  estimate_.store(estimate);
+  // Copy the particles outside of the snapshot lock, which is only held to
+  // swap the pointers.
+  std::shared_ptr<std::vector<Particle>> particles =
+      std::make_shared<std::vector<Particle>>();
+  particles_.toParticles(particles.get());
+  std::shared_ptr<const std::vector<Particle>> snapshot = std::move(particles);
+  std::unique_lock<std::mutex> lock(snapshot_mtx_);
+  particles_snapshot_.swap(snapshot);
+}
+
 Localizer::Params Localizer::Params::defaultParams() {
   Params params;
-  params.num_particles  = 250;
-  params.min_lin_update = 1.0;
-  params.min_ang_update = 1.0;
+  params.num_particles     = 250;
+  params.min_lin_update    = 1.0;
+  params.min_ang_update    = 1.0;
+  params.resampling_scheme = resampling::Scheme::SYSTEMATIC;
+  params.adaptive_sampling = false;
+  params.kld_sampling      = resampling::KLDSamplingParams::defaultParams();
+  params.free_space_max_occupancy         = 0.25;
+  params.global_localization_oversampling = 1;
+  params.branch_and_bound_relocalization  = false;
+  params.pyramid = LikelihoodFieldPyramid::Params::defaultParams();
+  params.matcher = BranchAndBoundMatcher::Params::defaultParams();
+  params.scan_matching_refinement  = false;
+  params.refinement_pyramid_levels = 3;
+  params.refinement_lin_window     = 0.2;
+  params.refinement_ang_window     = 0.1;
+  params.refinement_min_score      = 0.5;
+  params.refinement_stddev_xy      = 0.02;
+  params.refinement_stddev_a       = 0.01;
+  params.recovery_radius_xy        = 1.0;
+  params.recovery_radius_a         = 0.5 * M_PI;
+  params.recovery_num_particles    = 1000;
   return params;
 }
 
@@ -33,15 +33,23 @@
 
 #include <ros/package.h>
 
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <geometry_msgs/PoseArray.h>
 #include <nav_msgs/GetMap.h>
+#include <std_msgs/Float32MultiArray.h>
+#include <std_msgs/Int32.h>
+#include <std_msgs/UInt64.h>
 
 #include <angles/angles.h>
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <random>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 
 namespace squirrel_2d_localizer {
 
@@ -49,7 +57,18 @@ LocalizerROS::LocalizerROS()
     : node_name_(ros::this_node::getName()),
       update_laser_params_(true),
       initial_localization_counter_(0),
-      mcl_dsrv_(nullptr) {
+      mcl_dsrv_(nullptr),
+      processed_scans_(0),
+      dropped_scans_(0),
+      last_num_updates_(0),
+      last_num_skipped_updates_(0),
+      last_num_refinements_(0),
+      last_dropped_scans_(0),
+      last_num_recoveries_(0),
+      degraded_updates_(0),
+      has_good_pose_(false),
+      degraded_(false),
+      num_recoveries_(0) {
   ros::NodeHandle nh("~"), gnh;
   // frames.
   nh.param<std::string>("map_frame", map_frame_id_, "map");
@@ -64,8 +83,66 @@ LocalizerROS::LocalizerROS()
   nh.param<double>("init_pose_x", init_x_, 0.);
   nh.param<double>("init_pose_y", init_y_, 0.);
   nh.param<double>("init_pose_a", init_a_, 0.);
+  // filter pipeline.
+  int scan_buffer_size;
+  nh.param<bool>("pipelined", pipelined_, false);
+  nh.param<int>("scan_buffer_size", scan_buffer_size, 4);
+  // random streams, and replay of the bags.
+  int seed;
+  nh.param<bool>("replay", replay_, false);
+  nh.param<int>("seed", seed, replay_ ? 0 : -1);
+  if (replay_ && pipelined_) {
+    ROS_WARN_STREAM(
+        node_name_ << ": The pipeline drops scans, disabled in replay mode.");
+    pipelined_ = false;
+  }
+  if (replay_ && use_last_pose_) {
+    ROS_WARN_STREAM(
+        node_name_ << ": The last pose changes across runs, disabled in "
+                      "replay mode.");
+    use_last_pose_ = false;
+  }
+  // diagnostics.
+  nh.param<double>("diagnostics_period", diagnostics_period_, 1.);
+  trace_publisher_.reset(new squirrel_threading::tracing::TracePublisher(nh));
+  // health monitor.
+  nh.param<double>(
+      "health_min_inlier_fraction", health_min_inlier_fraction_, 0.5);
+  nh.param<double>(
+      "health_min_weight_entropy", health_min_weight_entropy_, 0.1);
+  nh.param<int>("recovery_degraded_updates", recovery_degraded_updates_, 10);
+  // map updates.
+  nh.param<bool>("map_updates", map_updates_, false);
+  // floors.
+  MapRegistry::Params registry_params = MapRegistry::Params::defaultParams();
+  nh.param<std::string>("map_name", active_map_, "default");
+  nh.param<int>(
+      "max_resident_maps", registry_params.max_resident_maps,
+      registry_params.max_resident_maps);
+  // particle set publishing.
+  std::string particles_decimation;
+  nh.param<int>("particles_max_size", particles_max_size_, 0);
+  nh.param<double>("particles_max_rate", particles_max_rate_, 0.);
+  nh.param<std::string>("particles_decimation", particles_decimation, "top_k");
+  nh.param<bool>("compact_particles", compact_particles_, false);
+  if (particles_decimation == "stratified") {
+    particles_decimation_ = Decimation::STRATIFIED;
+  } else {
+    if (particles_decimation != "top_k")
+      ROS_WARN_STREAM(
+          node_name_ << ": Unknown particles_decimation \""
+                     << particles_decimation << "\", using \"top_k\".");
+    particles_decimation_ = Decimation::TOP_K;
+  }
   // localizer parameters.
   localizer_.reset(new Localizer);
+  if (seed >= 0)
+    localizer_->seed(seed);
+  particles_rnd_eng_ = random_numbers::streamEngine(
+      localizer_->seed(), random_numbers::Stream::DECIMATION);
+  ROS_INFO_STREAM(
+      node_name_ << ": Random seed " << localizer_->seed()
+                 << (replay_ ? ", replay mode." : "."));
   ros::NodeHandle loc_nh("~/mcl");
   mcl_dsrv_.reset(
       new dynamic_reconfigure::Server<MonteCarloLocalizationConfig>(loc_nh));
@@ -107,7 +184,27 @@ LocalizerROS::LocalizerROS()
   std::unique_ptr<GridMap> grid_map(new GridMap(map_params));
   grid_map->initialize(get_map.response.map.data);
   likelihood_field->initialize(*grid_map);
-  ROS_INFO_STREAM(node_name_ << ": Initialized LikelihoodField.");
+  ROS_INFO_STREAM(
+      node_name_ << ": Initialized LikelihoodField"
+                 << (likelihood_field->fromCache() ? " from cache." : "."));
+  // Register the other floors, their fields share the parameters.
+  map_registry_.reset(
+      new MapRegistry(registry_params, likelihood_field->params()));
+  XmlRpc::XmlRpcValue maps;
+  if (nh.getParam("maps", maps) &&
+      maps.getType() == XmlRpc::XmlRpcValue::TypeStruct) {
+    for (auto it = maps.begin(); it != maps.end(); ++it) {
+      ros::NodeHandle floor_nh(nh, "maps/" + it->first);
+      std::string map_file, cache_file;
+      if (!floor_nh.getParam("map_file", map_file)) {
+        ROS_WARN_STREAM(
+            node_name_ << ": No map_file for map \"" << it->first << "\".");
+        continue;
+      }
+      floor_nh.param<std::string>("cache_file", cache_file, "");
+      map_registry_->addMap(it->first, map_file, cache_file);
+    }
+  }
   // initialize objects;
   localizer_->initialize(grid_map, likelihood_field, laser_model, motion_model);
   while (!lookupOdometry(ros::Time(0), ros::Duration(1.0), &tf_o2r_))
@@ -120,22 +217,67 @@ LocalizerROS::LocalizerROS()
     lp_nh.param<double>("a", init_a_, 0.);
   }
   localizer_->resetPose(Pose2d(init_x_, init_y_, init_a_));
+  updateMapToOdom();
   // Advertise publishers, subscribers and services.
-  scan_sub_     = gnh.subscribe("/scan", 1, &LocalizerROS::laserCallback, this);
+  // In replay mode every scan of the bag is processed, in order.
+  const int scan_queue_size = replay_ ? 1000 : 1;
+  scan_sub_                 = gnh.subscribe(
+      "/scan", scan_queue_size, &LocalizerROS::laserCallback, this);
   initpose_sub_ = gnh.subscribe(
       "/initialpose", 1, &LocalizerROS::initialPoseCallback, this);
   pose_pub_ = nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("pose", 1);
   particles_pub_ = nh.advertise<geometry_msgs::PoseArray>("particles", 1);
+  num_particles_pub_ = nh.advertise<std_msgs::Int32>("num_particles", 1);
+  if (compact_particles_)
+    compact_particles_pub_ =
+        nh.advertise<std_msgs::Float32MultiArray>("particles_compact", 1);
+  processed_scans_pub_ = nh.advertise<std_msgs::UInt64>("processed_scans", 1);
+  dropped_scans_pub_   = nh.advertise<std_msgs::UInt64>("dropped_scans", 1);
+  health_pub_ = nh.advertise<squirrel_2d_localizer::LocalizationHealth>(
+      "health", 1);
+  diagnostics_pub_ =
+      gnh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
   gloc_srv_      = nh.advertiseService(
       "globalLocalization", &LocalizerROS::globalLocalizationCallback, this);
+  switch_map_srv_ =
+      nh.advertiseService("switch_map", &LocalizerROS::switchMapCallback, this);
+  preload_map_sub_ =
+      nh.subscribe("preload_map", 1, &LocalizerROS::preloadMapCallback, this);
+  active_map_pub_ = nh.advertise<std_msgs::String>("active_map", 1, true);
   // Broadcast initial state.
   const ros::Time now = ros::Time::now();
   publishTransform(now);
-  publishParticles(now);
+  publishParticles(now, true);
   publishPoseWithCovariance(now);
+  std_msgs::String active_map_msg;
+  active_map_msg.data = active_map_;
+  active_map_pub_.publish(active_map_msg);
+  last_diagnostics_stamp_ = now;
+  // Apply the map updates on a dedicated thread.
+  if (map_updates_) {
+    ros::NodeHandle map_nh;
+    map_nh.setCallbackQueue(&map_queue_);
+    map_sub_ = map_nh.subscribe("/map", 1, &LocalizerROS::mapCallback, this);
+    map_update_sub_ = map_nh.subscribe(
+        "/map_updates", 10, &LocalizerROS::mapUpdateCallback, this);
+    map_spinner_.reset(new ros::AsyncSpinner(1, &map_queue_));
+    map_spinner_->start();
+  }
+  // Run the filter updates on a dedicated thread.
+  if (pipelined_) {
+    scan_buffer_.reset(
+        new RingBuffer<sensor_msgs::LaserScan::ConstPtr>(scan_buffer_size));
+    filter_thread_ = std::thread(&LocalizerROS::filterLoop, this);
+  }
 }
 
 LocalizerROS::~LocalizerROS() {
+  if (map_spinner_)
+    map_spinner_->stop();
+  if (filter_thread_.joinable()) {
+    scan_buffer_->close();
+    filter_thread_.join();
+  }
   const std::string last_pose_filename =
       ros::package::getPath("squirrel_2d_localizer") +
       std::string("/config/last_pose.yaml");
@@ -156,7 +298,11 @@ void LocalizerROS::spin(double hz) {
   for (ros::Rate lr(hz); ros::ok(); lr.sleep()) {
     try {
       ros::spinOnce();
-      publishTransform(ros::Time::now());
+      const ros::Time now = ros::Time::now();
+      publishTransform(now);
+      if (diagnostics_period_ > 0. &&
+          (now - last_diagnostics_stamp_).toSec() >= diagnostics_period_)
+        publishDiagnostics(now);
     } catch (const std::runtime_error& err) {
       ROS_ERROR_STREAM(node_name_ << ": " << err.what());
     }
@@ -170,13 +316,42 @@ void LocalizerROS::reconfigureCallback(
   localizer_->params().init_stddev_x  = config.init_stddev_x;
   localizer_->params().init_stddev_y  = config.init_stddev_y;
   localizer_->params().init_stddev_a  = config.init_stddev_a;
+  // resampling.
+  localizer_->params().resampling_scheme =
+      static_cast<resampling::Scheme>(config.resampling_scheme);
+  resampling::KLDSamplingParams& kld_params = localizer_->params().kld_sampling;
+  localizer_->params().adaptive_sampling    = config.adaptive_sampling;
+  kld_params.min_particles                  = config.min_particles;
+  kld_params.max_particles                  = config.max_particles;
+  kld_params.error_bound                    = config.kld_error_bound;
+  kld_params.upper_quantile                 = config.kld_upper_quantile;
+  kld_params.bin_size_xy                    = config.kld_bin_size_xy;
+  kld_params.bin_size_a                     = config.kld_bin_size_a;
+  localizer_->params().global_localization_oversampling =
+      config.global_localization_oversampling;
+  localizer_->params().branch_and_bound_relocalization =
+      config.branch_and_bound_relocalization;
+  localizer_->params().pyramid.num_levels   = config.pyramid_levels;
+  localizer_->params().matcher.angular_step = config.matcher_angular_step;
+  localizer_->params().matcher.min_score    = config.matcher_min_score;
+  localizer_->params().scan_matching_refinement =
+      config.scan_matching_refinement;
+  localizer_->params().refinement_pyramid_levels =
+      config.refinement_pyramid_levels;
+  localizer_->params().refinement_lin_window = config.refinement_lin_window;
+  localizer_->params().refinement_ang_window = config.refinement_ang_window;
+  localizer_->params().refinement_min_score  = config.refinement_min_score;
+  localizer_->params().refinement_stddev_xy  = config.refinement_stddev_xy;
+  localizer_->params().refinement_stddev_a   = config.refinement_stddev_a;
+  localizer_->params().recovery_radius_xy    = config.recovery_radius_xy;
+  localizer_->params().recovery_radius_a     = config.recovery_radius_a;
+  localizer_->params().recovery_num_particles = config.recovery_num_particles;
   if (localizer_->updateNumParticles(config.num_particles))
     localizer_->params().num_particles = config.num_particles;
 }
 
 void LocalizerROS::laserCallback(const sensor_msgs::LaserScan::ConstPtr& msg) {
   ROS_INFO_STREAM_ONCE(node_name_ << ": Subscribing to laser scan.");
-  ros::Time scan_time = msg->header.stamp;
   // update laser paramters from actual scan msg,
   if (update_laser_params_) {
     tf::StampedTransform tf_r2l;
@@ -198,20 +373,50 @@ void LocalizerROS::laserCallback(const sensor_msgs::LaserScan::ConstPtr& msg) {
     update_laser_params_ = false;
     return;
   }
+  // In pipelined mode, leave the update to the filter thread.
+  if (pipelined_) {
+    if (!scan_buffer_->push(msg))
+      ++dropped_scans_;
+    return;
+  }
+  processScan(msg);
+}
+
+void LocalizerROS::filterLoop() {
+  sensor_msgs::LaserScan::ConstPtr msg;
+  while (scan_buffer_->pop(&msg))
+    processScan(msg);
+}
+
+void LocalizerROS::processScan(const sensor_msgs::LaserScan::ConstPtr& msg) {
+  const ros::Time& scan_time = msg->header.stamp;
+  ScopedTimer scan_timer(&scan_latency_);
   // update filter.
   std::unique_lock<std::mutex> lock(update_mtx_);
+  last_scan_ = msg;
   tf::StampedTransform tf_o2r_new;
-  if (!lookupOdometry(scan_time, ros::Duration(0.05), &tf_o2r_new))
-    return;
+  {
+    ScopedTimer timer(&tf_lookup_latency_);
+    if (!lookupOdometry(scan_time, ros::Duration(0.05), &tf_o2r_new))
+      return;
+  }
   const Pose2d& motion =
       ros_conversions::fromTFMsgTo<Pose2d>(tf_o2r_.inverse() * tf_o2r_new);
   const Pose2d& correction = twist_correction_.correction(scan_time);
   const bool force_update  = initial_localization_counter_++ < 5;
   if (localizer_->updateFilter(motion, msg->ranges, correction, force_update)) {
     tf_o2r_ = tf_o2r_new;
+    updateMapToOdom();
     publishParticles(scan_time);
     publishPoseWithCovariance(scan_time);
+    monitorHealth(scan_time, msg->ranges);
   }
+  // Publish the pipeline counters.
+  std_msgs::UInt64 processed_scans_msg, dropped_scans_msg;
+  processed_scans_msg.data = ++processed_scans_;
+  dropped_scans_msg.data   = dropped_scans_;
+  processed_scans_pub_.publish(processed_scans_msg);
+  dropped_scans_pub_.publish(dropped_scans_msg);
 }
 
 void LocalizerROS::initialPoseCallback(
@@ -220,51 +425,139 @@ void LocalizerROS::initialPoseCallback(
   while (!lookupOdometry(now = ros::Time::now(), ros::Duration(0.1), &tf_o2r_))
     ROS_WARN_STREAM(node_name_ << ": Trying to reinitialize odometry.");
   localizer_->resetPose(ros_conversions::fromROSMsgTo<Pose2d>(msg->pose.pose));
-  publishParticles(now);
+  updateMapToOdom();
+  publishParticles(now, true);
   publishPoseWithCovariance(now);
   initial_localization_counter_ = 0;
+  std::unique_lock<std::mutex> lock(update_mtx_);
+  resetHealth();
 }
 
 bool LocalizerROS::globalLocalizationCallback(
     squirrel_2d_localizer_msgs::GlobalLocalization::Request& req,
     squirrel_2d_localizer_msgs::GlobalLocalization::Response& res) {
-  // Get the gridmap size.
-  const auto gridmap = localizer_->gridMap();
-  double min_x, max_x, min_y, max_y;
-  gridmap->boundingBox(&min_x, &max_x, &min_y, &max_y);
-  // Create the sampler.
-  std::mt19937 rnd(std::rand());
-  std::uniform_real_distribution<double> rand_x(min_x, max_x),
-      rand_y(min_x, max_y), rand_a(-M_PI, M_PI);
+  // Use the last scan to select the best candidates, if any.
+  std::vector<float> scan;
+  {
+    std::unique_lock<std::mutex> lock(update_mtx_);
+    if (last_scan_ && !update_laser_params_)
+      scan = last_scan_->ranges;
+  }
   // Sample new particles.
-  const size_t nparticles = localizer_->params().num_particles;
-  std::vector<Particle> new_particles;
-  new_particles.reserve(nparticles);
   const ros::Time start = ros::Time::now();
-  for (int i, j; new_particles.size() < nparticles;) {
-    if (ros::Time::now() - start > req.timeout) {
-      res.sampling_time         = req.timeout;
-      res.num_sampled_particles = new_particles.size();
-      // Resampling timed out.
-      return false;
-    }
-    const Pose2d particle_pose(rand_x(rnd), rand_y(rnd), rand_a(rnd));
-    const double particle_weight = 1. / nparticles;
-    gridmap->pointToIndices(particle_pose.translation(), &i, &j);
-    if (gridmap->inside(i, j) && !gridmap->unknown(i, j) &&
-        gridmap->at(i, j) <= 0.25)
-      new_particles.emplace_back(particle_pose, particle_weight);
+  if (!localizer_->globalLocalization(scan)) {
+    res.sampling_time         = ros::Time::now() - start;
+    res.num_sampled_particles = 0;
+    // No free space to sample from.
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lock(update_mtx_);
+    updateMapToOdom();
+    resetHealth();
   }
   const ros::Time& now      = ros::Time::now();
   res.sampling_time         = now - start;
-  res.num_sampled_particles = nparticles;
-  // Reinitialize the localizer.
-  localizer_->resetParticles(new_particles);
-  publishParticles(now);
+  res.num_sampled_particles = localizer_->particles()->size();
+  publishParticles(now, true);
   // Resampling was successful.
   return true;
 }
 
+bool LocalizerROS::switchMapCallback(
+    squirrel_2d_localizer::SwitchMap::Request& req,
+    squirrel_2d_localizer::SwitchMap::Response& res) {
+  const ros::WallTime start = ros::WallTime::now();
+  const Pose2d init_pose =
+      ros_conversions::fromROSMsgTo<Pose2d>(req.initial_pose);
+  // Loaded here unless preloaded, before holding the update guard.
+  MapRegistry::Floor floor;
+  if (req.name != active_map_ && !map_registry_->acquire(req.name, &floor)) {
+    ROS_ERROR_STREAM(
+        node_name_ << ": Unable to load map \"" << req.name << "\".");
+    res.success = false;
+    return true;
+  }
+  ros::Time now;
+  {
+    std::unique_lock<std::mutex> lock(update_mtx_);
+    if (!lookupOdometry(now = ros::Time::now(), ros::Duration(0.1), &tf_o2r_))
+      ROS_WARN_STREAM(node_name_ << ": Using the last odometry.");
+    if (floor.map)
+      localizer_->switchMap(&floor.map, &floor.likelihood_field, init_pose);
+    else
+      localizer_->resetPose(init_pose);
+    updateMapToOdom();
+    initial_localization_counter_ = 0;
+    resetHealth();
+  }
+  // The previous floor is kept resident, as the most recently used.
+  if (floor.map) {
+    map_registry_->release(active_map_, &floor);
+    active_map_ = req.name;
+  }
+  std_msgs::String active_map_msg;
+  active_map_msg.data = active_map_;
+  active_map_pub_.publish(active_map_msg);
+  publishParticles(now, true);
+  publishPoseWithCovariance(now);
+  res.success     = true;
+  res.switch_time = ros::Duration((ros::WallTime::now() - start).toSec());
+  ROS_INFO(
+      "%s: Switched to map \"%s\" in %.1f ms.", node_name_.c_str(),
+      active_map_.c_str(), res.switch_time.toSec() * 1e3);
+  return true;
+}
+
+void LocalizerROS::preloadMapCallback(const std_msgs::String::ConstPtr& msg) {
+  const ros::WallTime start = ros::WallTime::now();
+  if (!map_registry_->preload(msg->data))
+    ROS_ERROR_STREAM(
+        node_name_ << ": Unable to preload map \"" << msg->data << "\".");
+  else
+    ROS_INFO(
+        "%s: Preloaded map \"%s\" in %.1f ms.", node_name_.c_str(),
+        msg->data.c_str(), (ros::WallTime::now() - start).toSec() * 1e3);
+}
+
+void LocalizerROS::mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& msg) {
+  const GridMap::Params& map_params = localizer_->gridMap()->params();
+  if (msg->info.width != map_params.width ||
+      msg->info.height != map_params.height ||
+      std::abs(msg->info.resolution - map_params.resolution) > 1e-6) {
+    ROS_WARN_STREAM(
+        node_name_ << ": Received a map of different size or resolution. "
+                   << "Restart the node to use it.");
+    return;
+  }
+  // Only the region that changed is updated.
+  GridMap::Patch patch;
+  if (localizer_->gridMap()->difference(msg->data, &patch))
+    updateMap(patch);
+}
+
+void LocalizerROS::mapUpdateCallback(
+    const map_msgs::OccupancyGridUpdate::ConstPtr& msg) {
+  GridMap::Patch patch;
+  patch.x      = msg->x;
+  patch.y      = msg->y;
+  patch.width  = msg->width;
+  patch.height = msg->height;
+  patch.data.assign(msg->data.begin(), msg->data.end());
+  if (patch.width > 0 &&
+      patch.data.size() == static_cast<size_t>(patch.width * patch.height))
+    updateMap(patch);
+}
+
+void LocalizerROS::updateMap(const GridMap::Patch& patch) {
+  const ros::WallTime start = ros::WallTime::now();
+  if (localizer_->updateMap(patch))
+    ROS_INFO(
+        "%s: Updated a %d x %d region of the map in %.1f ms.",
+        node_name_.c_str(), patch.height, patch.width,
+        (ros::WallTime::now() - start).toSec() * 1e3);
+}
+
 bool LocalizerROS::lookupOdometry(
     const ros::Time& stamp, const ros::Duration& timeout,
     tf::StampedTransform* tf_o2r) {
@@ -278,11 +571,64 @@ bool LocalizerROS::lookupOdometry(
   return true;
 }
 
+void LocalizerROS::updateMapToOdom() {
+  const tf::Transform tf_m2r =
+      ros_conversions::toTFMsgFrom<Pose2d>(localizer_->pose());
+  tf_m2o_.store(tf_m2r * tf_o2r_.inverse());
+}
+
+void LocalizerROS::monitorHealth(
+    const ros::Time& stamp, const std::vector<float>& scan) {
+  const Localizer::Estimate estimate = localizer_->estimate();
+  const LaserModel::Health& health   = estimate.health;
+  const bool degraded = health.nbeams > 0 &&
+                        (health.inlier_fraction < health_min_inlier_fraction_ ||
+                         health.weight_entropy < health_min_weight_entropy_);
+  if (!degraded) {
+    degraded_updates_ = 0;
+    has_good_pose_    = true;
+    last_good_pose_   = estimate.pose.toVector();
+  } else {
+    ++degraded_updates_;
+  }
+  degraded_ = degraded;
+  // Relocalize around the last good pose, rather than over the whole map.
+  if (degraded && has_good_pose_ && recovery_degraded_updates_ > 0 &&
+      degraded_updates_ >= recovery_degraded_updates_) {
+    ROS_WARN_STREAM(
+        node_name_ << ": Localization degraded for " << degraded_updates_
+                   << " updates (inliers " << health.inlier_fraction
+                   << ", entropy " << health.weight_entropy
+                   << "), relocalizing around the last good pose.");
+    if (localizer_->recoverAround(Pose2d(last_good_pose_), scan)) {
+      ++num_recoveries_;
+      updateMapToOdom();
+      publishParticles(stamp, true);
+      publishPoseWithCovariance(stamp);
+      initial_localization_counter_ = 0;
+    }
+    degraded_updates_ = 0;
+  }
+  squirrel_2d_localizer::LocalizationHealth msg;
+  msg.header.stamp     = stamp;
+  msg.header.frame_id  = map_frame_id_;
+  msg.inlier_fraction  = health.inlier_fraction;
+  msg.weight_entropy   = health.weight_entropy;
+  msg.degraded         = degraded;
+  msg.degraded_updates = degraded_updates_;
+  msg.num_recoveries   = num_recoveries_;
+  health_pub_.publish(msg);
+}
+
+void LocalizerROS::resetHealth() {
+  degraded_updates_ = 0;
+  has_good_pose_    = false;
+  degraded_         = false;
+}
+
 void LocalizerROS::publishTransform(const ros::Time& stamp) {
-  std::unique_lock<std::mutex> lock(update_mtx_);
-  tf::Transform tf_m2o,
-      tf_m2r = ros_conversions::toTFMsgFrom<Pose2d>(localizer_->pose());
-  tf_m2o     = tf_m2r * tf_o2r_.inverse();
+  // Never waits for the filter update.
+  const tf::Transform tf_m2o = tf_m2o_.load();
   tfb_.sendTransform(
       tf::StampedTransform(tf_m2o, stamp, map_frame_id_, odom_frame_id_));
   if (publish_extra_tf_)
@@ -290,21 +636,104 @@ void LocalizerROS::publishTransform(const ros::Time& stamp) {
         tf_m2o, stamp, extra_parent_frame_id_, extra_child_frame_id_));
 }
 
-void LocalizerROS::publishParticles(const ros::Time& stamp) {
-  const std::vector<Particle>& particles = localizer_->particles();
-  geometry_msgs::PoseArray msg;
-  msg.header.frame_id = map_frame_id_;
-  msg.header.stamp    = stamp;
-  msg.poses.reserve(particles.size());
-  for (size_t i = 0; i < particles.size(); ++i)
-    msg.poses.emplace_back(
-        ros_conversions::toROSMsgFrom<Pose2d>(particles[i].pose));
-  particles_pub_.publish(msg);
+void LocalizerROS::publishParticles(const ros::Time& stamp, bool force) {
+  const auto particles_snapshot          = localizer_->particles();
+  const std::vector<Particle>& particles = *particles_snapshot;
+  // Publish the current size of the particle set.
+  std_msgs::Int32 num_particles_msg;
+  num_particles_msg.data = particles.size();
+  num_particles_pub_.publish(num_particles_msg);
+  // Nothing is serialized without subscribers, or before the period elapsed.
+  const bool publish_poses = particles_pub_.getNumSubscribers() > 0;
+  const bool publish_compact =
+      compact_particles_ && compact_particles_pub_.getNumSubscribers() > 0;
+  if (!publish_poses && !publish_compact)
+    return;
+  std::unique_lock<std::mutex> lock(particles_mtx_);
+  if (!force && particles_max_rate_ > 0. && stamp >= last_particles_stamp_ &&
+      (stamp - last_particles_stamp_).toSec() < 1. / particles_max_rate_)
+    return;
+  last_particles_stamp_ = stamp;
+  decimateParticles(particles);
+  if (publish_poses) {
+    geometry_msgs::PoseArray msg;
+    msg.header.frame_id = map_frame_id_;
+    msg.header.stamp    = stamp;
+    msg.poses.reserve(particles_indexes_.size());
+    for (size_t i : particles_indexes_)
+      msg.poses.emplace_back(
+          ros_conversions::toROSMsgFrom<Pose2d>(particles[i].pose));
+    particles_pub_.publish(msg);
+  }
+  if (publish_compact) {
+    // Rows of (x, y, a, weight), in map_frame.
+    std_msgs::Float32MultiArray msg;
+    msg.layout.dim.resize(2);
+    msg.layout.dim[0].label  = "particles";
+    msg.layout.dim[0].size   = particles_indexes_.size();
+    msg.layout.dim[0].stride = 4 * particles_indexes_.size();
+    msg.layout.dim[1].label  = "x_y_a_weight";
+    msg.layout.dim[1].size   = 4;
+    msg.layout.dim[1].stride = 4;
+    msg.data.reserve(4 * particles_indexes_.size());
+    for (size_t i : particles_indexes_) {
+      const Particle& particle = particles[i];
+      msg.data.push_back(particle.pose[0]);
+      msg.data.push_back(particle.pose[1]);
+      msg.data.push_back(particle.pose[2]);
+      msg.data.push_back(particle.weight);
+    }
+    compact_particles_pub_.publish(msg);
+  }
+}
+
+void LocalizerROS::decimateParticles(const std::vector<Particle>& particles) {
+  const size_t n = particles.size();
+  particles_indexes_.clear();
+  if (particles_max_size_ <= 0 || n <= (size_t)particles_max_size_) {
+    for (size_t i = 0; i < n; ++i)
+      particles_indexes_.push_back(i);
+    return;
+  }
+  const size_t k = particles_max_size_;
+  if (particles_decimation_ == Decimation::TOP_K) {
+    // The k heaviest particles, in the order of the set.
+    for (size_t i = 0; i < n; ++i)
+      particles_indexes_.push_back(i);
+    std::nth_element(
+        particles_indexes_.begin(), particles_indexes_.begin() + k,
+        particles_indexes_.end(), [&particles](size_t i, size_t j) {
+          return particles[i].weight > particles[j].weight;
+        });
+    particles_indexes_.resize(k);
+    std::sort(particles_indexes_.begin(), particles_indexes_.end());
+  } else {
+    // One draw per stratum of the cumulative weight, the particles drawn
+    // more than once are published once.
+    double tot_weight = 0.;
+    for (const auto& particle : particles)
+      tot_weight += particle.weight;
+    if (tot_weight <= 0.) {
+      for (size_t j = 0; j < k; ++j)
+        particles_indexes_.push_back((j * n) / k);
+      return;
+    }
+    std::uniform_real_distribution<double> uniform(0., tot_weight / k);
+    double cum_weight = particles[0].weight;
+    for (size_t j = 0, i = 0; j < k; ++j) {
+      const double u = j * (tot_weight / k) + uniform(particles_rnd_eng_);
+      while (cum_weight < u && i + 1 < n)
+        cum_weight += particles[++i].weight;
+      if (particles_indexes_.empty() || particles_indexes_.back() != i)
+        particles_indexes_.push_back(i);
+    }
+  }
 }
 
 void LocalizerROS::publishPoseWithCovariance(const ros::Time& stamp) {
-  const Pose2d& pose         = localizer_->pose();
-  const Eigen::Matrix3d& cov = localizer_->covariance();
+  const Localizer::Estimate estimate = localizer_->estimate();
+  const Pose2d& pose                 = estimate.pose;
+  const Eigen::Matrix3d& cov         = estimate.covariance;
   geometry_msgs::PoseWithCovarianceStamped msg;
   msg.header.frame_id = map_frame_id_;
   msg.header.stamp    = stamp;
@@ -319,4 +748,87 @@ void LocalizerROS::publishPoseWithCovariance(const ros::Time& stamp) {
   pose_pub_.publish(msg);
 }
 
+void LocalizerROS::publishDiagnostics(const ros::Time& stamp) {
+  const Localizer::Timings& timings = localizer_->timings();
+  const std::vector<std::pair<std::string, const LatencyHistogram*>> stages =
+      {{"scan", &scan_latency_},
+       {"tf_lookup", &tf_lookup_latency_},
+       {"update", &timings.update},
+       {"proposal", &timings.proposal},
+       {"likelihood", &timings.likelihood},
+       {"resampling", &timings.resampling},
+       {"statistics", &timings.statistics},
+       {"refinement", &timings.refinement}};
+  last_latencies_.resize(stages.size());
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name        = node_name_ + ": filter update";
+  status.hardware_id = robot_frame_id_;
+  // Latencies of the last period.
+  for (size_t k = 0; k < stages.size(); ++k) {
+    const LatencyHistogram::Snapshot latencies = stages[k].second->snapshot();
+    const LatencyHistogram::Snapshot period    = latencies - last_latencies_[k];
+    last_latencies_[k]                         = latencies;
+    const std::pair<std::string, double> percentiles[] = {
+        {" p50 [ms]", period.percentile(0.5)},
+        {" p99 [ms]", period.percentile(0.99)}};
+    for (const auto& percentile : percentiles) {
+      diagnostic_msgs::KeyValue key_value;
+      std::ostringstream value;
+      value << 1e3 * percentile.second;
+      key_value.key   = stages[k].first + percentile.first;
+      key_value.value = value.str();
+      status.values.push_back(key_value);
+    }
+  }
+  // Update counters of the last period.
+  const uint64_t num_updates = timings.num_updates.load();
+  const uint64_t num_skipped = timings.num_skipped_updates.load();
+  const uint64_t num_refined = timings.num_refinements.load();
+  const uint64_t num_dropped   = dropped_scans_.load();
+  const uint64_t num_recovered = num_recoveries_.load();
+  const std::pair<std::string, uint64_t> counters[] = {
+      {"updates", num_updates - last_num_updates_},
+      {"skipped updates", num_skipped - last_num_skipped_updates_},
+      {"refined updates", num_refined - last_num_refinements_},
+      {"dropped scans", num_dropped - last_dropped_scans_},
+      {"recoveries", num_recovered - last_num_recoveries_}};
+  for (const auto& counter : counters) {
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key   = counter.first;
+    key_value.value = std::to_string(counter.second);
+    status.values.push_back(key_value);
+  }
+  // Health of the last update.
+  const LaserModel::Health health = localizer_->estimate().health;
+  const std::pair<std::string, double> health_values[] = {
+      {"inlier fraction", health.inlier_fraction},
+      {"weight entropy", health.weight_entropy}};
+  for (const auto& health_value : health_values) {
+    diagnostic_msgs::KeyValue key_value;
+    std::ostringstream value;
+    value << health_value.second;
+    key_value.key   = health_value.first;
+    key_value.value = value.str();
+    status.values.push_back(key_value);
+  }
+  const bool dropping = num_dropped > last_dropped_scans_;
+  const bool degraded = degraded_;
+  status.level   = (dropping || degraded)
+                       ? diagnostic_msgs::DiagnosticStatus::WARN
+                       : diagnostic_msgs::DiagnosticStatus::OK;
+  status.message = degraded ? "Localization degraded"
+                            : (dropping ? "Dropping scans" : "OK");
+  last_num_updates_         = num_updates;
+  last_num_skipped_updates_ = num_skipped;
+  last_num_refinements_     = num_refined;
+  last_dropped_scans_       = num_dropped;
+  last_num_recoveries_      = num_recovered;
+  last_diagnostics_stamp_   = stamp;
+  // Publish.
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = stamp;
+  msg.status.push_back(status);
+  diagnostics_pub_.publish(msg);
+}
+
 }  // namespace squirrel_2d_localizer
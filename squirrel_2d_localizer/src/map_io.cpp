@@ -0,0 +1,144 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_2d_localizer/map_io.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace squirrel_2d_localizer {
+namespace map_io {
+namespace {
+
+// Trim spaces, and quotes around the value.
+std::string trim(const std::string& str) {
+  const size_t first = str.find_first_not_of(" \t\"'");
+  if (first == std::string::npos)
+    return "";
+  const size_t last = str.find_last_not_of(" \t\"'\r");
+  return str.substr(first, last - first + 1);
+}
+
+// Read the next token of a PGM header, skipping comments.
+bool readPGMToken(std::istream& in, std::string* token) {
+  while (in >> *token) {
+    if ((*token)[0] != '#')
+      return true;
+    std::string comment;
+    std::getline(in, comment);
+  }
+  return false;
+}
+
+}  // namespace
+
+bool loadMap(
+    const std::string& yaml_filename, GridMap::Params* params,
+    std::vector<signed char>* data) {
+  std::ifstream fin(yaml_filename.c_str());
+  if (!fin.is_open())
+    return false;
+  // Flat key/value pairs is all map_server uses.
+  std::string image, line;
+  double resolution = 0., occupied_thresh = 0.65, free_thresh = 0.196;
+  double origin[3] = {0., 0., 0.};
+  bool negate      = false;
+  while (std::getline(fin, line)) {
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos)
+      continue;
+    const std::string key   = trim(line.substr(0, colon));
+    const std::string value = trim(line.substr(colon + 1));
+    if (key == "image") {
+      image = value;
+    } else if (key == "resolution") {
+      resolution = std::atof(value.c_str());
+    } else if (key == "negate") {
+      negate = std::atoi(value.c_str()) != 0;
+    } else if (key == "occupied_thresh") {
+      occupied_thresh = std::atof(value.c_str());
+    } else if (key == "free_thresh") {
+      free_thresh = std::atof(value.c_str());
+    } else if (key == "origin") {
+      std::string values = value;
+      for (char& c : values)
+        if (c == '[' || c == ']' || c == ',')
+          c = ' ';
+      std::istringstream iss(values);
+      iss >> origin[0] >> origin[1] >> origin[2];
+    }
+  }
+  if (image.empty() || resolution <= 0.)
+    return false;
+  // Image paths are relative to the yaml file.
+  if (image[0] != '/') {
+    const size_t slash = yaml_filename.find_last_of('/');
+    if (slash != std::string::npos)
+      image = yaml_filename.substr(0, slash + 1) + image;
+  }
+  size_t width, height;
+  std::vector<unsigned char> pixels;
+  if (!loadPGM(image, &width, &height, &pixels))
+    return false;
+  params->resolution = resolution;
+  params->origin     = Pose2d(origin[0], origin[1], origin[2]);
+  params->width      = width;
+  params->height     = height;
+  data->resize(width * height);
+  for (size_t r = 0; r < height; ++r)
+    for (size_t c = 0; c < width; ++c) {
+      const double value = pixels[r * width + c] / 255.;
+      const double occ   = negate ? value : 1. - value;
+      signed char& cell  = (*data)[(height - 1 - r) * width + c];
+      cell = occ > occupied_thresh ? 100 : (occ < free_thresh ? 0 : -1);
+    }
+  return true;
+}
+
+bool loadPGM(
+    const std::string& filename, size_t* width, size_t* height,
+    std::vector<unsigned char>* pixels) {
+  std::ifstream fin(filename.c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return false;
+  std::string magic, w, h, max_value;
+  if (!readPGMToken(fin, &magic) || magic != "P5" || !readPGMToken(fin, &w) ||
+      !readPGMToken(fin, &h) || !readPGMToken(fin, &max_value) ||
+      std::atoi(max_value.c_str()) > 255)
+    return false;
+  fin.get();  // Single whitespace before the raster.
+  *width  = std::atoi(w.c_str());
+  *height = std::atoi(h.c_str());
+  pixels->resize(*width * *height);
+  fin.read(reinterpret_cast<char*>(pixels->data()), pixels->size());
+  return static_cast<size_t>(fin.gcount()) == pixels->size();
+}
+
+}  // namespace map_io
+}  // namespace squirrel_2d_localizer
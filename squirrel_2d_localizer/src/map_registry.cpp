@@ -0,0 +1,146 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_2d_localizer/map_registry.h"
+#include "squirrel_2d_localizer/map_io.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace squirrel_2d_localizer {
+
+void MapRegistry::addMap(
+    const std::string& name, const std::string& map_filename,
+    const std::string& cache_filename) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  Entry& entry         = entries_[name];
+  entry.map_filename   = map_filename;
+  entry.cache_filename = cache_filename;
+}
+
+bool MapRegistry::contains(const std::string& name) const {
+  std::unique_lock<std::mutex> lock(mtx_);
+  return entries_.count(name) > 0;
+}
+
+bool MapRegistry::acquire(const std::string& name, Floor* floor) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  auto it = entries_.find(name);
+  if (it == entries_.end() || it->second.in_use)
+    return false;
+  Entry& entry = it->second;
+  if (!entry.floor.map && !load(&entry))
+    return false;
+  floor->map              = std::move(entry.floor.map);
+  floor->likelihood_field = std::move(entry.floor.likelihood_field);
+  entry.in_use            = true;
+  // Floors in use do not count against the budget.
+  lru_.remove(name);
+  return true;
+}
+
+void MapRegistry::release(const std::string& name, Floor* floor) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  Entry& entry                 = entries_[name];
+  entry.floor.map              = std::move(floor->map);
+  entry.floor.likelihood_field = std::move(floor->likelihood_field);
+  entry.in_use                 = false;
+  touch(name);
+  enforceBudget();
+}
+
+bool MapRegistry::preload(const std::string& name) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  auto it = entries_.find(name);
+  if (it == entries_.end())
+    return false;
+  Entry& entry = it->second;
+  if (entry.in_use)
+    return true;
+  if (!entry.floor.map && !load(&entry))
+    return false;
+  touch(name);
+  enforceBudget();
+  return true;
+}
+
+int MapRegistry::numResidentMaps() const {
+  std::unique_lock<std::mutex> lock(mtx_);
+  int num_in_use = 0;
+  for (const auto& entry : entries_)
+    num_in_use += entry.second.in_use ? 1 : 0;
+  return lru_.size() + num_in_use;
+}
+
+bool MapRegistry::load(Entry* entry) const {
+  GridMap::Params map_params;
+  std::vector<signed char> data;
+  if (entry->map_filename.empty() ||
+      !map_io::loadMap(entry->map_filename, &map_params, &data))
+    return false;
+  std::unique_ptr<GridMap> map(new GridMap(map_params));
+  map->initialize(data);
+  // Each floor has its own cache file, keyed on its map.
+  LatentModelLikelihoodField::Params field_params = likelihood_field_params_;
+  field_params.cache_filename = entry->cache_filename;
+  std::unique_ptr<LatentModelLikelihoodField> likelihood_field(
+      new LatentModelLikelihoodField(field_params));
+  likelihood_field->initialize(*map);
+  entry->floor.map              = std::move(map);
+  entry->floor.likelihood_field = std::move(likelihood_field);
+  return true;
+}
+
+void MapRegistry::touch(const std::string& name) {
+  lru_.remove(name);
+  lru_.push_front(name);
+}
+
+void MapRegistry::enforceBudget() {
+  const size_t max_resident_maps = std::max(params_.max_resident_maps, 0);
+  while (lru_.size() > max_resident_maps) {
+    auto it = entries_.find(lru_.back());
+    lru_.pop_back();
+    // Floors without a map file could not be loaded again.
+    if (it->second.map_filename.empty()) {
+      entries_.erase(it);
+    } else {
+      it->second.floor.map.reset();
+      it->second.floor.likelihood_field.reset();
+    }
+  }
+}
+
+MapRegistry::Params MapRegistry::Params::defaultParams() {
+  Params params;
+  params.max_resident_maps = 2;
+  return params;
+}
+
+}  // namespace squirrel_2d_localizer
@@ -30,14 +30,12 @@
 
 #include <angles/angles.h>
 
-#include <thread>
+#include <vector>
 
 namespace squirrel_2d_localizer {
 
 void MotionModel::sampleProposal(
-    const Transform2d& motion, std::vector<Particle>* particles) const {
-  std::unique_lock<std::mutex> lock(mtx_);
-  std::normal_distribution<double> randn(0., 1.);
+    const Transform2d& motion, ParticleSet* particles) const {
   const double dx = motion[0], dy = motion[1],
                da = angles::normalize_angle(motion[2]);
   const double mx = params_.noise_magnitude * std::abs(dx),
@@ -49,14 +47,44 @@ void MotionModel::sampleProposal(
                     params_.noise_yy * my + params_.noise_ya * ma;
   const double sa = params_.noise_xa * mx +
                     params_.noise_ya * my + params_.noise_aa * ma;
-  for (size_t i = 0; i < particles->size(); ++i) {
-    const Pose2d e(
-        dx + sx * randn(rnd_eng_), dy + sy * randn(rnd_eng_),
-        da + sa * randn(rnd_eng_));
-    particles->at(i).pose *= e;
+  const long nparticles = particles->size();
+  // One Philox block per pair of samples.
+  std::vector<double> noise(3 * nparticles);
+  const uint64_t counter = counter_.fetch_add((noise.size() + 1) / 2);
+  random_numbers::fillStandardNormal(
+      generator_, counter, 0, noise.size(), noise.data());
+  double* x     = particles->x.data();
+  double* y     = particles->y.data();
+  double* a     = particles->a.data();
+  double* cos_a = particles->cos_a.data();
+  double* sin_a = particles->sin_a.data();
+#pragma omp parallel for default(shared) schedule(static)
+  for (long i = 0; i < nparticles; ++i) {
+    const double* n = noise.data() + 3 * i;
+    const double ex = dx + sx * n[0];
+    const double ey = dy + sy * n[1];
+    const double ea = da + sa * n[2];
+    // Compose the pose with the noisy motion.
+    x[i] += cos_a[i] * ex - sin_a[i] * ey;
+    y[i] += sin_a[i] * ex + cos_a[i] * ey;
+    a[i] += ea;
+    cos_a[i] = std::cos(a[i]);
+    sin_a[i] = std::sin(a[i]);
   }
 }
 
+void MotionModel::sampleProposal(
+    const Transform2d& motion, std::vector<Particle>* particles) const {
+  ParticleSet particle_set(*particles);
+  sampleProposal(motion, &particle_set);
+  particle_set.toParticles(particles);
+}
+
+void MotionModel::seed(uint64_t seed) {
+  generator_ = random_numbers::Philox4x32(seed);
+  counter_   = 0;
+}
+
 MotionModel::Params MotionModel::Params::defaultParams() {
   Params params;
   params.noise_xx        = 1.;
@@ -0,0 +1,357 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Offline replay of a bag through the localizer core. Scans and transforms
+// are read from the bag in order and the filter runs as fast as possible: no
+// node, no TransformListener and no waiting. Odometry is interpolated in a
+// tf2::BufferCore filled from /tf (and /tf_static), and a scan is processed
+// as soon as the odometry covers its stamp.
+//
+// Usage:
+//   squirrel_2d_localizer_replay --map map.yaml --bag run.bag
+//       [--trajectory trajectory.txt] [--timings timings.txt]
+//       [--init x,y,a] [--particles N] [--min-lin-update D]
+//       [--min-ang-update A] [--observation-sigma S] [--uniform-hit U]
+//       [--odom-frame odom] [--robot-frame base_link] [--scan-topic /scan]
+
+#include "squirrel_2d_localizer/grid_map.h"
+#include "squirrel_2d_localizer/laser_model.h"
+#include "squirrel_2d_localizer/latent_model_likelihood_field.h"
+#include "squirrel_2d_localizer/localizer.h"
+#include "squirrel_2d_localizer/map_io.h"
+#include "squirrel_2d_localizer/motion_model.h"
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include <sensor_msgs/LaserScan.h>
+#include <tf/transform_datatypes.h>
+#include <tf2/buffer_core.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include <angles/angles.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace squirrel_2d_localizer;
+
+namespace {
+
+struct Options {
+  std::string map, bag;
+  std::string trajectory = "trajectory.txt";
+  std::string timings    = "timings.txt";
+  std::string odom_frame = "odom", robot_frame = "base_link";
+  std::string scan_topic = "/scan";
+  Pose2d init_pose;
+  Localizer::Params localizer = Localizer::Params::defaultParams();
+  LatentModelLikelihoodField::Params likelihood_field =
+      LatentModelLikelihoodField::Params::defaultParams();
+};
+
+bool parsePose(const char* arg, Pose2d* pose) {
+  double x, y, a;
+  if (std::sscanf(arg, "%lf,%lf,%lf", &x, &y, &a) != 3)
+    return false;
+  *pose = Pose2d(x, y, a);
+  return true;
+}
+
+bool parseOptions(int argc, char* argv[], Options* options) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const char *opt = argv[i], *arg = argv[i + 1];
+    if (std::strcmp(opt, "--map") == 0)
+      options->map = arg;
+    else if (std::strcmp(opt, "--bag") == 0)
+      options->bag = arg;
+    else if (std::strcmp(opt, "--trajectory") == 0)
+      options->trajectory = arg;
+    else if (std::strcmp(opt, "--timings") == 0)
+      options->timings = arg;
+    else if (std::strcmp(opt, "--odom-frame") == 0)
+      options->odom_frame = arg;
+    else if (std::strcmp(opt, "--robot-frame") == 0)
+      options->robot_frame = arg;
+    else if (std::strcmp(opt, "--scan-topic") == 0)
+      options->scan_topic = arg;
+    else if (std::strcmp(opt, "--init") == 0) {
+      if (!parsePose(arg, &options->init_pose))
+        return false;
+    } else if (std::strcmp(opt, "--particles") == 0)
+      options->localizer.num_particles = std::max(1, std::atoi(arg));
+    else if (std::strcmp(opt, "--min-lin-update") == 0)
+      options->localizer.min_lin_update = std::atof(arg);
+    else if (std::strcmp(opt, "--min-ang-update") == 0)
+      options->localizer.min_ang_update = std::atof(arg);
+    else if (std::strcmp(opt, "--observation-sigma") == 0)
+      options->likelihood_field.observation_sigma = std::atof(arg);
+    else if (std::strcmp(opt, "--uniform-hit") == 0)
+      options->likelihood_field.uniform_hit = std::atof(arg);
+    else
+      return false;
+  }
+  return (argc % 2) == 1 && !options->map.empty() && !options->bag.empty();
+}
+
+// Replays the scans of a bag, in the same way LocalizerROS processes them.
+class Replay {
+ public:
+  Replay(const Options& options, Localizer* localizer)
+      : options_(options),
+        localizer_(localizer),
+        transformer_(ros::Duration(3600.)),
+        laser_initialized_(false),
+        odometry_initialized_(false),
+        num_scans_(0),
+        num_updates_(0),
+        num_dropped_(0),
+        initial_localization_counter_(0) {}
+
+  bool open() {
+    trajectory_.open(options_.trajectory.c_str());
+    timings_.open(options_.timings.c_str());
+    if (!trajectory_.good() || !timings_.good())
+      return false;
+    trajectory_ << "# stamp x y a" << std::endl;
+    timings_ << "# stamp update[ms] updated num_particles" << std::endl;
+    return true;
+  }
+
+  void addTransforms(const tf2_msgs::TFMessage& msg, bool is_static) {
+    for (const geometry_msgs::TransformStamped& t : msg.transforms) {
+      transformer_.setTransform(t, "bag", is_static);
+      if (!is_static)
+        latest_stamp_ = std::max(latest_stamp_, t.header.stamp);
+    }
+    processPendingScans(false);
+  }
+
+  void addScan(const sensor_msgs::LaserScan::ConstPtr& msg) {
+    pending_scans_.push_back(msg);
+    processPendingScans(false);
+  }
+
+  // Process what is left at the end of the bag.
+  void flush() { processPendingScans(true); }
+
+  size_t numScans() const { return num_scans_; }
+  size_t numUpdates() const { return num_updates_; }
+  size_t numDropped() const { return num_dropped_; }
+  const std::vector<double>& updateTimes() const { return update_ms_; }
+
+ private:
+  // Scans wait until the odometry is known at their stamp, since transforms
+  // are recorded shortly after the sensor data they refer to.
+  void processPendingScans(bool flush) {
+    while (!pending_scans_.empty()) {
+      const sensor_msgs::LaserScan::ConstPtr& msg = pending_scans_.front();
+      if (!transformer_.canTransform(
+              options_.odom_frame, options_.robot_frame, msg->header.stamp)) {
+        if (!flush && !outdated(msg->header.stamp))
+          return;
+        ++num_dropped_;
+      } else {
+        processScan(*msg);
+      }
+      pending_scans_.pop_front();
+    }
+  }
+
+  // The transforms moved past the scan without covering it.
+  bool outdated(const ros::Time& stamp) const {
+    return latest_stamp_ > stamp + ros::Duration(1.0);
+  }
+
+  tf::StampedTransform lookup(
+      const std::string& target, const std::string& source,
+      const ros::Time& stamp) const {
+    tf::StampedTransform transform;
+    tf::transformStampedMsgToTF(
+        transformer_.lookupTransform(target, source, stamp), transform);
+    return transform;
+  }
+
+  void processScan(const sensor_msgs::LaserScan& msg) {
+    ++num_scans_;
+    const tf::StampedTransform tf_o2r =
+        lookup(options_.odom_frame, options_.robot_frame, msg.header.stamp);
+    if (!laser_initialized_ && !initializeLaser(msg))
+      return;
+    if (!odometry_initialized_) {
+      tf_o2r_               = tf_o2r;
+      odometry_initialized_ = true;
+    }
+    const Pose2d motion =
+        ros_conversions::fromTFMsgTo<Pose2d>(tf_o2r_.inverse() * tf_o2r);
+    const bool force_update = initial_localization_counter_++ < 5;
+    const auto start        = std::chrono::steady_clock::now();
+    const bool updated      = localizer_->updateFilter(
+        motion, msg.ranges, Pose2d(0., 0., 0.), force_update);
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+    const Pose2d pose = localizer_->pose();
+    if (updated) {
+      tf_o2r_ = tf_o2r;
+      ++num_updates_;
+      update_ms_.push_back(elapsed_ms);
+      trajectory_ << msg.header.stamp << " " << pose[0] << " " << pose[1]
+                  << " " << angles::normalize_angle(pose[2]) << std::endl;
+    }
+    timings_ << msg.header.stamp << " " << elapsed_ms << " " << updated << " "
+             << localizer_->particles()->size() << std::endl;
+  }
+
+  // Set the laser parameters from the first scan whose sensor pose is known.
+  bool initializeLaser(const sensor_msgs::LaserScan& msg) {
+    if (!transformer_.canTransform(
+            options_.robot_frame, msg.header.frame_id, msg.header.stamp))
+      return false;
+    const tf::StampedTransform tf_r2l =
+        lookup(options_.robot_frame, msg.header.frame_id, msg.header.stamp);
+    LaserModel::Params& laser_params = localizer_->laserModel()->params();
+    laser_params.range_min           = msg.range_min;
+    laser_params.range_max           = msg.range_max;
+    laser_params.angle_min           = msg.angle_min;
+    laser_params.angle_max           = msg.angle_max;
+    laser_params.tf_r2l = ros_conversions::fromTFMsgTo<Pose2d>(tf_r2l);
+    laser_initialized_  = true;
+    return true;
+  }
+
+  const Options& options_;
+  Localizer* localizer_;
+  tf2::BufferCore transformer_;
+  ros::Time latest_stamp_;
+  tf::Transform tf_o2r_;
+  bool laser_initialized_, odometry_initialized_;
+  std::deque<sensor_msgs::LaserScan::ConstPtr> pending_scans_;
+  size_t num_scans_, num_updates_, num_dropped_;
+  int initial_localization_counter_;
+  std::vector<double> update_ms_;
+  std::ofstream trajectory_, timings_;
+};
+
+double percentile(std::vector<double> values, double p) {
+  if (values.empty())
+    return 0.;
+  const size_t k = std::min(
+      values.size() - 1, static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + k, values.end());
+  return values[k];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parseOptions(argc, argv, &options)) {
+    std::fprintf(
+        stderr,
+        "Usage: %s --map map.yaml --bag run.bag [--trajectory FILE] "
+        "[--timings FILE] [--init x,y,a] [--particles N] "
+        "[--min-lin-update D] [--min-ang-update A] [--observation-sigma S] "
+        "[--uniform-hit U] [--odom-frame F] [--robot-frame F] "
+        "[--scan-topic T]\n",
+        argv[0]);
+    return EXIT_FAILURE;
+  }
+  ros::Time::init();
+  // Load the map and initialize the localizer.
+  GridMap::Params map_params;
+  std::vector<signed char> data;
+  if (!map_io::loadMap(options.map, &map_params, &data)) {
+    std::fprintf(stderr, "Unable to load %s.\n", options.map.c_str());
+    return EXIT_FAILURE;
+  }
+  std::unique_ptr<GridMap> grid_map(new GridMap(map_params));
+  grid_map->initialize(data);
+  std::unique_ptr<LatentModelLikelihoodField> likelihood_field(
+      new LatentModelLikelihoodField(options.likelihood_field));
+  likelihood_field->initialize(*grid_map);
+  std::unique_ptr<LaserModel> laser_model(new LaserModel);
+  std::unique_ptr<MotionModel> motion_model(new MotionModel);
+  Localizer localizer(options.localizer);
+  localizer.initialize(grid_map, likelihood_field, laser_model, motion_model);
+  localizer.resetPose(options.init_pose);
+  // Replay the bag.
+  Replay replay(options, &localizer);
+  if (!replay.open()) {
+    std::fprintf(stderr, "Unable to open the output files.\n");
+    return EXIT_FAILURE;
+  }
+  rosbag::Bag bag;
+  try {
+    bag.open(options.bag, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& ex) {
+    std::fprintf(stderr, "%s\n", ex.what());
+    return EXIT_FAILURE;
+  }
+  const std::vector<std::string> topics = {"/tf", "/tf_static",
+                                           options.scan_topic};
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+  const auto start = std::chrono::steady_clock::now();
+  for (const rosbag::MessageInstance& m : view) {
+    if (m.getTopic() == options.scan_topic) {
+      const sensor_msgs::LaserScan::ConstPtr scan =
+          m.instantiate<sensor_msgs::LaserScan>();
+      if (scan)
+        replay.addScan(scan);
+    } else {
+      const tf2_msgs::TFMessage::ConstPtr transforms =
+          m.instantiate<tf2_msgs::TFMessage>();
+      if (transforms)
+        replay.addTransforms(*transforms, m.getTopic() == "/tf_static");
+    }
+  }
+  replay.flush();
+  const double wall_time = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+  const double bag_time = (view.getEndTime() - view.getBeginTime()).toSec();
+  bag.close();
+  // Summary.
+  const std::vector<double>& update_ms = replay.updateTimes();
+  std::printf(
+      "scans: %zu (%zu dropped), updates: %zu\n"
+      "bag: %.1f s, replay: %.1f s (%.1fx real time)\n"
+      "update[ms]: p50 %.2f, p99 %.2f, max %.2f\n",
+      replay.numScans(), replay.numDropped(), replay.numUpdates(), bag_time,
+      wall_time, bag_time / std::max(wall_time, 1e-9),
+      percentile(update_ms, 0.5), percentile(update_ms, 0.99),
+      percentile(update_ms, 1.));
+  return EXIT_SUCCESS;
+}
@@ -29,44 +29,202 @@
 #include "squirrel_2d_localizer/resampling.h"
 #include "squirrel_2d_localizer/particle_types.h"
 
+#include <angles/angles.h>
+
 #include <algorithm>
-#include <random>
+#include <cmath>
+#include <mutex>
+#include <numeric>
 #include <thread>
-#include <vector>
 
 namespace squirrel_2d_localizer {
 namespace resampling {
+namespace {
 
-void importanceSampling(std::vector<Particle>* particles) {
-  std::unique_lock<std::mutex> lock(__internal::resampling_mtx_);
-  std::mt19937 eng(std::rand());
+std::mutex resampling_mtx_;
+
+inline double totalWeight(const std::vector<double>& weights) {
+  return std::accumulate(weights.begin(), weights.end(), 0.);
+}
+
+}  // namespace
+
+void Resampler::importanceSampling(Scheme scheme, ParticleSet* particles) {
+  if (particles->empty())
+    return;
+  computeIndexes(scheme, particles->weight);
+  swapBuffers(particles);
+}
+
+void Resampler::importanceSampling(
+    Scheme scheme, std::vector<Particle>* particles) {
+  ParticleSet particle_set(*particles);
+  importanceSampling(scheme, &particle_set);
+  particle_set.toParticles(particles);
+}
+
+void Resampler::kldSampling(
+    const KLDSamplingParams& params, ParticleSet* particles) {
+  if (particles->empty())
+    return;
+  kldIndexes(params, *particles);
+  swapBuffers(particles);
+}
+
+void Resampler::kldSampling(
+    const KLDSamplingParams& params, std::vector<Particle>* particles) {
+  ParticleSet particle_set(*particles);
+  kldSampling(params, &particle_set);
+  particle_set.toParticles(particles);
+}
+
+void Resampler::computeIndexes(
+    Scheme scheme, const std::vector<double>& weights) {
+  switch (scheme) {
+    case Scheme::STRATIFIED:
+      stratifiedIndexes(weights);
+      break;
+    case Scheme::RESIDUAL:
+      residualIndexes(weights);
+      break;
+    default:
+      systematicIndexes(weights);
+      break;
+  }
+}
+
+void Resampler::kldIndexes(
+    const KLDSamplingParams& params, const ParticleSet& particles) {
+  std::uniform_real_distribution<double> rand(0., 1.);
+  const size_t nparticles = particles.size();
+  cum_weights_.resize(nparticles);
+  double cum_weight = 0.;
+  for (size_t i = 0; i < nparticles; ++i)
+    cum_weights_[i] = cum_weight += particles.weight[i];
+  const size_t min_particles = std::max(1, params.min_particles);
+  const size_t max_particles =
+      std::max<size_t>(min_particles, params.max_particles);
+  indexes_.clear();
+  bins_.clear();
+  size_t required_particles = min_particles;
+  while (indexes_.size() < max_particles &&
+         indexes_.size() < required_particles) {
+    const double target = cum_weight * rand(rnd_eng_);
+    const size_t idx    = std::min<size_t>(
+        std::upper_bound(cum_weights_.begin(), cum_weights_.end(), target) -
+            cum_weights_.begin(),
+        nparticles - 1);
+    indexes_.push_back(idx);
+    if (bins_.insert(__internal::kldSamplingBin(
+                         particles.pose(idx), params.bin_size_xy,
+                         params.bin_size_a))
+            .second)
+      required_particles = std::max(
+          min_particles,
+          __internal::kldSamplingBound(
+              bins_.size(), params.error_bound, params.upper_quantile));
+  }
+}
+
+void Resampler::systematicIndexes(const std::vector<double>& weights) {
   std::uniform_real_distribution<double> rand(0., 1.);
-  const double tot_weights = particles::computeTotalWeight(*particles);
-  const size_t nparticles  = particles->size();
+  const size_t nparticles  = weights.size();
+  const double tot_weights = totalWeight(weights);
   const double interval    = tot_weights / nparticles;
-  std::vector<size_t> indexes(nparticles);
+  indexes_.resize(nparticles);
   double cum_weight = 0.;
-  double target     = interval * rand(eng);
-  for (size_t i = 0, j = 0; i < nparticles; ++i) {
-    cum_weight += particles->at(i).weight;
+  double target     = interval * rand(rnd_eng_);
+  size_t j          = 0;
+  for (size_t i = 0; i < nparticles; ++i) {
+    cum_weight += weights[i];
     while (cum_weight > target && j < nparticles) {
-      indexes[j++] = i;
+      indexes_[j++] = i;
+      target += interval;
+    }
+  }
+  // Guard against round-off in the cumulative sum.
+  for (; j < nparticles; ++j)
+    indexes_[j] = nparticles - 1;
+}
+
+void Resampler::stratifiedIndexes(const std::vector<double>& weights) {
+  std::uniform_real_distribution<double> rand(0., 1.);
+  const size_t nparticles  = weights.size();
+  const double tot_weights = totalWeight(weights);
+  const double interval    = tot_weights / nparticles;
+  indexes_.resize(nparticles);
+  double cum_weight = weights[0];
+  for (size_t i = 0, j = 0; j < nparticles; ++j) {
+    const double target = interval * (j + rand(rnd_eng_));
+    while (cum_weight < target && i < nparticles - 1)
+      cum_weight += weights[++i];
+    indexes_[j] = i;
+  }
+}
+
+void Resampler::residualIndexes(const std::vector<double>& weights) {
+  std::uniform_real_distribution<double> rand(0., 1.);
+  const size_t nparticles  = weights.size();
+  const double tot_weights = totalWeight(weights);
+  indexes_.clear();
+  residuals_.resize(nparticles);
+  // Deterministic replication of the integer part of the expected copies.
+  double tot_residuals = 0.;
+  for (size_t i = 0; i < nparticles; ++i) {
+    const double copies  = nparticles * weights[i] / tot_weights;
+    const size_t ncopies = std::floor(copies);
+    indexes_.insert(indexes_.end(), ncopies, i);
+    tot_residuals += residuals_[i] = copies - ncopies;
+  }
+  // Systematic sampling of the remaining particles from the residuals.
+  const size_t nresiduals = nparticles - indexes_.size();
+  if (nresiduals == 0)
+    return;
+  const double interval = tot_residuals / nresiduals;
+  double cum_residual   = 0.;
+  double target         = interval * rand(rnd_eng_);
+  for (size_t i = 0; i < nparticles && indexes_.size() < nparticles; ++i) {
+    cum_residual += residuals_[i];
+    while (cum_residual > target && indexes_.size() < nparticles) {
+      indexes_.push_back(i);
       target += interval;
     }
   }
-  std::vector<Pose2d> new_poses;
-  new_poses.reserve(nparticles);
-  for (size_t i = 0, idx; i < nparticles; ++i) {
-    idx = indexes[i];
-    new_poses.emplace_back(particles->at(idx).pose);
+  while (indexes_.size() < nparticles)
+    indexes_.push_back(nparticles - 1);
+}
+
+void Resampler::swapBuffers(ParticleSet* particles) {
+  const size_t nparticles = indexes_.size();
+  const double weight     = 1. / nparticles;
+  buffer_.resize(nparticles);
+  for (size_t i = 0; i < nparticles; ++i) {
+    const size_t k    = indexes_[i];
+    buffer_.x[i]      = particles->x[k];
+    buffer_.y[i]      = particles->y[k];
+    buffer_.a[i]      = particles->a[k];
+    buffer_.cos_a[i]  = particles->cos_a[k];
+    buffer_.sin_a[i]  = particles->sin_a[k];
+    buffer_.weight[i] = weight;
   }
-  particles::setPoses(new_poses, particles);
-  particles::setWeight(1. / nparticles, particles);
+  particles->swap(buffer_);
 }
 
-void uniformUpsample(int nparticles_add, std::vector<Particle>* particles) {
-  std::unique_lock<std::mutex> lock(__internal::resampling_mtx_);
-  std::mt19937 rg(std::rand());
+void importanceSampling(std::vector<Particle>* particles) {
+  Resampler resampler;
+  resampler.importanceSampling(Scheme::SYSTEMATIC, particles);
+}
+
+void importanceSampling(
+    const KLDSamplingParams& params, std::vector<Particle>* particles) {
+  Resampler resampler;
+  resampler.kldSampling(params, particles);
+}
+
+void uniformUpsample(
+    int nparticles_add, std::mt19937_64* rnd_eng,
+    std::vector<Particle>* particles) {
+  std::unique_lock<std::mutex> lock(resampling_mtx_);
   std::normal_distribution<double> randn(0, 1);
   // Compute mean and covariance.
   Pose2d mean;
@@ -75,20 +233,53 @@ void uniformUpsample(int nparticles_add, std::vector<Particle>* particles) {
   const Eigen::Vector3d& mean_vec = mean.toVector();
   // Create new particles.
   for (int i = 0; i < nparticles_add; ++i) {
-    const double x = randn(rg), y = randn(rg), a = randn(rg);
+    const double x = randn(*rnd_eng), y = randn(*rnd_eng),
+                 a = randn(*rnd_eng);
     particles->emplace_back(
         Pose2d(cov * Eigen::Vector3d(x, y, a) + mean_vec), 0.);
   }
 }
 
 void uniformDownsample(
-    int nparticles_remove, std::vector<Particle>* particles) {
-  std::unique_lock<std::mutex> lock(__internal::resampling_mtx_);
+    int nparticles_remove, std::mt19937_64* rnd_eng,
+    std::vector<Particle>* particles) {
+  std::unique_lock<std::mutex> lock(resampling_mtx_);
   // Extract uniformly which particles to keep.
   const int new_particles_num = particles->size() - nparticles_remove;
-  std::shuffle(particles->begin(), particles->end(), std::mt19937(std::rand()));
+  std::shuffle(particles->begin(), particles->end(), *rnd_eng);
   particles->erase(particles->begin() + new_particles_num, particles->end());
 }
 
+KLDSamplingParams KLDSamplingParams::defaultParams() {
+  KLDSamplingParams params;
+  params.min_particles  = 100;
+  params.max_particles  = 5000;
+  params.error_bound    = 0.01;
+  params.upper_quantile = 2.326;
+  params.bin_size_xy    = 0.5;
+  params.bin_size_a     = 10. * M_PI / 180.;
+  return params;
+}
+
+namespace __internal {
+
+size_t kldSamplingBound(size_t k, double error_bound, double upper_quantile) {
+  if (k <= 1)
+    return 0;
+  const double a = 2. / (9. * (k - 1));
+  const double b = 1. - a + std::sqrt(a) * upper_quantile;
+  return std::ceil((k - 1) / (2. * error_bound) * b * b * b);
+}
+
+int64_t kldSamplingBin(
+    const Pose2d& pose, double bin_size_xy, double bin_size_a) {
+  const int64_t mask = (1 << 21) - 1;
+  const int64_t i    = std::floor(pose[0] / bin_size_xy);
+  const int64_t j    = std::floor(pose[1] / bin_size_xy);
+  const int64_t k = std::floor(angles::normalize_angle(pose[2]) / bin_size_a);
+  return ((i & mask) << 42) | ((j & mask) << 21) | (k & mask);
+}
+
+}  // namespace __internal
 }  // namespace resampling
 }  // namespace squirrel_2d_localizer
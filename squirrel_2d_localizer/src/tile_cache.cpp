@@ -0,0 +1,118 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_2d_localizer/tile_cache.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace squirrel_2d_localizer {
+
+TileCache::TileCache(int tile_rows, int tile_cols, int max_resident_tiles)
+    : tile_rows_(tile_rows),
+      tile_cols_(tile_cols),
+      max_resident_tiles_(max_resident_tiles),
+      lru_position_(tile_rows * tile_cols, lru_.end()),
+      state_(tile_rows * tile_cols, State::RELEASED),
+      num_pinned_(0) {}
+
+void TileCache::addArray(const void* data, size_t tile_bytes) {
+  arrays_.push_back(static_cast<const char*>(data));
+  tile_bytes_.push_back(tile_bytes);
+}
+
+void TileCache::touch(
+    int tile_row0, int tile_row1, int tile_col0, int tile_col1) {
+  tile_row0 = std::max(tile_row0, 0);
+  tile_col0 = std::max(tile_col0, 0);
+  tile_row1 = std::min(tile_row1, tile_rows_ - 1);
+  tile_col1 = std::min(tile_col1, tile_cols_ - 1);
+  for (int r = tile_row0; r <= tile_row1; ++r)
+    for (int c = tile_col0; c <= tile_col1; ++c) {
+      const int tile = r * tile_cols_ + c;
+      if (state_[tile] == State::PINNED)
+        continue;
+      if (state_[tile] == State::RESIDENT) {
+        lru_.splice(lru_.begin(), lru_, lru_position_[tile]);
+        continue;
+      }
+      advise(tile, true);
+      lru_.push_front(tile);
+      lru_position_[tile] = lru_.begin();
+      state_[tile]        = State::RESIDENT;
+    }
+  // Never release the tiles just touched.
+  const int num_touched =
+      std::max(0, tile_row1 - tile_row0 + 1) *
+      std::max(0, tile_col1 - tile_col0 + 1);
+  const int budget = std::max(max_resident_tiles_ - num_pinned_, num_touched);
+  while (static_cast<int>(lru_.size()) > budget) {
+    const int tile = lru_.back();
+    lru_.pop_back();
+    advise(tile, false);
+    lru_position_[tile] = lru_.end();
+    state_[tile]        = State::RELEASED;
+  }
+}
+
+void TileCache::pin(int tile_row, int tile_col) {
+  const int tile = tile_row * tile_cols_ + tile_col;
+  if (state_[tile] == State::PINNED)
+    return;
+  if (state_[tile] == State::RESIDENT) {
+    lru_.erase(lru_position_[tile]);
+    lru_position_[tile] = lru_.end();
+  }
+  state_[tile] = State::PINNED;
+  ++num_pinned_;
+}
+
+void TileCache::advise(int tile, bool will_need) const {
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  for (size_t k = 0; k < arrays_.size(); ++k) {
+    const uintptr_t begin =
+        reinterpret_cast<uintptr_t>(arrays_[k]) + tile * tile_bytes_[k];
+    const uintptr_t end = begin + tile_bytes_[k];
+    // Faulting in may cover the neighbouring pages, releasing must not.
+    const uintptr_t page_begin =
+        will_need ? begin & ~(page_size - 1)
+                  : (begin + page_size - 1) & ~(page_size - 1);
+    const uintptr_t page_end =
+        will_need ? (end + page_size - 1) & ~(page_size - 1)
+                  : end & ~(page_size - 1);
+    if (page_end > page_begin)
+      madvise(
+          reinterpret_cast<void*>(page_begin), page_end - page_begin,
+          will_need ? MADV_WILLNEED : MADV_DONTNEED);
+  }
+}
+
+}  // namespace squirrel_2d_localizer
@@ -0,0 +1,65 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQUIRREL_3D_LOCALIZER_ADAPTIVESAMPLING_H_
+#define SQUIRREL_3D_LOCALIZER_ADAPTIVESAMPLING_H_
+
+#include <ros/ros.h>
+
+#include <atomic>
+#include <cstddef>
+
+namespace squirrel_3d_localizer {
+
+/// Closed-loop control of the sensor sampling distance: after every
+/// measurement the distance is scaled such that the integrated points, or
+/// the time of the observation model, approach a budget. Points sampled
+/// uniformly on surfaces decrease with the square of the distance.
+class AdaptiveSampling {
+ public:
+  AdaptiveSampling(ros::NodeHandle* nh, double sampleDist);
+  virtual ~AdaptiveSampling();
+
+  /// false without a budget, the sampling distance is then constant
+  bool enabled() const { return m_pointBudget > 0 || m_timeBudget > 0.0; };
+
+  /// Current sampling distance, may be read while another thread updates.
+  double sampleDist() const {
+    return m_sampleDist.load(std::memory_order_relaxed);
+  };
+
+  /// Feedback of one measurement: numPoints integrated by the observation
+  /// model in the given seconds, both for the full resolution.
+  void update(size_t numPoints, double seconds);
+
+ protected:
+  int m_pointBudget;
+  double m_timeBudget;
+  double m_minDist;
+  double m_maxDist;
+  /// fraction of the error corrected per measurement, in (0, 1]
+  double m_gain;
+  std::atomic<double> m_sampleDist;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_ADAPTIVESAMPLING_H_ */
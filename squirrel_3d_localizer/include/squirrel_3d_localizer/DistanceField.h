@@ -0,0 +1,179 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_DISTANCEFIELD_H_
+#define SQUIRREL_3D_LOCALIZER_DISTANCEFIELD_H_
+
+#include <stdint.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <dynamicEDT3D/dynamicEDTOctomap.h>
+#include <octomap/octomap.h>
+
+namespace squirrel_3d_localizer {
+
+/// Read-only copy of a DynamicEDTOctomap baked into a flat, contiguous 3D
+/// array. Distances are clamped to the maximum obstacle distance and
+/// optionally quantized to one byte per cell, so that a lookup is a single
+/// index computation and one load. Tiled fields store the cells in bricks of
+/// 8x8x8, so that the endpoints of a scan around a particle fall in a few
+/// cache lines and pages. A baked field can be saved and then attached
+/// read-only by any number of processes through a shared mapping.
+class DistanceField {
+ public:
+  DistanceField();
+  /// Deep copy, an attached field is copied into memory.
+  DistanceField(const DistanceField& other);
+  virtual ~DistanceField();
+
+  /// Samples the distance map at the centers of the voxels in [min, max].
+  /// Cells outside the map and occupied cells get the maximum distance, as
+  /// in the endpoint model.
+  void bake(
+      const DynamicEDTOctomap& distanceMap, const octomap::point3d& min,
+      const octomap::point3d& max, double resolution, float maxDistance,
+      bool quantize, bool tiled = false);
+
+  /// Samples again the cells in [min, max] of a baked, not attached field,
+  /// after an incremental update of the distance map.
+  void bakeRegion(
+      const DynamicEDTOctomap& distanceMap, const octomap::point3d& min,
+      const octomap::point3d& max);
+
+  /// Builds a field factor times coarser than fine, every cell holding the
+  /// smallest distance of the fine cells it covers, in the layout of fine.
+  void coarsen(const DistanceField& fine, int factor);
+
+  /// Writes the field tagged with the version of the map it was baked from.
+  /// The file is replaced atomically, attached readers keep the old copy.
+  bool save(const std::string& filename, uint64_t version) const;
+  /// Maps a saved field read-only, fails if the file is missing or invalid.
+  bool attach(const std::string& filename);
+
+  /// Version of an octree in the terms of save(), from its occupied leaves.
+  static uint64_t mapVersion(const octomap::OcTree& map);
+
+  /// Flat index of the cell containing (x, y, z), -1 if outside the field.
+  inline int index(float x, float y, float z) const {
+    const int ix = static_cast<int>(std::floor((x - m_min[0]) * m_invRes));
+    const int iy = static_cast<int>(std::floor((y - m_min[1]) * m_invRes));
+    const int iz = static_cast<int>(std::floor((z - m_min[2]) * m_invRes));
+    if (static_cast<unsigned>(ix) >= static_cast<unsigned>(m_size[0]) ||
+        static_cast<unsigned>(iy) >= static_cast<unsigned>(m_size[1]) ||
+        static_cast<unsigned>(iz) >= static_cast<unsigned>(m_size[2]))
+      return -1;
+    return cellIndex(ix, iy, iz);
+  };
+
+  /// Quantized distance of a cell, maxCode() for index -1.
+  inline uint8_t code(int idx) const {
+    return idx < 0 ? kMaxCode : m_codeData[idx];
+  };
+
+  /// Distance of a cell in meters, maxDistance() for index -1.
+  inline float distance(int idx) const {
+    if (idx < 0)
+      return m_maxDistance;
+    return m_quantized ? m_codeData[idx] * m_step : m_distanceData[idx];
+  };
+
+  /// Distance in meters represented by a quantized code.
+  inline float decode(uint8_t code) const { return code * m_step; };
+
+  bool empty() const { return m_size[0] * m_size[1] * m_size[2] == 0; };
+  bool attached() const { return m_mapped != NULL; };
+  bool quantized() const { return m_quantized; };
+  bool tiled() const { return m_tiled; };
+  float maxDistance() const { return m_maxDistance; };
+  float resolution() const { return 1.0f / m_invRes; };
+  uint64_t version() const { return m_version; };
+  static int maxCode() { return kMaxCode; };
+
+  /// Memory used by the baked cells in bytes, shared if attached.
+  size_t memoryUsage() const;
+
+ private:
+  struct Header {
+    char magic[8];
+    uint64_t version;
+    float min[3];
+    int32_t size[3];
+    float resolution;
+    float maxDistance;
+    int32_t quantized;
+    int32_t tiled;
+  };
+
+  static const uint8_t kMaxCode = 255;
+  // cells per brick side of tiled fields, log2
+  static const int kBrickShift = 3;
+  static const int kBrickMask  = (1 << kBrickShift) - 1;
+
+  /// Index of the cell (ix, iy, iz), row major or brick major.
+  inline int cellIndex(int ix, int iy, int iz) const {
+    if (!m_tiled)
+      return (iz * m_size[1] + iy) * m_size[0] + ix;
+    const int brick =
+        ((iz >> kBrickShift) * m_bricks[1] + (iy >> kBrickShift)) *
+            m_bricks[0] +
+        (ix >> kBrickShift);
+    return (brick << (3 * kBrickShift)) +
+           ((((iz & kBrickMask) << kBrickShift) + (iy & kBrickMask))
+            << kBrickShift) +
+           (ix & kBrickMask);
+  };
+
+  DistanceField& operator=(const DistanceField&);
+
+  void unmap();
+  /// Cells stored, including the padding of the bricks.
+  size_t numCells() const;
+  /// Sets the layout for the current size and allocates the cells.
+  void allocate(bool tiled);
+  void sample(
+      const DynamicEDTOctomap& distanceMap, const int begin[3],
+      const int end[3]);
+
+  float m_min[3];
+  int m_size[3];
+  float m_invRes;
+  float m_maxDistance;
+  float m_step;
+  bool m_quantized;
+  bool m_tiled;
+  int m_bricks[3];
+  uint64_t m_version;
+  // point either into the vectors or into the mapped file
+  const uint8_t* m_codeData;
+  const float* m_distanceData;
+  std::vector<uint8_t> m_codes;
+  std::vector<float> m_distances;
+  void* m_mapped;
+  size_t m_mappedSize;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_DISTANCEFIELD_H_ */
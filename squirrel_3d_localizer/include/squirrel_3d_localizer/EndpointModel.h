@@ -29,11 +29,14 @@
 
 #include <omp.h>
 
+#include <boost/thread.hpp>
+
 #include <ros/ros.h>
 #include <tf/transform_datatypes.h>
 
 #include <dynamicEDT3D/dynamicEDTOctomap.h>
 #include <octomap/octomap.h>
+#include <squirrel_3d_localizer/DistanceField.h>
 #include <squirrel_3d_localizer/ObservationModel.h>
 #include <visualization_msgs/Marker.h>
 
@@ -47,19 +50,59 @@ class EndpointModel : public ObservationModel {
   virtual ~EndpointModel();
   virtual void integrateMeasurement(
       Particles& particles, const PointCloud& pc,
-      const std::vector<float>& ranges, float max_range,
-      const tf::Transform& baseToSensor);
+      const std::vector<float>& ranges, const SensorTags& tags,
+      float max_range, const tf::Transform& baseToSensor);
 
   virtual void setMap(boost::shared_ptr<octomap::OcTree> map);
 
  protected:
+  /// Sum of the log-likelihoods of the points moved by transform, looked up
+  /// in field if not NULL, else in m_distanceMap.
+  template <typename Transform, typename Points>
+  double pointsLogLikelihood(
+      const Transform& transform, const Points& points,
+      const std::vector<float>& ranges, const SensorTags& tags,
+      const DistanceField* field) const;
+
   bool getHeightError(
       const Particle& p, const tf::StampedTransform& footprintToBase,
       double& heightError) const;
+  void refreshDistanceMap();
   void initDistanceMap();
+  /// Applies the differences between m_map and m_edtMap to the distance
+  /// map, false if the map has to be computed from scratch.
+  bool updateDistanceMap();
+  boost::shared_ptr<const DistanceField> distanceField() const;
+  /// field coarsened to m_resolutionLevel, cached until field changes
+  boost::shared_ptr<const DistanceField> coarseField(
+      const boost::shared_ptr<const DistanceField>& field);
+  void publishDistanceField(
+      const boost::shared_ptr<const DistanceField>& field);
+  void initLogLikelihoodTable();
   double m_sigma;
+  /// per SensorType, endpoint/sigma unless overridden
+  double m_sensorSigma[NUM_SENSOR_TYPES];
   double m_maxObstacleDistance;
   boost::shared_ptr<DynamicEDTOctomap> m_distanceMap;
+  // flat copy of m_distanceMap and log-likelihoods of its quantized distances
+  bool m_bakeDistanceField;
+  bool m_quantizeDistance;
+  bool m_tileDistanceField;
+  // file through which instances on the same map share the baked field
+  std::string m_distanceFieldFile;
+  // tree followed by m_distanceMap for incremental updates, and its bounds
+  bool m_incrementalUpdate;
+  boost::shared_ptr<octomap::OcTree> m_edtMap;
+  octomap::point3d m_edtMin;
+  octomap::point3d m_edtMax;
+  boost::shared_ptr<const DistanceField> m_distanceField;
+  mutable boost::mutex m_distanceFieldMutex;
+  boost::shared_ptr<const DistanceField> m_coarseSource;
+  boost::shared_ptr<const DistanceField> m_coarseField;
+  int m_coarseLevel;
+  boost::thread m_refreshThread;
+  /// NUM_SENSOR_TYPES tables of DistanceField::maxCode() + 1 entries
+  std::vector<double> m_logLikelihoodTable;
 };
 
 }  // namespace squirrel_3d_localizer
@@ -0,0 +1,106 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQUIRREL_3D_LOCALIZER_FILTERSNAPSHOT_H_
+#define SQUIRREL_3D_LOCALIZER_FILTERSNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+
+#include <squirrel_3d_localizer/ImuBuffer.h>
+#include <squirrel_3d_localizer/SquirrelLocalizerDefs.h>
+
+namespace squirrel_3d_localizer {
+
+/// Binary snapshot of the filter state (particles, last odometry pose and
+/// IMU buffer) in a memory-mapped file with two slots. Every write goes to
+/// the older slot and is framed by its sequence number, so a crash while
+/// writing leaves the previous snapshot readable. Frame ids are not stored.
+class FilterSnapshot {
+ public:
+  FilterSnapshot();
+  virtual ~FilterSnapshot();
+
+  /// Maps filename for numParticles particles and imuCapacity IMU samples.
+  /// A file of another layout is cleared. Returns false if it cannot be
+  /// mapped.
+  bool open(
+      const std::string& filename, size_t numParticles, size_t imuCapacity);
+
+  bool isOpen() const { return m_mapped != NULL; };
+
+  /// Stores the state in the older slot, odomPose may be NULL.
+  void write(
+      const ros::Time& stamp, const Particles& particles,
+      const tf::Stamped<tf::Pose>* odomPose,
+      const ImuBuffer& imu);
+
+  /// Stamp of the newest complete snapshot, false if there is none.
+  bool stamp(ros::Time& stamp) const;
+
+  /// Restores the newest complete snapshot, false if there is none.
+  /// hasOdomPose tells whether odomPose was stored.
+  bool read(
+      Particles& particles, bool& hasOdomPose,
+      tf::Stamped<tf::Pose>& odomPose,
+      ImuBuffer& imu) const;
+
+ private:
+  struct Header {
+    char magic[8];
+    uint64_t num_particles, imu_capacity;
+  };
+
+  /// followed by the particles, the IMU samples and the closing sequence
+  struct SlotHeader {
+    uint64_t sequence;
+    double stamp;
+    uint32_t num_particles, num_imu;
+    uint32_t has_odom_pose, padding;
+    double odom_stamp;
+    double odom_pose[7];
+  };
+
+  /// x, y, z, qx, qy, qz, qw, weight
+  static const size_t kParticleSize = 8;
+  /// stamp, roll, pitch, qx, qy, qz, qw
+  static const size_t kImuSize = 7;
+
+  void unmap();
+  char* slot(unsigned index) const;
+  /// index of the newest complete slot, -1 if there is none
+  int newestSlot() const;
+
+  void* m_mapped;
+  size_t m_mappedSize;
+  size_t m_numParticles;
+  size_t m_imuCapacity;
+  size_t m_slotSize;
+  uint64_t m_sequence;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_FILTERSNAPSHOT_H_ */
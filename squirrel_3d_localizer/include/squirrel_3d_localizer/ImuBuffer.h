@@ -0,0 +1,74 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQUIRREL_3D_LOCALIZER_IMUBUFFER_H_
+#define SQUIRREL_3D_LOCALIZER_IMUBUFFER_H_
+
+#include <ros/time.h>
+#include <tf/transform_datatypes.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace squirrel_3d_localizer {
+
+/// Ring of the last IMU orientations ordered by stamp, with roll and pitch
+/// extracted once on arrival. The samples bracketing a stamp are found by
+/// binary search.
+class ImuBuffer {
+ public:
+  struct Sample {
+    ros::Time stamp;
+    double roll, pitch;
+    tf::Quaternion orientation;
+  };
+
+  explicit ImuBuffer(size_t capacity);
+
+  size_t capacity() const { return m_samples.size(); }
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  void clear() { m_first = m_size = 0; }
+  void swap(ImuBuffer& other);
+
+  /// Appends a sample, dropping the oldest one when full. Samples not newer
+  /// than the last one are ignored, returns false for them.
+  bool push(const Sample& sample);
+
+  /// i-th sample, oldest first
+  const Sample& operator[](size_t i) const {
+    return m_samples[(m_first + i) % m_samples.size()];
+  }
+  const Sample& back() const { return (*this)[m_size - 1]; }
+
+  /// Newest sample not newer than t and oldest sample newer than t, NULL
+  /// where there is none.
+  void bracket(
+      const ros::Time& t, const Sample*& older, const Sample*& newer) const;
+
+ protected:
+  std::vector<Sample> m_samples;
+  size_t m_first, m_size;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_IMUBUFFER_H_ */
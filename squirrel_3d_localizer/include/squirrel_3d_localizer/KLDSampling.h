@@ -0,0 +1,84 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQUIRREL_3D_LOCALIZER_KLDSAMPLING_H_
+#define SQUIRREL_3D_LOCALIZER_KLDSAMPLING_H_
+
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <unordered_set>
+
+namespace squirrel_3d_localizer {
+
+/// Adaptive particle count via KLD-sampling (Fox, 2003). Particles are drawn
+/// until their number bounds, with probability 1 - delta, the
+/// KL-divergence between the sample based and the true posterior by
+/// errorBound, the posterior being discretized over an (x, y, z, yaw)
+/// histogram. The non-empty bins are kept in a hash set, so the histogram
+/// covers any map without being allocated.
+class KLDSampling {
+ public:
+  explicit KLDSampling(ros::NodeHandle* nh);
+  virtual ~KLDSampling();
+
+  bool enabled() const { return m_enabled; };
+
+  int minParticles() const { return m_minParticles; };
+  int maxParticles() const { return m_maxParticles; };
+
+  /// Starts a new particle set, the storage of the bins is kept.
+  void reset();
+
+  /// Adds the pose of a drawn particle, returns true while more particles
+  /// are required.
+  bool add(const tf::Pose& pose);
+
+  /// Particles required for the bins filled so far, within the bounds.
+  size_t requiredParticles() const { return m_requiredParticles; };
+
+  /// Particles required for k non-empty bins (Wilson-Hilferty).
+  size_t bound(size_t k) const;
+
+ protected:
+  int64_t bin(const tf::Pose& pose) const;
+
+  bool m_enabled;
+  int m_minParticles;
+  int m_maxParticles;
+  double m_errorBound;
+  /// standard normal upper quantile of 1 - delta
+  double m_upperQuantile;
+  double m_binSizeXY;
+  double m_binSizeZ;
+  double m_binSizeYaw;
+
+  std::unordered_set<int64_t> m_bins;
+  size_t m_numDrawn;
+  size_t m_requiredParticles;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_KLDSAMPLING_H_ */
@@ -68,8 +68,40 @@ class MapModel {
   void getHeightlist(
       double x, double y, double totalHeight, std::vector<double>& heights);
 
+  /// Calls f(key, logOdds) for every finest voxel of the occupied leaves.
+  template <typename F>
+  static void forEachOccupiedVoxel(const octomap::OcTree& tree, F f) {
+    const double res = tree.getResolution();
+    for (octomap::OcTree::leaf_iterator it = tree.begin_leafs(),
+                                        end = tree.end_leafs();
+         it != end; ++it) {
+      if (!tree.isNodeOccupied(*it))
+        continue;
+      const int n                   = int(it.getSize() / res + 0.5);
+      const octomap::point3d corner = it.getCoordinate() -
+                                      octomap::point3d(1, 1, 1) *
+                                          (0.5 * (n - 1) * res);
+      for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+          for (int k = 0; k < n; ++k)
+            f(tree.coordToKey(
+                  corner + octomap::point3d(i * res, j * res, k * res)),
+              it->getLogOdds());
+    }
+  }
+
  protected:
+  /// Valid pose heights of an xy cell, as in getHeightlist()
+  struct FloorCell {
+    float x, y, z;
+  };
+
+  /// Collects the heights of getHeightlist() for all xy cells at once.
+  void initFloorCells(double totalHeight);
+
   boost::shared_ptr<octomap::OcTree> m_map;
+  std::vector<FloorCell> m_floorCells;
+  double m_floorCellsHeight;
 
   bool m_useMapBounds;
 
@@ -26,6 +26,10 @@
 #include <tf/transform_listener.h>
 #include <Eigen/Cholesky>
 
+#include <boost/shared_ptr.hpp>
+
+#include <squirrel_3d_localizer/PoseCache.h>
+#include <squirrel_3d_localizer/RandomNumbers.h>
 #include <squirrel_3d_localizer/SquirrelLocalizerDefs.h>
 
 namespace squirrel_3d_localizer {
@@ -37,6 +41,8 @@ class MotionModel {
       const std::string& odomFrameId, const std::string& baseFrameId);
   virtual ~MotionModel();
   void reset();
+  /// serve pose lookups from cache first, tf is the fallback on a miss
+  void setPoseCache(const boost::shared_ptr<const PoseCache>& poseCache);
   /// look up the odom pose at a certain time through tf
   bool lookupOdomPose(
       const ros::Time& t, tf::Stamped<tf::Pose>& odomPose) const;
@@ -90,17 +96,25 @@ class MotionModel {
   void transformPose(
       tf::Pose& particlePose, const tf::Transform& odomTransform);
 
-  /// Generates motion noise corresponding to odomTransform
-  /// May not be called in parallel, accesses the random generator m_rngNormal
-  tf::Transform odomTransformNoise(const tf::Transform& odomTransform);
+  /// std.devs of the motion noise in roll, pitch, yaw, x, y, z
+  Vector6d odomNoiseStdDev(const tf::Transform& odomTransform) const;
+
+  /// Generates motion noise with the given std.devs from kNoiseCounters
+  /// counters starting at counter, may be called in parallel
+  tf::Transform odomTransformNoise(
+      const Vector6d& stdDev, uint64_t counter) const;
 
   /// @return calibrated odometry transform w.r.t. 2D drift (pos. + orientation)
   tf::Transform calibrateOdometry(const tf::Transform& odomTransform) const;
 
   tf::TransformListener* m_tfListener;
+  boost::shared_ptr<const PoseCache> m_poseCache;
 
-  NormalGeneratorT m_rngNormal;  // standard normal-distributed noise
+  static const uint64_t kNoiseCounters = 3;
   UniformGeneratorT m_rngUniform;
+  /// standard normal-distributed noise, counters advance with every sample
+  Philox4x32 m_noiseGenerator;
+  uint64_t m_noiseCounter;
   // parameters:
   /// variance parameters for calibrated odometry noise
   Eigen::Matrix3d m_odomNoise2D;
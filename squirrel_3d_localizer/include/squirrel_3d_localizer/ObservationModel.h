@@ -66,6 +66,57 @@ class ObservationModel {
     return -1.0 * (LOG_SQRT_2_PI)-log(sigma) - ((x_sq) / (2 * sigma * sigma));
   }
 
+  /// Helper function to split a transform into a single precision rotation
+  /// and translation, so that the measurement points can be moved one by one
+  /// without building a transformed point cloud
+  static inline void toEigen(
+      const tf::Transform& transform, Eigen::Matrix3f& rotation,
+      Eigen::Vector3f& translation) {
+    const tf::Matrix3x3& basis = transform.getBasis();
+    for (int r = 0; r < 3; ++r) {
+      for (int c = 0; c < 3; ++c)
+        rotation(r, c) = basis[r][c];
+      translation(r) = transform.getOrigin()[r];
+    }
+  }
+
+  /// Moves points with a single precision rigid transform.
+  struct RigidTransform {
+    explicit RigidTransform(const tf::Transform& transform) {
+      toEigen(transform, rotation, translation);
+    }
+    inline Eigen::Vector3f operator()(const Eigen::Vector3f& p) const {
+      return rotation * p + translation;
+    }
+    Eigen::Matrix3f rotation;
+    Eigen::Vector3f translation;
+  };
+
+  /// Moves points with the yaw and translation of a particle pose, i.e. with
+  /// a 2D rotation. Roll and pitch are applied beforehand to all the points
+  /// when the particles share them (see setPlanarParticles()).
+  struct PlanarTransform {
+    explicit PlanarTransform(const tf::Pose& pose) {
+      const double yaw = tf::getYaw(pose.getRotation());
+      c                = std::cos(yaw);
+      s                = std::sin(yaw);
+      translation << pose.getOrigin().x(), pose.getOrigin().y(),
+          pose.getOrigin().z();
+    }
+    inline Eigen::Vector3f operator()(const Eigen::Vector3f& p) const {
+      return Eigen::Vector3f(
+          c * p.x() - s * p.y() + translation.x(),
+          s * p.x() + c * p.y() + translation.y(), p.z() + translation.z());
+    }
+    inline Eigen::Matrix3f rotation() const {
+      Eigen::Matrix3f r;
+      r << c, -s, 0.0f, s, c, 0.0f, 0.0f, 0.0f, 1.0f;
+      return r;
+    }
+    float c, s;
+    Eigen::Vector3f translation;
+  };
+
   // static double logLikelihoodSimple(double x, double sigma){
   //	return  -((x * x) / (2* sigma * sigma));
   //}
@@ -73,11 +124,12 @@ class ObservationModel {
   /**
    * Integrate a measurement in particle set, update weights accordingly
    * Particle weights should be in log scale before, weights are added.
+   * Every point is evaluated with the sensor model of its tag.
    */
   virtual void integrateMeasurement(
       Particles& particles, const PointCloud& pc,
-      const std::vector<float>& ranges, float max_range,
-      const tf::Transform& baseToSensor) = 0;
+      const std::vector<float>& ranges, const SensorTags& tags,
+      float max_range, const tf::Transform& baseToSensor) = 0;
 
   virtual void integratePoseMeasurement(
       Particles& particles, double roll, double pitch,
@@ -85,7 +137,23 @@ class ObservationModel {
 
   virtual void setMap(boost::shared_ptr<octomap::OcTree> map);
 
+  /// All particles have the same roll and pitch (constrain_motion_rp), beams
+  /// are then moved into the map frame with PlanarTransform.
+  void setPlanarParticles(bool planar) { m_planarParticles = planar; };
+
+  /// Coarse-to-fine evaluation, level 0 is the full resolution and every
+  /// level halves the resolution of the map lookups where supported.
+  virtual void setResolutionLevel(int level) { m_resolutionLevel = level; };
+  /// Replaces the map model and passes its map to setMap().
+  void setMapModel(boost::shared_ptr<MapModel> mapModel);
+
  protected:
+  /// Roll and pitch of particle p followed by baseToSensor, the part of the
+  /// sensor transform shared by planar particles.
+  static void levelSensor(
+      const Particle& p, const tf::Transform& baseToSensor,
+      Eigen::Matrix3f& rotation, Eigen::Vector3f& translation);
+
   virtual bool getHeightError(
       const Particle& p, const tf::StampedTransform& footprintToBase,
       double& heightError) const = 0;
@@ -94,6 +162,8 @@ class ObservationModel {
   NormalGeneratorT m_rngNormal;
   UniformGeneratorT m_rngUniform;
   boost::shared_ptr<octomap::OcTree> m_map;
+  bool m_planarParticles;
+  int m_resolutionLevel;
   ros::Publisher m_pc_pub;
 
   double m_weightRoll;
@@ -0,0 +1,81 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_OCCUPANCYGRID_H_
+#define SQUIRREL_3D_LOCALIZER_OCCUPANCYGRID_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include <octomap/octomap.h>
+
+namespace squirrel_3d_localizer {
+
+/// Dense occupancy grid voxelized once from an OcTree at its leaf
+/// resolution. Unknown space is treated as free, as in castRay with
+/// ignoreUnknown set.
+class OccupancyGrid {
+ public:
+  OccupancyGrid();
+  virtual ~OccupancyGrid() {}
+
+  void voxelize(const octomap::OcTree& map);
+
+  /// Casts one ray with a 3D-DDA. Returns false if no occupied cell is found
+  /// within max_range or the ray leaves the grid; otherwise range is the
+  /// distance from origin to the center of the hit cell.
+  bool castRay(
+      const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+      float max_range, float& range) const;
+
+  /// Casts all directions (one per column) from a common origin. Ranges of
+  /// rays without hit are set to -1.
+  void castRays(
+      const Eigen::Vector3f& origin, const Eigen::Matrix3Xf& directions,
+      float max_range, std::vector<float>& ranges) const;
+
+  /// Returns false if p is outside the grid, its occupancy otherwise in
+  /// occupied.
+  bool query(const Eigen::Vector3f& p, bool& occupied) const;
+
+  inline bool occupied(int ix, int iy, int iz) const {
+    return m_cells[(static_cast<size_t>(iz) * m_size[1] + iy) * m_size[0] +
+                   ix] != 0;
+  };
+
+  bool empty() const { return m_cells.empty(); };
+  size_t memoryUsage() const { return m_cells.size(); };
+
+ private:
+  Eigen::Vector3f m_min;
+  int m_size[3];
+  float m_resolution;
+  float m_invRes;
+  std::vector<uint8_t> m_cells;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_OCCUPANCYGRID_H_ */
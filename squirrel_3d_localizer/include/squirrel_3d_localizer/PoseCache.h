@@ -0,0 +1,114 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQUIRREL_3D_LOCALIZER_POSECACHE_H_
+#define SQUIRREL_3D_LOCALIZER_POSECACHE_H_
+
+#include <ros/callback_queue.h>
+#include <ros/ros.h>
+#include <tf/transform_datatypes.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace squirrel_3d_localizer {
+
+/// Timestamp-indexed copy of the tf tree, filled from /tf and /tf_static by
+/// its own spinner thread. Every edge keeps a ring of samples behind a
+/// sequence lock, so lookups never block and cost O(log n) per edge.
+class PoseCache {
+ public:
+  /// capacity: samples kept per dynamic edge
+  PoseCache(ros::NodeHandle& nh, size_t capacity);
+  virtual ~PoseCache();
+
+  /// Same semantics as tf::Transformer::lookupTransform(), t = 0 means the
+  /// latest common time. Returns false when the frames are not connected in
+  /// the cache or t lies outside the buffered interval (no extrapolation).
+  bool lookupTransform(
+      const std::string& targetFrame, const std::string& sourceFrame,
+      const ros::Time& t, tf::StampedTransform& transform) const;
+
+  /// Adds a sample, normally called by the spinner thread. Only to be used
+  /// directly when nothing is published on /tf, there must be one writer.
+  void insert(const geometry_msgs::TransformStamped& msg, bool isStatic);
+
+ protected:
+  struct Sample {
+    ros::Time stamp;
+    tf::Transform transform;
+  };
+
+  /// parent <- child transforms of one frame, written by the spinner only
+  struct Edge {
+    Edge() : isStatic(false), written(0), sequence(0) {}
+    std::string child;
+    std::string parent;
+    bool isStatic;
+    std::vector<Sample> samples;
+    /// total number of samples ever written (ring position)
+    std::atomic<uint64_t> written;
+    /// odd while the single writer updates the ring
+    std::atomic<uint32_t> sequence;
+  };
+
+  void tfCallback(const tf2_msgs::TFMessageConstPtr& msg);
+  void tfStaticCallback(const tf2_msgs::TFMessageConstPtr& msg);
+
+  /// @return index of the edge with the given child frame, or -1
+  int findEdge(const std::string& child) const;
+
+  /// frames from frame up to its root, with the edges in between
+  bool chainToRoot(
+      const std::string& frame, std::vector<std::string>& frames,
+      std::vector<int>& edges) const;
+
+  /// newest sample stamp of a dynamic edge, false if it has none yet
+  bool latestStamp(const Edge& edge, ros::Time& stamp) const;
+
+  /// interpolated parent <- child transform of edge at t
+  bool interpolate(
+      const Edge& edge, const ros::Time& t, tf::Transform& transform) const;
+
+  static std::string stripSlash(const std::string& frame);
+
+  static const size_t kMaxEdges  = 64;
+  static const size_t kMaxDepth  = 32;
+  static const int kMaxReadTries = 8;
+
+  size_t m_capacity;
+  Edge m_edges[kMaxEdges];
+  /// edges are published by incrementing m_numEdges, never removed
+  std::atomic<size_t> m_numEdges;
+
+  ros::CallbackQueue m_queue;
+  ros::Subscriber m_tfSub, m_tfStaticSub;
+  boost::scoped_ptr<ros::AsyncSpinner> m_spinner;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_POSECACHE_H_ */
@@ -0,0 +1,86 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_RANDOMNUMBERS_H_
+#define SQUIRREL_3D_LOCALIZER_RANDOMNUMBERS_H_
+
+#include <stdint.h>
+
+#include <cmath>
+
+namespace squirrel_3d_localizer {
+
+/// Philox4x32-10 counter-based generator (Salmon et al., 2011). Every
+/// counter maps to four independent 32 bit words, so that threads draw from
+/// disjoint counters without shared state and the samples only depend on
+/// the seed.
+class Philox4x32 {
+ public:
+  explicit Philox4x32(uint64_t seed = 0)
+      : m_key0(static_cast<uint32_t>(seed)),
+        m_key1(static_cast<uint32_t>(seed >> 32)) {}
+
+  /// Generates the block of the given counter.
+  inline void operator()(uint64_t counter, uint32_t* out) const {
+    uint32_t c0 = static_cast<uint32_t>(counter);
+    uint32_t c1 = static_cast<uint32_t>(counter >> 32);
+    uint32_t c2 = 0, c3 = 0;
+    uint32_t k0 = m_key0, k1 = m_key1;
+    for (int round = 0; round < 10; ++round) {
+      const uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+      const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+      c0                = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+      c1                = static_cast<uint32_t>(p1);
+      c2                = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+      c3                = static_cast<uint32_t>(p0);
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+  };
+
+  /// Two standard normal samples from the block of counter (Box-Muller).
+  inline void normalPair(uint64_t counter, double* out) const {
+    uint32_t block[4];
+    (*this)(counter, block);
+    const double u1 = 1.0 - toUniform(block[0], block[1]);  // (0, 1]
+    const double u2 = toUniform(block[2], block[3]);
+    const double r  = std::sqrt(-2.0 * std::log(u1));
+    out[0]          = r * std::cos(2.0 * M_PI * u2);
+    out[1]          = r * std::sin(2.0 * M_PI * u2);
+  };
+
+  /// Uniform double in [0, 1) with 53 bits of precision.
+  static inline double toUniform(uint32_t hi, uint32_t lo) {
+    return ((hi >> 5) * 67108864.0 + (lo >> 6)) * (1.0 / 9007199254740992.0);
+  };
+
+ private:
+  uint32_t m_key0, m_key1;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_RANDOMNUMBERS_H_ */
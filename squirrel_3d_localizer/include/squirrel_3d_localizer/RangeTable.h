@@ -0,0 +1,107 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_RANGETABLE_H_
+#define SQUIRREL_3D_LOCALIZER_RANGETABLE_H_
+
+#include <stdint.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <squirrel_3d_localizer/OccupancyGrid.h>
+
+namespace squirrel_3d_localizer {
+
+/// Expected ranges of a planar sensor precomputed on an (x, y, yaw) grid at a
+/// fixed sensor height. Ranges are stored as millimeters in 16 bits with the
+/// yaw bins of a cell contiguous; the file is memory-mapped when loaded.
+class RangeTable {
+ public:
+  enum Status { HIT, NO_HIT, UNKNOWN };
+
+  RangeTable();
+  virtual ~RangeTable();
+
+  /// Casts num_angles rays from every free cell of the xy grid at height z.
+  void build(
+      const OccupancyGrid& grid, double min_x, double min_y, double max_x,
+      double max_y, double z, double resolution, int num_angles,
+      double max_range);
+
+  bool save(const std::string& filename) const;
+  bool load(const std::string& filename);
+
+  /// Expected range of the ray at (x, y) with heading yaw. UNKNOWN when the
+  /// position is not covered by the table, e.g. occupied or out of bounds.
+  inline Status lookup(float x, float y, float yaw, float& range) const {
+    const int ix = static_cast<int>(std::floor((x - m_header.min_x) * m_invRes));
+    const int iy = static_cast<int>(std::floor((y - m_header.min_y) * m_invRes));
+    if (static_cast<unsigned>(ix) >= static_cast<unsigned>(m_header.size_x) ||
+        static_cast<unsigned>(iy) >= static_cast<unsigned>(m_header.size_y))
+      return UNKNOWN;
+    int ia = static_cast<int>(std::floor(yaw * m_invAngleRes + 0.5f)) %
+             m_header.num_angles;
+    if (ia < 0)
+      ia += m_header.num_angles;
+    const uint16_t value =
+        m_data[(static_cast<size_t>(iy) * m_header.size_x + ix) *
+                   m_header.num_angles +
+               ia];
+    if (value == kUnknown)
+      return UNKNOWN;
+    if (value == kNoHit)
+      return NO_HIT;
+    range = value * 1e-3f;
+    return HIT;
+  };
+
+  bool empty() const { return m_data == NULL; };
+  float height() const { return m_header.z; };
+  float maxRange() const { return m_header.max_range; };
+
+ private:
+  struct Header {
+    char magic[8];
+    float min_x, min_y, resolution, z, max_range;
+    int32_t size_x, size_y, num_angles;
+  };
+
+  static const uint16_t kUnknown = 0xffff;
+  static const uint16_t kNoHit   = 0xfffe;
+
+  void unmap();
+
+  Header m_header;
+  float m_invRes;
+  float m_invAngleRes;
+  // either points into m_buffer or into the mapped file
+  const uint16_t* m_data;
+  std::vector<uint16_t> m_buffer;
+  void* m_mapped;
+  size_t m_mappedSize;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_RANGETABLE_H_ */
@@ -30,6 +30,8 @@
 #include <tf/transform_datatypes.h>
 
 #include <squirrel_3d_localizer/ObservationModel.h>
+#include <squirrel_3d_localizer/OccupancyGrid.h>
+#include <squirrel_3d_localizer/RangeTable.h>
 
 #include <octomap/octomap.h>
 
@@ -43,21 +45,34 @@ class RaycastingModel : public ObservationModel {
   virtual ~RaycastingModel();
   virtual void integrateMeasurement(
       Particles& particles, const PointCloud& pc,
-      const std::vector<float>& ranges, float max_range,
-      const tf::Transform& baseToSensor);
+      const std::vector<float>& ranges, const SensorTags& tags,
+      float max_range, const tf::Transform& baseToSensor);
+
+  virtual void setMap(boost::shared_ptr<octomap::OcTree> map);
 
  protected:
   bool getHeightError(
       const Particle& p, const tf::StampedTransform& footprintToBase,
       double& heightError) const;
+  void initOccupancyGrid();
   // laser parameters:
   double m_zHit;
   double m_zRand;
   double m_zShort;
   double m_zMax;
   double m_sigmaHit;
+  /// per SensorType, raycasting/sigma_hit unless overridden
+  double m_sensorSigmaHit[NUM_SENSOR_TYPES];
   double m_lambdaShort;
 
+  // dense copy of the map for batched 3D-DDA raycasting
+  bool m_useDenseGrid;
+  OccupancyGrid m_occupancyGrid;
+
+  // precomputed expected ranges of a planar sensor
+  RangeTable m_rangeTable;
+  double m_rangeTableHeightTolerance;
+
   bool m_filterPointCloudGround;
   double m_groundFilterDistance;
   double m_groundFilterAngle;
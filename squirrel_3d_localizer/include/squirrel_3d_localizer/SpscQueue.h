@@ -0,0 +1,70 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_SPSCQUEUE_H_
+#define SQUIRREL_3D_LOCALIZER_SPSCQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace squirrel_3d_localizer {
+
+/// Bounded lock-free queue for exactly one producer and one consumer thread.
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(size_t capacity)
+      : m_buffer(capacity + 1), m_head(0), m_tail(0) {}
+
+  /// Called by the producer. Returns false, dropping item, if full.
+  bool push(const T& item) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    const size_t next = (tail + 1) % m_buffer.size();
+    if (next == m_head.load(std::memory_order_acquire))
+      return false;
+    m_buffer[tail] = item;
+    m_tail.store(next, std::memory_order_release);
+    return true;
+  };
+
+  /// Called by the consumer. Returns false if empty.
+  bool pop(T& item) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+      return false;
+    item           = m_buffer[head];
+    m_buffer[head] = T();
+    m_head.store((head + 1) % m_buffer.size(), std::memory_order_release);
+    return true;
+  };
+
+ private:
+  std::vector<T> m_buffer;
+  // head and tail on separate cache lines, written by different threads
+  alignas(64) std::atomic<size_t> m_head;
+  alignas(64) std::atomic<size_t> m_tail;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_SPSCQUEUE_H_ */
@@ -23,6 +23,7 @@
 
 #include <ros/ros.h>
 
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/PoseArray.h>
 #include <geometry_msgs/PoseWithCovariance.h>
@@ -56,17 +57,26 @@
 #include <pcl/segmentation/sac_segmentation.h>
 #include <pcl_ros/point_cloud.h>
 
+#include <squirrel_3d_localizer/AdaptiveSampling.h>
 #include <squirrel_3d_localizer/EndpointModel.h>
+#include <squirrel_3d_localizer/FilterSnapshot.h>
+#include <squirrel_3d_localizer/ImuBuffer.h>
+#include <squirrel_3d_localizer/KLDSampling.h>
 #include <squirrel_3d_localizer/MotionModel.h>
 #include <squirrel_3d_localizer/ObservationModel.h>
+#include <squirrel_3d_localizer/PoseCache.h>
 #include <squirrel_3d_localizer/RaycastingModel.h>
+#include <squirrel_3d_localizer/SpscQueue.h>
 #include <squirrel_3d_localizer/SquirrelLocalizerDefs.h>
+#include <squirrel_3d_localizer/StageProfiler.h>
 
 #include <octomap/octomap.h>
 
-#include <boost/circular_buffer.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
+#include <atomic>
 #include <ctime>
 
 namespace squirrel_3d_localizer {
@@ -91,6 +101,10 @@ class SquirrelLocalizer {
 
  public:
   SquirrelLocalizer(unsigned randomSeed);
+  /// constructor for the nodelet, which provides its own handles
+  SquirrelLocalizer(
+      unsigned randomSeed, const ros::NodeHandle& nh,
+      const ros::NodeHandle& privateNh);
   virtual ~SquirrelLocalizer();
 
   /// callback for laser scanner data
@@ -104,6 +118,9 @@ class SquirrelLocalizer {
   /// reinitialization from pose
   void initPoseCallback(
       const geometry_msgs::PoseWithCovarianceStampedConstPtr& msg);
+  /// initPoseCallback() excluding the particle filter thread
+  void lockedInitPoseCallback(
+      const geometry_msgs::PoseWithCovarianceStampedConstPtr& msg);
   /// global reinitialization
   bool globalLocalizationCallback(
       std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
@@ -127,12 +144,17 @@ class SquirrelLocalizer {
 
   /**
    * Importance sampling from m_particles according to weights,
-   * resets weight to 1/numParticles. Uses low variance sampling
+   * resets weight to 1/numParticles. Uses low variance sampling, or
+   * KLD-sampling when enabled
    *
-   * @param numParticles how many particles to sample, 0 (default): keep size of
-   * particle distribution
+   * @param numParticles how many particles to sample, 0 (default): num_particles
+   * or as many as KLD-sampling requires
    */
   void resample(unsigned numParticles = 0);
+  /// Draws m_resampledIndices until KLD-sampling is satisfied
+  void kldResampledIndices();
+  /// Largest particle set, the buffers are reserved for it
+  int maxNumParticles() const;
   /// Returns index of particle with highest weight (log or normal scale)
   unsigned getBestParticleIdx() const;
   /// Returns the 6D pose of a particle
@@ -141,6 +163,14 @@ class SquirrelLocalizer {
   tf::Pose getBestParticlePose() const;
   /// Returns the 6D pose of the weighted mean particle
   tf::Pose getMeanParticlePose() const;
+  /// The pose last published by publishPoseEstimate(), stamped with its time
+  tf::Stamped<tf::Pose> getPoseEstimate() const;
+
+  /// Inserts a transform into the tf buffer (and the pose cache) directly,
+  /// for offline replay without a tf publisher
+  void addTransform(const geometry_msgs::TransformStamped& msg, bool isStatic);
+  /// stage latencies of the callbacks
+  const StageProfiler& profiler() const { return m_profiler; };
 
   /// function call for global initialization (called by
   /// globalLocalizationCallback)
@@ -152,6 +182,17 @@ class SquirrelLocalizer {
       double groundFilterDistance, double groundFilterAngle,
       double groundFilterPlaneDistance);
 
+  /**
+   * Classifies in one pass the points of a cloud in the footprint frame as
+   * ground when within groundFilterDistance of the floor. With cellSize > 0
+   * the floor is a plane fitted per xy cell to the points within
+   * groundFilterPlaneDistance of z=0, unless steeper than groundFilterAngle.
+   */
+  static void filterGroundHeightBand(
+      const PointCloud& pc, PointCloud& ground, PointCloud& nonground,
+      double groundFilterDistance, double groundFilterAngle,
+      double groundFilterPlaneDistance, double cellSize);
+
  protected:
   /**
    * General reset of the filter:
@@ -160,13 +201,30 @@ class SquirrelLocalizer {
    */
   void reset();
 
+  /// Restores the particles, odometry pose and IMU buffer from the snapshot
+  /// file, once after the start. False if there is no recent snapshot.
+  bool restoreSnapshot();
+
+  /// writes the filter state to the snapshot file every snapshot/period
+  void writeSnapshot(const ros::Time& time);
+
   // converts particles into PoseArray and publishes them for visualization
   void publishPoseEstimate(const ros::Time& time, bool publish_eval);
+  /// Publishes the last estimate moved by the odometry since the update,
+  /// without touching the particles (lazy_prediction).
+  void publishPredictedPose(
+      const ros::Time& time, const tf::Stamped<tf::Pose>& odomPose);
+  /// pose, tf and synchronized odometry part of publishPoseEstimate()
+  void publishPose(
+      const ros::Time& time, const tf::Pose& pose,
+      const tf::Stamped<tf::Pose>& odomPose, bool publish_eval);
 
   /**
    * Normalizes the weights and transforms from log to normal scale
    * m_minWeight gives the lower bound for weight (normal scale).
    * No adjustment will be done for minWeight = 0 (default)
+   * In the same pass nEff and the cumulative weights used by resample() are
+   * computed.
    */
   void normalizeWeights();
 
@@ -177,10 +235,14 @@ class SquirrelLocalizer {
    * nEff - returns the number of effective particles = 1/sum(w_i^2)
    *
    * Needed for selective resampling (Doucet 98, Arulampalam 01), when nEff <
-   *n/2
+   *n/2. Computed by the last call of normalizeWeights().
    **/
   double nEff() const;
 
+  /// Coarse-to-fine level of the next measurement update, from the spread of
+  /// the particles and the last nEff (0 = full resolution)
+  int annealingLevel() const;
+
   /**
    * Converts particles into log scale
    */
@@ -235,14 +297,36 @@ class SquirrelLocalizer {
 
   bool isAboveMotionThreshold(const tf::Pose& odomTransform);
 
+  /// one measurement batch, tags holds the sensor model of every point
   bool localizeWithMeasurement(
       const PointCloud& pc_filtered, const std::vector<float>& ranges,
-      double max_range);
+      const SensorTags& tags, double max_range);
 
   void constrainMotion(const tf::Pose& odomPose);
 
   void timerCallback(const ros::TimerEvent& e);
 
+  /// Point cloud with its sparse cloud and ranges for the observation model
+  struct PreparedCloud {
+    sensor_msgs::PointCloud2::ConstPtr msg;
+    PointCloud pc;
+    std::vector<float> ranges;
+  };
+
+  /// Integrates a point cloud, prepared by the preprocessing thread if
+  /// prepared is non-NULL. m_filterMutex must be held.
+  void processPointCloud(
+      const sensor_msgs::PointCloud2::ConstPtr& msg, PreparedCloud* prepared);
+
+  /// Stages of the point cloud pipeline, each in its own thread
+  void preprocessingLoop();
+  void filterLoop();
+  void waitForPipeline();
+
+  /// publishes the stage latencies on /diagnostics, at most once per
+  /// diagnostics period
+  void publishDiagnostics(const ros::Time& stamp);
+
   unsigned computeBeamStep(unsigned numBeams) const;
 
   /**
@@ -258,6 +342,8 @@ class SquirrelLocalizer {
   NormalGeneratorT m_rngNormal;
   /// uniform distribution [0:1]
   UniformGeneratorT m_rngUniform;
+  /// key of the counter-based subsampling of the clouds
+  uint64_t m_samplingSeed;
   boost::shared_ptr<MotionModel> m_motionModel;
   boost::shared_ptr<ObservationModel> m_observationModel;
   boost::shared_ptr<MapModel> m_mapModel;
@@ -281,11 +367,14 @@ class SquirrelLocalizer {
   message_filters::Synchronizer<ApprxTimePolicy>* synchronizer_;
 
   ros::Publisher m_posePub, m_poseEvalPub, m_poseOdomPub, m_poseTruePub,
-      m_poseArrayPub, m_bestPosePub, m_nEffPub, m_filteredPointCloudPub;
+      m_poseArrayPub, m_bestPosePub, m_nEffPub, m_filteredPointCloudPub,
+      m_diagnosticsPub;
   ros::Subscriber m_imuSub;
   ros::ServiceServer m_globalLocSrv, m_pauseLocSrv, m_resumeLocSrv,
       m_toggleSensorsSrv;
   tf::TransformListener m_tfListener;
+  /// optional, filled from /tf and shared with the motion model
+  boost::shared_ptr<PoseCache> m_poseCache;
   tf::TransformBroadcaster m_tfBroadcaster;
   ros::Timer m_timer;
 
@@ -305,11 +394,24 @@ class SquirrelLocalizer {
   bool m_useRaycasting;
   bool m_initFromTruepose;
   bool m_useLastPose;
+  bool m_saveLastPose;
+  FilterSnapshot m_snapshot;
+  bool m_restoreSnapshot;
+  double m_snapshotPeriod;
+  /// older snapshots are not restored (s), 0 for any age
+  double m_snapshotMaxAge;
+  ros::WallTime m_lastSnapshotTime;
   int m_numParticles;
   double m_sensorSampleDist;
+  /// current sampling distance, m_sensorSampleDist adapted to a budget
+  boost::scoped_ptr<AdaptiveSampling> m_adaptiveSampling;
+  /// adaptive number of particles, if enabled
+  boost::scoped_ptr<KLDSampling> m_kldSampling;
 
   double m_nEffFactor;
   double m_minParticleWeight;
+  /// below this number of particles the weights are processed serially
+  int m_parallelMinParticles;
   Vector6d m_initPose;      // fixed init. pose (from params)
   Vector6d m_initNoiseStd;  // Std.dev for init. pose
   bool
@@ -320,10 +422,23 @@ class SquirrelLocalizer {
 
   Particles m_particles;
   int m_bestParticleIdx;
+  double m_nEff;
+  int m_annealingLevels;
+  double m_annealingSpread;
+  double m_annealingNEffRatio;
+  // buffers kept across updates for normalization and resampling
+  std::vector<double> m_cumWeights;
+  std::vector<double> m_blockWeights;
+  std::vector<double> m_blockSqrWeights;
+  std::vector<double> m_blockMinWeights;
+  std::vector<int> m_blockBestIdx;
+  std::vector<unsigned> m_resampledIndices;
+  Particles m_resampledParticles;
   tf::Pose m_odomPose;  // incrementally added odometry pose (=dead reckoning)
   tf::Pose m_bestParticlePose;
+  ros::Time m_bestParticleTime;
   geometry_msgs::PoseArray m_poseArray;  // particles as PoseArray
-  boost::circular_buffer<sensor_msgs::Imu> m_lastIMUMsgBuffer;
+  ImuBuffer m_imuBuffer;
 
   bool m_bestParticleAsMean;
   bool m_receivedSensorData;
@@ -347,6 +462,8 @@ class SquirrelLocalizer {
   double m_groundFilterDistance;
   double m_groundFilterAngle;
   double m_groundFilterPlaneDistance;
+  std::string m_groundFilterMethod;  ///< "ransac" or "height_band"
+  double m_groundFilterCellSize;
   double m_sensorSampleDistGroundFactor;
 
   /// sensor data last integrated at this odom pose, to check if moved enough
@@ -368,7 +485,31 @@ class SquirrelLocalizer {
 
   // timer stuff
   bool m_useTimer;
+  /// defer the odometry of callbacks without integration to the next update
+  bool m_lazyPrediction;
   double m_timerPeriod;
+
+  // point cloud pipeline: the ROS callback feeds m_rawClouds, the
+  // preprocessing thread moves them to m_preparedClouds, and the filter thread
+  // integrates them. m_filterMutex guards the particles against the other
+  // callbacks.
+  bool m_pipelinePointClouds;
+  std::atomic<bool> m_pipelineRunning;
+  boost::scoped_ptr<SpscQueue<sensor_msgs::PointCloud2::ConstPtr> >
+      m_rawClouds;
+  boost::scoped_ptr<SpscQueue<boost::shared_ptr<PreparedCloud> > >
+      m_preparedClouds;
+  boost::thread m_preprocessingThread;
+  boost::thread m_filterThread;
+  boost::mutex m_pipelineMutex;
+  boost::condition_variable m_pipelineCondition;
+  boost::mutex m_filterMutex;
+
+  // profiling of the callback stages
+  mutable StageProfiler m_profiler;
+  double m_diagnosticsPeriod;
+  double m_updateBudget;  ///< target latency of a sensor update [s]
+  ros::WallTime m_lastDiagnosticsTime;
 };
 
 }  // namespace squirrel_3d_localizer
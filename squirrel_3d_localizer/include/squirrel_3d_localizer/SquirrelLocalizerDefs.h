@@ -25,6 +25,7 @@
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/uniform_real.hpp>
 #include <boost/random/variate_generator.hpp>
+#include <stdint.h>
 #include <vector>
 
 #include <tf/transform_datatypes.h>
@@ -46,6 +47,11 @@ typedef std::vector<Particle> Particles;
 
 typedef pcl::PointCloud<pcl::PointXYZ> PointCloud;
 
+/// Sensor model of the points of a measurement batch
+enum SensorType { LASER_SENSOR = 0, DEPTH_SENSOR, NUM_SENSOR_TYPES };
+/// SensorType of every point, parallel to the point cloud
+typedef std::vector<uint8_t> SensorTags;
+
 /// Boost RNG engine:
 typedef boost::mt19937 EngineT;
 /// Boost RNG distribution:
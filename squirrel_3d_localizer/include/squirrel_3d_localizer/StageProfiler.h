@@ -0,0 +1,104 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef SQUIRREL_3D_LOCALIZER_STAGEPROFILER_H_
+#define SQUIRREL_3D_LOCALIZER_STAGEPROFILER_H_
+
+#include <boost/thread/mutex.hpp>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace squirrel_3d_localizer {
+
+/// Per-stage latencies of the localizer callbacks, measured on a monotonic
+/// clock. Every stage keeps a ring buffer over the most recent samples, from
+/// which windowed percentiles are computed; optionally all samples are
+/// streamed as complete events to a Chrome trace (chrome://tracing) file.
+class StageProfiler {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Summary {
+    std::string name;
+    size_t count;  ///< total number of samples
+    double mean, p50, p90, p99, max;  ///< over the window, in seconds
+  };
+
+  /// Times the lifetime of the scope as one sample of a stage.
+  class Scope {
+   public:
+    Scope(StageProfiler& profiler, const char* stage)
+        : m_profiler(profiler), m_stage(stage), m_start(Clock::now()) {}
+    ~Scope() { m_profiler.record(m_stage, m_start, Clock::now()); }
+
+   private:
+    StageProfiler& m_profiler;
+    const char* m_stage;
+    Clock::time_point m_start;
+  };
+
+  explicit StageProfiler(size_t windowSize = 512);
+  virtual ~StageProfiler();
+
+  /// Starts streaming trace events to filename. Returns false on error.
+  bool openTrace(const std::string& filename);
+
+  void record(
+      const std::string& stage, const Clock::time_point& start,
+      const Clock::time_point& end);
+
+  /// Records a stage ending now and returns the end, to time consecutive
+  /// stages without nested scopes.
+  Clock::time_point record(
+      const std::string& stage, const Clock::time_point& start) {
+    const Clock::time_point end = Clock::now();
+    record(stage, start, end);
+    return end;
+  }
+
+  /// Summaries of all stages, in order of first appearance.
+  std::vector<Summary> summaries() const;
+
+ private:
+  struct Stage {
+    Stage() : count(0), next(0) {}
+    size_t count;
+    size_t next;
+    std::vector<double> window;
+  };
+
+  size_t m_windowSize;
+  Clock::time_point m_epoch;
+  std::map<std::string, Stage> m_stages;
+  std::vector<std::string> m_order;
+  std::ofstream m_trace;
+  size_t m_numTraceEvents;
+  mutable boost::mutex m_mutex;
+};
+
+}  // namespace squirrel_3d_localizer
+
+#endif /* SQUIRREL_3D_LOCALIZER_STAGEPROFILER_H_ */
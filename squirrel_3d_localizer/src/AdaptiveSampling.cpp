@@ -0,0 +1,79 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/AdaptiveSampling.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_3d_localizer {
+
+AdaptiveSampling::AdaptiveSampling(ros::NodeHandle* nh, double sampleDist)
+    : m_pointBudget(0),
+      m_timeBudget(0.0),
+      m_minDist(0.05),
+      m_maxDist(1.0),
+      m_gain(0.5),
+      m_sampleDist(sampleDist) {
+  nh->param("adaptive_sampling/points", m_pointBudget, m_pointBudget);
+  nh->param("adaptive_sampling/time", m_timeBudget, m_timeBudget);
+  nh->param("adaptive_sampling/min_dist", m_minDist, m_minDist);
+  nh->param("adaptive_sampling/max_dist", m_maxDist, m_maxDist);
+  nh->param("adaptive_sampling/gain", m_gain, m_gain);
+
+  if (m_minDist <= 0.0 || m_maxDist < m_minDist) {
+    ROS_ERROR(
+        "AdaptiveSampling: need 0 < min_dist <= max_dist, fixed at %f",
+        sampleDist);
+    m_minDist = m_maxDist = sampleDist;
+  }
+  m_gain = std::min(std::max(m_gain, 0.01), 1.0);
+  if (enabled())
+    ROS_INFO(
+        "Adapting the sensor sampling distance in [%f, %f] to %d points, "
+        "%f s per measurement",
+        m_minDist, m_maxDist, m_pointBudget, m_timeBudget);
+}
+
+AdaptiveSampling::~AdaptiveSampling() {}
+
+void AdaptiveSampling::update(size_t numPoints, double seconds) {
+  if (!enabled() || numPoints == 0)
+    return;
+
+  // load relative to the budget, the more violated budget dominates
+  double load = 0.0;
+  if (m_pointBudget > 0)
+    load = std::max(load, double(numPoints) / m_pointBudget);
+  if (m_timeBudget > 0.0 && seconds > 0.0)
+    load = std::max(load, seconds / m_timeBudget);
+  if (load <= 0.0)
+    return;
+
+  // points ~ 1 / dist^2, damped and limited to a factor of 2 per measurement
+  const double factor =
+      std::min(std::max(std::pow(load, 0.5 * m_gain), 0.5), 2.0);
+  const double dist =
+      std::min(std::max(sampleDist() * factor, m_minDist), m_maxDist);
+  m_sampleDist.store(dist, std::memory_order_relaxed);
+}
+
+}  // namespace squirrel_3d_localizer
@@ -0,0 +1,342 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <squirrel_3d_localizer/DistanceField.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace squirrel_3d_localizer {
+
+namespace {
+const char kMagic[8] = {'S', '3', 'D', 'E', 'D', 'F', '0', '2'};
+
+inline uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  return hash;
+}
+}  // namespace
+
+const uint8_t DistanceField::kMaxCode;
+const int DistanceField::kBrickShift;
+const int DistanceField::kBrickMask;
+
+DistanceField::DistanceField()
+    : m_invRes(1.0f),
+      m_maxDistance(0.0f),
+      m_step(0.0f),
+      m_quantized(true),
+      m_tiled(false),
+      m_version(0),
+      m_codeData(NULL),
+      m_distanceData(NULL),
+      m_mapped(NULL),
+      m_mappedSize(0) {
+  for (int i = 0; i < 3; ++i) {
+    m_min[i]    = 0.0f;
+    m_size[i]   = 0;
+    m_bricks[i] = 0;
+  }
+}
+
+DistanceField::DistanceField(const DistanceField& other)
+    : m_invRes(other.m_invRes),
+      m_maxDistance(other.m_maxDistance),
+      m_step(other.m_step),
+      m_quantized(other.m_quantized),
+      m_tiled(other.m_tiled),
+      m_version(other.m_version),
+      m_codeData(NULL),
+      m_distanceData(NULL),
+      m_mapped(NULL),
+      m_mappedSize(0) {
+  for (int i = 0; i < 3; ++i) {
+    m_min[i]    = other.m_min[i];
+    m_size[i]   = other.m_size[i];
+    m_bricks[i] = other.m_bricks[i];
+  }
+  if (other.m_codeData)
+    m_codes.assign(other.m_codeData, other.m_codeData + numCells());
+  if (other.m_distanceData)
+    m_distances.assign(
+        other.m_distanceData, other.m_distanceData + numCells());
+  m_codeData     = m_codes.empty() ? NULL : &m_codes[0];
+  m_distanceData = m_distances.empty() ? NULL : &m_distances[0];
+}
+
+DistanceField::~DistanceField() { unmap(); }
+
+void DistanceField::unmap() {
+  if (m_mapped)
+    munmap(m_mapped, m_mappedSize);
+  m_mapped       = NULL;
+  m_mappedSize   = 0;
+  m_codeData     = NULL;
+  m_distanceData = NULL;
+}
+
+size_t DistanceField::numCells() const {
+  if (m_tiled)
+    return (static_cast<size_t>(m_bricks[0]) * m_bricks[1] * m_bricks[2])
+           << (3 * kBrickShift);
+  return static_cast<size_t>(m_size[0]) * m_size[1] * m_size[2];
+}
+
+void DistanceField::allocate(bool tiled) {
+  m_tiled = tiled;
+  for (int i = 0; i < 3; ++i)
+    m_bricks[i] = (m_size[i] + kBrickMask) >> kBrickShift;
+  // the padding of the bricks reads as the maximum distance
+  m_codes.clear();
+  m_distances.clear();
+  if (m_quantized)
+    m_codes.resize(numCells(), kMaxCode);
+  else
+    m_distances.resize(numCells(), m_maxDistance);
+  m_codeData     = m_codes.empty() ? NULL : &m_codes[0];
+  m_distanceData = m_distances.empty() ? NULL : &m_distances[0];
+}
+
+void DistanceField::bake(
+    const DynamicEDTOctomap& distanceMap, const octomap::point3d& min,
+    const octomap::point3d& max, double resolution, float maxDistance,
+    bool quantize, bool tiled) {
+  unmap();
+  m_version     = 0;
+  m_invRes      = 1.0f / resolution;
+  m_maxDistance = maxDistance;
+  m_step        = maxDistance / kMaxCode;
+  m_quantized   = quantize;
+  for (int i = 0; i < 3; ++i) {
+    m_min[i]  = min(i);
+    m_size[i] = std::max(
+        0, static_cast<int>(std::ceil((max(i) - min(i)) * m_invRes - 1e-3)));
+  }
+  allocate(tiled);
+
+  const int begin[3] = {0, 0, 0};
+  sample(distanceMap, begin, m_size);
+}
+
+void DistanceField::bakeRegion(
+    const DynamicEDTOctomap& distanceMap, const octomap::point3d& min,
+    const octomap::point3d& max) {
+  if (m_mapped)
+    return;
+  int begin[3], end[3];
+  for (int i = 0; i < 3; ++i) {
+    begin[i] = std::max(
+        0, static_cast<int>(std::floor((min(i) - m_min[i]) * m_invRes)));
+    end[i] = std::min(
+        m_size[i],
+        static_cast<int>(std::floor((max(i) - m_min[i]) * m_invRes)) + 1);
+  }
+  sample(distanceMap, begin, end);
+}
+
+void DistanceField::sample(
+    const DynamicEDTOctomap& distanceMap, const int begin[3],
+    const int end[3]) {
+  const float resolution = 1.0f / m_invRes;
+  uint8_t* codes         = m_codes.empty() ? NULL : &m_codes[0];
+  float* distances       = m_distances.empty() ? NULL : &m_distances[0];
+
+#pragma omp parallel for
+  for (int iz = begin[2]; iz < end[2]; ++iz) {
+    const float z = m_min[2] + (iz + 0.5f) * resolution;
+    for (int iy = begin[1]; iy < end[1]; ++iy) {
+      const float y = m_min[1] + (iy + 0.5f) * resolution;
+      for (int ix = begin[0]; ix < end[0]; ++ix) {
+        const float x    = m_min[0] + (ix + 0.5f) * resolution;
+        const size_t idx = cellIndex(ix, iy, iz);
+        float dist    = distanceMap.getDistance(octomap::point3d(x, y, z));
+        // Outside the map and inside obstacles the endpoint model assigns the
+        // weight of the maximum distance.
+        if (dist <= 0.0f || dist > m_maxDistance)
+          dist = m_maxDistance;
+        if (m_quantized)
+          codes[idx] = static_cast<uint8_t>(
+              std::min<float>(kMaxCode, std::floor(dist / m_step + 0.5f)));
+        else
+          distances[idx] = dist;
+      }
+    }
+  }
+}
+
+void DistanceField::coarsen(const DistanceField& fine, int factor) {
+  unmap();
+  m_version     = fine.m_version;
+  m_invRes      = fine.m_invRes / factor;
+  m_maxDistance = fine.m_maxDistance;
+  m_step        = fine.m_step;
+  m_quantized   = fine.m_quantized;
+  for (int i = 0; i < 3; ++i) {
+    m_min[i]  = fine.m_min[i];
+    m_size[i] = (fine.m_size[i] + factor - 1) / factor;
+  }
+  allocate(fine.m_tiled);
+
+  // min-pooling keeps obstacles of the fine field in the coarse one
+#pragma omp parallel for
+  for (int iz = 0; iz < m_size[2]; ++iz) {
+    for (int fz = iz * factor; fz < std::min((iz + 1) * factor, fine.m_size[2]);
+         ++fz) {
+      for (int fy = 0; fy < fine.m_size[1]; ++fy) {
+        for (int fx = 0; fx < fine.m_size[0]; ++fx) {
+          const size_t idx     = cellIndex(fx / factor, fy / factor, iz);
+          const size_t fineIdx = fine.cellIndex(fx, fy, fz);
+          if (m_quantized)
+            m_codes[idx] = std::min(m_codes[idx], fine.m_codeData[fineIdx]);
+          else
+            m_distances[idx] =
+                std::min(m_distances[idx], fine.m_distanceData[fineIdx]);
+        }
+      }
+    }
+  }
+}
+
+bool DistanceField::save(const std::string& filename, uint64_t version) const {
+  if (empty())
+    return false;
+  Header header;
+  std::memset(&header, 0, sizeof(Header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = version;
+  for (int i = 0; i < 3; ++i) {
+    header.min[i]  = m_min[i];
+    header.size[i] = m_size[i];
+  }
+  header.resolution  = resolution();
+  header.maxDistance = m_maxDistance;
+  header.quantized   = m_quantized;
+  header.tiled       = m_tiled;
+
+  // write next to the target and rename, so that readers never see a
+  // partial file and keep their mapping of the previous one
+  const std::string tmpFilename = filename + ".tmp";
+  {
+    std::ofstream f(tmpFilename.c_str(), std::ios::binary);
+    if (!f.is_open())
+      return false;
+    f.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    if (m_quantized)
+      f.write(reinterpret_cast<const char*>(m_codeData), numCells());
+    else
+      f.write(
+          reinterpret_cast<const char*>(m_distanceData),
+          numCells() * sizeof(float));
+    if (!f.good())
+      return false;
+  }
+  return std::rename(tmpFilename.c_str(), filename.c_str()) == 0;
+}
+
+bool DistanceField::attach(const std::string& filename) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(Header))) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+
+  const Header* header = static_cast<const Header*>(mapped);
+  size_t cells          = 1;
+  for (int i = 0; i < 3; ++i) {
+    const size_t size = std::max(header->size[i], 0);
+    cells *= header->tiled ? ((size + kBrickMask) >> kBrickShift)
+                                 << kBrickShift
+                           : size;
+  }
+  const size_t cellSize = header->quantized ? sizeof(uint8_t) : sizeof(float);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->resolution <= 0.0f || header->maxDistance <= 0.0f ||
+      size_t(st.st_size) < sizeof(Header) + cells * cellSize) {
+    munmap(mapped, st.st_size);
+    return false;
+  }
+
+  unmap();
+  m_codes.clear();
+  m_distances.clear();
+  m_mapped      = mapped;
+  m_mappedSize  = st.st_size;
+  m_version     = header->version;
+  m_invRes      = 1.0f / header->resolution;
+  m_maxDistance = header->maxDistance;
+  m_step        = m_maxDistance / kMaxCode;
+  m_quantized   = header->quantized;
+  m_tiled       = header->tiled;
+  for (int i = 0; i < 3; ++i) {
+    m_min[i]    = header->min[i];
+    m_size[i]   = header->size[i];
+    m_bricks[i] = (m_size[i] + kBrickMask) >> kBrickShift;
+  }
+  const char* data = static_cast<const char*>(mapped) + sizeof(Header);
+  if (m_quantized)
+    m_codeData = reinterpret_cast<const uint8_t*>(data);
+  else
+    m_distanceData = reinterpret_cast<const float*>(data);
+  return true;
+}
+
+uint64_t DistanceField::mapVersion(const octomap::OcTree& map) {
+  uint64_t hash           = 14695981039346656037ull;
+  const double resolution = map.getResolution();
+  hash                    = fnv1a(hash, &resolution, sizeof(resolution));
+  for (octomap::OcTree::leaf_iterator it = map.begin_leafs(),
+                                      end = map.end_leafs();
+       it != end; ++it) {
+    if (!map.isNodeOccupied(*it))
+      continue;
+    const octomap::OcTreeKey key = it.getKey();
+    const unsigned depth         = it.getDepth();
+    hash = fnv1a(hash, &key[0], 3 * sizeof(key[0]));
+    hash = fnv1a(hash, &depth, sizeof(depth));
+  }
+  return hash;
+}
+
+size_t DistanceField::memoryUsage() const {
+  if (m_mapped)
+    return m_mappedSize;
+  return m_codes.size() * sizeof(uint8_t) +
+         m_distances.size() * sizeof(float);
+}
+
+}  // namespace squirrel_3d_localizer
@@ -23,64 +23,163 @@
 
 #include <squirrel_3d_localizer/EndpointModel.h>
 
+#include <boost/make_shared.hpp>
+
 namespace squirrel_3d_localizer {
 
+namespace {
+typedef std::vector<std::pair<octomap::OcTreeKey, float> > VoxelChanges;
+
+/// Voxels occupied in the new map but not in the old one.
+struct OccupiedChanges {
+  OccupiedChanges(const octomap::OcTree& old, VoxelChanges& changes)
+      : old(old), changes(changes) {}
+  void operator()(const octomap::OcTreeKey& key, float value) const {
+    const octomap::OcTreeNode* node = old.search(key);
+    if (!node || !old.isNodeOccupied(node))
+      changes.push_back(std::make_pair(key, value));
+  }
+  const octomap::OcTree& old;
+  VoxelChanges& changes;
+};
+
+/// Voxels occupied in the old map but not in the new one.
+struct FreedChanges {
+  FreedChanges(const octomap::OcTree& map, VoxelChanges& changes)
+      : map(map), changes(changes) {}
+  void operator()(const octomap::OcTreeKey& key, float) const {
+    const octomap::OcTreeNode* node = map.search(key);
+    if (!node || !map.isNodeOccupied(node))
+      changes.push_back(std::make_pair(
+          key, node ? node->getLogOdds() : map.getClampingThresMinLog()));
+  }
+  const octomap::OcTree& map;
+  VoxelChanges& changes;
+};
+}  // namespace
+
 EndpointModel::EndpointModel(
     ros::NodeHandle* nh, boost::shared_ptr<MapModel> mapModel,
     EngineT* rngEngine)
     : ObservationModel(nh, mapModel, rngEngine),
       m_sigma(0.2),
-      m_maxObstacleDistance(0.5) {
+      m_maxObstacleDistance(0.5),
+      m_bakeDistanceField(true),
+      m_quantizeDistance(true),
+      m_tileDistanceField(false),
+      m_incrementalUpdate(true),
+      m_coarseLevel(0) {
   ROS_INFO("Using Endpoint observation model (precomputing...)");
 
   nh->param("endpoint/sigma", m_sigma, m_sigma);
+  nh->param("endpoint/laser_sigma", m_sensorSigma[LASER_SENSOR], m_sigma);
+  nh->param("endpoint/depth_sigma", m_sensorSigma[DEPTH_SENSOR], m_sigma);
   nh->param(
       "endpoint/max_obstacle_distance", m_maxObstacleDistance,
       m_maxObstacleDistance);
+  nh->param(
+      "endpoint/bake_distance_field", m_bakeDistanceField,
+      m_bakeDistanceField);
+  nh->param(
+      "endpoint/quantize_distance", m_quantizeDistance, m_quantizeDistance);
+  nh->param(
+      "endpoint/tile_distance_field", m_tileDistanceField,
+      m_tileDistanceField);
+  nh->param(
+      "endpoint/distance_field_file", m_distanceFieldFile,
+      m_distanceFieldFile);
+  nh->param(
+      "endpoint/incremental_update", m_incrementalUpdate,
+      m_incrementalUpdate);
 
-  if (m_sigma <= 0.0) {
+  if (m_sigma <= 0.0 || m_sensorSigma[LASER_SENSOR] <= 0.0 ||
+      m_sensorSigma[DEPTH_SENSOR] <= 0.0) {
     ROS_ERROR("Sigma (std.dev) needs to be > 0 in EndpointModel");
   }
 
+  initLogLikelihoodTable();
   initDistanceMap();
 }
 
-EndpointModel::~EndpointModel() {}
+EndpointModel::~EndpointModel() {
+  if (m_refreshThread.joinable())
+    m_refreshThread.join();
+}
 
 void EndpointModel::integrateMeasurement(
     Particles& particles, const PointCloud& pc,
-    const std::vector<float>& ranges, float max_range,
+    const std::vector<float>& ranges, const SensorTags& tags, float max_range,
     const tf::Transform& baseToSensor) {
+  assert(pc.size() == ranges.size() && pc.size() == tags.size());
+  // zero-copy view on the xyz coordinates of the points
+  const Eigen::Map<const Eigen::MatrixXf, Eigen::Aligned, Eigen::OuterStride<> >
+      points = pc.getMatrixXfMap(3, 4, 0);
+  // the field is replaced in the background when the map changes
+  const boost::shared_ptr<const DistanceField> field =
+      m_bakeDistanceField ? coarseField(distanceField())
+                          : boost::shared_ptr<const DistanceField>();
+
+  if (m_planarParticles && !particles.empty()) {
+    // roll, pitch and the sensor offset are applied once to all points
+    Eigen::Matrix3f rotation;
+    Eigen::Vector3f translation;
+    levelSensor(particles[0], baseToSensor, rotation, translation);
+    const Eigen::Matrix3Xf leveled =
+        (rotation * points).colwise() + translation;
+#pragma omp parallel for
+    for (int i = 0; i < int(particles.size()); ++i)
+      particles[i].weight += pointsLogLikelihood(
+          PlanarTransform(particles[i].pose), leveled, ranges, tags,
+          field.get());
+    return;
+  }
 
 // iterate over samples, multithreaded:
 #pragma omp parallel for
-  for (unsigned i = 0; i < particles.size(); ++i) {
-    Eigen::Matrix4f globalLaserOrigin;
-    pcl_ros::transformAsMatrix(
-        particles[i].pose * baseToSensor, globalLaserOrigin);
-    PointCloud pc_transformed;
-    pcl::transformPointCloud(pc, pc_transformed, globalLaserOrigin);
-
-    std::vector<float>::const_iterator ranges_it = ranges.begin();
-    // iterate over beams:
-    for (PointCloud::const_iterator it = pc_transformed.begin();
-         it != pc_transformed.end(); ++it, ++ranges_it) {
-      // search only for endpoint in tree
-      octomap::point3d endPoint(it->x, it->y, it->z);
-      float dist         = m_distanceMap->getDistance(endPoint);
-      float sigma_scaled = m_sigma;
-      if (m_useSquaredError)
-        sigma_scaled = (*ranges_it) * (*ranges_it) * (m_sigma);
-      if (dist > 0.0) {  // endpoint is inside map:
-        particles[i].weight += logLikelihood(dist, sigma_scaled);
-      } else {  // assign weight of max.distance:
-        particles[i].weight +=
-            logLikelihood(m_maxObstacleDistance, sigma_scaled);
-      }
+  for (int i = 0; i < int(particles.size()); ++i)
+    particles[i].weight += pointsLogLikelihood(
+        RigidTransform(particles[i].pose * baseToSensor), points, ranges, tags,
+        field.get());
+  // TODO: handle max range measurements
+}
+
+template <typename Transform, typename Points>
+double EndpointModel::pointsLogLikelihood(
+    const Transform& transform, const Points& points,
+    const std::vector<float>& ranges, const SensorTags& tags,
+    const DistanceField* field) const {
+  const bool useTable = field && field->quantized() && !m_useSquaredError;
+  const int tableSize = DistanceField::maxCode() + 1;
+  double weight       = 0.0;
+  // iterate over beams, moving each endpoint into the map frame:
+  for (int k = 0; k < int(points.cols()); ++k) {
+    const Eigen::Vector3f e = transform(points.col(k));
+    const double sigma      = m_sensorSigma[tags[k]];
+    double sigma_scaled     = sigma;
+    if (m_useSquaredError)
+      sigma_scaled = ranges[k] * ranges[k] * sigma;
+
+    if (field) {
+      // gather from the baked field, table lookup for quantized distances
+      const int idx = field->index(e.x(), e.y(), e.z());
+      if (useTable)
+        weight +=
+            m_logLikelihoodTable[tags[k] * tableSize + field->code(idx)];
+      else
+        weight += logLikelihood(field->distance(idx), sigma_scaled);
+      continue;
+    }
+
+    // search only for endpoint in tree
+    octomap::point3d endPoint(e.x(), e.y(), e.z());
+    float dist = m_distanceMap->getDistance(endPoint);
+    if (dist > 0.0) {  // endpoint is inside map:
+      weight += logLikelihood(dist, sigma_scaled);
+    } else {  // assign weight of max.distance:
+      weight += logLikelihood(m_maxObstacleDistance, sigma_scaled);
     }
-    // TODO: handle max range measurements
-    // std::cout << "\n";
   }
+  return weight;
 }
 
 bool EndpointModel::getHeightError(
@@ -106,21 +205,181 @@ bool EndpointModel::getHeightError(
 }
 
 void EndpointModel::setMap(boost::shared_ptr<octomap::OcTree> map) {
+  // one refresh at a time, the field of the last map is published last
+  if (m_refreshThread.joinable())
+    m_refreshThread.join();
   m_map = map;
-  initDistanceMap();
+  // the baked field is swapped when ready, the distance map is used directly
+  if (m_incrementalUpdate && m_bakeDistanceField)
+    m_refreshThread =
+        boost::thread(boost::bind(&EndpointModel::refreshDistanceMap, this));
+  else
+    refreshDistanceMap();
+}
+
+void EndpointModel::refreshDistanceMap() {
+  if (!m_edtMap || !updateDistanceMap())
+    initDistanceMap();
 }
 
 void EndpointModel::initDistanceMap() {
+  // attach to the field baked by another instance for the same map
+  const bool shareField = m_bakeDistanceField && !m_distanceFieldFile.empty();
+  const uint64_t version =
+      shareField ? DistanceField::mapVersion(*m_map) : uint64_t(0);
+  if (shareField) {
+    boost::shared_ptr<DistanceField> field(new DistanceField);
+    if (field->attach(m_distanceFieldFile) && field->version() == version &&
+        field->quantized() == m_quantizeDistance &&
+        field->maxDistance() == float(m_maxObstacleDistance) &&
+        std::abs(field->resolution() - m_map->getResolution()) < 1e-6) {
+      m_distanceMap.reset();
+      m_edtMap.reset();
+      publishDistanceField(field);
+      ROS_INFO_STREAM(
+          ros::this_node::getName()
+          << ": Attached to distance field " << m_distanceFieldFile << " ("
+          << field->memoryUsage() / (1024.0 * 1024.0) << " MB)");
+      return;
+    }
+  }
+
   double x, y, z;
   m_map->getMetricMin(x, y, z);
   octomap::point3d min(x, y, z);
   m_map->getMetricMax(x, y, z);
   octomap::point3d max(x, y, z);
-  m_distanceMap = boost::shared_ptr<DynamicEDTOctomap>(new DynamicEDTOctomap(
-      float(m_maxObstacleDistance), &(*m_map), min, max, false));
-  m_distanceMap->update();
+  // The distance map reads the occupancy of the tree it is built on. For
+  // incremental updates it gets a copy that follows the changes of the map.
+  boost::shared_ptr<octomap::OcTree> edtMap =
+      m_incrementalUpdate ? boost::make_shared<octomap::OcTree>(*m_map)
+                          : m_map;
+  boost::shared_ptr<DynamicEDTOctomap> distanceMap(new DynamicEDTOctomap(
+      float(m_maxObstacleDistance), &(*edtMap), min, max, false));
+  distanceMap->update();
+
+  if (m_bakeDistanceField) {
+    boost::shared_ptr<DistanceField> field(new DistanceField);
+    field->bake(
+        *distanceMap, min, max, m_map->getResolution(),
+        float(m_maxObstacleDistance), m_quantizeDistance, m_tileDistanceField);
+    ROS_INFO_STREAM(
+        ros::this_node::getName()
+        << ": Baked distance field uses "
+        << field->memoryUsage() / (1024.0 * 1024.0) << " MB");
+    if (shareField && !field->save(m_distanceFieldFile, version))
+      ROS_WARN_STREAM(
+          ros::this_node::getName() << ": Could not write distance field "
+                                    << m_distanceFieldFile);
+    publishDistanceField(field);
+  }
+
+  if (m_incrementalUpdate) {
+    edtMap->enableChangeDetection(true);
+    m_edtMap = edtMap;
+    m_edtMin = min;
+    m_edtMax = max;
+  } else {
+    m_edtMap.reset();
+  }
+  // without updates the baked field replaces the distance map
+  if (m_incrementalUpdate || !m_bakeDistanceField)
+    m_distanceMap = distanceMap;
+  else
+    m_distanceMap.reset();
   ROS_INFO_STREAM(
       ros::this_node::getName()
       << ": Distance map for endpoint model completed");
 }
+
+bool EndpointModel::updateDistanceMap() {
+  octomap::OcTree& edtMap    = *m_edtMap;
+  const octomap::OcTree& map = *m_map;
+  // the distance map cannot grow, larger maps are computed from scratch
+  double x, y, z;
+  map.getMetricMin(x, y, z);
+  const octomap::point3d min(x, y, z);
+  map.getMetricMax(x, y, z);
+  const octomap::point3d max(x, y, z);
+  const double eps = 1e-3;
+  if (std::abs(map.getResolution() - edtMap.getResolution()) > 1e-6)
+    return false;
+  for (int i = 0; i < 3; ++i)
+    if (min(i) < m_edtMin(i) - eps || max(i) > m_edtMax(i) + eps)
+      return false;
+
+  // voxels whose occupancy differs, with the log-odds of the new map
+  VoxelChanges changes;
+  MapModel::forEachOccupiedVoxel(map, OccupiedChanges(edtMap, changes));
+  MapModel::forEachOccupiedVoxel(edtMap, FreedChanges(map, changes));
+
+  octomap::point3d changedMin(x, y, z), changedMax = min;
+  for (size_t i = 0; i < changes.size(); ++i) {
+    edtMap.setNodeValue(changes[i].first, changes[i].second);
+    const octomap::point3d p = edtMap.keyToCoord(changes[i].first);
+    for (int k = 0; k < 3; ++k) {
+      changedMin(k) = std::min(changedMin(k), p(k));
+      changedMax(k) = std::max(changedMax(k), p(k));
+    }
+  }
+  m_distanceMap->update();
+
+  if (m_bakeDistanceField && !changes.empty()) {
+    // distances change at most m_maxObstacleDistance away from an update
+    const float margin = m_maxObstacleDistance + map.getResolution();
+    boost::shared_ptr<DistanceField> field(
+        new DistanceField(*distanceField()));
+    field->bakeRegion(
+        *m_distanceMap,
+        changedMin - octomap::point3d(margin, margin, margin),
+        changedMax + octomap::point3d(margin, margin, margin));
+    if (!m_distanceFieldFile.empty() &&
+        !field->save(m_distanceFieldFile, DistanceField::mapVersion(map)))
+      ROS_WARN_STREAM(
+          ros::this_node::getName() << ": Could not write distance field "
+                                    << m_distanceFieldFile);
+    publishDistanceField(field);
+  }
+  ROS_INFO_STREAM(
+      ros::this_node::getName() << ": Distance map updated, " << changes.size()
+                                << " voxels changed");
+  return true;
+}
+
+boost::shared_ptr<const DistanceField> EndpointModel::distanceField() const {
+  boost::mutex::scoped_lock lock(m_distanceFieldMutex);
+  return m_distanceField;
+}
+
+boost::shared_ptr<const DistanceField> EndpointModel::coarseField(
+    const boost::shared_ptr<const DistanceField>& field) {
+  if (m_resolutionLevel <= 0 || !field)
+    return field;
+  if (field != m_coarseSource || m_resolutionLevel != m_coarseLevel) {
+    boost::shared_ptr<DistanceField> coarse(new DistanceField);
+    coarse->coarsen(*field, 1 << m_resolutionLevel);
+    m_coarseSource = field;
+    m_coarseField  = coarse;
+    m_coarseLevel  = m_resolutionLevel;
+  }
+  return m_coarseField;
+}
+
+void EndpointModel::publishDistanceField(
+    const boost::shared_ptr<const DistanceField>& field) {
+  boost::mutex::scoped_lock lock(m_distanceFieldMutex);
+  m_distanceField = field;
+}
+
+void EndpointModel::initLogLikelihoodTable() {
+  // the quantization of a field baked with m_maxObstacleDistance
+  const double step   = m_maxObstacleDistance / DistanceField::maxCode();
+  const int tableSize = DistanceField::maxCode() + 1;
+  m_logLikelihoodTable.resize(NUM_SENSOR_TYPES * tableSize);
+  for (int s = 0; s < NUM_SENSOR_TYPES; ++s) {
+    for (int c = 0; c < tableSize; ++c)
+      m_logLikelihoodTable[s * tableSize + c] =
+          logLikelihood(c * step, m_sensorSigma[s]);
+  }
+}
 }
@@ -0,0 +1,257 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/FilterSnapshot.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace squirrel_3d_localizer {
+
+namespace {
+const char kMagic[8] = {'S', '3', 'D', 'F', 'S', 'N', '0', '2'};
+}  // namespace
+
+const size_t FilterSnapshot::kParticleSize;
+const size_t FilterSnapshot::kImuSize;
+
+FilterSnapshot::FilterSnapshot()
+    : m_mapped(NULL),
+      m_mappedSize(0),
+      m_numParticles(0),
+      m_imuCapacity(0),
+      m_slotSize(0),
+      m_sequence(0) {}
+
+FilterSnapshot::~FilterSnapshot() { unmap(); }
+
+void FilterSnapshot::unmap() {
+  if (m_mapped)
+    munmap(m_mapped, m_mappedSize);
+  m_mapped     = NULL;
+  m_mappedSize = 0;
+}
+
+bool FilterSnapshot::open(
+    const std::string& filename, size_t numParticles, size_t imuCapacity) {
+  unmap();
+  m_numParticles = numParticles;
+  m_imuCapacity  = imuCapacity;
+  m_slotSize     = sizeof(SlotHeader) +
+               sizeof(double) *
+                   (numParticles * kParticleSize + imuCapacity * kImuSize) +
+               sizeof(uint64_t);
+  const size_t size = sizeof(Header) + 2 * m_slotSize;
+
+  const int fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  // a file of another size is zeroed, which marks both slots empty
+  if (size_t(st.st_size) != size &&
+      (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0)) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+
+  m_mapped     = mapped;
+  m_mappedSize = size;
+
+  Header* header = static_cast<Header*>(m_mapped);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->num_particles != numParticles ||
+      header->imu_capacity != imuCapacity) {
+    std::memset(m_mapped, 0, size);
+    std::memcpy(header->magic, kMagic, sizeof(kMagic));
+    header->num_particles = numParticles;
+    header->imu_capacity  = imuCapacity;
+  }
+
+  const int newest = newestSlot();
+  m_sequence =
+      newest < 0 ? 0
+                 : reinterpret_cast<const SlotHeader*>(slot(newest))->sequence;
+  return true;
+}
+
+char* FilterSnapshot::slot(unsigned index) const {
+  return static_cast<char*>(m_mapped) + sizeof(Header) + index * m_slotSize;
+}
+
+int FilterSnapshot::newestSlot() const {
+  int newest       = -1;
+  uint64_t highest = 0;
+  for (unsigned i = 0; i < 2; ++i) {
+    const char* data         = slot(i);
+    const SlotHeader* header = reinterpret_cast<const SlotHeader*>(data);
+    uint64_t closing;
+    std::memcpy(
+        &closing, data + m_slotSize - sizeof(uint64_t), sizeof(uint64_t));
+    if (header->sequence != 0 && header->sequence == closing &&
+        header->sequence > highest) {
+      highest = header->sequence;
+      newest  = i;
+    }
+  }
+  return newest;
+}
+
+void FilterSnapshot::write(
+    const ros::Time& stamp, const Particles& particles,
+    const tf::Stamped<tf::Pose>* odomPose,
+    const ImuBuffer& imu) {
+  if (!m_mapped || particles.size() > m_numParticles)
+    return;
+
+  const uint64_t sequence = m_sequence + 1;
+  char* data              = slot(sequence % 2);
+  SlotHeader* header      = reinterpret_cast<SlotHeader*>(data);
+
+  // open the slot before its contents change
+  header->sequence = sequence;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  header->stamp         = stamp.toSec();
+  header->num_particles = particles.size();
+  header->num_imu       = std::min(imu.size(), m_imuCapacity);
+  header->has_odom_pose = odomPose != NULL;
+  if (odomPose) {
+    const tf::Vector3& origin = odomPose->getOrigin();
+    const tf::Quaternion q    = odomPose->getRotation();
+    const double odom[7]      = {origin.x(), origin.y(), origin.z(), q.x(),
+                            q.y(),      q.z(),      q.w()};
+    header->odom_stamp        = odomPose->stamp_.toSec();
+    std::memcpy(header->odom_pose, odom, sizeof(odom));
+  }
+
+  double* values = reinterpret_cast<double*>(data + sizeof(SlotHeader));
+  for (Particles::const_iterator it = particles.begin(); it != particles.end();
+       ++it, values += kParticleSize) {
+    const tf::Vector3& origin = it->pose.getOrigin();
+    const tf::Quaternion q    = it->pose.getRotation();
+    values[0]                 = origin.x();
+    values[1]                 = origin.y();
+    values[2]                 = origin.z();
+    values[3]                 = q.x();
+    values[4]                 = q.y();
+    values[5]                 = q.z();
+    values[6]                 = q.w();
+    values[7]                 = it->weight;
+  }
+
+  values = reinterpret_cast<double*>(
+      data + sizeof(SlotHeader) +
+      sizeof(double) * m_numParticles * kParticleSize);
+  // the newest samples, if the buffer is larger than the slot
+  for (size_t i = imu.size() - header->num_imu; i < imu.size();
+       ++i, values += kImuSize) {
+    const ImuBuffer::Sample& sample = imu[i];
+    values[0]                       = sample.stamp.toSec();
+    values[1]                       = sample.roll;
+    values[2]                       = sample.pitch;
+    values[3]                       = sample.orientation.x();
+    values[4]                       = sample.orientation.y();
+    values[5]                       = sample.orientation.z();
+    values[6]                       = sample.orientation.w();
+  }
+
+  // close it, the slot is complete from here on
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::memcpy(
+      data + m_slotSize - sizeof(uint64_t), &sequence, sizeof(uint64_t));
+  m_sequence = sequence;
+
+  // schedule the write back, the page cache survives a crash of the process
+  msync(m_mapped, m_mappedSize, MS_ASYNC);
+}
+
+bool FilterSnapshot::stamp(ros::Time& stamp) const {
+  if (!m_mapped)
+    return false;
+  const int newest = newestSlot();
+  if (newest < 0)
+    return false;
+  stamp.fromSec(reinterpret_cast<const SlotHeader*>(slot(newest))->stamp);
+  return true;
+}
+
+bool FilterSnapshot::read(
+    Particles& particles, bool& hasOdomPose, tf::Stamped<tf::Pose>& odomPose,
+    ImuBuffer& imu) const {
+  if (!m_mapped)
+    return false;
+  const int newest = newestSlot();
+  if (newest < 0)
+    return false;
+
+  const char* data         = slot(newest);
+  const SlotHeader* header = reinterpret_cast<const SlotHeader*>(data);
+
+  hasOdomPose = header->has_odom_pose != 0;
+  if (hasOdomPose) {
+    const double* odom = header->odom_pose;
+    odomPose.setOrigin(tf::Vector3(odom[0], odom[1], odom[2]));
+    odomPose.setRotation(tf::Quaternion(odom[3], odom[4], odom[5], odom[6]));
+    odomPose.stamp_.fromSec(header->odom_stamp);
+  }
+
+  const double* values =
+      reinterpret_cast<const double*>(data + sizeof(SlotHeader));
+  particles.resize(header->num_particles);
+  for (Particles::iterator it = particles.begin(); it != particles.end();
+       ++it, values += kParticleSize) {
+    it->pose.setOrigin(tf::Vector3(values[0], values[1], values[2]));
+    it->pose.setRotation(
+        tf::Quaternion(values[3], values[4], values[5], values[6]));
+    it->weight = values[7];
+  }
+
+  values = reinterpret_cast<const double*>(
+      data + sizeof(SlotHeader) +
+      sizeof(double) * m_numParticles * kParticleSize);
+  imu.clear();
+  ImuBuffer::Sample sample;
+  for (uint32_t i = 0; i < header->num_imu; ++i, values += kImuSize) {
+    sample.stamp.fromSec(values[0]);
+    sample.roll        = values[1];
+    sample.pitch       = values[2];
+    sample.orientation =
+        tf::Quaternion(values[3], values[4], values[5], values[6]);
+    imu.push(sample);
+  }
+  return true;
+}
+
+}  // namespace squirrel_3d_localizer
@@ -0,0 +1,65 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/ImuBuffer.h>
+
+#include <algorithm>
+
+namespace squirrel_3d_localizer {
+
+ImuBuffer::ImuBuffer(size_t capacity)
+    : m_samples(std::max<size_t>(capacity, 1)), m_first(0), m_size(0) {}
+
+void ImuBuffer::swap(ImuBuffer& other) {
+  m_samples.swap(other.m_samples);
+  std::swap(m_first, other.m_first);
+  std::swap(m_size, other.m_size);
+}
+
+bool ImuBuffer::push(const Sample& sample) {
+  if (m_size > 0 && sample.stamp <= back().stamp)
+    return false;
+  if (m_size < m_samples.size()) {
+    m_samples[(m_first + m_size) % m_samples.size()] = sample;
+    ++m_size;
+  } else {
+    m_samples[m_first] = sample;
+    m_first            = (m_first + 1) % m_samples.size();
+  }
+  return true;
+}
+
+void ImuBuffer::bracket(
+    const ros::Time& t, const Sample*& older, const Sample*& newer) const {
+  // first sample newer than t
+  size_t low = 0, high = m_size;
+  while (low < high) {
+    const size_t middle = (low + high) / 2;
+    if ((*this)[middle].stamp <= t)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  older = low > 0 ? &(*this)[low - 1] : NULL;
+  newer = low < m_size ? &(*this)[low] : NULL;
+}
+
+}  // namespace squirrel_3d_localizer
@@ -0,0 +1,106 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/KLDSampling.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_3d_localizer {
+
+KLDSampling::KLDSampling(ros::NodeHandle* nh)
+    : m_enabled(false),
+      m_minParticles(100),
+      m_maxParticles(5000),
+      m_errorBound(0.05),
+      m_upperQuantile(2.326),
+      m_binSizeXY(0.5),
+      m_binSizeZ(0.5),
+      m_binSizeYaw(M_PI / 18.0),
+      m_numDrawn(0),
+      m_requiredParticles(0) {
+  nh->param("kld_sampling/enabled", m_enabled, m_enabled);
+  nh->param("kld_sampling/min_particles", m_minParticles, m_minParticles);
+  nh->param("kld_sampling/max_particles", m_maxParticles, m_maxParticles);
+  nh->param("kld_sampling/error_bound", m_errorBound, m_errorBound);
+  nh->param("kld_sampling/upper_quantile", m_upperQuantile, m_upperQuantile);
+  nh->param("kld_sampling/bin_size_xy", m_binSizeXY, m_binSizeXY);
+  nh->param("kld_sampling/bin_size_z", m_binSizeZ, m_binSizeZ);
+  nh->param("kld_sampling/bin_size_yaw", m_binSizeYaw, m_binSizeYaw);
+
+  m_minParticles = std::max(m_minParticles, 1);
+  if (m_maxParticles < m_minParticles) {
+    ROS_ERROR(
+        "KLDSampling: need min_particles <= max_particles, fixed at %d",
+        m_minParticles);
+    m_maxParticles = m_minParticles;
+  }
+  if (m_errorBound <= 0.0 || m_binSizeXY <= 0.0 || m_binSizeZ <= 0.0 ||
+      m_binSizeYaw <= 0.0) {
+    ROS_ERROR("KLDSampling: error bound and bin sizes must be positive");
+    m_enabled = false;
+  }
+  if (m_enabled)
+    ROS_INFO(
+        "Adapting the number of particles in [%d, %d] by KLD-sampling, "
+        "error bound %f",
+        m_minParticles, m_maxParticles, m_errorBound);
+  reset();
+}
+
+KLDSampling::~KLDSampling() {}
+
+void KLDSampling::reset() {
+  m_bins.clear();
+  m_numDrawn          = 0;
+  m_requiredParticles = m_minParticles;
+}
+
+bool KLDSampling::add(const tf::Pose& pose) {
+  ++m_numDrawn;
+  if (m_bins.insert(bin(pose)).second)
+    m_requiredParticles = std::min<size_t>(
+        m_maxParticles,
+        std::max<size_t>(m_minParticles, bound(m_bins.size())));
+  return m_numDrawn < m_requiredParticles;
+}
+
+size_t KLDSampling::bound(size_t k) const {
+  if (k <= 1)
+    return 1;
+  const double a = 2.0 / (9.0 * (k - 1));
+  const double b = 1.0 - a + std::sqrt(a) * m_upperQuantile;
+  return std::ceil((k - 1) / (2.0 * m_errorBound) * b * b * b);
+}
+
+int64_t KLDSampling::bin(const tf::Pose& pose) const {
+  // 16 bits per coordinate, wrapping far away is harmless for the count
+  const tf::Vector3& origin = pose.getOrigin();
+  const int64_t x = int64_t(std::floor(origin.x() / m_binSizeXY)) & 0xffff;
+  const int64_t y = int64_t(std::floor(origin.y() / m_binSizeXY)) & 0xffff;
+  const int64_t z = int64_t(std::floor(origin.z() / m_binSizeZ)) & 0xffff;
+  const int64_t yaw =
+      int64_t(std::floor(tf::getYaw(pose.getRotation()) / m_binSizeYaw)) &
+      0xffff;
+  return (x << 48) | (y << 32) | (z << 16) | yaw;
+}
+
+}  // namespace squirrel_3d_localizer
@@ -19,13 +19,28 @@
  */
 
 #include <squirrel_3d_localizer/MapModel.h>
+#include <squirrel_3d_localizer/RandomNumbers.h>
 
+#include <algorithm>
 #include <limits>
 
 namespace squirrel_3d_localizer {
 
+namespace {
+/// Packs the key of a voxel so that voxels sort by column, then by height.
+struct ColumnKeys {
+  explicit ColumnKeys(std::vector<uint64_t>& keys) : keys(keys) {}
+  void operator()(const octomap::OcTreeKey& key, float) const {
+    keys.push_back(
+        (uint64_t(key[0]) << 32) | (uint64_t(key[1]) << 16) | key[2]);
+  }
+  std::vector<uint64_t>& keys;
+};
+}  // namespace
+
 MapModel::MapModel(ros::NodeHandle* nh)
-    : m_useMapBounds(false),
+    : m_floorCellsHeight(-1.0),
+      m_useMapBounds(false),
       m_motionMeanZ(0.0),
       m_motionRangeZ(-1.0),
       m_motionRangeRoll(-1.0),
@@ -136,42 +151,85 @@ void MapModel::initGlobal(
     Particles& particles, double z, double roll, double pitch,
     const Vector6d& initNoise, UniformGeneratorT& rngUniform,
     NormalGeneratorT& rngNormal) {
-  double sizeX, sizeY, sizeZ, minX, minY, minZ;
-  m_map->getMetricSize(sizeX, sizeY, sizeZ);
-  m_map->getMetricMin(minX, minY, minZ);
+  const double totalHeight = 0.6;
+  if (m_floorCells.empty() || m_floorCellsHeight != totalHeight)
+    initFloorCells(totalHeight);
+  if (m_floorCells.empty()) {
+    ROS_ERROR_STREAM(
+        ros::this_node::getName()
+        << ": No free floor in the map, cannot initialize globally");
+    return;
+  }
+
+  // counter-based noise, every particle is sampled independently
+  const uint64_t seedHigh = uint64_t(rngUniform() * 4294967296.0);
+  const uint64_t seedLow  = uint64_t(rngUniform() * 4294967296.0);
+  const Philox4x32 generator((seedHigh << 32) | seedLow);
+  const double res    = m_map->getResolution();
+  const double weight = 1.0 / particles.size();
+
+#pragma omp parallel for
+  for (int i = 0; i < int(particles.size()); ++i) {
+    uint32_t position[4], orientation[4];
+    double noise[2];
+    generator(3 * uint64_t(i), position);
+    generator(3 * uint64_t(i) + 1, orientation);
+    generator.normalPair(3 * uint64_t(i) + 2, noise);
+    // a floor cell uniformly, then a position within it
+    const FloorCell& cell = m_floorCells[std::min<size_t>(
+        m_floorCells.size() - 1,
+        size_t(Philox4x32::toUniform(position[0], position[1]) *
+               m_floorCells.size()))];
+    const double x   = cell.x + (position[2] / 4294967296.0 - 0.5) * res;
+    const double y   = cell.y + (position[3] / 4294967296.0 - 0.5) * res;
+    const double yaw =
+        Philox4x32::toUniform(orientation[0], orientation[1]) * 2 * M_PI - M_PI;
+    // TODO: sample roll, pitch
+    particles[i].pose.setOrigin(
+        tf::Vector3(x, y, cell.z + z + noise[0] * initNoise(2)));
+    particles[i].pose.setRotation(
+        tf::createQuaternionFromRPY(roll, pitch, yaw));
+    particles[i].weight = weight;
+  }
+}
+
+void MapModel::initFloorCells(double totalHeight) {
+  m_floorCells.clear();
+  m_floorCellsHeight = totalHeight;
+
+  std::vector<uint64_t> keys;
+  forEachOccupiedVoxel(*m_map, ColumnKeys(keys));
+  std::sort(keys.begin(), keys.end());
 
-  double weight          = 1.0 / particles.size();
-  Particles::iterator it = particles.begin();
-  while (true) {
-    if (it == particles.end())
-      break;
-    // obtain a pose hypothesis:
-    double x = minX + sizeX * rngUniform();
-    double y = minY + sizeY * rngUniform();
-    std::vector<double> z_list;
-    getHeightlist(x, y, 0.6, z_list);
-
-    for (unsigned zIdx = 0; zIdx < z_list.size(); zIdx++) {
-      if (it == particles.end())
-        break;
-
-      // not needed => we already know that z contains valid poses
-      // distance map: used distance from obstacles:
-      // std::abs(node->getLogOdds()) < 0.1){
-      //			if (!isOccupied(octomap::point3d(x, y,
-      // z[zIdx]))){
-
-      it->pose.getOrigin().setX(x);
-      it->pose.getOrigin().setY(y);
-      // TODO: sample z, roll, pitch
-      it->pose.getOrigin().setZ(
-          z_list.at(zIdx) + z + rngNormal() * initNoise(2));
-      double yaw = rngUniform() * 2 * M_PI - M_PI;
-      it->pose.setRotation(tf::createQuaternionFromRPY(roll, pitch, yaw));
-      it->weight = weight;
-      it++;
+  // Sweep every column top down like getHeightlist(): an occupied voxel is
+  // floor when the free space above it is at least totalHeight.
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  m_map->getMetricMin(minX, minY, minZ);
+  m_map->getMetricMax(maxX, maxY, maxZ);
+  const double res   = m_map->getResolution();
+  const int topKey   = m_map->coordToKey(maxZ - res / 2.0);
+  const double clear = totalHeight + res - 1e-6;
+  size_t end         = keys.size();
+  while (end > 0) {
+    const uint64_t column = keys[end - 1] >> 16;
+    int lastKey           = topKey + 1;
+    size_t k              = end;
+    for (; k > 0 && (keys[k - 1] >> 16) == column; --k) {
+      const int key = keys[k - 1] & 0xffff;
+      if ((lastKey - key) * res >= clear) {
+        FloorCell cell;
+        cell.x = m_map->keyToCoord(octomap::key_type(column >> 16));
+        cell.y = m_map->keyToCoord(octomap::key_type(column & 0xffff));
+        cell.z = m_map->keyToCoord(octomap::key_type(key)) + res / 2.0;
+        m_floorCells.push_back(cell);
+      }
+      lastKey = key;
     }
+    end = k;
   }
+  ROS_INFO_STREAM(
+      ros::this_node::getName() << ": " << m_floorCells.size()
+                                << " floor cells for global localization");
 }
 
 void MapModel::getHeightlist(
@@ -262,19 +320,36 @@ double DistanceMap::getFloorHeight(const tf::Transform& pose) const {
 ///////////////////////////////////////////////////////////////////////
 
 OccupancyMap::OccupancyMap(ros::NodeHandle* nh) : MapModel(nh) {
-  std::string servname = "octomap_binary";
-  ROS_INFO("Requesting the map from %s...", nh->resolveName(servname).c_str());
-  octomap_msgs::GetOctomap::Request req;
-  octomap_msgs::GetOctomap::Response resp;
-  while (nh->ok() && !ros::service::call(servname, req, resp)) {
-    ROS_WARN(
-        "%s: Request to %s failed; trying again...",
-        ros::this_node::getName().c_str(), nh->resolveName(servname).c_str());
-    usleep(1000000);
-  }
+  std::string mapFile;
+  nh->param("map_file", mapFile, std::string(""));
+  if (!mapFile.empty()) {
+    // e.g. for offline replay, without an octomap_server
+    ROS_INFO("Reading the map from %s...", mapFile.c_str());
+    if (mapFile.size() > 3 && mapFile.substr(mapFile.size() - 3) == ".bt") {
+      m_map.reset(new octomap::OcTree(0.1));
+      if (!m_map->readBinary(mapFile))
+        m_map.reset();
+    } else {
+      m_map.reset(dynamic_cast<octomap::OcTree*>(
+          octomap::AbstractOcTree::read(mapFile)));
+    }
+  } else {
+    std::string servname = "octomap_binary";
+    ROS_INFO(
+        "Requesting the map from %s...", nh->resolveName(servname).c_str());
+    octomap_msgs::GetOctomap::Request req;
+    octomap_msgs::GetOctomap::Response resp;
+    while (nh->ok() && !ros::service::call(servname, req, resp)) {
+      ROS_WARN(
+          "%s: Request to %s failed; trying again...",
+          ros::this_node::getName().c_str(),
+          nh->resolveName(servname).c_str());
+      usleep(1000000);
+    }
 
-  m_map.reset(
-      dynamic_cast<octomap::OcTree*>(octomap_msgs::binaryMsgToMap(resp.map)));
+    m_map.reset(dynamic_cast<octomap::OcTree*>(
+        octomap_msgs::binaryMsgToMap(resp.map)));
+  }
 
   if (!m_map || m_map->size() <= 1) {
     ROS_ERROR("Occupancy map is erroneous, exiting...");
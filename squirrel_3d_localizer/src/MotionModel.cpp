@@ -25,12 +25,14 @@
 
 namespace squirrel_3d_localizer {
 
+const uint64_t MotionModel::kNoiseCounters;
+
 MotionModel::MotionModel(
     ros::NodeHandle* nh, EngineT* rngEngine, tf::TransformListener* tf,
     const std::string& odomFrameId, const std::string& baseFrameId)
     : m_tfListener(tf),
-      m_rngNormal(*rngEngine, NormalDistributionT(0.0, 1.0)),
       m_rngUniform(*rngEngine, UniformDistributionT(0.0, 1.0)),
+      m_noiseCounter(0),
       m_odomFrameId(odomFrameId),
       m_baseFrameId(baseFrameId),
       m_firstOdometryReceived(false) {
@@ -86,13 +88,18 @@ MotionModel::MotionModel(
   nh->param("motion_calib/ty", m_odomCalibration2D(2, 1), 0.0);
   nh->param("motion_calib/tt", m_odomCalibration2D(2, 2), 1.0);
 
+  // the noise only depends on the seed of the localizer's engine
+  const uint64_t seedHigh = (*rngEngine)();
+  const uint64_t seedLow  = (*rngEngine)();
+  m_noiseGenerator        = Philox4x32((seedHigh << 32) | seedLow);
+
   reset();
 }
 
 MotionModel::~MotionModel() {}
 
-tf::Transform MotionModel::odomTransformNoise(
-    const tf::Transform& odomTransform) {
+Vector6d MotionModel::odomNoiseStdDev(
+    const tf::Transform& odomTransform) const {
   // vectors (x,y,theta) in 2D for squared motion and variance
   Eigen::Vector3d motion2D_sq, motion_variance;
   double yaw = tf::getYaw(odomTransform.getRotation());
@@ -111,33 +118,50 @@ tf::Transform MotionModel::odomTransformNoise(
   // absolute amount of translation, used to scale noise in z, roll & pitch
   // (about 1-2cm for each update step)
   const double d = odomTransform.getOrigin().length();
+  Vector6d stdDev;
+  stdDev << d * m_odomNoiseRoll, d * m_odomNoisePitch,
+      sqrt(motion_variance(2)), sqrt(motion_variance(0)),
+      sqrt(motion_variance(1)), d * m_odomNoiseZ;
+  return stdDev;
+}
+
+tf::Transform MotionModel::odomTransformNoise(
+    const Vector6d& stdDev, uint64_t counter) const {
+  // roll, pitch, yaw, x, y, z from three consecutive counters
+  double n[6];
+  m_noiseGenerator.normalPair(counter, n);
+  m_noiseGenerator.normalPair(counter + 1, n + 2);
+  m_noiseGenerator.normalPair(counter + 2, n + 4);
   return tf::Transform(
       tf::createQuaternionFromRPY(
-          m_rngNormal() * d * m_odomNoiseRoll,        // roll
-          m_rngNormal() * d * m_odomNoisePitch,       // pitch
-          m_rngNormal() * sqrt(motion_variance(2))),  // yaw
-      tf::Vector3(
-          m_rngNormal() * sqrt(motion_variance(0)),  // x
-          m_rngNormal() * sqrt(motion_variance(1)),  // y
-          m_rngNormal() * d * m_odomNoiseZ));        // z
+          n[0] * stdDev(0), n[1] * stdDev(1), n[2] * stdDev(2)),
+      tf::Vector3(n[3] * stdDev(3), n[4] * stdDev(4), n[5] * stdDev(5)));
 }
 
 void MotionModel::reset() { m_firstOdometryReceived = false; }
 
 void MotionModel::applyOdomTransform(
     tf::Pose& particlePose, const tf::Transform& odomTransform) {
-  particlePose *=
-      calibrateOdometry(odomTransform) * odomTransformNoise(odomTransform);
+  particlePose *= calibrateOdometry(odomTransform) *
+                  odomTransformNoise(
+                      odomNoiseStdDev(odomTransform), m_noiseCounter);
+  m_noiseCounter += kNoiseCounters;
 }
 
 void MotionModel::applyOdomTransform(
     Particles& particles, const tf::Transform& odomTransform) {
   const tf::Transform calibratedOdomTransform =
       calibrateOdometry(odomTransform);
+  const Vector6d stdDev  = odomNoiseStdDev(odomTransform);
+  const uint64_t counter = m_noiseCounter;
+  m_noiseCounter += kNoiseCounters * particles.size();
 
-  for (unsigned i = 0; i < particles.size(); ++i) {
+  // particle i always draws from the same counters, whatever the schedule
+#pragma omp parallel for
+  for (int i = 0; i < int(particles.size()); ++i) {
     particles[i].pose *=
-        calibratedOdomTransform * odomTransformNoise(odomTransform);
+        calibratedOdomTransform *
+        odomTransformNoise(stdDev, counter + kNoiseCounters * i);
   }
 }
 
@@ -242,8 +266,20 @@ void MotionModel::storeOdomPose(const tf::Stamped<tf::Pose>& odomPose) {
   }
 }
 
+void MotionModel::setPoseCache(
+    const boost::shared_ptr<const PoseCache>& poseCache) {
+  m_poseCache = poseCache;
+}
+
 bool MotionModel::lookupOdomPose(
     const ros::Time& t, tf::Stamped<tf::Pose>& odomPose) const {
+  tf::StampedTransform cached;
+  if (m_poseCache &&
+      m_poseCache->lookupTransform(m_odomFrameId, m_baseFrameId, t, cached)) {
+    odomPose = tf::Stamped<tf::Pose>(cached, cached.stamp_, m_odomFrameId);
+    return true;
+  }
+
   tf::Stamped<tf::Pose> ident(
       tf::Transform(tf::createIdentityQuaternion(), tf::Vector3(0, 0, 0)), t,
       m_baseFrameId);
@@ -263,6 +299,11 @@ bool MotionModel::lookupOdomPose(
 bool MotionModel::lookupLocalTransform(
     const std::string& targetFrame, const ros::Time& t,
     tf::StampedTransform& localTransform) const {
+  if (m_poseCache &&
+      m_poseCache->lookupTransform(
+          targetFrame, m_baseFrameId, t, localTransform))
+    return true;
+
   try {
     m_tfListener->lookupTransform(
         targetFrame, m_baseFrameId, t, localTransform);
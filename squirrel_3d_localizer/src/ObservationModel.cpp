@@ -30,7 +30,9 @@ ObservationModel::ObservationModel(ros::NodeHandle *nh,
                                    EngineT *rngEngine)
     : m_mapModel(mapModel),
       m_rngNormal(*rngEngine, NormalDistributionT(0.0, 1.0)),
-      m_rngUniform(*rngEngine, UniformDistributionT(0.0, 1.0)) {
+      m_rngUniform(*rngEngine, UniformDistributionT(0.0, 1.0)),
+      m_planarParticles(false),
+      m_resolutionLevel(0) {
 
   m_map = m_mapModel->getMap();
   
@@ -79,4 +81,21 @@ void ObservationModel::setMap(boost::shared_ptr<octomap::OcTree> map) {
   m_map = map;
 }
 
+void ObservationModel::levelSensor(
+    const Particle& p, const tf::Transform& baseToSensor,
+    Eigen::Matrix3f& rotation, Eigen::Vector3f& translation) {
+  double roll, pitch, yaw;
+  p.pose.getBasis().getRPY(roll, pitch, yaw);
+  toEigen(
+      tf::Transform(
+          tf::createQuaternionFromRPY(roll, pitch, 0.0), tf::Vector3(0, 0, 0)) *
+          baseToSensor,
+      rotation, translation);
+}
+
+void ObservationModel::setMapModel(boost::shared_ptr<MapModel> mapModel) {
+  m_mapModel = mapModel;
+  setMap(m_mapModel->getMap());
+}
+
 } // namespace squirrel_3d_localizer
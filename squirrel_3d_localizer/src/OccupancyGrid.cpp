@@ -0,0 +1,148 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <squirrel_3d_localizer/OccupancyGrid.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace squirrel_3d_localizer {
+
+OccupancyGrid::OccupancyGrid()
+    : m_min(Eigen::Vector3f::Zero()), m_resolution(1.0f), m_invRes(1.0f) {
+  m_size[0] = m_size[1] = m_size[2] = 0;
+}
+
+void OccupancyGrid::voxelize(const octomap::OcTree& map) {
+  double x, y, z;
+  map.getMetricMin(x, y, z);
+  m_min = Eigen::Vector3f(x, y, z);
+  double max[3];
+  map.getMetricMax(max[0], max[1], max[2]);
+
+  m_resolution = map.getResolution();
+  m_invRes     = 1.0f / m_resolution;
+  for (int i = 0; i < 3; ++i)
+    m_size[i] = std::max(
+        0, static_cast<int>(std::ceil((max[i] - m_min(i)) * m_invRes - 1e-3)));
+  m_cells.assign(
+      static_cast<size_t>(m_size[0]) * m_size[1] * m_size[2], uint8_t(0));
+
+  // leaves above the finest depth cover several cells
+  for (octomap::OcTree::leaf_iterator it = map.begin_leafs(),
+                                      end = map.end_leafs();
+       it != end; ++it) {
+    if (!map.isNodeOccupied(*it))
+      continue;
+    const float half = 0.5 * it.getSize();
+    int lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+      const float c = it.getCoordinate()(i);
+      lo[i] = std::max(
+          0, static_cast<int>(std::floor((c - half - m_min(i)) * m_invRes +
+                                         1e-3)));
+      hi[i] = std::min(
+          m_size[i], static_cast<int>(std::ceil(
+                         (c + half - m_min(i)) * m_invRes - 1e-3)));
+    }
+    for (int iz = lo[2]; iz < hi[2]; ++iz)
+      for (int iy = lo[1]; iy < hi[1]; ++iy)
+        for (int ix = lo[0]; ix < hi[0]; ++ix)
+          m_cells[(static_cast<size_t>(iz) * m_size[1] + iy) * m_size[0] +
+                  ix] = 1;
+  }
+}
+
+bool OccupancyGrid::query(const Eigen::Vector3f& p, bool& occupied) const {
+  int cell[3];
+  for (int i = 0; i < 3; ++i) {
+    cell[i] = static_cast<int>(std::floor((p(i) - m_min(i)) * m_invRes));
+    if (cell[i] < 0 || cell[i] >= m_size[i])
+      return false;
+  }
+  occupied = this->occupied(cell[0], cell[1], cell[2]);
+  return true;
+}
+
+bool OccupancyGrid::castRay(
+    const Eigen::Vector3f& origin, const Eigen::Vector3f& direction,
+    float max_range, float& range) const {
+  const float norm = direction.norm();
+  if (norm <= 0.0f)
+    return false;
+  const Eigen::Vector3f dir = direction / norm;
+  const Eigen::Vector3f g   = (origin - m_min) * m_invRes;
+
+  int cell[3], step[3];
+  float tMax[3], tDelta[3];
+  for (int i = 0; i < 3; ++i) {
+    cell[i] = static_cast<int>(std::floor(g(i)));
+    if (cell[i] < 0 || cell[i] >= m_size[i])
+      return false;
+    if (dir(i) > 0.0f) {
+      step[i]   = 1;
+      tDelta[i] = m_resolution / dir(i);
+      tMax[i]   = (cell[i] + 1 - g(i)) * tDelta[i];
+    } else if (dir(i) < 0.0f) {
+      step[i]   = -1;
+      tDelta[i] = -m_resolution / dir(i);
+      tMax[i]   = (g(i) - cell[i]) * tDelta[i];
+    } else {
+      step[i]   = 0;
+      tDelta[i] = std::numeric_limits<float>::infinity();
+      tMax[i]   = std::numeric_limits<float>::infinity();
+    }
+  }
+
+  while (true) {
+    if (occupied(cell[0], cell[1], cell[2])) {
+      const Eigen::Vector3f center(
+          m_min(0) + (cell[0] + 0.5f) * m_resolution,
+          m_min(1) + (cell[1] + 0.5f) * m_resolution,
+          m_min(2) + (cell[2] + 0.5f) * m_resolution);
+      range = (center - origin).norm();
+      return true;
+    }
+    // advance along the axis with the closest cell boundary
+    int a = tMax[0] < tMax[1] ? 0 : 1;
+    if (tMax[2] < tMax[a])
+      a = 2;
+    if (tMax[a] > max_range)
+      return false;
+    cell[a] += step[a];
+    if (cell[a] < 0 || cell[a] >= m_size[a])
+      return false;
+    tMax[a] += tDelta[a];
+  }
+}
+
+void OccupancyGrid::castRays(
+    const Eigen::Vector3f& origin, const Eigen::Matrix3Xf& directions,
+    float max_range, std::vector<float>& ranges) const {
+  ranges.resize(directions.cols());
+  for (int k = 0; k < directions.cols(); ++k)
+    if (!castRay(origin, directions.col(k), max_range, ranges[k]))
+      ranges[k] = -1.0f;
+}
+
+}  // namespace squirrel_3d_localizer
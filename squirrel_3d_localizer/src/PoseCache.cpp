@@ -0,0 +1,289 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/PoseCache.h>
+
+#include <algorithm>
+
+namespace squirrel_3d_localizer {
+
+const size_t PoseCache::kMaxEdges;
+const size_t PoseCache::kMaxDepth;
+const int PoseCache::kMaxReadTries;
+
+PoseCache::PoseCache(ros::NodeHandle& nh, size_t capacity)
+    : m_capacity(std::max<size_t>(capacity, 2)), m_numEdges(0) {
+  // own queue and thread, like tf::TransformListener, so that the cache
+  // keeps up while the filter callbacks are busy and has a single writer
+  ros::SubscribeOptions tfOps =
+      ros::SubscribeOptions::create<tf2_msgs::TFMessage>(
+          "/tf", 100, boost::bind(&PoseCache::tfCallback, this, _1),
+          ros::VoidPtr(), &m_queue);
+  tfOps.transport_hints = ros::TransportHints().tcpNoDelay();
+  m_tfSub               = nh.subscribe(tfOps);
+
+  ros::SubscribeOptions staticOps =
+      ros::SubscribeOptions::create<tf2_msgs::TFMessage>(
+          "/tf_static", 100,
+          boost::bind(&PoseCache::tfStaticCallback, this, _1), ros::VoidPtr(),
+          &m_queue);
+  m_tfStaticSub = nh.subscribe(staticOps);
+
+  m_spinner.reset(new ros::AsyncSpinner(1, &m_queue));
+  m_spinner->start();
+}
+
+PoseCache::~PoseCache() {
+  m_spinner->stop();
+  m_tfSub.shutdown();
+  m_tfStaticSub.shutdown();
+}
+
+void PoseCache::tfCallback(const tf2_msgs::TFMessageConstPtr& msg) {
+  for (size_t i = 0; i < msg->transforms.size(); ++i)
+    insert(msg->transforms[i], false);
+}
+
+void PoseCache::tfStaticCallback(const tf2_msgs::TFMessageConstPtr& msg) {
+  for (size_t i = 0; i < msg->transforms.size(); ++i)
+    insert(msg->transforms[i], true);
+}
+
+void PoseCache::insert(
+    const geometry_msgs::TransformStamped& msg, bool isStatic) {
+  const std::string child  = stripSlash(msg.child_frame_id);
+  const std::string parent = stripSlash(msg.header.frame_id);
+  if (child.empty() || parent.empty() || child == parent)
+    return;
+
+  Sample sample;
+  sample.stamp = msg.header.stamp;
+  tf::transformMsgToTF(msg.transform, sample.transform);
+
+  const int idx = findEdge(child);
+  if (idx < 0) {
+    // new edge: fill it completely before readers can see it
+    const size_t n = m_numEdges.load(std::memory_order_relaxed);
+    if (n == kMaxEdges) {
+      ROS_WARN_ONCE("PoseCache: too many frames, ignoring %s", child.c_str());
+      return;
+    }
+    Edge& edge    = m_edges[n];
+    edge.child    = child;
+    edge.parent   = parent;
+    edge.isStatic = isStatic;
+    edge.samples.resize(isStatic ? 1 : m_capacity);
+    edge.samples[0] = sample;
+    edge.written.store(1, std::memory_order_relaxed);
+    m_numEdges.store(n + 1, std::memory_order_release);
+    return;
+  }
+
+  Edge& edge = m_edges[idx];
+  if (edge.parent != parent) {
+    ROS_WARN_THROTTLE(
+        5.0, "PoseCache: %s changed its parent from %s to %s, ignoring",
+        child.c_str(), edge.parent.c_str(), parent.c_str());
+    return;
+  }
+
+  const uint64_t written = edge.written.load(std::memory_order_relaxed);
+  size_t slot            = 0;
+  if (!edge.isStatic) {
+    // samples are kept sorted, late messages are dropped
+    if (sample.stamp <= edge.samples[(written - 1) % m_capacity].stamp)
+      return;
+    slot = written % m_capacity;
+  }
+
+  const uint32_t sequence = edge.sequence.load(std::memory_order_relaxed);
+  edge.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  edge.samples[slot] = sample;
+  if (!edge.isStatic)
+    edge.written.store(written + 1, std::memory_order_relaxed);
+  edge.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+int PoseCache::findEdge(const std::string& child) const {
+  const size_t n = m_numEdges.load(std::memory_order_acquire);
+  for (size_t i = 0; i < n; ++i) {
+    if (m_edges[i].child == child)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+bool PoseCache::chainToRoot(
+    const std::string& frame, std::vector<std::string>& frames,
+    std::vector<int>& edges) const {
+  frames.assign(1, frame);
+  edges.clear();
+  while (edges.size() < kMaxDepth) {
+    const int idx = findEdge(frames.back());
+    if (idx < 0)
+      return true;
+    edges.push_back(idx);
+    frames.push_back(m_edges[idx].parent);
+  }
+  ROS_WARN_THROTTLE(5.0, "PoseCache: loop in tf tree above %s", frame.c_str());
+  return false;
+}
+
+bool PoseCache::latestStamp(const Edge& edge, ros::Time& stamp) const {
+  if (edge.isStatic)
+    return false;
+  for (int tries = 0; tries < kMaxReadTries; ++tries) {
+    const uint32_t before = edge.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+      continue;
+    const uint64_t written = edge.written.load(std::memory_order_relaxed);
+    stamp = edge.samples[(written - 1) % m_capacity].stamp;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (edge.sequence.load(std::memory_order_relaxed) == before)
+      return true;
+  }
+  return false;
+}
+
+bool PoseCache::interpolate(
+    const Edge& edge, const ros::Time& t, tf::Transform& transform) const {
+  for (int tries = 0; tries < kMaxReadTries; ++tries) {
+    const uint32_t before = edge.sequence.load(std::memory_order_acquire);
+    if (before & 1)
+      continue;
+
+    // copy the bracketing samples, they are only used after validation
+    Sample lower, upper;
+    bool inRange = true;
+    if (edge.isStatic) {
+      lower = upper = edge.samples[0];
+    } else {
+      const uint64_t written = edge.written.load(std::memory_order_relaxed);
+      const uint64_t n     = std::min<uint64_t>(written, m_capacity);
+      const uint64_t first = written - n;
+      const Sample& oldest = edge.samples[first % m_capacity];
+      const Sample& newest = edge.samples[(written - 1) % m_capacity];
+      if (t.isZero() || t == newest.stamp) {
+        lower = upper = newest;
+      } else if (t < oldest.stamp || t > newest.stamp) {
+        inRange = false;
+      } else {
+        // first sample not older than t, there is one before it
+        uint64_t lo = 1, hi = n - 1;
+        while (lo < hi) {
+          const uint64_t mid = lo + (hi - lo) / 2;
+          if (edge.samples[(first + mid) % m_capacity].stamp < t)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        lower = edge.samples[(first + lo - 1) % m_capacity];
+        upper = edge.samples[(first + lo) % m_capacity];
+      }
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (edge.sequence.load(std::memory_order_relaxed) != before)
+      continue;
+    if (!inRange)
+      return false;
+
+    if (upper.stamp <= lower.stamp || upper.stamp <= t) {
+      transform = upper.transform;
+    } else {
+      const double ratio =
+          (t - lower.stamp).toSec() / (upper.stamp - lower.stamp).toSec();
+      transform.setOrigin(lower.transform.getOrigin().lerp(
+          upper.transform.getOrigin(), ratio));
+      transform.setRotation(lower.transform.getRotation().slerp(
+          upper.transform.getRotation(), ratio));
+    }
+    return true;
+  }
+  return false;
+}
+
+bool PoseCache::lookupTransform(
+    const std::string& targetFrame, const std::string& sourceFrame,
+    const ros::Time& t, tf::StampedTransform& transform) const {
+  std::vector<std::string> sourceFrames, targetFrames;
+  std::vector<int> sourceEdges, targetEdges;
+  if (!chainToRoot(stripSlash(sourceFrame), sourceFrames, sourceEdges) ||
+      !chainToRoot(stripSlash(targetFrame), targetFrames, targetEdges))
+    return false;
+
+  // lowest common ancestor; both chains end in the same root if connected
+  size_t sourceDepth = 0, targetDepth = 0;
+  bool connected = false;
+  for (size_t i = 0; i < sourceFrames.size() && !connected; ++i) {
+    for (size_t j = 0; j < targetFrames.size() && !connected; ++j) {
+      if (sourceFrames[i] == targetFrames[j]) {
+        sourceDepth = i;
+        targetDepth = j;
+        connected   = true;
+      }
+    }
+  }
+  if (!connected)
+    return false;
+
+  ros::Time stamp = t;
+  if (stamp.isZero()) {
+    // latest time at which all dynamic edges of the path are known
+    bool haveStamp = false;
+    for (size_t i = 0; i < sourceDepth + targetDepth; ++i) {
+      const int idx = i < sourceDepth ? sourceEdges[i]
+                                      : targetEdges[i - sourceDepth];
+      ros::Time latest;
+      if (latestStamp(m_edges[idx], latest) && (!haveStamp || latest < stamp)) {
+        stamp     = latest;
+        haveStamp = true;
+      }
+    }
+  }
+
+  tf::Transform ancestorToSource = tf::Transform::getIdentity();
+  for (size_t i = 0; i < sourceDepth; ++i) {
+    tf::Transform edgeTransform;
+    if (!interpolate(m_edges[sourceEdges[i]], stamp, edgeTransform))
+      return false;
+    ancestorToSource = edgeTransform * ancestorToSource;
+  }
+  tf::Transform ancestorToTarget = tf::Transform::getIdentity();
+  for (size_t i = 0; i < targetDepth; ++i) {
+    tf::Transform edgeTransform;
+    if (!interpolate(m_edges[targetEdges[i]], stamp, edgeTransform))
+      return false;
+    ancestorToTarget = edgeTransform * ancestorToTarget;
+  }
+
+  transform = tf::StampedTransform(
+      ancestorToTarget.inverse() * ancestorToSource, stamp, targetFrame,
+      sourceFrame);
+  return true;
+}
+
+std::string PoseCache::stripSlash(const std::string& frame) {
+  return !frame.empty() && frame[0] == '/' ? frame.substr(1) : frame;
+}
+
+}  // namespace squirrel_3d_localizer
@@ -0,0 +1,163 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <squirrel_3d_localizer/RangeTable.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace squirrel_3d_localizer {
+
+namespace {
+const char kMagic[8] = {'S', '3', 'D', 'R', 'L', 'T', '0', '1'};
+}  // namespace
+
+const uint16_t RangeTable::kUnknown;
+const uint16_t RangeTable::kNoHit;
+
+RangeTable::RangeTable()
+    : m_invRes(1.0f),
+      m_invAngleRes(1.0f),
+      m_data(NULL),
+      m_mapped(NULL),
+      m_mappedSize(0) {
+  std::memset(&m_header, 0, sizeof(Header));
+}
+
+RangeTable::~RangeTable() { unmap(); }
+
+void RangeTable::unmap() {
+  if (m_mapped)
+    munmap(m_mapped, m_mappedSize);
+  m_mapped     = NULL;
+  m_mappedSize = 0;
+  m_data       = NULL;
+}
+
+void RangeTable::build(
+    const OccupancyGrid& grid, double min_x, double min_y, double max_x,
+    double max_y, double z, double resolution, int num_angles,
+    double max_range) {
+  unmap();
+  std::memcpy(m_header.magic, kMagic, sizeof(kMagic));
+  m_header.min_x      = min_x;
+  m_header.min_y      = min_y;
+  m_header.resolution = resolution;
+  m_header.z          = z;
+  m_header.max_range  = std::min(max_range, 65.0);
+  m_header.size_x     = std::max(0, int(std::ceil((max_x - min_x) / resolution)));
+  m_header.size_y     = std::max(0, int(std::ceil((max_y - min_y) / resolution)));
+  m_header.num_angles = std::max(1, num_angles);
+  m_invRes            = 1.0f / resolution;
+  m_invAngleRes       = m_header.num_angles / (2.0f * M_PI);
+
+  m_buffer.assign(
+      static_cast<size_t>(m_header.size_x) * m_header.size_y *
+          m_header.num_angles,
+      kUnknown);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int iy = 0; iy < m_header.size_y; ++iy) {
+    for (int ix = 0; ix < m_header.size_x; ++ix) {
+      const Eigen::Vector3f origin(
+          m_header.min_x + (ix + 0.5f) * resolution,
+          m_header.min_y + (iy + 0.5f) * resolution, m_header.z);
+      uint16_t* cell = &m_buffer[(static_cast<size_t>(iy) * m_header.size_x +
+                                  ix) *
+                                 m_header.num_angles];
+      // cells outside the map or in obstacles are left unknown
+      bool occupied;
+      if (!grid.query(origin, occupied) || occupied)
+        continue;
+      float range;
+      for (int ia = 0; ia < m_header.num_angles; ++ia) {
+        const float yaw = ia / m_invAngleRes;
+        const Eigen::Vector3f direction(std::cos(yaw), std::sin(yaw), 0.0f);
+        if (grid.castRay(origin, direction, m_header.max_range, range))
+          cell[ia] = static_cast<uint16_t>(
+              std::min(65000.0f, std::floor(range * 1e3f + 0.5f)));
+        else
+          cell[ia] = kNoHit;
+      }
+    }
+  }
+  m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+}
+
+bool RangeTable::save(const std::string& filename) const {
+  if (!m_data)
+    return false;
+  std::ofstream f(filename.c_str(), std::ios::binary);
+  if (!f.is_open())
+    return false;
+  f.write(reinterpret_cast<const char*>(&m_header), sizeof(Header));
+  f.write(
+      reinterpret_cast<const char*>(m_data),
+      sizeof(uint16_t) * static_cast<size_t>(m_header.size_x) *
+          m_header.size_y * m_header.num_angles);
+  return f.good();
+}
+
+bool RangeTable::load(const std::string& filename) {
+  unmap();
+  m_buffer.clear();
+
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(Header))) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    return false;
+
+  const Header* header = static_cast<const Header*>(mapped);
+  const size_t numEntries = static_cast<size_t>(header->size_x) *
+                            header->size_y * header->num_angles;
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->num_angles <= 0 || header->resolution <= 0.0f ||
+      size_t(st.st_size) < sizeof(Header) + numEntries * sizeof(uint16_t)) {
+    munmap(mapped, st.st_size);
+    return false;
+  }
+
+  m_mapped      = mapped;
+  m_mappedSize  = st.st_size;
+  m_header      = *header;
+  m_invRes      = 1.0f / m_header.resolution;
+  m_invAngleRes = m_header.num_angles / (2.0f * M_PI);
+  m_data        = reinterpret_cast<const uint16_t*>(
+      static_cast<const char*>(mapped) + sizeof(Header));
+  return true;
+}
+
+}  // namespace squirrel_3d_localizer
@@ -27,6 +27,11 @@
 
 namespace squirrel_3d_localizer {
 
+namespace {
+// max. ratio of vertical to horizontal extent of a beam using the range table
+const float kPlanarBeamSlope = 0.02f;
+}  // namespace
+
 RaycastingModel::RaycastingModel(
     ros::NodeHandle* nh, boost::shared_ptr<MapModel> mapModel,
     EngineT* rngEngine)
@@ -37,7 +42,29 @@ RaycastingModel::RaycastingModel(
   nh->param("raycasting/z_max", m_zMax, 0.05);
   nh->param("raycasting/z_rand", m_zRand, 0.05);
   nh->param("raycasting/sigma_hit", m_sigmaHit, 0.02);
+  nh->param(
+      "raycasting/laser_sigma_hit", m_sensorSigmaHit[LASER_SENSOR],
+      m_sigmaHit);
+  nh->param(
+      "raycasting/depth_sigma_hit", m_sensorSigmaHit[DEPTH_SENSOR],
+      m_sigmaHit);
   nh->param("raycasting/lambda_short", m_lambdaShort, 0.1);
+  nh->param("raycasting/dense_grid", m_useDenseGrid, true);
+  std::string rangeTableFile;
+  nh->param("raycasting/range_table_file", rangeTableFile, std::string(""));
+  nh->param(
+      "raycasting/range_table_height_tolerance", m_rangeTableHeightTolerance,
+      0.05);
+  if (!rangeTableFile.empty()) {
+    if (m_rangeTable.load(rangeTableFile))
+      ROS_INFO_STREAM(
+          ros::this_node::getName() << ": Using range table " << rangeTableFile
+                                    << " at height " << m_rangeTable.height());
+    else
+      ROS_ERROR_STREAM(
+          ros::this_node::getName() << ": Could not load range table "
+                                    << rangeTableFile << ", raycasting instead");
+  }
 
   if (m_zMax <= 0.0) {
     ROS_ERROR_STREAM(
@@ -57,88 +84,164 @@ RaycastingModel::RaycastingModel(
           ros::this_node::getName().c_str(), omp_get_num_threads());
     }
   }
+
+  initOccupancyGrid();
 }
 
 RaycastingModel::~RaycastingModel() {}
 
 void RaycastingModel::integrateMeasurement(
     Particles& particles, const PointCloud& pc,
-    const std::vector<float>& ranges, float max_range,
+    const std::vector<float>& ranges, const SensorTags& tags, float max_range,
     const tf::Transform& base_to_laser) {
-  assert(pc.size() == ranges.size());
+  assert(pc.size() == ranges.size() && pc.size() == tags.size());
 
   if (!m_map) {
     ROS_ERROR_STREAM(
         ros::this_node::getName() << ": Map file is not set in raycasting");
     return;
   }
+  // zero-copy view on the xyz coordinates of the points
+  const Eigen::Map<const Eigen::MatrixXf, Eigen::Aligned, Eigen::OuterStride<> >
+      points = pc.getMatrixXfMap(3, 4, 0);
+
+  // planar particles share roll, pitch and the sensor offset
+  Eigen::Matrix3f levelRotation;
+  Eigen::Vector3f levelTranslation;
+  const bool planar = m_planarParticles && !particles.empty();
+  if (planar)
+    levelSensor(particles[0], base_to_laser, levelRotation, levelTranslation);
+
 // iterate over samples, multi-threaded:
-#pragma omp parallel for
-  for (unsigned i = 0; i < particles.size(); ++i) {
-    Eigen::Matrix4f globalLaserOrigin;
-    tf::Transform globalLaserOriginTf = particles[i].pose * base_to_laser;
-    pcl_ros::transformAsMatrix(globalLaserOriginTf, globalLaserOrigin);
-
-    // raycasting origin
-    octomap::point3d originP(
-        globalLaserOriginTf.getOrigin().x(),
-        globalLaserOriginTf.getOrigin().y(),
-        globalLaserOriginTf.getOrigin().z());
-    PointCloud pc_transformed;
-    pcl::transformPointCloud(pc, pc_transformed, globalLaserOrigin);
-
-    // iterate over beams:
-    PointCloud::const_iterator pc_it             = pc_transformed.begin();
-    std::vector<float>::const_iterator ranges_it = ranges.begin();
-    for (; pc_it != pc_transformed.end(); ++pc_it, ++ranges_it) {
-
-      double p = 0.0;  // probability for weight
-
-      if (*ranges_it <= max_range) {
-
-        // direction of ray in global (map) coords
-        octomap::point3d direction(pc_it->x, pc_it->y, pc_it->z);
-        direction = direction - originP;
-
-        // TODO: check first if endpoint is within map?
-        octomap::point3d end;
-        // raycast in OctoMap, we need to cast a little longer than max_range
-        // to correct for particle drifts away from obstacles
-        if (m_map->castRay(originP, direction, end, true, 1.5 * max_range)) {
-          assert(m_map->isNodeOccupied(m_map->search(end)));
-          float raycastRange = (originP - end).norm();
-          float z            = raycastRange - *ranges_it;
-          float sigma_scaled = m_sigmaHit;
-          if (m_useSquaredError)
-            sigma_scaled = (*ranges_it) * (*ranges_it) * (m_sigmaHit);
-
-          // obstacle hit:
-          p = m_zHit / (SQRT_2_PI * sigma_scaled) *
-              exp(-(z * z) / (2 * sigma_scaled * sigma_scaled));
-
-          // short range:
-          if (*ranges_it <= raycastRange)
-            p += m_zShort * m_lambdaShort * exp(-m_lambdaShort * (*ranges_it)) /
-                 (1 - exp(-m_lambdaShort * raycastRange));
-          // random measurement:
-          p += m_zRand / max_range;
-        } else {  // racasting did not hit, but measurement is no maxrange =>
-                  // random?
-          p = m_zRand / max_range;
+#pragma omp parallel
+  {
+    Eigen::Matrix3Xf directions;
+    std::vector<float> rayRanges;
+#pragma omp for
+    for (unsigned i = 0; i < particles.size(); ++i) {
+      Eigen::Matrix3f rotation;
+      Eigen::Vector3f translation;
+      if (planar) {
+        const PlanarTransform yawTransform(particles[i].pose);
+        rotation.noalias() = yawTransform.rotation() * levelRotation;
+        translation        = yawTransform(levelTranslation);
+      } else {
+        toEigen(particles[i].pose * base_to_laser, rotation, translation);
+      }
+
+      // raycasting origin
+      octomap::point3d originP(
+          translation.x(), translation.y(), translation.z());
+
+      // the range table is only valid at the height it was computed for
+      const bool useTable =
+          !m_rangeTable.empty() && m_rangeTable.maxRange() >= max_range &&
+          std::abs(translation.z() - m_rangeTable.height()) <=
+              m_rangeTableHeightTolerance;
+
+      // direction of rays in global (map) coords, i.e. the rotated endpoints
+      // in the sensor frame. With the dense grid all beams of the particle
+      // are cast in one batch, we need to cast a little longer than
+      // max_range to correct for particle drifts away from obstacles
+      if (m_useDenseGrid || useTable)
+        directions.noalias() = rotation * points;
+      if (m_useDenseGrid && !useTable)
+        m_occupancyGrid.castRays(
+            translation, directions, 1.5 * max_range, rayRanges);
+
+      // iterate over beams:
+      std::vector<float>::const_iterator ranges_it = ranges.begin();
+      for (int k = 0; ranges_it != ranges.end(); ++k, ++ranges_it) {
+
+        double p = 0.0;  // probability for weight
+
+        if (*ranges_it <= max_range) {
+          bool hit           = false;
+          bool cast          = true;
+          float raycastRange = 0.0f;
+          if (useTable) {
+            // lookup of horizontal beams, cast the others
+            const Eigen::Vector3f& d = directions.col(k);
+            if (std::abs(d.z()) <= kPlanarBeamSlope * d.head<2>().norm()) {
+              const RangeTable::Status status = m_rangeTable.lookup(
+                  translation.x(), translation.y(), std::atan2(d.y(), d.x()),
+                  raycastRange);
+              hit  = status == RangeTable::HIT;
+              cast = status == RangeTable::UNKNOWN;
+            }
+          }
+          if (cast && m_useDenseGrid && useTable) {
+            hit = m_occupancyGrid.castRay(
+                translation, directions.col(k), 1.5 * max_range, raycastRange);
+          } else if (cast && m_useDenseGrid) {
+            raycastRange = rayRanges[k];
+            hit          = raycastRange >= 0.0f;
+          } else if (cast) {
+            const Eigen::Vector3f d = rotation * points.col(k);
+            octomap::point3d direction(d.x(), d.y(), d.z());
+
+            // TODO: check first if endpoint is within map?
+            octomap::point3d end;
+            // raycast in OctoMap
+            hit = m_map->castRay(
+                originP, direction, end, true, 1.5 * max_range);
+            if (hit) {
+              assert(m_map->isNodeOccupied(m_map->search(end)));
+              raycastRange = (originP - end).norm();
+            }
+          }
+
+          if (hit) {
+            float z            = raycastRange - *ranges_it;
+            const float sigmaHit = m_sensorSigmaHit[tags[k]];
+            float sigma_scaled   = sigmaHit;
+            if (m_useSquaredError)
+              sigma_scaled = (*ranges_it) * (*ranges_it) * sigmaHit;
+
+            // obstacle hit:
+            p = m_zHit / (SQRT_2_PI * sigma_scaled) *
+                exp(-(z * z) / (2 * sigma_scaled * sigma_scaled));
+
+            // short range:
+            if (*ranges_it <= raycastRange)
+              p += m_zShort * m_lambdaShort *
+                   exp(-m_lambdaShort * (*ranges_it)) /
+                   (1 - exp(-m_lambdaShort * raycastRange));
+            // random measurement:
+            p += m_zRand / max_range;
+          } else {  // racasting did not hit, but measurement is no maxrange
+                    // => random?
+            p = m_zRand / max_range;
+          }
+
+        } else {  // maximum range
+          p = m_zMax;
         }
 
-      } else {  // maximum range
-        p = m_zMax;
-      }
+        // add log-likelihood
+        // (note: likelihood can be larger than 1!)
+        assert(p > 0.0);
+        particles[i].weight += log(p);
+
+      }  // end of loop over scan
 
-      // add log-likelihood
-      // (note: likelihood can be larger than 1!)
-      assert(p > 0.0);
-      particles[i].weight += log(p);
+    }  // end of loop over particles
+  }
+}
 
-    }  // end of loop over scan
+void RaycastingModel::setMap(boost::shared_ptr<octomap::OcTree> map) {
+  m_map = map;
+  initOccupancyGrid();
+}
 
-  }  // end of loop over particles
+void RaycastingModel::initOccupancyGrid() {
+  if (!m_useDenseGrid || !m_map)
+    return;
+  m_occupancyGrid.voxelize(*m_map);
+  ROS_INFO_STREAM(
+      ros::this_node::getName()
+      << ": Dense occupancy grid for raycasting uses "
+      << m_occupancyGrid.memoryUsage() / (1024.0 * 1024.0) << " MB");
 }
 
 bool RaycastingModel::getHeightError(
@@ -22,8 +22,16 @@
 
 #include <pcl/keypoints/uniform_sampling.h>
 #include <squirrel_3d_localizer/SquirrelLocalizer.h>
+#include <squirrel_point_buffer/kernels.h>
+#include <squirrel_point_buffer/pcl_adapters.h>
+#include <Eigen/LU>
+#include <algorithm>
+#include <cmath>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 #include <pcl_ros/transforms.h>
 
@@ -37,12 +45,18 @@
 namespace squirrel_3d_localizer {
 
 SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
+    : SquirrelLocalizer(randomSeed, ros::NodeHandle(), ros::NodeHandle("~")) {}
+
+SquirrelLocalizer::SquirrelLocalizer(
+    unsigned randomSeed, const ros::NodeHandle& nh,
+    const ros::NodeHandle& privateNh)
     : m_rngEngine(randomSeed),
       m_rngNormal(m_rngEngine, NormalDistributionT(0.0, 1.0)),
       m_rngUniform(m_rngEngine, UniformDistributionT(0.0, 1.0)),
-      m_nodeName(ros::this_node::getName()),
-      m_nh(),
-      m_privateNh("~"),
+      m_samplingSeed(uint64_t(randomSeed) << 32 | 0x5eed),
+      m_nodeName(privateNh.getNamespace()),
+      m_nh(nh),
+      m_privateNh(privateNh),
       m_verbose(false),
       m_printPointCloudSubscription(true),
       m_printLaserSubscription(true),
@@ -55,12 +69,20 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
       m_useRaycasting(true),
       m_initFromTruepose(false),
       m_useLastPose(true),
+      m_restoreSnapshot(true),
+      m_snapshotPeriod(1.0),
+      m_snapshotMaxAge(30.0),
       m_numParticles(500),
       m_sensorSampleDist(0.2),
       m_nEffFactor(1.0),
       m_minParticleWeight(0.0),
+      m_parallelMinParticles(1000),
       m_bestParticleIdx(-1),
-      m_lastIMUMsgBuffer(5),
+      m_nEff(0.0),
+      m_annealingLevels(0),
+      m_annealingSpread(1.0),
+      m_annealingNEffRatio(0.5),
+      m_imuBuffer(5),
       m_bestParticleAsMean(true),
       m_receivedSensorData(false),
       m_initialized(false),
@@ -77,6 +99,8 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
       m_groundFilterDistance(0.04),
       m_groundFilterAngle(0.15),
       m_groundFilterPlaneDistance(0.07),
+      m_groundFilterMethod("ransac"),
+      m_groundFilterCellSize(0.5),
       m_sensorSampleDistGroundFactor(3),
       m_headYawRotationLastScan(0.0),
       m_headPitchRotationLastScan(0.0),
@@ -84,7 +108,12 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
       m_constrainMotionZ(false),
       m_constrainMotionRP(false),
       m_useTimer(false),
-      m_timerPeriod(0.1) {
+      m_lazyPrediction(false),
+      m_timerPeriod(0.1),
+      m_pipelinePointClouds(false),
+      m_pipelineRunning(false),
+      m_diagnosticsPeriod(1.0),
+      m_updateBudget(0.1) {
 
   m_latest_transform.setData(tf::Transform(tf::createIdentityQuaternion()));
   // raycasting or endpoint model?
@@ -100,13 +129,25 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
   m_privateNh.param(
       "init_from_truepose", m_initFromTruepose, m_initFromTruepose);
   m_privateNh.param("use_last_pose", m_useLastPose, m_useLastPose);
+  m_privateNh.param("save_last_pose", m_saveLastPose, true);
+  m_privateNh.param("snapshot/period", m_snapshotPeriod, m_snapshotPeriod);
+  m_privateNh.param("snapshot/max_age", m_snapshotMaxAge, m_snapshotMaxAge);
   m_privateNh.param("init_global", m_initGlobal, m_initGlobal);
   m_privateNh.param(
       "best_particle_as_mean", m_bestParticleAsMean, m_bestParticleAsMean);
   m_privateNh.param("num_particles", m_numParticles, m_numParticles);
   m_privateNh.param("neff_factor", m_nEffFactor, m_nEffFactor);
+  m_privateNh.param(
+      "annealing_levels", m_annealingLevels, m_annealingLevels);
+  m_privateNh.param(
+      "annealing_spread", m_annealingSpread, m_annealingSpread);
+  m_privateNh.param(
+      "annealing_neff_ratio", m_annealingNEffRatio, m_annealingNEffRatio);
   m_privateNh.param(
       "min_particle_weight", m_minParticleWeight, m_minParticleWeight);
+  m_privateNh.param(
+      "parallel_min_particles", m_parallelMinParticles,
+      m_parallelMinParticles);
 
   m_privateNh.param("initial_pose/x", m_initPose(0), 0.0);
   m_privateNh.param("initial_pose/y", m_initPose(1), 0.0);
@@ -179,14 +220,59 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
   m_privateNh.param(
       "sensor_sampling_dist_ground_factor", m_sensorSampleDistGroundFactor,
       m_sensorSampleDistGroundFactor);
+  // closed-loop sensor_sampling_dist, if a budget is set
+  m_adaptiveSampling.reset(
+      new AdaptiveSampling(&m_privateNh, m_sensorSampleDist));
+  // adaptive num_particles, if enabled
+  m_kldSampling.reset(new KLDSampling(&m_privateNh));
+  m_privateNh.param(
+      "ground_filter_method", m_groundFilterMethod, m_groundFilterMethod);
+  m_privateNh.param(
+      "ground_filter_cell_size", m_groundFilterCellSize,
+      m_groundFilterCellSize);
+  if (m_groundFilterMethod != "ransac" &&
+      m_groundFilterMethod != "height_band") {
+    ROS_WARN_STREAM(
+        m_nodeName << ": Unknown ground_filter_method \""
+                   << m_groundFilterMethod << "\", using \"ransac\"");
+    m_groundFilterMethod = "ransac";
+  }
 
   m_privateNh.param("use_timer", m_useTimer, m_useTimer);
+  m_privateNh.param("lazy_prediction", m_lazyPrediction, false);
   m_privateNh.param("timer_period", m_timerPeriod, m_timerPeriod);
 
+  // point cloud pipeline
+  m_privateNh.param(
+      "pipeline_point_clouds", m_pipelinePointClouds, m_pipelinePointClouds);
+  int pipelineQueueSize;
+  m_privateNh.param("pipeline_queue_size", pipelineQueueSize, 2);
+
+  // profiling
+  m_privateNh.param(
+      "diagnostics_period", m_diagnosticsPeriod, m_diagnosticsPeriod);
+  m_privateNh.param("update_budget", m_updateBudget, m_updateBudget);
+  std::string traceFile;
+  m_privateNh.param("profile_trace_file", traceFile, std::string(""));
+  if (!traceFile.empty()) {
+    if (m_profiler.openTrace(traceFile))
+      ROS_INFO_STREAM(m_nodeName << ": Writing stage trace to " << traceFile);
+    else
+      ROS_ERROR_STREAM(
+          m_nodeName << ": Unable to open trace file " << traceFile);
+  }
+
+  // pose lookups by timestamp without going through tf
+  int poseCacheSize;
+  m_privateNh.param("pose_cache_size", poseCacheSize, 0);
+  if (poseCacheSize > 0)
+    m_poseCache.reset(new PoseCache(m_nh, poseCacheSize));
+
   // motion model parameters
 
   m_motionModel = boost::shared_ptr<MotionModel>(new MotionModel(
       &m_privateNh, &m_rngEngine, &m_tfListener, m_odomFrameId, m_baseFrameId));
+  m_motionModel->setPoseCache(m_poseCache);
 
   if (m_useRaycasting) {
     m_mapModel = boost::shared_ptr<MapModel>(new OccupancyMap(&m_privateNh));
@@ -198,12 +284,28 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
     m_observationModel = boost::shared_ptr<ObservationModel>(
         new EndpointModel(&m_privateNh, m_mapModel, &m_rngEngine));
   }
-
+  // constrainMotion() gives all particles the roll and pitch of odometry
+  m_observationModel->setPlanarParticles(m_constrainMotionRP);
+
+  // the particle buffers are resized in place, they never reallocate
+  m_particles.reserve(maxNumParticles());
+  m_resampledParticles.reserve(maxNumParticles());
+  m_resampledIndices.reserve(maxNumParticles());
+  m_cumWeights.reserve(maxNumParticles());
+  m_poseArray.poses.reserve(maxNumParticles());
   m_particles.resize(m_numParticles);
   m_poseArray.poses.resize(m_numParticles);
   m_poseArray.header.frame_id = m_globalFrameId;
   m_tfListener.clear();
 
+  std::string snapshotFile;
+  m_privateNh.param("snapshot/file", snapshotFile, std::string(""));
+  if (!snapshotFile.empty() &&
+      !m_snapshot.open(
+          snapshotFile, maxNumParticles(), m_imuBuffer.capacity()))
+    ROS_ERROR_STREAM(
+        m_nodeName << ": Unable to map the snapshot file " << snapshotFile);
+
   // publishers can be advertised first, before needed:
   m_posePub =
       m_nh.advertise<geometry_msgs::PoseWithCovarianceStamped>("pose", 10);
@@ -218,10 +320,27 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
   m_nEffPub = m_privateNh.advertise<std_msgs::Float32>("n_eff", 10);
   m_filteredPointCloudPub =
       m_privateNh.advertise<sensor_msgs::PointCloud2>("filtered_cloud", 1);
+  m_diagnosticsPub =
+      m_nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
 
   // TODO Propagate particles independent of sensor callback
   reset();
 
+  // preprocessing and filter threads before the subscriptions
+  if (m_pipelinePointClouds) {
+    m_rawClouds.reset(new SpscQueue<sensor_msgs::PointCloud2::ConstPtr>(
+        std::max(1, pipelineQueueSize)));
+    m_preparedClouds.reset(new SpscQueue<boost::shared_ptr<PreparedCloud> >(
+        std::max(1, pipelineQueueSize)));
+    m_pipelineRunning     = true;
+    m_preprocessingThread = boost::thread(
+        boost::bind(&SquirrelLocalizer::preprocessingLoop, this));
+    m_filterThread =
+        boost::thread(boost::bind(&SquirrelLocalizer::filterLoop, this));
+    ROS_INFO_STREAM(
+        m_nodeName << ": Preprocessing point clouds in a separate thread");
+  }
+
   // ROS subscriptions last:
   m_globalLocSrv = m_nh.advertiseService(
       "global_localization", &SquirrelLocalizer::globalLocalizationCallback,
@@ -261,7 +380,7 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
       new tf::MessageFilter<geometry_msgs::PoseWithCovarianceStamped>(
           *m_initPoseSub, m_tfListener, m_globalFrameId, 2);
   m_initPoseFilter->registerCallback(
-      boost::bind(&SquirrelLocalizer::initPoseCallback, this, _1));
+      boost::bind(&SquirrelLocalizer::lockedInitPoseCallback, this, _1));
 
   m_pauseIntegrationSub = m_privateNh.subscribe(
       "pause_localization", 1, &SquirrelLocalizer::pauseLocalizationCallback,
@@ -289,28 +408,37 @@ SquirrelLocalizer::SquirrelLocalizer(unsigned randomSeed)
 }
 
 SquirrelLocalizer::~SquirrelLocalizer() {
-  std::string lastPoseFilename =
-      ros::package::getPath("squirrel_3d_localizer") +
-      std::string("/config/last_pose.yaml");
-  std::ofstream f(lastPoseFilename.c_str());
-
-  if (f.is_open()) {
-    tf::Vector3 position = m_bestParticlePose.getOrigin();
-    tf::Matrix3x3 rotation(m_bestParticlePose.getRotation());
-    double roll, pitch, yaw;
-    rotation.getRPY(roll, pitch, yaw);
-
-    f << "last_pose: " << std::endl
-      << "  x: " << position.getX() << std::endl
-      << "  y: " << position.getY() << std::endl
-      << "  z: " << position.getZ() << std::endl
-      << "  roll: " << roll << std::endl
-      << "  pitch: " << pitch << std::endl
-      << "  yaw: " << yaw;
-    f.close();
-  } else {
-    ROS_ERROR_STREAM(
-        m_nodeName << ": Unable to dump last pose on last_pose.yaml");
+  if (m_pipelineRunning) {
+    m_pipelineRunning = false;
+    m_pipelineCondition.notify_all();
+    m_preprocessingThread.join();
+    m_filterThread.join();
+  }
+
+  if (m_saveLastPose) {
+    std::string lastPoseFilename =
+        ros::package::getPath("squirrel_3d_localizer") +
+        std::string("/config/last_pose.yaml");
+    std::ofstream f(lastPoseFilename.c_str());
+
+    if (f.is_open()) {
+      tf::Vector3 position = m_bestParticlePose.getOrigin();
+      tf::Matrix3x3 rotation(m_bestParticlePose.getRotation());
+      double roll, pitch, yaw;
+      rotation.getRPY(roll, pitch, yaw);
+
+      f << "last_pose: " << std::endl
+        << "  x: " << position.getX() << std::endl
+        << "  y: " << position.getY() << std::endl
+        << "  z: " << position.getZ() << std::endl
+        << "  roll: " << roll << std::endl
+        << "  pitch: " << pitch << std::endl
+        << "  yaw: " << yaw;
+      f.close();
+    } else {
+      ROS_ERROR_STREAM(
+          m_nodeName << ": Unable to dump last pose on last_pose.yaml");
+    }
   }
 
   delete m_laserFilter;
@@ -338,6 +466,9 @@ void SquirrelLocalizer::reset() {
   ros::WallTime startTime = ros::WallTime::now();
 #endif
 
+  if (restoreSnapshot())
+    return;
+
   if (m_initGlobal) {
     this->initGlobal();
   } else {
@@ -438,6 +569,67 @@ void SquirrelLocalizer::reset() {
 #endif
 }
 
+bool SquirrelLocalizer::restoreSnapshot() {
+  // only a respawned node continues from the snapshot
+  if (!m_restoreSnapshot || !m_snapshot.isOpen())
+    return false;
+  m_restoreSnapshot = false;
+
+  ros::Time stamp;
+  if (!m_snapshot.stamp(stamp))
+    return false;
+  const double age = (ros::Time::now() - stamp).toSec();
+  if (m_snapshotMaxAge > 0.0 && age > m_snapshotMaxAge) {
+    ROS_INFO_STREAM(
+        m_nodeName << ": Ignoring the filter snapshot, it is " << age
+                   << " s old");
+    return false;
+  }
+
+  ros::WallTime startTime = ros::WallTime::now();
+  Particles particles;
+  bool hasOdomPose;
+  tf::Stamped<tf::Pose> odomPose;
+  ImuBuffer imuBuffer(m_imuBuffer.capacity());
+  if (!m_snapshot.read(particles, hasOdomPose, odomPose, imuBuffer) ||
+      particles.empty())
+    return false;
+
+  // copied, to keep the reserved buffer
+  m_particles.assign(particles.begin(), particles.end());
+  m_imuBuffer.swap(imuBuffer);
+  // the odometry since the snapshot is applied at the next update
+  m_motionModel->reset();
+  if (hasOdomPose) {
+    odomPose.frame_id_ = m_odomFrameId;
+    m_motionModel->storeOdomPose(odomPose);
+  }
+  m_receivedSensorData = false;
+  m_initialized        = true;
+
+  ROS_INFO_STREAM(
+      m_nodeName << ": Restored " << m_particles.size()
+                 << " particles from the snapshot of " << age << " s ago in "
+                 << (ros::WallTime::now() - startTime).toSec() << " s");
+  publishPoseEstimate(stamp, false);
+  return true;
+}
+
+void SquirrelLocalizer::writeSnapshot(const ros::Time& time) {
+  if (!m_snapshot.isOpen())
+    return;
+  const ros::WallTime now = ros::WallTime::now();
+  if ((now - m_lastSnapshotTime).toSec() < m_snapshotPeriod)
+    return;
+  m_lastSnapshotTime = now;
+
+  tf::Stamped<tf::Pose> lastOdomPose;
+  const bool hasOdomPose = m_motionModel->getLastOdomPose(lastOdomPose);
+  m_snapshot.write(
+      time, m_particles, hasOdomPose ? &lastOdomPose : NULL,
+      m_imuBuffer);
+}
+
 void SquirrelLocalizer::initZRP(double& z, double& roll, double& pitch) {
   if (m_initPoseRealZRP) {
     // Get latest pose height
@@ -455,8 +647,9 @@ void SquirrelLocalizer::initZRP(double& z, double& roll, double& pitch) {
     }
 
     // Get latest roll and pitch
-    if (!m_lastIMUMsgBuffer.empty()) {
-      getRP(m_lastIMUMsgBuffer.back().orientation, roll, pitch);
+    if (!m_imuBuffer.empty()) {
+      roll  = m_imuBuffer.back().roll;
+      pitch = m_imuBuffer.back().pitch;
     } else {
       ROS_WARN_STREAM(
           m_nodeName
@@ -476,6 +669,7 @@ void SquirrelLocalizer::initZRP(double& z, double& roll, double& pitch) {
 void SquirrelLocalizer::laserCallback(
     const sensor_msgs::LaserScan::ConstPtr& msg) {
   ROS_DEBUG("Laser received (time: %f)", msg->header.stamp.toSec());
+  boost::mutex::scoped_lock lock(m_filterMutex);
 
   // for both sensors we use synchronizedCallback
   if (!m_useLaserScanner || m_useDepthCamera)
@@ -502,10 +696,15 @@ void SquirrelLocalizer::laserCallback(
     return;
   }
 
+  StageProfiler::Scope callbackScope(m_profiler, "laser_callback");
+  StageProfiler::Clock::time_point t = StageProfiler::Clock::now();
+
   /// absolute, current odom pose
   tf::Stamped<tf::Pose> odomPose;
   // check if odometry available, skip scan if not.
-  if (!m_motionModel->lookupOdomPose(msg->header.stamp, odomPose))
+  const bool odomOk = m_motionModel->lookupOdomPose(msg->header.stamp, odomPose);
+  t                 = m_profiler.record("odom_lookup", t);
+  if (!odomOk)
     return;
 
   bool sensor_integrated = false;
@@ -516,25 +715,35 @@ void SquirrelLocalizer::laserCallback(
     PointCloud pc_filtered;
     std::vector<float> laserRangesSparse;
     prepareLaserPointCloud(msg, pc_filtered, laserRangesSparse);
+    m_profiler.record("prepare_laser", t);
 
-    sensor_integrated =
-        localizeWithMeasurement(pc_filtered, laserRangesSparse, msg->range_max);
+    sensor_integrated = localizeWithMeasurement(
+        pc_filtered, laserRangesSparse,
+        SensorTags(pc_filtered.size(), LASER_SENSOR), msg->range_max);
   }
 
-  if (!sensor_integrated) {  // no laser integration: propagate particles
-                             // forward by full interval
-
+  // with lazy prediction the particles follow at the next update only
+  const bool deferMotion = m_lazyPrediction && !sensor_integrated;
+  // no laser integration: propagate particles forward by full interval
+  if (!sensor_integrated && !deferMotion) {
     // relative odom transform to last odomPose
     tf::Transform odomTransform = m_motionModel->computeOdomTransform(odomPose);
     m_motionModel->applyOdomTransform(m_particles, odomTransform);
     constrainMotion(odomPose);
-  } else {
+  } else if (sensor_integrated) {
     m_lastLocalizedPose = odomPose;
   }
 
-  m_motionModel->storeOdomPose(odomPose);
-  publishPoseEstimate(msg->header.stamp, sensor_integrated);
+  if (!deferMotion)
+    m_motionModel->storeOdomPose(odomPose);
+  t = StageProfiler::Clock::now();
+  if (deferMotion)
+    publishPredictedPose(msg->header.stamp, odomPose);
+  else
+    publishPoseEstimate(msg->header.stamp, sensor_integrated);
+  m_profiler.record("publish", t);
   m_lastLaserTime = msg->header.stamp;
+  publishDiagnostics(msg->header.stamp);
 }
 
 void SquirrelLocalizer::constrainMotion(const tf::Pose& odomPose) {
@@ -577,8 +786,9 @@ bool SquirrelLocalizer::isAboveMotionThreshold(const tf::Pose& odomPose) {
 
 bool SquirrelLocalizer::localizeWithMeasurement(
     const PointCloud& pc_filtered, const std::vector<float>& ranges,
-    double max_range) {
+    const SensorTags& tags, double max_range) {
   ros::WallTime startTime = ros::WallTime::now();
+  StageProfiler::Clock::time_point stageStart = StageProfiler::Clock::now();
 #if PCL_VERSION_COMPARE(>=, 1, 7, 0)
   ros::Time t = pcl_conversions::fromPCL(pc_filtered.header).stamp;
 #else
@@ -593,17 +803,23 @@ bool SquirrelLocalizer::localizeWithMeasurement(
   if (!m_motionModel->lookupOdomPose(t, odomPose))
     return false;
   constrainMotion(odomPose);
+  stageStart = m_profiler.record("motion_model", stageStart);
 
   // transformation from torso frame to sensor
   // this takes the latest tf, assumes that torso to sensor did not change over
   // temp. sampling!
   tf::StampedTransform localSensorFrame;
-  if (!m_motionModel->lookupLocalTransform(
-          pc_filtered.header.frame_id, t, localSensorFrame))
+  const bool sensorFrameOk = m_motionModel->lookupLocalTransform(
+      pc_filtered.header.frame_id, t, localSensorFrame);
+  stageStart = m_profiler.record("sensor_tf_lookup", stageStart);
+  if (!sensorFrameOk)
     return false;
 
   tf::Transform torsoToSensor(localSensorFrame.inverse());
 
+  // evaluate wide distributions on fewer beams and coarser maps
+  const int resolutionLevel = annealingLevel();
+
   //### Particles in log-form from here...
   toLogForm();
 
@@ -644,16 +860,54 @@ bool SquirrelLocalizer::localizeWithMeasurement(
     }
   }
 
+  stageStart = m_profiler.record("pose_measurement", stageStart);
+
   m_filteredPointCloudPub.publish(pc_filtered);
-  m_observationModel->integrateMeasurement(
-      m_particles, pc_filtered, ranges, max_range, torsoToSensor);
+  m_observationModel->setResolutionLevel(resolutionLevel);
+  size_t numIntegrated = pc_filtered.size();
+  if (resolutionLevel > 0) {
+    const size_t stride = size_t(1) << resolutionLevel;
+    PointCloud pcCoarse;
+    std::vector<float> rangesCoarse;
+    SensorTags tagsCoarse;
+    pcCoarse.header = pc_filtered.header;
+    pcCoarse.reserve(pc_filtered.size() / stride + 1);
+    rangesCoarse.reserve(pc_filtered.size() / stride + 1);
+    tagsCoarse.reserve(pc_filtered.size() / stride + 1);
+    for (size_t k = 0; k < pc_filtered.size(); k += stride) {
+      pcCoarse.push_back(pc_filtered[k]);
+      rangesCoarse.push_back(ranges[k]);
+      tagsCoarse.push_back(tags[k]);
+    }
+    ROS_DEBUG_STREAM(
+        m_nodeName << ": Annealing level " << resolutionLevel << ", "
+                   << pcCoarse.size() << " beams");
+    m_observationModel->integrateMeasurement(
+        m_particles, pcCoarse, rangesCoarse, tagsCoarse, max_range,
+        torsoToSensor);
+    numIntegrated = pcCoarse.size();
+  } else {
+    m_observationModel->integrateMeasurement(
+        m_particles, pc_filtered, ranges, tags, max_range, torsoToSensor);
+  }
+  const StageProfiler::Clock::time_point observationEnd =
+      m_profiler.record("observation_model", stageStart);
+  // feedback for the sampling distance, as if at full resolution
+  if (numIntegrated > 0)
+    m_adaptiveSampling->update(
+        pc_filtered.size(),
+        std::chrono::duration<double>(observationEnd - stageStart).count() *
+            pc_filtered.size() / numIntegrated);
+  stageStart = observationEnd;
 
   // TODO: verify poses before measurements, ignore particles then
   m_mapModel->verifyPoses(m_particles);
+  stageStart = m_profiler.record("verify_poses", stageStart);
 
   // normalize weights and transform back from log:
   normalizeWeights();
   //### Particles back in regular form now
+  stageStart = m_profiler.record("normalize", stageStart);
 
   double nEffParticles = nEff();
 
@@ -667,6 +921,7 @@ bool SquirrelLocalizer::localizeWithMeasurement(
         m_nodeName << ": Resampling, nEff=" << nEffParticles
                    << " numParticles=" << m_particles.size());
     resample();
+    m_profiler.record("resample", stageStart);
   } else {
     ROS_INFO_STREAM(
         m_nodeName << ": Skipped resampling, nEff=" << nEffParticles
@@ -677,8 +932,9 @@ bool SquirrelLocalizer::localizeWithMeasurement(
 
   double dt = (ros::WallTime::now() - startTime).toSec();
   ROS_INFO_STREAM(
-      m_nodeName << "Observations for " << m_numParticles << " particles took "
-                 << dt << "s (=" << dt / m_numParticles << "s/particle)");
+      m_nodeName << "Observations for " << m_particles.size()
+                 << " particles took " << dt << "s (="
+                 << dt / m_particles.size() << "s/particle)");
 
   return true;
 }
@@ -734,7 +990,7 @@ void SquirrelLocalizer::prepareLaserPointCloud(
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloudPtr;
   cloudPtr.reset(new pcl::PointCloud<pcl::PointXYZ>(pc));
   uniformSampling.setInputCloud(cloudPtr);
-  uniformSampling.setRadiusSearch(m_sensorSampleDist);
+  uniformSampling.setRadiusSearch(m_adaptiveSampling->sampleDist());
   pcl::PointCloud<int> sampledIndices;
   uniformSampling.compute(sampledIndices);
   pcl::copyPointCloud(*cloudPtr, sampledIndices.points, pc);
@@ -791,7 +1047,7 @@ void SquirrelLocalizer::prepareLaserPointCloud(
   pcl::PointCloud<pcl::PointXYZ>::Ptr cloudPtr;
   cloudPtr.reset(new pcl::PointCloud<pcl::PointXYZ>(pc));
   uniformSampling.setInputCloud(cloudPtr);
-  uniformSampling.setRadiusSearch(m_sensorSampleDist);
+  uniformSampling.setRadiusSearch(m_adaptiveSampling->sampleDist());
   pcl::PointCloud<int> sampledIndices;
   uniformSampling.compute(sampledIndices);
   pcl::copyPointCloud(*cloudPtr, sampledIndices.points, pc);
@@ -817,7 +1073,15 @@ int SquirrelLocalizer::filterUniform(
   indices.reserve(numPoints);
   for (int i = 0; i < numPoints; ++i)
     indices.push_back(i);
-  random_shuffle(indices.begin(), indices.end());
+  // Fisher-Yates on the counter of the stamp of the cloud, so the samples
+  // only depend on the seed and on the cloud
+  const Philox4x32 generator(m_samplingSeed);
+  const uint64_t counter = uint64_t(cloud_in.header.stamp) << 20;
+  for (int i = numPoints - 1; i > 0; --i) {
+    uint32_t block[4];
+    generator(counter + i, block);
+    std::swap(indices[i], indices[block[0] % (i + 1)]);
+  }
 
   cloud_out.reserve(cloud_out.size() + numSamples);
   for (int i = 0; i < numSamples; ++i) {
@@ -950,45 +1214,145 @@ void SquirrelLocalizer::filterGroundPlane(
   }
 }
 
+void SquirrelLocalizer::filterGroundHeightBand(
+    const PointCloud& pc, PointCloud& ground, PointCloud& nonground,
+    double groundFilterDistance, double groundFilterAngle,
+    double groundFilterPlaneDistance, double cellSize) {
+  ground.header    = pc.header;
+  nonground.header = pc.header;
+  ground.clear();
+  nonground.clear();
+  ground.reserve(pc.size());
+  nonground.reserve(pc.size());
+
+  if (cellSize <= 0.0) {
+    // the footprint frame is on the floor, ground is a band around z=0
+    for (size_t i = 0; i < pc.size(); ++i) {
+      if (std::abs(pc[i].z) <= groundFilterDistance)
+        ground.push_back(pc[i]);
+      else
+        nonground.push_back(pc[i]);
+    }
+    return;
+  }
+
+  // Local planes z = a*x + b*y + c, least squares fit of the points within
+  // groundFilterPlaneDistance of the floor in every xy cell, in one pass.
+  typedef Eigen::Matrix<double, 8, 1, Eigen::DontAlign> Sums;
+  struct PlaneFit {
+    PlaneFit()
+        : n(0),
+          sums(Sums::Zero()),
+          valid(false),
+          plane(Eigen::Vector3d::Zero()) {}
+    int n;
+    Sums sums;  // x, y, z, xx, xy, yy, xz, yz
+    bool valid;
+    Eigen::Vector3d plane;
+  };
+  typedef std::map<std::pair<int, int>, PlaneFit> Cells;
+  const double invCellSize = 1.0 / cellSize;
+  std::vector<Cells::iterator> cellOfPoint(pc.size());
+  Cells cells;
+  for (size_t i = 0; i < pc.size(); ++i) {
+    const pcl::PointXYZ& p = pc[i];
+    const std::pair<int, int> key(
+        std::floor(p.x * invCellSize), std::floor(p.y * invCellSize));
+    cellOfPoint[i] = cells.insert(std::make_pair(key, PlaneFit())).first;
+    if (std::abs(p.z) <= groundFilterPlaneDistance) {
+      PlaneFit& fit = cellOfPoint[i]->second;
+      ++fit.n;
+      fit.sums += (Sums() << p.x, p.y, p.z, p.x * p.x,
+                   p.x * p.y, p.y * p.y, p.x * p.z, p.y * p.z)
+                      .finished();
+    }
+  }
+
+  // planes steeper than groundFilterAngle or away from the floor are rejected
+  const double maxSlope = std::tan(groundFilterAngle);
+  for (Cells::iterator it = cells.begin(); it != cells.end(); ++it) {
+    PlaneFit& fit = it->second;
+    if (fit.n < 3)
+      continue;
+    const Sums& s = fit.sums;
+    Eigen::Matrix3d A;
+    A << s(3), s(4), s(0), s(4), s(5), s(1), s(0), s(1), fit.n;
+    const Eigen::Vector3d b(s(6), s(7), s(2));
+    Eigen::FullPivLU<Eigen::Matrix3d> lu(A);
+    if (lu.rank() < 3)
+      continue;
+    fit.plane = lu.solve(b);
+    // plane height at the cell center
+    const double cx = (it->first.first + 0.5) * cellSize;
+    const double cy = (it->first.second + 0.5) * cellSize;
+    fit.valid =
+        std::hypot(fit.plane(0), fit.plane(1)) <= maxSlope &&
+        std::abs(fit.plane(0) * cx + fit.plane(1) * cy + fit.plane(2)) <=
+            groundFilterPlaneDistance;
+  }
+
+  // cells without a valid plane fall back to the height band
+  for (size_t i = 0; i < pc.size(); ++i) {
+    const pcl::PointXYZ& p = pc[i];
+    const PlaneFit& fit    = cellOfPoint[i]->second;
+    const double height =
+        fit.valid ? p.z - (fit.plane(0) * p.x + fit.plane(1) * p.y +
+                           fit.plane(2))
+                  : p.z;
+    if (std::abs(height) <= groundFilterDistance)
+      ground.push_back(p);
+    else
+      nonground.push_back(p);
+  }
+}
+
 void SquirrelLocalizer::prepareGeneralPointCloud(
     const sensor_msgs::PointCloud2::ConstPtr& msg, PointCloud& pc,
     std::vector<float>& ranges) const {
 
   pc.clear();
+  StageProfiler::Clock::time_point t = StageProfiler::Clock::now();
   // lookup Transfrom Sensor to BaseFootprint
   tf::StampedTransform sensorToBaseFootprint;
-  try {
-    m_tfListener.waitForTransform(
-        m_baseFootprintId, msg->header.frame_id, msg->header.stamp,
-        ros::Duration(0.2));
-    m_tfListener.lookupTransform(
-        m_baseFootprintId, msg->header.frame_id, msg->header.stamp,
-        sensorToBaseFootprint);
-
-  } catch (tf::TransformException& ex) {
-    ROS_ERROR_STREAM(
-        m_nodeName << ": Transform error for pointCloudCallback: " << ex.what()
-                   << ", quitting callback.");
-    return;
+  if (!m_poseCache ||
+      !m_poseCache->lookupTransform(
+          m_baseFootprintId, msg->header.frame_id, msg->header.stamp,
+          sensorToBaseFootprint)) {
+    try {
+      m_tfListener.waitForTransform(
+          m_baseFootprintId, msg->header.frame_id, msg->header.stamp,
+          ros::Duration(0.2));
+      m_tfListener.lookupTransform(
+          m_baseFootprintId, msg->header.frame_id, msg->header.stamp,
+          sensorToBaseFootprint);
+
+    } catch (tf::TransformException& ex) {
+      ROS_ERROR_STREAM(
+          m_nodeName << ": Transform error for pointCloudCallback: "
+                     << ex.what() << ", quitting callback.");
+      return;
+    }
   }
+  t = m_profiler.record("footprint_tf_lookup", t);
 
   /*** filter PointCloud and fill pc and ranges ***/
 
-  // pass-through filter to get rid of near and far ranges
-  pcl::PassThrough<pcl::PointXYZ> pass;
-  pcl::PointCloud<pcl::PointXYZ>::Ptr pcd_tmp(
-      new pcl::PointCloud<pcl::PointXYZ>());
+  // read the cloud once, without the NaN points, and get rid of near and far
+  // ranges in place
+  squirrel_point_buffer::PointBuffer points;
+  const squirrel_point_buffer::PointCloud2View view(*msg);
+  if (!points.assign(view)) {
+    pcl::PointCloud<pcl::PointXYZ> pcd_tmp;
+    pcl::fromROSMsg(*msg, pcd_tmp);
+    squirrel_point_buffer::fromPCL(pcd_tmp, &points);
+  }
+  squirrel_point_buffer::cropAxis(
+      2, m_filterMinRange, m_filterMaxRange, &points);
 #if PCL_VERSION_COMPARE(>=, 1, 7, 0)
-  pcl::PCLPointCloud2 pcd2_tmp;
-  pcl_conversions::toPCL(*msg, pcd2_tmp);
-  pcl::fromPCLPointCloud2(pcd2_tmp, *pcd_tmp);
+  pcl_conversions::toPCL(msg->header, pc.header);
 #else
-  pcl::fromROSMsg(*msg, *pcd_tmp);
+  pc.header = msg->header;
 #endif
-  pass.setInputCloud(pcd_tmp);
-  pass.setFilterFieldName("z");
-  pass.setFilterLimits(m_filterMinRange, m_filterMaxRange);
-  pass.filter(pc);
 
   // identify ground plane
   PointCloud ground, nonground;
@@ -998,22 +1362,31 @@ void SquirrelLocalizer::prepareGeneralPointCloud(
     pcl_ros::transformAsMatrix(
         sensorToBaseFootprint.inverse(), matBaseFootprintToSensor);
     // TODO:Why transform the point cloud and not just the normal vector?
-    pcl::transformPointCloud(pc, pc, matSensorToBaseFootprint);
-    filterGroundPlane(
-        pc, ground, nonground, m_groundFilterDistance, m_groundFilterAngle,
-        m_groundFilterPlaneDistance);
+    squirrel_point_buffer::transform(
+        Eigen::Affine3f(matSensorToBaseFootprint), &points);
+    squirrel_point_buffer::toPCL(points, &pc);
+    t = m_profiler.record("range_filter", t);
+    if (m_groundFilterMethod == "height_band")
+      filterGroundHeightBand(
+          pc, ground, nonground, m_groundFilterDistance, m_groundFilterAngle,
+          m_groundFilterPlaneDistance, m_groundFilterCellSize);
+    else
+      filterGroundPlane(
+          pc, ground, nonground, m_groundFilterDistance, m_groundFilterAngle,
+          m_groundFilterPlaneDistance);
+    t = m_profiler.record("ground_filter", t);
 
     // clear pc again and refill it based on classification
     pc.clear();
     pcl::PointCloud<int> sampledIndices;
+    const double sampleDist = m_adaptiveSampling->sampleDist();
 
     int numFloorPoints = 0;
     if (ground.size() > 0) {  // check for 0 size, otherwise PCL crashes
       // transform clouds back to sensor for integration
       pcl::transformPointCloud(ground, ground, matBaseFootprintToSensor);
       voxelGridSampling(
-          ground, sampledIndices,
-          m_sensorSampleDist * m_sensorSampleDistGroundFactor);
+          ground, sampledIndices, sampleDist * m_sensorSampleDistGroundFactor);
       pcl::copyPointCloud(ground, sampledIndices.points, pc);
       numFloorPoints = sampledIndices.size();
     }
@@ -1024,12 +1397,14 @@ void SquirrelLocalizer::prepareGeneralPointCloud(
     if (nonground.size() > 0) {  // check for 0 size, otherwise PCL crashes
       // transform clouds back to sensor for integration
       pcl::transformPointCloud(nonground, nonground, matBaseFootprintToSensor);
-      voxelGridSampling(nonground, sampledIndices, m_sensorSampleDist);
+      voxelGridSampling(nonground, sampledIndices, sampleDist);
       pcl::copyPointCloud(nonground, sampledIndices.points, nonground);
       numNonFloorPoints = sampledIndices.size();
       pc += nonground;
     }
 
+    m_profiler.record("voxel_sampling", t);
+
     // TODO improve sampling?
     if (m_verbose)
       ROS_INFO_STREAM(
@@ -1045,12 +1420,15 @@ void SquirrelLocalizer::prepareGeneralPointCloud(
     }
 
   } else {
+    squirrel_point_buffer::toPCL(points, &pc);
+    t = m_profiler.record("range_filter", t);
     ROS_INFO_STREAM(m_nodeName << ": Starting uniform sampling");
     // ROS_ERROR("No ground filtering is not implemented yet!");
     // uniform sampling:
     pcl::PointCloud<int> sampledIndices;
-    voxelGridSampling(pc, sampledIndices, m_sensorSampleDist);
+    voxelGridSampling(pc, sampledIndices, m_adaptiveSampling->sampleDist());
     pcl::copyPointCloud(pc, sampledIndices.points, pc);
+    m_profiler.record("voxel_sampling", t);
 
     // adjust "ranges" array to contain the same points:
     ranges.resize(sampledIndices.size());
@@ -1084,6 +1462,69 @@ void SquirrelLocalizer::pointCloudCallback(
   if (!m_useDepthCamera || m_useLaserScanner)
     return;
 
+  if (!m_pipelinePointClouds) {
+    boost::mutex::scoped_lock lock(m_filterMutex);
+    processPointCloud(msg, NULL);
+    return;
+  }
+
+  // hand over to the preprocessing thread
+  if (m_rawClouds->push(msg))
+    m_pipelineCondition.notify_all();
+  else
+    ROS_WARN_STREAM_THROTTLE(
+        1.0, m_nodeName << ": Point cloud preprocessing is busy, dropping "
+                           "point cloud");
+}
+
+void SquirrelLocalizer::preprocessingLoop() {
+  while (m_pipelineRunning) {
+    sensor_msgs::PointCloud2::ConstPtr msg;
+    if (!m_rawClouds->pop(msg)) {
+      waitForPipeline();
+      continue;
+    }
+
+    boost::shared_ptr<PreparedCloud> prepared(new PreparedCloud);
+    prepared->msg = msg;
+    StageProfiler::Clock::time_point t = StageProfiler::Clock::now();
+    prepareGeneralPointCloud(msg, prepared->pc, prepared->ranges);
+    m_profiler.record("prepare_cloud", t);
+
+    if (m_preparedClouds->push(prepared))
+      m_pipelineCondition.notify_all();
+    else
+      ROS_WARN_STREAM_THROTTLE(
+          1.0, m_nodeName << ": Particle filter is busy, dropping "
+                             "preprocessed point cloud");
+  }
+}
+
+void SquirrelLocalizer::filterLoop() {
+  while (m_pipelineRunning) {
+    boost::shared_ptr<PreparedCloud> prepared;
+    if (!m_preparedClouds->pop(prepared)) {
+      waitForPipeline();
+      continue;
+    }
+
+    boost::mutex::scoped_lock lock(m_filterMutex);
+    processPointCloud(prepared->msg, prepared.get());
+  }
+}
+
+void SquirrelLocalizer::waitForPipeline() {
+  // the queues are lock-free, the mutex only serves sleeping until new data
+  // is pushed. The timeout covers notifications between pop() and wait.
+  boost::unique_lock<boost::mutex> lock(m_pipelineMutex);
+  m_pipelineCondition.timed_wait(lock, boost::posix_time::milliseconds(5));
+}
+
+void SquirrelLocalizer::processPointCloud(
+    const sensor_msgs::PointCloud2::ConstPtr& msg, PreparedCloud* prepared) {
+  if (!m_useDepthCamera || m_useLaserScanner)
+    return;
+
   ROS_INFO_STREAM_COND(
       m_printPointCloudSubscription,
       m_nodeName << ": Subscribing to sensor_msgs::PointCloud2 data.");
@@ -1104,10 +1545,15 @@ void SquirrelLocalizer::pointCloudCallback(
     return;
   }
 
+  StageProfiler::Scope callbackScope(m_profiler, "cloud_callback");
+  StageProfiler::Clock::time_point t = StageProfiler::Clock::now();
+
   /// absolute, current odom pose
   tf::Stamped<tf::Pose> odomPose;
   // check if odometry available, skip scan if not.
-  if (!m_motionModel->lookupOdomPose(msg->header.stamp, odomPose))
+  const bool odomOk = m_motionModel->lookupOdomPose(msg->header.stamp, odomPose);
+  t                 = m_profiler.record("odom_lookup", t);
+  if (!odomOk)
     return;
 
   bool sensor_integrated = false;
@@ -1143,7 +1589,14 @@ void SquirrelLocalizer::pointCloudCallback(
     // convert laser to point cloud first:
     PointCloud pc_filtered;
     std::vector<float> rangesSparse;
-    prepareGeneralPointCloud(msg, pc_filtered, rangesSparse);
+    if (prepared) {
+      pc_filtered.swap(prepared->pc);
+      rangesSparse.swap(prepared->ranges);
+    } else {
+      t = StageProfiler::Clock::now();
+      prepareGeneralPointCloud(msg, pc_filtered, rangesSparse);
+      m_profiler.record("prepare_cloud", t);
+    }
 
     double maxRange = 10.0;  // TODO #4: What is a maxRange for pointClouds?
                              // NaN? maxRange is expected to be a double and
@@ -1153,31 +1606,42 @@ void SquirrelLocalizer::pointCloudCallback(
         "Updating Pose Estimate from a PointCloud with %zu points and %zu "
         "ranges",
         pc_filtered.size(), rangesSparse.size());
-    sensor_integrated =
-        localizeWithMeasurement(pc_filtered, rangesSparse, maxRange);
+    sensor_integrated = localizeWithMeasurement(
+        pc_filtered, rangesSparse,
+        SensorTags(pc_filtered.size(), DEPTH_SENSOR), maxRange);
   }
-  if (!sensor_integrated) {  // no observation necessary: propagate particles
-                             // forward by full interval
+  // with lazy prediction the particles follow at the next update only
+  const bool deferMotion = m_lazyPrediction && !sensor_integrated;
+  // no observation necessary: propagate particles forward by full interval
+  if (!sensor_integrated && !deferMotion) {
     // relative odom transform to last odomPose
     tf::Transform odomTransform = m_motionModel->computeOdomTransform(odomPose);
     m_motionModel->applyOdomTransform(m_particles, odomTransform);
     constrainMotion(odomPose);
-  } else {
+  } else if (sensor_integrated) {
     m_lastLocalizedPose = odomPose;
     // TODO #1
     m_headYawRotationLastScan   = headYaw;
     m_headPitchRotationLastScan = headPitch;
   }
 
-  m_motionModel->storeOdomPose(odomPose);
-  publishPoseEstimate(msg->header.stamp, sensor_integrated);
+  if (!deferMotion)
+    m_motionModel->storeOdomPose(odomPose);
+  t = StageProfiler::Clock::now();
+  if (deferMotion)
+    publishPredictedPose(msg->header.stamp, odomPose);
+  else
+    publishPoseEstimate(msg->header.stamp, sensor_integrated);
+  m_profiler.record("publish", t);
   m_lastPointCloudTime = msg->header.stamp;
+  publishDiagnostics(msg->header.stamp);
   ROS_DEBUG("PointCloud callback complete.");
 }
 
 void SquirrelLocalizer::synchronizedCallback(
     const sensor_msgs::LaserScan::ConstPtr& scanMsg,
     const sensor_msgs::PointCloud2::ConstPtr& cloudMsg) {
+  boost::mutex::scoped_lock lock(m_filterMutex);
   /// use mean of time stamps
   double stamp_sec =
       0.5 * (scanMsg->header.stamp.toSec() + cloudMsg->header.stamp.toSec());
@@ -1219,10 +1683,15 @@ void SquirrelLocalizer::synchronizedCallback(
     }
   }
 
+  StageProfiler::Scope callbackScope(m_profiler, "synchronized_callback");
+  StageProfiler::Clock::time_point t = StageProfiler::Clock::now();
+
   /// absolute, current odom pose
   tf::Stamped<tf::Pose> odomPose;
   // check if odometry available, skip scan if not.
-  if (!m_motionModel->lookupOdomPose(stamp, odomPose))
+  const bool odomOk = m_motionModel->lookupOdomPose(stamp, odomPose);
+  t                 = m_profiler.record("odom_lookup", t);
+  if (!odomOk)
     return;
 
   bool sensor_integrated = false;
@@ -1254,19 +1723,26 @@ void SquirrelLocalizer::synchronizedCallback(
 
   if (!m_paused && (!m_receivedSensorData || isAboveHeadMotionThreshold ||
                     isAboveMotionThreshold(odomPose))) {
-    // convert laser to point cloud first: (we use the sparse poincloud of the
-    // pointcloud data as storage for the full sensors' readings
+    // one batch for both sensors, evaluated in a single pass per particle:
+    // the laser points (in the camera frame) are appended to the sparse
+    // point cloud, and tagged with their sensor model
     PointCloud pc_filteredScan, pc_filteredFull;
     std::vector<float> rangesSparseScan, rangesSparseFull;
+    t = StageProfiler::Clock::now();
     prepareLaserPointCloud(
         scanMsg, cloudMsg->header.frame_id, pc_filteredScan, rangesSparseScan);
+    t = m_profiler.record("prepare_laser", t);
     prepareGeneralPointCloud(cloudMsg, pc_filteredFull, rangesSparseFull);
+    t = m_profiler.record("prepare_cloud", t);
+    SensorTags tagsFull(pc_filteredFull.size(), DEPTH_SENSOR);
+    pc_filteredFull.reserve(pc_filteredFull.size() + pc_filteredScan.size());
     pc_filteredFull.insert(
-        pc_filteredFull.begin(), pc_filteredScan.begin(),
-        pc_filteredScan.end());
+        pc_filteredFull.end(), pc_filteredScan.begin(), pc_filteredScan.end());
     rangesSparseFull.insert(
-        rangesSparseFull.begin(), rangesSparseScan.begin(),
+        rangesSparseFull.end(), rangesSparseScan.begin(),
         rangesSparseScan.end());
+    tagsFull.resize(pc_filteredFull.size(), LASER_SENSOR);
+    m_profiler.record("fuse_batch", t);
 
     double maxRange = scanMsg->range_max > 10. ? scanMsg->range_max : 10.;
 
@@ -1274,37 +1750,53 @@ void SquirrelLocalizer::synchronizedCallback(
         "Updating Pose Estimate from a PointCloud with %zu points and %zu "
         "ranges",
         pc_filteredFull.size(), rangesSparseFull.size());
-    sensor_integrated =
-        localizeWithMeasurement(pc_filteredFull, rangesSparseFull, maxRange);
+    sensor_integrated = localizeWithMeasurement(
+        pc_filteredFull, rangesSparseFull, tagsFull, maxRange);
   }
 
-  if (!sensor_integrated) {  // no observation necessary: propagate particles
-                             // forward by full interval
+  // with lazy prediction the particles follow at the next update only
+  const bool deferMotion = m_lazyPrediction && !sensor_integrated;
+  // no observation necessary: propagate particles forward by full interval
+  if (!sensor_integrated && !deferMotion) {
     // relative odom transform to last odomPose
     tf::Transform odomTransform = m_motionModel->computeOdomTransform(odomPose);
     m_motionModel->applyOdomTransform(m_particles, odomTransform);
     constrainMotion(odomPose);
-  } else {
+  } else if (sensor_integrated) {
     m_lastLocalizedPose = odomPose;
     // TODO #1
     m_headYawRotationLastScan   = headYaw;
     m_headPitchRotationLastScan = headPitch;
   }
 
-  m_motionModel->storeOdomPose(odomPose);
-  publishPoseEstimate(stamp, sensor_integrated);
+  if (!deferMotion)
+    m_motionModel->storeOdomPose(odomPose);
+  t = StageProfiler::Clock::now();
+  if (deferMotion)
+    publishPredictedPose(stamp, odomPose);
+  else
+    publishPoseEstimate(stamp, sensor_integrated);
+  m_profiler.record("publish", t);
   m_lastPointCloudTime = cloudMsg->header.stamp;
   m_lastLaserTime      = scanMsg->header.stamp;
+  publishDiagnostics(stamp);
   ROS_DEBUG("LaserScan + PointCloud callback complete.");
 }
 
 void SquirrelLocalizer::imuCallback(const sensor_msgs::ImuConstPtr& msg) {
-  m_lastIMUMsgBuffer.push_back(*msg);
+  ImuBuffer::Sample sample;
+  sample.stamp = msg->header.stamp;
+  getRP(msg->orientation, sample.roll, sample.pitch);
+  tf::quaternionMsgToTF(msg->orientation, sample.orientation);
+  if (!m_imuBuffer.push(sample))
+    ROS_DEBUG_STREAM(
+        m_nodeName << ": Ignoring an IMU message older than the last one");
 }
 
 bool SquirrelLocalizer::toggleSensorsSrvCallback(
     squirrel_3d_localizer_msgs::ToggleSensors::Request& req,
     squirrel_3d_localizer_msgs::ToggleSensors::Response& res) {
+  boost::mutex::scoped_lock lock(m_filterMutex);
   const bool useLaserScanner = req.use_laser_scanner.data;
   const bool useDepthCamera  = req.use_depth_camera.data;
 
@@ -1329,18 +1821,14 @@ bool SquirrelLocalizer::toggleSensorsSrvCallback(
 bool SquirrelLocalizer::resetMapSrvCallback(
     squirrel_3d_localizer_msgs::SetMap::Request& req,
     squirrel_3d_localizer_msgs::SetMap::Response& res) {
+  boost::mutex::scoped_lock lock(m_filterMutex);
   // resetting map.
   m_motionModel = boost::shared_ptr<MotionModel>(new MotionModel(
       &m_privateNh, &m_rngEngine, &m_tfListener, m_odomFrameId, m_baseFrameId));
-  if (m_useRaycasting) {
-    m_mapModel.reset(new OccupancyMap(&m_privateNh));
-    m_observationModel.reset(
-        new RaycastingModel(&m_privateNh, m_mapModel, &m_rngEngine));
-  } else {
-    m_mapModel.reset(new OccupancyMap(&m_privateNh));
-    m_observationModel.reset(
-        new EndpointModel(&m_privateNh, m_mapModel, &m_rngEngine));
-  }
+  m_motionModel->setPoseCache(m_poseCache);
+  // the observation model updates its precomputed data for the new map
+  m_mapModel.reset(new OccupancyMap(&m_privateNh));
+  m_observationModel->setMapModel(m_mapModel);
   // adapting the particles to the new map.
   tf::Transform tf_newMap2oldMap;
   tf::poseMsgToTF(req.tf_oldMap2newMap, tf_newMap2oldMap);
@@ -1361,26 +1849,19 @@ bool SquirrelLocalizer::resetMapSrvCallback(
 bool SquirrelLocalizer::getImuMsg(
     const ros::Time& stamp, ros::Time& imuStamp, double& angleX,
     double& angleY) const {
-  if (m_lastIMUMsgBuffer.empty())
+  if (m_imuBuffer.empty())
     return false;
 
-  typedef boost::circular_buffer<sensor_msgs::Imu>::const_iterator ItT;
-  const double maxAge      = 0.2;
-  double closestOlderStamp = std::numeric_limits<double>::max();
-  double closestNewerStamp = std::numeric_limits<double>::max();
-  ItT closestOlder         = m_lastIMUMsgBuffer.end(),
-      closestNewer         = m_lastIMUMsgBuffer.end();
-  for (ItT it = m_lastIMUMsgBuffer.begin(); it != m_lastIMUMsgBuffer.end();
-       it++) {
-    const double age = (stamp - it->header.stamp).toSec();
-    if (age >= 0.0 && age < closestOlderStamp) {
-      closestOlderStamp = age;
-      closestOlder      = it;
-    } else if (age < 0.0 && -age < closestNewerStamp) {
-      closestNewerStamp = -age;
-      closestNewer      = it;
-    }
-  }
+  typedef ImuBuffer::Sample SampleT;
+  const double maxAge = 0.2;
+  const SampleT *closestOlder, *closestNewer;
+  m_imuBuffer.bracket(stamp, closestOlder, closestNewer);
+  const double closestOlderStamp =
+      closestOlder ? (stamp - closestOlder->stamp).toSec()
+                   : std::numeric_limits<double>::max();
+  const double closestNewerStamp =
+      closestNewer ? (closestNewer->stamp - stamp).toSec()
+                   : std::numeric_limits<double>::max();
 
   if (closestOlderStamp < maxAge && closestNewerStamp < maxAge &&
       closestOlderStamp + closestNewerStamp > 0.0) {
@@ -1389,24 +1870,24 @@ bool SquirrelLocalizer::getImuMsg(
         closestNewerStamp / (closestNewerStamp + closestOlderStamp);
     const double weightNewer = 1.0 - weightOlder;
     imuStamp                 = ros::Time(
-        weightOlder * closestOlder->header.stamp.toSec() +
-        weightNewer * closestNewer->header.stamp.toSec());
-    double olderX, olderY, newerX, newerY;
-    getRP(closestOlder->orientation, olderX, olderY);
-    getRP(closestNewer->orientation, newerX, newerY);
-    angleX = weightOlder * olderX + weightNewer * newerX;
-    angleY = weightOlder * olderY + weightNewer * newerY;
+        weightOlder * closestOlder->stamp.toSec() +
+        weightNewer * closestNewer->stamp.toSec());
+    angleX =
+        weightOlder * closestOlder->roll + weightNewer * closestNewer->roll;
+    angleY =
+        weightOlder * closestOlder->pitch + weightNewer * closestNewer->pitch;
     ROS_DEBUG(
         "Msg: %.3f, Interpolate [%.3f .. %.3f .. %.3f]\n", stamp.toSec(),
-        closestOlder->header.stamp.toSec(), imuStamp.toSec(),
-        closestNewer->header.stamp.toSec());
+        closestOlder->stamp.toSec(), imuStamp.toSec(),
+        closestNewer->stamp.toSec());
     return true;
   } else if (closestOlderStamp < maxAge || closestNewerStamp < maxAge) {
     // Return closer one
-    ItT it =
+    const SampleT* it =
         (closestOlderStamp < closestNewerStamp) ? closestOlder : closestNewer;
-    imuStamp = it->header.stamp;
-    getRP(it->orientation, angleX, angleY);
+    imuStamp = it->stamp;
+    angleX   = it->roll;
+    angleY   = it->pitch;
     return true;
   } else {
     if (closestOlderStamp < closestNewerStamp)
@@ -1422,6 +1903,12 @@ bool SquirrelLocalizer::getImuMsg(
   }
 }
 
+void SquirrelLocalizer::lockedInitPoseCallback(
+    const geometry_msgs::PoseWithCovarianceStampedConstPtr& msg) {
+  boost::mutex::scoped_lock lock(m_filterMutex);
+  initPoseCallback(msg);
+}
+
 void SquirrelLocalizer::initPoseCallback(
     const geometry_msgs::PoseWithCovarianceStampedConstPtr& msg) {
   tf::Pose pose;
@@ -1488,7 +1975,7 @@ void SquirrelLocalizer::initPoseCallback(
     if (m_initPoseRealZRP) {
       bool useOdometry = true;
       if (m_useIMU) {
-        if (m_lastIMUMsgBuffer.empty()) {
+        if (m_imuBuffer.empty()) {
           ROS_WARN_STREAM(
               m_nodeName << ": Could not determine current roll and pitch "
                             "because IMU message "
@@ -1498,7 +1985,8 @@ void SquirrelLocalizer::initPoseCallback(
           if (msg->header.stamp.isZero()) {
             // Header stamp is not set (e.g. RViz), use stamp from latest IMU
             // message instead
-            getRP(m_lastIMUMsgBuffer.back().orientation, roll, pitch);
+            roll  = m_imuBuffer.back().roll;
+            pitch = m_imuBuffer.back().pitch;
             ok = true;
           } else {
             ros::Time imuStamp;
@@ -1560,6 +2048,7 @@ void SquirrelLocalizer::initPoseCallback(
   }
 
   // sample from initial pose covariance:
+  m_particles.resize(m_numParticles);
   Matrix6d initCovL = initCov.llt().matrixL();
   tf::Transform transformNoise;  // transformation on original pose from noise
   unsigned idx = 0;
@@ -1624,6 +2113,7 @@ void SquirrelLocalizer::initPoseCallback(
 
 bool SquirrelLocalizer::globalLocalizationCallback(
     std_srvs::Empty::Request& req, std_srvs::Empty::Response& res) {
+  boost::mutex::scoped_lock lock(m_filterMutex);
 
   initGlobal();
 
@@ -1631,67 +2121,115 @@ bool SquirrelLocalizer::globalLocalizationCallback(
 }
 
 void SquirrelLocalizer::normalizeWeights() {
+  const int numParticles = m_particles.size();
+  const bool parallel    = numParticles >= m_parallelMinParticles;
+  m_cumWeights.resize(numParticles);
+  m_blockWeights.resize(omp_get_max_threads() + 1);
+  m_blockSqrWeights.resize(omp_get_max_threads());
+  m_blockMinWeights.resize(omp_get_max_threads());
+  m_blockBestIdx.resize(omp_get_max_threads());
 
   double wmin = std::numeric_limits<double>::max();
   double wmax = -std::numeric_limits<double>::max();
+  double scale = 1.0, offset = 0.0, weights_sum = 0.0, sqr_weights_sum = 0.0;
 
-  for (unsigned i = 0; i < m_particles.size(); ++i) {
-    double weight = m_particles[i].weight;
-    assert(!isnan(weight));
-    if (weight < wmin)
-      wmin = weight;
-    if (weight > wmax) {
-      wmax              = weight;
-      m_bestParticleIdx = i;
+  // One region over contiguous blocks of particles: min/max, rescaling from
+  // log form, sums of weights and squared weights, normalization and the
+  // cumulative weights used for resampling.
+#pragma omp parallel if (parallel)
+  {
+    const int numThreads = omp_get_num_threads();
+    const int thread     = omp_get_thread_num();
+    const int begin      = numParticles * thread / numThreads;
+    const int end        = numParticles * (thread + 1) / numThreads;
+
+    double blockMin = std::numeric_limits<double>::max();
+    int blockBest   = -1;
+    for (int i = begin; i < end; ++i) {
+      const double weight = m_particles[i].weight;
+      assert(!isnan(weight));
+      if (weight < blockMin)
+        blockMin = weight;
+      if (blockBest < 0 || weight > m_particles[blockBest].weight)
+        blockBest = i;
     }
-  }
-  if (wmin > wmax) {
-    ROS_ERROR_STREAM(
-        m_nodeName << ": Error in weights: min=" << wmin << ", max=" << wmax
-                   << ", 1st particle weight=" << m_particles[1].weight
-                   << std::endl);
-  }
-
-  double min_normalized_value;
-  if (m_minParticleWeight > 0.0)
-    min_normalized_value = std::max(log(m_minParticleWeight), wmin - wmax);
-  else
-    min_normalized_value = wmin - wmax;
-
-  double max_normalized_value = 0.0;  // = log(1.0);
-  double dn                   = max_normalized_value - min_normalized_value;
-  double dw                   = wmax - wmin;
-  if (dw == 0.0)
-    dw         = 1;
-  double scale = dn / dw;
-  if (scale < 0.0) {
-    ROS_WARN_STREAM(
-        m_nodeName << ": normalizeWeights: scale is " << scale
-                   << " < 0, dw=" << dw << ", dn=" << dn);
-  }
-  double offset      = -wmax * scale;
-  double weights_sum = 0.0;
+    m_blockMinWeights[thread] = blockMin;
+    m_blockBestIdx[thread]    = blockBest;
+#pragma omp barrier
+
+#pragma omp single
+    {
+      for (int t = 0; t < numThreads; ++t) {
+        wmin = std::min(wmin, m_blockMinWeights[t]);
+        if (m_blockBestIdx[t] >= 0 &&
+            m_particles[m_blockBestIdx[t]].weight > wmax) {
+          wmax              = m_particles[m_blockBestIdx[t]].weight;
+          m_bestParticleIdx = m_blockBestIdx[t];
+        }
+      }
+      if (wmin > wmax) {
+        ROS_ERROR_STREAM(
+            m_nodeName << ": Error in weights: min=" << wmin
+                       << ", max=" << wmax << ", 1st particle weight="
+                       << m_particles[1].weight << std::endl);
+      }
 
-#pragma omp parallel
-  {
+      double min_normalized_value;
+      if (m_minParticleWeight > 0.0)
+        min_normalized_value = std::max(log(m_minParticleWeight), wmin - wmax);
+      else
+        min_normalized_value = wmin - wmax;
+
+      double max_normalized_value = 0.0;  // = log(1.0);
+      double dn = max_normalized_value - min_normalized_value;
+      double dw = wmax - wmin;
+      if (dw == 0.0)
+        dw  = 1;
+      scale = dn / dw;
+      if (scale < 0.0) {
+        ROS_WARN_STREAM(
+            m_nodeName << ": normalizeWeights: scale is " << scale
+                       << " < 0, dw=" << dw << ", dn=" << dn);
+      }
+      offset = -wmax * scale;
+    }
 
-#pragma omp for
-    for (unsigned i = 0; i < m_particles.size(); ++i) {
-      double w = m_particles[i].weight;
-      w        = exp(scale * w + offset);
+    double blockSum = 0.0, blockSqrSum = 0.0;
+    for (int i = begin; i < end; ++i) {
+      const double w = exp(scale * m_particles[i].weight + offset);
       assert(!isnan(w));
       m_particles[i].weight = w;
-#pragma omp atomic
-      weights_sum += w;
+      blockSum += w;
+      blockSqrSum += w * w;
+    }
+    m_blockWeights[thread + 1] = blockSum;
+    m_blockSqrWeights[thread]  = blockSqrSum;
+#pragma omp barrier
+
+#pragma omp single
+    {
+      // exclusive prefix sum over the blocks
+      m_blockWeights[0] = 0.0;
+      for (int t = 0; t < numThreads; ++t) {
+        m_blockWeights[t + 1] += m_blockWeights[t];
+        sqr_weights_sum += m_blockSqrWeights[t];
+      }
+      weights_sum = m_blockWeights[numThreads];
+      assert(weights_sum > 0.0);
     }
 
-    assert(weights_sum > 0.0);
-// normalize sum to 1:
-#pragma omp for
-    for (unsigned i = 0; i < m_particles.size(); ++i) {
+    // normalize sum to 1:
+    double cumWeight = m_blockWeights[thread] / weights_sum;
+    for (int i = begin; i < end; ++i) {
       m_particles[i].weight /= weights_sum;
+      cumWeight += m_particles[i].weight;
+      m_cumWeights[i] = cumWeight;
     }
   }
+
+  m_nEff = sqr_weights_sum > 0.0
+               ? weights_sum * weights_sum / sqr_weights_sum
+               : 0.0;
 }
 
 double SquirrelLocalizer::getCumParticleWeight() const {
@@ -1706,44 +2244,91 @@ double SquirrelLocalizer::getCumParticleWeight() const {
   return cumWeight;
 }
 
-void SquirrelLocalizer::resample(unsigned numParticles) {
-
-  if (numParticles <= 0)
-    numParticles = m_numParticles;
-
-  // compute the interval
-  double interval = getCumParticleWeight() / numParticles;
+int SquirrelLocalizer::maxNumParticles() const {
+  return m_kldSampling->enabled()
+             ? std::max(m_numParticles, m_kldSampling->maxParticles())
+             : m_numParticles;
+}
 
-  // compute the initial target weight
-  double target = interval * m_rngUniform();
+void SquirrelLocalizer::kldResampledIndices() {
+  // particles are drawn one at a time, until the bound of the bins they
+  // filled is reached
+  const double totalWeight = m_cumWeights.back();
+  m_kldSampling->reset();
+  m_resampledIndices.clear();
+  bool required = true;
+  while (required) {
+    const size_t i =
+        std::upper_bound(
+            m_cumWeights.begin(), m_cumWeights.end(),
+            totalWeight * m_rngUniform()) -
+        m_cumWeights.begin();
+    m_resampledIndices.push_back(std::min(i, m_cumWeights.size() - 1));
+    required = m_kldSampling->add(m_particles[m_resampledIndices.back()].pose);
+  }
+}
 
-  // compute the resampled indexes
-  double cumWeight = 0;
-  std::vector<unsigned> indices(numParticles);
+void SquirrelLocalizer::resample(unsigned numParticles) {
 
-  unsigned n = 0;
-  for (unsigned i = 0; i < m_particles.size(); ++i) {
-    cumWeight += m_particles[i].weight;
-    while (cumWeight > target && n < numParticles) {
-      if (m_bestParticleIdx >= 0 && i == unsigned(m_bestParticleIdx)) {
-        m_bestParticleIdx = n;
-      }
+  // cumulative weights are left by normalizeWeights(), recompute otherwise
+  if (m_cumWeights.size() != m_particles.size()) {
+    m_cumWeights.resize(m_particles.size());
+    double cumWeight = 0.0;
+    for (unsigned i = 0; i < m_particles.size(); ++i) {
+      cumWeight += m_particles[i].weight;
+      m_cumWeights[i] = cumWeight;
+    }
+  }
+  if (m_cumWeights.empty())
+    return;
 
-      indices[n++] = i;
-      target += interval;
+  if (numParticles <= 0 && m_kldSampling->enabled()) {
+    kldResampledIndices();
+    numParticles = m_resampledIndices.size();
+  } else {
+    if (numParticles <= 0)
+      numParticles = m_numParticles;
+
+    // compute the interval
+    double interval = m_cumWeights.back() / numParticles;
+
+    // compute the initial target weight
+    double target = interval * m_rngUniform();
+
+    // compute the resampled indexes, the n-th target is independent of the
+    // others in low variance sampling
+    const bool parallel = numParticles >= unsigned(m_parallelMinParticles);
+    m_resampledIndices.resize(numParticles);
+#pragma omp parallel for if (parallel)
+    for (unsigned n = 0; n < numParticles; ++n) {
+      const size_t i =
+          std::upper_bound(
+              m_cumWeights.begin(), m_cumWeights.end(),
+              target + n * interval) -
+          m_cumWeights.begin();
+      m_resampledIndices[n] = std::min(i, m_cumWeights.size() - 1);
     }
   }
   // indices now contains the indices to draw from the particles distribution
+  const bool parallel = numParticles >= unsigned(m_parallelMinParticles);
+
+  if (m_bestParticleIdx >= 0) {
+    const unsigned bestIdx = m_bestParticleIdx;
+    for (unsigned n = 0; n < numParticles; ++n)
+      if (m_resampledIndices[n] == bestIdx)
+        m_bestParticleIdx = n;
+  }
 
-  Particles oldParticles = m_particles;
-  m_particles.resize(numParticles);
+  m_resampledParticles.resize(numParticles);
   m_poseArray.poses.resize(numParticles);
   double newWeight = 1.0 / numParticles;
-#pragma omp parallel for
+#pragma omp parallel for if (parallel)
   for (unsigned i = 0; i < numParticles; ++i) {
-    m_particles[i].pose   = oldParticles[indices[i]].pose;
-    m_particles[i].weight = newWeight;
+    m_resampledParticles[i].pose   = m_particles[m_resampledIndices[i]].pose;
+    m_resampledParticles[i].weight = newWeight;
   }
+  m_particles.swap(m_resampledParticles);
+  m_cumWeights.clear();
 }
 
 void SquirrelLocalizer::initGlobal() {
@@ -1752,6 +2337,8 @@ void SquirrelLocalizer::initGlobal() {
   double roll, pitch, z;
   initZRP(z, roll, pitch);
 
+  // the largest set covers the map, KLD-sampling shrinks it as it converges
+  m_particles.resize(maxNumParticles());
   m_mapModel->initGlobal(
       m_particles, z, roll, pitch, m_initNoiseStd, m_rngUniform, m_rngNormal);
 
@@ -1763,6 +2350,18 @@ void SquirrelLocalizer::initGlobal() {
   publishPoseEstimate(ros::Time::now(), false);
 }
 
+tf::Stamped<tf::Pose> SquirrelLocalizer::getPoseEstimate() const {
+  return tf::Stamped<tf::Pose>(
+      m_bestParticlePose, m_bestParticleTime, m_globalFrameId);
+}
+
+void SquirrelLocalizer::addTransform(
+    const geometry_msgs::TransformStamped& msg, bool isStatic) {
+  m_tfListener.getTF2BufferPtr()->setTransform(msg, "replay", isStatic);
+  if (m_poseCache)
+    m_poseCache->insert(msg, isStatic);
+}
+
 void SquirrelLocalizer::publishPoseEstimate(
     const ros::Time& time, bool publish_eval) {
 
@@ -1782,6 +2381,30 @@ void SquirrelLocalizer::publishPoseEstimate(
 
   m_poseArrayPub.publish(m_poseArray);
 
+  if (m_bestParticleAsMean)
+    m_bestParticlePose = getMeanParticlePose();
+  else
+    m_bestParticlePose = getBestParticlePose();
+  m_bestParticleTime = time;
+
+  tf::Stamped<tf::Pose> lastOdomPose;
+  m_motionModel->getLastOdomPose(lastOdomPose);
+  publishPose(time, m_bestParticlePose, lastOdomPose, publish_eval);
+
+  writeSnapshot(time);
+}
+
+void SquirrelLocalizer::publishPredictedPose(
+    const ros::Time& time, const tf::Stamped<tf::Pose>& odomPose) {
+  // the estimate of the last update followed by the odometry since then
+  const tf::Pose pose =
+      m_bestParticlePose * m_motionModel->computeOdomTransform(odomPose);
+  publishPose(time, pose, odomPose, false);
+}
+
+void SquirrelLocalizer::publishPose(
+    const ros::Time& time, const tf::Pose& pose,
+    const tf::Stamped<tf::Pose>& odomPose, bool publish_eval) {
   ////
   // send best particle as pose and one array:
   ////
@@ -1789,12 +2412,7 @@ void SquirrelLocalizer::publishPoseEstimate(
   p.header.stamp    = time;
   p.header.frame_id = m_globalFrameId;
 
-  if (m_bestParticleAsMean)
-    m_bestParticlePose = getMeanParticlePose();
-  else
-    m_bestParticlePose = getBestParticlePose();
-
-  tf::poseTFToMsg(m_bestParticlePose, p.pose.pose);
+  tf::poseTFToMsg(pose, p.pose.pose);
   m_posePub.publish(p);
 
   if (publish_eval) {
@@ -1804,16 +2422,15 @@ void SquirrelLocalizer::publishPoseEstimate(
   geometry_msgs::PoseArray bestPose;
   bestPose.header = p.header;
   bestPose.poses.resize(1);
-  tf::poseTFToMsg(m_bestParticlePose, bestPose.poses[0]);
+  tf::poseTFToMsg(pose, bestPose.poses[0]);
   m_bestPosePub.publish(bestPose);
 
   ////
   // send incremental odom pose (synced to localization)
   ////
-  tf::Stamped<tf::Pose> lastOdomPose;
-  if (m_motionModel->getLastOdomPose(lastOdomPose)) {
+  if (!odomPose.frame_id_.empty()) {
     geometry_msgs::PoseStamped odomPoseMsg;
-    tf::poseStampedTFToMsg(lastOdomPose, odomPoseMsg);
+    tf::poseStampedTFToMsg(odomPose, odomPoseMsg);
     m_poseOdomPub.publish(odomPoseMsg);
   }
 
@@ -1821,8 +2438,7 @@ void SquirrelLocalizer::publishPoseEstimate(
   // Send tf target->map (where target is typically odom)
   tf::Stamped<tf::Pose> targetToMapTF;
   try {
-    tf::Stamped<tf::Pose> baseToMapTF(
-        m_bestParticlePose.inverse(), time, m_baseFrameId);
+    tf::Stamped<tf::Pose> baseToMapTF(pose.inverse(), time, m_baseFrameId);
     m_tfListener.transformPose(
         m_targetFrameId, baseToMapTF,
         targetToMapTF);  // typically target == odom
@@ -1858,8 +2474,79 @@ void SquirrelLocalizer::publishPoseEstimate(
   m_tfBroadcaster.sendTransform(tmp_tf_stamped);
 }
 
+void SquirrelLocalizer::publishDiagnostics(const ros::Time& stamp) {
+  const ros::WallTime now = ros::WallTime::now();
+  if (m_diagnosticsPeriod <= 0.0 ||
+      (now - m_lastDiagnosticsTime).toSec() < m_diagnosticsPeriod)
+    return;
+  m_lastDiagnosticsTime = now;
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name        = m_nodeName + ": stage latencies";
+  status.hardware_id = m_nodeName;
+  status.level       = diagnostic_msgs::DiagnosticStatus::OK;
+  status.message     = "OK";
+
+  // slowest callback and slowest stage within it, by 90th percentile
+  double callbackP90 = 0.0, stageP90 = 0.0;
+  std::string slowestStage;
+  const std::vector<StageProfiler::Summary> summaries = m_profiler.summaries();
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const StageProfiler::Summary& s = summaries[i];
+    std::ostringstream value;
+    value << std::fixed << std::setprecision(2) << "p50 " << 1e3 * s.p50
+          << " p90 " << 1e3 * s.p90 << " p99 " << 1e3 * s.p99 << " max "
+          << 1e3 * s.max << " ms (n=" << s.count << ")";
+    diagnostic_msgs::KeyValue keyValue;
+    keyValue.key   = s.name;
+    keyValue.value = value.str();
+    status.values.push_back(keyValue);
+
+    const bool isCallback = s.name.find("_callback") != std::string::npos;
+    if (isCallback && s.p90 > callbackP90)
+      callbackP90 = s.p90;
+    else if (!isCallback && s.p90 > stageP90) {
+      stageP90     = s.p90;
+      slowestStage = s.name;
+    }
+  }
+
+  if (m_updateBudget > 0.0 && callbackP90 > m_updateBudget) {
+    std::ostringstream message;
+    message << "p90 update latency " << 1e3 * callbackP90 << " ms exceeds "
+            << 1e3 * m_updateBudget << " ms, slowest stage " << slowestStage;
+    status.level   = diagnostic_msgs::DiagnosticStatus::WARN;
+    status.message = message.str();
+  }
+
+  if (m_kldSampling->enabled()) {
+    diagnostic_msgs::KeyValue keyValue;
+    keyValue.key = "num_particles";
+    std::ostringstream value;
+    value << m_particles.size();
+    keyValue.value = value.str();
+    status.values.push_back(keyValue);
+  }
+
+  if (m_adaptiveSampling->enabled()) {
+    diagnostic_msgs::KeyValue keyValue;
+    keyValue.key = "sensor_sampling_dist";
+    std::ostringstream value;
+    value << std::fixed << std::setprecision(3)
+          << m_adaptiveSampling->sampleDist() << " m";
+    keyValue.value = value.str();
+    status.values.push_back(keyValue);
+  }
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = stamp;
+  msg.status.push_back(status);
+  m_diagnosticsPub.publish(msg);
+}
+
 unsigned SquirrelLocalizer::getBestParticleIdx() const {
-  if (m_bestParticleIdx < 0 || m_bestParticleIdx >= m_numParticles) {
+  if (m_bestParticleIdx < 0 ||
+      m_bestParticleIdx >= int(m_particles.size())) {
     ROS_WARN(
         "%s: Index (%d) of best particle not valid, using 0 instead",
         m_nodeName.c_str(), m_bestParticleIdx);
@@ -1898,8 +2585,9 @@ tf::Pose SquirrelLocalizer::getMeanParticlePose() const {
   // just in case weights are not normalized:
   meanPose.getOrigin() /= totalWeight;
   // TODO: only rough estimate of mean rotation, asserts normalized weights!
-  meanPose.getBasis() = meanPose.getBasis().scaled(tf::Vector3(
-      1.0 / m_numParticles, 1.0 / m_numParticles, 1.0 / m_numParticles));
+  const double numParticles = m_particles.size();
+  meanPose.getBasis()       = meanPose.getBasis().scaled(tf::Vector3(
+      1.0 / numParticles, 1.0 / numParticles, 1.0 / numParticles));
 
   // Apparently we need to normalize again
   meanPose.setRotation(meanPose.getRotation().normalized());
@@ -1907,23 +2595,42 @@ tf::Pose SquirrelLocalizer::getMeanParticlePose() const {
   return meanPose;
 }
 
-double SquirrelLocalizer::nEff() const {
+double SquirrelLocalizer::nEff() const { return m_nEff; }
 
-  double sqrWeights = 0.0;
-  for (Particles::const_iterator it = m_particles.begin();
-       it != m_particles.end(); ++it) {
-    sqrWeights += (it->weight * it->weight);
-  }
+int SquirrelLocalizer::annealingLevel() const {
+  if (m_annealingLevels <= 0 || m_particles.empty() ||
+      m_nEff >= m_annealingNEffRatio * m_particles.size())
+    return 0;
 
-  if (sqrWeights > 0.0)
-    return 1. / sqrWeights;
-  else
-    return 0.0;
+  // weighted standard deviation of the particle positions in the plane
+  double sumWeights = 0.0, sumX = 0.0, sumY = 0.0, sumSq = 0.0;
+#pragma omp parallel for reduction(+ : sumWeights, sumX, sumY, sumSq)
+  for (int i = 0; i < int(m_particles.size()); ++i) {
+    const double w      = m_particles[i].weight;
+    const tf::Vector3 p = m_particles[i].pose.getOrigin();
+    sumWeights += w;
+    sumX += w * p.x();
+    sumY += w * p.y();
+    sumSq += w * (p.x() * p.x() + p.y() * p.y());
+  }
+  if (sumWeights <= 0.0)
+    return 0;
+  const double meanX  = sumX / sumWeights;
+  const double meanY  = sumY / sumWeights;
+  const double spread = std::sqrt(std::max(
+      0.0, sumSq / sumWeights - meanX * meanX - meanY * meanY));
+  if (spread <= m_annealingSpread)
+    return 0;
+  // one level per doubling of the spread
+  const double doublings =
+      std::log(spread / m_annealingSpread) / std::log(2.0);
+  return std::min(m_annealingLevels, 1 + int(std::floor(doublings)));
 }
 
 void SquirrelLocalizer::toLogForm() {
+  const bool parallel = int(m_particles.size()) >= m_parallelMinParticles;
 // TODO: linear offset needed?
-#pragma omp parallel for
+#pragma omp parallel for if (parallel)
   for (unsigned i = 0; i < m_particles.size(); ++i) {
     assert(m_particles[i].weight > 0.0);
     m_particles[i].weight = log(m_particles[i].weight);
@@ -0,0 +1,111 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <squirrel_3d_localizer/StageProfiler.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace squirrel_3d_localizer {
+
+StageProfiler::StageProfiler(size_t windowSize)
+    : m_windowSize(std::max<size_t>(1, windowSize)),
+      m_epoch(Clock::now()),
+      m_numTraceEvents(0) {}
+
+StageProfiler::~StageProfiler() {
+  boost::mutex::scoped_lock lock(m_mutex);
+  if (m_trace.is_open()) {
+    m_trace << std::endl << "]" << std::endl;
+    m_trace.close();
+  }
+}
+
+bool StageProfiler::openTrace(const std::string& filename) {
+  boost::mutex::scoped_lock lock(m_mutex);
+  m_trace.open(filename.c_str());
+  if (!m_trace.is_open())
+    return false;
+  m_trace << "[";
+  m_numTraceEvents = 0;
+  return true;
+}
+
+void StageProfiler::record(
+    const std::string& stage, const Clock::time_point& start,
+    const Clock::time_point& end) {
+  const double duration = std::chrono::duration<double>(end - start).count();
+
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::map<std::string, Stage>::iterator it = m_stages.find(stage);
+  if (it == m_stages.end()) {
+    it = m_stages.insert(std::make_pair(stage, Stage())).first;
+    it->second.window.reserve(m_windowSize);
+    m_order.push_back(stage);
+  }
+
+  Stage& s = it->second;
+  if (s.window.size() < m_windowSize)
+    s.window.push_back(duration);
+  else
+    s.window[s.next] = duration;
+  s.next = (s.next + 1) % m_windowSize;
+  ++s.count;
+
+  if (m_trace.is_open()) {
+    typedef std::chrono::microseconds Us;
+    m_trace << (m_numTraceEvents++ > 0 ? ",\n" : "\n")
+            << "{\"name\":\"" << stage << "\",\"ph\":\"X\",\"pid\":" << getpid()
+            << ",\"tid\":1,\"ts\":"
+            << std::chrono::duration_cast<Us>(start - m_epoch).count()
+            << ",\"dur\":" << std::chrono::duration_cast<Us>(end - start).count()
+            << "}";
+  }
+}
+
+std::vector<StageProfiler::Summary> StageProfiler::summaries() const {
+  boost::mutex::scoped_lock lock(m_mutex);
+  std::vector<Summary> summaries;
+  summaries.reserve(m_order.size());
+  for (size_t i = 0; i < m_order.size(); ++i) {
+    const Stage& s = m_stages.find(m_order[i])->second;
+    std::vector<double> sorted(s.window);
+    std::sort(sorted.begin(), sorted.end());
+
+    Summary summary;
+    summary.name  = m_order[i];
+    summary.count = s.count;
+    summary.mean  = 0.0;
+    for (size_t k = 0; k < sorted.size(); ++k)
+      summary.mean += sorted[k] / sorted.size();
+    const size_t n = sorted.size();
+    summary.p50    = sorted[std::min(n - 1, size_t(0.50 * n))];
+    summary.p90    = sorted[std::min(n - 1, size_t(0.90 * n))];
+    summary.p99    = sorted[std::min(n - 1, size_t(0.99 * n))];
+    summary.max    = sorted.back();
+    summaries.push_back(summary);
+  }
+  return summaries;
+}
+
+}  // namespace squirrel_3d_localizer
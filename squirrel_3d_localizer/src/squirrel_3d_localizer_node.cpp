@@ -20,11 +20,15 @@
 
 #include <ros/ros.h>
 #include <squirrel_3d_localizer/SquirrelLocalizer.h>
+#include <squirrel_threading/thread_policy.h>
 
 int main(int argc, char** argv) {
   ros::init(argc, argv, "squirrel_3d_localizer");
 
   ros::NodeHandle private_nh("~");
+  // Before the localizer spawns its threads, so that they inherit the policy.
+  squirrel_threading::configureThreads(private_nh);
+
   unsigned seed;
   int iseed;
   private_nh.param("seed", iseed, -1);
@@ -0,0 +1,58 @@
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humonoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ros/ros.h>
+#include <squirrel_3d_localizer/SquirrelLocalizer.h>
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <ctime>
+
+namespace squirrel_3d_localizer {
+
+// Runs the localizer in a nodelet manager: the point clouds of the other
+// nodelets of the manager are received by pointer, without serialization.
+class SquirrelLocalizerNodelet : public nodelet::Nodelet {
+ public:
+  virtual void onInit() {
+    ros::NodeHandle& privateNh = getPrivateNodeHandle();
+    unsigned seed;
+    int iseed;
+    privateNh.param("seed", iseed, -1);
+    if (iseed == -1)
+      seed = static_cast<unsigned int>(std::time(0));
+    else
+      seed = static_cast<unsigned int>(iseed);
+
+    m_localizer.reset(
+        new SquirrelLocalizer(seed, getNodeHandle(), privateNh));
+  }
+
+ private:
+  boost::shared_ptr<SquirrelLocalizer> m_localizer;
+};
+
+}  // namespace squirrel_3d_localizer
+
+PLUGINLIB_EXPORT_CLASS(
+    squirrel_3d_localizer::SquirrelLocalizerNodelet, nodelet::Nodelet);
@@ -0,0 +1,88 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <squirrel_3d_localizer/OccupancyGrid.h>
+#include <squirrel_3d_localizer/RangeTable.h>
+
+#include <octomap/octomap.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace squirrel_3d_localizer;
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <octomap.bt|octomap.ot> <output.rlt> [sensor_height=0.3]"
+                 " [resolution=map] [num_angles=360] [max_range=30.0]"
+              << std::endl;
+    return 1;
+  }
+  const std::string mapFile(argv[1]), tableFile(argv[2]);
+
+  octomap::OcTree* map = NULL;
+  if (mapFile.size() > 3 && mapFile.substr(mapFile.size() - 3) == ".bt") {
+    map = new octomap::OcTree(0.1);
+    if (!map->readBinary(mapFile)) {
+      delete map;
+      map = NULL;
+    }
+  } else {
+    map = dynamic_cast<octomap::OcTree*>(
+        octomap::AbstractOcTree::read(mapFile));
+  }
+  if (!map) {
+    std::cerr << "Could not read an OcTree from " << mapFile << std::endl;
+    return 1;
+  }
+
+  const double sensorHeight = argc > 3 ? std::atof(argv[3]) : 0.3;
+  const double resolution =
+      argc > 4 ? std::atof(argv[4]) : map->getResolution();
+  const int numAngles   = argc > 5 ? std::atoi(argv[5]) : 360;
+  const double maxRange = argc > 6 ? std::atof(argv[6]) : 30.0;
+
+  OccupancyGrid grid;
+  grid.voxelize(*map);
+
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  map->getMetricMin(minX, minY, minZ);
+  map->getMetricMax(maxX, maxY, maxZ);
+  delete map;
+
+  std::cout << "Casting " << numAngles << " rays per cell on a "
+            << (maxX - minX) / resolution << "x" << (maxY - minY) / resolution
+            << " grid at height " << sensorHeight << "..." << std::endl;
+  RangeTable table;
+  table.build(
+      grid, minX, minY, maxX, maxY, sensorHeight, resolution, numAngles,
+      maxRange);
+  if (!table.save(tableFile)) {
+    std::cerr << "Could not write " << tableFile << std::endl;
+    return 1;
+  }
+  std::cout << "Range table written to " << tableFile << std::endl;
+
+  return 0;
+}
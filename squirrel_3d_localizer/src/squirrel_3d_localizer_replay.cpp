@@ -0,0 +1,338 @@
+
+/*
+ * 6D localization for humanoid robots
+ *
+ * Copyright 2009-2012 Armin Hornung, University of Freiburg
+ * http://www.ros.org/wiki/humanoid_localization
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <squirrel_3d_localizer/SquirrelLocalizer.h>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <nav_msgs/Odometry.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <tf2_msgs/TFMessage.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace squirrel_3d_localizer;
+
+namespace {
+
+typedef message_filters::sync_policies::ApproximateTime<
+    sensor_msgs::LaserScan, sensor_msgs::PointCloud2>
+    ApprxTimePolicy;
+
+/// sensor message held back until tf has reached its stamp
+struct PendingMessage {
+  ros::Time stamp;
+  sensor_msgs::LaserScan::ConstPtr scan;
+  sensor_msgs::PointCloud2::ConstPtr cloud;
+};
+
+struct StampedPose {
+  ros::Time stamp;
+  tf::Pose pose;
+};
+
+/// Feeds the messages of a bag to the callbacks, the way the subscriptions,
+/// tf message filters and the synchronizer of the node would.
+class Replay {
+ public:
+  Replay(SquirrelLocalizer& localizer)
+      : m_localizer(localizer),
+        m_synchronizer(ApprxTimePolicy(10)),
+        m_numMessages(0),
+        m_processingTime(0.0) {
+    m_synchronizer.registerCallback(
+        boost::bind(&Replay::synchronizedCallback, this, _1, _2));
+  }
+
+  void addTransforms(const tf2_msgs::TFMessage& msg, bool isStatic) {
+    for (size_t i = 0; i < msg.transforms.size(); ++i) {
+      m_localizer.addTransform(msg.transforms[i], isStatic);
+      if (!isStatic && msg.transforms[i].header.stamp > m_tfTime)
+        m_tfTime = msg.transforms[i].header.stamp;
+    }
+    flush(false);
+  }
+
+  void addScan(const sensor_msgs::LaserScan::ConstPtr& msg) {
+    PendingMessage pending;
+    pending.stamp = msg->header.stamp;
+    pending.scan  = msg;
+    m_pending.push_back(pending);
+    flush(false);
+  }
+
+  void addCloud(const sensor_msgs::PointCloud2::ConstPtr& msg) {
+    PendingMessage pending;
+    pending.stamp = msg->header.stamp;
+    pending.cloud = msg;
+    m_pending.push_back(pending);
+    flush(false);
+  }
+
+  /// processes the pending messages whose transforms are available, or all
+  void flush(bool all) {
+    while (!m_pending.empty() && (all || m_pending.front().stamp <= m_tfTime)) {
+      const PendingMessage pending = m_pending.front();
+      m_pending.pop_front();
+      const ros::WallTime start = ros::WallTime::now();
+      if (pending.scan) {
+        m_localizer.laserCallback(pending.scan);
+        m_synchronizer.add<0>(pending.scan);
+      } else {
+        m_localizer.pointCloudCallback(pending.cloud);
+        m_synchronizer.add<1>(pending.cloud);
+      }
+      m_processingTime += (ros::WallTime::now() - start).toSec();
+      ++m_numMessages;
+      recordEstimate();
+    }
+  }
+
+  const std::vector<StampedPose>& estimates() const { return m_estimates; }
+  size_t numMessages() const { return m_numMessages; }
+  double processingTime() const { return m_processingTime; }
+
+ private:
+  void synchronizedCallback(
+      const sensor_msgs::LaserScan::ConstPtr& scan,
+      const sensor_msgs::PointCloud2::ConstPtr& cloud) {
+    m_localizer.synchronizedCallback(scan, cloud);
+  }
+
+  /// one estimate per published pose (skipped callbacks publish none)
+  void recordEstimate() {
+    const tf::Stamped<tf::Pose> estimate = m_localizer.getPoseEstimate();
+    if (estimate.stamp_.isZero() ||
+        (!m_estimates.empty() && estimate.stamp_ <= m_estimates.back().stamp))
+      return;
+    StampedPose pose;
+    pose.stamp = estimate.stamp_;
+    pose.pose  = estimate;
+    m_estimates.push_back(pose);
+  }
+
+  SquirrelLocalizer& m_localizer;
+  message_filters::Synchronizer<ApprxTimePolicy> m_synchronizer;
+  std::deque<PendingMessage> m_pending;
+  ros::Time m_tfTime;
+  std::vector<StampedPose> m_estimates;
+  size_t m_numMessages;
+  double m_processingTime;
+};
+
+bool toTruthPose(const rosbag::MessageInstance& m, StampedPose& truth) {
+  geometry_msgs::PoseStamped::ConstPtr pose =
+      m.instantiate<geometry_msgs::PoseStamped>();
+  if (pose) {
+    truth.stamp = pose->header.stamp;
+    tf::poseMsgToTF(pose->pose, truth.pose);
+    return true;
+  }
+  geometry_msgs::PoseWithCovarianceStamped::ConstPtr poseCov =
+      m.instantiate<geometry_msgs::PoseWithCovarianceStamped>();
+  if (poseCov) {
+    truth.stamp = poseCov->header.stamp;
+    tf::poseMsgToTF(poseCov->pose.pose, truth.pose);
+    return true;
+  }
+  nav_msgs::Odometry::ConstPtr odom = m.instantiate<nav_msgs::Odometry>();
+  if (odom) {
+    truth.stamp = odom->header.stamp;
+    tf::poseMsgToTF(odom->pose.pose, truth.pose);
+    return true;
+  }
+  return false;
+}
+
+bool stampLess(const StampedPose& a, const StampedPose& b) {
+  return a.stamp < b.stamp;
+}
+
+/// ground truth interpolated at t, false if there is no sample within maxGap
+bool interpolateTruth(
+    const std::vector<StampedPose>& truth, const ros::Time& t, double maxGap,
+    tf::Pose& pose) {
+  StampedPose key;
+  key.stamp = t;
+  std::vector<StampedPose>::const_iterator upper =
+      std::lower_bound(truth.begin(), truth.end(), key, stampLess);
+  if (upper == truth.end())
+    return false;
+  if (upper->stamp == t) {
+    pose = upper->pose;
+    return true;
+  }
+  if (upper == truth.begin())
+    return false;
+  const StampedPose& lower = *(upper - 1);
+  const double span        = (upper->stamp - lower.stamp).toSec();
+  if (span > maxGap)
+    return false;
+  const double ratio = span > 0.0 ? (t - lower.stamp).toSec() / span : 1.0;
+  pose.setOrigin(lower.pose.getOrigin().lerp(upper->pose.getOrigin(), ratio));
+  pose.setRotation(
+      lower.pose.getRotation().slerp(upper->pose.getRotation(), ratio));
+  return true;
+}
+
+void printStages(const StageProfiler& profiler) {
+  const std::vector<StageProfiler::Summary> summaries = profiler.summaries();
+  std::printf(
+      "%-24s %8s %9s %9s %9s %9s %9s\n", "stage [ms]", "count", "mean", "p50",
+      "p90", "p99", "max");
+  for (size_t i = 0; i < summaries.size(); ++i) {
+    const StageProfiler::Summary& s = summaries[i];
+    std::printf(
+        "%-24s %8zu %9.3f %9.3f %9.3f %9.3f %9.3f\n", s.name.c_str(), s.count,
+        1e3 * s.mean, 1e3 * s.p50, 1e3 * s.p90, 1e3 * s.p99, 1e3 * s.max);
+  }
+}
+
+void printTrajectoryError(
+    const std::vector<StampedPose>& estimates,
+    const std::vector<StampedPose>& truth) {
+  size_t n          = 0;
+  double sumSqTrans = 0.0, maxTrans = 0.0, sumYaw = 0.0, maxYaw = 0.0;
+  for (size_t i = 0; i < estimates.size(); ++i) {
+    tf::Pose truePose;
+    if (!interpolateTruth(truth, estimates[i].stamp, 0.5, truePose))
+      continue;
+    const tf::Pose delta = truePose.inverseTimes(estimates[i].pose);
+    const double trans   = delta.getOrigin().length();
+    const double yaw     = std::abs(tf::getYaw(delta.getRotation()));
+    sumSqTrans += trans * trans;
+    maxTrans = std::max(maxTrans, trans);
+    sumYaw += yaw;
+    maxYaw = std::max(maxYaw, yaw);
+    ++n;
+  }
+  if (n == 0) {
+    std::printf("trajectory error: no estimate matches the ground truth\n");
+    return;
+  }
+  std::printf(
+      "trajectory error over %zu poses: translation rmse %.4f m, max %.4f m; "
+      "yaw mean %.4f rad, max %.4f rad\n",
+      n, std::sqrt(sumSqTrans / n), maxTrans, sumYaw / n, maxYaw);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ros::init(argc, argv, "squirrel_3d_localizer_replay");
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " <input.bag> <octomap.bt|octomap.ot> [truth_topic]\n"
+                 "Parameters of the localizer are set as private parameters "
+                 "(_name:=value or rosparam load), topics by remapping."
+              << std::endl;
+    return 1;
+  }
+  const std::string bagFile(argv[1]), mapFile(argv[2]);
+  const std::string truthTopic =
+      argc > 3 ? ros::names::resolve(argv[3]) : std::string("");
+
+  // deterministic and self-contained: map from file, updates in the caller
+  ros::NodeHandle privateNh("~");
+  privateNh.setParam("map_file", mapFile);
+  privateNh.setParam("pipeline_point_clouds", false);
+  privateNh.setParam("use_timer", false);
+  privateNh.setParam("save_last_pose", false);
+  int seed;
+  privateNh.param("seed", seed, 0);
+
+  rosbag::Bag bag;
+  try {
+    bag.open(bagFile, rosbag::bagmode::Read);
+  } catch (const rosbag::BagException& e) {
+    std::cerr << "Could not open " << bagFile << ": " << e.what() << std::endl;
+    return 1;
+  }
+
+  SquirrelLocalizer localizer(static_cast<unsigned>(seed));
+  Replay replay(localizer);
+
+  const std::string scanTopic  = ros::names::resolve("scan");
+  const std::string cloudTopic = ros::names::resolve("point_cloud");
+  const std::string imuTopic   = ros::names::resolve("imu");
+  const std::string initTopic  = ros::names::resolve("initialpose");
+  std::vector<StampedPose> truth;
+
+  const ros::WallTime start = ros::WallTime::now();
+  rosbag::View view(bag);
+  for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it) {
+    const std::string& topic = it->getTopic();
+    if (topic == "/tf" || topic == "/tf_static") {
+      tf2_msgs::TFMessage::ConstPtr msg =
+          it->instantiate<tf2_msgs::TFMessage>();
+      if (msg)
+        replay.addTransforms(*msg, topic == "/tf_static");
+    } else if (topic == scanTopic) {
+      sensor_msgs::LaserScan::ConstPtr msg =
+          it->instantiate<sensor_msgs::LaserScan>();
+      if (msg)
+        replay.addScan(msg);
+    } else if (topic == cloudTopic) {
+      sensor_msgs::PointCloud2::ConstPtr msg =
+          it->instantiate<sensor_msgs::PointCloud2>();
+      if (msg)
+        replay.addCloud(msg);
+    } else if (topic == imuTopic) {
+      sensor_msgs::Imu::ConstPtr msg = it->instantiate<sensor_msgs::Imu>();
+      if (msg)
+        localizer.imuCallback(msg);
+    } else if (topic == initTopic) {
+      geometry_msgs::PoseWithCovarianceStamped::ConstPtr msg =
+          it->instantiate<geometry_msgs::PoseWithCovarianceStamped>();
+      if (msg)
+        localizer.lockedInitPoseCallback(msg);
+    } else if (topic == truthTopic) {
+      StampedPose pose;
+      if (toTruthPose(*it, pose))
+        truth.push_back(pose);
+    }
+  }
+  replay.flush(true);
+  const double wallTime = (ros::WallTime::now() - start).toSec();
+  bag.close();
+
+  std::printf(
+      "%zu sensor messages in %.3f s (%.3f s in the callbacks), %.1f "
+      "messages/s, %zu pose estimates, %.1f estimates/s\n",
+      replay.numMessages(), wallTime, replay.processingTime(),
+      replay.numMessages() / std::max(wallTime, 1e-9),
+      replay.estimates().size(),
+      replay.estimates().size() / std::max(replay.processingTime(), 1e-9));
+  printStages(localizer.profiler());
+  if (!truthTopic.empty()) {
+    std::sort(truth.begin(), truth.end(), stampLess);
+    printTrajectoryError(replay.estimates(), truth);
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_CHANGE_SET_CODING_H_
+#define SQUIRREL_3D_MAPPING_CHANGE_SET_CODING_H_
+
+#include <octomap/OcTreeKey.h>
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// Keys of an OctomapChangeSet are sent as LEB128 varints of the differences
+/// of their linear index (x << 32 | y << 16 | z).
+inline uint64_t linearKey(const octomap::OcTreeKey& key){
+  return (uint64_t(key[0]) << 32) | (uint64_t(key[1]) << 16) | uint64_t(key[2]);
+}
+
+inline octomap::OcTreeKey linearKeyToKey(uint64_t key){
+  return octomap::OcTreeKey(key >> 32, (key >> 16) & 0xFFFF, key & 0xFFFF);
+}
+
+inline void appendVarint(std::vector<uint8_t>& buffer, uint64_t value){
+  while (value >= 0x80){
+    buffer.push_back(uint8_t(value) | 0x80);
+    value >>= 7;
+  }
+  buffer.push_back(uint8_t(value));
+}
+
+/// reads the varint at pos and advances it; false if the buffer is truncated
+inline bool readVarint(const std::vector<uint8_t>& buffer, size_t& pos, uint64_t& value){
+  value = 0;
+  for (unsigned shift = 0; pos < buffer.size() && shift < 64; shift += 7){
+    uint8_t byte = buffer[pos++];
+    value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_CHANGE_SET_CODING_H_ */
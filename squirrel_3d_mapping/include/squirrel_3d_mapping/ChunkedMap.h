@@ -0,0 +1,116 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_CHUNKED_MAP_H_
+#define SQUIRREL_3D_MAPPING_CHUNKED_MAP_H_
+
+#include <octomap/OcTree.h>
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// Chunked map files (.otc). The tree is split into the subtrees (chunks) of
+/// its nodes at a fixed depth, or of the pruned leafs above it. The header
+/// holds the resolution and an index with key, depth, offset and size of each
+/// chunk, followed by the chunks' nodes (log-odds and child mask, preorder).
+/// The file can thus be written one chunk at a time and partially loaded
+/// within a bounding box without parsing the rest of it.
+struct MapChunk {
+  /// any key within the chunk's node
+  octomap::OcTreeKey key;
+  uint8_t depth;
+  uint64_t offset;
+  uint64_t size;
+};
+
+/// chunks of the nodes at depth, or of the leafs above it
+void listMapChunks(const octomap::OcTree& tree, unsigned depth, std::vector<MapChunk>& chunks);
+/// appends the nodes of the chunk to data; false if the tree has no node at the chunk's key and depth
+bool encodeMapChunk(const octomap::OcTree& tree, const MapChunk& chunk, std::vector<uint8_t>& data);
+/// replaces the chunk's subtree in the tree with the encoded nodes; false if data is truncated.
+/// The inner nodes above the chunk need tree.updateInnerOccupancy() afterwards.
+bool decodeMapChunk(const uint8_t* data, size_t size, const MapChunk& chunk, octomap::OcTree& tree);
+/// metric bounds of the chunk's node
+void getMapChunkBounds(const octomap::OcTree& tree, const MapChunk& chunk, octomap::point3d& min, octomap::point3d& max);
+
+/// Writes a chunked map file one chunk at a time, e.g. as they are requested
+/// from a running server. The index is filled in by close().
+class ChunkedMapWriter {
+ public:
+  ChunkedMapWriter();
+  ~ChunkedMapWriter();
+
+  bool open(const std::string& filename, double resolution, unsigned numChunks);
+  /// appends the encoded nodes of the next chunk
+  bool write(const MapChunk& chunk, const std::vector<uint8_t>& data);
+  bool close();
+
+  /// writes the whole tree in chunks of the given depth
+  static bool write(const std::string& filename, const octomap::OcTree& tree, unsigned depth);
+
+ private:
+  std::ofstream m_file;
+  std::vector<MapChunk> m_chunks;
+  unsigned m_numChunks;
+};
+
+/// Read-only access to a memory-mapped chunked map file; the chunks are
+/// decoded straight from the mapping, so only the requested ones are read.
+class ChunkedMapReader {
+ public:
+  ChunkedMapReader();
+  ~ChunkedMapReader();
+
+  bool open(const std::string& filename);
+  void close();
+
+  double getResolution() const { return m_resolution; }
+  const std::vector<MapChunk>& getChunks() const { return m_chunks; }
+
+  /// inserts the chunk into the tree, which must have the file's resolution
+  bool readChunk(unsigned i, octomap::OcTree& tree) const;
+  /// inserts the chunks intersecting the bounding box into the tree; the number of chunks read, -1 on errors
+  int read(octomap::OcTree& tree, const octomap::point3d& bbxMin, const octomap::point3d& bbxMax) const;
+  int read(octomap::OcTree& tree) const;
+
+ private:
+  int m_fd;
+  const uint8_t* m_data;
+  size_t m_size;
+  double m_resolution;
+  std::vector<MapChunk> m_chunks;
+};
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_CHUNKED_MAP_H_ */
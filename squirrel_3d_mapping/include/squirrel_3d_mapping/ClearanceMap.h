@@ -0,0 +1,96 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_CLEARANCE_MAP_H_
+#define SQUIRREL_3D_MAPPING_CLEARANCE_MAP_H_
+
+#include <octomap/OcTree.h>
+
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// 2.5D clearance of the robot's footprint layers. For every layer (z band
+/// between two layers_levels) it holds a raster with the xy distance of each
+/// column to the closest obstacle within the band, kept up to date from the
+/// columns of the updated bounding boxes.
+class ClearanceMap {
+ public:
+  ClearanceMap(octomap::OcTree* octree, const octomap::point3d& bbxMin, const octomap::point3d& bbxMax,
+               const std::vector<double>& layersLevels, double robotHeight, bool unknownAsOccupied);
+
+  /// recounts the columns of the xy range of the keys and updates the changed layers; true if an obstacle changed
+  bool update(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+  bool update();
+  /// the next update covers the whole map, e.g. after changes outside of the update boxes or a new tree
+  void invalidate(octomap::OcTree* octree) { m_octree = octree; m_complete = false; }
+  /// moves the raster in x and y to center it on p, the kept columns are shifted and only the exposed ones recounted; false if it did not move
+  bool recenter(const octomap::point3d& p);
+
+  /// xy distance [m] of (x, y) to the closest obstacle of the layer, infinite without obstacles; false outside of the raster
+  bool distance(double x, double y, unsigned layer, float& dist) const;
+
+  unsigned getNumLayers() const { return m_bands.size(); }
+  const std::vector<double>& getLayersLevels() const { return m_layersLevels; }
+  unsigned getSizeX() const { return m_sizeX; }
+  unsigned getSizeY() const { return m_sizeY; }
+  /// coordinates of the center of the first cell
+  octomap::point3d getOrigin() const { return m_octree->keyToCoord(m_minKey); }
+  /// distance of the cell x + y * getSizeX()
+  float getCellDistance(unsigned layer, unsigned cell) const { return m_distances[layer * m_numCells + cell]; }
+
+ private:
+  bool updateColumns(unsigned minX, unsigned minY, unsigned maxX, unsigned maxY);
+  void countColumns(unsigned minX, unsigned minY, unsigned maxX, unsigned maxY);
+  /// obstacles of the counted columns of a layer, true if one changed
+  bool updateObstacles(unsigned layer, unsigned minX, unsigned minY, unsigned maxX, unsigned maxY);
+  void computeDistances(unsigned layer);
+  template <typename T> void shiftLayers(std::vector<T>& data, int dx, int dy, T fill);
+
+  octomap::OcTree* m_octree;
+  std::vector<double> m_layersLevels;
+  bool m_unknownAsOccupied;
+  bool m_complete;
+
+  octomap::OcTreeKey m_minKey;
+  unsigned m_sizeX;
+  unsigned m_sizeY;
+  unsigned m_numCells;
+  /// z keys of the layers, both inclusive
+  std::vector<std::pair<unsigned, unsigned> > m_bands;
+
+  /// per layer and column, layer major
+  std::vector<unsigned> m_occupiedCells;
+  std::vector<unsigned> m_freeCells;
+  std::vector<char> m_obstacles;
+  std::vector<float> m_distances;
+};
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_CLEARANCE_MAP_H_ */
@@ -0,0 +1,141 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_COMPACT_OCTREE_H_
+#define SQUIRREL_3D_MAPPING_COMPACT_OCTREE_H_
+
+#include <octomap/OcTree.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// Occupancy octree for memory-constrained robots. Each node is an int8
+/// quantized log-odds and the index of its block of 8 children, kept in one
+/// arena (5 bytes per node, no per-node allocation) instead of a float, a
+/// pointer and a separately allocated pointer array per inner node. Inner
+/// nodes hold the maximum of their children, like octomap::OcTree, and
+/// children with one value are pruned on update. Conversions to and from
+/// octomap::OcTree keep the consumers of the latter (messages, EDT) usable.
+class CompactOcTree {
+ public:
+  /// log-odds of unknown children, outside of the quantized range
+  static const int8_t kUnknown = -128;
+
+  explicit CompactOcTree(double resolution);
+
+  void clear();
+
+  /// copies tree, with its sensor model and clamping
+  void fromOcTree(const octomap::OcTree& tree);
+  /// replaces the contents of tree, which must have the same resolution
+  void toOcTree(octomap::OcTree& tree) const;
+
+  /// arena dump of the tree (.cot), read back without any allocation per node
+  bool writeBinary(const std::string& filename) const;
+  bool readBinary(const std::string& filename);
+
+  /// integrates a hit or a miss at the leaf of key, pruning the path afterwards
+  void updateNode(const octomap::OcTreeKey& key, bool occupied);
+  /// log-odds of the deepest node on the path to key, false in unknown space
+  bool search(const octomap::OcTreeKey& key, float& logOdds) const;
+  bool isOccupied(float logOdds) const { return logOdds >= m_occupancyThres; }
+
+  bool coordToKeyChecked(const octomap::point3d& p, octomap::OcTreeKey& key) const;
+  octomap::point3d keyToCoord(const octomap::OcTreeKey& key, unsigned depth = kTreeDepth) const;
+
+  /// calls f(key, depth, logOdds) for each known leaf, in preorder
+  template <typename F>
+  void forEachLeaf(F f) const {
+    if (m_values[0] != kUnknown)
+      forEachLeaf(0, octomap::OcTreeKey(0, 0, 0), 0, f);
+  }
+
+  /// prunes all of the tree and rewrites the arena in preorder, so that the
+  /// freed blocks are returned and the siblings of a traversal are adjacent
+  void compact();
+
+  double getResolution() const { return m_resolution; }
+  /// known nodes
+  size_t size() const;
+  size_t memoryUsage() const;
+
+  static const unsigned kTreeDepth = 16;
+
+ private:
+  int8_t quantize(float logOdds) const;
+  float dequantize(int8_t value) const { return value * m_step; }
+
+  /// block of 8 children from the free list or the end of the arena
+  uint32_t allocateBlock();
+  void freeBlock(uint32_t block);
+  /// sets the node to the maximum of its children, prunes them if they are equal leafs
+  void updateInner(uint32_t node);
+  uint32_t copyNodes(const octomap::OcTree& tree, const octomap::OcTreeNode* node, uint32_t index);
+  void pruneAll(uint32_t node);
+  void repack(uint32_t node, uint32_t index, CompactOcTree& target) const;
+  void createNodes(octomap::OcTree& tree, octomap::OcTreeNode* node, uint32_t index) const;
+
+  template <typename F>
+  void forEachLeaf(uint32_t node, const octomap::OcTreeKey& key, unsigned depth, F& f) const {
+    const uint32_t block = m_children[node];
+    if (block == 0) {
+      f(key, depth, dequantize(m_values[node]));
+      return;
+    }
+    const unsigned half = 1u << (kTreeDepth - depth - 1);
+    for (unsigned i = 0; i < 8; ++i) {
+      const uint32_t child = 8 * block + i;
+      if (m_values[child] == kUnknown)
+        continue;
+      octomap::OcTreeKey childKey(key);
+      if (i & 1) childKey[0] += half;
+      if (i & 2) childKey[1] += half;
+      if (i & 4) childKey[2] += half;
+      forEachLeaf(child, childKey, depth + 1, f);
+    }
+  }
+
+  double m_resolution;
+  float m_step;
+  int8_t m_hit, m_miss, m_clampMin, m_clampMax;
+  float m_probHit, m_probMiss, m_clampingMin, m_clampingMax, m_occupancyThres;
+
+  /// node 8 * b + i is child i of block b, block 0 holds the root only, so
+  /// that a child block index of 0 marks a leaf
+  std::vector<int8_t> m_values;
+  std::vector<uint32_t> m_children;
+  std::vector<uint32_t> m_freeBlocks;
+};
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_COMPACT_OCTREE_H_ */
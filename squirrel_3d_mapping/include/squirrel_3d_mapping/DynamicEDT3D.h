@@ -31,6 +31,7 @@
 #define _DYNAMICEDT3D_H_
 
 #include <limits.h>
+#include <stddef.h>
 #include <queue>
 
 #include "squirrel_3d_mapping/BucketedQueue.h"
@@ -43,13 +44,16 @@ class DynamicEDT3D {
   
  public:
   
-  DynamicEDT3D( int );
+  //! with sparse set, the distance data is only stored for the bricks of
+  //! the grid the distance wave has reached
+  DynamicEDT3D( int, bool sparse=false );
   ~DynamicEDT3D( void );
   
   //! Initialization with an empty map
   void initializeEmpty( int, int, int, bool initGridMap=true );
-  //! Initialization with a given binary map (false==free, true==occupied)
-  void initializeMap( int, int, int, bool*** );
+  //! Initialization with a given binary map (false==free, true==occupied),
+  //! stored contiguously with z varying fastest
+  void initializeMap( int, int, int, const bool* );
   
   //! add an obstacle at the specified cell coordinate
   void occupyCell( int, int, int );
@@ -61,6 +65,17 @@ class DynamicEDT3D {
   //! update distance map to reflect the changes
   virtual void update( bool updateRealDist=true );
   
+  //! moves the map by whole bricks in x and y, the cell (x, y, z) afterwards
+  //! holds the former cell (x+dx, y+dy, z), rounded to brickSize multiples.
+  //! The bricks are reused, the cells that lose their closest obstacle are
+  //! raised by the next update. Call after an update, the exposed cells are
+  //! free. Returns the applied shift in cells
+  INTPOINT3D shiftMap( int dx, int dy );
+  
+  //! compute the first update after an initialization by a parallel
+  //! separable transform instead of the incremental brushfire
+  void setBatchInitialize( bool batch ) {batchInitialize = batch;}
+  
   //! returns the obstacle distance at the specified location
   float getDistance( int, int, int ) const;
   //! gets the closest occupied cell for that location
@@ -78,6 +93,9 @@ class DynamicEDT3D {
   //! returns the z size of the workspace/map
   unsigned int getSizeZ( void ) const {return sizeZ;}
   
+  //! returns the number of bytes used by the distance data and the gridMap
+  size_t getMemoryUsage( void ) const;
+  
   typedef enum {invalidObstData = INT_MAX} ObstDataState;
   
   ///distance value returned when requesting distance for a cell outside the map
@@ -102,16 +120,47 @@ class DynamicEDT3D {
   // methods
   inline void raiseCell( INTPOINT3D&, dataCell&, bool );
   inline void propagateCell( INTPOINT3D&, dataCell&, bool );
-  inline void inspectCellRaise( int&, int&, int&, bool );
-  inline void inspectCellPropagate( int&, int&, int&, dataCell&, bool );
+  inline void inspectCellRaise( int&, int&, int&, size_t, bool );
+  inline void inspectCellPropagate( int&, int&, int&, size_t, dataCell&, bool );
+
+  //! the data is stored in bricks of brickSize^3 cells
+  enum {brickShift=3, brickSize=1<<brickShift, brickMask=brickSize-1,
+        brickCellShift=3*brickShift, brickCells=1<<brickCellShift};
+  
+  //! index of a cell in the bricks, the brick number followed by the
+  //! position inside the brick
+  inline size_t cellIndex( int x, int y, int z ) const {
+    size_t brick = (size_t(x >> brickShift)*bricksY + (y >> brickShift))*bricksZ + (z >> brickShift);
+    return (brick << brickCellShift) | (((x & brickMask) << (2*brickShift)) | ((y & brickMask) << brickShift) | (z & brickMask));
+  }
+  //! index of a cell in the contiguous gridMap array, z varies fastest
+  inline size_t flatIndex( int x, int y, int z ) const {
+    return (size_t(x)*sizeY + y)*sizeZ + z;
+  }
+  //! read access, cells of unallocated bricks are unreached
+  inline const dataCell& cellAt( size_t i ) const {
+    return bricks[i >> brickCellShift][i & (brickCells-1)];
+  }
+  //! write access, allocates the brick of the cell if needed
+  inline dataCell& cellRef( size_t i ) {
+    dataCell*& brick = bricks[i >> brickCellShift];
+    if ( brick == unreachedBrick ) {
+      brick = allocateBrick();
+    }
+    return brick[i & (brickCells-1)];
+  }
   
   void setObstacle( int, int, int );
   void removeObstacle( int, int, int );
   
  private:
   void commitAndColorize( bool updateRealDist=true );
+  void batchUpdate( bool updateRealDist );
+  dataCell* allocateBrick( void );
+  void releaseBricks( void );
+  void shiftGridMap( int dx, int dy );
   
-  inline bool isOccupied( int&, int&, int&, dataCell& );
+  inline bool isOccupied( int&, int&, int&, const dataCell& );
   
   // queues
   BucketPrioQueue<INTPOINT3D> open;
@@ -128,11 +177,24 @@ class DynamicEDT3D {
   int sizeXm1;
   int sizeYm1;
   int sizeZm1;
-  
-  dataCell*** data;
-  bool*** gridMap;
+  // offsets to the x and y neighbors in the gridMap, z neighbors are adjacent
+  size_t strideX;
+  size_t strideY;
+  int bricksX;
+  int bricksY;
+  int bricksZ;
+  
+  // cache line aligned bricks, the unallocated ones of a sparse grid share
+  // the read-only unreachedBrick
+  bool sparse;
+  std::vector<dataCell*> bricks;
+  dataCell* brickPool;
+  dataCell* unreachedBrick;
+  bool* gridMap;
   
   // parameters
+  bool batchInitialize;
+  bool isInitialized;
   int padding;
   double doubleThreshold;
   
@@ -45,8 +45,9 @@ class DynamicEDTOctomap: private DynamicEDT3D {
    *  The constructor copies occupancy data but does not yet compute the distance map. You need to call udpate to do this.
    *
    *  The distance map is maintained in a full three-dimensional array, i.e., there exists a float field in memory for every voxel inside the bounding box given by bbxMin and bbxMax. Consider this when computing distance maps for large octomaps, they will use much more memory than the octomap itself!
+   *  With sparse set, only the 8x8x8 bricks reached by the distance wave (within maxdist of an obstacle) are allocated.
    */
-  DynamicEDTOctomap( float, octomap::OcTree*, octomap::point3d, octomap::point3d, bool );
+  DynamicEDTOctomap( float, octomap::OcTree*, octomap::point3d, octomap::point3d, bool, bool sparse=false );
   
   virtual ~DynamicEDTOctomap( void );
   
@@ -54,6 +55,16 @@ class DynamicEDTOctomap: private DynamicEDT3D {
   ///If you set updateRealDist to false, computations will be faster (square root will be omitted), but you can only retrieve squared distances
   virtual void update( bool updateRealDist=true );
   
+  ///moves the bounding box in x and y to center it on p, in steps of whole bricks of the grid. The kept cells are shifted, only the exposed ones
+  ///are read from the octomap. Returns false if the box did not move. Call after update, the changes are applied by the next update.
+  bool recenter( const octomap::point3d& p );
+  
+  ///compute the first update by a parallel separable transform, see DynamicEDT3D
+  using DynamicEDT3D::setBatchInitialize;
+  
+  ///bytes used by the distance map
+  using DynamicEDT3D::getMemoryUsage;
+  
   ///retrieves distance and closestObstacle (closestObstacle is to be discarded if distance is maximum distance, the method does not write closestObstacle in this case).
   ///Returns DynamicEDTOctomap::distanceValue_Error if point is outside the map.
   void getDistanceAndClosestObstacle( const octomap::point3d& , float&, octomap::point3d& ) const;
@@ -118,6 +129,7 @@ class DynamicEDTOctomap: private DynamicEDT3D {
   void initializeOcTree( octomap::point3d, octomap::point3d );
   void insertMaxDepthLeafAtInitialize( octomap::OcTreeKey );
   void updateMaxDepthLeaf( octomap::OcTreeKey&, bool );
+  void insertOccupiedCells( const octomap::OcTreeKey&, const octomap::OcTreeKey& );
   
   void worldToMap( const octomap::point3d&, int&, int&, int& ) const;
   void mapToWorld( int, int, int, octomap::point3d& ) const;
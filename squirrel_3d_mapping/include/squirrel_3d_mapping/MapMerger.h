@@ -0,0 +1,99 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_MAP_MERGER_H_
+#define SQUIRREL_3D_MAPPING_MAP_MERGER_H_
+
+#include "squirrel_3d_mapping/OctomapChangeSet.h"
+
+#include <octomap/OcTree.h>
+
+#include <tf/transform_datatypes.h>
+
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// Fuses the maps of other robots into a tree without raycasting: the known
+/// leafs of a remote tree (or a TrackingOctomapServer change set) are moved by
+/// the pose of the remote map frame and their log-odds are added to (or
+/// replace) the ones of the tree, clamped to its thresholds. The boxes are
+/// collected and fused by one task per root octant, on disjoint subtrees.
+/// Offsets by whole voxels without rotation keep pruned leafs as one box,
+/// other ones resample the remote leafs voxel by voxel.
+class MapMerger {
+ public:
+  explicit MapMerger(octomap::OcTree& tree, int threads = 8);
+
+  /// offset is the pose of the frame of source in the frame of the tree,
+  /// returns the number of remote leafs fused
+  size_t merge(const octomap::OcTree& source, const tf::Transform& offset, bool replace);
+  /// the changes replace the log-odds of their leafs, occupancy-only changes
+  /// are clamped to the thresholds of the tree
+  size_t merge(const OctomapChangeSet& changes, const tf::Transform& offset);
+
+ private:
+  /// half-open range of keys of the tree at maximum depth
+  struct Box {
+    int min[3];
+    int max[3];
+    float logOdds;
+  };
+  typedef std::vector<Box> Boxes;
+
+  /// boxes for the remote leaf of key (at depth, of a remote tree with
+  /// resolution), one list per root octant of the tree
+  void addLeaf(const octomap::OcTreeKey& key, unsigned depth, float logOdds, double resolution, Boxes* octants) const;
+  void addBox(const Box& box, Boxes* octants) const;
+  size_t collect(const octomap::OcTree& source, const octomap::OcTreeNode* node, const octomap::OcTreeKey& key, unsigned depth, Boxes* octants) const;
+
+  /// fuses the boxes, 8 lists (one per root octant) for each task that
+  /// collected them; false if there were none
+  bool fuse(const std::vector<Boxes>& boxes, bool replace);
+  void fuseBox(octomap::OcTreeNode* node, const octomap::OcTreeKey& key, unsigned depth, const Box& box, bool fresh, bool replace);
+  void fuseSubtree(octomap::OcTreeNode* node, float logOdds, bool fresh, bool replace);
+  octomap::OcTreeNode* createChild(octomap::OcTreeNode* node, unsigned i);
+
+  /// sets up the offset for the next merge, from a remote map of resolution
+  void setOffset(const tf::Transform& offset, double resolution);
+
+  octomap::OcTree& m_tree;
+  int m_threads;
+  const unsigned m_treeDepth;
+  const int m_treeMaxKey;
+  const float m_minLogOdds, m_maxLogOdds;
+
+  tf::Transform m_offset;
+  double m_sourceResolution;
+  bool m_aligned;
+  int m_shift[3];
+};
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_MAP_MERGER_H_ */
@@ -0,0 +1,150 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_3D_MAPPING_MAP_TILING_H_
+#define SQUIRREL_3D_MAPPING_MAP_TILING_H_
+
+#include "squirrel_3d_mapping/ChunkedMap.h"
+#include "squirrel_3d_mapping/MapTiles.h"
+#include "squirrel_3d_mapping/OctomapChunks.h"
+
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <octomap/OcTree.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace squirrel_3d_mapping {
+
+/// Maps for remote clients are sent in tiles: a 2D grid is split into square
+/// tiles of tileSize cells, an octree into the chunks of ChunkedMap.h. Every
+/// tile carries a version, the hash of its content, so that only the tiles
+/// whose content changed are sent, and a client holding the version of a
+/// tile is not sent it again.
+
+/// 64 bit FNV-1a hash of the bytes, never 0 (no version)
+uint64_t tileVersion(const uint8_t* data, size_t size);
+
+/// appends the runs of the cells of the window (x, y, width, height) of a
+/// grid with stride columns, row by row: the length of the run as a varint
+/// and the value of its cells
+void encodeTileCells(const int8_t* grid, unsigned stride, unsigned x, unsigned y, unsigned width, unsigned height, std::vector<uint8_t>& data);
+/// decodes numCells cells; false if data is truncated or holds more cells
+bool decodeTileCells(const std::vector<uint8_t>& data, size_t numCells, std::vector<int8_t>& cells);
+
+/// Tiles of a 2D grid. The grid is kept to apply its incremental updates and
+/// to serve the tiles on request; the tiles whose version changed since the
+/// last clearChanged() are collected.
+class GridTiles {
+ public:
+  explicit GridTiles(unsigned tileSize = 64);
+
+  /// replaces the grid, all of the tiles change if its geometry changed;
+  /// false if its data does not match its size
+  bool setGrid(const nav_msgs::OccupancyGrid& grid);
+  /// patches the grid, only the tiles overlapping the update are hashed
+  /// again; false before the first grid or if the update leaves the grid
+  bool update(const map_msgs::OccupancyGridUpdate& update);
+
+  bool empty() const { return m_versions.empty(); }
+  unsigned getTileSize() const { return m_tileSize; }
+  /// indices y * numTilesX + x of the changed tiles
+  const std::vector<unsigned>& getChangedTiles() const { return m_changed; }
+  void clearChanged();
+
+  /// geometry of the grid and of the tiles, without tiles
+  void getLayout(MapTiles& msg) const;
+  /// appends the tile of index i
+  void addTile(unsigned i, MapTiles& msg) const;
+  /// appends the tiles overlapping the box (all with useBbx false), except
+  /// the known ones whose version is the current one
+  void addTiles(bool useBbx, const octomap::point3d& min, const octomap::point3d& max, const std::vector<MapTile>& known, MapTiles& msg) const;
+
+ private:
+  /// hashes the tile again, and marks it if its version changed
+  void hashTile(unsigned i);
+
+  unsigned m_tileSize;
+  unsigned m_numTilesX, m_numTilesY;
+  nav_msgs::OccupancyGrid m_grid;
+  std::vector<uint64_t> m_versions;
+  std::vector<unsigned> m_changed;
+  std::vector<bool> m_isChanged;
+  /// cells of a tile, row after row, for its hash
+  std::vector<uint8_t> m_tileBuffer;
+};
+
+/// Chunks of an octree by their node key and depth. The encoded chunks are
+/// kept to serve them on request; the chunks added, changed or removed since
+/// the last clearChanged() are collected.
+class OctreeChunks {
+ public:
+  explicit OctreeChunks(unsigned depth = 10);
+
+  /// lists and encodes the chunks of the tree, all of them change if its
+  /// resolution changed
+  void setTree(const octomap::OcTree& tree);
+
+  bool empty() const { return m_chunks.empty(); }
+  unsigned getDepth() const { return m_depth; }
+  /// ids of the changed chunks, of their key and depth
+  const std::set<uint64_t>& getChangedChunks() const { return m_changed; }
+  void clearChanged();
+
+  /// resolution and depth, without chunks
+  void getLayout(OctomapChunks& msg) const;
+  /// appends the chunk of id, without data if it left the map
+  void addChunk(uint64_t id, OctomapChunks& msg) const;
+  /// appends the chunks overlapping the box (all with useBbx false), except
+  /// the known ones whose version is the current one, and the known ones
+  /// that left the map without data
+  void addChunks(bool useBbx, const octomap::point3d& min, const octomap::point3d& max, const std::vector<OctomapChunk>& known, OctomapChunks& msg) const;
+
+ private:
+  struct Entry {
+    MapChunk chunk;
+    uint64_t version;
+    octomap::point3d min, max;
+    std::vector<uint8_t> data;
+  };
+  typedef std::map<uint64_t, Entry> Entries;
+
+  unsigned m_depth;
+  double m_resolution;
+  Entries m_chunks;
+  std::set<uint64_t> m_changed;
+  std::vector<MapChunk> m_chunkList;
+};
+
+} // namespace squirrel_3d_mapping
+
+#endif /* SQUIRREL_3D_MAPPING_MAP_TILING_H_ */
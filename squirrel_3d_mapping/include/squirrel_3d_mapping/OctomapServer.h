@@ -31,13 +31,16 @@
 #define OCTOMAP_SERVER_OCTOMAPSERVER_H
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <std_msgs/ColorRGBA.h>
 
 // #include <moveit_msgs/CollisionObject.h>
 // #include <moveit_msgs/CollisionMap.h>
 #include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
 #include <std_msgs/Bool.h>
 #include <std_srvs/Empty.h>
 #include <dynamic_reconfigure/server.h>
@@ -67,10 +70,28 @@
 #include <octomap/octomap.h>
 #include <octomap/OcTreeKey.h>
 
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
+#include "squirrel_3d_mapping/CheckPathCollision.h"
+#include "squirrel_3d_mapping/ChunkedMap.h"
+#include "squirrel_3d_mapping/CompactOcTree.h"
+#include "squirrel_3d_mapping/GetOctomapChunk.h"
+#include "squirrel_3d_mapping/MapMerger.h"
+#include "squirrel_3d_mapping/MergeOctomap.h"
+#include "squirrel_3d_mapping/OctomapChangeSet.h"
+#include "squirrel_3d_mapping/ClearanceMap.h"
 #include "squirrel_3d_mapping/DynamicEDTOctomap.h"
 #include "squirrel_3d_mapping_msgs/CheckCollision.h"
 #include "squirrel_3d_mapping_msgs/OctomapUpdate.h"
 
+#include <squirrel_point_buffer/kernels.h>
+#include <squirrel_threading/memory_budget_publisher.h>
+#include <squirrel_threading/trace_publisher.h>
+
 namespace squirrel_3d_mapping {
 
 class OctomapServer{
@@ -82,14 +103,30 @@ public:
 
   typedef octomap::OcTree OcTreeT;
 
+  // Access to the tree from concurrent callbacks: queries hold a read lock,
+  // callbacks updating the tree or the publishing caches hold the (exclusive)
+  // update lock and upgrade it to a write lock only while they change the
+  // tree, so queries go on during their filtering and publishing.
+  typedef boost::shared_lock<boost::shared_mutex> TreeReadLock;
+  typedef boost::upgrade_lock<boost::shared_mutex> TreeUpdateLock;
+  typedef boost::upgrade_to_unique_lock<boost::shared_mutex> TreeWriteLock;
+
   OctomapServer(ros::NodeHandle private_nh_ = ros::NodeHandle("~"));
   virtual ~OctomapServer();
   virtual bool octomapBinarySrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
   virtual bool octomapFullSrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
   bool clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp);
   bool resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+  /// streams the map one chunk per call, e.g. for octomap_saver to write .otc files
+  bool octomapChunkSrv(GetOctomapChunk::Request& req, GetOctomapChunk::Response& res);
+  /// fuses the tree of another robot without raycasting, see MapMerger
+  bool mergeOctomapSrv(MergeOctomap::Request& req, MergeOctomap::Response& res);
+  /// applies the change sets of TrackingOctomapServers of other robots in their map frames
+  void mergeChangeSetCallback(const OctomapChangeSet::ConstPtr& changes);
 
   virtual void insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud);
+  /// casts the rays of a cloud of one of the ~sensors/names, see SensorInput
+  void sensorCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud, unsigned sensorIndex);
   virtual bool openFile(const std::string& filename);
 
 protected:
@@ -104,7 +141,7 @@ protected:
   };
 
   /// Test if key is within update area of map (2D, ignores height)
-  inline bool isInUpdateBBX(const octomap::OcTree::iterator& it) const{
+  inline bool isInUpdateBBX(const octomap::OcTree::iterator_base& it) const{
     // 2^(tree_depth-depth) voxels wide:
     unsigned voxelWidth = (1 << (m_maxTreeDepth - it.getDepth()));
     octomap::OcTreeKey key = it.getIndexKey(); // lower corner of voxel
@@ -114,12 +151,111 @@ protected:
          && key[1] <= m_updateBBXMax[1]);
   }
 
+  /// Test if a node (center and size) overlaps the columns re-traversed by publishAll
+  inline bool isInUpdateColumns(double x, double y, double size) const{
+    double half = 0.5*size - 0.25*m_res;
+    return (x+half > m_updateColumnsMin[0] && x-half < m_updateColumnsMax[0]
+         && y+half > m_updateColumnsMin[1] && y-half < m_updateColumnsMax[1]);
+  }
+
+  /// Test if a node (center and size) lies completely within the columns re-traversed by publishAll
+  inline bool isInsideUpdateColumns(double x, double y, double size) const{
+    double half = 0.5*size - 0.25*m_res;
+    return (x-half > m_updateColumnsMin[0] && x+half < m_updateColumnsMax[0]
+         && y-half > m_updateColumnsMin[1] && y+half < m_updateColumnsMax[1]);
+  }
+
   void reconfigureCallback(squirrel_3d_mapping::OctomapServerConfig& config, uint32_t level);
   void publishOctomapUpdates(const ros::Time& rostime);
-  void publishBinaryOctoMap(const ros::Time& rostime = ros::Time::now()) const;
-  void publishFullOctoMap(const ros::Time& rostime = ros::Time::now()) const;
+  void publishBinaryOctoMap(const ros::Time& rostime = ros::Time::now());
+  void publishFullOctoMap(const ros::Time& rostime = ros::Time::now());
+  void publishOccupiedCells(const ros::Time& rostime);
+  void publishFreeCells(const ros::Time& rostime);
+  void publishCellCenters(const ros::Time& rostime);
   void publishAll(const ros::Time& rostime = ros::Time::now());
+
+  /// outputs of publishAll with their own publishing policy
+  enum PublishedOutput { OCCUPIED_CELLS, FREE_CELLS, CELL_CENTERS, BINARY_MAP, FULL_MAP, NUM_OUTPUTS };
+
+  /// max. publishing rate of an output, skipped updates are sent later by the flush timer
+  struct PublishPolicy {
+    PublishPolicy() : maxRate(0.0), pending(false) {}
+    double maxRate; // 0: publish on every update
+    ros::WallTime lastPublished;
+    ros::Time stamp;
+    bool pending;
+  };
+
+  /// true if the output may be published now, otherwise it is marked as pending
+  bool isPublishDue(PublishedOutput output, const ros::Time& rostime, const ros::WallTime& now);
+  void publishOutput(PublishedOutput output, const ros::Time& rostime);
+  void publishPendingCallback(const ros::WallTimerEvent& event);
+  /// decays the occupied leafs around the robot that were not observed within decay/horizon
+  void decayCallback(const ros::WallTimerEvent& event);
+  /// prunes the tree outside of rolling_window/radius and moves the distance transform with the robot
+  void rollingWindowCallback(const ros::WallTimerEvent& event);
+  /// deletes the columns farther than radius from center and their decay stamps, call with the write lock. Returns the nodes deleted
+  size_t pruneOutsideRadius(const octomap::point3d& center, double radius);
+  /// deletes the children of the node (index key, depth) outside of the window of radius around center, true if the node itself is outside
+  bool pruneOutsideWindow(octomap::OcTreeNode* node, const octomap::OcTreeKey& key, unsigned depth, const octomap::point3d& center, double radius);
+  /// reports the memory of the tree and the distance transform and degrades them under the pressure of the memory budget
+  void memoryCallback(const ros::WallTimerEvent& event);
+  void subscriberCallback(const ros::SingleSubscriberPublisher& pub, PublishedOutput output);
+
+  template <class M>
+  static void publishMessage(const ros::Publisher& pub, const boost::shared_ptr<M>& msg){
+    pub.publish(msg);
+  }
+
+  /// publishes msg, from the publisher thread if enabled (only the latest message of an output is kept)
+  template <class M>
+  void queueMessage(PublishedOutput output, const ros::Publisher& pub, const boost::shared_ptr<M>& msg){
+    if (!m_publisherThreadEnabled){
+      pub.publish(msg);
+      return;
+    }
+    boost::lock_guard<boost::mutex> lock(m_publishMutex);
+    m_publishJobs[output] = boost::bind(&OctomapServer::publishMessage<M>, pub, msg);
+    m_publishCondition.notify_one();
+  }
+
+  void publisherThread();
+
+  /// traverses the leafs from it to end, filling the visualization caches and calling the hooks
+  template <class IteratorT>
+  void traverseNodes(IteratorT it, const IteratorT& end, bool markers, bool freeMarkers, bool pointCloud, bool columnsOnly);
+
+  /// copies the tree for the map services if concurrency/snapshot_period elapsed, call with the update lock (not the write lock)
+  void updateTreeSnapshot(bool force);
+
+  /// forces the next publishAll to traverse the complete tree, e.g. after changes outside the update BBX
+  inline void invalidatePublishCaches(){
+    m_occupiedNodesVisValid = false;
+    m_freeNodesVisValid = false;
+    m_pclCloudValid = false;
+    m_gridmapValid = false;
+    m_heightMapColors.clear();
+  }
+
+  /// empties the points of the markers but keeps their buffers for the next traversal
+  static void clearMarkers(visualization_msgs::MarkerArray& markers, unsigned size){
+    markers.markers.resize(size);
+    for (unsigned i = 0; i < size; ++i){
+      markers.markers[i].points.clear();
+      markers.markers[i].colors.clear();
+    }
+  }
+
+  /// sets the columns around the update BBX for incremental publishing, false if the caches cannot be patched
+  bool setUpdateColumns();
+  bool crossesUpdateColumns(const visualization_msgs::MarkerArray& markers, unsigned depth) const;
+  void eraseUpdateColumns(visualization_msgs::MarkerArray& markers);
   bool checkCollision(squirrel_3d_mapping_msgs::CheckCollision::Request&, squirrel_3d_mapping_msgs::CheckCollision::Response&);
+  bool checkPathCollision(CheckPathCollision::Request&, CheckPathCollision::Response&);
+  /// clearance of the robot's footprint layers at (x, y), false if the pose is outside of the distance transform
+  bool footprintClearance(double x, double y, const std::vector<double>& levels, const std::vector<double>& radii, float& clearance) const;
+  /// publishes where the footprint collides according to the clearance map
+  void publishFootprintMap(const ros::Time& rostime);
 
   /**
   * @brief update occupancy map with a scan labeled as ground and nonground.
@@ -131,9 +267,116 @@ protected:
   */
   virtual void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
 
+  /// keys of the rays cast by one thread during insertScan
+  struct ScanKeys {
+    octomap::KeyRay ray;
+    // hash sets, or flat vectors with sort-unique (insertion/sort_keys)
+    octomap::KeySet freeSet, occupiedSet;
+    std::vector<octomap::OcTreeKey> freeKeys, occupiedKeys;
+    // freeKeys is compacted when it exceeds this size
+    size_t compactSize;
+    octomap::OcTreeKey bbxMin, bbxMax;
+    // flags of the cube of insertion/dense_block shared by the threads,
+    // starting at key denseMin; NULL if the keys go to the buffers above
+    uint8_t* dense;
+    int denseMin[3];
+    int denseSize;
+  };
+
+  /// flags key in the dense block of keys, keys outside of it are skipped
+  static void markDense(ScanKeys& keys, const octomap::OcTreeKey& key, uint8_t flag);
+
+  /// end of the ray to p, cut at maxRange (if positive). Returns if the end is
+  /// occupied, i.e. p is not on the ground and within maxRange.
+  bool rayEnd(const octomap::point3d& origin, const pcl::PointXYZ& p, bool ground, double maxRange, octomap::point3d& end) const;
+
+  /// free cells from origin to end, end occupied if requested
+  void insertRay(const octomap::point3d& origin, const octomap::point3d& end, bool occupied, ScanKeys& keys) const;
+
+  /// prunes the tree and updates the distance transform after the cells of
+  /// the update BBX changed, then calls handlePostInsertion. Call with the write lock.
+  void finishInsertion();
+
+  /// hook that is called after the cells of a scan or of merged sensor clouds are updated (does nothing here)
+  virtual void handlePostInsertion() {};
+
+  /// updates the cell in the octree and records it in m_updateMsg
+  inline void updateCell(const octomap::OcTreeKey& key, bool occupied){
+    updateCell(key, occupied, occupied ? m_octree->getProbHitLog() : m_octree->getProbMissLog());
+  }
+
+  /// as above, with the log-odds of the sensor model of the cloud
+  inline void updateCell(const octomap::OcTreeKey& key, bool occupied, float logOdds){
+    m_octree->updateNode(key, logOdds);
+    if (m_decayEnabled && occupied)
+      m_lastObserved[linearKey(key)] = m_scanTime;
+    m_updateMsg.keys.push_back(key[0]);
+    m_updateMsg.keys.push_back(key[1]);
+    m_updateMsg.keys.push_back(key[2]);
+    m_updateMsg.occupied.push_back(occupied);
+  }
+
+  /**
+  * @brief filters the cloud in a single pass over its buffer: transform to
+  * the base frame, crop to pointcloud_{min,max}_*, NaN rejection and voxel
+  * filtering. Replaces the PCL filters of insertCloudCallback (fused_filter).
+  *
+  * @param cloud input cloud in the sensor frame
+  * @param sensorToWorldTf looked up transform of the sensor in the world frame
+  * @param ground ground points in the world frame (with filter_ground)
+  * @param nonground all other points in the world frame
+  * @return false if a transform is not available
+  */
+  bool fusedFilterCloud(const sensor_msgs::PointCloud2& cloud, tf::StampedTransform& sensorToWorldTf, PCLPointCloud& ground, PCLPointCloud& nonground);
+
+  /// filters the cloud with fusedFilterCloud or the PCL filters, false if a transform is not available
+  bool filterCloud(const sensor_msgs::PointCloud2& cloud, tf::StampedTransform& sensorToWorldTf, PCLPointCloud& ground, PCLPointCloud& nonground);
+
+  /// cloud input of ~sensors/names with its own sensor model. Its clouds are
+  /// filtered and ray cast on the threads of m_sensorSpinner, concurrently
+  /// with the other inputs, the keys wait in m_sensorBatches for the writer
+  struct SensorInput {
+    std::string name;
+    double maxRange;
+    float hitLogOdds, missLogOdds;
+    boost::shared_ptr<message_filters::Subscriber<sensor_msgs::PointCloud2> > sub;
+    boost::shared_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > tfSub;
+    // ray casting buffers, one cloud of the input at a time
+    boost::mutex mutex;
+    ScanKeys keys;
+  };
+
+  /// updates of one sensor cloud: sorted keys, the free ones not seen occupied in it
+  struct SensorBatch {
+    std::vector<octomap::OcTreeKey> freeKeys, occupiedKeys;
+    float hitLogOdds, missLogOdds;
+    octomap::OcTreeKey bbxMin, bbxMax;
+    ros::Time stamp;
+  };
+
+  /// single writer of the sensor inputs: applies the batches cast since the last call to the tree
+  void mergeSensorsCallback(const ros::WallTimerEvent& event);
+
   /// label the input cloud "pc" into ground and nonground. Should be in the robot's fixed frame (not world!)
   void filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const;
 
+  /**
+  * @brief single pass over a voxel hash of the cloud (cloud_prefilter): drops the
+  * points of voxels with less than cloud_prefilter/min_neighbors occupied
+  * neighbors and, with filter_ground, labels the points near z=0 and near the
+  * lowest point of their column as ground. Replaces filterGroundPlane.
+  *
+  * @param pc input cloud, in the robot's fixed frame with filter_ground
+  */
+  void prefilterCloud(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground);
+
+  /// index of the voxel of the scaled coordinates, 21 bits per axis offset to be positive
+  inline static uint64_t packVoxel(float x, float y, float z){
+    return (uint64_t(int64_t(std::floor(x)) + (1 << 20)) & 0x1fffff) << 42
+         | (uint64_t(int64_t(std::floor(y)) + (1 << 20)) & 0x1fffff) << 21
+         | (uint64_t(int64_t(std::floor(z)) + (1 << 20)) & 0x1fffff);
+  }
+
   /**
   * @brief Find speckle nodes (single occupied voxels with no neighbors). Only works on lowest resolution!
   * @param key
@@ -145,28 +388,28 @@ protected:
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
 
   /// hook that is called when traversing all nodes of the updated Octree (does nothing here)
-  virtual void handleNode(const OcTreeT::iterator& it) {};
+  virtual void handleNode(const OcTreeT::iterator_base& it) {};
 
   /// hook that is called when traversing all nodes of the updated Octree in the updated area (does nothing here)
-  virtual void handleNodeInBBX(const OcTreeT::iterator& it) {};
+  virtual void handleNodeInBBX(const OcTreeT::iterator_base& it) {};
 
   /// hook that is called when traversing occupied nodes of the updated Octree
-  virtual void handleOccupiedNode(const OcTreeT::iterator& it);
+  virtual void handleOccupiedNode(const OcTreeT::iterator_base& it);
 
   /// hook that is called when traversing occupied nodes in the updated area (updates 2D map projection here)
-  virtual void handleOccupiedNodeInBBX(const OcTreeT::iterator& it);
+  virtual void handleOccupiedNodeInBBX(const OcTreeT::iterator_base& it);
 
   /// hook that is called when traversing free nodes of the updated Octree
-  virtual void handleFreeNode(const OcTreeT::iterator& it);
+  virtual void handleFreeNode(const OcTreeT::iterator_base& it);
 
   /// hook that is called when traversing free nodes in the updated area (updates 2D map projection here)
-  virtual void handleFreeNodeInBBX(const OcTreeT::iterator& it);
+  virtual void handleFreeNodeInBBX(const OcTreeT::iterator_base& it);
 
   /// hook that is called after traversing all nodes
   virtual void handlePostNodeTraversal(const ros::Time& rostime);
 
   /// updates the downprojected 2D map as either occupied or free
-  virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
+  virtual void update2DMap(const OcTreeT::iterator_base& it, bool occupied);
 
   inline unsigned mapIdx(int i, int j) const{
     return m_gridmap.info.width*j + i;
@@ -186,6 +429,10 @@ protected:
 
   void adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::MapMetaData& oldMapInfo) const;
 
+  /// extends the padded keys of the tree to the grown bounds of the 2D map,
+  /// true if these shrunk since the last call (e.g. in a rolling window)
+  bool growGridBounds(octomap::OcTreeKey& minKey, octomap::OcTreeKey& maxKey);
+
   inline bool mapChanged(const nav_msgs::MapMetaData& oldMapInfo, const nav_msgs::MapMetaData& newMapInfo){
     return (    oldMapInfo.height != newMapInfo.height
              || oldMapInfo.width !=newMapInfo.width
@@ -194,25 +441,49 @@ protected:
   }
 
   static std_msgs::ColorRGBA heightMapColor(double h);
+  /// fills the height map colors of the z extent of the tree, one per voxel height
+  void updateHeightMapColors();
+  inline const std_msgs::ColorRGBA& heightMapColorAt(double z) const {
+    int i = int((z - m_heightMapMinZ) / m_res);
+    return m_heightMapColors[std::min(std::max(i, 0), int(m_heightMapColors.size()) - 1)];
+  }
   ros::NodeHandle m_nh;
   ros::Subscriber m_updateSub;
-  ros::Publisher  m_markerPub, m_binaryMapPub, m_fullMapPub, m_pointCloudPub, m_collisionObjectPub, m_mapPub, m_cmapPub, m_fmapPub, m_fmarkerPub, m_octomapUpdatePub;
+  ros::Publisher  m_markerPub, m_binaryMapPub, m_fullMapPub, m_pointCloudPub, m_collisionObjectPub, m_mapPub, m_cmapPub, m_fmapPub, m_fmarkerPub, m_octomapUpdatePub, m_mapUpdatePub;
   message_filters::Subscriber<sensor_msgs::PointCloud2>* m_pointCloudSub;
   tf::MessageFilter<sensor_msgs::PointCloud2>* m_tfPointCloudSub;
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_clearBBXService, m_resetService;
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_clearBBXService, m_resetService, m_octomapChunkService, m_mergeService;
+  std::vector<ros::Subscriber> m_mergeChangeSetSubs;
   tf::TransformListener m_tfListener;
   dynamic_reconfigure::Server<OctomapServerConfig> m_reconfigureServer;
+  // stage timings of the insertion and publishing, see squirrel_threading
+  boost::shared_ptr<squirrel_threading::tracing::TracePublisher> m_tracePublisher;
+
+  // multiple cloud inputs (~sensors/names) on their own callback queue,
+  // merged into the tree every sensors/merge_period by m_sensorMergeTimer
+  std::vector<boost::shared_ptr<SensorInput> > m_sensors;
+  ros::CallbackQueue m_sensorQueue;
+  boost::shared_ptr<ros::AsyncSpinner> m_sensorSpinner;
+  ros::WallTimer m_sensorMergeTimer;
+  // the filters of the inputs share their buffers
+  boost::mutex m_filterMutex;
+  boost::mutex m_sensorBatchMutex;
+  std::vector<boost::shared_ptr<SensorBatch> > m_sensorBatches;
 
   octomap::OcTree* m_octree;
-  octomap::KeyRay m_keyRay;  // temp storage for ray casting
+  // temp storage for ray casting, one per insertion thread
+  std::vector<ScanKeys> m_scanKeys;
   octomap::OcTreeKey m_updateBBXMin;
   octomap::OcTreeKey m_updateBBXMax;
 
   //////////////////////////////////////////////
   // Dynamic 3d Euclidean distance transform
   DynamicEDTOctomap *edt_distanceTransform;
+  ClearanceMap *edt_clearanceMap;
+  ros::Publisher edt_footprintMapPub;
 
   ros::ServiceServer edt_collisionCheckService;
+  ros::ServiceServer edt_pathCollisionCheckService;
 
   double edt_maxDist;
   double edt_maxX, edt_minX;
@@ -221,6 +492,10 @@ protected:
   double edt_robotHeight, edt_robotRadius;
   bool edt_dynamicEdt;
   bool edt_unknownAsOccupied;
+  bool edt_batchInitialize;
+  bool edt_sparse;
+  bool edt_robotHeightBand;
+  bool edt_useClearanceMap;
 
   int edt_layersNum;
   std::vector<double> edt_layersLevels;
@@ -245,21 +520,22 @@ protected:
     }
   };
 
-  inline unsigned int layer( double z ) {
-    if ( z < edt_layersLevels.front() ) {
+  static inline unsigned int layer( double z, const std::vector<double>& levels ) {
+    if ( z < levels.front() ) {
       return 0;
-    } else if ( z >= edt_layersLevels.back() ) {
-      return (unsigned int) edt_layersNum-1;
+    } else if ( z >= levels.back() ) {
+      return (unsigned int) levels.size()-1;
     } else {
-      for (unsigned int i=0; i<edt_layersNum-1; ++i) {
-        if ( z >= edt_layersLevels[i] && z < edt_layersLevels[i+1] ) {
+      for (unsigned int i=0; i<levels.size()-1; ++i) {
+        if ( z >= levels[i] && z < levels[i+1] ) {
           return i;
         }
       }
     }
+    return 0;
   }
 
-  inline float xyDistance( octomap::point3d p1, octomap::point3d p2 )
+  static inline float xyDistance( octomap::point3d p1, octomap::point3d p2 )
   {
     return std::sqrt((p1.x()-p2.x())*(p1.x()-p2.x())+(p1.y()-p2.y())*(p1.y()-p2.y()));
   }
@@ -313,6 +589,18 @@ protected:
 
   bool m_compressMap;
 
+  // ray casting of insertScan
+  int m_insertThreads;
+  bool m_sortUniqueKeys;
+  // one ray per end voxel, packed keys with the occupied flag in bit 48
+  bool m_discretizeEndpoints;
+  std::vector<uint64_t> m_endVoxels;
+  // free/occupied flags of the voxels within maxrange of the sensor
+  bool m_denseBlock;
+  std::vector<uint8_t> m_denseVoxels;
+  // fusion of the maps of other robots
+  int m_mergeThreads;
+
   bool m_updateOctree;
   squirrel_3d_mapping_msgs::OctomapUpdate m_updateMsg;
 
@@ -320,6 +608,109 @@ protected:
   bool m_useVoxelFiltering;
   double m_downsamplingVoxelSize;
 
+  // single pass filtering of the input clouds
+  bool m_fusedFilter;
+  // point in the base frame with its packed voxel index
+  struct VoxelPoint {
+    uint64_t voxel;
+    float x, y, z;
+    bool operator<(const VoxelPoint& other) const { return voxel < other.voxel; }
+  };
+  std::vector<VoxelPoint> m_voxelPoints;
+
+  // buffers of the filtering of the clouds, reused across the frames
+  squirrel_point_buffer::PointBuffer m_points, m_downsampledPoints;
+  squirrel_point_buffer::VoxelGrid m_voxelGrid;
+
+  // voxel hash pre-pass of the clouds:
+  bool m_cloudPrefilter;
+  double m_prefilterVoxelSize;
+  int m_prefilterMinNeighbors;
+  struct PrefilterVoxel {
+    unsigned points;
+    int keep; // -1 until the neighbors are counted
+  };
+  boost::unordered_map<uint64_t, PrefilterVoxel> m_prefilterVoxels;
+  boost::unordered_map<uint64_t, float> m_prefilterColumns;
+  std::vector<uint64_t> m_prefilterPointVoxels;
+
+  // incremental publishing:
+  bool m_incrementalPublish;
+  bool m_publishIncremental;
+  double m_updateColumnsMin[2];
+  double m_updateColumnsMax[2];
+  octomap::OcTreeKey m_updateColumnsMinKey;
+  octomap::OcTreeKey m_updateColumnsMaxKey;
+  visualization_msgs::MarkerArray m_occupiedNodesVis;
+  visualization_msgs::MarkerArray m_freeNodesVis;
+  pcl::PointCloud<pcl::PointXYZ> m_pclCloud;
+  std::vector<unsigned char> m_pclCloudDepths;
+  bool m_occupiedNodesVisValid;
+  bool m_freeNodesVisValid;
+  bool m_pclCloudValid;
+  double m_heightMapMinZ;
+  double m_heightMapMaxZ;
+  std::vector<std_msgs::ColorRGBA> m_heightMapColors;
+
+  // publishing policies:
+  PublishPolicy m_publishPolicies[NUM_OUTPUTS];
+  bool m_lazyPublish;
+  bool m_updateMsgPending;
+  ros::WallTimer m_publishTimer;
+
+  // time decay of unobserved obstacles: last time [s] each occupied leaf was
+  // hit by a scan, the entries are dropped once a leaf decays to free
+  bool m_decayEnabled;
+  double m_decayHorizon;
+  double m_decayRate;
+  double m_decayWindowRadius;
+  double m_scanTime;
+  boost::unordered_map<uint64_t, double> m_lastObserved;
+  ros::WallTimer m_decayTimer;
+
+  // rolling window: the tree only keeps the columns within the radius
+  // around the robot, the distance transform is centered on it
+  bool m_rollingWindow;
+  double m_rollingWindowRadius;
+  ros::WallTimer m_rollingWindowTimer;
+
+  // memory budget of the process (see squirrel_threading): under soft
+  // pressure the heavy outputs are throttled, under hard pressure the tree
+  // is pruned outside a radius around the robot and the box of the distance
+  // transform shrinks, more at every check the pressure persists
+  boost::shared_ptr<squirrel_threading::MemoryBudgetPublisher> m_memoryPublisher;
+  boost::shared_ptr<squirrel_threading::MemoryBudget::Account> m_treeMemory;
+  boost::shared_ptr<squirrel_threading::MemoryBudget::Account> m_edtMemory;
+  ros::WallTimer m_memoryTimer;
+  double m_memoryThrottledRate;
+  double m_memoryPruneRadius, m_memoryMinPruneRadius, m_memoryCurrentRadius;
+  double m_memoryShrinkFactor;
+  double m_memoryMinEdtSize;
+  bool m_memoryThrottled;
+  double m_configuredPublishRates[NUM_OUTPUTS];
+  bool m_publisherThreadEnabled;
+
+  // chunked map files: default chunk depth, snapshot of the streamed chunks
+  // and the bounding box loaded from .otc files
+  int m_mapChunkDepth;
+  std::vector<MapChunk> m_mapChunks;
+  octomap::point3d m_mapLoadMin;
+  octomap::point3d m_mapLoadMax;
+  bool m_publisherShutdown;
+  boost::thread m_publisherThread;
+  boost::mutex m_publishMutex;
+
+  // concurrency:
+  boost::shared_mutex m_treeMutex;
+  // immutable copy of the tree served by the map services without locking
+  // it, swapped under m_snapshotMutex; readers keep the old one alive
+  boost::mutex m_snapshotMutex;
+  boost::shared_ptr<const octomap::OcTree> m_treeSnapshot;
+  double m_snapshotPeriod;
+  ros::WallTime m_lastSnapshot;
+  boost::condition_variable m_publishCondition;
+  boost::function<void()> m_publishJobs[NUM_OUTPUTS];
+
   // downprojected 2D map:
   bool m_incrementalUpdate;
   nav_msgs::OccupancyGrid m_gridmap;
@@ -328,6 +719,14 @@ protected:
   octomap::OcTreeKey m_paddedMinKey;
   unsigned m_multires2DScale;
   bool m_projectCompleteMap;
+  bool m_gridmapValid;
+  uint32_t m_mapSubscribers;
+  unsigned m_mapUpdateMinX, m_mapUpdateMinY, m_mapUpdateMaxX, m_mapUpdateMaxY;
+  // xy bounds of the 2D map, grown by projected_map/growth times their size
+  // so that exploring reallocates the map a logarithmic number of times
+  double m_gridGrowth;
+  bool m_gridBoundsValid;
+  octomap::OcTreeKey m_gridMinKey, m_gridMaxKey;
 };
 
 } // namespace squirrel_3d_mapping
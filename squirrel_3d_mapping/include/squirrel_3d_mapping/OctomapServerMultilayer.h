@@ -48,22 +48,51 @@ protected:
   };
   typedef std::vector<ProjectedMap> MultilevelGrid;
 
+  /// precomputes for every z key the bitmask of the layers its cell touches, true if a mask changed
+  bool updateLayerMasks();
+  /// bitmask of the layers a node touches
+  inline uint32_t layerMask(const OcTreeT::iterator_base& it) const {
+    int minZ = std::max(int(it.getIndexKey()[2]), m_layerMasksMinKey);
+    int maxZ = std::min(int(it.getIndexKey()[2]) + (1 << (m_treeDepth - it.getDepth())) - 1, m_layerMasksMinKey + int(m_layerMasks.size()) - 1);
+    uint32_t mask = 0;
+    for (int z = minZ; z <= maxZ; ++z)
+      mask |= m_layerMasks[z - m_layerMasksMinKey];
+    return mask;
+  }
+  inline void updateLayerCell(unsigned idx, bool occupied, uint32_t mask){
+    for (unsigned i = 0; mask; ++i, mask >>= 1){
+      if (mask & 1){
+        if (occupied)
+          m_multiGridmap[i].map.data[idx] = 100;
+        else if (m_multiGridmap[i].map.data[idx] == -1)
+          m_multiGridmap[i].map.data[idx] = 0;
+      }
+    }
+  }
+
   /// hook that is called after traversing all nodes
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
 
   /// updates the downprojected 2D map as either occupied or free
-  virtual void update2DMap(const OcTreeT::iterator& it, bool occupied);
+  virtual void update2DMap(const OcTreeT::iterator_base& it, bool occupied);
 
   /// hook that is called after traversing all nodes
   virtual void handlePostNodeTraversal(const ros::Time& rostime);
 
   std::vector<ros::Publisher*> m_multiMapPub;
+  std::vector<ros::Publisher*> m_multiMapUpdatePub;
+  std::vector<uint32_t> m_multiMapSubscribers;
   ros::Subscriber m_attachedObjectsSub;
 
   std::vector<std::string> m_armLinks;
   std::vector<double> m_armLinkOffsets;
 
   MultilevelGrid m_multiGridmap;
+  /// index of the layer that follows the arm links, -1 if none
+  int m_armLayer;
+
+  std::vector<uint32_t> m_layerMasks;
+  int m_layerMasksMinKey;
 
 };
 
@@ -30,6 +30,7 @@
 #ifndef OCTOMAP_SERVER_TRACKINGOCTOMAPSERVER_H_
 #define OCTOMAP_SERVER_TRACKINGOCTOMAPSERVER_H_
 
+#include "squirrel_3d_mapping/OctomapChangeSet.h"
 #include "squirrel_3d_mapping/OctomapServer.h"
 
 namespace squirrel_3d_mapping {
@@ -40,13 +41,20 @@ public:
   virtual ~TrackingOctomapServer();
 
   void trackCallback(sensor_msgs::PointCloud2Ptr cloud);
-  void insertScan(const tf::Point& sensorOrigin, const PCLPointCloud& ground, const PCLPointCloud& nonground);
+  void trackChangeSetCallback(const OctomapChangeSet::ConstPtr& changes);
 
 protected:
+  /// publishes the changes of the scan or of the merged sensor clouds
+  void handlePostInsertion();
   void trackChanges();
+  /// sends the changes as a compact OctomapChangeSet instead of a point cloud
+  void trackChangeSet();
+  void commitTrackedChanges();
 
   bool listen_changes;
   bool track_changes;
+  bool compact_changes;
+  bool compact_changes_log_odds;
   ros::Publisher pubFreeChangeSet;
   ros::Publisher pubChangeSet;
   ros::Subscriber subChangeSet;
@@ -0,0 +1,314 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_3d_mapping/ChunkedMap.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace octomap;
+
+namespace squirrel_3d_mapping {
+
+namespace {
+
+// header: magic, resolution, number of chunks, reserved; index entries: key,
+// depth, reserved, offset, size. All in host byte order.
+const char kMagic[8] = {'O', 'T', 'C', 'H', 'U', 'N', 'K', '1'};
+const size_t kHeaderSize = 24;
+const size_t kEntrySize = 24;
+
+template <typename T>
+void put(uint8_t* p, const T& value) { memcpy(p, &value, sizeof(T)); }
+
+template <typename T>
+T get(const uint8_t* p) { T value; memcpy(&value, p, sizeof(T)); return value; }
+
+inline unsigned childIndex(const OcTreeKey& key, unsigned bit) {
+  return ((key[0] >> bit) & 1) | (((key[1] >> bit) & 1) << 1) | (((key[2] >> bit) & 1) << 2);
+}
+
+// the node at exactly the chunk's depth, NULL if the path is pruned or missing
+const OcTreeNode* findNode(const OcTree& tree, const MapChunk& chunk) {
+  const OcTreeNode* node = tree.getRoot();
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (unsigned d = 0; node && d < chunk.depth; ++d) {
+    const unsigned i = childIndex(chunk.key, treeDepth - 1 - d);
+    node = tree.nodeChildExists(node, i) ? tree.getNodeChild(node, i) : NULL;
+  }
+  return node;
+}
+
+void encodeNodes(const OcTree& tree, const OcTreeNode* node, std::vector<uint8_t>& data) {
+  const size_t n = data.size();
+  data.resize(n + sizeof(float) + 1);
+  put(&data[n], node->getLogOdds());
+  uint8_t mask = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    if (tree.nodeChildExists(node, i))
+      mask |= 1 << i;
+  data[n + sizeof(float)] = mask;
+  for (unsigned i = 0; i < 8; ++i)
+    if (mask & (1 << i))
+      encodeNodes(tree, tree.getNodeChild(node, i), data);
+}
+
+bool decodeNodes(OcTree& tree, OcTreeNode* node, const uint8_t*& p, const uint8_t* end) {
+  if (end - p < (ptrdiff_t)(sizeof(float) + 1))
+    return false;
+  node->setLogOdds(get<float>(p));
+  const uint8_t mask = p[sizeof(float)];
+  p += sizeof(float) + 1;
+  for (unsigned i = 0; i < 8; ++i)
+    if (mask & (1 << i))
+      if (!decodeNodes(tree, tree.createNodeChild(node, i), p, end))
+        return false;
+  return true;
+}
+
+void deleteChildren(OcTree& tree, OcTreeNode* node) {
+  for (unsigned i = 0; i < 8; ++i)
+    if (tree.nodeChildExists(node, i))
+      tree.deleteNodeChild(node, i);
+}
+
+} // namespace
+
+void listMapChunks(const OcTree& tree, unsigned depth, std::vector<MapChunk>& chunks) {
+  chunks.clear();
+  // a maximum depth of 0 means the whole tree to the iterator
+  depth = std::max(1u, std::min(depth, tree.getTreeDepth()));
+  for (OcTree::tree_iterator it = tree.begin_tree(depth), end = tree.end_tree(); it != end; ++it) {
+    if (it.getDepth() != depth && !it.isLeaf())
+      continue;
+    MapChunk chunk;
+    chunk.key = it.getIndexKey();
+    chunk.depth = it.getDepth();
+    chunk.offset = 0;
+    chunk.size = 0;
+    chunks.push_back(chunk);
+  }
+}
+
+bool encodeMapChunk(const OcTree& tree, const MapChunk& chunk, std::vector<uint8_t>& data) {
+  const OcTreeNode* node = findNode(tree, chunk);
+  if (!node)
+    return false;
+  encodeNodes(tree, node, data);
+  return true;
+}
+
+bool decodeMapChunk(const uint8_t* data, size_t size, const MapChunk& chunk, OcTree& tree) {
+  if (!tree.getRoot()) {
+    // the root can only be created through an update, drop the path it adds
+    tree.updateNode(chunk.key, 0.0f, true);
+    deleteChildren(tree, tree.getRoot());
+  }
+  OcTreeNode* node = tree.getRoot();
+  const unsigned treeDepth = tree.getTreeDepth();
+  for (unsigned d = 0; d < chunk.depth; ++d) {
+    const unsigned i = childIndex(chunk.key, treeDepth - 1 - d);
+    node = tree.nodeChildExists(node, i) ? tree.getNodeChild(node, i) : tree.createNodeChild(node, i);
+  }
+  deleteChildren(tree, node);
+  const uint8_t* p = data;
+  return decodeNodes(tree, node, p, data + size) && p == data + size;
+}
+
+void getMapChunkBounds(const OcTree& tree, const MapChunk& chunk, point3d& min, point3d& max) {
+  const unsigned cells = 1u << (tree.getTreeDepth() - chunk.depth);
+  const double res = tree.getResolution();
+  for (unsigned i = 0; i < 3; ++i) {
+    min(i) = tree.keyToCoord(chunk.key[i] & ~(cells - 1)) - 0.5 * res;
+    max(i) = min(i) + cells * res;
+  }
+}
+
+ChunkedMapWriter::ChunkedMapWriter() : m_numChunks(0) {}
+
+ChunkedMapWriter::~ChunkedMapWriter() {
+  if (m_file.is_open())
+    close();
+}
+
+bool ChunkedMapWriter::open(const std::string& filename, double resolution, unsigned numChunks) {
+  m_file.open(filename.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if (!m_file.is_open())
+    return false;
+  m_chunks.clear();
+  m_numChunks = numChunks;
+  std::vector<uint8_t> header(kHeaderSize + numChunks * kEntrySize, 0);
+  memcpy(&header[0], kMagic, sizeof(kMagic));
+  put(&header[8], resolution);
+  put(&header[16], (uint32_t)numChunks);
+  m_file.write((const char*)&header[0], header.size());
+  return m_file.good();
+}
+
+bool ChunkedMapWriter::write(const MapChunk& chunk, const std::vector<uint8_t>& data) {
+  if (!m_file.is_open() || m_chunks.size() >= m_numChunks || data.empty())
+    return false;
+  MapChunk entry = chunk;
+  entry.offset = m_file.tellp();
+  entry.size = data.size();
+  m_file.write((const char*)&data[0], data.size());
+  m_chunks.push_back(entry);
+  return m_file.good();
+}
+
+bool ChunkedMapWriter::close() {
+  if (!m_file.is_open())
+    return false;
+  // chunks skipped by the caller leave unused entries at the end of the index
+  std::vector<uint8_t> index(sizeof(uint32_t) + m_chunks.size() * kEntrySize, 0);
+  put(&index[0], (uint32_t)m_chunks.size());
+  for (size_t i = 0; i < m_chunks.size(); ++i) {
+    uint8_t* p = &index[sizeof(uint32_t) + i * kEntrySize];
+    for (unsigned j = 0; j < 3; ++j)
+      put(p + 2 * j, (uint16_t)m_chunks[i].key[j]);
+    p[6] = m_chunks[i].depth;
+    put(p + 8, m_chunks[i].offset);
+    put(p + 16, m_chunks[i].size);
+  }
+  m_file.seekp(16);
+  m_file.write((const char*)&index[0], sizeof(uint32_t));
+  m_file.seekp(kHeaderSize);
+  if (!m_chunks.empty())
+    m_file.write((const char*)&index[sizeof(uint32_t)], m_chunks.size() * kEntrySize);
+  const bool ok = m_file.good();
+  m_file.close();
+  return ok;
+}
+
+bool ChunkedMapWriter::write(const std::string& filename, const OcTree& tree, unsigned depth) {
+  std::vector<MapChunk> chunks;
+  listMapChunks(tree, depth, chunks);
+  ChunkedMapWriter writer;
+  if (!writer.open(filename, tree.getResolution(), chunks.size()))
+    return false;
+  std::vector<uint8_t> data;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    data.clear();
+    if (!encodeMapChunk(tree, chunks[i], data) || !writer.write(chunks[i], data))
+      return false;
+  }
+  return writer.close();
+}
+
+ChunkedMapReader::ChunkedMapReader() : m_fd(-1), m_data(NULL), m_size(0), m_resolution(0.0) {}
+
+ChunkedMapReader::~ChunkedMapReader() { close(); }
+
+bool ChunkedMapReader::open(const std::string& filename) {
+  close();
+  m_fd = ::open(filename.c_str(), O_RDONLY);
+  if (m_fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(m_fd, &st) != 0 || (size_t)st.st_size < kHeaderSize) {
+    close();
+    return false;
+  }
+  m_size = st.st_size;
+  void* data = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+  if (data == MAP_FAILED) {
+    close();
+    return false;
+  }
+  m_data = (const uint8_t*)data;
+
+  const uint32_t numChunks = get<uint32_t>(m_data + 16);
+  if (memcmp(m_data, kMagic, sizeof(kMagic)) != 0 || m_size < kHeaderSize + (uint64_t)numChunks * kEntrySize) {
+    close();
+    return false;
+  }
+  m_resolution = get<double>(m_data + 8);
+  m_chunks.resize(numChunks);
+  for (uint32_t i = 0; i < numChunks; ++i) {
+    const uint8_t* p = m_data + kHeaderSize + i * kEntrySize;
+    MapChunk& chunk = m_chunks[i];
+    for (unsigned j = 0; j < 3; ++j)
+      chunk.key[j] = get<uint16_t>(p + 2 * j);
+    chunk.depth = p[6];
+    chunk.offset = get<uint64_t>(p + 8);
+    chunk.size = get<uint64_t>(p + 16);
+    if (chunk.offset > m_size || chunk.size > m_size - chunk.offset) {
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void ChunkedMapReader::close() {
+  if (m_data)
+    munmap((void*)m_data, m_size);
+  if (m_fd >= 0)
+    ::close(m_fd);
+  m_fd = -1;
+  m_data = NULL;
+  m_size = 0;
+  m_chunks.clear();
+}
+
+bool ChunkedMapReader::readChunk(unsigned i, OcTree& tree) const {
+  if (i >= m_chunks.size() || m_chunks[i].depth > tree.getTreeDepth())
+    return false;
+  return decodeMapChunk(m_data + m_chunks[i].offset, m_chunks[i].size, m_chunks[i], tree);
+}
+
+int ChunkedMapReader::read(OcTree& tree, const point3d& bbxMin, const point3d& bbxMax) const {
+  if (!m_data || tree.getResolution() != m_resolution)
+    return -1;
+  int numRead = 0;
+  for (unsigned i = 0; i < m_chunks.size(); ++i) {
+    point3d min, max;
+    getMapChunkBounds(tree, m_chunks[i], min, max);
+    if (min.x() > bbxMax.x() || min.y() > bbxMax.y() || min.z() > bbxMax.z() ||
+        max.x() < bbxMin.x() || max.y() < bbxMin.y() || max.z() < bbxMin.z())
+      continue;
+    if (!readChunk(i, tree))
+      return -1;
+    ++numRead;
+  }
+  tree.updateInnerOccupancy();
+  return numRead;
+}
+
+int ChunkedMapReader::read(OcTree& tree) const {
+  const float inf = std::numeric_limits<float>::infinity();
+  return read(tree, point3d(-inf, -inf, -inf), point3d(inf, inf, inf));
+}
+
+} // namespace squirrel_3d_mapping
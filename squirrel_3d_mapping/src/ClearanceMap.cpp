@@ -0,0 +1,307 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_3d_mapping/ClearanceMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+using namespace octomap;
+
+namespace squirrel_3d_mapping {
+
+namespace {
+
+const double kInfinity = 1e20;
+
+// first key whose cell center is not below z
+key_type firstKeyAbove(const OcTree* octree, double z){
+  key_type key = octree->coordToKey(z);
+  if (octree->keyToCoord(key) < z)
+    ++key;
+  return key;
+}
+
+// squared distances along a line, lower envelope of parabolas (Felzenszwalb and Huttenlocher)
+void distanceTransformLine(double* line, unsigned stride, unsigned n, std::vector<double>& f, std::vector<int>& v, std::vector<double>& z){
+  for (unsigned q = 0; q < n; ++q)
+    f[q] = line[q * stride];
+
+  int k = 0;
+  v[0] = 0;
+  z[0] = -kInfinity;
+  z[1] = kInfinity;
+  for (unsigned q = 1; q < n; ++q){
+    double s = ((f[q] + double(q) * q) - (f[v[k]] + double(v[k]) * v[k])) / (2.0 * (q - v[k]));
+    while (s <= z[k]){
+      --k;
+      s = ((f[q] + double(q) * q) - (f[v[k]] + double(v[k]) * v[k])) / (2.0 * (q - v[k]));
+    }
+    ++k;
+    v[k] = q;
+    z[k] = s;
+    z[k + 1] = kInfinity;
+  }
+
+  k = 0;
+  for (unsigned q = 0; q < n; ++q){
+    while (z[k + 1] < q)
+      ++k;
+    double d = double(q) - v[k];
+    line[q * stride] = d * d + f[v[k]];
+  }
+}
+
+} // namespace
+
+ClearanceMap::ClearanceMap(OcTree* octree, const point3d& bbxMin, const point3d& bbxMax,
+                           const std::vector<double>& layersLevels, double robotHeight, bool unknownAsOccupied)
+: m_octree(octree),
+  m_layersLevels(layersLevels),
+  m_unknownAsOccupied(unknownAsOccupied),
+  m_complete(false)
+{
+  m_minKey = m_octree->coordToKey(bbxMin);
+  OcTreeKey maxKey = m_octree->coordToKey(bbxMax);
+  m_sizeX = maxKey[0] - m_minKey[0] + 1;
+  m_sizeY = maxKey[1] - m_minKey[1] + 1;
+  m_numCells = m_sizeX * m_sizeY;
+
+  // as for the layers of checkCollision, the first one starts at the
+  // bottom of the map and the last one ends at the robot's height
+  const unsigned numLayers = m_layersLevels.size();
+  for (unsigned l = 0; l < numLayers; ++l){
+    int min = (l == 0) ? m_minKey[2] : firstKeyAbove(m_octree, m_layersLevels[l]);
+    int max = (l + 1 == numLayers) ? m_octree->coordToKey(robotHeight) : firstKeyAbove(m_octree, m_layersLevels[l + 1]) - 1;
+    min = std::max(min, (int) m_minKey[2]);
+    max = std::min(max, (int) maxKey[2]);
+    m_bands.push_back(std::make_pair((unsigned) min, (unsigned) std::max(min - 1, max)));
+  }
+
+  m_occupiedCells.assign(numLayers * m_numCells, 0);
+  m_freeCells.assign(numLayers * m_numCells, 0);
+  m_obstacles.assign(numLayers * m_numCells, 0);
+  m_distances.assign(numLayers * m_numCells, std::numeric_limits<float>::infinity());
+}
+
+bool ClearanceMap::update(){
+  m_complete = true;
+  return updateColumns(0, 0, m_sizeX - 1, m_sizeY - 1);
+}
+
+bool ClearanceMap::update(const OcTreeKey& min, const OcTreeKey& max){
+  if (!m_complete)
+    return update();
+
+  int minX = std::max(0, (int) min[0] - (int) m_minKey[0]);
+  int minY = std::max(0, (int) min[1] - (int) m_minKey[1]);
+  int maxX = std::min((int) m_sizeX - 1, (int) max[0] - (int) m_minKey[0]);
+  int maxY = std::min((int) m_sizeY - 1, (int) max[1] - (int) m_minKey[1]);
+  if (minX > maxX || minY > maxY)
+    return false;
+  return updateColumns(minX, minY, maxX, maxY);
+}
+
+bool ClearanceMap::recenter(const point3d& p){
+  OcTreeKey key;
+  if (!m_octree->coordToKeyChecked(p, key))
+    return false;
+
+  const int maxKey = std::numeric_limits<key_type>::max();
+  int dx = (int) key[0] - (int) m_sizeX / 2 - (int) m_minKey[0];
+  int dy = (int) key[1] - (int) m_sizeY / 2 - (int) m_minKey[1];
+  dx = std::max(-(int) m_minKey[0], std::min(dx, maxKey + 1 - (int) m_minKey[0] - (int) m_sizeX));
+  dy = std::max(-(int) m_minKey[1], std::min(dy, maxKey + 1 - (int) m_minKey[1] - (int) m_sizeY));
+  if (dx == 0 && dy == 0)
+    return false;
+  m_minKey[0] += dx;
+  m_minKey[1] += dy;
+  // a complete update recounts all columns anyway
+  if (!m_complete)
+    return true;
+
+  shiftLayers(m_occupiedCells, dx, dy, 0u);
+  shiftLayers(m_freeCells, dx, dy, 0u);
+  shiftLayers(m_obstacles, dx, dy, char(0));
+
+  if (m_bands.empty() || m_numCells == 0)
+    return true;
+
+  // the exposed strips along x and y are counted again, as obstacles also
+  // left the raster the distances of every layer change
+  const int keptX = std::max(0, (int) m_sizeX - std::abs(dx));
+  const int keptY = std::max(0, (int) m_sizeY - std::abs(dy));
+  const unsigned stripX[2] = {(dx > 0) ? keptX : 0u, (dx > 0) ? m_sizeX - 1 : m_sizeX - 1 - keptX};
+  const unsigned stripY[2] = {(dy > 0) ? keptY : 0u, (dy > 0) ? m_sizeY - 1 : m_sizeY - 1 - keptY};
+  if (dx != 0)
+    countColumns(stripX[0], 0, stripX[1], m_sizeY - 1);
+  if (dy != 0)
+    countColumns(0, stripY[0], m_sizeX - 1, stripY[1]);
+  for (unsigned l = 0; l < m_bands.size(); ++l){
+    if (dx != 0)
+      updateObstacles(l, stripX[0], 0, stripX[1], m_sizeY - 1);
+    if (dy != 0)
+      updateObstacles(l, 0, stripY[0], m_sizeX - 1, stripY[1]);
+    computeDistances(l);
+  }
+  return true;
+}
+
+template <typename T>
+void ClearanceMap::shiftLayers(std::vector<T>& data, int dx, int dy, T fill){
+  // the column (x, y) takes the former one at (x + dx, y + dy), the rows are
+  // visited such that a source row is read before it is overwritten
+  const int sizeX = m_sizeX, sizeY = m_sizeY;
+  const int minX = std::max(0, -dx), maxX = std::min(sizeX, sizeX - dx);
+  for (unsigned l = 0; l < m_bands.size(); ++l){
+    typename std::vector<T>::iterator layer = data.begin() + l * m_numCells;
+    for (int i = 0; i < sizeY; ++i){
+      int y = (dy >= 0) ? i : sizeY - 1 - i;
+      typename std::vector<T>::iterator row = layer + y * sizeX;
+      int sy = y + dy;
+      if (sy < 0 || sy >= sizeY || minX >= maxX){
+        std::fill(row, row + sizeX, fill);
+        continue;
+      }
+      typename std::vector<T>::iterator src = layer + sy * sizeX;
+      if (dx >= 0)
+        std::copy(src + minX + dx, src + maxX + dx, row + minX);
+      else
+        std::copy_backward(src + minX + dx, src + maxX + dx, row + maxX);
+      std::fill(row, row + minX, fill);
+      std::fill(row + maxX, row + sizeX, fill);
+    }
+  }
+}
+
+bool ClearanceMap::updateColumns(unsigned minX, unsigned minY, unsigned maxX, unsigned maxY){
+  if (m_bands.empty() || m_numCells == 0)
+    return false;
+
+  countColumns(minX, minY, maxX, maxY);
+
+  // the obstacles of the recounted columns, a changed layer gets new distances
+  bool changed = false;
+  for (unsigned l = 0; l < m_bands.size(); ++l){
+    if (updateObstacles(l, minX, minY, maxX, maxY)){
+      computeDistances(l);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool ClearanceMap::updateObstacles(unsigned layer, unsigned minX, unsigned minY, unsigned maxX, unsigned maxY){
+  const unsigned bandCells = m_bands[layer].second + 1 - m_bands[layer].first;
+  bool changed = false;
+  for (unsigned y = minY; y <= maxY; ++y){
+    for (unsigned x = minX; x <= maxX; ++x){
+      unsigned i = layer * m_numCells + x + y * m_sizeX;
+      char obstacle = m_occupiedCells[i] > 0 || (m_unknownAsOccupied && m_freeCells[i] < bandCells);
+      if (obstacle != m_obstacles[i]){
+        m_obstacles[i] = obstacle;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+bool ClearanceMap::distance(double x, double y, unsigned layer, float& dist) const{
+  key_type kx, ky;
+  if (layer >= m_bands.size() || !m_octree->coordToKeyChecked(x, kx) || !m_octree->coordToKeyChecked(y, ky))
+    return false;
+  if (kx < m_minKey[0] || ky < m_minKey[1] || kx >= m_minKey[0] + m_sizeX || ky >= m_minKey[1] + m_sizeY)
+    return false;
+
+  dist = getCellDistance(layer, (kx - m_minKey[0]) + (ky - m_minKey[1]) * m_sizeX);
+  return true;
+}
+
+void ClearanceMap::countColumns(unsigned minX, unsigned minY, unsigned maxX, unsigned maxY){
+  for (unsigned l = 0; l < m_bands.size(); ++l){
+    for (unsigned y = minY; y <= maxY; ++y){
+      unsigned i = l * m_numCells + minX + y * m_sizeX;
+      std::fill(m_occupiedCells.begin() + i, m_occupiedCells.begin() + i + maxX + 1 - minX, 0);
+      std::fill(m_freeCells.begin() + i, m_freeCells.begin() + i + maxX + 1 - minX, 0);
+    }
+  }
+
+  OcTreeKey bbxMin(m_minKey[0] + minX, m_minKey[1] + minY, m_bands.front().first);
+  OcTreeKey bbxMax(m_minKey[0] + maxX, m_minKey[1] + maxY, std::max(m_bands.front().first, m_bands.back().second));
+  const unsigned treeDepth = m_octree->getTreeDepth();
+
+  // every leaf adds the cells it covers in each band to its columns, the
+  // unknown cells are the ones neither counted as occupied nor as free
+  for (OcTree::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(bbxMin, bbxMax), end = m_octree->end_leafs_bbx(); it != end; ++it){
+    const unsigned size = 1 << (treeDepth - it.getDepth());
+    const OcTreeKey key = it.getIndexKey();
+    std::vector<unsigned>& counts = m_octree->isNodeOccupied(*it) ? m_occupiedCells : m_freeCells;
+
+    unsigned x0 = std::max((unsigned) key[0], (unsigned) bbxMin[0]);
+    unsigned y0 = std::max((unsigned) key[1], (unsigned) bbxMin[1]);
+    unsigned x1 = std::min((unsigned) key[0] + size - 1, (unsigned) bbxMax[0]);
+    unsigned y1 = std::min((unsigned) key[1] + size - 1, (unsigned) bbxMax[1]);
+    for (unsigned l = 0; l < m_bands.size(); ++l){
+      int z0 = std::max((unsigned) key[2], m_bands[l].first);
+      int z1 = std::min((unsigned) key[2] + size - 1, m_bands[l].second);
+      if (z1 < z0)
+        continue;
+      for (unsigned y = y0; y <= y1; ++y){
+        unsigned i = l * m_numCells + (x0 - m_minKey[0]) + (y - m_minKey[1]) * m_sizeX;
+        for (unsigned x = x0; x <= x1; ++x, ++i)
+          counts[i] += z1 + 1 - z0;
+      }
+    }
+  }
+}
+
+void ClearanceMap::computeDistances(unsigned layer){
+  const unsigned maxSize = std::max(m_sizeX, m_sizeY);
+  std::vector<double> sq(m_numCells), f(maxSize);
+  std::vector<double> z(maxSize + 1);
+  std::vector<int> v(maxSize);
+
+  const char* obstacles = &m_obstacles[layer * m_numCells];
+  for (unsigned i = 0; i < m_numCells; ++i)
+    sq[i] = obstacles[i] ? 0.0 : kInfinity;
+
+  for (unsigned y = 0; y < m_sizeY; ++y)
+    distanceTransformLine(&sq[y * m_sizeX], 1, m_sizeX, f, v, z);
+  for (unsigned x = 0; x < m_sizeX; ++x)
+    distanceTransformLine(&sq[x], m_sizeX, m_sizeY, f, v, z);
+
+  const double resolution = m_octree->getResolution();
+  float* distances = &m_distances[layer * m_numCells];
+  for (unsigned i = 0; i < m_numCells; ++i)
+    distances[i] = (sq[i] < 0.5 * kInfinity) ? std::sqrt(sq[i]) * resolution : std::numeric_limits<float>::infinity();
+}
+
+} // namespace squirrel_3d_mapping
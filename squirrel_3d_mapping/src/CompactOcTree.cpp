@@ -0,0 +1,328 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_3d_mapping/CompactOcTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using namespace octomap;
+
+namespace squirrel_3d_mapping {
+
+namespace {
+
+// header: magic, resolution, hit, miss, clamping and occupancy probabilities,
+// number of nodes; then the values and the child blocks of the nodes. All in
+// host byte order.
+const char kMagic[8] = {'O', 'T', 'C', 'O', 'M', 'P', 'T', '1'};
+
+inline unsigned childIndex(const OcTreeKey& key, unsigned bit) {
+  return ((key[0] >> bit) & 1) | (((key[1] >> bit) & 1) << 1) | (((key[2] >> bit) & 1) << 2);
+}
+
+inline float logOdds(float probability) { return std::log(probability / (1.0f - probability)); }
+
+} // namespace
+
+const int8_t CompactOcTree::kUnknown;
+const unsigned CompactOcTree::kTreeDepth;
+
+CompactOcTree::CompactOcTree(double resolution)
+    : m_resolution(resolution) {
+  fromOcTree(OcTree(resolution));
+}
+
+void CompactOcTree::clear() {
+  m_values.assign(8, kUnknown);
+  m_children.assign(8, 0);
+  m_freeBlocks.clear();
+}
+
+int8_t CompactOcTree::quantize(float logOdds) const {
+  const long value = (long)std::floor(logOdds / m_step + 0.5f);
+  return (int8_t)std::max(-127L, std::min(127L, value));
+}
+
+void CompactOcTree::fromOcTree(const OcTree& tree) {
+  m_resolution = tree.getResolution();
+  m_probHit = tree.getProbHit();
+  m_probMiss = tree.getProbMiss();
+  m_clampingMin = tree.getClampingThresMin();
+  m_clampingMax = tree.getClampingThresMax();
+  // the quantization spans the clamping range, the updates take at least one step
+  const float clampMin = logOdds(m_clampingMin), clampMax = logOdds(m_clampingMax);
+  m_step = std::max(std::fabs(clampMin), std::fabs(clampMax)) / 127.0f;
+  m_clampMin = quantize(clampMin);
+  m_clampMax = quantize(clampMax);
+  m_hit = std::max<int8_t>(quantize(logOdds(m_probHit)), 1);
+  m_miss = std::min<int8_t>(quantize(logOdds(m_probMiss)), -1);
+  m_occupancyThres = logOdds(tree.getOccupancyThres());
+
+  clear();
+  if (tree.getRoot()) {
+    copyNodes(tree, tree.getRoot(), 0);
+    // equal children after the quantization are pruned as well
+    compact();
+  }
+}
+
+uint32_t CompactOcTree::copyNodes(const OcTree& tree, const OcTreeNode* node, uint32_t index) {
+  m_values[index] = quantize(node->getLogOdds());
+  if (!tree.nodeHasChildren(node))
+    return index;
+  const uint32_t block = allocateBlock();
+  m_children[index] = block;
+  for (unsigned i = 0; i < 8; ++i)
+    if (tree.nodeChildExists(node, i))
+      copyNodes(tree, tree.getNodeChild(node, i), 8 * block + i);
+  return index;
+}
+
+void CompactOcTree::toOcTree(OcTree& tree) const {
+  tree.clear();
+  tree.setProbHit(m_probHit);
+  tree.setProbMiss(m_probMiss);
+  tree.setClampingThresMin(m_clampingMin);
+  tree.setClampingThresMax(m_clampingMax);
+  tree.setOccupancyThres(1.0 / (1.0 + std::exp(-m_occupancyThres)));
+  if (m_values[0] == kUnknown)
+    return;
+  // the root can only be created through an update, drop the path it adds
+  tree.updateNode(OcTreeKey(0, 0, 0), 0.0f, true);
+  OcTreeNode* root = tree.getRoot();
+  for (unsigned i = 0; i < 8; ++i)
+    if (tree.nodeChildExists(root, i))
+      tree.deleteNodeChild(root, i);
+  createNodes(tree, root, 0);
+}
+
+void CompactOcTree::createNodes(OcTree& tree, OcTreeNode* node, uint32_t index) const {
+  node->setLogOdds(dequantize(m_values[index]));
+  const uint32_t block = m_children[index];
+  if (block == 0)
+    return;
+  for (unsigned i = 0; i < 8; ++i)
+    if (m_values[8 * block + i] != kUnknown)
+      createNodes(tree, tree.createNodeChild(node, i), 8 * block + i);
+}
+
+uint32_t CompactOcTree::allocateBlock() {
+  if (!m_freeBlocks.empty()) {
+    const uint32_t block = m_freeBlocks.back();
+    m_freeBlocks.pop_back();
+    return block;
+  }
+  const uint32_t block = m_values.size() / 8;
+  m_values.resize(m_values.size() + 8, kUnknown);
+  m_children.resize(m_children.size() + 8, 0);
+  return block;
+}
+
+void CompactOcTree::freeBlock(uint32_t block) {
+  std::fill(m_values.begin() + 8 * block, m_values.begin() + 8 * block + 8, kUnknown);
+  std::fill(m_children.begin() + 8 * block, m_children.begin() + 8 * block + 8, 0);
+  m_freeBlocks.push_back(block);
+}
+
+void CompactOcTree::updateInner(uint32_t node) {
+  const uint32_t block = m_children[node];
+  if (block == 0)
+    return;
+  const int8_t* values = &m_values[8 * block];
+  const uint32_t* children = &m_children[8 * block];
+  int8_t maximum = kUnknown;
+  bool prunable = true;
+  for (unsigned i = 0; i < 8; ++i) {
+    maximum = std::max(maximum, values[i]);
+    prunable = prunable && children[i] == 0 && values[i] == values[0];
+  }
+  m_values[node] = maximum;
+  // equal leafs or no known children at all
+  if (prunable || maximum == kUnknown) {
+    freeBlock(block);
+    m_children[node] = 0;
+  }
+}
+
+void CompactOcTree::updateNode(const OcTreeKey& key, bool occupied) {
+  uint32_t path[kTreeDepth + 1];
+  uint32_t node = 0;
+  path[0] = 0;
+  for (unsigned d = 0; d < kTreeDepth; ++d) {
+    uint32_t block = m_children[node];
+    if (block == 0) {
+      const int8_t value = m_values[node];
+      // a clamped leaf does not change, do not expand it
+      if (value != kUnknown && (occupied ? value >= m_clampMax : value <= m_clampMin))
+        return;
+      block = allocateBlock();
+      m_children[node] = block;
+      // a pruned leaf passes its value on to its children
+      if (value != kUnknown)
+        std::fill(m_values.begin() + 8 * block, m_values.begin() + 8 * block + 8, value);
+    }
+    node = 8 * block + childIndex(key, kTreeDepth - 1 - d);
+    path[d + 1] = node;
+  }
+
+  const int value = (m_values[node] == kUnknown ? 0 : m_values[node]) + (occupied ? m_hit : m_miss);
+  m_values[node] = (int8_t)std::max<int>(m_clampMin, std::min<int>(m_clampMax, value));
+  for (unsigned d = kTreeDepth; d-- > 0;)
+    updateInner(path[d]);
+}
+
+bool CompactOcTree::search(const OcTreeKey& key, float& logOdds) const {
+  uint32_t node = 0;
+  if (m_values[0] == kUnknown)
+    return false;
+  for (unsigned d = 0; d < kTreeDepth; ++d) {
+    const uint32_t block = m_children[node];
+    if (block == 0)
+      break;
+    node = 8 * block + childIndex(key, kTreeDepth - 1 - d);
+    if (m_values[node] == kUnknown)
+      return false;
+  }
+  logOdds = dequantize(m_values[node]);
+  return true;
+}
+
+bool CompactOcTree::coordToKeyChecked(const point3d& p, OcTreeKey& key) const {
+  const int maxValue = 1 << (kTreeDepth - 1);
+  for (unsigned i = 0; i < 3; ++i) {
+    const int value = (int)std::floor(p(i) / m_resolution) + maxValue;
+    if (value < 0 || value >= 2 * maxValue)
+      return false;
+    key[i] = value;
+  }
+  return true;
+}
+
+point3d CompactOcTree::keyToCoord(const OcTreeKey& key, unsigned depth) const {
+  const unsigned cells = 1u << (kTreeDepth - depth);
+  const int maxValue = 1 << (kTreeDepth - 1);
+  point3d p;
+  for (unsigned i = 0; i < 3; ++i)
+    p(i) = ((int)(key[i] & ~(cells - 1)) - maxValue + 0.5 * cells) * m_resolution;
+  return p;
+}
+
+void CompactOcTree::pruneAll(uint32_t node) {
+  const uint32_t block = m_children[node];
+  if (block == 0)
+    return;
+  for (unsigned i = 0; i < 8; ++i)
+    if (m_children[8 * block + i] != 0)
+      pruneAll(8 * block + i);
+  updateInner(node);
+}
+
+void CompactOcTree::compact() {
+  pruneAll(0);
+  CompactOcTree target(m_resolution);
+  target.m_values[0] = m_values[0];
+  repack(0, 0, target);
+  // copies of the exact size, the target keeps the capacity of its growth
+  std::vector<int8_t>(target.m_values).swap(m_values);
+  std::vector<uint32_t>(target.m_children).swap(m_children);
+  m_freeBlocks.clear();
+}
+
+void CompactOcTree::repack(uint32_t node, uint32_t index, CompactOcTree& target) const {
+  const uint32_t block = m_children[node];
+  if (block == 0)
+    return;
+  const uint32_t targetBlock = target.allocateBlock();
+  target.m_children[index] = targetBlock;
+  std::copy(m_values.begin() + 8 * block, m_values.begin() + 8 * block + 8, target.m_values.begin() + 8 * targetBlock);
+  for (unsigned i = 0; i < 8; ++i)
+    repack(8 * block + i, 8 * targetBlock + i, target);
+}
+
+size_t CompactOcTree::size() const {
+  return m_values.size() - std::count(m_values.begin(), m_values.end(), kUnknown);
+}
+
+size_t CompactOcTree::memoryUsage() const {
+  return sizeof(*this) + m_values.capacity() * sizeof(int8_t) + m_children.capacity() * sizeof(uint32_t) +
+         m_freeBlocks.capacity() * sizeof(uint32_t);
+}
+
+bool CompactOcTree::writeBinary(const std::string& filename) const {
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  const float probabilities[5] = {m_probHit, m_probMiss, m_clampingMin, m_clampingMax,
+                                  (float)(1.0 / (1.0 + std::exp(-m_occupancyThres)))};
+  const uint64_t numNodes = m_values.size();
+  file.write(kMagic, sizeof(kMagic));
+  file.write((const char*)&m_resolution, sizeof(m_resolution));
+  file.write((const char*)probabilities, sizeof(probabilities));
+  file.write((const char*)&numNodes, sizeof(numNodes));
+  file.write((const char*)&m_values[0], numNodes * sizeof(int8_t));
+  file.write((const char*)&m_children[0], numNodes * sizeof(uint32_t));
+  return file.good();
+}
+
+bool CompactOcTree::readBinary(const std::string& filename) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  char magic[8];
+  double resolution;
+  float probabilities[5];
+  uint64_t numNodes;
+  file.read(magic, sizeof(magic));
+  file.read((char*)&resolution, sizeof(resolution));
+  file.read((char*)probabilities, sizeof(probabilities));
+  file.read((char*)&numNodes, sizeof(numNodes));
+  if (!file || std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 || numNodes < 8 || numNodes % 8 != 0)
+    return false;
+  std::vector<int8_t> values(numNodes);
+  std::vector<uint32_t> children(numNodes);
+  file.read((char*)&values[0], numNodes * sizeof(int8_t));
+  file.read((char*)&children[0], numNodes * sizeof(uint32_t));
+  if (!file)
+    return false;
+  for (size_t i = 0; i < numNodes; ++i)
+    if (children[i] >= numNodes / 8)
+      return false;
+
+  // the sensor model and the quantization of the writer
+  OcTree tree(resolution);
+  tree.setProbHit(probabilities[0]);
+  tree.setProbMiss(probabilities[1]);
+  tree.setClampingThresMin(probabilities[2]);
+  tree.setClampingThresMax(probabilities[3]);
+  tree.setOccupancyThres(probabilities[4]);
+  fromOcTree(tree);
+  m_values.swap(values);
+  m_children.swap(children);
+  return true;
+}
+
+} // namespace squirrel_3d_mapping
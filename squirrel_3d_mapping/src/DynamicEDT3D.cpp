@@ -29,109 +29,113 @@
 
 #include "squirrel_3d_mapping/DynamicEDT3D.h"
 
+#include <algorithm>
 #include <iostream>
+#include <new>
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace squirrel_3d_mapping {
 
-#define FOR_EACH_NEIGHBOR_WITH_CHECK(function, p, ...)          \
-  int x=p.x;                                                    \
-  int y=p.y;                                                    \
-  int z=p.z;                                                    \
-  int xp1 = x+1;                                                \
-  int xm1 = x-1;                                                \
-  int yp1 = y+1;                                                \
-  int ym1 = y-1;                                                \
-  int zp1 = z+1;                                                \
-  int zm1 = z-1;                                                \
-                                                                \
-  if(z<sizeZm1) function(x, y, zp1, ##__VA_ARGS__);             \
-  if(z>0)       function(x, y, zm1, ##__VA_ARGS__);             \
-                                                                \
-  if(y<sizeYm1){                                                \
-    function(x, yp1, z, ##__VA_ARGS__);                         \
-    if(z<sizeZm1) function(x, yp1, zp1, ##__VA_ARGS__);         \
-    if(z>0)       function(x, yp1, zm1, ##__VA_ARGS__);         \
-  }                                                             \
-                                                                \
-  if(y>0){                                                      \
-    function(x, ym1, z, ##__VA_ARGS__);                         \
-    if(z<sizeZm1) function(x, ym1, zp1, ##__VA_ARGS__);         \
-    if(z>0)       function(x, ym1, zm1, ##__VA_ARGS__);         \
-  }                                                             \
-                                                                \
-                                                                \
-  if(x<sizeXm1){                                                \
-    function(xp1, y, z, ##__VA_ARGS__);                         \
-    if(z<sizeZm1) function(xp1, y, zp1, ##__VA_ARGS__);         \
-    if(z>0)       function(xp1, y, zm1, ##__VA_ARGS__);         \
-                                                                \
-    if(y<sizeYm1){                                              \
-      function(xp1, yp1, z, ##__VA_ARGS__);                     \
-      if(z<sizeZm1) function(xp1, yp1, zp1, ##__VA_ARGS__);     \
-      if(z>0)       function(xp1, yp1, zm1, ##__VA_ARGS__);     \
-    }                                                           \
-                                                                \
-    if(y>0){                                                    \
-      function(xp1, ym1, z, ##__VA_ARGS__);                     \
-      if(z<sizeZm1) function(xp1, ym1, zp1, ##__VA_ARGS__);     \
-      if(z>0)       function(xp1, ym1, zm1, ##__VA_ARGS__);     \
-    }                                                           \
-}                                                               \
-                                                                \
-  if(x>0){                                                      \
-    function(xm1, y, z, ##__VA_ARGS__);                         \
-    if(z<sizeZm1) function(xm1, y, zp1, ##__VA_ARGS__);         \
-    if(z>0)       function(xm1, y, zm1, ##__VA_ARGS__);         \
-                                                                \
-    if(y<sizeYm1){                                              \
-      function(xm1, yp1, z, ##__VA_ARGS__);                     \
-      if(z<sizeZm1) function(xm1, yp1, zp1, ##__VA_ARGS__);     \
-      if(z>0)       function(xm1, yp1, zm1, ##__VA_ARGS__);     \
-    }                                                           \
-                                                                \
-    if(y>0){                                                    \
-      function(xm1, ym1, z, ##__VA_ARGS__);                     \
-      if(z<sizeZm1) function(xm1, ym1, zp1, ##__VA_ARGS__);     \
-      if(z>0)       function(xm1, ym1, zm1, ##__VA_ARGS__);     \
-    }                                                           \
+#define FOR_EACH_NEIGHBOR_WITH_CHECK(function, p, ...)                                \
+  int x=p.x;                                                                          \
+  int y=p.y;                                                                          \
+  int z=p.z;                                                                          \
+  int xp1 = x+1;                                                                      \
+  int xm1 = x-1;                                                                      \
+  int yp1 = y+1;                                                                      \
+  int ym1 = y-1;                                                                      \
+  int zp1 = z+1;                                                                      \
+  int zm1 = z-1;                                                                      \
+                                                                                      \
+  if(z<sizeZm1) function(x, y, zp1, cellIndex(x, y, zp1), ##__VA_ARGS__);             \
+  if(z>0)       function(x, y, zm1, cellIndex(x, y, zm1), ##__VA_ARGS__);             \
+                                                                                      \
+  if(y<sizeYm1){                                                                      \
+    function(x, yp1, z, cellIndex(x, yp1, z), ##__VA_ARGS__);                         \
+    if(z<sizeZm1) function(x, yp1, zp1, cellIndex(x, yp1, zp1), ##__VA_ARGS__);       \
+    if(z>0)       function(x, yp1, zm1, cellIndex(x, yp1, zm1), ##__VA_ARGS__);       \
+  }                                                                                   \
+                                                                                      \
+  if(y>0){                                                                            \
+    function(x, ym1, z, cellIndex(x, ym1, z), ##__VA_ARGS__);                         \
+    if(z<sizeZm1) function(x, ym1, zp1, cellIndex(x, ym1, zp1), ##__VA_ARGS__);       \
+    if(z>0)       function(x, ym1, zm1, cellIndex(x, ym1, zm1), ##__VA_ARGS__);       \
+  }                                                                                   \
+                                                                                      \
+                                                                                      \
+  if(x<sizeXm1){                                                                      \
+    function(xp1, y, z, cellIndex(xp1, y, z), ##__VA_ARGS__);                         \
+    if(z<sizeZm1) function(xp1, y, zp1, cellIndex(xp1, y, zp1), ##__VA_ARGS__);       \
+    if(z>0)       function(xp1, y, zm1, cellIndex(xp1, y, zm1), ##__VA_ARGS__);       \
+                                                                                      \
+    if(y<sizeYm1){                                                                    \
+      function(xp1, yp1, z, cellIndex(xp1, yp1, z), ##__VA_ARGS__);                   \
+      if(z<sizeZm1) function(xp1, yp1, zp1, cellIndex(xp1, yp1, zp1), ##__VA_ARGS__); \
+      if(z>0)       function(xp1, yp1, zm1, cellIndex(xp1, yp1, zm1), ##__VA_ARGS__); \
+    }                                                                                 \
+                                                                                      \
+    if(y>0){                                                                          \
+      function(xp1, ym1, z, cellIndex(xp1, ym1, z), ##__VA_ARGS__);                   \
+      if(z<sizeZm1) function(xp1, ym1, zp1, cellIndex(xp1, ym1, zp1), ##__VA_ARGS__); \
+      if(z>0)       function(xp1, ym1, zm1, cellIndex(xp1, ym1, zm1), ##__VA_ARGS__); \
+    }                                                                                 \
+}                                                                                     \
+                                                                                      \
+  if(x>0){                                                                            \
+    function(xm1, y, z, cellIndex(xm1, y, z), ##__VA_ARGS__);                         \
+    if(z<sizeZm1) function(xm1, y, zp1, cellIndex(xm1, y, zp1), ##__VA_ARGS__);       \
+    if(z>0)       function(xm1, y, zm1, cellIndex(xm1, y, zm1), ##__VA_ARGS__);       \
+                                                                                      \
+    if(y<sizeYm1){                                                                    \
+      function(xm1, yp1, z, cellIndex(xm1, yp1, z), ##__VA_ARGS__);                   \
+      if(z<sizeZm1) function(xm1, yp1, zp1, cellIndex(xm1, yp1, zp1), ##__VA_ARGS__); \
+      if(z>0)       function(xm1, yp1, zm1, cellIndex(xm1, yp1, zm1), ##__VA_ARGS__); \
+    }                                                                                 \
+                                                                                      \
+    if(y>0){                                                                          \
+      function(xm1, ym1, z, cellIndex(xm1, ym1, z), ##__VA_ARGS__);                   \
+      if(z<sizeZm1) function(xm1, ym1, zp1, cellIndex(xm1, ym1, zp1), ##__VA_ARGS__); \
+      if(z>0)       function(xm1, ym1, zm1, cellIndex(xm1, ym1, zm1), ##__VA_ARGS__); \
+    }                                                                                 \
 }
 
 float DynamicEDT3D::distanceValue_Error = -1.0;
 int DynamicEDT3D::distanceInCellsValue_Error = -1;
 
-DynamicEDT3D::DynamicEDT3D( int _maxdist_squared )
+DynamicEDT3D::DynamicEDT3D( int _maxdist_squared, bool _sparse )
 {
   sqrt2 = sqrt(2.0);
   maxDist_squared = _maxdist_squared;
   maxDist = sqrt((double) maxDist_squared);
-  data = NULL;
+  sparse = _sparse;
+  brickPool = NULL;
+  unreachedBrick = NULL;
   gridMap = NULL;
+  batchInitialize = false;
+  isInitialized = false;
 }
 
 DynamicEDT3D::~DynamicEDT3D( void )
 {
-  if ( data ) {
-    for (int x=0; x<sizeX; x++) {
-      for (int y=0; y<sizeY; y++) {
-        delete[] data[x][y];
-      }
-      delete[] data[x];
-    }
-    delete[] data;
-  }
-  
-  if ( gridMap ) {
-    for (int x=0; x<sizeX; x++) {
-      for (int y=0; y<sizeY; y++) {
-        delete[] gridMap[x][y];
-      }
-      delete[] gridMap[x];
-    }
-    delete[] gridMap;
+  releaseBricks();
+  ::free(gridMap);
+}
+
+template <typename T>
+static T* allocateAligned( size_t n )
+{
+  void* p = NULL;
+  if ( posix_memalign(&p, 64, n*sizeof(T)) != 0 ) {
+    throw std::bad_alloc();
   }
+  return static_cast<T*>(p);
 }
 
 void DynamicEDT3D::initializeEmpty( int _sizeX, int _sizeY, int _sizeZ, bool initGridMap )
@@ -143,43 +147,22 @@ void DynamicEDT3D::initializeEmpty( int _sizeX, int _sizeY, int _sizeZ, bool ini
   sizeXm1 = sizeX-1;
   sizeYm1 = sizeY-1;
   sizeZm1 = sizeZ-1;
+  isInitialized = false;
   
-  if ( data ) {
-    for (int x=0; x<sizeX; x++) {
-      for (int y=0; y<sizeY; y++) {
-        delete[] data[x][y];
-      }
-      delete[] data[x];
-    }
-    delete[] data;
-  }
+  strideY = sizeZ;
+  strideX = size_t(sizeY)*sizeZ;
+  const size_t numCells = size_t(sizeX)*strideX;
   
-  data = new dataCell**[sizeX];
-  for (int x=0; x<sizeX; x++) {
-    data[x] = new dataCell*[sizeY];
-    for(int y=0; y<sizeY; y++) {
-      data[x][y] = new dataCell[sizeZ];
-    }
-  }
+  bricksX = (sizeX + brickMask) >> brickShift;
+  bricksY = (sizeY + brickMask) >> brickShift;
+  bricksZ = (sizeZ + brickMask) >> brickShift;
+  const size_t numBricks = size_t(bricksX)*bricksY*bricksZ;
+  
+  releaseBricks();
   
   if ( initGridMap ) {
-    if ( gridMap ) {
-      for (int x=0; x<sizeX; x++) {
-        for (int y=0; y<sizeY; y++) {
-          delete[] gridMap[x][y];
-        }
-        delete[] gridMap[x];
-      }
-      delete[] gridMap;
-    }
-    
-    gridMap = new bool**[sizeX];
-    for (int x=0; x<sizeX; x++) {
-      gridMap[x] = new bool*[sizeY];
-      for (int y=0; y<sizeY; y++) {
-        gridMap[x][y] = new bool[sizeZ];
-      }
-    }
+    ::free(gridMap);
+    gridMap = allocateAligned<bool>(numCells);
   }
   
   dataCell c;
@@ -191,35 +174,201 @@ void DynamicEDT3D::initializeEmpty( int _sizeX, int _sizeY, int _sizeZ, bool ini
   c.queueing = fwNotQueued;
   c.needsRaise = false;
   
-  for (int x=0; x<sizeX; x++) {
-    for (int y=0; y<sizeY; y++) {
-      for (int z=0; z<sizeZ; z++) {
-        data[x][y][z] = c;
-      }
+  unreachedBrick = allocateAligned<dataCell>(brickCells);
+  std::fill(unreachedBrick, unreachedBrick+brickCells, c);
+  if ( sparse ) {
+    bricks.assign(numBricks, unreachedBrick);
+  } else {
+    brickPool = allocateAligned<dataCell>(numBricks*brickCells);
+    std::fill(brickPool, brickPool+numBricks*brickCells, c);
+    bricks.resize(numBricks);
+    for (size_t b=0; b<numBricks; b++) {
+      bricks[b] = brickPool + b*brickCells;
     }
   }
   
   if ( initGridMap ) {
-    for (int x=0; x<sizeX; x++) {
-      for (int y=0; y<sizeY; y++) {
-        for (int z=0; z<sizeZ; z++) {
-          gridMap[x][y][z] = 0;
+    std::fill(gridMap, gridMap+numCells, false);
+  }
+}
+
+DynamicEDT3D::dataCell* DynamicEDT3D::allocateBrick( void )
+{
+  dataCell* brick = allocateAligned<dataCell>(brickCells);
+  std::copy(unreachedBrick, unreachedBrick+brickCells, brick);
+  return brick;
+}
+
+void DynamicEDT3D::releaseBricks( void )
+{
+  if ( brickPool == NULL ) {
+    for (size_t b=0; b<bricks.size(); b++) {
+      if ( bricks[b] != unreachedBrick ) {
+        ::free(bricks[b]);
+      }
+    }
+  }
+  ::free(brickPool);
+  ::free(unreachedBrick);
+  brickPool = NULL;
+  unreachedBrick = NULL;
+  bricks.clear();
+}
+
+size_t DynamicEDT3D::getMemoryUsage( void ) const
+{
+  size_t allocated = 0;
+  for (size_t b=0; b<bricks.size(); b++) {
+    if ( bricks[b] != unreachedBrick ) {
+      allocated++;
+    }
+  }
+  size_t bytes = (allocated+1)*brickCells*sizeof(dataCell) + bricks.capacity()*sizeof(dataCell*);
+  if ( gridMap != NULL ) {
+    bytes += size_t(sizeX)*strideX*sizeof(bool);
+  }
+  return bytes;
+}
+
+INTPOINT3D DynamicEDT3D::shiftMap( int dx, int dy )
+{
+  const int shiftBricksX = dx/brickSize;
+  const int shiftBricksY = dy/brickSize;
+  dx = shiftBricksX*brickSize;
+  dy = shiftBricksY*brickSize;
+  if ( dx==0 && dy==0 ) {
+    return INTPOINT3D(0, 0, 0);
+  }
+  
+  // permute the brick directory, the bricks moved out of the map are reused
+  // for the exposed ones of a dense grid
+  const dataCell unreached = unreachedBrick[0];
+  std::vector<dataCell*> shifted(bricks.size(), (dataCell*) NULL);
+  std::vector<dataCell*> spare;
+  for (int bx=0; bx<bricksX; bx++) {
+    for (int by=0; by<bricksY; by++) {
+      for (int bz=0; bz<bricksZ; bz++) {
+        dataCell* brick = bricks[(size_t(bx)*bricksY + by)*bricksZ + bz];
+        int nbx = bx-shiftBricksX;
+        int nby = by-shiftBricksY;
+        if ( nbx>=0 && nbx<bricksX && nby>=0 && nby<bricksY ) {
+          shifted[(size_t(nbx)*bricksY + nby)*bricksZ + bz] = brick;
+        } else if ( brick != unreachedBrick ) {
+          spare.push_back(brick);
+        }
+      }
+    }
+  }
+  for (size_t b=0; b<shifted.size(); b++) {
+    if ( shifted[b] != NULL ) {
+      continue;
+    }
+    if ( sparse || spare.empty() ) {
+      shifted[b] = unreachedBrick;
+    } else {
+      shifted[b] = spare.back();
+      spare.pop_back();
+      std::fill(shifted[b], shifted[b]+brickCells, unreached);
+    }
+  }
+  if ( sparse ) {
+    for (size_t b=0; b<spare.size(); b++) {
+      ::free(spare[b]);
+    }
+  }
+  bricks.swap(shifted);
+  
+  // the closest obstacles move with the cells, a cell whose obstacle left
+  // the map is raised like the cells of a removed obstacle and the kept
+  // cells next to the exposed ones lower them again
+  const int borderX = (dx > 0) ? sizeX-dx-1 : -dx;
+  const int borderY = (dy > 0) ? sizeY-dy-1 : -dy;
+  for (size_t b=0; b<bricks.size(); b++) {
+    dataCell* brick = bricks[b];
+    if ( brick == unreachedBrick ) {
+      continue;
+    }
+    const int bx = int(b/(size_t(bricksY)*bricksZ)) << brickShift;
+    const int by = int((b/bricksZ)%bricksY) << brickShift;
+    const int bz = int(b%bricksZ) << brickShift;
+    for (int i=0; i<brickCells; i++) {
+      int x = bx | (i >> (2*brickShift));
+      int y = by | ((i >> brickShift) & brickMask);
+      int z = bz | (i & brickMask);
+      dataCell& c = brick[i];
+      if ( x>=sizeX || y>=sizeY || z>=sizeZ ) {
+        c = unreached; // padding of the border bricks
+        continue;
+      }
+      if ( c.obstX == invalidObstData ) {
+        continue;
+      }
+      c.obstX -= dx;
+      c.obstY -= dy;
+      if ( c.obstX>=0 && c.obstX<sizeX && c.obstY>=0 && c.obstY<sizeY ) {
+        if ( ((dx != 0 && x == borderX) || (dy != 0 && y == borderY)) && c.queueing != fwQueued ) {
+          open.push(c.sqdist, INTPOINT3D(x, y, z));
+          c.queueing = fwQueued;
         }
+        continue;
       }
+      open.push(c.sqdist, INTPOINT3D(x, y, z));
+      c.obstX = invalidObstData;
+      c.obstY = invalidObstData;
+      c.obstZ = invalidObstData;
+      c.sqdist = maxDist_squared;
+      c.dist = maxDist;
+      c.queueing = fwQueued;
+      c.needsRaise = true;
+    }
+  }
+  
+  size_t kept = 0;
+  for (size_t i=0; i<lastObstacles.size(); i++) {
+    INTPOINT3D p(lastObstacles[i].x-dx, lastObstacles[i].y-dy, lastObstacles[i].z);
+    if ( p.x>=0 && p.x<sizeX && p.y>=0 && p.y<sizeY ) {
+      lastObstacles[kept++] = p;
+    }
+  }
+  lastObstacles.resize(kept);
+  
+  shiftGridMap(dx, dy);
+  return INTPOINT3D(dx, dy, 0);
+}
+
+void DynamicEDT3D::shiftGridMap( int dx, int dy )
+{
+  if ( gridMap == NULL ) {
+    return;
+  }
+  
+  // the slabs are visited such that a source slab is read before it is overwritten
+  const int minY = std::max(0, -dy);
+  const int maxY = std::min(sizeY, sizeY-dy);
+  for (int i=0; i<sizeX; i++) {
+    int x = (dx >= 0) ? i : sizeXm1-i;
+    bool* slab = gridMap + x*strideX;
+    int sx = x+dx;
+    if ( sx<0 || sx>=sizeX || minY>=maxY ) {
+      std::fill(slab, slab+strideX, false);
+      continue;
     }
+    memmove(slab + minY*strideY, gridMap + sx*strideX + (minY+dy)*strideY, (maxY-minY)*strideY*sizeof(bool));
+    std::fill(slab, slab + minY*strideY, false);
+    std::fill(slab + maxY*strideY, slab + strideX, false);
   }
 }
 
-void DynamicEDT3D::initializeMap( int _sizeX, int _sizeY, int _sizeZ, bool*** _gridMap )
+void DynamicEDT3D::initializeMap( int _sizeX, int _sizeY, int _sizeZ, const bool* _gridMap )
 {
-  gridMap = _gridMap;
-  initializeEmpty(_sizeX, _sizeY, _sizeZ, false);
+  initializeEmpty(_sizeX, _sizeY, _sizeZ, true);
+  std::copy(_gridMap, _gridMap+size_t(sizeX)*strideX, gridMap);
   
   for (int x=0; x<sizeX; x++) {
     for (int y=0; y<sizeY; y++) {
       for (int z=0; z<sizeZ; z++) {
-        if ( gridMap[x][y][z] ) {
-          dataCell c = data[x][y][z];
+        if ( gridMap[flatIndex(x, y, z)] ) {
+          dataCell c = cellAt(cellIndex(x, y, z));
           if ( !isOccupied(x, y, z, c) ) {
             bool isSurrounded = true;
             for (int dx=-1; dx<=1; dx++) {
@@ -240,7 +389,7 @@ void DynamicEDT3D::initializeMap( int _sizeX, int _sizeY, int _sizeZ, bool*** _g
                   if ( nz<0 || nz>sizeZ-1 ) {
                     continue;
                   }
-                  if ( !gridMap[nx][ny][nz] ) {
+                  if ( !gridMap[flatIndex(nx, ny, nz)] ) {
                     isSurrounded = false;
                     break;
                   }
@@ -254,7 +403,7 @@ void DynamicEDT3D::initializeMap( int _sizeX, int _sizeY, int _sizeZ, bool*** _g
               c.sqdist = 0;
               c.dist = 0;
               c.queueing = fwProcessed;
-              data[x][y][z] = c;
+              cellRef(cellIndex(x, y, z)) = c;
             } else setObstacle(x, y, z);
           }
         }
@@ -265,19 +414,19 @@ void DynamicEDT3D::initializeMap( int _sizeX, int _sizeY, int _sizeZ, bool*** _g
 
 void DynamicEDT3D::occupyCell( int x, int y, int z )
 {
-  gridMap[x][y][z] = 1;
+  gridMap[flatIndex(x, y, z)] = 1;
   setObstacle(x, y, z);
 }
 
 void DynamicEDT3D::clearCell( int x, int y, int z )
 {
-  gridMap[x][y][z] = 0;
+  gridMap[flatIndex(x, y, z)] = 0;
   removeObstacle(x, y, z);
 }
 
 void DynamicEDT3D::setObstacle(int x, int y, int z)
 {
-  dataCell c = data[x][y][z];
+  dataCell c = cellAt(cellIndex(x, y, z));
   if( isOccupied(x, y, z, c) ) {
     return;
   }
@@ -286,12 +435,12 @@ void DynamicEDT3D::setObstacle(int x, int y, int z)
   c.obstX = x;
   c.obstY = y;
   c.obstZ = z;
-  data[x][y][z] = c;
+  cellRef(cellIndex(x, y, z)) = c;
 }
 
 void DynamicEDT3D::removeObstacle( int x, int y, int z )
 {
-  dataCell c = data[x][y][z];
+  dataCell c = cellAt(cellIndex(x, y, z));
   if( isOccupied(x, y, z, c) == false ) {
     return;
   }
@@ -301,7 +450,7 @@ void DynamicEDT3D::removeObstacle( int x, int y, int z )
   c.obstY  = invalidObstData;
   c.obstZ  = invalidObstData;
   c.queueing = bwQueued;
-  data[x][y][z] = c;
+  cellRef(cellIndex(x, y, z)) = c;
 }
 
 void DynamicEDT3D::exchangeObstacles( std::vector<INTPOINT3D> points )
@@ -312,7 +461,7 @@ void DynamicEDT3D::exchangeObstacles( std::vector<INTPOINT3D> points )
     int y = lastObstacles[i].y;
     int z = lastObstacles[i].z;
     
-    bool v = gridMap[x][y][z];
+    bool v = gridMap[flatIndex(x, y, z)];
     if ( v ) {
       continue;
     }
@@ -325,7 +474,7 @@ void DynamicEDT3D::exchangeObstacles( std::vector<INTPOINT3D> points )
     int x = points[i].x;
     int y = points[i].y;
     int z = points[i].z;
-    bool v = gridMap[x][y][z];
+    bool v = gridMap[flatIndex(x, y, z)];
     if ( v ) {
       continue;
     }
@@ -336,6 +485,13 @@ void DynamicEDT3D::exchangeObstacles( std::vector<INTPOINT3D> points )
 
 void DynamicEDT3D::update( bool updateRealDist )
 {
+  if ( batchInitialize && !isInitialized ) {
+    batchUpdate(updateRealDist);
+    isInitialized = true;
+    return;
+  }
+  isInitialized = true;
+  
   commitAndColorize(updateRealDist);
   
   while ( !open.empty() ) {
@@ -343,7 +499,8 @@ void DynamicEDT3D::update( bool updateRealDist )
     int x = p.x;
     int y = p.y;
     int z = p.z;
-    dataCell c = data[x][y][z];
+    size_t i = cellIndex(x, y, z);
+    dataCell c = cellAt(i);
     
     if( c.queueing==fwProcessed ) {
       continue;
@@ -352,12 +509,148 @@ void DynamicEDT3D::update( bool updateRealDist )
     if ( c.needsRaise ) {
       // RAISE
       raiseCell(p, c, updateRealDist);
-      data[x][y][z] = c;
+      cellRef(i) = c;
     }
-    else if ( c.obstX != invalidObstData && isOccupied(c.obstX, c.obstY, c.obstZ, data[c.obstX][c.obstY][c.obstZ]) ) {
+    else if ( c.obstX != invalidObstData && isOccupied(c.obstX, c.obstY, c.obstZ, cellAt(cellIndex(c.obstX, c.obstY, c.obstZ))) ) {
       // LOWER
       propagateCell(p, c, updateRealDist);
-      data[x][y][z] = c;
+      cellRef(i) = c;
+    }
+  }
+}
+
+static const int batchInfinity = INT_MAX;
+
+//! squared distances along one line of the grid with the lower envelope of
+//! parabolas (Felzenszwalb and Huttenlocher), obst holds the index of the
+//! closest obstacle
+static void distanceTransformLine( std::vector<int>& sq, std::vector<int>& obst, size_t base, size_t stride, int n,
+                                   std::vector<int>& f, std::vector<int>& a, std::vector<int>& v, std::vector<double>& b )
+{
+  for (int q=0; q<n; q++) {
+    f[q] = sq[base+q*stride];
+    a[q] = obst[base+q*stride];
+  }
+  
+  int k = -1;
+  for (int q=0; q<n; q++) {
+    if ( f[q] == batchInfinity ) {
+      continue;
+    }
+    double s = 0.0;
+    while ( k >= 0 ) {
+      s = ((f[q] + double(q)*q) - (f[v[k]] + double(v[k])*v[k])) / (2.0*(q - v[k]));
+      if ( s > b[k] ) {
+        break;
+      }
+      k--;
+    }
+    k++;
+    v[k] = q;
+    b[k] = (k == 0) ? -HUGE_VAL : s;
+  }
+  if ( k < 0 ) {
+    return; // no obstacle on this line
+  }
+  b[k+1] = HUGE_VAL;
+  
+  int j = 0;
+  for (int q=0; q<n; q++) {
+    while ( b[j+1] < q ) {
+      j++;
+    }
+    int d = q - v[j];
+    sq[base+q*stride] = d*d + f[v[j]];
+    obst[base+q*stride] = a[v[j]];
+  }
+}
+
+void DynamicEDT3D::batchUpdate( bool updateRealDist )
+{
+  const size_t numCells = size_t(sizeX)*strideX;
+  if ( numCells > size_t(INT_MAX) ) {
+    commitAndColorize(updateRealDist);
+    batchInitialize = false;
+    update(updateRealDist);
+    return;
+  }
+  
+  // the obstacles were set by setObstacle or directly as surrounded ones,
+  // the transform works on contiguous lines indexed like the gridMap
+  std::vector<int> sq(numCells);
+  std::vector<int> obst(numCells);
+#pragma omp parallel for schedule(static)
+  for (int x=0; x<sizeX; x++) {
+    for (int y=0; y<sizeY; y++) {
+      for (int z=0; z<sizeZ; z++) {
+        size_t i = flatIndex(x, y, z);
+        bool occupied = isOccupied(x, y, z, cellAt(cellIndex(x, y, z)));
+        sq[i] = occupied ? 0 : batchInfinity;
+        obst[i] = occupied ? int(i) : -1;
+      }
+    }
+  }
+  addList.clear();
+  removeList.clear();
+  
+  // separable passes along z, y and x, the lines of each pass are independent
+  const int maxSize = std::max(sizeX, std::max(sizeY, sizeZ));
+#pragma omp parallel
+  {
+    std::vector<int> f(maxSize), a(maxSize), v(maxSize);
+    std::vector<double> b(maxSize+1);
+    
+#pragma omp for schedule(static)
+    for (int l=0; l<sizeX*sizeY; l++) {
+      distanceTransformLine(sq, obst, size_t(l)*sizeZ, 1, sizeZ, f, a, v, b);
+    }
+#pragma omp for schedule(static)
+    for (int l=0; l<sizeX*sizeZ; l++) {
+      distanceTransformLine(sq, obst, (l/sizeZ)*strideX + l%sizeZ, strideY, sizeY, f, a, v, b);
+    }
+#pragma omp for schedule(static)
+    for (int l=0; l<sizeY*sizeZ; l++) {
+      distanceTransformLine(sq, obst, l, strideX, sizeX, f, a, v, b);
+    }
+  }
+  
+  // cells beyond maxDist have no closest obstacle, as after the brushfire
+  dataCell unreached;
+  unreached.dist = maxDist;
+  unreached.sqdist = maxDist_squared;
+  unreached.obstX = invalidObstData;
+  unreached.obstY = invalidObstData;
+  unreached.obstZ = invalidObstData;
+  unreached.queueing = fwNotQueued;
+  unreached.needsRaise = false;
+  
+  // a brick is only written by the thread of its x slab
+#pragma omp parallel for schedule(dynamic)
+  for (int bx=0; bx<bricksX; bx++) {
+    for (int x=bx*brickSize; x<std::min(sizeX, (bx+1)*brickSize); x++) {
+      for (int y=0; y<sizeY; y++) {
+        for (int z=0; z<sizeZ; z++) {
+          size_t i = flatIndex(x, y, z);
+          size_t n = cellIndex(x, y, z);
+          if ( obst[i] < 0 || sq[i] >= maxDist_squared ) {
+            if ( bricks[n >> brickCellShift] != unreachedBrick ) {
+              cellRef(n) = unreached;
+            }
+            continue;
+          }
+          dataCell& c = cellRef(n);
+          int o = obst[i];
+          c.obstX = o/strideX;
+          c.obstY = (o%strideX)/strideY;
+          c.obstZ = o%strideY;
+          c.sqdist = sq[i];
+          if ( updateRealDist ) {
+            c.dist = sqrt((double) sq[i]);
+          }
+          c.queueing = fwProcessed;
+          c.needsRaise = false;
+        }
+      }
     }
   }
 }
@@ -387,11 +680,11 @@ void DynamicEDT3D::raiseCell( INTPOINT3D &p, dataCell &c, bool updateRealDist )
   c.queueing = bwProcessed;
 }
 
-void DynamicEDT3D::inspectCellRaise( int &nx, int &ny, int &nz, bool updateRealDist )
+void DynamicEDT3D::inspectCellRaise( int &nx, int &ny, int &nz, size_t n, bool updateRealDist )
 {
-  dataCell nc = data[nx][ny][nz];
+  dataCell nc = cellAt(n);
   if ( nc.obstX!=invalidObstData && !nc.needsRaise ) {
-    if( !isOccupied(nc.obstX, nc.obstY, nc.obstZ, data[nc.obstX][nc.obstY][nc.obstZ]) ) {
+    if( !isOccupied(nc.obstX, nc.obstY, nc.obstZ, cellAt(cellIndex(nc.obstX, nc.obstY, nc.obstZ))) ) {
       open.push(nc.sqdist, INTPOINT3D(nx, ny, nz));
       nc.queueing = fwQueued;
       nc.needsRaise = true;
@@ -402,12 +695,12 @@ void DynamicEDT3D::inspectCellRaise( int &nx, int &ny, int &nz, bool updateRealD
         nc.dist = maxDist;
       }
       nc.sqdist = maxDist_squared;
-      data[nx][ny][nz] = nc;
+      cellRef(n) = nc;
     } else {
       if( nc.queueing != fwQueued ){
         open.push(nc.sqdist, INTPOINT3D(nx, ny, nz));
         nc.queueing = fwQueued;
-        data[nx][ny][nz] = nc;
+        cellRef(n) = nc;
       }
     }
   }
@@ -455,63 +748,63 @@ void DynamicEDT3D::propagateCell(INTPOINT3D &p, dataCell &c, bool updateRealDist
     //    dpz=0;
     
     
-    if( dpz >=0 && z<sizeZm1 ) inspectCellPropagate(x, y, zp1, c, updateRealDist);
-    if( dpz <=0 && z>0 )       inspectCellPropagate(x, y, zm1, c, updateRealDist);
+    if( dpz >=0 && z<sizeZm1 ) inspectCellPropagate(x, y, zp1, cellIndex(x, y, zp1), c, updateRealDist);
+    if( dpz <=0 && z>0 )       inspectCellPropagate(x, y, zm1, cellIndex(x, y, zm1), c, updateRealDist);
     
     if( dpy>=0 && y<sizeYm1 ){
-      inspectCellPropagate(x, yp1, z, c, updateRealDist);
-      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(x, yp1, zp1, c, updateRealDist);
-      if(dpz <=0 && z>0)       inspectCellPropagate(x, yp1, zm1, c, updateRealDist);
+      inspectCellPropagate(x, yp1, z, cellIndex(x, yp1, z), c, updateRealDist);
+      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(x, yp1, zp1, cellIndex(x, yp1, zp1), c, updateRealDist);
+      if(dpz <=0 && z>0)       inspectCellPropagate(x, yp1, zm1, cellIndex(x, yp1, zm1), c, updateRealDist);
     }
     
     if( dpy<=0 && y>0 ){
-      inspectCellPropagate(x, ym1, z, c, updateRealDist);
-      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(x, ym1, zp1, c, updateRealDist);
-      if(dpz <=0 && z>0)       inspectCellPropagate(x, ym1, zm1, c, updateRealDist);
+      inspectCellPropagate(x, ym1, z, cellIndex(x, ym1, z), c, updateRealDist);
+      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(x, ym1, zp1, cellIndex(x, ym1, zp1), c, updateRealDist);
+      if(dpz <=0 && z>0)       inspectCellPropagate(x, ym1, zm1, cellIndex(x, ym1, zm1), c, updateRealDist);
     }
     
     
     if( dpx>=0 && x<sizeXm1 ){
-      inspectCellPropagate(xp1, y, z, c, updateRealDist);
-      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, y, zp1, c, updateRealDist);
-      if(dpz <=0 && z>0)       inspectCellPropagate(xp1, y, zm1, c, updateRealDist);
+      inspectCellPropagate(xp1, y, z, cellIndex(xp1, y, z), c, updateRealDist);
+      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, y, zp1, cellIndex(xp1, y, zp1), c, updateRealDist);
+      if(dpz <=0 && z>0)       inspectCellPropagate(xp1, y, zm1, cellIndex(xp1, y, zm1), c, updateRealDist);
       
       if( dpy>=0 && y<sizeYm1 ){
-        inspectCellPropagate(xp1, yp1, z, c, updateRealDist);
-        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, yp1, zp1, c, updateRealDist);
-        if(dpz <=0 && z>0)       inspectCellPropagate(xp1, yp1, zm1, c, updateRealDist);
+        inspectCellPropagate(xp1, yp1, z, cellIndex(xp1, yp1, z), c, updateRealDist);
+        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, yp1, zp1, cellIndex(xp1, yp1, zp1), c, updateRealDist);
+        if(dpz <=0 && z>0)       inspectCellPropagate(xp1, yp1, zm1, cellIndex(xp1, yp1, zm1), c, updateRealDist);
       }
       
       if( dpy<=0 && y>0 ){
-        inspectCellPropagate(xp1, ym1, z, c, updateRealDist);
-        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, ym1, zp1, c, updateRealDist);
-        if(dpz <=0 && z>0)       inspectCellPropagate(xp1, ym1, zm1, c, updateRealDist);
+        inspectCellPropagate(xp1, ym1, z, cellIndex(xp1, ym1, z), c, updateRealDist);
+        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xp1, ym1, zp1, cellIndex(xp1, ym1, zp1), c, updateRealDist);
+        if(dpz <=0 && z>0)       inspectCellPropagate(xp1, ym1, zm1, cellIndex(xp1, ym1, zm1), c, updateRealDist);
       }
     }
     
     if( dpx<=0 && x>0 ){
-      inspectCellPropagate(xm1, y, z, c, updateRealDist);
-      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, y, zp1, c, updateRealDist);
-      if(dpz <=0 && z>0)       inspectCellPropagate(xm1, y, zm1, c, updateRealDist);
+      inspectCellPropagate(xm1, y, z, cellIndex(xm1, y, z), c, updateRealDist);
+      if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, y, zp1, cellIndex(xm1, y, zp1), c, updateRealDist);
+      if(dpz <=0 && z>0)       inspectCellPropagate(xm1, y, zm1, cellIndex(xm1, y, zm1), c, updateRealDist);
       
       if( dpy>=0 && y<sizeYm1 ){
-        inspectCellPropagate(xm1, yp1, z, c, updateRealDist);
-        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, yp1, zp1, c, updateRealDist);
-        if(dpz <=0 && z>0)       inspectCellPropagate(xm1, yp1, zm1, c, updateRealDist);
+        inspectCellPropagate(xm1, yp1, z, cellIndex(xm1, yp1, z), c, updateRealDist);
+        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, yp1, zp1, cellIndex(xm1, yp1, zp1), c, updateRealDist);
+        if(dpz <=0 && z>0)       inspectCellPropagate(xm1, yp1, zm1, cellIndex(xm1, yp1, zm1), c, updateRealDist);
       }
       
       if( dpy<=0 && y>0 ){
-        inspectCellPropagate(xm1, ym1, z, c, updateRealDist);
-        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, ym1, zp1, c, updateRealDist);
-        if(dpz <=0 && z>0)       inspectCellPropagate(xm1, ym1, zm1, c, updateRealDist);
+        inspectCellPropagate(xm1, ym1, z, cellIndex(xm1, ym1, z), c, updateRealDist);
+        if(dpz >=0 && z<sizeZm1) inspectCellPropagate(xm1, ym1, zp1, cellIndex(xm1, ym1, zp1), c, updateRealDist);
+        if(dpz <=0 && z>0)       inspectCellPropagate(xm1, ym1, zm1, cellIndex(xm1, ym1, zm1), c, updateRealDist);
       }
     }
   }
 }
 
-void DynamicEDT3D::inspectCellPropagate( int &nx, int &ny, int &nz, dataCell &c, bool updateRealDist )
+void DynamicEDT3D::inspectCellPropagate( int &nx, int &ny, int &nz, size_t n, dataCell &c, bool updateRealDist )
 {
-  dataCell nc = data[nx][ny][nz];
+  dataCell nc = cellAt(n);
   if( !nc.needsRaise ) {
     int distx = nx-c.obstX;
     int disty = ny-c.obstY;
@@ -527,7 +820,7 @@ void DynamicEDT3D::inspectCellPropagate( int &nx, int &ny, int &nz, dataCell &c,
         overwrite = true;
       } else {
         //the neighbor has no valid source obstacle but the raise wave has not yet reached it
-        dataCell tmp = data[nc.obstX][nc.obstY][nc.obstZ];
+        dataCell tmp = cellAt(cellIndex(nc.obstX, nc.obstY, nc.obstZ));
         
         if( (tmp.obstX==nc.obstX && tmp.obstY==nc.obstY && tmp.obstZ==nc.obstZ)==false )
           overwrite = true;
@@ -545,8 +838,8 @@ void DynamicEDT3D::inspectCellPropagate( int &nx, int &ny, int &nz, dataCell &c,
       nc.obstX = c.obstX;
       nc.obstY = c.obstY;
       nc.obstZ = c.obstZ;
+      cellRef(n) = nc;
     }
-    data[nx][ny][nz] = nc;
   }
 }
 
@@ -554,7 +847,7 @@ void DynamicEDT3D::inspectCellPropagate( int &nx, int &ny, int &nz, dataCell &c,
 float DynamicEDT3D::getDistance( int x, int y, int z ) const
 {
   if( (x>=0) && (x<sizeX) && (y>=0) && (y<sizeY) && (z>=0) && (z<sizeZ)){
-    return data[x][y][z].dist;
+    return cellAt(cellIndex(x, y, z)).dist;
   }
   else return distanceValue_Error;
 }
@@ -562,7 +855,7 @@ float DynamicEDT3D::getDistance( int x, int y, int z ) const
 INTPOINT3D DynamicEDT3D::getClosestObstacle( int x, int y, int z ) const
 {
   if( (x>=0) && (x<sizeX) && (y>=0) && (y<sizeY) && (z>=0) && (z<sizeZ)){
-    dataCell c = data[x][y][z];
+    dataCell c = cellAt(cellIndex(x, y, z));
     return INTPOINT3D(c.obstX, c.obstY, c.obstZ);
   } else {
     return INTPOINT3D(invalidObstData, invalidObstData, invalidObstData);
@@ -572,7 +865,7 @@ INTPOINT3D DynamicEDT3D::getClosestObstacle( int x, int y, int z ) const
 int DynamicEDT3D::getSQCellDistance( int x, int y, int z ) const
 {
   if( (x>=0) && (x<sizeX) && (y>=0) && (y<sizeY) && (z>=0) && (z<sizeZ)){
-    return data[x][y][z].sqdist;
+    return cellAt(cellIndex(x, y, z)).sqdist;
   }
   else {
     return distanceInCellsValue_Error;
@@ -587,7 +880,7 @@ void DynamicEDT3D::commitAndColorize( bool updateRealDist ) {
     int x = p.x;
     int y = p.y;
     int z = p.z;
-    dataCell c = data[x][y][z];
+    dataCell c = cellAt(cellIndex(x, y, z));
     
     if( c.queueing != fwQueued ){
       if ( updateRealDist ) {
@@ -598,7 +891,7 @@ void DynamicEDT3D::commitAndColorize( bool updateRealDist ) {
       c.obstY = y;
       c.obstZ = z;
       c.queueing = fwQueued;
-      data[x][y][z] = c;
+      cellRef(cellIndex(x, y, z)) = c;
       open.push(0, INTPOINT3D(x,y,z));
     }
   }
@@ -609,7 +902,7 @@ void DynamicEDT3D::commitAndColorize( bool updateRealDist ) {
     int x = p.x;
     int y = p.y;
     int z = p.z;
-    dataCell c = data[x][y][z];
+    dataCell c = cellAt(cellIndex(x, y, z));
     
     if ( isOccupied(x,y,z,c)==true ) {
       continue; // obstacle was removed and reinserted
@@ -620,7 +913,7 @@ void DynamicEDT3D::commitAndColorize( bool updateRealDist ) {
     }
     c.sqdist = maxDist_squared;
     c.needsRaise = true;
-    data[x][y][z] = c;
+    cellRef(cellIndex(x, y, z)) = c;
   }
   removeList.clear();
   addList.clear();
@@ -628,11 +921,11 @@ void DynamicEDT3D::commitAndColorize( bool updateRealDist ) {
 
 bool DynamicEDT3D::isOccupied( int x, int y, int z ) const
 {
-  dataCell c = data[x][y][z];
+  dataCell c = cellAt(cellIndex(x, y, z));
   return (c.obstX==x && c.obstY==y && c.obstZ==z);
 }
 
-bool DynamicEDT3D::isOccupied( int &x, int &y, int &z, dataCell &c )
+bool DynamicEDT3D::isOccupied( int &x, int &y, int &z, const dataCell &c )
 { 
   return (c.obstX==x && c.obstY==y && c.obstZ==z);
 }
@@ -29,14 +29,17 @@
 
 #include "squirrel_3d_mapping/DynamicEDTOctomap.h"
 
+#include <algorithm>
+#include <limits>
+
 namespace squirrel_3d_mapping {
 
 float DynamicEDTOctomap::distanceValue_Error = -1.0;
 int DynamicEDTOctomap::distanceInCellsValue_Error = -1;
 
 DynamicEDTOctomap::DynamicEDTOctomap( float maxdist, octomap::OcTree* _octree, octomap::point3d bbxMin,
-                                      octomap::point3d bbxMax, bool treatUnknownAsOccupied) :
-    DynamicEDT3D(((int) (maxdist/_octree->getResolution()+1)*((int) (maxdist/_octree->getResolution()+1)))),
+                                      octomap::point3d bbxMax, bool treatUnknownAsOccupied, bool sparse) :
+    DynamicEDT3D(((int) (maxdist/_octree->getResolution()+1)*((int) (maxdist/_octree->getResolution()+1))), sparse),
     octree(_octree),
     unknownOccupied(treatUnknownAsOccupied)
 {
@@ -78,6 +81,93 @@ void DynamicEDTOctomap::update( bool updateRealDist )
   DynamicEDT3D::update(updateRealDist);
 }
 
+bool DynamicEDTOctomap::recenter( const octomap::point3d& p )
+{
+  octomap::OcTreeKey key;
+  if ( !octree->coordToKeyChecked(p, key) ) {
+    return false;
+  }
+  
+  // the box stays inside of the key range of the octree
+  const int maxKeyValue = std::numeric_limits<octomap::key_type>::max();
+  int dx = int(key[0]) - sizeX/2 - int(boundingBoxMinKey[0]);
+  int dy = int(key[1]) - sizeY/2 - int(boundingBoxMinKey[1]);
+  dx = std::max(-int(boundingBoxMinKey[0]), std::min(dx, maxKeyValue - int(boundingBoxMaxKey[0])));
+  dy = std::max(-int(boundingBoxMinKey[1]), std::min(dy, maxKeyValue - int(boundingBoxMaxKey[1])));
+  
+  INTPOINT3D shift = shiftMap(dx, dy);
+  if ( shift.x == 0 && shift.y == 0 ) {
+    return false;
+  }
+  boundingBoxMinKey[0] += shift.x;
+  boundingBoxMinKey[1] += shift.y;
+  boundingBoxMaxKey[0] += shift.x;
+  boundingBoxMaxKey[1] += shift.y;
+  offsetX = -boundingBoxMinKey[0];
+  offsetY = -boundingBoxMinKey[1];
+  
+  // only the exposed strips along x and y need the occupancy of the octree
+  if ( shift.x != 0 ) {
+    octomap::OcTreeKey min = boundingBoxMinKey, max = boundingBoxMaxKey;
+    if ( shift.x > 0 ) {
+      min[0] = std::max(int(boundingBoxMinKey[0]), int(boundingBoxMaxKey[0]) + 1 - shift.x);
+    } else {
+      max[0] = std::min(int(boundingBoxMaxKey[0]), int(boundingBoxMinKey[0]) - 1 - shift.x);
+    }
+    insertOccupiedCells(min, max);
+  }
+  if ( shift.y != 0 ) {
+    octomap::OcTreeKey min = boundingBoxMinKey, max = boundingBoxMaxKey;
+    if ( shift.y > 0 ) {
+      min[1] = std::max(int(boundingBoxMinKey[1]), int(boundingBoxMaxKey[1]) + 1 - shift.y);
+    } else {
+      max[1] = std::min(int(boundingBoxMaxKey[1]), int(boundingBoxMinKey[1]) - 1 - shift.y);
+    }
+    insertOccupiedCells(min, max);
+  }
+  return true;
+}
+
+void DynamicEDTOctomap::insertOccupiedCells( const octomap::OcTreeKey& min, const octomap::OcTreeKey& max )
+{
+  if ( unknownOccupied ) {
+    octomap::OcTreeKey key;
+    for (int x=min[0]; x<=max[0]; x++) {
+      key[0] = x;
+      for (int y=min[1]; y<=max[1]; y++) {
+        key[1] = y;
+        for (int z=min[2]; z<=max[2]; z++) {
+          key[2] = z;
+          octomap::OcTreeNode* node = octree->search(key);
+          if ( !node || octree->isNodeOccupied(node) ) {
+            setObstacle(key[0]+offsetX, key[1]+offsetY, key[2]+offsetZ);
+          }
+        }
+      }
+    }
+    return;
+  }
+  
+  // the cells of the occupied leafs clipped to the box
+  for (octomap::OcTree::leaf_bbx_iterator it = octree->begin_leafs_bbx(min, max), end=octree->end_leafs_bbx(); it!= end; ++it) {
+    if ( !octree->isNodeOccupied(*it) ) {
+      continue;
+    }
+    int cubeSize = 1 << (treeDepth - it.getDepth());
+    octomap::OcTreeKey key = it.getIndexKey();
+    int x0 = std::max(int(key[0]), int(min[0])), x1 = std::min(int(key[0]) + cubeSize - 1, int(max[0]));
+    int y0 = std::max(int(key[1]), int(min[1])), y1 = std::min(int(key[1]) + cubeSize - 1, int(max[1]));
+    int z0 = std::max(int(key[2]), int(min[2])), z1 = std::min(int(key[2]) + cubeSize - 1, int(max[2]));
+    for (int x=x0; x<=x1; x++) {
+      for (int y=y0; y<=y1; y++) {
+        for (int z=z0; z<=z1; z++) {
+          setObstacle(x+offsetX, y+offsetY, z+offsetZ);
+        }
+      }
+    }
+  }
+}
+
 void DynamicEDTOctomap::initializeOcTree( octomap::point3d bbxMin, octomap::point3d bbxMax )
 {  
   boundingBoxMinKey = octree->coordToKey(bbxMin);
@@ -181,7 +271,7 @@ void DynamicEDTOctomap::insertMaxDepthLeafAtInitialize( octomap::OcTreeKey key )
     c.dist = 0.0;
     c.queueing = fwProcessed;
     c.needsRaise = false;
-    data[x][y][z] = c;
+    cellRef(cellIndex(x, y, z)) = c;
   } else {
     setObstacle(key[0]+offsetX, key[1]+offsetY, key[2]+offsetZ);
   }
@@ -219,7 +309,7 @@ void DynamicEDTOctomap::getDistanceAndClosestObstacle( const octomap::point3d& p
   int x,y,z;
   worldToMap(p, x, y, z);
   if ( x>=0 && x<sizeX && y>=0 && y<sizeY && z>=0 && z<sizeZ ) {
-    dataCell c= data[x][y][z];
+    dataCell c= cellAt(cellIndex(x, y, z));
     
     distance = c.dist*treeResolution;
     if( c.obstX != invalidObstData ) {
@@ -238,7 +328,7 @@ void DynamicEDTOctomap::getDistanceAndClosestObstacle_unsafe( const octomap::poi
   int x,y,z;
   worldToMap(p, x, y, z);
   
-  dataCell c= data[x][y][z];
+  dataCell c= cellAt(cellIndex(x, y, z));
   
   distance = c.dist*treeResolution;
   if ( c.obstX != invalidObstData ){
@@ -255,7 +345,7 @@ float DynamicEDTOctomap::getDistance(const octomap::point3d& p) const {
   // std::cout << "worldToMap: " << x << " " << y << " " << z << std::endl;
   // std::cout << "size" << sizeX << " " << sizeY << " " << sizeZ << std::endl; 
   if(x>=0 && x<sizeX && y>=0 && y<sizeY && z>=0 && z<sizeZ){
-    return data[x][y][z].dist*treeResolution;
+    return cellAt(cellIndex(x, y, z)).dist*treeResolution;
   } else {
     return distanceValue_Error;
   }
@@ -265,7 +355,7 @@ float DynamicEDTOctomap::getDistance_unsafe( const octomap::point3d& p ) const
 {
   int x,y,z;
   worldToMap(p, x, y, z);
-  return data[x][y][z].dist*treeResolution;
+  return cellAt(cellIndex(x, y, z)).dist*treeResolution;
 }
 
 float DynamicEDTOctomap::getDistance( const octomap::OcTreeKey& k ) const
@@ -275,7 +365,7 @@ float DynamicEDTOctomap::getDistance( const octomap::OcTreeKey& k ) const
   int z = k[2] + offsetZ;
   
   if( x>=0 && x<sizeX && y>=0 && y<sizeY && z>=0 && z<sizeZ ) {
-    return data[x][y][z].dist*treeResolution;
+    return cellAt(cellIndex(x, y, z)).dist*treeResolution;
   } else {
     return distanceValue_Error;
   }
@@ -288,7 +378,7 @@ float DynamicEDTOctomap::getDistance_unsafe( const octomap::OcTreeKey& k ) const
   int y = k[1] + offsetY;
   int z = k[2] + offsetZ;
   
-  return data[x][y][z].dist*treeResolution;
+  return cellAt(cellIndex(x, y, z)).dist*treeResolution;
 }
 
 
@@ -297,7 +387,7 @@ int DynamicEDTOctomap::getSquaredDistanceInCells( const octomap::point3d& p ) co
   int x,y,z;
   worldToMap(p, x, y, z);
   if( x>=0 && x<sizeX && y>=0 && y<sizeY && z>=0 && z<sizeZ ) {
-    return data[x][y][z].sqdist;
+    return cellAt(cellIndex(x, y, z)).sqdist;
   } else {
     return distanceInCellsValue_Error;
   }
@@ -307,7 +397,7 @@ int DynamicEDTOctomap::getSquaredDistanceInCells_unsafe( const octomap::point3d&
 {
   int x,y,z;
   worldToMap(p, x, y, z);
-  return data[x][y][z].sqdist;
+  return cellAt(cellIndex(x, y, z)).sqdist;
 }
 
 
@@ -0,0 +1,307 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_3d_mapping/MapMerger.h"
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace octomap;
+
+namespace squirrel_3d_mapping {
+
+MapMerger::MapMerger(OcTree& tree, int threads) :
+  m_tree(tree),
+  m_threads(std::max(1, threads)),
+  m_treeDepth(tree.getTreeDepth()),
+  m_treeMaxKey(1 << tree.getTreeDepth()),
+  m_minLogOdds(tree.getClampingThresMinLog()),
+  m_maxLogOdds(tree.getClampingThresMaxLog()),
+  m_sourceResolution(tree.getResolution()),
+  m_aligned(true)
+{
+  m_offset.setIdentity();
+  m_shift[0] = m_shift[1] = m_shift[2] = 0;
+}
+
+size_t MapMerger::merge(const OcTree& source, const tf::Transform& offset, bool replace){
+  const OcTreeNode* root = source.getRoot();
+  if (!root)
+    return 0;
+  setOffset(offset, source.getResolution());
+
+  // boxes of the remote octant i for the local octant j at 8 * i + j
+  std::vector<Boxes> boxes(64);
+  size_t leafs = 0;
+  if (!source.nodeHasChildren(root)){
+    addLeaf(OcTreeKey(0, 0, 0), 0, root->getLogOdds(), m_sourceResolution, &boxes[0]);
+    leafs = 1;
+  } else {
+    const unsigned half = 1 << (m_treeDepth - 1);
+    #pragma omp parallel for num_threads(m_threads) schedule(dynamic) reduction(+:leafs)
+    for (int i = 0; i < 8; ++i){
+      if (!source.nodeChildExists(root, i))
+        continue;
+      OcTreeKey key((i & 1) ? half : 0, (i & 2) ? half : 0, (i & 4) ? half : 0);
+      leafs += collect(source, source.getNodeChild(root, i), key, 1, &boxes[8 * i]);
+    }
+  }
+
+  if (fuse(boxes, replace))
+    m_tree.prune();
+  return leafs;
+}
+
+size_t MapMerger::merge(const OctomapChangeSet& changes, const tf::Transform& offset){
+  if (changes.occupancy.size() * 8 < changes.num_changes)
+    return 0;
+  setOffset(offset, changes.resolution);
+
+  const bool logOdds = changes.log_odds.size() == changes.num_changes;
+  std::vector<Boxes> boxes(8);
+  size_t pos = 0;
+  uint64_t key = 0;
+  uint32_t i = 0;
+  for (; i < changes.num_changes; ++i){
+    uint64_t delta;
+    if (!readVarint(changes.keys, pos, delta))
+      break;
+    key += delta;
+    float value;
+    if (logOdds)
+      value = changes.log_odds[i];
+    else
+      value = (changes.occupancy[i / 8] >> (i % 8)) & 1 ? m_maxLogOdds : m_minLogOdds;
+    addLeaf(linearKeyToKey(key), m_treeDepth, value, changes.resolution, &boxes[0]);
+  }
+
+  fuse(boxes, true);
+  return i;
+}
+
+void MapMerger::setOffset(const tf::Transform& offset, double resolution){
+  m_offset = offset;
+  m_sourceResolution = resolution;
+  m_aligned = std::fabs(resolution - m_tree.getResolution()) < 1e-9;
+  const tf::Matrix3x3& basis = offset.getBasis();
+  for (unsigned r = 0; r < 3; ++r)
+    for (unsigned c = 0; c < 3; ++c)
+      if (std::fabs(basis[r][c] - (r == c ? 1.0 : 0.0)) > 1e-9)
+        m_aligned = false;
+  for (unsigned a = 0; a < 3; ++a){
+    const double shift = offset.getOrigin()[a] / resolution;
+    m_shift[a] = int(std::floor(shift + 0.5));
+    if (std::fabs(shift - m_shift[a]) > 1e-3)
+      m_aligned = false;
+  }
+}
+
+size_t MapMerger::collect(const OcTree& source, const OcTreeNode* node, const OcTreeKey& key, unsigned depth, Boxes* octants) const {
+  if (!source.nodeHasChildren(node)){
+    addLeaf(key, depth, node->getLogOdds(), m_sourceResolution, octants);
+    return 1;
+  }
+  const unsigned half = 1 << (m_treeDepth - depth - 1);
+  size_t leafs = 0;
+  for (unsigned i = 0; i < 8; ++i){
+    if (!source.nodeChildExists(node, i))
+      continue;
+    OcTreeKey childKey(key[0] + ((i & 1) ? half : 0), key[1] + ((i & 2) ? half : 0), key[2] + ((i & 4) ? half : 0));
+    leafs += collect(source, source.getNodeChild(node, i), childKey, depth + 1, octants);
+  }
+  return leafs;
+}
+
+void MapMerger::addLeaf(const OcTreeKey& key, unsigned depth, float logOdds, double resolution, Boxes* octants) const {
+  const int size = 1 << (m_treeDepth - depth);
+  Box box;
+  box.logOdds = logOdds;
+  if (m_aligned){
+    for (unsigned a = 0; a < 3; ++a){
+      box.min[a] = (key[a] & ~(size - 1)) + m_shift[a];
+      box.max[a] = box.min[a] + size;
+    }
+    addBox(box, octants);
+    return;
+  }
+
+  // nearest voxel of the center of each remote voxel
+  const int center = m_treeMaxKey / 2;
+  const int x0 = key[0] & ~(size - 1), y0 = key[1] & ~(size - 1), z0 = key[2] & ~(size - 1);
+  for (int x = x0; x < x0 + size; ++x)
+    for (int y = y0; y < y0 + size; ++y)
+      for (int z = z0; z < z0 + size; ++z){
+        tf::Vector3 p = m_offset * tf::Vector3((x - center + 0.5) * resolution, (y - center + 0.5) * resolution, (z - center + 0.5) * resolution);
+        OcTreeKey k;
+        if (!m_tree.coordToKeyChecked(point3d(p.x(), p.y(), p.z()), k))
+          continue;
+        for (unsigned a = 0; a < 3; ++a){
+          box.min[a] = k[a];
+          box.max[a] = k[a] + 1;
+        }
+        addBox(box, octants);
+      }
+}
+
+void MapMerger::addBox(const Box& box, Boxes* octants) const {
+  const int half = m_treeMaxKey / 2;
+  for (unsigned j = 0; j < 8; ++j){
+    Box clipped = box;
+    bool empty = false;
+    for (unsigned a = 0; a < 3; ++a){
+      const int min = ((j >> a) & 1) * half;
+      clipped.min[a] = std::max(box.min[a], min);
+      clipped.max[a] = std::min(box.max[a], min + half);
+      empty = empty || clipped.min[a] >= clipped.max[a];
+    }
+    if (!empty)
+      octants[j].push_back(clipped);
+  }
+}
+
+bool MapMerger::fuse(const std::vector<Boxes>& boxes, bool replace){
+  const unsigned sources = boxes.size() / 8;
+  bool needed[8];
+  bool any = false;
+  for (unsigned j = 0; j < 8; ++j){
+    needed[j] = false;
+    for (unsigned s = 0; s < sources; ++s)
+      needed[j] = needed[j] || !boxes[8 * s + j].empty();
+    any = any || needed[j];
+  }
+  if (!any)
+    return false;
+
+  bool rootFresh = false;
+  if (!m_tree.getRoot()){
+    // the root can only be created through an update, drop the path it adds
+    m_tree.updateNode(OcTreeKey(0, 0, 0), 0.0f, true);
+    OcTreeNode* root = m_tree.getRoot();
+    for (unsigned i = 0; i < 8; ++i)
+      if (m_tree.nodeChildExists(root, i))
+        m_tree.deleteNodeChild(root, i);
+    rootFresh = true;
+  }
+  OcTreeNode* root = m_tree.getRoot();
+  if (!rootFresh && !m_tree.nodeHasChildren(root))
+    m_tree.expandNode(root);
+
+  // the children of the root are created up front, each task then changes
+  // only the subtree of its octant
+  OcTreeNode* octants[8];
+  bool fresh[8];
+  for (unsigned j = 0; j < 8; ++j){
+    octants[j] = NULL;
+    fresh[j] = false;
+    if (!needed[j])
+      continue;
+    fresh[j] = !m_tree.nodeChildExists(root, j);
+    octants[j] = fresh[j] ? m_tree.createNodeChild(root, j) : m_tree.getNodeChild(root, j);
+  }
+
+  const unsigned half = 1 << (m_treeDepth - 1);
+  #pragma omp parallel for num_threads(m_threads) schedule(dynamic)
+  for (int j = 0; j < 8; ++j){
+    if (!octants[j])
+      continue;
+    OcTreeKey key((j & 1) ? half : 0, (j & 2) ? half : 0, (j & 4) ? half : 0);
+    bool isFresh = fresh[j];
+    for (unsigned s = 0; s < sources; ++s){
+      const Boxes& octant = boxes[8 * s + j];
+      for (size_t b = 0; b < octant.size(); ++b){
+        fuseBox(octants[j], key, 1, octant[b], isFresh, replace);
+        isFresh = false;
+      }
+    }
+  }
+
+  m_tree.updateInnerOccupancy();
+  return true;
+}
+
+void MapMerger::fuseBox(OcTreeNode* node, const OcTreeKey& key, unsigned depth, const Box& box, bool fresh, bool replace){
+  const int size = 1 << (m_treeDepth - depth);
+  bool covered = true;
+  for (unsigned a = 0; a < 3; ++a)
+    covered = covered && box.min[a] <= key[a] && key[a] + size <= box.max[a];
+  if (covered){
+    fuseSubtree(node, box.logOdds, fresh, replace);
+    return;
+  }
+
+  // a known leaf keeps its value outside of the box, unknown space stays unknown
+  if (!fresh && !m_tree.nodeHasChildren(node)){
+    #pragma omp critical (map_merger)
+    m_tree.expandNode(node);
+  }
+  const int half = size / 2;
+  for (unsigned i = 0; i < 8; ++i){
+    OcTreeKey childKey(key[0] + ((i & 1) ? half : 0), key[1] + ((i & 2) ? half : 0), key[2] + ((i & 4) ? half : 0));
+    bool overlaps = true;
+    for (unsigned a = 0; a < 3; ++a)
+      overlaps = overlaps && childKey[a] < box.max[a] && childKey[a] + half > box.min[a];
+    if (!overlaps)
+      continue;
+    if (m_tree.nodeChildExists(node, i))
+      fuseBox(m_tree.getNodeChild(node, i), childKey, depth + 1, box, false, replace);
+    else
+      fuseBox(createChild(node, i), childKey, depth + 1, box, true, replace);
+  }
+}
+
+void MapMerger::fuseSubtree(OcTreeNode* node, float logOdds, bool fresh, bool replace){
+  if (!fresh && replace && m_tree.nodeHasChildren(node)){
+    #pragma omp critical (map_merger)
+    for (unsigned i = 0; i < 8; ++i)
+      if (m_tree.nodeChildExists(node, i))
+        m_tree.deleteNodeChild(node, i);
+  }
+  if (fresh || !m_tree.nodeHasChildren(node)){
+    // unknown space fused with logOdds is logOdds
+    const float value = (fresh || replace) ? logOdds : node->getLogOdds() + logOdds;
+    node->setLogOdds(std::min(std::max(value, m_minLogOdds), m_maxLogOdds));
+    return;
+  }
+  for (unsigned i = 0; i < 8; ++i){
+    if (m_tree.nodeChildExists(node, i))
+      fuseSubtree(m_tree.getNodeChild(node, i), logOdds, false, replace);
+    else
+      fuseSubtree(createChild(node, i), logOdds, true, replace);
+  }
+}
+
+OcTreeNode* MapMerger::createChild(OcTreeNode* node, unsigned i){
+  // creating and deleting nodes changes the size of the tree
+  OcTreeNode* child;
+  #pragma omp critical (map_merger)
+  child = m_tree.createNodeChild(node, i);
+  return child;
+}
+
+} // namespace squirrel_3d_mapping
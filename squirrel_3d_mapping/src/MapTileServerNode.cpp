@@ -0,0 +1,225 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <ros/ros.h>
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_msgs/conversions.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <squirrel_3d_mapping/GetMapTiles.h>
+#include <squirrel_3d_mapping/GetOctomapChunks.h>
+#include <squirrel_3d_mapping/MapTiling.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using squirrel_3d_mapping::GetMapTiles;
+using squirrel_3d_mapping::GetOctomapChunks;
+using squirrel_3d_mapping::GridTiles;
+using squirrel_3d_mapping::MapTiles;
+using squirrel_3d_mapping::OctomapChunks;
+using squirrel_3d_mapping::OctreeChunks;
+
+/// Streams 2D grids (projected maps, costmaps) and the octree to remote
+/// clients in tiles (see MapTiling.h). The maps are received in full on the
+/// robot; the tiles that changed are collected and published at most once
+/// per publish_period, and the services return the tiles a client does not
+/// hold yet.
+class MapTileServer{
+public:
+  MapTileServer()
+  {
+    ros::NodeHandle private_nh("~");
+    int defaultTileSize, octreeDepth;
+    double publishPeriod;
+    std::string octomapTopic;
+    std::vector<std::string> mapNames(1, "projected_map");
+    private_nh.param("tile_size", defaultTileSize, 64);
+    private_nh.param("publish_period", publishPeriod, 1.0);
+    private_nh.param("maps/names", mapNames, mapNames);
+    private_nh.param("octomap/topic", octomapTopic, std::string("octomap_binary"));
+    private_nh.param("octomap/depth", octreeDepth, 10);
+
+    for (unsigned i = 0; i < mapNames.size(); ++i){
+      const std::string ns = "maps/" + mapNames[i] + "/";
+      std::string topic;
+      int tileSize;
+      bool subscribeToUpdates;
+      private_nh.param(ns + "topic", topic, mapNames[i]);
+      private_nh.param(ns + "tile_size", tileSize, defaultTileSize);
+      private_nh.param(ns + "subscribe_to_updates", subscribeToUpdates, true);
+      boost::shared_ptr<GridInput> grid(new GridInput(mapNames[i], std::max(1, tileSize)));
+      grid->gridSub = m_nh.subscribe<nav_msgs::OccupancyGrid>(topic, 1, boost::bind(&MapTileServer::gridCallback, this, _1, grid.get()));
+      if (subscribeToUpdates)
+        grid->updatesSub = m_nh.subscribe<map_msgs::OccupancyGridUpdate>(topic + "_updates", 10, boost::bind(&MapTileServer::gridUpdateCallback, this, _1, grid.get()));
+      grid->tilesPub = m_nh.advertise<MapTiles>(topic + "_tiles", 10);
+      m_grids.push_back(grid);
+      ROS_INFO("%s: Map %s from %s in tiles of %d cells", ros::this_node::getName().c_str(), mapNames[i].c_str(), topic.c_str(), tileSize);
+    }
+
+    m_octreeChunks = OctreeChunks(std::max(1, octreeDepth));
+    if (!octomapTopic.empty()){
+      m_octomapSub = m_nh.subscribe(octomapTopic, 1, &MapTileServer::octomapCallback, this);
+      m_octomapChunksPub = m_nh.advertise<OctomapChunks>(octomapTopic + "_chunks", 10);
+      ROS_INFO("%s: Octree from %s in chunks of depth %d", ros::this_node::getName().c_str(), octomapTopic.c_str(), octreeDepth);
+    }
+
+    m_mapTilesService = private_nh.advertiseService("map_tiles", &MapTileServer::mapTilesSrv, this);
+    m_octomapChunksService = private_nh.advertiseService("octomap_chunks", &MapTileServer::octomapChunksSrv, this);
+
+    // with a period of 0 the changes of every input are published at once
+    m_publishOnInput = publishPeriod <= 0.0;
+    if (!m_publishOnInput)
+      m_publishTimer = m_nh.createWallTimer(ros::WallDuration(publishPeriod), &MapTileServer::publishCallback, this);
+  }
+
+private:
+  struct GridInput{
+    GridInput(const std::string& name, unsigned tileSize) : name(name), tiles(tileSize) {}
+
+    std::string name;
+    GridTiles tiles;
+    ros::Subscriber gridSub, updatesSub;
+    ros::Publisher tilesPub;
+  };
+
+  void gridCallback(const nav_msgs::OccupancyGrid::ConstPtr& msg, GridInput* grid){
+    if (!grid->tiles.setGrid(*msg))
+      ROS_WARN("%s: Map %s has %zu cells instead of %ux%u", ros::this_node::getName().c_str(), grid->name.c_str(), msg->data.size(), msg->info.width, msg->info.height);
+    else if (m_publishOnInput)
+      publishGrid(*grid);
+  }
+
+  void gridUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& msg, GridInput* grid){
+    // updates before the first map, or of a replaced one, are dropped
+    if (!grid->tiles.update(*msg))
+      ROS_DEBUG("%s: Dropped an update of map %s outside of it", ros::this_node::getName().c_str(), grid->name.c_str());
+    else if (m_publishOnInput)
+      publishGrid(*grid);
+  }
+
+  void octomapCallback(const octomap_msgs::Octomap::ConstPtr& msg){
+    octomap::AbstractOcTree* tree = octomap_msgs::msgToMap(*msg);
+    octomap::OcTree* octree = dynamic_cast<octomap::OcTree*>(tree);
+    if (!octree){
+      ROS_WARN_THROTTLE(10.0, "%s: Octomap of type %s not supported", ros::this_node::getName().c_str(), msg->id.c_str());
+      delete tree;
+      return;
+    }
+    m_octreeChunks.setTree(*octree);
+    m_octreeHeader = msg->header;
+    delete tree;
+    if (m_publishOnInput)
+      publishOctree();
+  }
+
+  void publishCallback(const ros::WallTimerEvent&){
+    for (unsigned i = 0; i < m_grids.size(); ++i)
+      publishGrid(*m_grids[i]);
+    publishOctree();
+  }
+
+  /// the changed tiles, dropped without subscribers: new clients request the
+  /// tiles they miss
+  void publishGrid(GridInput& grid){
+    if (grid.tiles.getChangedTiles().empty())
+      return;
+    if (grid.tilesPub.getNumSubscribers() > 0){
+      MapTiles msg;
+      grid.tiles.getLayout(msg);
+      msg.map = grid.name;
+      const std::vector<unsigned>& changed = grid.tiles.getChangedTiles();
+      for (unsigned i = 0; i < changed.size(); ++i)
+        grid.tiles.addTile(changed[i], msg);
+      grid.tilesPub.publish(msg);
+    }
+    grid.tiles.clearChanged();
+  }
+
+  void publishOctree(){
+    if (m_octreeChunks.getChangedChunks().empty())
+      return;
+    if (m_octomapChunksPub.getNumSubscribers() > 0){
+      OctomapChunks msg;
+      m_octreeChunks.getLayout(msg);
+      msg.header = m_octreeHeader;
+      const std::set<uint64_t>& changed = m_octreeChunks.getChangedChunks();
+      for (std::set<uint64_t>::const_iterator it = changed.begin(); it != changed.end(); ++it)
+        m_octreeChunks.addChunk(*it, msg);
+      m_octomapChunksPub.publish(msg);
+    }
+    m_octreeChunks.clearChanged();
+  }
+
+  bool mapTilesSrv(GetMapTiles::Request& req, GetMapTiles::Response& res){
+    for (unsigned i = 0; i < m_grids.size(); ++i){
+      const GridInput& grid = *m_grids[i];
+      if (grid.name != req.map)
+        continue;
+      grid.tiles.getLayout(res.tiles);
+      res.tiles.map = grid.name;
+      const octomap::point3d min(req.min.x, req.min.y, req.min.z), max(req.max.x, req.max.y, req.max.z);
+      grid.tiles.addTiles(req.use_bbx, min, max, req.known, res.tiles);
+      res.success = !grid.tiles.empty();
+      return true;
+    }
+    ROS_WARN("%s: No map %s to serve", ros::this_node::getName().c_str(), req.map.c_str());
+    res.success = false;
+    return true;
+  }
+
+  bool octomapChunksSrv(GetOctomapChunks::Request& req, GetOctomapChunks::Response& res){
+    m_octreeChunks.getLayout(res.chunks);
+    res.chunks.header = m_octreeHeader;
+    const octomap::point3d min(req.min.x, req.min.y, req.min.z), max(req.max.x, req.max.y, req.max.z);
+    m_octreeChunks.addChunks(req.use_bbx, min, max, req.known, res.chunks);
+    res.success = !m_octreeChunks.empty();
+    return true;
+  }
+
+  ros::NodeHandle m_nh;
+  std::vector<boost::shared_ptr<GridInput> > m_grids;
+  OctreeChunks m_octreeChunks;
+  std_msgs::Header m_octreeHeader;
+  ros::Subscriber m_octomapSub;
+  ros::Publisher m_octomapChunksPub;
+  ros::ServiceServer m_mapTilesService, m_octomapChunksService;
+  ros::WallTimer m_publishTimer;
+  bool m_publishOnInput;
+};
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "map_tile_server");
+  MapTileServer server;
+  ros::spin();
+  return 0;
+}
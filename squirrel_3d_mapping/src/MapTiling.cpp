@@ -0,0 +1,304 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_3d_mapping/MapTiling.h"
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace octomap;
+
+namespace squirrel_3d_mapping {
+
+namespace {
+
+const uint64_t kFnvOffset = 14695981039346656037ULL;
+const uint64_t kFnvPrime = 1099511628211ULL;
+
+// the linear key of the chunk's node above its depth
+inline uint64_t chunkId(const OcTreeKey& key, unsigned depth) {
+  return (linearKey(key) << 8) | depth;
+}
+
+inline bool sameGeometry(const nav_msgs::MapMetaData& a, const nav_msgs::MapMetaData& b) {
+  return a.width == b.width && a.height == b.height && a.resolution == b.resolution &&
+         a.origin.position.x == b.origin.position.x && a.origin.position.y == b.origin.position.y &&
+         a.origin.position.z == b.origin.position.z && a.origin.orientation.x == b.origin.orientation.x &&
+         a.origin.orientation.y == b.origin.orientation.y && a.origin.orientation.z == b.origin.orientation.z &&
+         a.origin.orientation.w == b.origin.orientation.w;
+}
+
+// cells of the grid, within [0, size), of the coordinates [min, max]
+inline bool cellRange(double min, double max, double origin, double resolution, unsigned size, unsigned& first, unsigned& last) {
+  const double lo = std::floor((min - origin) / resolution), hi = std::floor((max - origin) / resolution);
+  if (hi < 0.0 || lo >= size || hi < lo)
+    return false;
+  first = lo < 0.0 ? 0 : unsigned(lo);
+  last = hi >= size ? size - 1 : unsigned(hi);
+  return true;
+}
+
+} // namespace
+
+uint64_t tileVersion(const uint8_t* data, size_t size) {
+  uint64_t hash = kFnvOffset;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * kFnvPrime;
+  return hash ? hash : 1;
+}
+
+void encodeTileCells(const int8_t* grid, unsigned stride, unsigned x, unsigned y, unsigned width, unsigned height, std::vector<uint8_t>& data) {
+  uint64_t run = 0;
+  int8_t value = 0;
+  for (unsigned j = y; j < y + height; ++j) {
+    const int8_t* row = grid + size_t(j) * stride;
+    for (unsigned i = x; i < x + width; ++i) {
+      if (run > 0 && row[i] == value) {
+        ++run;
+        continue;
+      }
+      if (run > 0) {
+        appendVarint(data, run);
+        data.push_back(uint8_t(value));
+      }
+      value = row[i];
+      run = 1;
+    }
+  }
+  if (run > 0) {
+    appendVarint(data, run);
+    data.push_back(uint8_t(value));
+  }
+}
+
+bool decodeTileCells(const std::vector<uint8_t>& data, size_t numCells, std::vector<int8_t>& cells) {
+  cells.clear();
+  cells.reserve(numCells);
+  size_t pos = 0;
+  while (pos < data.size()) {
+    uint64_t run;
+    if (!readVarint(data, pos, run) || pos >= data.size() || run > numCells - cells.size())
+      return false;
+    cells.insert(cells.end(), size_t(run), int8_t(data[pos++]));
+  }
+  return cells.size() == numCells;
+}
+
+GridTiles::GridTiles(unsigned tileSize)
+  : m_tileSize(std::max(1u, tileSize)), m_numTilesX(0), m_numTilesY(0)
+{
+}
+
+bool GridTiles::setGrid(const nav_msgs::OccupancyGrid& grid) {
+  if (grid.data.size() != size_t(grid.info.width) * grid.info.height)
+    return false;
+  const bool geometryChanged = empty() || !sameGeometry(grid.info, m_grid.info);
+  m_grid = grid;
+  if (geometryChanged) {
+    // the indices of the tiles are no longer the ones of the clients
+    m_numTilesX = (grid.info.width + m_tileSize - 1) / m_tileSize;
+    m_numTilesY = (grid.info.height + m_tileSize - 1) / m_tileSize;
+    m_versions.assign(size_t(m_numTilesX) * m_numTilesY, 0);
+    m_isChanged.assign(m_versions.size(), false);
+    m_changed.clear();
+  }
+  for (unsigned i = 0; i < m_versions.size(); ++i)
+    hashTile(i);
+  return true;
+}
+
+bool GridTiles::update(const map_msgs::OccupancyGridUpdate& update) {
+  if (empty() || update.x < 0 || update.y < 0 || update.x + update.width > m_grid.info.width ||
+      update.y + update.height > m_grid.info.height || update.data.size() != size_t(update.width) * update.height)
+    return false;
+  if (update.width == 0 || update.height == 0)
+    return true;
+
+  const unsigned stride = m_grid.info.width;
+  for (unsigned j = 0; j < update.height; ++j)
+    memcpy(&m_grid.data[size_t(update.y + j) * stride + update.x], &update.data[size_t(j) * update.width], update.width);
+  m_grid.header.stamp = update.header.stamp;
+
+  const unsigned minX = update.x / m_tileSize, maxX = (update.x + update.width - 1) / m_tileSize;
+  const unsigned minY = update.y / m_tileSize, maxY = (update.y + update.height - 1) / m_tileSize;
+  for (unsigned ty = minY; ty <= maxY; ++ty)
+    for (unsigned tx = minX; tx <= maxX; ++tx)
+      hashTile(ty * m_numTilesX + tx);
+  return true;
+}
+
+void GridTiles::clearChanged() {
+  for (unsigned i = 0; i < m_changed.size(); ++i)
+    m_isChanged[m_changed[i]] = false;
+  m_changed.clear();
+}
+
+void GridTiles::getLayout(MapTiles& msg) const {
+  msg.header = m_grid.header;
+  msg.info = m_grid.info;
+  msg.tile_size = m_tileSize;
+  msg.num_tiles_x = m_numTilesX;
+  msg.num_tiles_y = m_numTilesY;
+  msg.tiles.clear();
+}
+
+void GridTiles::addTile(unsigned i, MapTiles& msg) const {
+  MapTile tile;
+  tile.x = i % m_numTilesX;
+  tile.y = i / m_numTilesX;
+  tile.version = m_versions[i];
+  const unsigned x = tile.x * m_tileSize, y = tile.y * m_tileSize;
+  tile.width = std::min(m_tileSize, m_grid.info.width - x);
+  tile.height = std::min(m_tileSize, m_grid.info.height - y);
+  encodeTileCells(&m_grid.data[0], m_grid.info.width, x, y, tile.width, tile.height, tile.data);
+  msg.tiles.push_back(tile);
+}
+
+void GridTiles::addTiles(bool useBbx, const point3d& min, const point3d& max, const std::vector<MapTile>& known, MapTiles& msg) const {
+  if (empty())
+    return;
+  std::vector<uint64_t> knownVersions(m_versions.size(), 0);
+  for (unsigned i = 0; i < known.size(); ++i)
+    if (known[i].x < m_numTilesX && known[i].y < m_numTilesY)
+      knownVersions[known[i].y * m_numTilesX + known[i].x] = known[i].version;
+
+  // the grids of the maps are axis aligned, their orientation is ignored
+  unsigned minX = 0, minY = 0, maxX = m_grid.info.width - 1, maxY = m_grid.info.height - 1;
+  if (useBbx) {
+    const nav_msgs::MapMetaData& info = m_grid.info;
+    if (!cellRange(min.x(), max.x(), info.origin.position.x, info.resolution, info.width, minX, maxX) ||
+        !cellRange(min.y(), max.y(), info.origin.position.y, info.resolution, info.height, minY, maxY))
+      return;
+  }
+  for (unsigned ty = minY / m_tileSize; ty <= maxY / m_tileSize; ++ty)
+    for (unsigned tx = minX / m_tileSize; tx <= maxX / m_tileSize; ++tx) {
+      const unsigned i = ty * m_numTilesX + tx;
+      if (knownVersions[i] != m_versions[i])
+        addTile(i, msg);
+    }
+}
+
+void GridTiles::hashTile(unsigned i) {
+  const unsigned x = (i % m_numTilesX) * m_tileSize, y = (i / m_numTilesX) * m_tileSize;
+  const unsigned width = std::min(m_tileSize, m_grid.info.width - x), height = std::min(m_tileSize, m_grid.info.height - y);
+  m_tileBuffer.resize(size_t(width) * height);
+  for (unsigned j = 0; j < height; ++j)
+    memcpy(&m_tileBuffer[size_t(j) * width], &m_grid.data[size_t(y + j) * m_grid.info.width + x], width);
+  const uint64_t version = tileVersion(m_tileBuffer.empty() ? NULL : &m_tileBuffer[0], m_tileBuffer.size());
+  if (version == m_versions[i])
+    return;
+  m_versions[i] = version;
+  if (!m_isChanged[i]) {
+    m_isChanged[i] = true;
+    m_changed.push_back(i);
+  }
+}
+
+OctreeChunks::OctreeChunks(unsigned depth)
+  : m_depth(depth), m_resolution(0.0)
+{
+}
+
+void OctreeChunks::setTree(const OcTree& tree) {
+  if (tree.getResolution() != m_resolution) {
+    // the keys are no longer the ones of the clients
+    m_chunks.clear();
+    m_changed.clear();
+    m_resolution = tree.getResolution();
+  }
+
+  Entries chunks;
+  listMapChunks(tree, m_depth, m_chunkList);
+  for (unsigned i = 0; i < m_chunkList.size(); ++i) {
+    const MapChunk& chunk = m_chunkList[i];
+    const uint64_t id = chunkId(chunk.key, chunk.depth);
+    Entry& entry = chunks[id];
+    entry.chunk = chunk;
+    if (!encodeMapChunk(tree, chunk, entry.data)) {
+      chunks.erase(id);
+      continue;
+    }
+    entry.version = tileVersion(&entry.data[0], entry.data.size());
+    getMapChunkBounds(tree, chunk, entry.min, entry.max);
+    Entries::const_iterator previous = m_chunks.find(id);
+    if (previous == m_chunks.end() || previous->second.version != entry.version)
+      m_changed.insert(id);
+  }
+  for (Entries::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+    if (!chunks.count(it->first))
+      m_changed.insert(it->first);
+  m_chunks.swap(chunks);
+}
+
+void OctreeChunks::clearChanged() {
+  m_changed.clear();
+}
+
+void OctreeChunks::getLayout(OctomapChunks& msg) const {
+  msg.resolution = m_resolution;
+  msg.depth = m_depth;
+  msg.chunks.clear();
+}
+
+void OctreeChunks::addChunk(uint64_t id, OctomapChunks& msg) const {
+  OctomapChunk chunk;
+  const OcTreeKey key = linearKeyToKey(id >> 8);
+  for (unsigned i = 0; i < 3; ++i)
+    chunk.key[i] = key[i];
+  chunk.depth = id & 0xFF;
+  chunk.version = 0;
+  Entries::const_iterator it = m_chunks.find(id);
+  if (it != m_chunks.end()) {
+    chunk.version = it->second.version;
+    chunk.data = it->second.data;
+  }
+  msg.chunks.push_back(chunk);
+}
+
+void OctreeChunks::addChunks(bool useBbx, const point3d& min, const point3d& max, const std::vector<OctomapChunk>& known, OctomapChunks& msg) const {
+  std::map<uint64_t, uint64_t> knownVersions;
+  for (unsigned i = 0; i < known.size(); ++i) {
+    const uint64_t id = chunkId(OcTreeKey(known[i].key[0], known[i].key[1], known[i].key[2]), known[i].depth);
+    knownVersions[id] = known[i].version;
+    if (!m_chunks.count(id))
+      addChunk(id, msg);
+  }
+  for (Entries::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it) {
+    const Entry& entry = it->second;
+    if (useBbx && (entry.max.x() < min.x() || entry.min.x() > max.x() || entry.max.y() < min.y() ||
+                   entry.min.y() > max.y() || entry.max.z() < min.z() || entry.min.z() > max.z()))
+      continue;
+    std::map<uint64_t, uint64_t>::const_iterator k = knownVersions.find(it->first);
+    if (k == knownVersions.end() || k->second != entry.version)
+      addChunk(it->first, msg);
+  }
+}
+
+} // namespace squirrel_3d_mapping
@@ -0,0 +1,243 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <ros/ros.h>
+#include <octomap/octomap.h>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "squirrel_3d_mapping/OctomapServer.h"
+
+#define USAGE "\nUSAGE: octomap_benchmark <map.bt> [map.bt ...]\n" \
+                "  map.bt: ground truth maps the benchmark clouds are synthesized from\n"
+
+using namespace octomap;
+using namespace squirrel_3d_mapping;
+
+namespace {
+
+struct BenchmarkParams {
+  int poses;
+  int width;
+  int height;
+  double hfov;
+  double vfov;
+  double maxRange;
+  double sensorHeight;
+  double pitch;
+  int collisionQueries;
+  int seed;
+};
+
+double elapsedMs(const ros::WallTime& start){
+  return (ros::WallTime::now() - start).toSec() * 1e3;
+}
+
+double uniform(double min, double max){
+  return min + (max - min) * (rand() / (double) RAND_MAX);
+}
+
+// peak resident set size of the process [MB]
+double peakRss(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss / 1024.0;
+}
+
+// sensor poses at known free cells of the map, looking slightly down
+void samplePoses(const OcTree& map, const BenchmarkParams& params, std::vector<pose6d>& poses){
+  double minX, minY, minZ, maxX, maxY, maxZ;
+  map.getMetricMin(minX, minY, minZ);
+  map.getMetricMax(maxX, maxY, maxZ);
+  poses.clear();
+  for (int attempts = 0; (int) poses.size() < params.poses && attempts < 100 * params.poses; ++attempts){
+    double x = uniform(minX, maxX), y = uniform(minY, maxY);
+    const OcTreeNode* node = map.search(x, y, params.sensorHeight);
+    if (!node || map.isNodeOccupied(node))
+      continue;
+    poses.push_back(pose6d(x, y, params.sensorHeight, 0.0, params.pitch, uniform(-M_PI, M_PI)));
+  }
+}
+
+// depth image of the map as the end points of its rays in the world frame,
+// rays without a hit within the range are dropped like invalid readings
+void synthesizeCloud(const OcTree& map, const pose6d& pose, const BenchmarkParams& params, OctomapServer::PCLPointCloud& cloud){
+  cloud.clear();
+  for (int v = 0; v < params.height; ++v){
+    for (int u = 0; u < params.width; ++u){
+      double a = (u / (params.width - 1.0) - 0.5) * params.hfov;
+      double b = (v / (params.height - 1.0) - 0.5) * params.vfov;
+      point3d direction = pose.rot().rotate(point3d(1.0, tan(a), tan(b)).normalized());
+      point3d end;
+      if (map.castRay(pose.trans(), direction, end, true, params.maxRange))
+        cloud.push_back(pcl::PointXYZ(end.x(), end.y(), end.z()));
+    }
+  }
+}
+
+} // namespace
+
+/// Times the stages of the server on clouds synthesized from a ground truth
+/// map: insertScan, the update of the distance transform, publishAll and
+/// checkCollision, each on its own.
+class OctomapBenchmark : public OctomapServer {
+public:
+  OctomapBenchmark() : OctomapServer() {}
+
+  void run(const OcTree& map, const std::vector<pose6d>& poses, const BenchmarkParams& params){
+    std::vector<PCLPointCloud> clouds(poses.size());
+    for (size_t i = 0; i < poses.size(); ++i)
+      synthesizeCloud(map, poses[i], params, clouds[i]);
+
+    // the distance transform is updated by insertScan, here it is timed on its own
+    const bool edt = edt_dynamicEdt;
+    const PCLPointCloud ground;
+    size_t points = 0, changed = 0;
+    double insertMs = 0.0, edtMs = 0.0, publishMs = 0.0;
+    for (size_t i = 0; i < poses.size(); ++i){
+      ros::WallTime start = ros::WallTime::now();
+      edt_dynamicEdt = false;
+      insertScan(tf::Point(poses[i].x(), poses[i].y(), poses[i].z()), ground, clouds[i]);
+      edt_dynamicEdt = edt;
+      insertMs += elapsedMs(start);
+      points += clouds[i].size();
+
+      if (edt){
+        changed += m_octree->numChangesDetected();
+        start = ros::WallTime::now();
+        edt_distanceTransform->update();
+        edtMs += elapsedMs(start);
+      }
+
+      start = ros::WallTime::now();
+      publishAll(ros::Time::now());
+      publishMs += elapsedMs(start);
+    }
+
+    const size_t scans = std::max((size_t) 1, poses.size());
+    ROS_INFO("%s: insertScan: %zu scans, %zu points, %.0f points/s, %.2f ms/scan", ros::this_node::getName().c_str(),
+             poses.size(), points, points / std::max(1e-9, insertMs * 1e-3), insertMs / scans);
+    ROS_INFO("%s: publishAll: %.2f ms/scan, %zu tree nodes", ros::this_node::getName().c_str(), publishMs / scans, m_octree->size());
+    if (!edt){
+      ROS_INFO("%s: distance transform disabled, no EDT and collision results", ros::this_node::getName().c_str());
+      return;
+    }
+    ROS_INFO("%s: EDT update: %zu changed voxels, %.2f ms/scan, %.4f ms/changed voxel, %.1f MB", ros::this_node::getName().c_str(),
+             changed, edtMs / scans, edtMs / std::max((size_t) 1, changed), edt_distanceTransform->getMemoryUsage() / 1e6);
+
+    // random positions within the box of the distance transform
+    std::vector<std::pair<double, double> > queries(params.collisionQueries);
+    for (size_t i = 0; i < queries.size(); ++i)
+      queries[i] = std::make_pair(uniform(edt_minX, edt_maxX), uniform(edt_minY, edt_maxY));
+
+    squirrel_3d_mapping_msgs::CheckCollision::Request req;
+    squirrel_3d_mapping_msgs::CheckCollision::Response res;
+    size_t collisions = 0, failed = 0;
+    ros::WallTime start = ros::WallTime::now();
+    for (size_t i = 0; i < queries.size(); ++i){
+      req.pose.x = queries[i].first;
+      req.pose.y = queries[i].second;
+      if (!checkCollision(req, res))
+        ++failed;
+      else if (res.collision)
+        ++collisions;
+    }
+    const double queryMs = elapsedMs(start);
+    ROS_INFO("%s: checkCollision: %zu queries, %.0f queries/s, %zu in collision, %zu failed", ros::this_node::getName().c_str(),
+             queries.size(), queries.size() / std::max(1e-9, queryMs * 1e-3), collisions, failed);
+  }
+};
+
+int main(int argc, char** argv){
+  ros::init(argc, argv, "octomap_benchmark");
+  if (argc < 2 || std::string(argv[1]) == "-h"){
+    ROS_ERROR("%s", USAGE);
+    exit(-1);
+  }
+
+  ros::NodeHandle private_nh("~");
+  BenchmarkParams params;
+  private_nh.param("benchmark/poses", params.poses, 100);
+  private_nh.param("benchmark/width", params.width, 160);
+  private_nh.param("benchmark/height", params.height, 120);
+  private_nh.param("benchmark/hfov", params.hfov, 1.01);
+  private_nh.param("benchmark/vfov", params.vfov, 0.79);
+  private_nh.param("benchmark/max_range", params.maxRange, 4.0);
+  private_nh.param("benchmark/sensor_height", params.sensorHeight, 0.8);
+  private_nh.param("benchmark/pitch", params.pitch, 0.3);
+  private_nh.param("benchmark/collision_queries", params.collisionQueries, 100000);
+  private_nh.param("benchmark/seed", params.seed, 1);
+  params.width = std::max(2, params.width);
+  params.height = std::max(2, params.height);
+
+  // the distance transform covers the whole map unless configured otherwise
+  const bool edtConfigured = private_nh.hasParam("distance_transform/enabled");
+  const bool edtBoxConfigured = private_nh.hasParam("distance_transform/min_x");
+
+  for (int i = 1; i < argc; ++i){
+    OcTree map(0.1);
+    if (!map.readBinary(argv[i])){
+      ROS_ERROR("%s: Could not open file %s", ros::this_node::getName().c_str(), argv[i]);
+      continue;
+    }
+
+    // same random poses and queries for every run of a map
+    srand(params.seed);
+    std::vector<pose6d> poses;
+    samplePoses(map, params, poses);
+    ROS_INFO("%s: %s: %zu leafs at %.3f m, %zu poses", ros::this_node::getName().c_str(), argv[i],
+             map.getNumLeafNodes(), map.getResolution(), poses.size());
+
+    private_nh.setParam("resolution", map.getResolution());
+    if (!edtConfigured)
+      private_nh.setParam("distance_transform/enabled", true);
+    if (!edtBoxConfigured){
+      double minX, minY, minZ, maxX, maxY, maxZ;
+      map.getMetricMin(minX, minY, minZ);
+      map.getMetricMax(maxX, maxY, maxZ);
+      private_nh.setParam("distance_transform/min_x", minX);
+      private_nh.setParam("distance_transform/min_y", minY);
+      private_nh.setParam("distance_transform/max_x", maxX);
+      private_nh.setParam("distance_transform/max_y", maxY);
+    }
+
+    {
+      OctomapBenchmark benchmark;
+      benchmark.run(map, poses, params);
+    }
+    ROS_INFO("%s: peak RSS %.1f MB", ros::this_node::getName().c_str(), peakRss());
+  }
+
+  return 0;
+}
@@ -30,14 +30,19 @@
 #include <ros/ros.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
+#include <algorithm>
 #include <fstream>
 
 #include <octomap_msgs/GetOctomap.h>
+#include <squirrel_3d_mapping/ChunkedMap.h>
+#include <squirrel_3d_mapping/CompactOcTree.h>
+#include <squirrel_3d_mapping/GetOctomapChunk.h>
 using octomap_msgs::GetOctomap;
+using squirrel_3d_mapping::GetOctomapChunk;
 
-#define USAGE "\nUSAGE: octomap_saver [-f] <mapfile.[bt|ot]>\n" \
+#define USAGE "\nUSAGE: octomap_saver [-f] <mapfile.[bt|ot|otc|cot]>\n" \
                 "  -f: Query for the full occupancy octree, instead of just the compact binary one\n" \
-		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree)\n"
+		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree, .otc: chunked full octree, .cot: compact tree)\n"
 
 using namespace std;
 using namespace octomap;
@@ -46,6 +51,10 @@ class MapSaver{
 public:
   MapSaver(const std::string& mapname, bool full){
     ros::NodeHandle n;
+    if (mapname.length() > 4 && mapname.substr(mapname.length()-4, 4) == ".otc"){
+      saveChunks(mapname);
+      return;
+    }
     std::string servname = "octomap_binary";
     if (full)
       servname = "octomap_full";
@@ -70,7 +79,20 @@ public:
         ROS_INFO("Map received (%zu nodes, %f m res), saving to %s", octree->size(), octree->getResolution(), mapname.c_str());
         
         std::string suffix = mapname.substr(mapname.length()-3, 3);
-        if (suffix== ".bt"){ // write to binary file:
+        OcTree* ocTree = dynamic_cast<OcTree*>(octree);
+        if (mapname.length() > 4 && mapname.substr(mapname.length()-4, 4) == ".cot"){ // write to compact file:
+          if (!ocTree){
+            ROS_ERROR("Only OcTree maps can be saved as compact trees");
+          } else{
+            squirrel_3d_mapping::CompactOcTree compactTree(ocTree->getResolution());
+            compactTree.fromOcTree(*ocTree);
+            ROS_INFO("Compact tree: %zu of %zu bytes in memory (%.1f%%)", compactTree.memoryUsage(), ocTree->memoryUsage(),
+                     100.0 * compactTree.memoryUsage() / std::max<size_t>(ocTree->memoryUsage(), 1));
+            if (!compactTree.writeBinary(mapname)){
+              ROS_ERROR("Error writing to file %s", mapname.c_str());
+            }
+          }
+        } else if (suffix== ".bt"){ // write to binary file:
           if (!octree->writeBinary(mapname)){
             ROS_ERROR("Error writing to file %s", mapname.c_str());
           }
@@ -79,7 +101,7 @@ public:
             ROS_ERROR("Error writing to file %s", mapname.c_str());
           }
         } else{
-          ROS_ERROR("Unknown file extension, must be either .bt or .ot");
+          ROS_ERROR("Unknown file extension, must be either .bt, .ot or .cot");
         }
 
 
@@ -91,6 +113,59 @@ public:
 
     }
   }
+
+private:
+  // streams the map one chunk per service call, so that large maps need
+  // neither a single huge message nor the whole tree in memory
+  void saveChunks(const std::string& mapname){
+    ros::NodeHandle n;
+    std::string servname = "octomap_chunks";
+    ROS_INFO("Requesting the map chunks from %s...", n.resolveName(servname).c_str());
+    GetOctomapChunk::Request req;
+    GetOctomapChunk::Response resp;
+    req.index = 0;
+    req.depth = 0;
+    while(n.ok() && !ros::service::call(servname, req, resp))
+    {
+      ROS_WARN("Request to %s failed; trying again...", n.resolveName(servname).c_str());
+      usleep(1000000);
+    }
+    if (!n.ok())
+      return;
+
+    squirrel_3d_mapping::ChunkedMapWriter writer;
+    if (!writer.open(mapname, resp.resolution, resp.num_chunks)){
+      ROS_ERROR("Error writing to file %s", mapname.c_str());
+      return;
+    }
+
+    const unsigned numChunks = resp.num_chunks;
+    unsigned numSkipped = 0;
+    for (unsigned i = 0; i < numChunks && n.ok(); ++i){
+      req.index = i;
+      if (i > 0 && !ros::service::call(servname, req, resp)){
+        ROS_ERROR("Request of chunk %u from %s failed", i, n.resolveName(servname).c_str());
+        return;
+      }
+      if (resp.data.empty()){ // the chunk left the map in the meantime
+        ++numSkipped;
+        continue;
+      }
+      squirrel_3d_mapping::MapChunk chunk;
+      for (unsigned j = 0; j < 3; ++j)
+        chunk.key[j] = resp.key[j];
+      chunk.depth = resp.depth;
+      if (!writer.write(chunk, resp.data)){
+        ROS_ERROR("Error writing to file %s", mapname.c_str());
+        return;
+      }
+    }
+
+    if (!writer.close())
+      ROS_ERROR("Error writing to file %s", mapname.c_str());
+    else
+      ROS_INFO("Saved %u chunks (%u skipped, %f m res) to %s", numChunks - numSkipped, numSkipped, resp.resolution, mapname.c_str());
+  }
 };
 
 int main(int argc, char** argv){
@@ -29,7 +29,20 @@
 
 #include "squirrel_3d_mapping/OctomapServer.h"
 
+#include <squirrel_point_buffer/pcl_adapters.h>
+
 #include <pcl/filters/voxel_grid.h>
+#include <boost/scoped_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace octomap;
 using octomap_msgs::Octomap;
@@ -57,6 +70,7 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_maptopicBinary("octomap_binary"),
   m_maptopicFull("octomap_full"),
   m_downsamplingVoxelSize(0.008),
+  m_fusedFilter(false),
   m_pointcloudMaxX(std::numeric_limits<double>::max()),
   m_pointcloudMinY(-std::numeric_limits<double>::max()),
   m_pointcloudMaxY(std::numeric_limits<double>::max()),
@@ -72,10 +86,33 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_filterSpeckles(false), m_filterGroundPlane(false),
   m_groundFilterDistance(0.04), m_groundFilterAngle(0.15), m_groundFilterPlaneDistance(0.07),
   m_compressMap(true),
+  m_insertThreads(1),
+  m_sortUniqueKeys(false),
+  m_discretizeEndpoints(false),
+  m_denseBlock(false),
+  m_mergeThreads(8),
+  m_incrementalPublish(false),
+  m_publishIncremental(false),
+  m_occupiedNodesVisValid(false),
+  m_freeNodesVisValid(false),
+  m_pclCloudValid(false),
+  m_heightMapMinZ(0.0), m_heightMapMaxZ(0.0),
+  m_lazyPublish(false),
+  m_updateMsgPending(false),
+  m_publisherThreadEnabled(false),
+  m_publisherShutdown(false),
   m_incrementalUpdate(false),
-  m_updateOctree(true)
+  m_updateOctree(true),
+  m_mapOriginChanged(true),
+  m_gridmapValid(false),
+  m_mapSubscribers(0),
+  m_mapUpdateMinX(0), m_mapUpdateMinY(0), m_mapUpdateMaxX(0), m_mapUpdateMaxY(0),
+  m_gridGrowth(0.5),
+  m_gridBoundsValid(false),
+  m_memoryThrottled(false)
 {
   ros::NodeHandle private_nh(private_nh_);
+  m_tracePublisher.reset(new squirrel_threading::tracing::TracePublisher(private_nh));
   private_nh.param("frame_id", m_worldFrameId, m_worldFrameId);
   private_nh.param("base_frame_id", m_baseFrameId, m_baseFrameId);
   private_nh.param("height_map", m_useHeightMap, m_useHeightMap);
@@ -97,9 +134,14 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("occupancy_max_z", m_occupancyMaxZ,m_occupancyMaxZ);
   private_nh.param("min_x_size", m_minSizeX,m_minSizeX);
   private_nh.param("min_y_size", m_minSizeY,m_minSizeY);
+  private_nh.param("projected_map/growth", m_gridGrowth, m_gridGrowth);
 
-  private_nh.param("voxel_filter/enable", m_useVoxelFiltering, m_useVoxelFiltering);
-  private_nh.param("voxel_filter/voxel_size", m_useVoxelFiltering, m_useVoxelFiltering);
+  private_nh.param("voxel_filter/enabled", m_useVoxelFiltering, m_useVoxelFiltering);
+  private_nh.param("voxel_filter/voxel_size", m_downsamplingVoxelSize, m_downsamplingVoxelSize);
+  private_nh.param("fused_filter", m_fusedFilter, m_fusedFilter);
+  private_nh.param("cloud_prefilter/enabled", m_cloudPrefilter, false);
+  private_nh.param("cloud_prefilter/voxel_size", m_prefilterVoxelSize, m_res);
+  private_nh.param("cloud_prefilter/min_neighbors", m_prefilterMinNeighbors, 1);
 
   private_nh.param("filter_speckles", m_filterSpeckles, m_filterSpeckles);
   private_nh.param("filter_ground", m_filterGroundPlane, m_filterGroundPlane);
@@ -118,7 +160,23 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("sensor_model/min", m_thresMin, m_thresMin);
   private_nh.param("sensor_model/max", m_thresMax, m_thresMax);
   private_nh.param("compress_map", m_compressMap, m_compressMap);
+  private_nh.param("insertion/threads", m_insertThreads, m_insertThreads);
+  private_nh.param("insertion/sort_keys", m_sortUniqueKeys, m_sortUniqueKeys);
+  private_nh.param("insertion/discretize", m_discretizeEndpoints, m_discretizeEndpoints);
+  private_nh.param("insertion/dense_block", m_denseBlock, m_denseBlock);
+  private_nh.param("merge/threads", m_mergeThreads, m_mergeThreads);
+  m_insertThreads = std::max(1, m_insertThreads);
+#ifndef _OPENMP
+  if (m_insertThreads > 1)
+    ROS_WARN("%s: Built without OpenMP, scans are inserted by a single thread", ros::this_node::getName().c_str());
+  m_insertThreads = 1;
+  m_mergeThreads = 1;
+#endif
   private_nh.param("incremental_2D_projection", m_incrementalUpdate, m_incrementalUpdate);
+  private_nh.param("incremental_publish", m_incrementalPublish, m_incrementalPublish);
+  // only the update BBX of the 2D map is re-projected when publishing incrementally
+  if (m_incrementalPublish)
+    m_incrementalUpdate = true;
 
   if (m_filterGroundPlane && (m_pointcloudMinZ > 0.0 || m_pointcloudMaxZ < 0.0)){
     ROS_WARN_STREAM("You enabled ground filtering but incoming pointclouds will be pre-filtered in ["
@@ -141,6 +199,10 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("distance_transform/enabled", edt_dynamicEdt, false);
   private_nh.param("distance_transform/max_dist", edt_maxDist, 1.0);
   private_nh.param("distance_transform/unknown_as_occupied", edt_unknownAsOccupied, false);
+  private_nh.param("distance_transform/batch_initialize", edt_batchInitialize, false);
+  private_nh.param("distance_transform/sparse", edt_sparse, false);
+  private_nh.param("distance_transform/robot_height_band", edt_robotHeightBand, false);
+  private_nh.param("distance_transform/clearance_map", edt_useClearanceMap, false);
   private_nh.param("distance_transform/min_x", edt_minX, -10.0);
   private_nh.param("distance_transform/max_x", edt_maxX, 10.0);
   private_nh.param("distance_transform/min_y", edt_minY, -10.0);
@@ -153,7 +215,7 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   std::string layers_levels_params, inscribed_radii_params;
   private_nh.param("distance_transform/layers_num", edt_layersNum, 2);
   private_nh.param("distance_transform/layers_levels", layers_levels_params, std::string("0.03, 0.25"));
-  private_nh.param("distance_transform/layers_levels", inscribed_radii_params, std::string("0.22, 0.07"));
+  private_nh.param("distance_transform/inscribed_radii", inscribed_radii_params, std::string("0.22, 0.07"));
   edt_layersLevels = ParameterParser::array<double>(layers_levels_params);
   edt_inscribedRadii = ParameterParser::array<double>(inscribed_radii_params);
 
@@ -163,13 +225,27 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   }
 
   ROS_INFO("%s: Initializing Euclidean Distance Transform...", ros::this_node::getName().c_str());
+  edt_distanceTransform = NULL;
+  edt_clearanceMap = NULL;
   if ( edt_dynamicEdt ) {
+    // checkCollision only queries up to the robot height, farther obstacles don't change its distances
+    if ( edt_robotHeightBand ) {
+      edt_minZ = std::max(edt_minZ, -edt_maxDist);
+      edt_maxZ = std::min(edt_maxZ, edt_robotHeight + edt_maxDist);
+    }
     point3d min(edt_minX, edt_minY, edt_minZ);
     point3d max(edt_maxX, edt_maxY, edt_maxZ);
 
     ROS_INFO("%s: Creating Euclidean Distance Transform...", ros::this_node::getName().c_str());
-    edt_distanceTransform = new DynamicEDTOctomap((float) edt_maxDist, m_octree, min, max, edt_unknownAsOccupied);
+    edt_distanceTransform = new DynamicEDTOctomap((float) edt_maxDist, m_octree, min, max, edt_unknownAsOccupied, edt_sparse);
+    edt_distanceTransform->setBatchInitialize(edt_batchInitialize);
     edt_distanceTransform->update();
+    ROS_INFO("%s: Euclidean Distance Transform uses %.1f MB", ros::this_node::getName().c_str(), edt_distanceTransform->getMemoryUsage() / 1e6);
+
+    if ( edt_useClearanceMap ) {
+      edt_clearanceMap = new ClearanceMap(m_octree, min, max, edt_layersLevels, edt_robotHeight, edt_unknownAsOccupied);
+      edt_clearanceMap->update();
+    }
   }
 
   double r, g, b, a;
@@ -199,28 +275,150 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   } else
     ROS_INFO("%s: Publishing non-latched (topics are only prepared as needed, will only be re-published on map change", ros::this_node::getName().c_str());
 
-  m_markerPub = m_nh.advertise<visualization_msgs::MarkerArray>("occupied_cells_vis_array", 1, m_latchedTopics);
-  m_binaryMapPub = m_nh.advertise<Octomap>(m_maptopicBinary, 1, m_latchedTopics);
-  m_fullMapPub = m_nh.advertise<Octomap>(m_maptopicFull, 1, m_latchedTopics);
-  m_pointCloudPub = m_nh.advertise<sensor_msgs::PointCloud2>("octomap_point_cloud_centers", 1, m_latchedTopics);
+  // publishing policies of the outputs, 0 Hz publishes on every update
+  private_nh.param("publish/lazy", m_lazyPublish, m_lazyPublish);
+  private_nh.param("publish/occupied_cells_rate", m_publishPolicies[OCCUPIED_CELLS].maxRate, 0.0);
+  private_nh.param("publish/free_cells_rate", m_publishPolicies[FREE_CELLS].maxRate, 0.0);
+  private_nh.param("publish/cell_centers_rate", m_publishPolicies[CELL_CENTERS].maxRate, 0.0);
+  private_nh.param("publish/binary_map_rate", m_publishPolicies[BINARY_MAP].maxRate, 0.0);
+  private_nh.param("publish/full_map_rate", m_publishPolicies[FULL_MAP].maxRate, 0.0);
+  private_nh.param("publish/background_thread", m_publisherThreadEnabled, m_publisherThreadEnabled);
+  private_nh.param("concurrency/snapshot_period", m_snapshotPeriod, 0.0);
+
+  double decayPeriod;
+  private_nh.param("decay/enabled", m_decayEnabled, false);
+  private_nh.param("decay/horizon", m_decayHorizon, 10.0);
+  private_nh.param("decay/rate", m_decayRate, 0.2);
+  private_nh.param("decay/period", decayPeriod, 1.0);
+  private_nh.param("decay/window_radius", m_decayWindowRadius, 3.0);
+  m_scanTime = 0.0;
+
+  double rollingWindowPeriod;
+  private_nh.param("rolling_window/enabled", m_rollingWindow, false);
+  private_nh.param("rolling_window/radius", m_rollingWindowRadius, 8.0);
+  private_nh.param("rolling_window/period", rollingWindowPeriod, 1.0);
+  if (m_rollingWindow && edt_dynamicEdt){
+    // the distance transform and the clearance map only see what the window keeps
+    const double halfX = 0.5 * (edt_maxX - edt_minX), halfY = 0.5 * (edt_maxY - edt_minY);
+    if (m_rollingWindowRadius < sqrt(halfX*halfX + halfY*halfY))
+      ROS_WARN("%s: rolling_window/radius %.2f does not cover the distance transform's box", ros::this_node::getName().c_str(), m_rollingWindowRadius);
+  }
+
+  double memoryCheckPeriod;
+  m_memoryPublisher.reset(new squirrel_threading::MemoryBudgetPublisher(private_nh));
+  m_treeMemory.reset(new squirrel_threading::MemoryBudget::Account(ros::this_node::getName() + "/octree"));
+  if (edt_distanceTransform)
+    m_edtMemory.reset(new squirrel_threading::MemoryBudget::Account(ros::this_node::getName() + "/distance_transform"));
+  private_nh.param("memory/check_period", memoryCheckPeriod, 1.0);
+  private_nh.param("memory/throttled_rate", m_memoryThrottledRate, 0.2);
+  private_nh.param("memory/prune_radius", m_memoryPruneRadius, 10.0);
+  private_nh.param("memory/min_prune_radius", m_memoryMinPruneRadius, 3.0);
+  private_nh.param("memory/shrink_factor", m_memoryShrinkFactor, 0.75);
+  private_nh.param("memory/min_distance_transform_size", m_memoryMinEdtSize, 4.0);
+  m_memoryCurrentRadius = m_memoryPruneRadius;
+
+  double loadMinX, loadMinY, loadMinZ, loadMaxX, loadMaxY, loadMaxZ;
+  private_nh.param("map_chunks/depth", m_mapChunkDepth, 8);
+  private_nh.param("map_chunks/load_min_x", loadMinX, -std::numeric_limits<double>::max());
+  private_nh.param("map_chunks/load_min_y", loadMinY, -std::numeric_limits<double>::max());
+  private_nh.param("map_chunks/load_min_z", loadMinZ, -std::numeric_limits<double>::max());
+  private_nh.param("map_chunks/load_max_x", loadMaxX, std::numeric_limits<double>::max());
+  private_nh.param("map_chunks/load_max_y", loadMaxY, std::numeric_limits<double>::max());
+  private_nh.param("map_chunks/load_max_z", loadMaxZ, std::numeric_limits<double>::max());
+  m_mapLoadMin = point3d(loadMinX, loadMinY, loadMinZ);
+  m_mapLoadMax = point3d(loadMaxX, loadMaxY, loadMaxZ);
+
+  ros::SubscriberStatusCallback noCallback;
+  m_markerPub = m_nh.advertise<visualization_msgs::MarkerArray>("occupied_cells_vis_array", 1, boost::bind(&OctomapServer::subscriberCallback, this, _1, OCCUPIED_CELLS), noCallback, ros::VoidConstPtr(), m_latchedTopics);
+  m_binaryMapPub = m_nh.advertise<Octomap>(m_maptopicBinary, 1, boost::bind(&OctomapServer::subscriberCallback, this, _1, BINARY_MAP), noCallback, ros::VoidConstPtr(), m_latchedTopics);
+  m_fullMapPub = m_nh.advertise<Octomap>(m_maptopicFull, 1, boost::bind(&OctomapServer::subscriberCallback, this, _1, FULL_MAP), noCallback, ros::VoidConstPtr(), m_latchedTopics);
+  m_pointCloudPub = m_nh.advertise<sensor_msgs::PointCloud2>("octomap_point_cloud_centers", 1, boost::bind(&OctomapServer::subscriberCallback, this, _1, CELL_CENTERS), noCallback, ros::VoidConstPtr(), m_latchedTopics);
   m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5, m_latchedTopics);
-  m_fmarkerPub = m_nh.advertise<visualization_msgs::MarkerArray>("free_cells_vis_array", 1, m_latchedTopics);
+  m_mapUpdatePub = m_nh.advertise<map_msgs::OccupancyGridUpdate>("projected_map_updates", 5);
+  m_fmarkerPub = m_nh.advertise<visualization_msgs::MarkerArray>("free_cells_vis_array", 1, boost::bind(&OctomapServer::subscriberCallback, this, _1, FREE_CELLS), noCallback, ros::VoidConstPtr(), m_latchedTopics);
   m_octomapUpdatePub = m_nh.advertise<squirrel_3d_mapping_msgs::OctomapUpdate>("octomap_updates", 1, m_latchedTopics);
 
+  // updates skipped by the rate limits are flushed at the highest rate
+  double maxPublishRate = 0.0;
+  for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+    maxPublishRate = std::max(maxPublishRate, m_publishPolicies[i].maxRate);
+  if (maxPublishRate > 0.0)
+    m_publishTimer = m_nh.createWallTimer(ros::WallDuration(1.0/maxPublishRate), &OctomapServer::publishPendingCallback, this);
+
+  if (m_publisherThreadEnabled)
+    m_publisherThread = boost::thread(&OctomapServer::publisherThread, this);
+
+  if (m_decayEnabled)
+    m_decayTimer = m_nh.createWallTimer(ros::WallDuration(decayPeriod), &OctomapServer::decayCallback, this);
+  if (m_rollingWindow)
+    m_rollingWindowTimer = m_nh.createWallTimer(ros::WallDuration(rollingWindowPeriod), &OctomapServer::rollingWindowCallback, this);
+  for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+    m_configuredPublishRates[i] = m_publishPolicies[i].maxRate;
+  if (memoryCheckPeriod > 0.0)
+    m_memoryTimer = m_nh.createWallTimer(ros::WallDuration(memoryCheckPeriod), &OctomapServer::memoryCallback, this);
+
   m_updateSub = private_nh.subscribe("update", 1, &OctomapServer::updateCallback, this);
-  m_pointCloudSub = new message_filters::Subscriber<sensor_msgs::PointCloud2> (m_nh, "cloud_in", 5);
-  m_tfPointCloudSub = new tf::MessageFilter<sensor_msgs::PointCloud2> (*m_pointCloudSub, m_tfListener, m_worldFrameId, 5);
-  m_tfPointCloudSub->registerCallback(boost::bind(&OctomapServer::insertCloudCallback, this, _1));
+
+  // several cloud inputs with their own sensor models replace cloud_in,
+  // their rays are cast concurrently and merged by a single writer
+  std::vector<std::string> sensorNames;
+  private_nh.param("sensors/names", sensorNames, sensorNames);
+  if (sensorNames.empty()){
+    m_pointCloudSub = new message_filters::Subscriber<sensor_msgs::PointCloud2> (m_nh, "cloud_in", 5);
+    m_tfPointCloudSub = new tf::MessageFilter<sensor_msgs::PointCloud2> (*m_pointCloudSub, m_tfListener, m_worldFrameId, 5);
+    m_tfPointCloudSub->registerCallback(boost::bind(&OctomapServer::insertCloudCallback, this, _1));
+  } else {
+    ros::NodeHandle sensorNh;
+    sensorNh.setCallbackQueue(&m_sensorQueue);
+    for (unsigned i = 0; i < sensorNames.size(); ++i){
+      boost::shared_ptr<SensorInput> sensor(new SensorInput);
+      const std::string ns = "sensors/" + sensorNames[i] + "/";
+      std::string topic;
+      double probHit, probMiss;
+      private_nh.param(ns + "topic", topic, sensorNames[i]);
+      private_nh.param(ns + "max_range", sensor->maxRange, m_maxRange);
+      private_nh.param(ns + "hit", probHit, m_probHit);
+      private_nh.param(ns + "miss", probMiss, m_probMiss);
+      sensor->name = sensorNames[i];
+      sensor->hitLogOdds = octomap::logodds(probHit);
+      sensor->missLogOdds = octomap::logodds(probMiss);
+      sensor->sub.reset(new message_filters::Subscriber<sensor_msgs::PointCloud2> (sensorNh, topic, 5));
+      sensor->tfSub.reset(new tf::MessageFilter<sensor_msgs::PointCloud2> (*sensor->sub, m_tfListener, m_worldFrameId, 5, sensorNh));
+      sensor->tfSub->registerCallback(boost::bind(&OctomapServer::sensorCloudCallback, this, _1, i));
+      m_sensors.push_back(sensor);
+      ROS_INFO("%s: Sensor %s on %s, max range %f, hit %f, miss %f", ros::this_node::getName().c_str(), sensor->name.c_str(), sensor->sub->getTopic().c_str(), sensor->maxRange, probHit, probMiss);
+    }
+
+    int sensorThreads;
+    double mergePeriod;
+    private_nh.param("sensors/threads", sensorThreads, int(m_sensors.size()));
+    private_nh.param("sensors/merge_period", mergePeriod, 0.05);
+    m_sensorMergeTimer = m_nh.createWallTimer(ros::WallDuration(mergePeriod), &OctomapServer::mergeSensorsCallback, this);
+    m_sensorSpinner.reset(new ros::AsyncSpinner(std::max(1, sensorThreads), &m_sensorQueue));
+    m_sensorSpinner->start();
+  }
 
   m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServer::octomapBinarySrv, this);
   m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServer::octomapFullSrv, this);
   m_clearBBXService = private_nh.advertiseService("clear_bbx", &OctomapServer::clearBBXSrv, this);
   m_resetService = private_nh.advertiseService("reset", &OctomapServer::resetSrv, this);
+  m_octomapChunkService = m_nh.advertiseService("octomap_chunks", &OctomapServer::octomapChunkSrv, this);
+  m_mergeService = private_nh.advertiseService("merge_octomap", &OctomapServer::mergeOctomapSrv, this);
+
+  std::vector<std::string> mergeChangeTopics;
+  private_nh.param("merge/change_topics", mergeChangeTopics, mergeChangeTopics);
+  for (unsigned i = 0; i < mergeChangeTopics.size(); ++i)
+    m_mergeChangeSetSubs.push_back(m_nh.subscribe(mergeChangeTopics[i], 10, &OctomapServer::mergeChangeSetCallback, this));
 
   m_updateMsg.header.frame_id = m_worldFrameId;
 
   if ( edt_dynamicEdt ) {
     edt_collisionCheckService = m_nh.advertiseService("distance_transform/collisions/check", &OctomapServer::checkCollision, this);
+    edt_pathCollisionCheckService = m_nh.advertiseService("distance_transform/collisions/check_path", &OctomapServer::checkPathCollision, this);
+    if ( edt_clearanceMap ) {
+      edt_footprintMapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("distance_transform/footprint_map", 1, m_latchedTopics);
+      publishFootprintMap(ros::Time::now());
+    }
   }
 
   dynamic_reconfigure::Server<OctomapServerConfig>::CallbackType f;
@@ -230,6 +428,21 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
 }
 
 OctomapServer::~OctomapServer() {
+  // no sensor callbacks may run on the members destroyed below
+  if (m_sensorSpinner)
+    m_sensorSpinner->stop();
+  m_sensorMergeTimer.stop();
+  m_sensors.clear();
+
+  if (m_publisherThread.joinable()){
+    {
+      boost::lock_guard<boost::mutex> lock(m_publishMutex);
+      m_publisherShutdown = true;
+    }
+    m_publishCondition.notify_one();
+    m_publisherThread.join();
+  }
+
   if ( m_tfPointCloudSub ){
     delete m_tfPointCloudSub;
     m_tfPointCloudSub = NULL;
@@ -246,6 +459,11 @@ OctomapServer::~OctomapServer() {
   }
 
   // cleaning up the edt
+  if ( edt_clearanceMap ) {
+    delete edt_clearanceMap;
+    edt_clearanceMap = NULL;
+  }
+
   if ( edt_distanceTransform ) {
     delete edt_distanceTransform;
     edt_distanceTransform = NULL;
@@ -256,8 +474,36 @@ bool OctomapServer::openFile(const std::string& filename){
   if (filename.length() <= 3)
     return false;
 
+  TreeUpdateLock lock(m_treeMutex);
+  TreeWriteLock writeLock(lock);
+  {
+    boost::lock_guard<boost::mutex> snapshotLock(m_snapshotMutex);
+    m_treeSnapshot.reset();
+  }
+  m_lastObserved.clear();
+
   std::string suffix = filename.substr(filename.length()-3, 3);
-  if (suffix== ".bt"){
+  if (filename.length() > 4 && filename.substr(filename.length()-4, 4) == ".otc"){
+    ChunkedMapReader reader;
+    if (!reader.open(filename)){
+      return false;
+    }
+    m_octree->clear();
+    m_octree->setResolution(reader.getResolution());
+    int numChunks = reader.read(*m_octree, m_mapLoadMin, m_mapLoadMax);
+    if (numChunks < 0){
+      ROS_ERROR("%s: Could not read the chunks of %s", ros::this_node::getName().c_str(), filename.c_str());
+      return false;
+    }
+    ROS_INFO("%s: Read %d of %zu chunks within the load bounding box", ros::this_node::getName().c_str(), numChunks, reader.getChunks().size());
+  } else if (filename.length() > 4 && filename.substr(filename.length()-4, 4) == ".cot"){
+    CompactOcTree compactTree(m_res);
+    if (!compactTree.readBinary(filename)){
+      return false;
+    }
+    m_octree->setResolution(compactTree.getResolution());
+    compactTree.toOcTree(*m_octree);
+  } else if (suffix== ".bt"){
     if (!m_octree->readBinary(filename)){
       return false;
     }
@@ -299,6 +545,9 @@ bool OctomapServer::openFile(const std::string& filename){
   m_updateBBXMax[1] = m_octree->coordToKey(maxY);
   m_updateBBXMax[2] = m_octree->coordToKey(maxZ);
 
+  if (edt_clearanceMap)
+    edt_clearanceMap->invalidate(m_octree);
+  invalidatePublishCaches();
   publishAll();
 
   return true;
@@ -306,53 +555,81 @@ bool OctomapServer::openFile(const std::string& filename){
 }
 
 void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud){
+  SQUIRREL_TRACE_SCOPE("octomap_server/insert_cloud");
   ros::WallTime startTime = ros::WallTime::now();
+  // one cloud at a time, the filters share their buffers
+  TreeUpdateLock lock(m_treeMutex);
 
-  PCLPointCloud pc; // input cloud for filtering and ground-detection
-
-  //
-  // downsample with VoxelFilter
-  //
-  if (m_useVoxelFiltering) {
-    PCLPointCloud::Ptr pc_raw(new PCLPointCloud);
-    pcl::fromROSMsg(*cloud, *pc_raw);
-    pcl::VoxelGrid<pcl::PointXYZ> voxel_filter;
-    voxel_filter.setInputCloud(pc_raw);
-    voxel_filter.setLeafSize(m_downsamplingVoxelSize, m_downsamplingVoxelSize, m_downsamplingVoxelSize);
-    voxel_filter.filter(pc);
-  } else {
-    pcl::fromROSMsg(*cloud, pc);
-  }
-
-  //
-  // ground filtering in base frame
-  //
-  //PCLPointCloud pc; // input cloud for filtering and ground-detection
-  //pcl::fromROSMsg(*cloud, pc);
-
-  //
-  // ground filtering in base frame
-  //
+  PCLPointCloud pc_ground; // segmented ground plane
+  PCLPointCloud pc_nonground; // everything else
   tf::StampedTransform sensorToWorldTf;
-  try {
-    m_tfListener.lookupTransform(m_worldFrameId, cloud->header.frame_id, cloud->header.stamp, sensorToWorldTf);
-  } catch(tf::TransformException& ex){
-    ROS_ERROR_STREAM(ros::this_node::getName() << ": Transform error of sensor data: " << ex.what() << ", quitting callback");
+
+  if (!filterCloud(*cloud, sensorToWorldTf, pc_ground, pc_nonground))
     return;
+
+  if ( m_updateOctree ) {
+    {
+      TreeWriteLock writeLock(lock);
+      insertScan(sensorToWorldTf.getOrigin(), pc_ground, pc_nonground);
+    }
+    updateTreeSnapshot(false);
+
+  /*  for(octomap::OcTree::leaf_iterator it = m_octree->begin_leafs(),end = m_octree->end_leafs(); it!= end; ++it)*/
+      //{
+
+          //fprintf(stderr,"%f\n",it->getOccupancy());
+      /*}*/
+    //			m_octree->updateNode(it.getKey(), -6.0f);
+
+    double total_elapsed = (ros::WallTime::now() - startTime).toSec();
+    ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", pc_ground.size(), pc_nonground.size(), total_elapsed);
+
+    publishAll(cloud->header.stamp);
   }
+}
+
+bool OctomapServer::filterCloud(const sensor_msgs::PointCloud2& cloud, tf::StampedTransform& sensorToWorldTf, PCLPointCloud& ground, PCLPointCloud& nonground){
+  if (m_fusedFilter){
+    if (!fusedFilterCloud(cloud, sensorToWorldTf, ground, nonground))
+      return false;
+  } else {
+    PCLPointCloud pc; // input cloud for filtering and ground-detection
+
+    // read the cloud once, without the NaN points
+    const squirrel_point_buffer::PointCloud2View view(cloud);
+    if (!m_points.assign(view)) {
+      PCLPointCloud pc_raw;
+      pcl::fromROSMsg(cloud, pc_raw);
+      squirrel_point_buffer::fromPCL(pc_raw, &m_points);
+    }
 
-  Eigen::Matrix4f sensorToWorld;
-  pcl_ros::transformAsMatrix(sensorToWorldTf, sensorToWorld);
+    //
+    // downsample with VoxelFilter
+    //
+    if (m_useVoxelFiltering) {
+      m_voxelGrid.setLeafSize(m_downsamplingVoxelSize, m_downsamplingVoxelSize, m_downsamplingVoxelSize);
+      m_voxelGrid.filter(m_points, &m_downsampledPoints);
+      m_points.swap(m_downsampledPoints);
+    }
 
+    //
+    // ground filtering in base frame
+    //
+    try {
+      m_tfListener.lookupTransform(m_worldFrameId, cloud.header.frame_id, cloud.header.stamp, sensorToWorldTf);
+    } catch(tf::TransformException& ex){
+      ROS_ERROR_STREAM(ros::this_node::getName() << ": Transform error of sensor data: " << ex.what() << ", quitting callback");
+      return false;
+    }
 
-  PCLPointCloud pc_ground; // segmented ground plane
-  PCLPointCloud pc_nonground; // everything else
+    Eigen::Matrix4f sensorToWorld;
+    pcl_ros::transformAsMatrix(sensorToWorldTf, sensorToWorld);
 
     tf::StampedTransform sensorToBaseTf, baseToWorldTf;
     try{
-      m_tfListener.waitForTransform(m_baseFrameId, cloud->header.frame_id, cloud->header.stamp, ros::Duration(0.2));
-      m_tfListener.lookupTransform(m_baseFrameId, cloud->header.frame_id, cloud->header.stamp, sensorToBaseTf);
-      m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, cloud->header.stamp, baseToWorldTf);
+      m_tfListener.waitForTransform(m_baseFrameId, cloud.header.frame_id, cloud.header.stamp, ros::Duration(0.2));
+      m_tfListener.lookupTransform(m_baseFrameId, cloud.header.frame_id, cloud.header.stamp, sensorToBaseTf);
+      m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, cloud.header.stamp, baseToWorldTf);
 
 
     } catch(tf::TransformException& ex){
@@ -366,60 +643,220 @@ void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr
     pcl_ros::transformAsMatrix(baseToWorldTf, baseToWorld);
 
     // transform pointcloud from sensor frame to fixed robot frame
-    pcl::transformPointCloud(pc, pc, sensorToBase);
-
-    // set up filter for height range, also removes NANs:
-    pcl::PassThrough<pcl::PointXYZ> passX;
-    passX.setFilterFieldName("x");
-    passX.setFilterLimits(m_pointcloudMinX, m_pointcloudMaxX);
-    passX.setInputCloud(pc.makeShared());
-    passX.filter(pc);
-
-    pcl::PassThrough<pcl::PointXYZ> passY;
-    passY.setFilterFieldName("y");
-    passY.setFilterLimits(m_pointcloudMinY, m_pointcloudMaxY);
-    passY.setInputCloud(pc.makeShared());
-    passY.filter(pc);
-
-    pcl::PassThrough<pcl::PointXYZ> passZ;
-    passZ.setFilterFieldName("z");
-    passZ.setFilterLimits(m_pointcloudMinZ, m_pointcloudMaxZ);
-    passZ.setInputCloud(pc.makeShared());
-    passZ.filter(pc);
+    squirrel_point_buffer::transform(Eigen::Affine3f(sensorToBase), &m_points);
+
+    // filter for the box in the base frame, in place on the arrays
+    squirrel_point_buffer::crop(
+        Eigen::Vector3f(m_pointcloudMinX, m_pointcloudMinY, m_pointcloudMinZ),
+        Eigen::Vector3f(m_pointcloudMaxX, m_pointcloudMaxY, m_pointcloudMaxZ),
+        &m_points);
+    squirrel_point_buffer::toPCL(m_points, &pc);
+
+    if (m_cloudPrefilter){
+      prefilterCloud(pc, ground, nonground);
+    } else if (m_filterGroundPlane){
+      filterGroundPlane(pc, ground, nonground);
+    } else {
+      nonground = pc;
+    }
 
-    if (m_filterGroundPlane){
-      filterGroundPlane(pc, pc_ground, pc_nonground);
+    // transform clouds to world frame for insertion
+    pcl::transformPointCloud(ground, ground, baseToWorld);
+    pcl::transformPointCloud(nonground, nonground, baseToWorld);
+
+    // nonground is empty without ground segmentation
+    // ground.header = pc.header;
+    // nonground.header = pc.header;
+  }
+
+  return true;
+}
+
+bool OctomapServer::fusedFilterCloud(const sensor_msgs::PointCloud2& cloud, tf::StampedTransform& sensorToWorldTf, PCLPointCloud& ground, PCLPointCloud& nonground){
+  tf::StampedTransform sensorToBaseTf, baseToWorldTf;
+  try{
+    m_tfListener.lookupTransform(m_worldFrameId, cloud.header.frame_id, cloud.header.stamp, sensorToWorldTf);
+    m_tfListener.waitForTransform(m_baseFrameId, cloud.header.frame_id, cloud.header.stamp, ros::Duration(0.2));
+    m_tfListener.lookupTransform(m_baseFrameId, cloud.header.frame_id, cloud.header.stamp, sensorToBaseTf);
+    m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, cloud.header.stamp, baseToWorldTf);
+  } catch(tf::TransformException& ex){
+    ROS_ERROR_STREAM(ros::this_node::getName() << ": Transform error of sensor data: " << ex.what() << ", quitting callback");
+    return false;
+  }
+
+  Eigen::Matrix4f sensorToBase, baseToWorld;
+  pcl_ros::transformAsMatrix(sensorToBaseTf, sensorToBase);
+  pcl_ros::transformAsMatrix(baseToWorldTf, baseToWorld);
+  const Eigen::Matrix3f rotation = sensorToBase.topLeftCorner<3,3>();
+  const Eigen::Vector3f translation = sensorToBase.topRightCorner<3,1>();
+
+  // the ground plane is segmented in the base frame, otherwise the points go
+  // straight to the world frame
+  PCLPointCloud& out = nonground;
+  out.clear();
+  ground.clear();
+  const bool toWorld = !m_filterGroundPlane;
+  const Eigen::Matrix3f worldRotation = baseToWorld.topLeftCorner<3,3>();
+  const Eigen::Vector3f worldTranslation = baseToWorld.topRightCorner<3,1>();
+
+  const float invVoxelSize = 1.0 / m_downsamplingVoxelSize;
+  m_voxelPoints.clear();
+  if (m_useVoxelFiltering)
+    m_voxelPoints.reserve(cloud.width * cloud.height);
+  else
+    out.reserve(cloud.width * cloud.height);
+
+  for (sensor_msgs::PointCloud2ConstIterator<float> x(cloud, "x"), y(cloud, "y"), z(cloud, "z"); x != x.end(); ++x, ++y, ++z){
+    if (!pcl_isfinite(*x) || !pcl_isfinite(*y) || !pcl_isfinite(*z))
+      continue;
+    const Eigen::Vector3f p = rotation * Eigen::Vector3f(*x, *y, *z) + translation;
+    // same limits as the PassThrough filters
+    if (p.x() < m_pointcloudMinX || p.x() > m_pointcloudMaxX
+        || p.y() < m_pointcloudMinY || p.y() > m_pointcloudMaxY
+        || p.z() < m_pointcloudMinZ || p.z() > m_pointcloudMaxZ)
+      continue;
+
+    if (m_useVoxelFiltering){
+      // 21 bits per axis, offset to be positive
+      VoxelPoint vp;
+      vp.voxel = packVoxel(p.x() * invVoxelSize, p.y() * invVoxelSize, p.z() * invVoxelSize);
+      vp.x = p.x();
+      vp.y = p.y();
+      vp.z = p.z();
+      m_voxelPoints.push_back(vp);
+    } else if (toWorld){
+      const Eigen::Vector3f w = worldRotation * p + worldTranslation;
+      out.push_back(pcl::PointXYZ(w.x(), w.y(), w.z()));
     } else {
-      pc_nonground = pc;
+      out.push_back(pcl::PointXYZ(p.x(), p.y(), p.z()));
     }
+  }
+
+  // centroids of the occupied voxels, as the VoxelGrid filter
+  if (m_useVoxelFiltering){
+    std::sort(m_voxelPoints.begin(), m_voxelPoints.end());
+    for (size_t begin = 0, end = 0; begin < m_voxelPoints.size(); begin = end){
+      Eigen::Vector3f sum(0.0f, 0.0f, 0.0f);
+      for (end = begin; end < m_voxelPoints.size() && m_voxelPoints[end].voxel == m_voxelPoints[begin].voxel; ++end)
+        sum += Eigen::Vector3f(m_voxelPoints[end].x, m_voxelPoints[end].y, m_voxelPoints[end].z);
+      Eigen::Vector3f p = sum / float(end - begin);
+      if (toWorld)
+        p = worldRotation * p + worldTranslation;
+      out.push_back(pcl::PointXYZ(p.x(), p.y(), p.z()));
+    }
+  }
 
+  if (m_cloudPrefilter || m_filterGroundPlane){
+    PCLPointCloud pc;
+    pc.swap(out);
+    if (m_cloudPrefilter)
+      prefilterCloud(pc, ground, nonground);
+    else
+      filterGroundPlane(pc, ground, nonground);
+  }
+  if (m_filterGroundPlane){
     // transform clouds to world frame for insertion
-    pcl::transformPointCloud(pc_ground, pc_ground, baseToWorld);
-    pcl::transformPointCloud(pc_nonground, pc_nonground, baseToWorld);
+    pcl::transformPointCloud(ground, ground, baseToWorld);
+    pcl::transformPointCloud(nonground, nonground, baseToWorld);
+  }
+  return true;
+}
 
-    // pc_nonground is empty without ground segmentation
-    // pc_ground.header = pc.header;
-    // pc_nonground.header = pc.header;
+namespace {
 
-  if ( m_updateOctree ) {
-    insertScan(sensorToWorldTf.getOrigin(), pc_ground, pc_nonground);
+inline uint64_t packKey(const OcTreeKey& key){
+  return (uint64_t(key[0]) << 32) | (uint64_t(key[1]) << 16) | uint64_t(key[2]);
+}
 
-  /*  for(octomap::OcTree::leaf_iterator it = m_octree->begin_leafs(),end = m_octree->end_leafs(); it!= end; ++it)*/
-      //{
+inline OcTreeKey unpackKey(uint64_t packed){
+  return OcTreeKey((packed >> 32) & 0xffff, (packed >> 16) & 0xffff, packed & 0xffff);
+}
 
-          //fprintf(stderr,"%f\n",it->getOccupancy());
-      /*}*/
-    //			m_octree->updateNode(it.getKey(), -6.0f);
+const uint64_t kOccupiedBit = uint64_t(1) << 48;
 
-    double total_elapsed = (ros::WallTime::now() - startTime).toSec();
-    ROS_DEBUG("Pointcloud insertion in OctomapServer done (%zu+%zu pts (ground/nonground), %f sec)", pc_ground.size(), pc_nonground.size(), total_elapsed);
+inline bool keyLess(const OcTreeKey& a, const OcTreeKey& b){
+  return packKey(a) < packKey(b);
+}
 
-    publishAll(cloud->header.stamp);
+inline void sortUnique(std::vector<OcTreeKey>& keys){
+  std::sort(keys.begin(), keys.end(), keyLess);
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+// the flat key buffers are compacted once they grow beyond this size
+const size_t kMinCompactSize = 1 << 16;
+
+// flags of the dense block, a voxel seen occupied in a cloud is not cleared
+const uint8_t kDenseFree = 1;
+const uint8_t kDenseOccupied = 2;
+// bytes of the dense block, larger maxranges fall back to the key buffers
+const size_t kMaxDenseVoxels = size_t(1) << 27;
+
+// incremental publishing is aligned to blocks this many levels above the leafs
+const unsigned kIncrementalBlockLevels = 4;
+
+} // namespace
+
+bool OctomapServer::rayEnd(const point3d& origin, const pcl::PointXYZ& p, bool ground, double maxRange, point3d& end) const{
+  end = point3d(p.x, p.y, p.z);
+  // maxrange check
+  if ((maxRange > 0.0) && ((end - origin).norm() > maxRange) ) {
+    end = origin + (end - origin).normalized() * maxRange;
+    return false;
+  }
+  // ground points only clear space, all other points: occupied on endpoint
+  return !ground;
+}
+
+void OctomapServer::markDense(ScanKeys& keys, const OcTreeKey& key, uint8_t flag){
+  const int x = key[0] - keys.denseMin[0];
+  const int y = key[1] - keys.denseMin[1];
+  const int z = key[2] - keys.denseMin[2];
+  if (x < 0 || y < 0 || z < 0 || x >= keys.denseSize || y >= keys.denseSize || z >= keys.denseSize)
+    return;
+  uint8_t& voxel = keys.dense[x + keys.denseSize * (y + keys.denseSize * z)];
+  #pragma omp atomic
+  voxel |= flag;
+}
+
+void OctomapServer::insertRay(const point3d& origin, const point3d& end, bool occupied, ScanKeys& keys) const{
+  if (m_octree->computeRayKeys(origin, end, keys.ray)){
+    if (keys.dense){
+      for (KeyRay::const_iterator it = keys.ray.begin(), last = keys.ray.end(); it != last; ++it)
+        markDense(keys, *it, kDenseFree);
+    } else if (m_sortUniqueKeys){
+      keys.freeKeys.insert(keys.freeKeys.end(), keys.ray.begin(), keys.ray.end());
+      // bounded memory, rays of neighboring points share most of their keys
+      if (keys.freeKeys.size() > keys.compactSize){
+        sortUnique(keys.freeKeys);
+        keys.compactSize = std::max(kMinCompactSize, 2 * keys.freeKeys.size());
+      }
+    } else {
+      keys.freeSet.insert(keys.ray.begin(), keys.ray.end());
+    }
+  }
+
+  OcTreeKey endKey;
+  if (m_octree->coordToKeyChecked(end, endKey)){
+    if (occupied){
+      if (keys.dense)
+        markDense(keys, endKey, kDenseOccupied);
+      else if (m_sortUniqueKeys)
+        keys.occupiedKeys.push_back(endKey);
+      else
+        keys.occupiedSet.insert(endKey);
+    }
+    updateMinKey(endKey, keys.bbxMin);
+    updateMaxKey(endKey, keys.bbxMax);
+  } else{
+    ROS_ERROR_STREAM(ros::this_node::getName() << ": Could not generate Key for endpoint " << end);
   }
 }
 
 void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCloud& ground, const PCLPointCloud& nonground){
+  SQUIRREL_TRACE_SCOPE("octomap_server/insert_scan");
   point3d sensorOrigin = pointTfToOctomap(sensorOriginTf);
+  m_scanTime = ros::Time::now().toSec();
 
   if (!m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMin)
     || !m_octree->coordToKeyChecked(sensorOrigin, m_updateBBXMax))
@@ -427,95 +864,165 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
     ROS_ERROR_STREAM(ros::this_node::getName() << "Could not generate Key for origin " << sensorOrigin);
   }
 
-  // instead of direct scan insertion, compute update to filter ground:
-  KeySet free_cells, occupied_cells;
-  // insert ground points only as free:
-  for (PCLPointCloud::const_iterator it = ground.begin(); it != ground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange > 0.0) && ((point - sensorOrigin).norm() > m_maxRange) ) {
-      point = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
+  // the rays stay within maxrange of the origin, so their keys can be flagged
+  // in the cube around it instead of being collected and deduplicated
+  int denseSize = 0;
+  if (m_denseBlock){
+    if (m_maxRange > 0.0)
+      denseSize = 2 * (int(std::ceil(m_maxRange / m_res)) + 2) + 1;
+    const size_t denseVoxels = size_t(denseSize) * denseSize * denseSize;
+    if (denseVoxels > kMaxDenseVoxels){
+      ROS_WARN_ONCE("%s: The dense block of maxrange %f needs %zu voxels, using the key buffers", ros::this_node::getName().c_str(), m_maxRange, denseVoxels);
+      denseSize = 0;
+    } else if (denseSize > 0 && m_denseVoxels.size() != denseVoxels){
+      m_denseVoxels.assign(denseVoxels, 0);
     }
+  }
 
-    // only clear space (ground points)
-    if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-      free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-    }
+  // instead of direct scan insertion, compute update to filter ground.
+  // Every thread casts its share of the rays into its own buffers:
+  m_scanKeys.resize(m_insertThreads);
+  for (std::vector<ScanKeys>::iterator it = m_scanKeys.begin(); it != m_scanKeys.end(); ++it){
+    it->freeSet.clear();
+    it->occupiedSet.clear();
+    it->freeKeys.clear();
+    it->occupiedKeys.clear();
+    it->compactSize = kMinCompactSize;
+    it->bbxMin = m_updateBBXMin;
+    it->bbxMax = m_updateBBXMax;
+    it->dense = denseSize > 0 ? &m_denseVoxels[0] : NULL;
+    for (unsigned i = 0; i < 3; ++i)
+      it->denseMin[i] = int(m_updateBBXMin[i]) - denseSize / 2;
+    it->denseSize = denseSize;
+  }
 
-    octomap::OcTreeKey endKey;
-    if (m_octree->coordToKeyChecked(point, endKey)){
-      updateMinKey(endKey, m_updateBBXMin);
-      updateMaxKey(endKey, m_updateBBXMax);
-    } else{
-      ROS_ERROR_STREAM(ros::this_node::getName() << ": Could not generate Key for endpoint " << point);
+  const int numGround = ground.size();
+  const int numPoints = numGround + nonground.size();
+  if (m_discretizeEndpoints){
+    // bucket the endpoints by voxel, one ray to the center of each voxel
+    m_endVoxels.clear();
+    m_endVoxels.reserve(numPoints);
+    for (int i = 0; i < numPoints; ++i){
+      const bool isGround = i < numGround;
+      point3d end;
+      const bool occupied = rayEnd(sensorOrigin, isGround ? ground[i] : nonground[i - numGround], isGround, m_maxRange, end);
+      OcTreeKey endKey;
+      if (m_octree->coordToKeyChecked(end, endKey))
+        m_endVoxels.push_back(packKey(endKey) | (occupied ? kOccupiedBit : 0));
+      else
+        ROS_ERROR_STREAM(ros::this_node::getName() << ": Could not generate Key for endpoint " << end);
+    }
+    std::sort(m_endVoxels.begin(), m_endVoxels.end());
+    m_endVoxels.erase(std::unique(m_endVoxels.begin(), m_endVoxels.end()), m_endVoxels.end());
+    ROS_DEBUG("%s: %d endpoints in %zu voxels", ros::this_node::getName().c_str(), numPoints, m_endVoxels.size());
+
+    const int numVoxels = m_endVoxels.size();
+    #pragma omp parallel for num_threads(m_insertThreads) schedule(static)
+    for (int i = 0; i < numVoxels; ++i){
+#ifdef _OPENMP
+      ScanKeys& keys = m_scanKeys[omp_get_thread_num()];
+#else
+      ScanKeys& keys = m_scanKeys[0];
+#endif
+      const uint64_t voxel = m_endVoxels[i];
+      insertRay(sensorOrigin, m_octree->keyToCoord(unpackKey(voxel)), (voxel & kOccupiedBit) != 0, keys);
+    }
+  } else {
+    #pragma omp parallel for num_threads(m_insertThreads) schedule(static)
+    for (int i = 0; i < numPoints; ++i){
+#ifdef _OPENMP
+      ScanKeys& keys = m_scanKeys[omp_get_thread_num()];
+#else
+      ScanKeys& keys = m_scanKeys[0];
+#endif
+      const bool isGround = i < numGround;
+      point3d end;
+      const bool occupied = rayEnd(sensorOrigin, isGround ? ground[i] : nonground[i - numGround], isGround, m_maxRange, end);
+      insertRay(sensorOrigin, end, occupied, keys);
     }
   }
 
-  // all other points: free on ray, occupied on endpoint:
-  for (PCLPointCloud::const_iterator it = nonground.begin(); it != nonground.end(); ++it){
-    point3d point(it->x, it->y, it->z);
-    // maxrange check
-    if ((m_maxRange < 0.0) || ((point - sensorOrigin).norm() <= m_maxRange) ) {
-
-      // free cells
-      if (m_octree->computeRayKeys(sensorOrigin, point, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-      }
-      // occupied endpoint
-      OcTreeKey key;
-      if (m_octree->coordToKeyChecked(point, key)){
-        occupied_cells.insert(key);
-
-        updateMinKey(key, m_updateBBXMin);
-        updateMaxKey(key, m_updateBBXMax);
-      }
-    } else {// ray longer than maxrange:;
-      point3d new_end = sensorOrigin + (point - sensorOrigin).normalized() * m_maxRange;
-      if (m_octree->computeRayKeys(sensorOrigin, new_end, m_keyRay)){
-        free_cells.insert(m_keyRay.begin(), m_keyRay.end());
-
-        octomap::OcTreeKey endKey;
-        if (m_octree->coordToKeyChecked(new_end, endKey)){
-          updateMinKey(endKey, m_updateBBXMin);
-          updateMaxKey(endKey, m_updateBBXMax);
-        } else{
-          ROS_ERROR_STREAM(ros::this_node::getName() << ": Could not generate Key for endpoint " << new_end);
-        }
-      }
+  // merge the thread buffers into the first one
+  ScanKeys& merged = m_scanKeys.front();
+  for (size_t t = 1; t < m_scanKeys.size(); ++t){
+    const ScanKeys& keys = m_scanKeys[t];
+    if (m_sortUniqueKeys){
+      merged.freeKeys.insert(merged.freeKeys.end(), keys.freeKeys.begin(), keys.freeKeys.end());
+      merged.occupiedKeys.insert(merged.occupiedKeys.end(), keys.occupiedKeys.begin(), keys.occupiedKeys.end());
+    } else {
+      merged.freeSet.insert(keys.freeSet.begin(), keys.freeSet.end());
+      merged.occupiedSet.insert(keys.occupiedSet.begin(), keys.occupiedSet.end());
     }
+    updateMinKey(keys.bbxMin, merged.bbxMin);
+    updateMaxKey(keys.bbxMax, merged.bbxMax);
+  }
+  m_updateBBXMin = merged.bbxMin;
+  m_updateBBXMax = merged.bbxMax;
+  if (m_sortUniqueKeys){
+    sortUnique(merged.freeKeys);
+    sortUnique(merged.occupiedKeys);
   }
 
-  if (!m_updateMsg.keys.empty())
-    m_updateMsg.keys.clear();
-  if (!m_updateMsg.occupied.empty())
-    m_updateMsg.occupied.clear();
+  m_updateMsg.keys.clear();
+  m_updateMsg.occupied.clear();
+  m_updateMsgPending = true;
 
-  const size_t n = occupied_cells.size()+free_cells.size();
+  const size_t n = m_sortUniqueKeys ? merged.freeKeys.size() + merged.occupiedKeys.size()
+                                    : merged.freeSet.size() + merged.occupiedSet.size();
   m_updateMsg.keys.reserve(3*n);
-  m_updateMsg.occupied.resize(n);
+  m_updateMsg.occupied.reserve(n);
 
   // mark free cells only if not seen occupied in this cloud
-  for(KeySet::iterator it = free_cells.begin(), end=free_cells.end(); it!= end; ++it){
-    if (occupied_cells.find(*it) == occupied_cells.end()){
-      m_octree->updateNode(*it, false);
-
-      m_updateMsg.keys.push_back((*it)[0]);
-      m_updateMsg.keys.push_back((*it)[1]);
-      m_updateMsg.keys.push_back((*it)[2]);
-      m_updateMsg.occupied.push_back(false);
+  if (denseSize > 0){
+    // the rays are within the bounding box of their ends and the origin,
+    // which also bounds the flags to reset for the next cloud
+    int min[3], max[3];
+    for (unsigned i = 0; i < 3; ++i){
+      min[i] = std::max(int(m_updateBBXMin[i]) - merged.denseMin[i], 0);
+      max[i] = std::min(int(m_updateBBXMax[i]) - merged.denseMin[i], denseSize - 1);
+    }
+    for (int z = min[2]; z <= max[2]; ++z)
+      for (int y = min[1]; y <= max[1]; ++y){
+        uint8_t* row = &m_denseVoxels[denseSize * (y + denseSize * z)];
+        for (int x = min[0]; x <= max[0]; ++x){
+          if (row[x])
+            updateCell(OcTreeKey(x + merged.denseMin[0], y + merged.denseMin[1], z + merged.denseMin[2]), (row[x] & kDenseOccupied) != 0);
+        }
+        std::fill(row + min[0], row + max[0] + 1, 0);
+      }
+  } else if (m_sortUniqueKeys){
+    std::vector<OcTreeKey>::const_iterator occ = merged.occupiedKeys.begin();
+    for (std::vector<OcTreeKey>::const_iterator it = merged.freeKeys.begin(); it != merged.freeKeys.end(); ++it){
+      // both are sorted, advance to the first occupied key not below it
+      while (occ != merged.occupiedKeys.end() && keyLess(*occ, *it))
+        ++occ;
+      if (occ == merged.occupiedKeys.end() || !(*occ == *it)){
+        updateCell(*it, false);
+      }
+    }
+  } else {
+    for (KeySet::const_iterator it = merged.freeSet.begin(), end = merged.freeSet.end(); it != end; ++it){
+      if (merged.occupiedSet.find(*it) == merged.occupiedSet.end()){
+        updateCell(*it, false);
+      }
     }
   }
 
   // now mark all occupied cells:
-  for (KeySet::iterator it = occupied_cells.begin(), end=free_cells.end(); it!= end; it++) {
-    m_octree->updateNode(*it, true);
-
-    m_updateMsg.keys.push_back((*it)[0]);
-    m_updateMsg.keys.push_back((*it)[1]);
-    m_updateMsg.keys.push_back((*it)[2]);
-    m_updateMsg.occupied.push_back(true);
+  if (m_sortUniqueKeys){
+    for (std::vector<OcTreeKey>::const_iterator it = merged.occupiedKeys.begin(); it != merged.occupiedKeys.end(); ++it){
+      updateCell(*it, true);
+    }
+  } else {
+    for (KeySet::const_iterator it = merged.occupiedSet.begin(), end = merged.occupiedSet.end(); it != end; ++it){
+      updateCell(*it, true);
+    }
   }
 
+  finishInsertion();
+}
+
+void OctomapServer::finishInsertion(){
   // update distance transform
   // TODO: eval lazy+updateInner vs. proper insertion
   // non-lazy by default (updateInnerOccupancy() too slow for large maps)
@@ -547,48 +1054,129 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
   if ( edt_dynamicEdt )
     edt_distanceTransform->update();
 
+  if ( edt_clearanceMap && edt_clearanceMap->update(m_updateBBXMin, m_updateBBXMax) )
+    publishFootprintMap(ros::Time::now());
+
+  handlePostInsertion();
 }
 
-void OctomapServer::publishAll(const ros::Time& rostime){
-  ros::WallTime startTime = ros::WallTime::now();
-  size_t octomapSize = m_octree->size();
-  // TODO: estimate num occ. voxels for size of arrays (reserve)
-  if (octomapSize <= 1){
-    ROS_WARN_ONCE("%s: Nothing to publish, octree is empty", ros::this_node::getName().c_str());
+void OctomapServer::sensorCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud, unsigned sensorIndex){
+  SQUIRREL_TRACE_SCOPE("octomap_server/sensor_cloud");
+  if (!m_updateOctree)
     return;
+  SensorInput& sensor = *m_sensors[sensorIndex];
+
+  PCLPointCloud ground, nonground;
+  tf::StampedTransform sensorToWorldTf;
+  {
+    boost::lock_guard<boost::mutex> filterLock(m_filterMutex);
+    if (!filterCloud(*cloud, sensorToWorldTf, ground, nonground))
+      return;
   }
 
-  bool publishFreeMarkerArray = m_publishFreeSpace && (m_latchedTopics || m_fmarkerPub.getNumSubscribers() > 0);
-  bool publishMarkerArray = (m_latchedTopics || m_markerPub.getNumSubscribers() > 0);
-  bool publishPointCloud = (m_latchedTopics || m_pointCloudPub.getNumSubscribers() > 0);
-  bool publishBinaryMap = (m_latchedTopics || m_binaryMapPub.getNumSubscribers() > 0);
-  bool publishFullMap = (m_latchedTopics || m_fullMapPub.getNumSubscribers() > 0);
-  bool publishOctomapUpdate = (m_latchedTopics || m_octomapUpdatePub.getNumSubscribers() > 0);
-  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0);
+  boost::shared_ptr<SensorBatch> batch(new SensorBatch);
+  batch->hitLogOdds = sensor.hitLogOdds;
+  batch->missLogOdds = sensor.missLogOdds;
+  batch->stamp = cloud->header.stamp;
+  {
+    boost::lock_guard<boost::mutex> sensorLock(sensor.mutex);
+    // the keys only depend on the tree's resolution, the read lock keeps the
+    // tree from being replaced (openFile) while the rays are cast
+    TreeReadLock treeLock(m_treeMutex);
+    const point3d origin = pointTfToOctomap(sensorToWorldTf.getOrigin());
+    ScanKeys& keys = sensor.keys;
+    if (!m_octree->coordToKeyChecked(origin, keys.bbxMin)){
+      ROS_ERROR_STREAM(ros::this_node::getName() << ": Could not generate Key for origin " << origin << " of sensor " << sensor.name);
+      return;
+    }
+    keys.bbxMax = keys.bbxMin;
+    keys.freeSet.clear();
+    keys.occupiedSet.clear();
+    keys.freeKeys.clear();
+    keys.occupiedKeys.clear();
+    keys.compactSize = kMinCompactSize;
+    keys.dense = NULL;
+    keys.denseSize = 0;
+
+    const size_t numGround = ground.size();
+    const size_t numPoints = numGround + nonground.size();
+    for (size_t i = 0; i < numPoints; ++i){
+      const bool isGround = i < numGround;
+      point3d end;
+      const bool occupied = rayEnd(origin, isGround ? ground[i] : nonground[i - numGround], isGround, sensor.maxRange, end);
+      insertRay(origin, end, occupied, keys);
+    }
 
-  // init markers for free space:
-  visualization_msgs::MarkerArray freeNodesVis;
-  // each array stores all cubes of a different size, one for each depth level:
-  freeNodesVis.markers.resize(m_treeDepth+1);
+    if (!m_sortUniqueKeys){
+      keys.freeKeys.assign(keys.freeSet.begin(), keys.freeSet.end());
+      keys.occupiedKeys.assign(keys.occupiedSet.begin(), keys.occupiedSet.end());
+    }
+    sortUnique(keys.freeKeys);
+    sortUnique(keys.occupiedKeys);
+    // mark free cells only if not seen occupied in this cloud
+    batch->freeKeys.reserve(keys.freeKeys.size());
+    std::set_difference(keys.freeKeys.begin(), keys.freeKeys.end(), keys.occupiedKeys.begin(), keys.occupiedKeys.end(),
+                        std::back_inserter(batch->freeKeys), keyLess);
+    batch->occupiedKeys = keys.occupiedKeys;
+    batch->bbxMin = keys.bbxMin;
+    batch->bbxMax = keys.bbxMax;
+  }
 
-  geometry_msgs::Pose pose;
-  pose.orientation = tf::createQuaternionMsgFromYaw(0.0);
+  boost::lock_guard<boost::mutex> batchLock(m_sensorBatchMutex);
+  m_sensorBatches.push_back(batch);
+}
 
-  // init markers:
-  visualization_msgs::MarkerArray occupiedNodesVis;
-  // each array stores all cubes of a different size, one for each depth level:
-  occupiedNodesVis.markers.resize(m_treeDepth+1);
+void OctomapServer::mergeSensorsCallback(const ros::WallTimerEvent& event){
+  std::vector<boost::shared_ptr<SensorBatch> > batches;
+  {
+    boost::lock_guard<boost::mutex> batchLock(m_sensorBatchMutex);
+    batches.swap(m_sensorBatches);
+  }
+  if (batches.empty())
+    return;
+
+  SQUIRREL_TRACE_SCOPE("octomap_server/merge_sensors");
+  ros::WallTime startTime = ros::WallTime::now();
+  TreeUpdateLock lock(m_treeMutex);
+  ros::Time stamp = batches.front()->stamp;
+  size_t numKeys = 0;
+  {
+    TreeWriteLock writeLock(lock);
+    m_scanTime = ros::Time::now().toSec();
+    m_updateBBXMin = batches.front()->bbxMin;
+    m_updateBBXMax = batches.front()->bbxMax;
+    m_updateMsg.keys.clear();
+    m_updateMsg.occupied.clear();
+    m_updateMsgPending = true;
+
+    // the clouds in the order of their casting, each with its sensor model
+    for (size_t b = 0; b < batches.size(); ++b){
+      const SensorBatch& batch = *batches[b];
+      for (std::vector<OcTreeKey>::const_iterator it = batch.freeKeys.begin(); it != batch.freeKeys.end(); ++it)
+        updateCell(*it, false, batch.missLogOdds);
+      for (std::vector<OcTreeKey>::const_iterator it = batch.occupiedKeys.begin(); it != batch.occupiedKeys.end(); ++it)
+        updateCell(*it, true, batch.hitLogOdds);
+      updateMinKey(batch.bbxMin, m_updateBBXMin);
+      updateMaxKey(batch.bbxMax, m_updateBBXMax);
+      stamp = std::max(stamp, batch.stamp);
+      numKeys += batch.freeKeys.size() + batch.occupiedKeys.size();
+    }
+    finishInsertion();
+  }
+  updateTreeSnapshot(false);
 
-  // init pointcloud:
-  pcl::PointCloud<pcl::PointXYZ> pclCloud;
+  ROS_DEBUG("%s: Merged %zu sensor clouds (%zu keys, %f sec)", ros::this_node::getName().c_str(), batches.size(), numKeys, (ros::WallTime::now() - startTime).toSec());
 
-  // call pre-traversal hook:
-  handlePreNodeTraversal(rostime);
+  publishAll(stamp);
+}
 
-  // now, traverse all leafs in the tree:
-  for (OcTree::iterator it = m_octree->begin(m_maxTreeDepth),
-      end = m_octree->end(); it != end; ++it)
+template <class IteratorT>
+void OctomapServer::traverseNodes(IteratorT it, const IteratorT& end, bool markers, bool freeMarkers, bool pointCloud, bool columnsOnly){
+  for (; it != end; ++it)
   {
+    if (columnsOnly && !isInUpdateColumns(it.getX(), it.getY(), it.getSize()))
+      continue;
+
     bool inUpdateBBX = isInUpdateBBX(it);
 
     // call general hook:
@@ -600,7 +1188,6 @@ void OctomapServer::publishAll(const ros::Time& rostime){
       double z = it.getZ();
       if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
       {
-        double size = it.getSize();
         double x = it.getX();
         double y = it.getY();
 
@@ -616,29 +1203,26 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 
 
         //create marker:
-        if (publishMarkerArray){
+        if (markers){
           unsigned idx = it.getDepth();
-          assert(idx < occupiedNodesVis.markers.size());
+          assert(idx < m_occupiedNodesVis.markers.size());
 
           geometry_msgs::Point cubeCenter;
           cubeCenter.x = x;
           cubeCenter.y = y;
           cubeCenter.z = z;
 
-          occupiedNodesVis.markers[idx].points.push_back(cubeCenter);
+          m_occupiedNodesVis.markers[idx].points.push_back(cubeCenter);
           if (m_useHeightMap){
-            double minX, minY, minZ, maxX, maxY, maxZ;
-            m_octree->getMetricMin(minX, minY, minZ);
-            m_octree->getMetricMax(maxX, maxY, maxZ);
-
-            double h = (1.0 - std::min(std::max((cubeCenter.z-minZ)/ (maxZ - minZ), 0.0), 1.0)) *m_colorFactor;
-            occupiedNodesVis.markers[idx].colors.push_back(heightMapColor(h));
+            m_occupiedNodesVis.markers[idx].colors.push_back(heightMapColorAt(z));
           }
         }
 
         // insert into pointcloud:
-        if (publishPointCloud)
-          pclCloud.push_back(pcl::PointXYZ(x, y, z));
+        if (pointCloud){
+          m_pclCloud.push_back(pcl::PointXYZ(x, y, z));
+          m_pclCloudDepths.push_back(it.getDepth());
+        }
 
       }
     } else{ // node not occupied => mark as free in 2D map if unknown so far
@@ -649,107 +1233,603 @@ void OctomapServer::publishAll(const ros::Time& rostime){
         if (inUpdateBBX)
           handleFreeNodeInBBX(it);
 
-        if (m_publishFreeSpace){
-          double x = it.getX();
-          double y = it.getY();
-
-          //create marker for free space:
-          if (publishFreeMarkerArray){
-            unsigned idx = it.getDepth();
-            assert(idx < freeNodesVis.markers.size());
+        //create marker for free space:
+        if (freeMarkers){
+          unsigned idx = it.getDepth();
+          assert(idx < m_freeNodesVis.markers.size());
 
-            geometry_msgs::Point cubeCenter;
-            cubeCenter.x = x;
-            cubeCenter.y = y;
-            cubeCenter.z = z;
+          geometry_msgs::Point cubeCenter;
+          cubeCenter.x = it.getX();
+          cubeCenter.y = it.getY();
+          cubeCenter.z = z;
 
-            freeNodesVis.markers[idx].points.push_back(cubeCenter);
-          }
+          m_freeNodesVis.markers[idx].points.push_back(cubeCenter);
         }
 
       }
     }
   }
+}
 
-  // call post-traversal hook:
-  handlePostNodeTraversal(rostime);
+bool OctomapServer::setUpdateColumns(){
+  // the columns are aligned to blocks kIncrementalBlockLevels above the
+  // leafs, so that all finer nodes are either in or out
+  unsigned blockDepth = m_maxTreeDepth > kIncrementalBlockLevels ? m_maxTreeDepth - kIncrementalBlockLevels : 0;
+  double blockSize = m_octree->getNodeSize(blockDepth);
+
+  // one more voxel for the speckles next to updated voxels
+  point3d minPt = m_octree->keyToCoord(m_updateBBXMin);
+  point3d maxPt = m_octree->keyToCoord(m_updateBBXMax);
+  m_updateColumnsMin[0] = std::floor((minPt.x() - 1.5*m_res) / blockSize) * blockSize;
+  m_updateColumnsMin[1] = std::floor((minPt.y() - 1.5*m_res) / blockSize) * blockSize;
+  m_updateColumnsMax[0] = std::ceil((maxPt.x() + 1.5*m_res) / blockSize) * blockSize;
+  m_updateColumnsMax[1] = std::ceil((maxPt.y() + 1.5*m_res) / blockSize) * blockSize;
+
+  if (!m_octree->coordToKeyChecked(point3d(m_updateColumnsMin[0] + 0.5*m_res, m_updateColumnsMin[1] + 0.5*m_res, 0.0), m_updateColumnsMinKey)
+      || !m_octree->coordToKeyChecked(point3d(m_updateColumnsMax[0] - 0.5*m_res, m_updateColumnsMax[1] - 0.5*m_res, 0.0), m_updateColumnsMaxKey))
+    return false;
+  m_updateColumnsMinKey[2] = 0;
+  m_updateColumnsMaxKey[2] = std::numeric_limits<octomap::key_type>::max();
 
-  // finish MarkerArray:
-  if (publishMarkerArray){
-    for (unsigned i= 0; i < occupiedNodesVis.markers.size(); ++i){
-      double size = m_octree->getNodeSize(i);
+  // coarser nodes (pruned, or split since the last publishing) may cross the
+  // border of the columns, these require a complete traversal
+  for (unsigned i = 0; i < blockDepth; ++i){
+    if (crossesUpdateColumns(m_occupiedNodesVis, i) || crossesUpdateColumns(m_freeNodesVis, i))
+      return false;
+  }
+  for (size_t j = 0; j < m_pclCloud.size(); ++j){
+    if (m_pclCloudDepths[j] < blockDepth && isInUpdateColumns(m_pclCloud[j].x, m_pclCloud[j].y, m_octree->getNodeSize(m_pclCloudDepths[j]))
+        && !isInsideUpdateColumns(m_pclCloud[j].x, m_pclCloud[j].y, m_octree->getNodeSize(m_pclCloudDepths[j])))
+      return false;
+  }
+  for (OcTreeT::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(m_updateColumnsMinKey, m_updateColumnsMaxKey, blockDepth),
+       end = m_octree->end_leafs_bbx(); it != end; ++it){
+    if (it.getDepth() < blockDepth && !isInsideUpdateColumns(it.getX(), it.getY(), it.getSize()))
+      return false;
+  }
 
-      occupiedNodesVis.markers[i].header.frame_id = m_worldFrameId;
-      occupiedNodesVis.markers[i].header.stamp = rostime;
-      occupiedNodesVis.markers[i].ns = "map";
-      occupiedNodesVis.markers[i].id = i;
-      occupiedNodesVis.markers[i].type = visualization_msgs::Marker::CUBE_LIST;
-      occupiedNodesVis.markers[i].scale.x = size;
-      occupiedNodesVis.markers[i].scale.y = size;
-      occupiedNodesVis.markers[i].scale.z = size;
-      occupiedNodesVis.markers[i].color = m_color;
+  return true;
+}
 
+bool OctomapServer::crossesUpdateColumns(const visualization_msgs::MarkerArray& markers, unsigned depth) const{
+  if (depth >= markers.markers.size())
+    return false;
 
-      if (occupiedNodesVis.markers[i].points.size() > 0)
-        occupiedNodesVis.markers[i].action = visualization_msgs::Marker::ADD;
-      else
-        occupiedNodesVis.markers[i].action = visualization_msgs::Marker::DELETE;
-    }
+  const std::vector<geometry_msgs::Point>& points = markers.markers[depth].points;
+  double size = m_octree->getNodeSize(depth);
+  for (size_t j = 0; j < points.size(); ++j){
+    if (isInUpdateColumns(points[j].x, points[j].y, size) && !isInsideUpdateColumns(points[j].x, points[j].y, size))
+      return true;
+  }
+  return false;
+}
 
-    m_markerPub.publish(occupiedNodesVis);
+void OctomapServer::eraseUpdateColumns(visualization_msgs::MarkerArray& markers){
+  for (unsigned i = 0; i < markers.markers.size(); ++i){
+    visualization_msgs::Marker& marker = markers.markers[i];
+    const double size = m_octree->getNodeSize(i);
+    const bool colored = marker.colors.size() == marker.points.size();
+    size_t kept = 0;
+    for (size_t j = 0; j < marker.points.size(); ++j){
+      if (!isInUpdateColumns(marker.points[j].x, marker.points[j].y, size)){
+        marker.points[kept] = marker.points[j];
+        if (colored)
+          marker.colors[kept] = marker.colors[j];
+        ++kept;
+      }
+    }
+    marker.points.resize(kept);
+    if (colored)
+      marker.colors.resize(kept);
   }
+}
 
+void OctomapServer::publishAll(const ros::Time& rostime){
+  SQUIRREL_TRACE_SCOPE("octomap_server/publish_all");
+  ros::WallTime startTime = ros::WallTime::now();
+  size_t octomapSize = m_octree->size();
+  // TODO: estimate num occ. voxels for size of arrays (reserve)
+  if (octomapSize <= 1){
+    ROS_WARN_ONCE("%s: Nothing to publish, octree is empty", ros::this_node::getName().c_str());
+    return;
+  }
 
-  // finish FreeMarkerArray:
-  if (publishFreeMarkerArray){
-    for (unsigned i= 0; i < freeNodesVis.markers.size(); ++i){
-      double size = m_octree->getNodeSize(i);
+  // lazily published latched topics are prepared once subscribed
+  bool latched = m_latchedTopics && !m_lazyPublish;
+  bool publishFreeMarkerArray = m_publishFreeSpace && (latched || m_fmarkerPub.getNumSubscribers() > 0);
+  bool publishMarkerArray = (latched || m_markerPub.getNumSubscribers() > 0);
+  bool publishPointCloud = (latched || m_pointCloudPub.getNumSubscribers() > 0);
+  bool publishBinaryMap = (latched || m_binaryMapPub.getNumSubscribers() > 0);
+  bool publishFullMap = (latched || m_fullMapPub.getNumSubscribers() > 0);
+  bool publishOctomapUpdate = (m_latchedTopics || m_octomapUpdatePub.getNumSubscribers() > 0);
+  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0);
 
-      freeNodesVis.markers[i].header.frame_id = m_worldFrameId;
-      freeNodesVis.markers[i].header.stamp = rostime;
-      freeNodesVis.markers[i].ns = "map";
-      freeNodesVis.markers[i].id = i;
-      freeNodesVis.markers[i].type = visualization_msgs::Marker::CUBE_LIST;
-      freeNodesVis.markers[i].scale.x = size;
-      freeNodesVis.markers[i].scale.y = size;
-      freeNodesVis.markers[i].scale.z = size;
-      freeNodesVis.markers[i].color = m_colorFree;
+  // the height map colors are relative to the extent of the tree
+  bool heightMapChanged = false;
+  if (m_useHeightMap){
+    double minX, minY, minZ, maxX, maxY, maxZ;
+    m_octree->getMetricMin(minX, minY, minZ);
+    m_octree->getMetricMax(maxX, maxY, maxZ);
+    heightMapChanged = (minZ != m_heightMapMinZ || maxZ != m_heightMapMaxZ);
+    m_heightMapMinZ = minZ;
+    m_heightMapMaxZ = maxZ;
+    if (heightMapChanged || m_heightMapColors.empty())
+      updateHeightMapColors();
+  }
 
+  // call pre-traversal hook:
+  handlePreNodeTraversal(rostime);
 
-      if (freeNodesVis.markers[i].points.size() > 0)
-        freeNodesVis.markers[i].action = visualization_msgs::Marker::ADD;
-      else
-        freeNodesVis.markers[i].action = visualization_msgs::Marker::DELETE;
+  // with complete caches of the outputs, only the columns around the update
+  // bounding box are traversed again
+  m_publishIncremental = m_incrementalPublish
+      && !(m_publish2DMap && m_projectCompleteMap)
+      && !(publishMarkerArray && (!m_occupiedNodesVisValid || heightMapChanged))
+      && !(publishFreeMarkerArray && !m_freeNodesVisValid)
+      && !(publishPointCloud && !m_pclCloudValid)
+      && setUpdateColumns();
+
+  if (m_publishIncremental){
+    if (publishMarkerArray)
+      eraseUpdateColumns(m_occupiedNodesVis);
+    if (publishFreeMarkerArray)
+      eraseUpdateColumns(m_freeNodesVis);
+    if (publishPointCloud){
+      size_t kept = 0;
+      for (size_t j = 0; j < m_pclCloud.size(); ++j){
+        if (!isInUpdateColumns(m_pclCloud[j].x, m_pclCloud[j].y, m_octree->getNodeSize(m_pclCloudDepths[j]))){
+          m_pclCloud[kept] = m_pclCloud[j];
+          m_pclCloudDepths[kept] = m_pclCloudDepths[j];
+          ++kept;
+        }
+      }
+      m_pclCloud.resize(kept);
+      m_pclCloudDepths.resize(kept);
     }
 
-    m_fmarkerPub.publish(freeNodesVis);
+    traverseNodes(m_octree->begin_leafs_bbx(m_updateColumnsMinKey, m_updateColumnsMaxKey, m_maxTreeDepth), m_octree->end_leafs_bbx(),
+                  publishMarkerArray, publishFreeMarkerArray, publishPointCloud, true);
+  } else {
+    // each array stores all cubes of a different size, one for each depth level:
+    clearMarkers(m_occupiedNodesVis, m_treeDepth+1);
+    clearMarkers(m_freeNodesVis, m_treeDepth+1);
+    m_pclCloud.clear();
+    m_pclCloudDepths.clear();
+
+    // now, traverse all leafs in the tree:
+    traverseNodes(m_octree->begin(m_maxTreeDepth), m_octree->end(),
+                  publishMarkerArray, publishFreeMarkerArray, publishPointCloud, false);
   }
+  // outputs that are not published now cannot be patched later
+  m_occupiedNodesVisValid = publishMarkerArray;
+  m_freeNodesVisValid = publishFreeMarkerArray;
+  m_pclCloudValid = publishPointCloud;
+  m_gridmapValid = m_publish2DMap;
 
+  // call post-traversal hook:
+  handlePostNodeTraversal(rostime);
 
-  // finish pointcloud:
-  if (publishPointCloud){
-    sensor_msgs::PointCloud2 cloud;
-    pcl::toROSMsg (pclCloud, cloud);
-    cloud.header.frame_id = m_worldFrameId;
-    cloud.header.stamp = rostime;
-    m_pointCloudPub.publish(cloud);
-  }
+  // the outputs are sent as far as their rate limits allow:
+  if (publishMarkerArray && isPublishDue(OCCUPIED_CELLS, rostime, startTime))
+    publishOccupiedCells(rostime);
+
+  if (publishFreeMarkerArray && isPublishDue(FREE_CELLS, rostime, startTime))
+    publishFreeCells(rostime);
 
-  if (publishOctomapUpdate)
+  if (publishPointCloud && isPublishDue(CELL_CENTERS, rostime, startTime))
+    publishCellCenters(rostime);
+
+  if (publishOctomapUpdate && m_updateMsgPending)
     publishOctomapUpdates(rostime);
 
-  if (publishBinaryMap)
+  if (publishBinaryMap && isPublishDue(BINARY_MAP, rostime, startTime))
     publishBinaryOctoMap(rostime);
 
-  if (publishFullMap)
+  if (publishFullMap && isPublishDue(FULL_MAP, rostime, startTime))
     publishFullOctoMap(rostime);
 
 
   double total_elapsed = (ros::WallTime::now() - startTime).toSec();
-  ROS_DEBUG("Map publishing in OctomapServer took %f sec", total_elapsed);
+  ROS_DEBUG("Map publishing in OctomapServer took %f sec (%s)", total_elapsed, m_publishIncremental ? "incremental" : "complete");
+
+}
+
+
+void OctomapServer::updateTreeSnapshot(bool force){
+  if (m_snapshotPeriod <= 0.0)
+    return;
+  ros::WallTime now = ros::WallTime::now();
+  if (!force && m_treeSnapshot && (now - m_lastSnapshot).toSec() < m_snapshotPeriod)
+    return;
+
+  // the update lock keeps the tree unchanged while the queries go on
+  boost::shared_ptr<const OcTree> snapshot(new OcTree(*m_octree));
+  boost::lock_guard<boost::mutex> snapshotLock(m_snapshotMutex);
+  m_treeSnapshot = snapshot;
+  m_lastSnapshot = now;
+}
+
+void OctomapServer::publishOccupiedCells(const ros::Time& rostime){
+  for (unsigned i= 0; i < m_occupiedNodesVis.markers.size(); ++i){
+    double size = m_octree->getNodeSize(i);
+
+    m_occupiedNodesVis.markers[i].header.frame_id = m_worldFrameId;
+    m_occupiedNodesVis.markers[i].header.stamp = rostime;
+    m_occupiedNodesVis.markers[i].ns = "map";
+    m_occupiedNodesVis.markers[i].id = i;
+    m_occupiedNodesVis.markers[i].type = visualization_msgs::Marker::CUBE_LIST;
+    m_occupiedNodesVis.markers[i].scale.x = size;
+    m_occupiedNodesVis.markers[i].scale.y = size;
+    m_occupiedNodesVis.markers[i].scale.z = size;
+    m_occupiedNodesVis.markers[i].color = m_color;
+
+
+    if (m_occupiedNodesVis.markers[i].points.size() > 0)
+      m_occupiedNodesVis.markers[i].action = visualization_msgs::Marker::ADD;
+    else
+      m_occupiedNodesVis.markers[i].action = visualization_msgs::Marker::DELETE;
+  }
+
+  // the cached markers are patched by the next update, the publisher gets a copy
+  queueMessage(OCCUPIED_CELLS, m_markerPub, visualization_msgs::MarkerArrayPtr(new visualization_msgs::MarkerArray(m_occupiedNodesVis)));
+}
+
+void OctomapServer::publishFreeCells(const ros::Time& rostime){
+  for (unsigned i= 0; i < m_freeNodesVis.markers.size(); ++i){
+    double size = m_octree->getNodeSize(i);
+
+    m_freeNodesVis.markers[i].header.frame_id = m_worldFrameId;
+    m_freeNodesVis.markers[i].header.stamp = rostime;
+    m_freeNodesVis.markers[i].ns = "map";
+    m_freeNodesVis.markers[i].id = i;
+    m_freeNodesVis.markers[i].type = visualization_msgs::Marker::CUBE_LIST;
+    m_freeNodesVis.markers[i].scale.x = size;
+    m_freeNodesVis.markers[i].scale.y = size;
+    m_freeNodesVis.markers[i].scale.z = size;
+    m_freeNodesVis.markers[i].color = m_colorFree;
+
+
+    if (m_freeNodesVis.markers[i].points.size() > 0)
+      m_freeNodesVis.markers[i].action = visualization_msgs::Marker::ADD;
+    else
+      m_freeNodesVis.markers[i].action = visualization_msgs::Marker::DELETE;
+  }
+
+  queueMessage(FREE_CELLS, m_fmarkerPub, visualization_msgs::MarkerArrayPtr(new visualization_msgs::MarkerArray(m_freeNodesVis)));
+}
+
+void OctomapServer::publishCellCenters(const ros::Time& rostime){
+  sensor_msgs::PointCloud2Ptr cloud(new sensor_msgs::PointCloud2);
+  pcl::toROSMsg (m_pclCloud, *cloud);
+  cloud->header.frame_id = m_worldFrameId;
+  cloud->header.stamp = rostime;
+  queueMessage(CELL_CENTERS, m_pointCloudPub, cloud);
+}
+
+bool OctomapServer::isPublishDue(PublishedOutput output, const ros::Time& rostime, const ros::WallTime& now){
+  PublishPolicy& policy = m_publishPolicies[output];
+  if (policy.maxRate > 0.0 && (now - policy.lastPublished).toSec() < 1.0/policy.maxRate){
+    policy.pending = true;
+    policy.stamp = rostime;
+    return false;
+  }
+
+  policy.pending = false;
+  policy.lastPublished = now;
+  return true;
+}
+
+void OctomapServer::publishOutput(PublishedOutput output, const ros::Time& rostime){
+  // the caches are only up to date as long as they are published
+  switch (output){
+    case OCCUPIED_CELLS:
+      if (m_occupiedNodesVisValid)
+        publishOccupiedCells(rostime);
+      break;
+    case FREE_CELLS:
+      if (m_freeNodesVisValid)
+        publishFreeCells(rostime);
+      break;
+    case CELL_CENTERS:
+      if (m_pclCloudValid)
+        publishCellCenters(rostime);
+      break;
+    case BINARY_MAP:
+      publishBinaryOctoMap(rostime);
+      break;
+    case FULL_MAP:
+      publishFullOctoMap(rostime);
+      break;
+    default:
+      break;
+  }
+}
+
+void OctomapServer::decayCallback(const ros::WallTimerEvent& event){
+  tf::StampedTransform robotToWorldTf;
+  try{
+    m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, ros::Time(0), robotToWorldTf);
+  } catch(tf::TransformException& ex){
+    ROS_WARN_STREAM_THROTTLE(10.0, ros::this_node::getName() << ": No robot pose for the decay window: " << ex.what());
+    return;
+  }
+
+  TreeUpdateLock lock(m_treeMutex);
+  const double now = ros::Time::now().toSec();
+  const point3d robot = pointTfToOctomap(robotToWorldTf.getOrigin());
+  const point3d radius(m_decayWindowRadius, m_decayWindowRadius, m_decayWindowRadius);
+  OcTreeKey minKey, maxKey;
+  if (!m_octree->coordToKeyChecked(robot - radius, minKey) || !m_octree->coordToKeyChecked(robot + radius, maxKey))
+    return;
+
+  // leafs never stamped (e.g. loaded from a file) start their horizon now
+  std::vector<OcTreeKey> outdated;
+  for (OcTree::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(minKey, maxKey), end = m_octree->end_leafs_bbx(); it != end; ++it){
+    if (!m_octree->isNodeOccupied(*it))
+      continue;
+    std::pair<boost::unordered_map<uint64_t, double>::iterator, bool> stamp = m_lastObserved.insert(std::make_pair(linearKey(it.getKey()), now));
+    if (!stamp.second && now - stamp.first->second > m_decayHorizon)
+      outdated.push_back(it.getKey());
+  }
+  if (outdated.empty())
+    return;
+
+  {
+    TreeWriteLock writeLock(lock);
+    m_updateBBXMin = m_updateBBXMax = outdated[0];
+    for (std::vector<OcTreeKey>::const_iterator it = outdated.begin(); it != outdated.end(); ++it){
+      OcTreeNode* node = m_octree->updateNode(*it, float(-m_decayRate));
+      if (!node || !m_octree->isNodeOccupied(node))
+        m_lastObserved.erase(linearKey(*it));
+      updateMinKey(*it, m_updateBBXMin);
+      updateMaxKey(*it, m_updateBBXMax);
+    }
+
+    if ( edt_dynamicEdt )
+      edt_distanceTransform->update();
+    if ( edt_clearanceMap && edt_clearanceMap->update(m_updateBBXMin, m_updateBBXMax) )
+      publishFootprintMap(ros::Time::now());
+  }
+  ROS_DEBUG("%s: Decayed %zu outdated leafs", ros::this_node::getName().c_str(), outdated.size());
+
+  updateTreeSnapshot(false);
+  publishAll(ros::Time::now());
+}
+
+void OctomapServer::rollingWindowCallback(const ros::WallTimerEvent& event){
+  tf::StampedTransform robotToWorldTf;
+  try{
+    m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, ros::Time(0), robotToWorldTf);
+  } catch(tf::TransformException& ex){
+    ROS_WARN_STREAM_THROTTLE(10.0, ros::this_node::getName() << ": No robot pose for the rolling window: " << ex.what());
+    return;
+  }
+
+  const point3d robot = pointTfToOctomap(robotToWorldTf.getOrigin());
+  size_t pruned = 0;
+  bool edtMoved = false;
+  TreeUpdateLock lock(m_treeMutex);
+  {
+    TreeWriteLock writeLock(lock);
+    pruned = pruneOutsideRadius(robot, m_rollingWindowRadius);
+
+    // the kept part of the grids is shifted, only the exposed cells are read from the tree
+    if ( edt_dynamicEdt && edt_distanceTransform->recenter(robot) ){
+      edt_distanceTransform->update();
+      edtMoved = true;
+    }
+    if ( edt_clearanceMap && edt_clearanceMap->recenter(robot) )
+      publishFootprintMap(ros::Time::now());
+  }
+  if (pruned == 0 && !edtMoved)
+    return;
+  ROS_DEBUG("%s: Pruned %zu nodes outside of the rolling window", ros::this_node::getName().c_str(), pruned);
+
+  updateTreeSnapshot(false);
+  if (pruned > 0)
+    publishAll(ros::Time::now());
+}
+
+size_t OctomapServer::pruneOutsideRadius(const point3d& center, double radius){
+  const size_t size = m_octree->size();
+  if (m_octree->getRoot() && pruneOutsideWindow(m_octree->getRoot(), OcTreeKey(0, 0, 0), 0, center, radius))
+    m_octree->clear();
+  const size_t pruned = size - m_octree->size();
+  if (pruned == 0)
+    return 0;
+
+  const double radiusSq = radius * radius;
+  for (boost::unordered_map<uint64_t, double>::iterator it = m_lastObserved.begin(); it != m_lastObserved.end();){
+    point3d p = m_octree->keyToCoord(linearKeyToKey(it->first));
+    double dx = p.x() - center.x(), dy = p.y() - center.y();
+    if (dx*dx + dy*dy > radiusSq)
+      it = m_lastObserved.erase(it);
+    else
+      ++it;
+  }
+  invalidatePublishCaches();
+  return pruned;
+}
+
+bool OctomapServer::pruneOutsideWindow(OcTreeNode* node, const OcTreeKey& key, unsigned depth, const point3d& center, double radius){
+  // xy distances of center to the closest and the farthest point of the node
+  const double size = m_octree->getNodeSize(depth);
+  const double minX = m_octree->keyToCoord(key[0]) - 0.5 * m_res - center.x();
+  const double minY = m_octree->keyToCoord(key[1]) - 0.5 * m_res - center.y();
+  const double nearX = std::max(0.0, std::max(minX, -minX - size));
+  const double nearY = std::max(0.0, std::max(minY, -minY - size));
+  const double farX = std::max(fabs(minX), fabs(minX + size));
+  const double farY = std::max(fabs(minY), fabs(minY + size));
+  const double radiusSq = radius * radius;
+  if (nearX*nearX + nearY*nearY > radiusSq)
+    return true;
+  // a pruned leaf across the border is kept as a whole
+  if (farX*farX + farY*farY <= radiusSq || depth >= m_treeDepth || !m_octree->nodeHasChildren(node))
+    return false;
+
+  const unsigned half = 1 << (m_treeDepth - depth - 1);
+  bool deleted = false;
+  for (unsigned i = 0; i < 8; ++i){
+    if (!m_octree->nodeChildExists(node, i))
+      continue;
+    OcTreeKey childKey(key[0] + ((i & 1) ? half : 0), key[1] + ((i & 2) ? half : 0), key[2] + ((i & 4) ? half : 0));
+    if (pruneOutsideWindow(m_octree->getNodeChild(node, i), childKey, depth + 1, center, radius)){
+      m_octree->deleteNodeChild(node, i);
+      deleted = true;
+    }
+  }
+  if (!deleted)
+    return false;
+  if (!m_octree->nodeHasChildren(node))
+    return true;
+  node->updateOccupancyChildren();
+  return false;
+}
+
+void OctomapServer::memoryCallback(const ros::WallTimerEvent& event){
+  using squirrel_threading::MemoryPressure;
+  bool throttled = false;
+  {
+    TreeUpdateLock lock(m_treeMutex);
+    m_treeMemory->report(m_octree->memoryUsage());
+    if (m_edtMemory)
+      m_edtMemory->report(edt_distanceTransform->getMemoryUsage());
+    const MemoryPressure pressure = m_treeMemory->pressure();
+
+    // the heavy outputs are throttled until the pressure is released
+    if (pressure != MemoryPressure::NONE && !m_memoryThrottled && m_memoryThrottledRate > 0.0){
+      for (unsigned i = 0; i < NUM_OUTPUTS; ++i){
+        const double rate = m_configuredPublishRates[i];
+        m_publishPolicies[i].maxRate = rate > 0.0 ? std::min(rate, m_memoryThrottledRate) : m_memoryThrottledRate;
+      }
+      m_memoryThrottled = true;
+      std::ostringstream action;
+      action << "throttled the publishing to " << m_memoryThrottledRate << " Hz";
+      m_treeMemory->recordAction(action.str());
+    } else if (pressure == MemoryPressure::NONE){
+      if (m_memoryThrottled){
+        for (unsigned i = 0; i < NUM_OUTPUTS; ++i)
+          m_publishPolicies[i].maxRate = m_configuredPublishRates[i];
+        m_memoryThrottled = false;
+        m_treeMemory->recordAction("restored the publishing rates");
+      }
+      m_memoryCurrentRadius = m_memoryPruneRadius;
+    }
+    throttled = m_memoryThrottled;
+
+    if (pressure == MemoryPressure::HARD){
+      tf::StampedTransform robotToWorldTf;
+      try{
+        m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, ros::Time(0), robotToWorldTf);
+      } catch(tf::TransformException& ex){
+        ROS_WARN_STREAM_THROTTLE(10.0, ros::this_node::getName() << ": No robot pose to degrade the map around: " << ex.what());
+        return;
+      }
+      const point3d robot = pointTfToOctomap(robotToWorldTf.getOrigin());
+
+      size_t merged = 0, pruned = 0;
+      bool edtShrunk = false;
+      {
+        TreeWriteLock writeLock(lock);
+        // the identical children are merged first, without any loss
+        const size_t size = m_octree->size();
+        m_octree->prune();
+        merged = size - m_octree->size();
+        pruned = pruneOutsideRadius(robot, m_memoryCurrentRadius);
+        if (merged > 0 && pruned == 0)
+          invalidatePublishCaches();
+
+        // the distance transform is rebuilt on a smaller box around the robot
+        if (edt_distanceTransform){
+          const double sizeX = edt_maxX - edt_minX, sizeY = edt_maxY - edt_minY;
+          const double newSizeX = std::min(sizeX, std::max(m_memoryMinEdtSize, m_memoryShrinkFactor * sizeX));
+          const double newSizeY = std::min(sizeY, std::max(m_memoryMinEdtSize, m_memoryShrinkFactor * sizeY));
+          if (newSizeX < sizeX || newSizeY < sizeY){
+            edt_minX = robot.x() - 0.5 * newSizeX;
+            edt_maxX = robot.x() + 0.5 * newSizeX;
+            edt_minY = robot.y() - 0.5 * newSizeY;
+            edt_maxY = robot.y() + 0.5 * newSizeY;
+            delete edt_distanceTransform;
+            edt_distanceTransform = new DynamicEDTOctomap((float) edt_maxDist, m_octree, point3d(edt_minX, edt_minY, edt_minZ), point3d(edt_maxX, edt_maxY, edt_maxZ), edt_unknownAsOccupied, edt_sparse);
+            edt_distanceTransform->setBatchInitialize(edt_batchInitialize);
+            edt_distanceTransform->update();
+            edtShrunk = true;
+          }
+        }
+      }
+
+      if (merged > 0 || pruned > 0){
+        std::ostringstream action;
+        action << "merged " << merged << " and pruned " << pruned << " nodes beyond " << m_memoryCurrentRadius << " m";
+        m_treeMemory->recordAction(action.str());
+        m_treeMemory->report(m_octree->memoryUsage());
+      }
+      if (edtShrunk){
+        std::ostringstream action;
+        action << "shrunk the box to " << edt_maxX - edt_minX << "x" << edt_maxY - edt_minY << " m";
+        m_edtMemory->recordAction(action.str());
+        m_edtMemory->report(edt_distanceTransform->getMemoryUsage());
+      }
+      ROS_WARN_THROTTLE(10.0, "%s: Out of the memory budget, merged %zu and pruned %zu nodes beyond %.1f m", ros::this_node::getName().c_str(), merged, pruned, m_memoryCurrentRadius);
+      m_memoryCurrentRadius = std::max(m_memoryMinPruneRadius, m_memoryShrinkFactor * m_memoryCurrentRadius);
+
+      updateTreeSnapshot(false);
+      if (pruned > 0)
+        publishAll(ros::Time::now());
+    }
+  }
+
+  // the outputs skipped by the throttled rates, also without the flush timer
+  if (throttled)
+    publishPendingCallback(event);
+}
+
+void OctomapServer::publishPendingCallback(const ros::WallTimerEvent& event){
+  TreeUpdateLock lock(m_treeMutex);
+  ros::WallTime now = ros::WallTime::now();
+  for (unsigned i = 0; i < NUM_OUTPUTS; ++i){
+    PublishedOutput output = PublishedOutput(i);
+    if (m_publishPolicies[i].pending && isPublishDue(output, m_publishPolicies[i].stamp, now))
+      publishOutput(output, m_publishPolicies[i].stamp);
+  }
+}
+
+void OctomapServer::subscriberCallback(const ros::SingleSubscriberPublisher& pub, PublishedOutput output){
+  // latched topics hold the latest map unless they are published lazily
+  if (!m_latchedTopics || !m_lazyPublish)
+    return;
 
+  TreeUpdateLock lock(m_treeMutex);
+
+  bool cached = (output == BINARY_MAP || output == FULL_MAP)
+      || (output == OCCUPIED_CELLS && m_occupiedNodesVisValid)
+      || (output == FREE_CELLS && m_freeNodesVisValid)
+      || (output == CELL_CENTERS && m_pclCloudValid);
+  if (cached)
+    publishOutput(output, ros::Time::now());
+  else
+    publishAll(ros::Time::now());
 }
 
+void OctomapServer::publisherThread(){
+  boost::unique_lock<boost::mutex> lock(m_publishMutex);
+  while (!m_publisherShutdown){
+    bool idle = true;
+    for (unsigned i = 0; i < NUM_OUTPUTS; ++i){
+      if (m_publishJobs[i]){
+        boost::function<void()> job;
+        job.swap(m_publishJobs[i]);
+        // serialization and sending happen without the lock
+        lock.unlock();
+        job();
+        lock.lock();
+        idle = false;
+      }
+    }
+    if (idle)
+      m_publishCondition.wait(lock);
+  }
+}
 
 bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
@@ -757,6 +1837,15 @@ bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
   ROS_INFO("%s: Sending binary map data on service request", ros::this_node::getName().c_str());
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
+  boost::shared_ptr<const OcTree> snapshot;
+  {
+    boost::lock_guard<boost::mutex> snapshotLock(m_snapshotMutex);
+    snapshot = m_treeSnapshot;
+  }
+  if (snapshot)
+    return octomap_msgs::binaryMapToMsg(*snapshot, res.map);
+
+  TreeReadLock lock(m_treeMutex);
   if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
     return false;
 
@@ -769,37 +1858,146 @@ bool OctomapServer::octomapFullSrv(OctomapSrv::Request  &req,
   ROS_INFO("Sending full map data on service request");
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
+  boost::shared_ptr<const OcTree> snapshot;
+  {
+    boost::lock_guard<boost::mutex> snapshotLock(m_snapshotMutex);
+    snapshot = m_treeSnapshot;
+  }
+  if (snapshot)
+    return octomap_msgs::fullMapToMsg(*snapshot, res.map);
 
-
+  TreeReadLock lock(m_treeMutex);
   if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
     return false;
 
   return true;
 }
 
+bool OctomapServer::octomapChunkSrv(GetOctomapChunk::Request& req, GetOctomapChunk::Response& res){
+  TreeUpdateLock lock(m_treeMutex);
+  // index 0 starts a new stream, the snapshot keeps the indices stable while
+  // the map is updated between the calls
+  if (req.index == 0 || m_mapChunks.empty())
+    listMapChunks(*m_octree, req.depth > 0 ? req.depth : m_mapChunkDepth, m_mapChunks);
+
+  res.num_chunks = m_mapChunks.size();
+  res.resolution = m_res;
+  if (req.index >= m_mapChunks.size())
+    return m_mapChunks.empty();
+
+  const MapChunk& chunk = m_mapChunks[req.index];
+  for (unsigned i = 0; i < 3; ++i)
+    res.key[i] = chunk.key[i];
+  res.depth = chunk.depth;
+  if (!encodeMapChunk(*m_octree, chunk, res.data))
+    ROS_WARN("%s: Chunk %u left the map since the request of the first chunk", ros::this_node::getName().c_str(), req.index);
+
+  if (req.index + 1 == m_mapChunks.size())
+    m_mapChunks.clear();
+  return true;
+}
+
 bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
   point3d min = pointMsgToOctomap(req.min);
   point3d max = pointMsgToOctomap(req.max);
 
-  for(OcTree::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(min,max),
-      end=m_octree->end_leafs_bbx(); it!= end; ++it){
+  TreeUpdateLock lock(m_treeMutex);
+  {
+    TreeWriteLock writeLock(lock);
+    for(OcTree::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(min,max),
+        end=m_octree->end_leafs_bbx(); it!= end; ++it){
 
-    it->setLogOdds(octomap::logodds(m_thresMin));
-    //			m_octree->updateNode(it.getKey(), -6.0f);
-  }
-  // TODO: eval which is faster (setLogOdds+updateInner or updateNode)
-  m_octree->updateInnerOccupancy();
+      it->setLogOdds(octomap::logodds(m_thresMin));
+      //			m_octree->updateNode(it.getKey(), -6.0f);
+    }
+    // TODO: eval which is faster (setLogOdds+updateInner or updateNode)
+    m_octree->updateInnerOccupancy();
 
+    if (edt_clearanceMap)
+      edt_clearanceMap->invalidate(m_octree);
+  }
+  updateTreeSnapshot(true);
+  invalidatePublishCaches();
   publishAll(ros::Time::now());
 
   return true;
 }
 
+bool OctomapServer::mergeOctomapSrv(MergeOctomap::Request& req, MergeOctomap::Response& res){
+  boost::scoped_ptr<AbstractOcTree> tree(octomap_msgs::msgToMap(req.map));
+  OcTree* source = dynamic_cast<OcTree*>(tree.get());
+  if (!source){
+    ROS_ERROR("%s: Cannot merge a map of type %s", ros::this_node::getName().c_str(), req.map.id.c_str());
+    return false;
+  }
+
+  // the offset of the request is the fallback of the transform of the map frame
+  tf::Transform offset;
+  tf::transformMsgToTF(req.offset, offset);
+  if (!req.map.header.frame_id.empty() && req.map.header.frame_id != m_worldFrameId){
+    try {
+      tf::StampedTransform remoteToWorld;
+      m_tfListener.lookupTransform(m_worldFrameId, req.map.header.frame_id, ros::Time(0), remoteToWorld);
+      offset = remoteToWorld;
+    } catch (tf::TransformException& ex){
+      ROS_DEBUG("%s: No transform from %s, merging with the offset of the request", ros::this_node::getName().c_str(), req.map.header.frame_id.c_str());
+    }
+  }
+
+  ros::WallTime startTime = ros::WallTime::now();
+  TreeUpdateLock lock(m_treeMutex);
+  {
+    TreeWriteLock writeLock(lock);
+    MapMerger merger(*m_octree, m_mergeThreads);
+    res.num_leafs = merger.merge(*source, offset, req.replace);
+    if (edt_clearanceMap)
+      edt_clearanceMap->invalidate(m_octree);
+  }
+  ROS_INFO("%s: Merged %u leafs in %f sec", ros::this_node::getName().c_str(), res.num_leafs, (ros::WallTime::now() - startTime).toSec());
+
+  updateTreeSnapshot(true);
+  invalidatePublishCaches();
+  publishAll(ros::Time::now());
+  return true;
+}
+
+void OctomapServer::mergeChangeSetCallback(const OctomapChangeSet::ConstPtr& changes){
+  tf::StampedTransform remoteToWorld;
+  try {
+    m_tfListener.lookupTransform(m_worldFrameId, changes->header.frame_id, changes->header.stamp, remoteToWorld);
+  } catch (tf::TransformException& ex){
+    ROS_WARN_THROTTLE(1.0, "%s: Ignoring change set of %s: %s", ros::this_node::getName().c_str(), changes->header.frame_id.c_str(), ex.what());
+    return;
+  }
+
+  TreeUpdateLock lock(m_treeMutex);
+  {
+    TreeWriteLock writeLock(lock);
+    MapMerger merger(*m_octree, m_mergeThreads);
+    merger.merge(*changes, remoteToWorld);
+    if (edt_clearanceMap)
+      edt_clearanceMap->invalidate(m_octree);
+  }
+  ROS_DEBUG("%s: Merged %u changes of %s", ros::this_node::getName().c_str(), changes->num_changes, changes->header.frame_id.c_str());
+
+  updateTreeSnapshot(false);
+  invalidatePublishCaches();
+  publishAll(changes->header.stamp);
+}
+
 bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp) {
   visualization_msgs::MarkerArray occupiedNodesVis;
   occupiedNodesVis.markers.resize(m_treeDepth +1);
   ros::Time rostime = ros::Time::now();
-  m_octree->clear();
+  TreeUpdateLock lock(m_treeMutex);
+  {
+    TreeWriteLock writeLock(lock);
+    m_octree->clear();
+    m_lastObserved.clear();
+    if (edt_clearanceMap)
+      edt_clearanceMap->invalidate(m_octree);
+  }
+  updateTreeSnapshot(true);
   // clear 2D map:
   m_gridmap.data.clear();
   m_gridmap.info.height = 0.0;
@@ -809,6 +2007,7 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
   m_gridmap.info.origin.position.y = 0.0;
 
   ROS_INFO("%s: Cleared octomap", ros::this_node::getName().c_str());
+  invalidatePublishCaches();
   publishAll(rostime);
 
   publishBinaryOctoMap(rostime);
@@ -823,7 +2022,8 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
   }
 
 
-  m_markerPub.publish(occupiedNodesVis);
+  // queued as well, so that no older markers are sent afterwards
+  queueMessage(OCCUPIED_CELLS, m_markerPub, visualization_msgs::MarkerArrayPtr(new visualization_msgs::MarkerArray(occupiedNodesVis)));
 
 
   visualization_msgs::MarkerArray freeNodesVis;
@@ -838,7 +2038,7 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
     freeNodesVis.markers[i].type = visualization_msgs::Marker::CUBE_LIST;
     freeNodesVis.markers[i].action = visualization_msgs::Marker::DELETE;
   }
-  m_fmarkerPub.publish(freeNodesVis);
+  queueMessage(FREE_CELLS, m_fmarkerPub, visualization_msgs::MarkerArrayPtr(new visualization_msgs::MarkerArray(freeNodesVis)));
 
   return true;
 }
@@ -846,34 +2046,96 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
 void OctomapServer::publishOctomapUpdates(const ros::Time& rostime) {
   m_updateMsg.header.stamp = rostime;
   m_octomapUpdatePub.publish(m_updateMsg);
+  m_updateMsgPending = false;
 }
 
-void OctomapServer::publishBinaryOctoMap(const ros::Time& rostime) const{
+void OctomapServer::publishBinaryOctoMap(const ros::Time& rostime){
 
-  Octomap map;
-  map.header.frame_id = m_worldFrameId;
-  map.header.stamp = rostime;
+  octomap_msgs::OctomapPtr map(new Octomap);
+  map->header.frame_id = m_worldFrameId;
+  map->header.stamp = rostime;
 
-  if (octomap_msgs::binaryMapToMsg(*m_octree, map))
-    m_binaryMapPub.publish(map);
+  if (octomap_msgs::binaryMapToMsg(*m_octree, *map))
+    queueMessage(BINARY_MAP, m_binaryMapPub, map);
   else
     ROS_ERROR("Error serializing OctoMap");
 }
 
-void OctomapServer::publishFullOctoMap(const ros::Time& rostime) const{
+void OctomapServer::publishFullOctoMap(const ros::Time& rostime){
 
-  Octomap map;
-  map.header.frame_id = m_worldFrameId;
-  map.header.stamp = rostime;
+  octomap_msgs::OctomapPtr map(new Octomap);
+  map->header.frame_id = m_worldFrameId;
+  map->header.stamp = rostime;
 
-  if (octomap_msgs::fullMapToMsg(*m_octree, map))
-    m_fullMapPub.publish(map);
+  if (octomap_msgs::fullMapToMsg(*m_octree, *map))
+    queueMessage(FULL_MAP, m_fullMapPub, map);
   else
     ROS_ERROR("Error serializing OctoMap");
 
 }
 
 
+void OctomapServer::prefilterCloud(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground){
+  ground.clear();
+  nonground.clear();
+  ground.header = pc.header;
+  nonground.header = pc.header;
+
+  // points per voxel and lowest point per column
+  const float invVoxelSize = 1.0 / m_prefilterVoxelSize;
+  const uint64_t mask = 0x1fffff;
+  m_prefilterVoxels.clear();
+  m_prefilterColumns.clear();
+  m_prefilterPointVoxels.resize(pc.size());
+  for (size_t i = 0; i < pc.size(); ++i){
+    const pcl::PointXYZ& p = pc[i];
+    const uint64_t voxel = packVoxel(p.x * invVoxelSize, p.y * invVoxelSize, p.z * invVoxelSize);
+    m_prefilterPointVoxels[i] = voxel;
+    PrefilterVoxel& v = m_prefilterVoxels[voxel];
+    if (v.points++ == 0)
+      v.keep = -1;
+    if (m_filterGroundPlane){
+      std::pair<boost::unordered_map<uint64_t, float>::iterator, bool> column = m_prefilterColumns.insert(std::make_pair(voxel >> 21, p.z));
+      if (!column.second)
+        column.first->second = std::min(column.first->second, p.z);
+    }
+  }
+
+  ground.reserve(pc.size());
+  nonground.reserve(pc.size());
+  for (size_t i = 0; i < pc.size(); ++i){
+    const uint64_t voxel = m_prefilterPointVoxels[i];
+    PrefilterVoxel& v = m_prefilterVoxels[voxel];
+    if (v.keep < 0){
+      // occupied voxels among the 26 neighbors, the components wrap as in packVoxel
+      int neighbors = 0;
+      for (int dx = -1; dx <= 1 && neighbors < m_prefilterMinNeighbors; ++dx){
+        for (int dy = -1; dy <= 1 && neighbors < m_prefilterMinNeighbors; ++dy){
+          for (int dz = -1; dz <= 1 && neighbors < m_prefilterMinNeighbors; ++dz){
+            if (dx == 0 && dy == 0 && dz == 0)
+              continue;
+            const uint64_t neighbor = (((voxel >> 42) + dx) & mask) << 42
+                                    | ((((voxel >> 21) & mask) + dy) & mask) << 21
+                                    | (((voxel & mask) + dz) & mask);
+            if (m_prefilterVoxels.find(neighbor) != m_prefilterVoxels.end())
+              ++neighbors;
+          }
+        }
+      }
+      v.keep = neighbors >= m_prefilterMinNeighbors;
+    }
+    if (!v.keep)
+      continue;
+
+    const pcl::PointXYZ& p = pc[i];
+    if (m_filterGroundPlane && std::abs(p.z) <= m_groundFilterPlaneDistance
+        && p.z - m_prefilterColumns[voxel >> 21] <= m_groundFilterDistance)
+      ground.push_back(p);
+    else
+      nonground.push_back(p);
+  }
+}
+
 void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
   ground.header = pc.header;
   nonground.header = pc.header;
@@ -1025,7 +2287,11 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
     ROS_DEBUG("Padded MinKey: %d %d %d / padded MaxKey: %d %d %d", m_paddedMinKey[0], m_paddedMinKey[1], m_paddedMinKey[2], paddedMaxKey[0], paddedMaxKey[1], paddedMaxKey[2]);
     assert(paddedMaxKey[0] >= maxKey[0] && paddedMaxKey[1] >= maxKey[1]);
 
-    m_multires2DScale = 1 << (m_treeDepth - m_maxTreeDepth);
+    unsigned multires2DScale = 1 << (m_treeDepth - m_maxTreeDepth);
+    if (multires2DScale != m_multires2DScale)
+      m_gridBoundsValid = false;
+    m_multires2DScale = multires2DScale;
+    const bool boundsShrunk = growGridBounds(m_paddedMinKey, paddedMaxKey);
     m_gridmap.info.width = (paddedMaxKey[0] - m_paddedMinKey[0])/m_multires2DScale +1;
     m_gridmap.info.height = (paddedMaxKey[1] - m_paddedMinKey[1])/m_multires2DScale +1;
 
@@ -1036,7 +2302,7 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
     // might not exactly be min / max of octree:
     octomap::point3d origin = m_octree->keyToCoord(m_paddedMinKey, m_treeDepth);
     double gridRes = m_octree->getNodeSize(m_maxTreeDepth);
-    m_projectCompleteMap = (!m_incrementalUpdate || (std::abs(gridRes-m_gridmap.info.resolution) > 1e-6));
+    m_projectCompleteMap = (!m_incrementalUpdate || !m_gridmapValid || (std::abs(gridRes-m_gridmap.info.resolution) > 1e-6));
     m_gridmap.info.resolution = gridRes;
     m_gridmap.info.origin.position.x = origin.x() - gridRes*0.5;
     m_gridmap.info.origin.position.y = origin.y() - gridRes*0.5;
@@ -1047,10 +2313,12 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
 
     // workaround for  multires. projection not working properly for inner nodes:
     // force re-building complete map
-    if (m_maxTreeDepth < m_treeDepth)
+    if (m_maxTreeDepth < m_treeDepth || boundsShrunk)
       m_projectCompleteMap = true;
 
 
+    m_mapOriginChanged = m_projectCompleteMap || mapChanged(oldMapInfo, m_gridmap.info);
+
     if(m_projectCompleteMap){
       ROS_DEBUG("Rebuilding complete 2D map");
       m_gridmap.data.clear();
@@ -1059,7 +2327,7 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
 
     } else {
 
-       if (mapChanged(oldMapInfo, m_gridmap.info)){
+       if (m_mapOriginChanged){
           ROS_DEBUG("2D grid map size changed to %dx%d", m_gridmap.info.width, m_gridmap.info.height);
           adjustMapData(m_gridmap, oldMapInfo);
        }
@@ -1079,6 +2347,11 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
        if (max_idx  >= m_gridmap.data.size())
          ROS_ERROR("%s: BBX index not valid: %d (max index %zu for size %d x %d) update-BBX is: [%zu %zu]-[%zu %zu]", ros::this_node::getName().c_str(), max_idx, m_gridmap.data.size(), m_gridmap.info.width, m_gridmap.info.height, mapUpdateBBXMinX, mapUpdateBBXMinY, mapUpdateBBXMaxX, mapUpdateBBXMaxY);
 
+       m_mapUpdateMinX = mapUpdateBBXMinX;
+       m_mapUpdateMinY = mapUpdateBBXMinY;
+       m_mapUpdateMaxX = mapUpdateBBXMaxX;
+       m_mapUpdateMaxY = mapUpdateBBXMaxY;
+
        // reset proj. 2D map in bounding box:
        for (unsigned int j = mapUpdateBBXMinY; j <= mapUpdateBBXMaxY; ++j){
           std::fill_n(m_gridmap.data.begin() + m_gridmap.info.width*j+mapUpdateBBXMinX,
@@ -1090,39 +2363,59 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
 
 void OctomapServer::handlePostNodeTraversal(const ros::Time& rostime){
 
-  if (m_publish2DMap)
-    m_mapPub.publish(m_gridmap);
+  if (m_publish2DMap){
+    // new subscribers need the complete map first
+    uint32_t numSubscribers = m_mapPub.getNumSubscribers();
+    if (m_publishIncremental && !m_mapOriginChanged && numSubscribers == m_mapSubscribers){
+      map_msgs::OccupancyGridUpdate update;
+      update.header = m_gridmap.header;
+      update.x = m_mapUpdateMinX;
+      update.y = m_mapUpdateMinY;
+      update.width = m_mapUpdateMaxX - m_mapUpdateMinX + 1;
+      update.height = m_mapUpdateMaxY - m_mapUpdateMinY + 1;
+      update.data.resize(update.width * update.height);
+      for (unsigned j = 0; j < update.height; ++j){
+        std::copy(m_gridmap.data.begin() + mapIdx(update.x, update.y + j),
+                  m_gridmap.data.begin() + mapIdx(update.x, update.y + j) + update.width,
+                  update.data.begin() + update.width * j);
+      }
+      m_mapUpdatePub.publish(update);
+    } else {
+      m_mapPub.publish(m_gridmap);
+    }
+    m_mapSubscribers = numSubscribers;
+  }
 }
 
-void OctomapServer::handleOccupiedNode(const OcTreeT::iterator& it){
+void OctomapServer::handleOccupiedNode(const OcTreeT::iterator_base& it){
 
   if (m_publish2DMap && m_projectCompleteMap){
     update2DMap(it, true);
   }
 }
 
-void OctomapServer::handleFreeNode(const OcTreeT::iterator& it){
+void OctomapServer::handleFreeNode(const OcTreeT::iterator_base& it){
 
   if (m_publish2DMap && m_projectCompleteMap){
     update2DMap(it, false);
   }
 }
 
-void OctomapServer::handleOccupiedNodeInBBX(const OcTreeT::iterator& it){
+void OctomapServer::handleOccupiedNodeInBBX(const OcTreeT::iterator_base& it){
 
   if (m_publish2DMap && !m_projectCompleteMap){
     update2DMap(it, true);
   }
 }
 
-void OctomapServer::handleFreeNodeInBBX(const OcTreeT::iterator& it){
+void OctomapServer::handleFreeNodeInBBX(const OcTreeT::iterator_base& it){
 
   if (m_publish2DMap && !m_projectCompleteMap){
     update2DMap(it, false);
   }
 }
 
-void OctomapServer::update2DMap(const OcTreeT::iterator& it, bool occupied){
+void OctomapServer::update2DMap(const OcTreeT::iterator_base& it, bool occupied){
 
   // update 2D map (occupied always overrides):
 
@@ -1176,9 +2469,11 @@ bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) const {
 }
 
 void OctomapServer::reconfigureCallback(squirrel_3d_mapping::OctomapServerConfig& config, uint32_t level){
+  TreeUpdateLock lock(m_treeMutex);
   if (m_maxTreeDepth != unsigned(config.max_depth)){
     m_maxTreeDepth = unsigned(config.max_depth);
 
+    invalidatePublishCaches();
     publishAll();
   }
 
@@ -1202,30 +2497,80 @@ void OctomapServer::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::
     return;
   }
 
-  nav_msgs::OccupancyGrid::_data_type oldMapData = map.data;
+  if (map.data.size() < size_t(oldMapInfo.width) * oldMapInfo.height){
+    ROS_ERROR("%s: 2D map data does not match its old size", ros::this_node::getName().c_str());
+    return;
+  }
 
-  map.data.clear();
+  // the old rows are moved into the new map, one memcpy per row
+  nav_msgs::OccupancyGrid::_data_type oldMapData;
+  oldMapData.swap(map.data);
   // init to unknown:
-  map.data.resize(map.info.width * map.info.height, -1);
+  map.data.assign(map.info.width * map.info.height, -1);
 
-  nav_msgs::OccupancyGrid::_data_type::iterator fromStart, fromEnd, toStart;
-
-  for (int j =0; j < int(oldMapInfo.height); ++j ){
-    // copy chunks, row by row:
-    fromStart = oldMapData.begin() + j*oldMapInfo.width;
-    fromEnd = fromStart + oldMapInfo.width;
-    toStart = map.data.begin() + ((j+j_off)*m_gridmap.info.width + i_off);
-    copy(fromStart, fromEnd, toStart);
-
-//    for (int i =0; i < int(oldMapInfo.width); ++i){
-//      map.data[m_gridmap.info.width*(j+j_off) +i+i_off] = oldMapData[oldMapInfo.width*j +i];
-//    }
+  for (int j = 0; j < int(oldMapInfo.height); ++j)
+    memcpy(&map.data[(j + j_off) * map.info.width + i_off], &oldMapData[j * oldMapInfo.width], oldMapInfo.width);
+}
 
+bool OctomapServer::growGridBounds(OcTreeKey& minKey, OcTreeKey& maxKey){
+  if (m_gridGrowth <= 0.0){
+    m_gridBoundsValid = false;
+    return false;
+  }
+  // the first map and a reset one take the bounds of the tree
+  if (!m_gridBoundsValid || m_gridmap.data.empty()){
+    m_gridMinKey = minKey;
+    m_gridMaxKey = maxKey;
+    m_gridBoundsValid = true;
+    return false;
   }
 
+  bool shrunk = false;
+  const int scale = m_multires2DScale;
+  const int maxKeyValue = (1 << m_treeDepth) - 1;
+  for (unsigned i = 0; i < 2; ++i){
+    const int size = int(m_gridMaxKey[i]) - int(m_gridMinKey[i]) + scale;
+    // the tree left at least three quarters of the map along this axis
+    if (4 * (int(maxKey[i]) - int(minKey[i]) + scale) < size){
+      m_gridMinKey[i] = minKey[i];
+      m_gridMaxKey[i] = maxKey[i];
+      shrunk = true;
+      continue;
+    }
+    // margins in whole cells of the 2D map, keeping the keys at their centers
+    const int margin = int(m_gridGrowth * size / scale) * scale;
+    if (minKey[i] < m_gridMinKey[i]){
+      int key = int(minKey[i]) - margin;
+      while (key < 0)
+        key += scale;
+      m_gridMinKey[i] = key;
+    }
+    if (maxKey[i] > m_gridMaxKey[i]){
+      int key = int(maxKey[i]) + margin;
+      while (key > maxKeyValue)
+        key -= scale;
+      m_gridMaxKey[i] = key;
+    }
+  }
+  minKey[0] = m_gridMinKey[0];
+  minKey[1] = m_gridMinKey[1];
+  maxKey[0] = m_gridMaxKey[0];
+  maxKey[1] = m_gridMaxKey[1];
+  return shrunk;
 }
 
 
+void OctomapServer::updateHeightMapColors() {
+  // the colors of the voxel centers, coarser nodes take the one of their voxel
+  unsigned n = std::max(1, int(std::ceil((m_heightMapMaxZ - m_heightMapMinZ) / m_res)));
+  m_heightMapColors.resize(n);
+  for (unsigned i = 0; i < n; ++i){
+    double z = m_heightMapMinZ + (i + 0.5) * m_res;
+    double h = (1.0 - std::min(std::max((z-m_heightMapMinZ)/ (m_heightMapMaxZ - m_heightMapMinZ), 0.0), 1.0)) *m_colorFactor;
+    m_heightMapColors[i] = heightMapColor(h);
+  }
+}
+
 std_msgs::ColorRGBA OctomapServer::heightMapColor(double h) {
 
   std_msgs::ColorRGBA color;
@@ -1277,31 +2622,120 @@ std_msgs::ColorRGBA OctomapServer::heightMapColor(double h) {
 
 bool OctomapServer::checkCollision( squirrel_3d_mapping_msgs::CheckCollision::Request& req, squirrel_3d_mapping_msgs::CheckCollision::Response& res)
 {
-  double p_x = req.pose.x;
-  double p_y = req.pose.y;
-
   // Collision check for the robot platform
-  res.collision = 0;
+  float clearance;
+  TreeReadLock lock(m_treeMutex);
+  if ( !footprintClearance(req.pose.x, req.pose.y, edt_layersLevels, edt_inscribedRadii, clearance) ) {
+    ROS_WARN("%s: couldn't compute distance transform value for such pose", ros::this_node::getName().c_str());
+    return false;
+  }
+  res.collision = clearance <= 0;
+  return true;
+  // TODO: collision check for the arm.
+}
+
+bool OctomapServer::checkPathCollision( CheckPathCollision::Request& req, CheckPathCollision::Response& res)
+{
+  const std::vector<double>& levels = req.layers_levels.empty() ? edt_layersLevels : req.layers_levels;
+  const std::vector<double>& radii = req.layers_levels.empty() ? edt_inscribedRadii : req.inscribed_radii;
+  const int numPoses = (int) req.poses.size();
+  TreeReadLock lock(m_treeMutex);
+
+  res.first_collision = -1;
+  res.clearances.assign(numPoses, std::numeric_limits<float>::quiet_NaN());
+  res.valid = !levels.empty() && levels.size() == radii.size();
+  if ( !res.valid ) {
+    ROS_WARN("%s: inconsistent footprint layers in the path collision check", ros::this_node::getName().c_str());
+    return true;
+  }
+
+  // poses after a known collision are skipped with early_exit, the chunks
+  // are handed out in path order so the first collision is found early
+  int firstCollision = numPoses;
+  bool valid = true;
+  #pragma omp parallel for num_threads(m_insertThreads) schedule(dynamic, 8)
+  for (int i = 0; i < numPoses; ++i){
+    int known;
+    #pragma omp atomic read
+    known = firstCollision;
+    if (req.early_exit && i > known)
+      continue;
+
+    float clearance;
+    if (!footprintClearance(req.poses[i].x, req.poses[i].y, levels, radii, clearance)){
+      #pragma omp critical (path_collision)
+      valid = false;
+      continue;
+    }
+    res.clearances[i] = clearance;
+    if (clearance <= 0){
+      #pragma omp critical (path_collision)
+      firstCollision = std::min(firstCollision, i);
+    }
+  }
+
+  if (firstCollision < numPoses)
+    res.first_collision = firstCollision;
+  res.valid = valid;
+  if (!valid)
+    ROS_WARN("%s: the path leaves the distance transform", ros::this_node::getName().c_str());
+  return true;
+}
+
+bool OctomapServer::footprintClearance(double x, double y, const std::vector<double>& levels, const std::vector<double>& radii, float& clearance) const
+{
+  // the xy distance of the closest obstacle beyond the inscribed radius of
+  // its layer, capped at the distance transform's range
+  clearance = edt_distanceTransform->getMaxDist();
+  if ( edt_clearanceMap && levels == edt_clearanceMap->getLayersLevels() ) {
+    for (unsigned int l=0; l<edt_clearanceMap->getNumLayers(); ++l) {
+      float xy_dist;
+      if ( !edt_clearanceMap->distance(x, y, l, xy_dist) ) {
+        return false;
+      }
+      clearance = std::min(clearance, xy_dist - (float) radii[l]);
+    }
+    return true;
+  }
+
   for (unsigned int i=0; i<=edt_robotHeight/m_res; ++i) {
-    double p_z = i * m_res;
-    point3d p(p_x, p_y, p_z), p_cl;
+    // the closest obstacle is not written beyond the range of the transform
+    point3d p(x, y, i * m_res), p_cl(x, y, std::numeric_limits<float>::infinity());
     float xyz_dist;
-    // float distance = edt_distanceTransform->getDistance(p);
     edt_distanceTransform->getDistanceAndClosestObstacle(p,xyz_dist,p_cl);
-    float xy_dist = xyDistance(p,p_cl);
-    if ( xyz_dist != DynamicEDTOctomap::distanceValue_Error ) {
-      unsigned int l = layer(p_cl.z());
-      res.collision = ( res.collision || (xy_dist <= edt_inscribedRadii[l] && p_cl.z() <= edt_robotHeight) );
-      if ( res.collision ) {
-        return true;
-      }
-    } else {
-      ROS_WARN("%s: couldn't compute distance transform value for such pose", ros::this_node::getName().c_str());
+    if ( xyz_dist == DynamicEDTOctomap::distanceValue_Error ) {
       return false;
     }
+    if ( p_cl.z() <= edt_robotHeight ) {
+      clearance = std::min(clearance, xyDistance(p,p_cl) - (float) radii[layer(p_cl.z(), levels)]);
+    }
   }
   return true;
-  // TODO: collision check for the arm.
+}
+
+void OctomapServer::publishFootprintMap(const ros::Time& rostime){
+  if (edt_footprintMapPub.getNumSubscribers() == 0 && !m_latchedTopics)
+    return;
+
+  nav_msgs::OccupancyGrid footprintMap;
+  footprintMap.header.frame_id = m_worldFrameId;
+  footprintMap.header.stamp = rostime;
+  footprintMap.info.resolution = m_res;
+  footprintMap.info.width = edt_clearanceMap->getSizeX();
+  footprintMap.info.height = edt_clearanceMap->getSizeY();
+  footprintMap.info.origin.position.x = edt_clearanceMap->getOrigin().x() - 0.5 * m_res;
+  footprintMap.info.origin.position.y = edt_clearanceMap->getOrigin().y() - 0.5 * m_res;
+  footprintMap.info.origin.orientation.w = 1.0;
+
+  const unsigned numCells = footprintMap.info.width * footprintMap.info.height;
+  footprintMap.data.assign(numCells, 0);
+  for (unsigned l = 0; l < edt_clearanceMap->getNumLayers(); ++l){
+    for (unsigned i = 0; i < numCells; ++i){
+      if (edt_clearanceMap->getCellDistance(l, i) <= edt_inscribedRadii[l])
+        footprintMap.data[i] = 100;
+    }
+  }
+  edt_footprintMapPub.publish(footprintMap);
 }
 
 } // namespace squirrel_3d_mapping
@@ -40,32 +40,45 @@ OctomapServerMultilayer::OctomapServerMultilayer(ros::NodeHandle private_nh_)
   // TODO: callback for arm_navigation attached objects was removed, is
   // there a replacement functionality?
 
-  // TODO: param maps, limits
-  // right now 0: base, 1: spine, 2: arms
-  ProjectedMap m;
-  m.name = "projected_base_map";
-  m.minZ = 0.0;
-  m.maxZ = 0.3;
-  m.z = 0.0;
-  m_multiGridmap.push_back(m);
-
-  m.name = "projected_spine_map";
-  m.minZ = 0.25;
-  m.maxZ = 1.4;
-  m.z = 0.6;
-  m_multiGridmap.push_back(m);
-
-  m.name = "projected_arm_map";
-  m.minZ = 0.7;
-  m.maxZ = 0.9;
-  m.z = 0.8;
-  m_multiGridmap.push_back(m);
+  // layers as z intervals, by default 0: base, 1: spine, 2: arms
+  std::string layerNames, layerMinZ, layerMaxZ, layerZ, armLayer;
+  private_nh_.param("layers/names", layerNames, std::string("projected_base_map, projected_spine_map, projected_arm_map"));
+  private_nh_.param("layers/min_z", layerMinZ, std::string("0.0, 0.25, 0.7"));
+  private_nh_.param("layers/max_z", layerMaxZ, std::string("0.3, 1.4, 0.9"));
+  private_nh_.param("layers/z", layerZ, std::string("0.0, 0.6, 0.8"));
+  private_nh_.param("layers/arm_layer", armLayer, std::string("projected_arm_map"));
+
+  std::vector<std::string> names = ParameterParser::array<std::string>(layerNames);
+  std::vector<double> minZ = ParameterParser::array<double>(layerMinZ);
+  std::vector<double> maxZ = ParameterParser::array<double>(layerMaxZ);
+  std::vector<double> z = ParameterParser::array<double>(layerZ);
+  if (names.size() != minZ.size() || names.size() != maxZ.size() || names.size() != z.size() || names.size() > 32){
+    ROS_ERROR("%s: Error parsing the layers, expected up to 32 names with min_z, max_z and z each. Shutting down the node...", ros::this_node::getName().c_str());
+    ros::shutdown();
+    names.clear();
+  }
 
+  m_armLayer = -1;
+  for (unsigned i = 0; i < names.size(); ++i){
+    ProjectedMap m;
+    m.name = names[i];
+    m.minZ = minZ[i];
+    m.maxZ = maxZ[i];
+    m.z = z[i];
+    m_multiGridmap.push_back(m);
+    if (m.name == armLayer)
+      m_armLayer = i;
+  }
+  m_layerMasksMinKey = 0;
+  updateLayerMasks();
 
   for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
     ros::Publisher* pub = new ros::Publisher(m_nh.advertise<nav_msgs::OccupancyGrid>(m_multiGridmap.at(i).name, 5, m_latchedTopics));
     m_multiMapPub.push_back(pub);
+    pub = new ros::Publisher(m_nh.advertise<map_msgs::OccupancyGridUpdate>(m_multiGridmap.at(i).name + "_updates", 5));
+    m_multiMapUpdatePub.push_back(pub);
   }
+  m_multiMapSubscribers.assign(m_multiGridmap.size(), 0);
 
   // init arm links (could be params as well)
   m_armLinks.push_back("l_elbow_flex_link");
@@ -95,8 +108,38 @@ OctomapServerMultilayer::OctomapServerMultilayer(ros::NodeHandle private_nh_)
 OctomapServerMultilayer::~OctomapServerMultilayer(){
   for (unsigned i = 0; i < m_multiMapPub.size(); ++i){
     delete m_multiMapPub[i];
+    delete m_multiMapUpdatePub[i];
+  }
+
+}
+
+bool OctomapServerMultilayer::updateLayerMasks(){
+  std::vector<uint32_t> oldMasks;
+  oldMasks.swap(m_layerMasks);
+  int oldMinKey = m_layerMasksMinKey;
+  m_layerMasksMinKey = 0;
+  if (m_multiGridmap.empty())
+    return !oldMasks.empty();
+
+  double minZ = m_multiGridmap[0].minZ, maxZ = m_multiGridmap[0].maxZ;
+  for (unsigned i = 1; i < m_multiGridmap.size(); ++i){
+    minZ = std::min(minZ, m_multiGridmap[i].minZ);
+    maxZ = std::max(maxZ, m_multiGridmap[i].maxZ);
   }
 
+  // one key of margin for the cells touching the limits
+  m_layerMasksMinKey = int(m_octree->coordToKey(minZ)) - 1;
+  int maxKey = int(m_octree->coordToKey(maxZ)) + 1;
+  m_layerMasks.assign(maxKey - m_layerMasksMinKey + 1, 0);
+  for (unsigned k = 0; k < m_layerMasks.size(); ++k){
+    double z = m_octree->keyToCoord(key_type(m_layerMasksMinKey + k));
+    double s2 = m_res/2.0;
+    for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
+      if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ)
+        m_layerMasks[k] |= 1u << i;
+    }
+  }
+  return oldMinKey != m_layerMasksMinKey || oldMasks != m_layerMasks;
 }
 
 void OctomapServerMultilayer::handlePreNodeTraversal(const ros::Time& rostime){
@@ -104,42 +147,41 @@ void OctomapServerMultilayer::handlePreNodeTraversal(const ros::Time& rostime){
   m_publish2DMap = true;
   nav_msgs::MapMetaData gridmapInfo = m_gridmap.info;
 
-  OctomapServer::handlePreNodeTraversal(rostime);
-
-
-  // recalculate height of arm layer (stub, TODO)
-  geometry_msgs::PointStamped vin;
-  vin.point.x = 0;
-  vin.point.y = 0;
-  vin.point.z = 0;
-  vin.header.stamp = rostime;
-  double link_padding = 0.03;
-
-  double minArmHeight = 2.0;
-  double maxArmHeight = 0.0;
-
-  for (unsigned i = 0; i < m_armLinks.size(); ++i){
-    vin.header.frame_id = m_armLinks[i];
-    geometry_msgs::PointStamped vout;
-    const bool found_trans =
-        m_tfListener.waitForTransform("base_footprint", m_armLinks.at(i),
-                                      ros::Time(0), ros::Duration(1.0));
-    ROS_ASSERT_MSG(found_trans, "Timed out waiting for transform to %s",
-                   m_armLinks[i].c_str());
-    m_tfListener.transformPoint("base_footprint",vin,vout);
-    maxArmHeight = std::max(maxArmHeight, vout.point.z + (m_armLinkOffsets.at(i) + link_padding));
-    minArmHeight = std::min(minArmHeight, vout.point.z - (m_armLinkOffsets.at(i) + link_padding));
+  if (m_armLayer >= 0){
+    // recalculate height of arm layer (stub, TODO)
+    geometry_msgs::PointStamped vin;
+    vin.point.x = 0;
+    vin.point.y = 0;
+    vin.point.z = 0;
+    vin.header.stamp = rostime;
+    double link_padding = 0.03;
+
+    double minArmHeight = 2.0;
+    double maxArmHeight = 0.0;
+
+    for (unsigned i = 0; i < m_armLinks.size(); ++i){
+      vin.header.frame_id = m_armLinks[i];
+      geometry_msgs::PointStamped vout;
+      const bool found_trans =
+          m_tfListener.waitForTransform("base_footprint", m_armLinks.at(i),
+                                        ros::Time(0), ros::Duration(1.0));
+      ROS_ASSERT_MSG(found_trans, "Timed out waiting for transform to %s",
+                     m_armLinks[i].c_str());
+      m_tfListener.transformPoint("base_footprint",vin,vout);
+      maxArmHeight = std::max(maxArmHeight, vout.point.z + (m_armLinkOffsets.at(i) + link_padding));
+      minArmHeight = std::min(minArmHeight, vout.point.z - (m_armLinkOffsets.at(i) + link_padding));
+    }
+    ROS_INFO("Arm layer interval adjusted to (%f,%f)", minArmHeight, maxArmHeight);
+    ProjectedMap& armMap = m_multiGridmap.at(m_armLayer);
+    armMap.minZ = minArmHeight;
+    armMap.maxZ = maxArmHeight;
+    armMap.z = (maxArmHeight+minArmHeight)/2.0;
+    // with other cells in the arm layer, it is stale outside of the update columns
+    if (updateLayerMasks())
+      m_gridmapValid = false;
   }
-  ROS_INFO("Arm layer interval adjusted to (%f,%f)", minArmHeight, maxArmHeight);
-  m_multiGridmap.at(2).minZ = minArmHeight;
-  m_multiGridmap.at(2).maxZ = maxArmHeight;
-  m_multiGridmap.at(2).z = (maxArmHeight+minArmHeight)/2.0;
-
-
-
-
 
-  // TODO: also clear multilevel maps in BBX region (see OctomapServer.cpp)?
+  OctomapServer::handlePreNodeTraversal(rostime);
 
   bool mapInfoChanged = mapChanged(gridmapInfo, m_gridmap.info);
 
@@ -148,12 +190,19 @@ void OctomapServerMultilayer::handlePreNodeTraversal(const ros::Time& rostime){
     it->map.info = m_gridmap.info;
     it->map.info.origin.position.z = it->z;
     if (m_projectCompleteMap){
-      ROS_INFO("Map resolution changed, rebuilding complete 2D maps");
+      ROS_DEBUG("Rebuilding complete 2D maps");
       it->map.data.clear();
       // init to unknown:
       it->map.data.resize(it->map.info.width * it->map.info.height, -1);
-    } else if (mapInfoChanged){
-      adjustMapData(it->map, gridmapInfo);
+    } else {
+      if (mapInfoChanged)
+        adjustMapData(it->map, gridmapInfo);
+
+      // reset the layers in the update columns, as the 2D map
+      size_t numCols = m_mapUpdateMaxX - m_mapUpdateMinX + 1;
+      for (unsigned int j = m_mapUpdateMinY; j <= m_mapUpdateMaxY; ++j){
+        std::fill_n(it->map.data.begin() + it->map.info.width*j + m_mapUpdateMinX, numCols, -1);
+      }
     }
   }
 }
@@ -198,22 +247,34 @@ void OctomapServerMultilayer::handlePostNodeTraversal(const ros::Time& rostime){
 
   OctomapServer::handlePostNodeTraversal(rostime);
 
+  // as the 2D map, only the patches of the update columns after the first map
   for (unsigned i = 0; i < m_multiMapPub.size(); ++i){
-    m_multiMapPub[i]->publish(m_multiGridmap.at(i).map);
+    const nav_msgs::OccupancyGrid& map = m_multiGridmap.at(i).map;
+    uint32_t numSubscribers = m_multiMapPub[i]->getNumSubscribers();
+    if (m_publishIncremental && !m_mapOriginChanged && numSubscribers == m_multiMapSubscribers[i]){
+      map_msgs::OccupancyGridUpdate update;
+      update.header = map.header;
+      update.x = m_mapUpdateMinX;
+      update.y = m_mapUpdateMinY;
+      update.width = m_mapUpdateMaxX - m_mapUpdateMinX + 1;
+      update.height = m_mapUpdateMaxY - m_mapUpdateMinY + 1;
+      update.data.resize(update.width * update.height);
+      for (unsigned j = 0; j < update.height; ++j){
+        std::copy(map.data.begin() + mapIdx(update.x, update.y + j),
+                  map.data.begin() + mapIdx(update.x, update.y + j) + update.width,
+                  update.data.begin() + update.width * j);
+      }
+      m_multiMapUpdatePub[i]->publish(update);
+    } else {
+      m_multiMapPub[i]->publish(map);
+    }
+    m_multiMapSubscribers[i] = numSubscribers;
   }
 
 }
-void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occupied){
-  double z = it.getZ();
-  double s2 = it.getSize()/2.0;
-
-  // create a mask on which maps to update:
-  std::vector<bool> inMapLevel(m_multiGridmap.size(), false);
-  for (unsigned i = 0; i < m_multiGridmap.size(); ++i){
-    if (z+s2 >= m_multiGridmap[i].minZ && z-s2 <= m_multiGridmap[i].maxZ){
-      inMapLevel[i] = true;
-    }
-  }
+void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator_base& it, bool occupied){
+  // the layers the node touches:
+  const uint32_t mask = layerMask(it);
 
   if (it.getDepth() == m_maxTreeDepth){
     unsigned idx = mapIdx(it.getKey());
@@ -222,15 +283,7 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
     else if (m_gridmap.data[idx] == -1){
       m_gridmap.data[idx] = 0;
     }
-
-    for (unsigned i = 0; i < inMapLevel.size(); ++i){
-      if (inMapLevel[i]){
-        if (occupied)
-          m_multiGridmap[i].map.data[idx] = 100;
-        else if (m_multiGridmap[i].map.data[idx] == -1)
-          m_multiGridmap[i].map.data[idx] = 0;
-      }
-    }
+    updateLayerCell(idx, occupied, mask);
 
   } else {
     int intSize = 1 << (m_treeDepth - it.getDepth());
@@ -244,20 +297,10 @@ void OctomapServerMultilayer::update2DMap(const OcTreeT::iterator& it, bool occu
         else if (m_gridmap.data[idx] == -1){
           m_gridmap.data[idx] = 0;
         }
-
-        for (unsigned i = 0; i < inMapLevel.size(); ++i){
-          if (inMapLevel[i]){
-            if (occupied)
-              m_multiGridmap[i].map.data[idx] = 100;
-            else if (m_multiGridmap[i].map.data[idx] == -1)
-              m_multiGridmap[i].map.data[idx] = 0;
-          }
-        }
+        updateLayerCell(idx, occupied, mask);
       }
     }
   }
-
-
 }
 
 } // namespace squirrel_3d_mapping
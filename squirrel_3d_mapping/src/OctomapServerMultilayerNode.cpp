@@ -61,8 +61,17 @@ int main(int argc, char** argv){
 
 
 
+  // the callbacks lock the tree themselves, see OctomapServer::TreeUpdateLock
+  int threads = 1;
+  ros::NodeHandle("~").param("concurrency/threads", threads, threads);
+
   try{
-    ros::spin();
+    if (threads > 1){
+      ros::MultiThreadedSpinner spinner(threads);
+      spinner.spin();
+    } else {
+      ros::spin();
+    }
   }catch(std::runtime_error& e){
     ROS_ERROR("squirrel_3d_mapping_multilayer exception: %s", e.what());
     return -1;
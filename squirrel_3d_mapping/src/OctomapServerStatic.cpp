@@ -30,13 +30,24 @@
 #include <ros/ros.h>
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <octomap_msgs/GetOctomap.h>
+#include <squirrel_3d_mapping/CompactOcTree.h>
+#include <squirrel_3d_mapping/GetOctomapBox.h>
 using octomap_msgs::GetOctomap;
+using squirrel_3d_mapping::CompactOcTree;
+using squirrel_3d_mapping::GetOctomapBox;
 
-#define USAGE "\nUSAGE: squirrel_3d_mapping_static <mapfile.[bt|ot]>\n" \
-		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree)\n"
+#define USAGE "\nUSAGE: squirrel_3d_mapping_static <mapfile.[bt|ot|cot]>\n" \
+		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree, .cot: compact tree)\n"
 
 using namespace std;
 using namespace octomap;
@@ -44,90 +55,354 @@ using namespace octomap;
 class OctomapServerStatic{
 public:
   OctomapServerStatic(const std::string& filename)
-    : m_octree(NULL), m_worldFrameId("/map")
+    : m_worldFrameId("/map"), m_filename(filename), m_compact(false), m_octree(NULL), m_compactTree(NULL),
+      m_mmapBinary(false), m_mappedData(NULL), m_mappedSize(0), m_payloadOffset(0),
+      m_binaryCached(false), m_fullCached(false), m_fileTime(0), m_fileSize(0)
   {
 
     ros::NodeHandle private_nh("~");
     private_nh.param("frame_id", m_worldFrameId, m_worldFrameId);
+    private_nh.param("compact", m_compact, false);
+    private_nh.param("mmap_binary", m_mmapBinary, false);
+    double reloadPeriod;
+    private_nh.param("reload_period", reloadPeriod, 0.0);
+
+    if (!load(filename))
+      exit(1);
+
+    m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerStatic::octomapBinarySrv, this);
+    m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerStatic::octomapFullSrv, this);
+    m_octomapBoxService = m_nh.advertiseService("octomap_box", &OctomapServerStatic::octomapBoxSrv, this);
+
+    // the file is polled, a changed map replaces the current one once loaded
+    if (reloadPeriod > 0.0)
+      m_reloadTimer = m_nh.createWallTimer(ros::WallDuration(reloadPeriod), &OctomapServerStatic::reloadCallback, this);
 
+  }
+
+  ~OctomapServerStatic(){
+    clear();
+  }
+
+  bool octomapBinarySrv(GetOctomap::Request  &req,
+                        GetOctomap::Response &res)
+  {
+    ROS_INFO("Sending binary map data on service request");
+    // the payload of a .bt file is the data of its binary message
+    if (m_mappedData){
+      res.map.binary = true;
+      res.map.id = m_octree->getTreeType();
+      res.map.resolution = m_octree->getResolution();
+      res.map.data.assign(m_mappedData + m_payloadOffset, m_mappedData + m_mappedSize);
+    } else {
+      if (!m_binaryCached){
+        if (!binaryMapToMsg(m_binaryMsg))
+          return false;
+        m_binaryCached = true;
+      }
+      res.map = m_binaryMsg;
+    }
+    res.map.header.frame_id = m_worldFrameId;
+    res.map.header.stamp = ros::Time::now();
+    return true;
+  }
+
+  bool octomapFullSrv(GetOctomap::Request  &req,
+                                     GetOctomap::Response &res)
+  {
+    ROS_INFO("Sending full map data on service request");
+    if (!m_fullCached){
+      if (!fullMapToMsg(m_fullMsg))
+        return false;
+      m_fullCached = true;
+    }
+    res.map = m_fullMsg;
+    res.map.header.frame_id = m_worldFrameId;
+    res.map.header.stamp = ros::Time::now();
+    return true;
+  }
+
+  bool octomapBoxSrv(GetOctomapBox::Request  &req,
+                     GetOctomapBox::Response &res)
+  {
+    OcTree* octree = dynamic_cast<OcTree*>(m_octree);
+    if (!octree && !m_compactTree){
+      ROS_WARN("Bounding box maps are only extracted from OcTree maps");
+      return false;
+    }
+
+    const double resolution = octree ? octree->getResolution() : m_compactTree->getResolution();
+    const OcTreeKey minKey = coordToKeyClamped(resolution, req.min.x, req.min.y, req.min.z);
+    const OcTreeKey maxKey = coordToKeyClamped(resolution, req.max.x, req.max.y, req.max.z);
+    ROS_INFO("Sending %s map data of the box [%.2f, %.2f, %.2f] - [%.2f, %.2f, %.2f] on service request",
+             req.binary ? "binary" : "full", req.min.x, req.min.y, req.min.z, req.max.x, req.max.y, req.max.z);
+
+    // only the subtrees overlapping the box are visited, their leafs are copied at their depth
+    OcTree box(resolution);
+    if (octree){
+      for (OcTree::leaf_bbx_iterator it = octree->begin_leafs_bbx(minKey, maxKey), end = octree->end_leafs_bbx();
+           it != end; ++it)
+        insertLeaf(box, it.getKey(), it.getDepth(), it->getLogOdds());
+    } else {
+      BoxLeafs leafs(this, &box, minKey, maxKey);
+      m_compactTree->forEachLeaf(leafs);
+    }
+    box.updateInnerOccupancy();
+
+    res.map.header.frame_id = m_worldFrameId;
+    res.map.header.stamp = ros::Time::now();
+    if (req.binary)
+      return octomap_msgs::binaryMapToMsg(box, res.map);
+    return octomap_msgs::fullMapToMsg(box, res.map);
+  }
+
+private:
+  // copies the leafs of a compact tree overlapping the box
+  struct BoxLeafs {
+    BoxLeafs(OctomapServerStatic* server, OcTree* box, const OcTreeKey& minKey, const OcTreeKey& maxKey)
+      : server(server), box(box), minKey(minKey), maxKey(maxKey) {}
+
+    void operator()(const OcTreeKey& key, unsigned depth, float logOdds) const {
+      const unsigned size = 1u << (CompactOcTree::kTreeDepth - depth);
+      for (unsigned a = 0; a < 3; ++a)
+        if (key[a] > maxKey[a] || key[a] + size <= minKey[a])
+          return;
+      server->insertLeaf(*box, key, depth, logOdds);
+    }
+
+    OctomapServerStatic* server;
+    OcTree* box;
+    OcTreeKey minKey, maxKey;
+  };
+
+  bool load(const std::string& filename){
+    AbstractOccupancyOcTree* octree = NULL;
+    CompactOcTree* compactTree = NULL;
 
     // open file:
     if (filename.length() <= 3){
       ROS_ERROR("Octree file does not have .ot extension");
-      exit(1);
+      return false;
     }
 
     std::string suffix = filename.substr(filename.length()-3, 3);
 
     // .bt files only as OcTree, all other classes need to be in .ot files:
-    if (suffix == ".bt"){
-      OcTree* octree = new OcTree(filename);
+    if (filename.length() > 4 && filename.substr(filename.length()-4, 4) == ".cot"){
+      compactTree = new CompactOcTree(0.1);
+      if (!compactTree->readBinary(filename)){
+        ROS_ERROR("Could not read compact octree from file");
+        delete compactTree;
+        return false;
+      }
+      ROS_INFO("Read compact octree from file %s", filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %zu, memory: %zu bytes", compactTree->getResolution(), compactTree->size(), compactTree->memoryUsage());
+    } else if (suffix == ".bt"){
+      OcTree* bt = new OcTree(0.1);
+      if (!bt->readBinary(filename)){
+        ROS_ERROR("Could not read octree from file");
+        delete bt;
+        return false;
+      }
 
-      m_octree = octree;
+      octree = bt;
     } else if (suffix == ".ot"){
       AbstractOcTree* tree = AbstractOcTree::read(filename);
       if (!tree){
         ROS_ERROR("Could not read octree from file");
-        exit(1);
+        return false;
       }
 
-      m_octree = dynamic_cast<AbstractOccupancyOcTree*>(tree);
+      octree = dynamic_cast<AbstractOccupancyOcTree*>(tree);
+      if (!octree)
+        delete tree;
 
     } else{
       ROS_ERROR("Octree file does not have .bt or .ot extension");
-      exit(1);
+      return false;
     }
 
-    if (!m_octree ){
+    if (!octree && !compactTree){
       ROS_ERROR("Could not read right octree class in file");
-      exit(1);
+      return false;
     }
 
-    ROS_INFO("Read octree type \"%s\" from file %s", m_octree->getTreeType().c_str(), filename.c_str());
-    ROS_INFO("Octree resultion: %f, size: %zu", m_octree->getResolution(), m_octree->size());
-
+    if (octree){
+      ROS_INFO("Read octree type \"%s\" from file %s", octree->getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %zu", octree->getResolution(), octree->size());
+    }
 
-    m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerStatic::octomapBinarySrv, this);
-    m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerStatic::octomapFullSrv, this);
+    // with compact only the compact tree stays in memory, the messages are
+    // built from a temporary octree on request
+    OcTree* ocTree = dynamic_cast<OcTree*>(octree);
+    if (m_compact && ocTree){
+      compactTree = new CompactOcTree(ocTree->getResolution());
+      compactTree->fromOcTree(*ocTree);
+      ROS_INFO("Compact octree: %zu of %zu bytes (%.1f%%)", compactTree->memoryUsage(), ocTree->memoryUsage(),
+               100.0 * compactTree->memoryUsage() / std::max<size_t>(ocTree->memoryUsage(), 1));
+      delete octree;
+      octree = NULL;
+    } else if (m_compact && octree){
+      ROS_WARN("Only OcTree maps can be compacted, keeping the %s", octree->getTreeType().c_str());
+    }
 
+    // the new map replaces the current one only once it is complete
+    clear();
+    m_octree = octree;
+    m_compactTree = compactTree;
+    fileStatus(filename, m_fileTime, m_fileSize);
+    if (m_mmapBinary && suffix == ".bt" && m_octree)
+      mapBinaryFile(filename);
+    return true;
   }
 
-  ~OctomapServerStatic(){
-
+  void clear(){
+    delete m_octree;
+    delete m_compactTree;
+    m_octree = NULL;
+    m_compactTree = NULL;
+    if (m_mappedData)
+      munmap(const_cast<uint8_t*>(m_mappedData), m_mappedSize);
+    m_mappedData = NULL;
+    m_mappedSize = 0;
+    // the messages are serialized again on the next request
+    m_binaryCached = false;
+    m_fullCached = false;
+    m_binaryMsg = octomap_msgs::Octomap();
+    m_fullMsg = octomap_msgs::Octomap();
+  }
 
+  void reloadCallback(const ros::WallTimerEvent& event){
+    time_t fileTime;
+    off_t fileSize;
+    if (!fileStatus(m_filename, fileTime, fileSize) || (fileTime == m_fileTime && fileSize == m_fileSize))
+      return;
+    ROS_INFO("Map file %s changed, reloading", m_filename.c_str());
+    if (!load(m_filename)){
+      // a file still being written is retried on the next poll
+      ROS_ERROR("Could not reload map file %s, keeping the current map", m_filename.c_str());
+    }
   }
 
-  bool octomapBinarySrv(GetOctomap::Request  &req,
-                        GetOctomap::Response &res)
-  {
-    ROS_INFO("Sending binary map data on service request");
-    res.map.header.frame_id = m_worldFrameId;
-    res.map.header.stamp = ros::Time::now();
-    if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
+  static bool fileStatus(const std::string& filename, time_t& fileTime, off_t& fileSize){
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0)
       return false;
-
+    fileTime = status.st_mtime;
+    fileSize = status.st_size;
     return true;
   }
 
-  bool octomapFullSrv(GetOctomap::Request  &req,
-                                     GetOctomap::Response &res)
-  {
-    ROS_INFO("Sending full map data on service request");
-    res.map.header.frame_id = m_worldFrameId;
-    res.map.header.stamp = ros::Time::now();
+  // maps the .bt file and locates the data after its header, the file should
+  // be replaced by renaming a new one over it rather than rewritten in place
+  void mapBinaryFile(const std::string& filename){
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0){
+      ROS_WARN("Could not open %s, the binary map is serialized instead", filename.c_str());
+      return;
+    }
+    struct stat status;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && status.st_size > 0)
+      data = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED){
+      ROS_WARN("Could not map %s, the binary map is serialized instead", filename.c_str());
+      return;
+    }
 
+    // the header is made of text lines up to "data"
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const size_t size = status.st_size;
+    size_t line = 0;
+    bool found = false;
+    while (line < size && !found){
+      size_t next = line;
+      while (next < size && bytes[next] != '\n')
+        ++next;
+      found = next - line >= 4 && std::string(reinterpret_cast<const char*>(bytes + line), 4) == "data";
+      line = next + 1;
+    }
+    if (!found || line > size){
+      ROS_WARN("Could not find the data of %s, the binary map is serialized instead", filename.c_str());
+      munmap(data, size);
+      return;
+    }
 
-    if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
-      return false;
+    m_mappedData = bytes;
+    m_mappedSize = size;
+    m_payloadOffset = line;
+    ROS_INFO("Serving the binary map from the %zu bytes mapped from %s", size - line, filename.c_str());
+  }
 
-    return true;
+  bool binaryMapToMsg(octomap_msgs::Octomap& msg) const {
+    if (m_compactTree){
+      OcTree octree(m_compactTree->getResolution());
+      m_compactTree->toOcTree(octree);
+      return octomap_msgs::binaryMapToMsg(octree, msg);
+    }
+    return octomap_msgs::binaryMapToMsg(*m_octree, msg);
   }
 
-private:
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService;
+  bool fullMapToMsg(octomap_msgs::Octomap& msg) const {
+    if (m_compactTree){
+      OcTree octree(m_compactTree->getResolution());
+      m_compactTree->toOcTree(octree);
+      return octomap_msgs::fullMapToMsg(octree, msg);
+    }
+    return octomap_msgs::fullMapToMsg(*m_octree, msg);
+  }
+
+  static OcTreeKey coordToKeyClamped(double resolution, double x, double y, double z){
+    const double coords[3] = {x, y, z};
+    const int center = 1 << (CompactOcTree::kTreeDepth - 1);
+    OcTreeKey key;
+    for (unsigned a = 0; a < 3; ++a){
+      const double k = std::floor(coords[a] / resolution) + center;
+      key[a] = (key_type) std::min(std::max(k, 0.0), 2.0 * center - 1.0);
+    }
+    return key;
+  }
+
+  // sets the log-odds of the node of depth at key, creating the nodes above it
+  void insertLeaf(OcTree& tree, const OcTreeKey& key, unsigned depth, float logOdds) const {
+    if (!tree.getRoot()){
+      // the root can only be created through an update, drop the path it adds
+      tree.updateNode(OcTreeKey(0, 0, 0), 0.0f, true);
+      OcTreeNode* root = tree.getRoot();
+      for (unsigned i = 0; i < 8; ++i)
+        if (tree.nodeChildExists(root, i))
+          tree.deleteNodeChild(root, i);
+    }
+    OcTreeNode* node = tree.getRoot();
+    const int treeDepth = tree.getTreeDepth();
+    for (unsigned d = 0; d < depth; ++d){
+      const unsigned i = computeChildIdx(key, treeDepth - 1 - d);
+      node = tree.nodeChildExists(node, i) ? tree.getNodeChild(node, i) : tree.createNodeChild(node, i);
+    }
+    node->setLogOdds(logOdds);
+  }
+
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_octomapBoxService;
   ros::NodeHandle m_nh;
+  ros::WallTimer m_reloadTimer;
   std::string m_worldFrameId;
+  std::string m_filename;
+  bool m_compact;
   AbstractOccupancyOcTree* m_octree;
+  CompactOcTree* m_compactTree;
+
+  // optional mapping of the .bt file, the binary data starts at the offset
+  bool m_mmapBinary;
+  const uint8_t* m_mappedData;
+  size_t m_mappedSize, m_payloadOffset;
+
+  // messages serialized at the first request after each load
+  octomap_msgs::Octomap m_binaryMsg, m_fullMsg;
+  bool m_binaryCached, m_fullCached;
+
+  time_t m_fileTime;
+  off_t m_fileSize;
 
 };
 
@@ -43,6 +43,9 @@
 #include <message_filters/synchronizer.h>
 #include <message_filters/sync_policies/approximate_time.h>
 
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
+#include "squirrel_3d_mapping/OctomapChangeSet.h"
+
 using namespace octomap;
 using namespace std;
 using namespace message_filters;
@@ -53,6 +56,7 @@ class PublishOctomap
   private:
     ros::NodeHandle nh;
     ros::Subscriber cloud_sub;
+    ros::Subscriber changes_sub;
     ros::Publisher publisher;
     pcl::KdTreeFLANN <pcl::PointXYZ> kdtree;
     pcl::PCDReader reader;
@@ -61,6 +65,29 @@ class PublishOctomap
     Synchronizer<MySyncPolicy> sync;
     pcl::PointCloud<pcl::PointXYZ>::Ptr cloud;
     ColorOcTree *original_tree;
+    // with incremental, the colored tree is built from the first maps and
+    // then only patched with the changed leafs of the tracking server
+    bool incremental;
+    bool initialized;
+    bool dirty;
+    double publish_rate;
+
+    // green if the leaf is part of the loaded map, blue otherwise
+    void colorize(ColorOcTreeNode* node, const point3d& point)
+    {
+      pcl::PointXYZ pt_pcl;
+      pt_pcl.x = point.x();
+      pt_pcl.y = point.y();
+      pt_pcl.z = point.z();
+      std::vector <int> pointIdxRadiusSearch;
+      std::vector <float> pointRadiusSquaredDistance;
+      if(kdtree.nearestKSearch(pt_pcl,1,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0)
+        if(sqrt(pointRadiusSquaredDistance[0]) < 0.2)
+          node->setColor(0,255,0);
+        else
+          node->setColor(0,0,255);
+    }
+
   public:
 
     string map_filename;
@@ -88,21 +115,31 @@ class PublishOctomap
 
 
     }
-    PublishOctomap():cloud(new pcl::PointCloud<pcl::PointXYZ>),binary_sub(nh,"octomap_binary",50),full_sub(nh, "octomap_full", 50),sync(MySyncPolicy(10), binary_sub, full_sub)
+    PublishOctomap():cloud(new pcl::PointCloud<pcl::PointXYZ>),binary_sub(nh,"octomap_binary",50),full_sub(nh, "octomap_full", 50),sync(MySyncPolicy(10), binary_sub, full_sub),initialized(false),dirty(false)
     {
+      ros::NodeHandle private_nh("~");
+      std::string changes_topic;
+      private_nh.param("incremental", incremental, false);
+      private_nh.param("topic_changes", changes_topic, std::string("changes"));
+      private_nh.param("publish_rate", publish_rate, 10.0);
 
-      publisher = nh.advertise<octomap_msgs::Octomap>("/octomap_full_color",10);//Publising the filtered pointcloud
+      publisher = nh.advertise<octomap_msgs::Octomap>("/octomap_full_color",10,true);//Publising the filtered pointcloud
 //      reader.read("/home/dewan/octo_maps/18012017.pcd",*cloud);
       sync.registerCallback(boost::bind(&PublishOctomap::callback,this, _1, _2));
+      if(incremental)
+        changes_sub = nh.subscribe(changes_topic, 10, &PublishOctomap::changesCallback, this);
 
     }
     void callback(const octomap_msgs::OctomapConstPtr &map_binary, const octomap_msgs::OctomapConstPtr &map_full)
     {
+      // the change sets keep the tree up to date, rebuild only for a new map
+      if(incremental && initialized && fabs(original_tree->getResolution() - map_full->resolution) < 1e-6)
+        return;
 
       octomap::OcTree* octree = new octomap::OcTree(map_full->resolution);
 
       delete original_tree;
-      original_tree = new ColorOcTree(0.05);
+      original_tree = new ColorOcTree(map_binary->resolution);
       //octomap::ColorOcTree* octree_color = new octomap::ColorOcTree(map_binary->resolution);
       std::stringstream datastream;
       if(map_binary->data.size() > 0)
@@ -116,6 +153,7 @@ class PublishOctomap
         octomap::AbstractOcTree* tree = octomap::AbstractOcTree::createTree(map_full->id,map_full->resolution);
         datastream.write((const char*) &map_full->data[0], map_full->data.size());
         tree->readData(datastream);
+        delete octree;
         octree = dynamic_cast<octomap::OcTree*>(tree);
       }
 
@@ -131,40 +169,64 @@ class PublishOctomap
       }
       for(octomap::ColorOcTree::leaf_iterator it = original_tree->begin_leafs(),end = original_tree->end_leafs(); it!= end; ++it)
       {
-
-        octomap::point3d point = it.getCoordinate();
-        pcl::PointXYZ pt_pcl;
-        pt_pcl.x = point.x();
-        pt_pcl.y = point.y();
-        pt_pcl.z = point.z();
-        std::vector <int> pointIdxRadiusSearch;
-        std::vector <float> pointRadiusSquaredDistance;
-        if(kdtree.nearestKSearch(pt_pcl,1,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0)
-          if(sqrt(pointRadiusSquaredDistance[0]) < 0.2)
-            it->setColor(0,255,0);
-          else
-            it->setColor(0,0,255);
-
-      //  fprintf(stderr,"%f\n",it->getOccupancy());
-
-
+        colorize(&*it, it.getCoordinate());
       }
            //delete octree;
       delete octree;
+      initialized = true;
+      dirty = true;
+    }
+
+    // applies the changed leafs of a tracking server's OctomapChangeSet
+    void changesCallback(const squirrel_3d_mapping::OctomapChangeSetConstPtr &changes)
+    {
+      if(!initialized || fabs(original_tree->getResolution() - changes->resolution) > 1e-6)
+        return;
+      if(changes->occupancy.size() * 8 < changes->num_changes)
+        return;
+
+      const bool log_odds = changes->log_odds.size() == changes->num_changes;
+      size_t pos = 0;
+      uint64_t key = 0;
+      for(uint32_t i = 0; i < changes->num_changes; i++)
+      {
+        uint64_t delta;
+        if(!squirrel_3d_mapping::readVarint(changes->keys, pos, delta))
+          break;
+        key += delta;
+        OcTreeKey k = squirrel_3d_mapping::linearKeyToKey(key);
+
+        // same threshold as the full recolor
+        bool occupied = log_odds ? probability(changes->log_odds[i]) >= 0.9 : (changes->occupancy[i / 8] >> (i % 8)) & 1;
+        if(occupied)
+        {
+          ColorOcTreeNode* node = log_odds ? original_tree->setNodeValue(k, changes->log_odds[i]) : original_tree->updateNode(k, true);
+          colorize(node, original_tree->keyToCoord(k));
+        }
+        else
+          original_tree->deleteNode(k);
+      }
+      dirty = true;
     }
 
 
     void run()
     {
-
+      ros::Rate rate(publish_rate);
       while(ros::ok())
       {
-        octomap_msgs::Octomap msg_pub;
-        octomap_msgs::fullMapToMsg(*original_tree, msg_pub);
-        msg_pub.header.frame_id = "map";
-        publisher.publish(msg_pub);
+        // the publisher is latched, serialize the tree only after changes
+        if(dirty)
+        {
+          octomap_msgs::Octomap msg_pub;
+          octomap_msgs::fullMapToMsg(*original_tree, msg_pub);
+          msg_pub.header.frame_id = "map";
+          publisher.publish(msg_pub);
+          dirty = false;
+        }
 
         ros::spinOnce();
+        rate.sleep();
       }
 
 
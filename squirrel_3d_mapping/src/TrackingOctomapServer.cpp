@@ -28,13 +28,28 @@
  */
 
 #include "squirrel_3d_mapping/TrackingOctomapServer.h"
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 
 using namespace octomap;
 
 namespace squirrel_3d_mapping {
 
+namespace {
+
+struct KeyChange {
+  uint64_t key;
+  float logOdds;
+  bool occupied;
+
+  bool operator<(const KeyChange& other) const { return key < other.key; }
+};
+
+} // namespace
+
 TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
 	    OctomapServer()
 {
@@ -60,6 +75,8 @@ TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
   private_nh.param("topic_changes", changeSetTopic, changeSetTopic);
   private_nh.param("track_changes", track_changes, false);
   private_nh.param("listen_changes", listen_changes, false);
+  private_nh.param("compact_changes", compact_changes, false);
+  private_nh.param("compact_changes_log_odds", compact_changes_log_odds, false);
 
   if (track_changes && listen_changes) {
     ROS_WARN("OctoMapServer: It might not be useful to publish changes and at the same time listen to them."
@@ -69,26 +86,34 @@ TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
 
   if (track_changes) {
     ROS_INFO("starting server");
-    pubChangeSet = private_nh.advertise<sensor_msgs::PointCloud2>(
-        changeSetTopic, 1);
+    if (compact_changes)
+      pubChangeSet = private_nh.advertise<OctomapChangeSet>(changeSetTopic, 1);
+    else
+      pubChangeSet = private_nh.advertise<sensor_msgs::PointCloud2>(
+          changeSetTopic, 1);
     m_octree->enableChangeDetection(true);
   }
 
   if (listen_changes) {
     ROS_INFO("starting client");
-    subChangeSet = private_nh.subscribe(changeSetTopic, 1,
-                                        &TrackingOctomapServer::trackCallback, this);
+    if (compact_changes)
+      subChangeSet = private_nh.subscribe(changeSetTopic, 1,
+                                          &TrackingOctomapServer::trackChangeSetCallback, this);
+    else
+      subChangeSet = private_nh.subscribe(changeSetTopic, 1,
+                                          &TrackingOctomapServer::trackCallback, this);
   }
 }
 
 TrackingOctomapServer::~TrackingOctomapServer() {
 }
 
-void TrackingOctomapServer::insertScan(const tf::Point & sensorOrigin, const PCLPointCloud & ground, const PCLPointCloud & nonground) {
-  OctomapServer::insertScan(sensorOrigin, ground, nonground);
-
+void TrackingOctomapServer::handlePostInsertion() {
   if (track_changes) {
-    trackChanges();
+    if (compact_changes)
+      trackChangeSet();
+    else
+      trackChanges();
   }
 }
 
@@ -131,7 +156,93 @@ void TrackingOctomapServer::trackChanges() {
   ROS_DEBUG("[server] octomap size after updating: %d", (int)m_octree->calcNumNodes());
 }
 
+void TrackingOctomapServer::trackChangeSet() {
+  std::vector<KeyChange> changes;
+  changes.reserve(m_octree->numChangesDetected());
+  for (KeyBoolMap::const_iterator iter = m_octree->changedKeysBegin(), end = m_octree->changedKeysEnd(); iter != end; ++iter) {
+    OcTreeNode* node = m_octree->search(iter->first);
+    if (!node)
+      continue;
+
+    KeyChange change;
+    change.key = linearKey(iter->first);
+    change.logOdds = node->getLogOdds();
+    change.occupied = m_octree->isNodeOccupied(node);
+    changes.push_back(change);
+  }
+  std::sort(changes.begin(), changes.end());
+
+  OctomapChangeSetPtr changeSet(new OctomapChangeSet);
+  changeSet->header.frame_id = m_worldFrameId;
+  changeSet->header.stamp = ros::Time::now();
+  changeSet->resolution = m_res;
+  changeSet->num_changes = changes.size();
+  changeSet->keys.reserve(3 * changes.size());
+  changeSet->occupancy.assign((changes.size() + 7) / 8, 0);
+  if (compact_changes_log_odds)
+    changeSet->log_odds.resize(changes.size());
+
+  uint64_t previous = 0;
+  for (size_t i = 0; i < changes.size(); i++) {
+    appendVarint(changeSet->keys, changes[i].key - previous);
+    previous = changes[i].key;
+    if (changes[i].occupied)
+      changeSet->occupancy[i / 8] |= uint8_t(1 << (i % 8));
+    if (compact_changes_log_odds)
+      changeSet->log_odds[i] = changes[i].logOdds;
+  }
+
+  pubChangeSet.publish(changeSet);
+  ROS_DEBUG("[server] sending %d changed entries in %d bytes", (int)changes.size(), (int)changeSet->keys.size());
+
+  m_octree->resetChangeDetection();
+}
+
+void TrackingOctomapServer::trackChangeSetCallback(const OctomapChangeSet::ConstPtr& changes) {
+  TreeUpdateLock lock(m_treeMutex);
+  TreeWriteLock writeLock(lock);
+  if (std::fabs(changes->resolution - m_res) > 1e-6) {
+    ROS_WARN("[client] ignoring change set of resolution %f, the tree has %f", changes->resolution, m_res);
+    return;
+  }
+  if (changes->occupancy.size() * 8 < changes->num_changes) {
+    ROS_WARN("[client] ignoring change set with %d changes but occupancy for %d", (int)changes->num_changes, (int)changes->occupancy.size() * 8);
+    return;
+  }
+
+  const bool logOdds = changes->log_odds.size() == changes->num_changes;
+  size_t pos = 0;
+  uint64_t key = 0;
+  for (uint32_t i = 0; i < changes->num_changes; i++) {
+    uint64_t delta;
+    if (!readVarint(changes->keys, pos, delta)) {
+      ROS_WARN("[client] change set truncated after %d of %d changes", (int)i, (int)changes->num_changes);
+      break;
+    }
+    key += delta;
+
+    OcTreeKey k = linearKeyToKey(key);
+    if (logOdds)
+      m_octree->setNodeValue(k, changes->log_odds[i], false);
+    else
+      m_octree->updateNode(k, (changes->occupancy[i / 8] >> (i % 8)) & 1 ? 1000.0f : -1000.0f, false);
+  }
+  ROS_DEBUG("[client] received %d changed entries", (int)changes->num_changes);
+
+  commitTrackedChanges();
+}
+
+void TrackingOctomapServer::commitTrackedChanges() {
+  m_octree->updateInnerOccupancy();
+  if (edt_clearanceMap)
+    edt_clearanceMap->invalidate(m_octree);
+  invalidatePublishCaches();
+  ROS_DEBUG("[client] octomap size after updating: %d", (int)m_octree->calcNumNodes());
+}
+
 void TrackingOctomapServer::trackCallback(sensor_msgs::PointCloud2Ptr cloud) {
+  TreeUpdateLock lock(m_treeMutex);
+  TreeWriteLock writeLock(lock);
   pcl::PointCloud<pcl::PointXYZI> cells;
   pcl::fromROSMsg(*cloud, cells);
   ROS_DEBUG("[client] size of newly occupied cloud: %i", (int)cells.points.size());
@@ -141,8 +252,7 @@ void TrackingOctomapServer::trackCallback(sensor_msgs::PointCloud2Ptr cloud) {
     m_octree->updateNode(OcTreeKey(pnt.x, pnt.y, pnt.z), pnt.intensity, false);
   }
 
-  m_octree->updateInnerOccupancy();
-  ROS_DEBUG("[client] octomap size after updating: %d", (int)m_octree->calcNumNodes());
+  commitTrackedChanges();
 }
 
 } // namespace squirrel_3d_mapping
@@ -0,0 +1,110 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef DescriptorProjection_H
+#define DescriptorProjection_H
+#include <fstream>
+#include <string>
+#include <vector>
+#include "datatypes_squirrel.h"
+
+///Linear projection of the SHOT descriptors to a space of lower dimension,
+//trained offline by train_descriptor_projection. The rows are orthonormal
+//(principal components) so the squared distances in the reduced space
+//approximate the ones of the descriptors and the same score threshold
+//applies. The file has the dimension, the 352 values of the mean and then
+//one row of 352 values per dimension.
+class DescriptorProjection
+{
+ int dim;
+ std::vector <float> mean;
+ std::vector <float> components;
+
+ public:
+  static const int descriptor_size = 352;
+
+  DescriptorProjection():dim(0) {}
+
+  bool enabled() const { return dim > 0; }
+  int dimension() const { return dim; }
+
+  void set(const std::vector <float> &mean_in,const std::vector <float> &components_in)
+  {
+   mean = mean_in;
+   components = components_in;
+   dim = components.size() / descriptor_size;
+  }
+
+  ///False if the file cannot be read, the projection is then disabled
+  bool load(const std::string &filename)
+  {
+   dim = 0;
+   std::ifstream file(filename.c_str());
+   int d = 0;
+   if(!(file >> d) || d <= 0 || d > descriptor_size)
+    return false;
+   mean.resize(descriptor_size);
+   components.resize(d * descriptor_size);
+   for(auto &value:mean)
+    if(!(file >> value))
+     return false;
+   for(auto &value:components)
+    if(!(file >> value))
+     return false;
+   dim = d;
+   return true;
+  }
+
+  bool save(const std::string &filename) const
+  {
+   std::ofstream file(filename.c_str());
+   file.precision(9);
+   file << dim << "\n";
+   for(size_t i = 0; i < mean.size(); ++i)
+    file << mean[i] << (i + 1 < mean.size() ? " " : "\n");
+   for(size_t i = 0; i < components.size(); ++i)
+    file << components[i] << ((i + 1) % descriptor_size ? " " : "\n");
+   return file.good();
+  }
+
+  ///reduced has the dimension() values of the descriptor
+  void project(const float *descriptor,float *reduced) const
+  {
+   for(int r = 0; r < dim; ++r)
+   {
+    const float *row = &components[r * descriptor_size];
+    float sum = 0.0f;
+    for(int i = 0; i < descriptor_size; ++i)
+     sum += row[i] * (descriptor[i] - mean[i]);
+    reduced[r] = sum;
+   }
+  }
+
+  ///Projects the descriptors of the indices into consecutive rows of reduced
+  void project(const SHOTCloud &feature,const std::vector <int> &indices,std::vector <float> &reduced) const
+  {
+   reduced.resize(indices.size() * dim);
+#pragma omp parallel for
+   for(size_t i = 0; i < indices.size(); ++i)
+    project(feature.points[indices[i]].descriptor,&reduced[i * dim]);
+  }
+};
+#endif
@@ -39,6 +39,9 @@ template <class PointType,class NormalType> void cal_normal(boost::shared_ptr<pc
 
 template <class PointType,class NormalType> void cal_normal(boost::shared_ptr<pcl::PointCloud<PointType> > cloud_input,boost::shared_ptr<pcl::PointCloud<NormalType> >normal,boost::shared_ptr<pcl::PointCloud<PointType> > search_surface,float search_radius,int number_neighbours,std::vector<int> &indices);
 
+///the tree is an index of search_surface built beforehand, it is not rebuilt
+template <class PointType,class NormalType> void cal_normal(boost::shared_ptr<pcl::PointCloud<PointType> > cloud_input,boost::shared_ptr<pcl::PointCloud<NormalType> >normal,boost::shared_ptr<pcl::PointCloud<PointType> > search_surface,const boost::shared_ptr<pcl::search::KdTree<PointType> > &tree,float search_radius,int number_neighbours);
+
 };
 
 
@@ -25,6 +25,7 @@
 #ifndef EuclideanClusteringMesh_H
 #define EuclideanClusteringMesh_H
 #include "mesh_triangulation_cpu.h"
+#include "VoxelGridIndex.h"
 using namespace std;
 
 
@@ -40,6 +41,18 @@ void clustering( const pcl::PolygonMesh &triangles , const int min_cluster_size
 
 void extract_clusters(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &clusters ,std::vector< std::vector <int > > &neighbours, const float search_radius , const int max_neighbors,const int min_size);
 
+///Region growing over a neighbourhood graph, the clusters with more than
+//min_cluster_size points are kept
+void clustering(const std::vector< std::vector <int > > &neighbours , const int min_cluster_size , std::vector< std::vector <int> > &clusters);
+
+///Neighbourhood graphs without triangulation, symmetric as the one of the
+//mesh. For an organized cloud the 8 neighbours in the image closer than
+//max_distance (no depth discontinuity), otherwise the max_neighbors closest
+//points within max_distance found in a voxel grid
+void organized_neighbours(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &neighbours , const float max_distance);
+void voxel_neighbours(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &neighbours , const float max_distance , const int max_neighbors);
+void extract_clusters_graph(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &clusters ,std::vector< std::vector <int > > &neighbours, const float max_distance , const int max_neighbors,const int min_size);
+
 
 };
 
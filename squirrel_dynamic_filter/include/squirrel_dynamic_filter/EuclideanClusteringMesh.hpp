@@ -168,10 +168,101 @@ inline void EuclideanClusteringMesh::extract_clusters(const PointCloud::Ptr &clo
 
 }
 
+inline void EuclideanClusteringMesh::clustering(const std::vector< std::vector <int > > &neighbours , const int min_cluster_size , std::vector< std::vector <int> > &clusters)
+{
+ std::vector <bool> processed (neighbours.size (), false);
+ for (size_t i = 0; i < neighbours.size (); ++i)
+ {
+  if (processed[i])
+   continue;
+  std::vector <int> seed_queue;
+  seed_queue.push_back (static_cast<int> (i));
+  processed[i] = true;
+  for (size_t sq_idx = 0; sq_idx < seed_queue.size (); ++sq_idx)
+  {
+   for (auto &neighbour:neighbours[seed_queue[sq_idx]])
+   {
+    if (processed[neighbour])
+     continue;
+    processed[neighbour] = true;
+    seed_queue.push_back (neighbour);
+   }
+  }
+  if(seed_queue.size()>min_cluster_size)
+   clusters.push_back(seed_queue);
+ }
+}
 
+inline void EuclideanClusteringMesh::organized_neighbours(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &neighbours , const float max_distance)
+{
+ const int width = cloud_input->width;
+ const int height = cloud_input->height;
+ const float squared_distance = max_distance * max_distance;
+ neighbours.assign(cloud_input->points.size(),std::vector<int>());
+#pragma omp parallel for
+ for (int v = 0; v < height; ++v)
+  for (int u = 0; u < width; ++u)
+  {
+   const Point &point = cloud_input->points[v * width + u];
+   if (!pcl::isFinite(point))
+    continue;
+   for (int dv = -1; dv <= 1; ++dv)
+    for (int du = -1; du <= 1; ++du)
+    {
+     if ((du == 0 && dv == 0) || u + du < 0 || u + du >= width || v + dv < 0 || v + dv >= height)
+      continue;
+     const int index = (v + dv) * width + u + du;
+     const Point &neighbour = cloud_input->points[index];
+     if (pcl::isFinite(neighbour) && (neighbour.getVector3fMap() - point.getVector3fMap()).squaredNorm() < squared_distance)
+      neighbours[v * width + u].push_back(index);
+    }
+  }
+}
 
+inline void EuclideanClusteringMesh::voxel_neighbours(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &neighbours , const float max_distance , const int max_neighbors)
+{
+ VoxelGridIndex grid;
+ grid.setInputCloud(cloud_input,max_distance);
+ neighbours.assign(cloud_input->points.size(),std::vector<int>());
+#pragma omp parallel
+ {
+  std::vector< std::pair<float,int> > candidates;
+#pragma omp for schedule(dynamic,64)
+  for (size_t i = 0; i < cloud_input->points.size(); ++i)
+  {
+   candidates.clear();
+   grid.radiusSearch(cloud_input->points[i],max_distance,[&](int index,float distance)
+   {
+    if (index != static_cast<int>(i))
+     candidates.push_back(std::make_pair(distance,index));
+   });
+   const size_t k = std::min<size_t>(max_neighbors,candidates.size());
+   std::partial_sort(candidates.begin(),candidates.begin() + k,candidates.end());
+   for (size_t j = 0; j < k; ++j)
+    neighbours[i].push_back(candidates[j].second);
+  }
+ }
+///the closest points of a point may not have it among theirs
+ std::vector <size_t> num_closest(neighbours.size());
+ for (size_t i = 0; i < neighbours.size(); ++i)
+  num_closest[i] = neighbours[i].size();
+ for (size_t i = 0; i < neighbours.size(); ++i)
+  for (size_t j = 0; j < num_closest[i]; ++j)
+   neighbours[neighbours[i][j]].push_back(i);
+ for (auto &list:neighbours)
+ {
+  std::sort(list.begin(),list.end());
+  list.erase(std::unique(list.begin(),list.end()),list.end());
+ }
+}
 
-
-
+inline void EuclideanClusteringMesh::extract_clusters_graph(const PointCloud::Ptr &cloud_input , std::vector< std::vector <int > > &clusters ,std::vector< std::vector <int > > &neighbours, const float max_distance , const int max_neighbors, const int min_size)
+{
+ if (cloud_input->isOrganized())
+  organized_neighbours(cloud_input,neighbours,max_distance);
+ else
+  voxel_neighbours(cloud_input,neighbours,max_distance,max_neighbors);
+ clustering(neighbours,min_size,clusters);
+}
 
 #endif
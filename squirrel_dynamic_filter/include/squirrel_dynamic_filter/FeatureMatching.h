@@ -0,0 +1,92 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FeatureMatching_H
+#define FeatureMatching_H
+#include <algorithm>
+#include <utility>
+#include <vector>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+///Squared euclidean distance of two SHOT descriptors of 352 floats, with AVX
+//if the compiler targets it (e.g. -mavx or -march=native), otherwise with
+//eight independent sums the compiler can vectorize
+inline float SquaredDistanceSHOT(const float *a,const float *b)
+{
+ const int size = 352;
+#ifdef __AVX__
+ __m256 sum_0 = _mm256_setzero_ps();
+ __m256 sum_1 = _mm256_setzero_ps();
+ for(int i = 0; i < size; i += 16)
+ {
+  const __m256 diff_0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),_mm256_loadu_ps(b + i));
+  const __m256 diff_1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),_mm256_loadu_ps(b + i + 8));
+  sum_0 = _mm256_add_ps(sum_0,_mm256_mul_ps(diff_0,diff_0));
+  sum_1 = _mm256_add_ps(sum_1,_mm256_mul_ps(diff_1,diff_1));
+ }
+ const __m256 sum = _mm256_add_ps(sum_0,sum_1);
+ __m128 partial = _mm_add_ps(_mm256_castps256_ps128(sum),_mm256_extractf128_ps(sum,1));
+ partial = _mm_add_ps(partial,_mm_movehl_ps(partial,partial));
+ partial = _mm_add_ss(partial,_mm_shuffle_ps(partial,partial,1));
+ return _mm_cvtss_f32(partial);
+#else
+ float sum[8] = {0.0f,0.0f,0.0f,0.0f,0.0f,0.0f,0.0f,0.0f};
+ for(int i = 0; i < size; i += 8)
+  for(int j = 0; j < 8; ++j)
+  {
+   const float diff = a[i + j] - b[i + j];
+   sum[j] += diff * diff;
+  }
+ return ((sum[0] + sum[1]) + (sum[2] + sum[3])) + ((sum[4] + sum[5]) + (sum[6] + sum[7]));
+#endif
+}
+
+///Squared euclidean distance of two descriptors of any size, e.g. the
+//projected ones
+inline float SquaredDistance(const float *a,const float *b,int size)
+{
+ float sum[4] = {0.0f,0.0f,0.0f,0.0f};
+ int i = 0;
+ for(; i + 4 <= size; i += 4)
+  for(int j = 0; j < 4; ++j)
+  {
+   const float diff = a[i + j] - b[i + j];
+   sum[j] += diff * diff;
+  }
+ for(; i < size; ++i)
+  sum[0] += (a[i] - b[i]) * (a[i] - b[i]);
+ return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+///Moves the k candidates (index, distance) with the smallest distance to the
+//front, sorted, the order of the others is unspecified
+inline void SelectBestCandidates(std::vector< std::pair<int,float> > &candidates,size_t k)
+{
+ k = std::min(k,candidates.size());
+ auto closer = [](const std::pair<int,float> &a,const std::pair<int,float> &b) { return a.second < b.second; };
+ if(k < candidates.size())
+  std::nth_element(candidates.begin(),candidates.begin() + k,candidates.end(),closer);
+ std::sort(candidates.begin(),candidates.begin() + k,closer);
+}
+#endif
@@ -47,6 +47,8 @@ class FeatureEstimationSHOT
 
   void estimateFeature(const PointCloud::Ptr &cloud_1,const PointCloud::Ptr &search_surface,const float normal_radius,const float feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature,std::vector<int> &finite_points);
 
+  void estimateFeature(const PointCloud::Ptr &cloud_1,const PointCloud::Ptr &search_surface,const PointSearch::Ptr &search_surface_index,const float normal_radius,const float feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature,std::vector<int> &finite_points);
+
 void estimateFeature(const PointCloud::Ptr &scene,const NormalCloud::Ptr &cloud_normal,const std::vector <float> &feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature, std::vector<int> &finite_points);
 
   void estimateFeature(const PointCloud::Ptr &cloud_1,const NormalCloud::Ptr &cloud_normal,const float feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature, std::vector<int> &finite_points);
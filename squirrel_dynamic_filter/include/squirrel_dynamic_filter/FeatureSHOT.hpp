@@ -27,6 +27,7 @@
 
 #include "FeatureSHOT.h"
 #include <chrono>
+#include <squirrel_threading/thread_policy.h>
 inline FeatureEstimationSHOT::FeatureEstimationSHOT()
 {
 
@@ -90,7 +91,7 @@ scene->points = scene_temp->points;
 
 
  pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
- pfh.setNumberOfThreads(8);
+ pfh.setNumberOfThreads(squirrel_threading::currentPolicy().num_threads);
  pfh.setInputCloud (scene);
  pfh.setInputNormals (cloud_normal);
  pfh.setSearchMethod (tree);
@@ -114,10 +115,21 @@ end = std::chrono::system_clock::now();
 }
 
 inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,const PointCloud::Ptr &search_surface,const float normal_radius,const float feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature,std::vector<int> &finite_points)
+{
+ PointSearch::Ptr search_surface_index(new PointSearch);
+ search_surface_index->setInputCloud(search_surface);
+ estimateFeature(scene,search_surface,search_surface_index,normal_radius,feature_radius,feature,finite_points);
+}
+
+///search_surface_index is an index of search_surface, the normals of the
+//surface are estimated with it instead of a new one. If all of the normals
+//are finite the descriptors use it too, otherwise an index of the points
+//with a normal is built
+inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,const PointCloud::Ptr &search_surface,const PointSearch::Ptr &search_surface_index,const float normal_radius,const float feature_radius,pcl::PointCloud<pcl::SHOT352>::Ptr &feature,std::vector<int> &finite_points)
 {
  NormalCloud::Ptr cloud_normal_temp(new NormalCloud);
  NormalCloud::Ptr cloud_normal(new NormalCloud);
- estimate_normal.cal_normal<Point,PointNormal>(search_surface,cloud_normal_temp,search_surface,normal_radius,0);
+ estimate_normal.cal_normal<Point,PointNormal>(search_surface,cloud_normal_temp,search_surface,search_surface_index,normal_radius,0);
  PointCloud::Ptr scene_temp(new PointCloud);
  std::vector <int> normal_indices;
 
@@ -136,12 +148,20 @@ inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,
 // search_surface->points.clear();
 // search_surface->points = scene_temp->points;
 
- pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
- pfh.setNumberOfThreads(8);
+ pfh.setNumberOfThreads(squirrel_threading::currentPolicy().num_threads);
  pfh.setInputCloud (scene);
  pfh.setInputNormals (cloud_normal);
- pfh.setSearchMethod (tree);
- pfh.setSearchSurface (scene_temp);
+ if(scene_temp->points.size() == search_surface->points.size())
+ {
+  pfh.setSearchMethod (search_surface_index);
+  pfh.setSearchSurface (search_surface);
+ }
+ else
+ {
+  pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+  pfh.setSearchMethod (tree);
+  pfh.setSearchSurface (scene_temp);
+ }
  pfh.setRadiusSearch (feature_radius);
  pfh.compute (*feature);
  for(size_t j = 0; j < feature->points.size(); ++j)
@@ -175,7 +195,7 @@ inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,
 {
 
  pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
- pfh.setNumberOfThreads(8);
+ pfh.setNumberOfThreads(squirrel_threading::currentPolicy().num_threads);
  pfh.setInputCloud (scene);
  pfh.setInputNormals (cloud_normal);
  pfh.setSearchMethod (tree);
@@ -197,22 +217,25 @@ inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,
 
   feature->points.resize(scene->points.size());
 
-#pragma omp parallel for
- for(size_t j = 0; j < scene->points.size(); ++j)
+////one index of the scene shared by the threads, each thread has its own
+//estimator and only changes the point and the radius
+ pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
+ tree->setInputCloud (scene);
+#pragma omp parallel
  {
-
   PointCloud::Ptr cloud(new PointCloud);
-
+  cloud->points.resize(1);
   pcl::PointCloud < pcl::SHOT352 >::Ptr cloud_feature(new pcl::PointCloud < pcl::SHOT352 >);
-
-  cloud->points.push_back(scene->points[j]);
-
   pcl::SHOTEstimationOMP<Point, PointNormal, pcl::SHOT352> pfh;
-  pcl::search::KdTree<Point>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZ>);
   pfh.setNumberOfThreads(1);
   pfh.setSearchMethod (tree);
   pfh.setSearchSurface (scene);
   pfh.setInputNormals (cloud_normal);
+
+#pragma omp for
+ for(size_t j = 0; j < scene->points.size(); ++j)
+ {
+  cloud->points[0] = scene->points[j];
   pfh.setInputCloud (cloud);
   pfh.setRadiusSearch (feature_radius[j]);
   if(feature_radius[j] > 0.0)
@@ -225,6 +248,7 @@ inline void FeatureEstimationSHOT::estimateFeature(const PointCloud::Ptr &scene,
 
 
 
+ }
  }
  for(size_t j = 0; j < scene->points.size(); ++j)
  {
@@ -0,0 +1,283 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef FrameLog_H
+#define FrameLog_H
+#include <pcl/point_cloud.h>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+///Results of one frame of the dynamic filter, as stored by store_results:
+//the scan, the correspondences with the next scan, the motion of the points
+//with one (saved_points, motions, transformed_points, scores) and the timings
+struct FrameRecord
+{
+ int32_t frame_id;
+ double odometry[7];
+ double timings[4];///feature, correspondence, motion, total
+ std::vector <float> raw_points;///x,y,z
+ std::vector <int32_t> index_query;
+ std::vector <int32_t> index_match;
+ std::vector <float> saved_points;///x,y,z
+ std::vector <double> motions;///x,y,z,qx,qy,qz,qw
+ std::vector <float> transformed_points;///x,y,z
+ std::vector <float> scores;
+ FrameRecord():frame_id(-1)
+ {
+  std::memset(odometry,0,sizeof(odometry));
+  std::memset(timings,0,sizeof(timings));
+ }
+ void clear()
+ {
+  raw_points.clear();
+  index_query.clear();
+  index_match.clear();
+  saved_points.clear();
+  motions.clear();
+  transformed_points.clear();
+  scores.clear();
+ }
+};
+
+template <class PointType> void AppendPoints(const pcl::PointCloud<PointType> &cloud,std::vector<float> &points)
+{
+ points.reserve(points.size() + 3 * cloud.points.size());
+ for(auto &point:cloud.points)
+ {
+  points.push_back(point.x);
+  points.push_back(point.y);
+  points.push_back(point.z);
+ }
+}
+
+template <class PointType> void ToCloud(const std::vector<float> &points,pcl::PointCloud<PointType> &cloud)
+{
+ cloud.points.resize(points.size() / 3);
+ for(size_t i = 0; i < cloud.points.size(); ++i)
+ {
+  cloud.points[i].x = points[3 * i];
+  cloud.points[i].y = points[3 * i + 1];
+  cloud.points[i].z = points[3 * i + 2];
+ }
+ cloud.width = cloud.points.size();
+ cloud.height = 1;
+}
+
+///Append-only log of the frames of a run: a magic header, then the frames
+//prefixed by their size in bytes. Fixed-size fields come first, then each
+//array as its number of elements and its data, in native byte order.
+namespace frame_log
+{
+const char kMagic[8] = {'D','F','L','O','G','0','0','1'};
+
+template <class T> void append(std::string &buffer,const T *data,size_t count)
+{
+ buffer.append(reinterpret_cast<const char*>(data),count * sizeof(T));
+}
+
+template <class T> void appendArray(std::string &buffer,const std::vector<T> &array)
+{
+ const uint64_t count = array.size();
+ append(buffer,&count,1);
+ append(buffer,array.data(),array.size());
+}
+
+template <class T> bool read(const char *&p,const char *end,T *data,size_t count)
+{
+ if(static_cast<size_t>(end - p) < count * sizeof(T))
+  return false;
+ std::memcpy(data,p,count * sizeof(T));
+ p += count * sizeof(T);
+ return true;
+}
+
+template <class T> bool readArray(const char *&p,const char *end,std::vector<T> &array)
+{
+ uint64_t count;
+ if(!read(p,end,&count,1) || static_cast<uint64_t>(end - p) / sizeof(T) < count)
+  return false;
+ array.resize(count);
+ return read(p,end,array.data(),count);
+}
+
+inline void serialize(const FrameRecord &record,std::string &buffer)
+{
+ buffer.clear();
+ append(buffer,&record.frame_id,1);
+ append(buffer,record.odometry,7);
+ append(buffer,record.timings,4);
+ appendArray(buffer,record.raw_points);
+ appendArray(buffer,record.index_query);
+ appendArray(buffer,record.index_match);
+ appendArray(buffer,record.saved_points);
+ appendArray(buffer,record.motions);
+ appendArray(buffer,record.transformed_points);
+ appendArray(buffer,record.scores);
+}
+
+inline bool deserialize(const std::string &buffer,FrameRecord &record)
+{
+ const char *p = buffer.data();
+ const char *end = p + buffer.size();
+ return read(p,end,&record.frame_id,1) && read(p,end,record.odometry,7) && read(p,end,record.timings,4) &&
+        readArray(p,end,record.raw_points) && readArray(p,end,record.index_query) && readArray(p,end,record.index_match) &&
+        readArray(p,end,record.saved_points) && readArray(p,end,record.motions) && readArray(p,end,record.transformed_points) &&
+        readArray(p,end,record.scores);
+}
+}
+
+///Writes the frames in background, so that the filter never waits for the
+//disk unless max_queue frames are pending
+class FrameLogWriter
+{
+ public:
+  FrameLogWriter():stop_(false),max_queue_(16) {}
+  ~FrameLogWriter() { close(); }
+
+  bool open(const std::string &filename,size_t max_queue = 16)
+  {
+   close();
+   file_.open(filename.c_str(),std::ios::binary | std::ios::trunc);
+   if(!file_.is_open())
+    return false;
+   file_.write(frame_log::kMagic,sizeof(frame_log::kMagic));
+   max_queue_ = max_queue > 0 ? max_queue : 1;
+   stop_ = false;
+   thread_ = std::thread(&FrameLogWriter::writeLoop,this);
+   return true;
+  }
+
+  inline bool isOpen() const { return thread_.joinable(); }
+
+  ///the record is moved to the queue
+  void push(FrameRecord &record)
+  {
+   std::unique_lock<std::mutex> lock(mutex_);
+   not_full_.wait(lock,[this]{ return queue_.size() < max_queue_; });
+   queue_.emplace_back();
+   std::swap(queue_.back(),record);
+   not_empty_.notify_one();
+  }
+
+  ///writes the pending frames before closing the file
+  void close()
+  {
+   if(!thread_.joinable())
+    return;
+   {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+   }
+   not_empty_.notify_one();
+   thread_.join();
+   file_.close();
+  }
+
+ private:
+  void writeLoop()
+  {
+   std::string buffer;
+   FrameRecord record;
+   while(true)
+   {
+    {
+     std::unique_lock<std::mutex> lock(mutex_);
+     not_empty_.wait(lock,[this]{ return stop_ || !queue_.empty(); });
+     if(queue_.empty())
+      return;
+     std::swap(record,queue_.front());
+     queue_.pop_front();
+    }
+    not_full_.notify_one();
+    frame_log::serialize(record,buffer);
+    const uint64_t size = buffer.size();
+    file_.write(reinterpret_cast<const char*>(&size),sizeof(size));
+    file_.write(buffer.data(),buffer.size());
+   }
+  }
+
+  std::ofstream file_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_, not_full_;
+  std::deque <FrameRecord> queue_;
+  bool stop_;
+  size_t max_queue_;
+};
+
+///Random access to the frames of a log, the offsets of the frames are
+//indexed when the log is opened
+class FrameLogReader
+{
+ public:
+  bool open(const std::string &filename)
+  {
+   offsets_.clear();
+   file_.close();
+   file_.clear();
+   file_.open(filename.c_str(),std::ios::binary);
+   char magic[sizeof(frame_log::kMagic)];
+   if(!file_.read(magic,sizeof(magic)) || std::memcmp(magic,frame_log::kMagic,sizeof(magic)) != 0)
+    return false;
+   uint64_t size;
+   int32_t frame_id;
+   while(file_.read(reinterpret_cast<char*>(&size),sizeof(size)))
+   {
+    const std::streamoff offset = file_.tellg();
+    if(size < sizeof(frame_id) || !file_.read(reinterpret_cast<char*>(&frame_id),sizeof(frame_id)))
+     break;
+    offsets_[frame_id] = std::make_pair(offset,size);
+    file_.seekg(offset + static_cast<std::streamoff>(size));
+   }
+   file_.clear();
+   return true;
+  }
+
+  inline bool has(int frame_id) const { return offsets_.count(frame_id) > 0; }
+
+  bool read(int frame_id,FrameRecord &record)
+  {
+   auto it = offsets_.find(frame_id);
+   if(it == offsets_.end())
+    return false;
+   buffer_.resize(it->second.second);
+   file_.clear();
+   file_.seekg(it->second.first);
+   if(!file_.read(&buffer_[0],buffer_.size()))
+    return false;
+   return frame_log::deserialize(buffer_,record);
+  }
+
+ private:
+  std::ifstream file_;
+  std::map <int,std::pair<std::streamoff,uint64_t> > offsets_;
+  std::string buffer_;
+};
+#endif
@@ -0,0 +1,93 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef PoseIO_H
+#define PoseIO_H
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+///Loads the poses (x,y,z,qx,qy,qz,qw) of a csv file, one per line, as in
+//odometry.csv, sensor_to_base_link.csv and the motion files. The file is
+//mapped in memory and parsed in place, the lines with less than seven values
+//are skipped. False if the file cannot be read.
+inline bool LoadPoses(const std::string &filename,std::vector< Eigen::Matrix<double,7,1> > &poses)
+{
+ poses.clear();
+ const int fd = open(filename.c_str(),O_RDONLY);
+ if(fd < 0)
+  return false;
+ struct stat file_stat;
+ if(fstat(fd,&file_stat) != 0)
+ {
+  close(fd);
+  return false;
+ }
+ const size_t size = file_stat.st_size;
+ if(size == 0)
+ {
+  close(fd);
+  return true;
+ }
+ void *data = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+ close(fd);
+ if(data == MAP_FAILED)
+  return false;
+
+ const char *p = static_cast<const char*>(data);
+ const char *end = p + size;
+ poses.reserve(size / 64);
+ Eigen::Matrix<double,7,1> pose;
+ char field[64];
+ while(p < end)
+ {
+  int num_values = 0;
+  while(p < end && *p != '\n')
+  {
+   ///fields are copied to a buffer on the stack, strtod needs a terminator
+   const char *field_end = p;
+   while(field_end < end && *field_end != ',' && *field_end != '\n')
+    ++field_end;
+   const size_t length = std::min<size_t>(field_end - p,sizeof(field) - 1);
+   std::memcpy(field,p,length);
+   field[length] = '\0';
+   char *parsed;
+   const double value = std::strtod(field,&parsed);
+   if(parsed != field && num_values < 7)
+    pose[num_values++] = value;
+   p = field_end < end && *field_end == ',' ? field_end + 1 : field_end;
+  }
+  if(num_values == 7)
+   poses.push_back(pose);
+  ++p;
+ }
+ munmap(data,size);
+ return true;
+}
+#endif
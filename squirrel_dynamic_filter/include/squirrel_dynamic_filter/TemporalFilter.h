@@ -0,0 +1,114 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef TemporalFilter_H
+#define TemporalFilter_H
+#include "datatypes_squirrel.h"
+#include "PoseIO.h"
+#include "FrameLog.h"
+#include "VoxelGridIndex.h"
+#include "g2o/core/eigen_types.h"
+#include "g2o/types/slam3d/isometry3d_mappings.h"
+#include <cmath>
+#include <sstream>
+
+///Bayes filter of TemporalInference for classifying the points as static or
+//dynamic: a point is likely static if its estimated motion agrees with the
+//odometry of the robot, its prior is the belief of the closest point of the
+//previous frame moved by its motion.
+namespace temporal_filter
+{
+const float prior_dynamic = 0.2;
+const float p_s_d = 0.05;
+const float p_s_s = 0.95;
+const float p_d_s = 0.05;
+const float p_d_d = 0.95;
+///squared, as the distances of the pcl correspondences
+const float max_prior_distance = 0.1;
+const double variance = 0.1;
+
+///Likelihood of a static point relative to its maximum, a gaussian of
+//covariance variance * I around mean
+inline float StaticLikelihood(const Eigen::Vector3d &observation,const Eigen::Vector3d &mean)
+{
+ return std::exp(-0.5 * (observation - mean).squaredNorm() / variance);
+}
+
+///One step of the filter: the belief of the points with a motion, which are
+//moved to transformed for the next step. previous and previous_belief are
+//transformed and belief of the last step, empty for the first frame.
+inline void Update(const PointCloud &cloud,const std::vector<g2o::Vector7d> &motions,const g2o::Isometry3D &odometry,const Eigen::Vector3d &mean,
+                   const PointCloud::ConstPtr &previous,const std::vector<float> &previous_belief,PointCloud &transformed,std::vector<float> &belief)
+{
+ VoxelGridIndex grid;
+ grid.setInputCloud(previous,std::sqrt(max_prior_distance));
+ const size_t num_points = std::min(cloud.points.size(),motions.size());
+ transformed.points.resize(num_points);
+ transformed.width = num_points;
+ transformed.height = 1;
+ belief.resize(num_points);
+ for(size_t i = 0; i < num_points; ++i)
+ {
+  const g2o::Isometry3D estimated_motion = g2o::internal::fromVectorQT(motions[i]);
+  const Eigen::Vector3d point_trans = estimated_motion * cloud.points[i].getVector3fMap().cast<double>();
+  transformed.points[i].x = point_trans[0];
+  transformed.points[i].y = point_trans[1];
+  transformed.points[i].z = point_trans[2];
+
+  const g2o::Isometry3D motion_diff = estimated_motion.inverse() * odometry;
+  const float likelihood = StaticLikelihood(motion_diff.translation(),mean);
+
+  float prior = prior_dynamic;
+  float squared_distance;
+  const int match = grid.nearestSearch(cloud.points[i],std::sqrt(max_prior_distance),squared_distance);
+  if(match >= 0 && match < static_cast<int>(previous_belief.size()))
+   prior = previous_belief[match];
+
+  const float posterior_d = (1.0 - likelihood) * ((p_d_d * prior) + (p_d_s * (1.0 - prior)));
+  const float posterior_s = likelihood * ((p_s_s * (1.0 - prior)) + (p_s_d * prior));
+  belief[i] = posterior_d / (posterior_d + posterior_s);
+ }
+}
+}
+
+///Points and motions of a frame, from the log of the run (frames.dflog) if
+//there is one, otherwise from the pcd and csv files of the frame
+inline bool ReadFrame(FrameLogReader &frame_log,const std::string &folder,int frame_id,PointCloud &cloud,std::vector<g2o::Vector7d> &motions)
+{
+ FrameRecord record;
+ if(frame_log.read(frame_id,record))
+ {
+  ToCloud(record.saved_points,cloud);
+  motions.resize(record.motions.size() / 7);
+  for(size_t i = 0; i < motions.size(); ++i)
+   motions[i] = Eigen::Map<const g2o::Vector7d>(&record.motions[7 * i]);
+  return true;
+ }
+ std::stringstream ss;
+ pcl::PCDReader reader;
+ ss << folder << "cloud_save_robust_a_" << frame_id << ".pcd";
+ reader.read(ss.str(),cloud);
+ ss.str("");
+ ss << folder << "motion_a_" << frame_id << ".csv";
+ return LoadPoses(ss.str(),motions);
+}
+#endif
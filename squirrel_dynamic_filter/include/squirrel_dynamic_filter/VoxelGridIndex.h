@@ -0,0 +1,131 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#ifndef VoxelGridIndex_H
+#define VoxelGridIndex_H
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "datatypes_squirrel.h"
+
+///Hash grid of a cloud for the searches of a fixed radius, up to the size of
+//the cells: the neighbours of a point are in its cell and in the 26 around
+//it, so a query looks up 27 cells instead of traversing a tree. The points of
+//a cell are consecutive in one array.
+class VoxelGridIndex
+{
+ float cell_size;
+ float inv_cell_size;
+ PointCloud::ConstPtr cloud;
+ std::unordered_map <uint64_t,std::pair<int,int> > cells;///first point, count
+ std::vector <int> order;
+
+ ///21 bits per axis, the indices wrap around consistently
+ static uint64_t key(int x,int y,int z)
+ {
+  return (static_cast<uint64_t>(x & 0x1FFFFF) << 42) | (static_cast<uint64_t>(y & 0x1FFFFF) << 21) | static_cast<uint64_t>(z & 0x1FFFFF);
+ }
+ void cell(const Point &point,int &x,int &y,int &z) const
+ {
+  x = static_cast<int>(std::floor(point.x * inv_cell_size));
+  y = static_cast<int>(std::floor(point.y * inv_cell_size));
+  z = static_cast<int>(std::floor(point.z * inv_cell_size));
+ }
+
+ public:
+  VoxelGridIndex():cell_size(0.0f),inv_cell_size(0.0f) {}
+
+  void setInputCloud(const PointCloud::ConstPtr &input,const float size)
+  {
+   cloud = input;
+   cell_size = size;
+   inv_cell_size = 1.0f / size;
+   cells.clear();
+   std::vector< std::pair<uint64_t,int> > keys;
+   keys.reserve(cloud->points.size());
+   for(size_t i = 0; i < cloud->points.size(); ++i)
+   {
+    const Point &point = cloud->points[i];
+    if(!pcl::isFinite(point))
+     continue;
+    int x,y,z;
+    cell(point,x,y,z);
+    keys.push_back(std::make_pair(key(x,y,z),static_cast<int>(i)));
+   }
+   std::sort(keys.begin(),keys.end());
+   order.resize(keys.size());
+   cells.reserve(keys.size());
+   for(size_t i = 0; i < keys.size(); ++i)
+   {
+    order[i] = keys[i].second;
+    if(i == 0 || keys[i].first != keys[i - 1].first)
+     cells[keys[i].first] = std::make_pair(static_cast<int>(i),0);
+    cells[keys[i].first].second += 1;
+   }
+  }
+
+  ///Calls f(index,squared_distance) for the points within radius, which is
+  //at most the size of the cells
+  template <class Function> void radiusSearch(const Point &point,const float radius,Function f) const
+  {
+   const float squared_radius = radius * radius;
+   int x,y,z;
+   cell(point,x,y,z);
+   for(int dx = -1; dx <= 1; ++dx)
+    for(int dy = -1; dy <= 1; ++dy)
+     for(int dz = -1; dz <= 1; ++dz)
+     {
+      auto it = cells.find(key(x + dx,y + dy,z + dz));
+      if(it == cells.end())
+       continue;
+      for(int i = it->second.first; i < it->second.first + it->second.second; ++i)
+      {
+       const Point &neighbour = cloud->points[order[i]];
+       const float ex = neighbour.x - point.x,ey = neighbour.y - point.y,ez = neighbour.z - point.z;
+       const float squared_distance = ex * ex + ey * ey + ez * ez;
+       if(squared_distance <= squared_radius)
+        f(order[i],squared_distance);
+      }
+     }
+  }
+
+  ///Nearest point within radius, at most the size of the cells. -1 if there
+  //is none
+  int nearestSearch(const Point &point,const float radius,float &squared_distance) const
+  {
+   int nearest = -1;
+   squared_distance = std::numeric_limits<float>::max();
+   radiusSearch(point,radius,[&](int index,float distance)
+   {
+    if(distance < squared_distance)
+    {
+     squared_distance = distance;
+     nearest = index;
+    }
+   });
+   return nearest;
+  }
+};
+#endif
@@ -27,6 +27,7 @@
 
 #include <pcl/point_types.h>
 #include <pcl/io/pcd_io.h>
+#include <pcl/search/kdtree.h>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -47,6 +48,7 @@ typedef pcl::PointCloud <PointNormal>::Ptr NormalCloudPtr;
 typedef pcl::PointCloud <PointIntensity> IntensityCloud;
 typedef pcl::PointCloud <PointRGB> RGBCloud;
 typedef pcl::PointCloud <PointSHOT> SHOTCloud;
+typedef pcl::search::KdTree <Point> PointSearch;
 
 #endif
 
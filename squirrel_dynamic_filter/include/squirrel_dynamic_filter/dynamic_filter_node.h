@@ -11,15 +11,28 @@
 #include <pcl/filters/voxel_grid.h>
 #include "EuclideanClusteringMesh.h"
 #include "FeatureSHOT.h"
+#include "FrameLog.h"
+#include "DescriptorProjection.h"
 #include <pcl/keypoints/uniform_sampling.h>
 #include <pcl/registration/correspondence_estimation.h>
 #include <pcl/registration/impl/correspondence_estimation.hpp>
 #include "squirrel_dynamic_filter_msgs/CloudMsg.h"
 #include "squirrel_dynamic_filter_msgs/DynamicFilterSrv.h"
 #include "squirrel_dynamic_filter_msgs/DynamicFilterMsg.h"
+#include "squirrel_dynamic_filter/DynamicObjects.h"
 #include <mlpack/core.hpp>
 #include <mlpack/core/dists/gaussian_distribution.hpp>
 #include <tf/transform_broadcaster.h>
+#include <std_msgs/Float64MultiArray.h>
+#include <std_msgs/Int32.h>
+#include <squirrel_threading/memory_budget_publisher.h>
+#include <squirrel_threading/trace_publisher.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 using namespace Eigen;
 
@@ -47,9 +60,87 @@ class DynamicFilter
 
     bool is_verbose;
     bool store_results;
+    ///with results_log the results go to one log of the run written in
+    //background, instead of the pcd and csv files of each frame
+    bool results_log;
+    FrameLogWriter frame_log;
+    FrameRecord frame_record;
+    ///stage timings of the frames, with the private parameters tracing/* of
+    //the node (see squirrel_threading)
+    std::unique_ptr<squirrel_threading::tracing::TracePublisher> trace_publisher;
+    ///memory budget of the process, with the private parameters memory/* of
+    //the node (see squirrel_threading). Under soft pressure at most one frame
+    //is queued, under hard pressure the history of the frames is dropped and
+    //the buffers are not kept between the frames
+    std::unique_ptr<squirrel_threading::MemoryBudgetPublisher> memory_publisher;
+    std::unique_ptr<squirrel_threading::MemoryBudget::Account> memory_account;
+    squirrel_threading::MemoryPressure memory_pressure;
+    void reportMemoryUsage();
+    ///threads of the motion estimation, each one reuses its optimizer for
+    //the clusters it gets
+    int motion_threads;
+    ///linear solver of the motion graphs (csparse, eigen or pcg), and the one
+    //of the clusters of at least large_cluster_size points if positive
+    std::string motion_linear_solver;
+    std::string large_cluster_linear_solver;
+    int large_cluster_size;
+    ///start the motion of the points from the one of the previous scan
+    bool motion_warm_start;
+    ///if positive, clusters with a rigid motion within this distance skip the
+    //optimization
+    float rigid_cluster_threshold;
+    ///the correspondences of the static points and of the scores are found
+    //in voxel grids of their maximum distance instead of kd-trees
+    bool voxel_correspondences;
+    ///if positive, the clusters come from a graph of the points closer than
+    //this distance (image or voxel neighbours) instead of a triangulation
+    float cluster_graph_distance;
+    ///optional projection of the descriptors, the matching is done in the
+    //reduced space
+    DescriptorProjection descriptor_projection;
     ros::Subscriber cloud_sub;
 
     ros::Publisher static_cloud_pub;
+    ///feature, correspondence, motion and total time of each frame
+    ros::Publisher timings_pub;
+    ///id of each frame done, the input of l_frequency with AdaptiveRate
+    ros::Publisher ready_pub;
+    ///moving objects of each frame, published only with subscribers: the
+    //clusters of the points with a dynamic score of at least
+    //object_score_threshold in cells of object_cluster_distance, of at least
+    //object_min_points points and at most object_max_speed
+    ros::Publisher objects_pub;
+    float object_score_threshold;
+    float object_cluster_distance;
+    int object_min_points;
+    float object_max_speed;
+
+    ///A message converted by the input stage, with the search index of its
+    //cloud
+    struct InputFrame
+    {
+      PointCloud::Ptr cloud;
+      PointSearch::Ptr index;
+      Vector7d odometry;
+      int frame_id;
+      double stamp;
+      measure_time received;
+    };
+    ///With a positive pipeline_queue_size the messages are converted and
+    //indexed by the subscriber and queued for a processing thread, so the
+    //input of the next frame is prepared while a frame is processed. When
+    //the queue is full the oldest frame is dropped, or the new one without
+    //pipeline_drop_oldest
+    int pipeline_queue_size;
+    bool pipeline_drop_oldest;
+    std::deque <InputFrame> pipeline_queue;
+    std::mutex pipeline_mutex;
+    std::condition_variable pipeline_not_empty;
+    std::thread pipeline_thread;
+    bool pipeline_stop;
+    std::atomic <size_t> dropped_frames;
+    void pipelineLoop();
+    void processFrame(InputFrame &input);
 
 
 
@@ -61,12 +152,13 @@ class DynamicFilter
     void filter_correspondences(const float neighbour_radius,const float covariance_value,const float score_threshold);
     void optimize_keypoint(const PointCloud::Ptr& kp,const std::vector<int>&index_match,const std::vector<int>&index_query,std::vector<Isometry3D> &motion_kp);
 
-    void sample(const Frame frame,const float radius, const float threshold,std::vector<int> &sampled_finite);
+    void sample(Frame &frame,const float radius, const float threshold,std::vector<int> &sampled_finite);
     void sample_dynamic(const PointCloud::Ptr dynamic,const float radius, const float threshold,std::vector<int> &sampled_finite);
     void DynamicScore(const PointCloud::Ptr &cloud,const bool is_first,const PointCloud::Ptr &score);
+    void PublishObjects();
     void EstimateCorrespondenceEuclidean(const float sampling_radius,std::vector<int>&index_query, std::vector<int> &index_match,std::vector<int> &indices_dynamic);
     bool DynamicFilterSrvCallback(squirrel_dynamic_filter_msgs::DynamicFilterSrv::Request &req,squirrel_dynamic_filter_msgs::DynamicFilterSrv::Response &res);
-    void msgCallback(const squirrel_dynamic_filter_msgs::DynamicFilterMsg& dynamic_msg);
+    void msgCallback(const squirrel_dynamic_filter_msgs::DynamicFilterMsg::ConstPtr& dynamic_msg);
 
     Eigen::Matrix4f trans;
 
@@ -96,6 +188,9 @@ class DynamicFilter
 
   public:
     DynamicFilter();
+    // constructor for the nodelet, which provides its own handle
+    explicit DynamicFilter(const ros::NodeHandle& nh);
+    ~DynamicFilter();
     string output_folder;
     ofstream myfile_odom;
 
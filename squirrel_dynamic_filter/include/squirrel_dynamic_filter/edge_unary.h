@@ -55,7 +55,8 @@ namespace g2o {
 
     }
 
-//   virtual void linearizeOplus();
+    // closed form jacobian of the transformed point, the point itself is fixed
+    virtual void linearizeOplus();
 
 /*
     // return the error estimate as a 3-vector
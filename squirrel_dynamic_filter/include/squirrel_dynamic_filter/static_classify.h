@@ -0,0 +1,127 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#ifndef STATICCLASSIFY_H
+#define STATICCLASSIFY_H
+#include "ros/ros.h"
+#include "datatypes_squirrel.h"
+#include <octomap/octomap.h>
+#include <octomap/OcTree.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap/ColorOcTree.h>
+#include <sensor_msgs/PointCloud2.h>
+#include "squirrel_dynamic_filter_msgs/ClassifyStaticSrv.h"
+#include "squirrel_3d_mapping/OctomapChangeSet.h"
+#include "g2o/core/eigen_types.h"
+#include <tf/transform_broadcaster.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+///Compares the input scan with the existing octomap: the points in or close
+//to an occupied voxel are static, the others might be new static or dynamic.
+//It serves classify_static, and it can be used in the process of the caller
+//through classify and classifyAsync, without serializing the clouds.
+class ClassifyStatic
+{
+  public:
+    ///result of an asynchronous request, the indices are of its cloud
+    struct Result
+    {
+      int frame_id;
+      bool success;
+      PointCloud::ConstPtr cloud;
+      std::vector <int> static_points;
+      std::vector <int> unclassified_points;
+    };
+    typedef std::function<void (Result&)> ResultCallback;
+
+    ///with advertise_service false only the in-process interface is
+    //available. The private parameters are read from private_n
+    ClassifyStatic(const ros::NodeHandle &n,const ros::NodeHandle &private_n,bool advertise_service = true);
+    ~ClassifyStatic();
+
+    ///classifies the points of a scan in the sensor frame, odometry is the
+    //transform to base_link. False if there is no map yet
+    bool classify(const PointCloud &cloud_input_raw,const g2o::Vector7d &odometry,std::vector<int> &static_points,std::vector<int> &unclassified_points);
+    ///queues the scan for the thread of the requests, callback gets the
+    //result from that thread. The requests are processed in order
+    void classifyAsync(int frame_id,const PointCloud::ConstPtr &cloud,const g2o::Vector7d &odometry,const ResultCallback &callback);
+
+    std::string map_filename;
+
+  private:
+    ros::NodeHandle n;
+    ros::ServiceServer service;
+    ros::Publisher pub_static,pub_dynamic;
+    tf::TransformBroadcaster br;
+    tf::Transform transform_map_base_link;
+    ros::Subscriber octomap_sub;
+    ros::Subscriber changes_sub;
+    ///the tree is kept between the requests, it is read again only from a new
+    //map. With incremental it is read once and then patched with the changed
+    //leafs of the tracking server. The mutex guards the tree and the message
+    //against the requests of the asynchronous thread
+    octomap::ColorOcTree *tree;
+    octomap_msgs::OctomapConstPtr map_msg;
+    bool incremental;
+    std::mutex tree_mutex;
+    ///index over the input scan and the buffers of its searches, reused by
+    //the requests
+    PointSearch search;
+    std::vector <int> point_idx_radius_search;
+    std::vector <float> point_radius_squared_distance;
+    std::vector <std::pair <uint64_t,int> > point_codes;
+    std::vector <octomap::OcTreeKey> point_keys;
+    std::vector <bool> is_occupied;
+    ///with voxel_classification the scan is hashed in cells of the size of
+    //the static radius, a cell is static if one of its 27 neighbours has a
+    //point in an occupied voxel of the map. No radius search is needed
+    bool voxel_classification;
+    std::unordered_map <uint64_t,int> cells;
+    std::vector <int> point_cells;
+    std::vector <char> cell_occupied;
+
+    ///pending asynchronous requests
+    struct Request
+    {
+      int frame_id;
+      PointCloud::ConstPtr cloud;
+      g2o::Vector7d odometry;
+      ResultCallback callback;
+    };
+    std::deque <Request> requests;
+    std::mutex requests_mutex;
+    std::condition_variable requests_not_empty;
+    std::thread requests_thread;
+    bool requests_stop;
+    void requestsLoop();
+
+    void msgCallback(const octomap_msgs::OctomapConstPtr &msg);
+    void readMap();
+    void changesCallback(const squirrel_3d_mapping::OctomapChangeSetConstPtr &changes);
+    bool ClassifyStaticCallback(squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Request &req,squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Response &res);
+};
+#endif
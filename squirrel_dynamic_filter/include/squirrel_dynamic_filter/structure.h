@@ -30,6 +30,8 @@
 #include "g2o/core/optimization_algorithm_gauss_newton.h"
 #include "g2o/core/optimization_algorithm_levenberg.h"
 #include "g2o/solvers/csparse/linear_solver_csparse.h"
+#include "g2o/solvers/eigen/linear_solver_eigen.h"
+#include "g2o/solvers/pcg/linear_solver_pcg.h"
 #include "g2o/core/factory.h"
 #include "g2o/core/robust_kernel_impl.h"
 #include "g2o/stuff/command_args.h"
@@ -42,13 +44,19 @@ struct Frame
  PointCloud::Ptr cloud_input;///After preprocessing
  PointCloud::Ptr ground;
  SHOTCloud::Ptr feature;
+///With a DescriptorProjection the projected descriptors of cloud_input, one
+//row each, replace feature
+ std::vector <float> reduced_feature;
  Isometry3D odometry;
  int frame_id;
+///stamp [s] of the cloud
+ double stamp;
  std::vector <Isometry3D> motion_init;
  PointCloud::Ptr cloud_transformed;
  Frame():raw_input(new PointCloud),cloud_input(new PointCloud),ground(new PointCloud),feature(new SHOTCloud),cloud_transformed(new PointCloud)
  {
   frame_id = -1;
+  stamp = 0;
  }
 
  std::vector < std::vector<int> > clusters;
@@ -56,62 +64,101 @@ struct Frame
  std::vector <int> finite_points;
  std::vector <int> sampled_points;
  std::vector <float> prior_dynamic;
+///Search indices of raw_input and cloud_input, built once on the first query
+//and shared by all the stages of the frame
+ PointSearch::Ptr raw_index;
+ PointSearch::Ptr input_index;
+ const PointSearch::Ptr &rawIndex()
+ {
+  if(!raw_index)
+  {
+   raw_index.reset(new PointSearch);
+   raw_index->setInputCloud(raw_input);
+  }
+  return raw_index;
+ }
+ const PointSearch::Ptr &inputIndex()
+ {
+  if(!input_index)
+  {
+   input_index.reset(new PointSearch);
+   input_index->setInputCloud(cloud_input);
+  }
+  return input_index;
+ }
  void clear()
  {
+  raw_index.reset();
+  input_index.reset();
   raw_input->points.clear();
   cloud_input->points.clear();
   feature->points.clear();
+  reduced_feature.clear();
   clusters.clear();
   finite_points.clear();
   sampled_points.clear();
   neighbours.clear();
   ground->points.clear();
  }
- void copy(Frame &frame)
+ ///Bytes held by the clouds, the descriptors and the vectors of the frame,
+ //without the search indices
+ size_t memoryUsage() const
  {
-  frame.raw_input->points.clear();
-  frame.cloud_input->points.clear();
-  frame.feature->points.clear();
-  frame.finite_points.clear();
+  size_t bytes = (raw_input->points.capacity() + cloud_input->points.capacity() + ground->points.capacity() +
+                  cloud_transformed->points.capacity()) * sizeof(Point);
+  bytes += feature->points.capacity() * sizeof(PointSHOT);
+  bytes += (reduced_feature.capacity() + prior_dynamic.capacity()) * sizeof(float);
+  bytes += (finite_points.capacity() + sampled_points.capacity()) * sizeof(int);
+  bytes += motion_init.capacity() * sizeof(Isometry3D);
+  for(size_t i = 0; i < clusters.size(); ++i)
+   bytes += clusters[i].capacity() * sizeof(int);
+  for(size_t i = 0; i < neighbours.size(); ++i)
+   bytes += neighbours[i].capacity() * sizeof(int);
+  return bytes;
+ }
+ ///Clears the frame and its state about the pair of frames, and frees the
+ //storage kept for the next frames
+ void release()
+ {
+  clear();
+  PointCloud::VectorType().swap(raw_input->points);
+  PointCloud::VectorType().swap(cloud_input->points);
+  PointCloud::VectorType().swap(ground->points);
+  PointCloud::VectorType().swap(cloud_transformed->points);
+  SHOTCloud::VectorType().swap(feature->points);
+  std::vector <float>().swap(reduced_feature);
+  std::vector <float>().swap(prior_dynamic);
+  std::vector <int>().swap(finite_points);
+  std::vector <int>().swap(sampled_points);
+  std::vector <Isometry3D>().swap(motion_init);
+  std::vector < std::vector<int> >().swap(clusters);
+  std::vector < std::vector<int> >().swap(neighbours);
+ }
+ ///Hands the buffers of this frame over to the other one, which becomes the
+ //previous frame, and takes its old buffers to be cleared and refilled. Only
+ //pointers and vector storage are swapped, so the cost does not depend on the
+ //size of the clouds and of the descriptors, and the capacity is reused. The
+ //state of the other frame about the pair of frames (prior_dynamic,
+ //motion_init, cloud_transformed) is kept.
+ void moveTo(Frame &frame)
+ {
+  std::swap(frame.raw_input,raw_input);
+  std::swap(frame.cloud_input,cloud_input);
+  std::swap(frame.ground,ground);
+  std::swap(frame.feature,feature);
+  frame.reduced_feature.swap(reduced_feature);
+  std::swap(frame.raw_index,raw_index);
+  std::swap(frame.input_index,input_index);
+  frame.finite_points.swap(finite_points);
+  frame.clusters.swap(clusters);
+  frame.neighbours.swap(neighbours);
   frame.sampled_points.clear();
-  frame.clusters.clear();
-  frame.neighbours.clear();
-  frame.ground->points.clear();
-
-  frame.raw_input->points = raw_input->points;
-  frame.cloud_input->points = cloud_input->points;
-  frame.feature->points = feature->points;
-  frame.finite_points = finite_points;
-  frame.clusters = clusters;
   frame.frame_id = frame_id;
-  frame.neighbours = neighbours;
-  frame.ground = ground;
-  frame.odometry(0,0) = odometry(0,0);
-  frame.odometry(1,0) = odometry(1,0);
-  frame.odometry(2,0) = odometry(2,0);
-  frame.odometry(3,0) = odometry(3,0);
-  frame.odometry(0,1) = odometry(0,1);
-  frame.odometry(1,1) = odometry(1,1);
-  frame.odometry(2,1) = odometry(2,1);
-  frame.odometry(3,1) = odometry(3,1);
-  frame.odometry(0,2) = odometry(0,2);
-  frame.odometry(1,2) = odometry(1,2);
-  frame.odometry(2,2) = odometry(2,2);
-  frame.odometry(3,2) = odometry(3,2);
-  frame.odometry(0,3) = odometry(0,3);
-  frame.odometry(1,3) = odometry(1,3);
-  frame.odometry(2,3) = odometry(2,3);
-  frame.odometry(3,3) = odometry(3,3);
-
-
-
-
+  frame.stamp = stamp;
+  frame.odometry = odometry;
+  clear();
  }
 
-
-
-
-
  ///Odometry,motion,clsuter
 
 };
@@ -0,0 +1,129 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "dynamic_filter_node.h"
+#include <cmath>
+#include <unordered_map>
+///Moving objects for the navigation: the points of frame_1 with a dynamic
+//score of at least ObjectScoreThreshold are binned in cells of
+//ObjectClusterDistance of the ground plane of the map, the connected cells
+//(8 neighbours) are an object. Its velocity is the mean displacement of its
+//points in the map between the frames
+
+namespace
+{
+inline int64_t CellKey(const int x,const int y)
+{
+ return (static_cast<int64_t>(x) << 32) | static_cast<uint32_t>(y);
+}
+}
+
+void DynamicFilter::PublishObjects()
+{
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/publish_objects");
+ squirrel_dynamic_filter::DynamicObjects::Ptr objects(new squirrel_dynamic_filter::DynamicObjects);
+ objects->header.frame_id = "map";
+ objects->header.stamp = ros::Time(frame_2.stamp);
+ const double dt = frame_2.stamp - frame_1.stamp;
+ const size_t num_points = frame_1.prior_dynamic.size();
+ if(dt <= 0 || num_points != frame_1.motion_init.size() || num_points != frame_1.cloud_transformed->points.size())
+ {
+  objects_pub.publish(objects);
+  return;
+ }
+
+///the points moved to frame_2 and back to frame_1 by their motion, in the map
+ const float inv_cell = 1.0f / object_cluster_distance;
+ std::vector <Vector3d> position, displacement;
+ std::vector <float> score;
+ std::unordered_map <int64_t,std::vector<int> > cells;
+ for(size_t i = 0; i < num_points; ++i)
+ {
+  if(frame_1.prior_dynamic[i] < object_score_threshold)
+   continue;
+  const Vector3d moved = frame_1.cloud_transformed->points[i].getVector3fMap().cast<double>();
+  const Vector3d after = frame_2.odometry * moved;
+  const Vector3d before = frame_1.odometry * (frame_1.motion_init[i].inverse() * moved);
+  cells[CellKey(std::floor(after[0] * inv_cell),std::floor(after[1] * inv_cell))].push_back(position.size());
+  position.push_back(after);
+  displacement.push_back(after - before);
+  score.push_back(frame_1.prior_dynamic[i]);
+ }
+
+///connected cells, each cell is taken out of the map when it is reached
+ std::vector <int64_t> open;
+ std::vector <int> members;
+ while(!cells.empty())
+ {
+  open.assign(1,cells.begin()->first);
+  members.clear();
+  while(!open.empty())
+  {
+   const int64_t key = open.back();
+   open.pop_back();
+   auto cell = cells.find(key);
+   if(cell == cells.end())
+    continue;
+   members.insert(members.end(),cell->second.begin(),cell->second.end());
+   cells.erase(cell);
+   const int x = static_cast<int>(key >> 32);
+   const int y = static_cast<int>(static_cast<uint32_t>(key));
+   for(int dx = -1; dx <= 1; ++dx)
+    for(int dy = -1; dy <= 1; ++dy)
+     if((dx != 0 || dy != 0) && cells.count(CellKey(x + dx,y + dy)) > 0)
+      open.push_back(CellKey(x + dx,y + dy));
+  }
+  if(static_cast<int>(members.size()) < object_min_points)
+   continue;
+
+  Vector3d centroid = Vector3d::Zero();
+  Vector3d velocity = Vector3d::Zero();
+  float mean_score = 0;
+  for(const int index:members)
+  {
+   centroid += position[index];
+   velocity += displacement[index];
+   mean_score += score[index];
+  }
+  centroid /= members.size();
+  velocity /= members.size() * dt;
+  if(velocity.head<2>().norm() > object_max_speed)
+   continue;
+  double radius = 0;
+  for(const int index:members)
+   radius = std::max(radius,(position[index] - centroid).head<2>().norm());
+
+  squirrel_dynamic_filter::DynamicObject object;
+  object.x = centroid[0];
+  object.y = centroid[1];
+  object.vx = velocity[0];
+  object.vy = velocity[1];
+  object.radius = radius;
+  object.score = mean_score / members.size();
+  object.num_points = members.size();
+  objects->objects.push_back(object);
+ }
+ if(is_verbose)
+  ROS_INFO("%s: %ld moving objects in frame %d",ros::this_node::getName().c_str(),objects->objects.size(),frame_2.frame_id);
+ objects_pub.publish(objects);
+}
@@ -20,34 +20,69 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+
 #include "dynamic_filter_node.h"
+#include "VoxelGridIndex.h"
+#include <squirrel_threading/thread_pool.h>
+#include <atomic>
+#include <cmath>
 ///Used for calculating whether a point is static or dynamic by comparing the
 //estimated motion with odometry of the robot
 
-void DynamicFilter::DynamicScore(const PointCloud::Ptr &cloud,const bool is_first,const PointCloud::Ptr &score)
+namespace
+{
+///Points per task of the loops run on the shared thread pool
+const int kGrain = 1024;
+
+///Bayesian update of the dynamic belief of n points, the residual motions
+//and the priors are given as separate arrays. The observation model is an
+//isotropic Gaussian normalized by its value at zero, i.e. exp(-|x|^2/2s^2)
+void BayesianUpdate(const float *dx,const float *dy,const float *dz,const float *prior,const size_t n,const float inv_two_variance,
+                    const float p_d_d,const float p_d_s,const float p_s_s,const float p_s_d,float *belief)
 {
- arma::mat covariance(3,3);
- arma::vec mean(3);
- arma::vec observation(3);
- covariance(0,0) = 1.0; covariance(0,1) = 0.0; covariance(0,2) = 0.0;
- covariance(1,0) = 0.0; covariance(1,1) = 1.0; covariance(1,2) = 0.0;
- covariance(2,0) = 0.0; covariance(2,1) = 0.0; covariance(2,2) = 1.0;
- covariance *= 0.001;
- mean[0] = 0.0;
- mean[1] = 0.0;
- mean[2] = 0.0;
- observation[0] = 0.0;
- observation[1] = 0.0;
- observation[2] = 0.0;
+ squirrel_threading::ThreadPool::global().parallelFor(0,n,kGrain,[&](int begin,int end)
+ {
+  for(int i = begin; i < end; ++i)
+  {
+   const float squared_norm = dx[i] * dx[i] + dy[i] * dy[i] + dz[i] * dz[i];
+   const float likelihood = std::exp(-squared_norm * inv_two_variance);
+   const float posterior_d = (1.0f - likelihood) * ((p_d_d * prior[i]) + (p_d_s * (1.0f - prior[i])));
+   const float posterior_s = likelihood * ((p_s_s * (1.0f - prior[i])) + (p_s_d * prior[i]));
+   const float normalizer = posterior_d + posterior_s;
+   belief[i] = normalizer > 0.0f ? posterior_d / normalizer : prior[i];
+  }
+ });
+}
+}
 
- mlpack::distribution::GaussianDistribution dist(mean,covariance);
- float max = dist.Probability(observation);
+void DynamicFilter::DynamicScore(const PointCloud::Ptr &cloud,const bool is_first,const PointCloud::Ptr &score)
+{
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/dynamic_score");
+ const float variance = 0.001;
 
  pcl::Correspondences all_correspondences;
  pcl::registration::CorrespondenceEstimation< Point, Point> est;
 
 /// Associate points from t-1 to t to transfer the prior information
- if(!is_first)
+ const size_t num_points = frame_1.motion_init.size();
+ if(!is_first && voxel_correspondences)
+ {
+  VoxelGridIndex grid;
+  grid.setInputCloud(score,0.01);
+  all_correspondences.resize(cloud->points.size());
+  squirrel_threading::ThreadPool::global().parallelFor(0,cloud->points.size(),kGrain,[&](int begin,int end)
+  {
+   for(int i = begin; i < end; ++i)
+   {
+    float distance;
+    const int match = grid.nearestSearch(cloud->points[i],0.01,distance);
+    all_correspondences[i].index_query = i;
+    all_correspondences[i].index_match = match;
+    all_correspondences[i].distance = match >= 0 ? distance : std::numeric_limits<float>::max();
+   }
+  });
+ }
+ else if(!is_first)
  {
   est.setInputSource (cloud);
   est.setInputTarget (score);
@@ -56,64 +91,40 @@ void DynamicFilter::DynamicScore(const PointCloud::Ptr &cloud,const bool is_firs
  else
   frame_1.prior_dynamic.assign(cloud->points.size(),0.2);//Points have a higher chance of being static if no previous information is available
 
-
- std::vector <float> current_belief(frame_1.motion_init.size(),0.0);
- float prior;
- #pragma parallel omp for num_threads(8)
- for(size_t i = 0; i < frame_1.motion_init.size(); ++i)
+ std::vector <float> dx(num_points), dy(num_points), dz(num_points), prior(num_points);
+ std::atomic<bool> out_of_range(false);
+/// Residual of the estimated motion with the odometry and prior of each point
+ squirrel_threading::ThreadPool::global().parallelFor(0,num_points,kGrain,[&](int begin,int end)
  {
-  Isometry3D motion_diff = frame_1.motion_init[i].inverse() * odometry_diff;
-  observation[0] = motion_diff(0,3);
-  observation[1] = motion_diff(1,3);
-  observation[2] = motion_diff(2,3);
-  if(all_correspondences.empty())
-   prior = frame_1.prior_dynamic[i];
-  else
+  for(int i = begin; i < end; ++i)
   {
-   if(all_correspondences[i].distance <= 0.01 * 0.01 )
+   const Isometry3D motion_diff = frame_1.motion_init[i].inverse() * odometry_diff;
+   dx[i] = motion_diff(0,3);
+   dy[i] = motion_diff(1,3);
+   dz[i] = motion_diff(2,3);
+   if(all_correspondences.empty())
+    prior[i] = frame_1.prior_dynamic[i];
+   else if(all_correspondences[i].distance <= 0.01 * 0.01)
    {
-    if(all_correspondences[i].index_match >= frame_1.prior_dynamic.size())
+    const size_t index_match = all_correspondences[i].index_match;
+    if(index_match < frame_1.prior_dynamic.size())
+     prior[i] = frame_1.prior_dynamic[index_match];
+    else
     {
-
-
-      ROS_ERROR("%s:%ld,%ld,%ld",ros::this_node::getName().c_str(),frame_1.prior_dynamic.size(),score->points.size(),cloud->points.size());
-     getchar();
-
-
-
-
+     prior[i] = 0.2;
+     out_of_range = true;
     }
-     prior = frame_1.prior_dynamic[all_correspondences[i].index_match];
-
    }
    else
-    prior = 0.2;
+    prior[i] = 0.2;
   }
+ });
+ if(out_of_range)
+  ROS_ERROR("%s:%ld,%ld,%ld",ros::this_node::getName().c_str(),frame_1.prior_dynamic.size(),score->points.size(),cloud->points.size());
 
+ std::vector <float> current_belief(num_points,0.0);
+ BayesianUpdate(dx.data(),dy.data(),dz.data(),prior.data(),num_points,0.5 / variance,p_d_d,p_d_s,p_s_s,p_s_d,current_belief.data());
 
-
-  float posterior_d = (1.0 - dist.Probability(observation)/max)  * ((p_d_d * prior) + (p_d_s * (1.0 - prior)));
-  float posterior_s = (dist.Probability(observation)/max) * ((p_s_s * (1.0 - prior)) + (p_s_d * prior));
-  float probability = posterior_d/(posterior_d + posterior_s);
-  if(probability < 0.0)
-  {
-
-   ROS_ERROR("%s: %f, %f, %f, %f",ros::this_node::getName().c_str(),posterior_d,posterior_s,prior,dist.Probability(observation)/max);
-   getchar();
-  }
-  if(probability > 1.0)
-  {
-
-   ROS_ERROR("%s: %f, %f, %f, %f",ros::this_node::getName().c_str(),posterior_d,posterior_s,prior,dist.Probability(observation)/max);
-
-   getchar();
-
-  }
-
-  current_belief[i] = probability;
- }
-
- frame_1.prior_dynamic.clear();
- frame_1.prior_dynamic = current_belief;
+ frame_1.prior_dynamic.swap(current_belief);
 
 }
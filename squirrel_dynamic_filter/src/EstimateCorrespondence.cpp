@@ -23,6 +23,9 @@
 
 
 #include "dynamic_filter_node.h"
+#include "FeatureMatching.h"
+#include "VoxelGridIndex.h"
+#include <squirrel_threading/thread_pool.h>
 using namespace Eigen;
 using namespace std;
 ///choose correspondences which minimzes the distrtion. The neighbourhood
@@ -223,6 +226,7 @@ void DynamicFilter::filter_correspondences(const float neighbour_radius,const fl
 void DynamicFilter::EstimateCorrespondencePoint(const float radius,const float sampling_radius,int number_correspondences,std::vector<int>&index_query, std::vector<int> &index_match)
 
 {
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/correspondence_point");
 
  c_vec.clear();
  pcl::PointCloud <int> sampled_indices;
@@ -237,47 +241,45 @@ void DynamicFilter::EstimateCorrespondencePoint(const float radius,const float s
  PointCloud::Ptr cloud_source(new PointCloud);
  SHOTCloud::Ptr source(new SHOTCloud);
  pcl::copyPointCloud(*frame_1.cloud_input,sampled_indices.points,*cloud_source);
- pcl::copyPointCloud(*frame_1.feature,sampled_indices.points,*source);
- MatrixXf source_feature = source->getMatrixXfMap(352,361,0);
- MatrixXf target_feature = frame_2.feature->getMatrixXfMap(352,361,0);
-
-
-
- pcl::search::KdTree<pcl::SHOT352> kdtree;
- pcl::search::KdTree<pcl::PointXYZ>kdtree_point;
- kdtree_point.setInputCloud (frame_2.cloud_input);
-
- int counter = 0;
- int counter_check = 0;
-
- for(auto &point:cloud_source->points)
+ const bool reduced = descriptor_projection.enabled();
+ const int dim = descriptor_projection.dimension();
+ if(!reduced)
+  pcl::copyPointCloud(*frame_1.feature,sampled_indices.points,*source);
+ const SHOTCloud &target_feature = *frame_2.feature;
+
+ const PointSearch &kdtree_point = *frame_2.inputIndex();
+
+///The source points are matched in parallel on the shared pool, each chunk
+//reuses its buffers of neighbours and candidate distances, and the k best
+//candidates are selected without sorting all of them
+ const int num_source = cloud_source->points.size();
+ std::vector <correspondences> c_point(num_source);
+ std::vector <char> is_matched(num_source,0);
+ squirrel_threading::ThreadPool::global().parallelFor(0,num_source,16,[&](int begin,int end)
  {
   std::vector <int> pointIdxRadiusSearch;
   std::vector <float> pointRadiusSquaredDistance;
-  if ( kdtree_point.radiusSearch (point,radius,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0 )
+  std::vector< std::pair <int,float> >neighbour_info;
+  for(int counter = begin; counter < end; ++counter)
   {
-   counter_check+=1;
-   VectorXf s_v = source_feature.col(counter);
-   VectorXf score_vec (pointIdxRadiusSearch.size());
-
-   std::vector< std::pair <int,float> >neighbour_info;
-   for(int i = 0 ; i < pointIdxRadiusSearch.size() ; ++i)
+   if ( kdtree_point.radiusSearch (cloud_source->points[counter],radius,pointIdxRadiusSearch,pointRadiusSquaredDistance) <= 0 )
+    continue;
+   const float *s_v = reduced ? &frame_1.reduced_feature[sampled_indices.points[counter] * dim] : source->points[counter].descriptor;
+   neighbour_info.resize(pointIdxRadiusSearch.size());
+   for(size_t i = 0 ; i < pointIdxRadiusSearch.size() ; ++i)
    {
-    VectorXf diff = s_v - target_feature.col(pointIdxRadiusSearch[i]);
-    std::pair<int,float>element;
-    element.first = frame_2.finite_points[pointIdxRadiusSearch[i]];
-    element.second = (diff).dot((diff));
-    neighbour_info.push_back(element);
+    neighbour_info[i].first = frame_2.finite_points[pointIdxRadiusSearch[i]];
+    if(reduced)
+     neighbour_info[i].second = SquaredDistance(s_v,&frame_2.reduced_feature[pointIdxRadiusSearch[i] * dim],dim);
+    else
+     neighbour_info[i].second = SquaredDistanceSHOT(s_v,target_feature.points[pointIdxRadiusSearch[i]].descriptor);
    }
+   const size_t k = std::min<size_t>(number_correspondences,neighbour_info.size());
+   SelectBestCandidates(neighbour_info,k);
 
-  	std::sort(neighbour_info.begin(),neighbour_info.end(),boost::bind(&std::pair<int, float>::second, _1) < boost::bind(&std::pair<int, float>::second, _2));
-   correspondences c;
-
+   correspondences &c = c_point[counter];
    c.query = frame_1.sampled_points[counter];
-
-   if(number_correspondences > pointIdxRadiusSearch.size())
-    number_correspondences = pointIdxRadiusSearch.size();
-   for(int i = 0; i < number_correspondences ; ++i)
+   for(size_t i = 0; i < k ; ++i)
    {
     if(neighbour_info[i].second < feature_score_threshold)
     {
@@ -288,16 +290,15 @@ void DynamicFilter::EstimateCorrespondencePoint(const float radius,const float s
    if(c.score.size() > 0)
    {
     c.match = c.possible_matches[0];
-    c_vec.push_back(c);
-
+    is_matched[counter] = 1;
    }
-
-
   }
+ });
+///Kept in the order of the source points
+ for(int counter = 0; counter < num_source; ++counter)
+  if(is_matched[counter])
+   c_vec.push_back(std::move(c_point[counter]));
 
-  counter+=1;
-
- }
  if(c_vec.empty())
   return;
 
@@ -405,30 +406,54 @@ void DynamicFilter::EstimateCorrespondencePoint(const float radius,const float s
 
 void DynamicFilter::EstimateCorrespondenceEuclidean(const float sampling_radius,std::vector<int>&index_query, std::vector<int> &index_match,std::vector<int> &indices_dynamic)
 {
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/correspondence_euclidean");
 ///Associtaing points in scan t-1(frame_1.cloud_transformed) and points in scan
 //t(frame_1.raw_input)
- pcl::Correspondences corr;
  pcl::registration::CorrespondenceEstimation <Point,Point> est;
- est.setInputSource (frame_1.raw_input);
- est.setInputTarget (frame_1.cloud_transformed);
- est.determineCorrespondences (corr);
  const double max_distance = 0.01 * 0.01;
  std::vector <int> indices_corr;
  PointCloud::Ptr cloud_trans(new PointCloud);
- for(auto &corr_point:corr)
+///point of scan t-1 of each point of scan t, -1 if there is none. With
+//voxel_correspondences it is looked up in parallel in a grid of the maximum
+//distance
+ std::vector <int> previous(frame_1.raw_input->points.size(),-1);
+ if(voxel_correspondences)
+ {
+  VoxelGridIndex grid;
+  grid.setInputCloud(frame_1.cloud_transformed,0.01);
+  #pragma omp parallel for schedule(static)
+  for(size_t i = 0; i < previous.size(); ++i)
+  {
+   float distance;
+   const int match = grid.nearestSearch(frame_1.raw_input->points[i],0.01,distance);
+   if(match >= 0 && distance < max_distance)
+    previous[i] = match;
+  }
+ }
+ else
+ {
+  pcl::Correspondences corr;
+  est.setInputSource (frame_1.raw_input);
+  est.setInputTarget (frame_1.cloud_transformed);
+  est.determineCorrespondences (corr);
+  for(auto &corr_point:corr)
+   if(corr_point.distance < (max_distance))//actual correspondence
+    previous[corr_point.index_query] = corr_point.index_match;
+ }
+ for(size_t i = 0; i < previous.size(); ++i)
  {
-  if(corr_point.distance < (max_distance))//actual correspondence
+  if(previous[i] >= 0)
   {
-   if(frame_1.prior_dynamic[corr_point.index_match] < 0.15)//static Point
+   if(frame_1.prior_dynamic[previous[i]] < 0.15)//static Point
    {
-    Vector4f point = frame_1.raw_input->points[corr_point.index_query].getVector4fMap();
+    Vector4f point = frame_1.raw_input->points[i].getVector4fMap();
     point[3] = 1;
-    Vector4d point_trans = frame_1.motion_init[corr_point.index_match] * point.cast<double>();//Predicitng the location of point in scan t to location of scan t+1 using the motion calculated between t-1 and t
+    Vector4d point_trans = frame_1.motion_init[previous[i]] * point.cast<double>();//Predicitng the location of point in scan t to location of scan t+1 using the motion calculated between t-1 and t
     Point pointPCL;
     pointPCL.x = point_trans[0];
     pointPCL.y = point_trans[1];
     pointPCL.z = point_trans[2];
-    indices_corr.push_back(corr_point.index_query);
+    indices_corr.push_back(i);
     cloud_trans->points.push_back(pointPCL);
    }
   }
@@ -448,26 +473,42 @@ void DynamicFilter::EstimateCorrespondenceEuclidean(const float sampling_radius,
  pcl::Correspondences corr_final;
  est.setInputSource (cloud_trans_sampled);
  est.setInputTarget (frame_2.raw_input);
+ est.setSearchMethodTarget (frame_2.rawIndex(),true);
  est.determineReciprocalCorrespondences (corr_final);
 
 ///segmenting the static scene from the whole scan
 
- pcl::search::KdTree <pcl::PointXYZ> kdtree;
- kdtree.setInputCloud(frame_2.raw_input);
-
-//////Find the neighbours for all the point and store them
- std::vector <bool>is_dynamic(frame_2.raw_input->points.size(),true);
+ //////Find the neighbours for all the point and store them
+ std::vector <char>is_dynamic(frame_2.raw_input->points.size(),1);
  for(auto &c:corr_final)
  {
-
   index_query.push_back(indices_corr[sampled_indices.points[c.index_query]]);
   index_match.push_back(c.index_match);
+ }
+ if(voxel_correspondences)
+ {
+  VoxelGridIndex grid;
+  grid.setInputCloud(frame_2.raw_input,0.05);
+  #pragma omp parallel for schedule(static)
+  for(size_t i = 0; i < corr_final.size(); ++i)
+   grid.radiusSearch(frame_2.raw_input->points[corr_final[i].index_match],0.05,[&](int index,float)
+   {
+    #pragma omp atomic write
+    is_dynamic[index] = 0;
+   });
+ }
+ else
+ {
+  const PointSearch &kdtree = *frame_2.rawIndex();
   std::vector <int> pointIdxRadiusSearch;
   std::vector <float> pointRadiusSquaredDistance;
-  if (kdtree.radiusSearch(frame_2.raw_input->points[c.index_match],0.05,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0)
+  for(auto &c:corr_final)
   {
-   for(auto &index:pointIdxRadiusSearch)
-   is_dynamic[index] = false;
+   if (kdtree.radiusSearch(frame_2.raw_input->points[c.index_match],0.05,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0)
+   {
+    for(auto &index:pointIdxRadiusSearch)
+    is_dynamic[index] = false;
+   }
   }
  }
  std::vector<int>frame_2_dynamic;
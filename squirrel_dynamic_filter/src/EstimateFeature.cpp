@@ -32,10 +32,9 @@
 ///sampling step, take a point calculate its small neighbourhood and then that
 //point and then calculate descriptor for only that point and not for the
 //neighbourhood
-void DynamicFilter::sample(const Frame frame,const float radius, const float threshold,std::vector <int> &sampled_finite)
+void DynamicFilter::sample(Frame &frame,const float radius, const float threshold,std::vector <int> &sampled_finite)
 {
- pcl::search::KdTree <Point> kdtree_point;
- kdtree_point.setInputCloud (frame.raw_input);
+ const PointSearch &kdtree_point = *frame.rawIndex();
  std::vector <bool> check(frame.raw_input->points.size(),false);
 
 
@@ -81,6 +80,7 @@ void DynamicFilter::sample(const Frame frame,const float radius, const float thr
 //calculating feature for every point takes more time.
 void DynamicFilter::EstimateFeature(Frame &frame)
 {
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/estimate_feature");
  std::vector <int> sampled_indices;
  sample(frame,feature_radius,0.009,sampled_indices);
  PointCloud::Ptr sampled(new PointCloud);
@@ -88,13 +88,17 @@ void DynamicFilter::EstimateFeature(Frame &frame)
  std::vector <int> finite_points;
  FeatureEstimationSHOT FeatureEstimate;
  SHOTCloud::Ptr scene_feature (new SHOTCloud);
- FeatureEstimate.estimateFeature(sampled,frame.raw_input,normal_radius,feature_radius,scene_feature,finite_points);
+ FeatureEstimate.estimateFeature(sampled,frame.raw_input,frame.rawIndex(),normal_radius,feature_radius,scene_feature,finite_points);
 
  for(auto &index:finite_points)
   frame.finite_points.push_back(sampled_indices[index]);
 
  pcl::copyPointCloud(*frame.raw_input,frame.finite_points,*frame.cloud_input);
- pcl::copyPointCloud(*scene_feature,finite_points,*frame.feature);
+ frame.input_index.reset();
+ if(descriptor_projection.enabled())
+  descriptor_projection.project(*scene_feature,finite_points,frame.reduced_feature);
+ else
+  pcl::copyPointCloud(*scene_feature,finite_points,*frame.feature);
 
 }
 
@@ -146,6 +150,7 @@ void DynamicFilter::sample_dynamic(const PointCloud::Ptr dynamic ,const float ra
 ///Estimate feature for dynamic points.
 void DynamicFilter::EstimateFeature(Frame &frame,const std::vector <int> &dynamic_indices)
 {
+ SQUIRREL_TRACE_SCOPE("dynamic_filter/estimate_feature_dynamic");
 
  PointCloud::Ptr dynamic(new PointCloud);
  pcl::copyPointCloud(*frame.raw_input,dynamic_indices,*dynamic);
@@ -157,13 +162,17 @@ void DynamicFilter::EstimateFeature(Frame &frame,const std::vector <int> &dynami
  std::vector <int> finite_points;
  FeatureEstimationSHOT FeatureEstimate;
  SHOTCloud::Ptr scene_feature (new SHOTCloud);
- FeatureEstimate.estimateFeature(sampled,frame.raw_input,normal_radius,feature_radius,scene_feature,finite_points);
+ FeatureEstimate.estimateFeature(sampled,frame.raw_input,frame.rawIndex(),normal_radius,feature_radius,scene_feature,finite_points);
 
  for(auto &index:finite_points)
   frame.finite_points.push_back(dynamic_indices[sampled_indices[index]]);
 
  pcl::copyPointCloud(*frame.raw_input,frame.finite_points,*frame.cloud_input);
- pcl::copyPointCloud(*scene_feature,finite_points,*frame.feature);
+ frame.input_index.reset();
+ if(descriptor_projection.enabled())
+  descriptor_projection.project(*scene_feature,finite_points,frame.reduced_feature);
+ else
+  pcl::copyPointCloud(*scene_feature,finite_points,*frame.feature);
 
 }
 
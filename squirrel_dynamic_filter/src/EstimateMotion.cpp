@@ -22,15 +22,31 @@
 
 
 #include "dynamic_filter_node.h"
+#include <Eigen/Geometry>
 using namespace Eigen;
 using namespace std;
 
 
 
+////Levenberg on fixed 6x6 blocks, all the vertices of the motion graphs are
+//poses. The linear solver is csparse, eigen (sparse Cholesky) or pcg
+static OptimizationAlgorithmLevenberg* motionAlgorithm(const std::string &linear_solver)
+{
+  BlockSolver_6_3::LinearSolverType * linearSolver;
+  if(linear_solver == "eigen")
+    linearSolver = new LinearSolverEigen<BlockSolver_6_3::PoseMatrixType>();
+  else if(linear_solver == "pcg")
+    linearSolver = new LinearSolverPCG<BlockSolver_6_3::PoseMatrixType>();
+  else
+    linearSolver = new LinearSolverCSparse<BlockSolver_6_3::PoseMatrixType>();
+  return new OptimizationAlgorithmLevenberg(new BlockSolver_6_3(linearSolver));
+}
+
 ////Motion for each cluster is calculated separately. Clustering makes things
 //faster and constraints the problem better
 void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const std::vector <int> &index_match,PointCloud &cloud_dynamic)
 {
+  SQUIRREL_TRACE_SCOPE("dynamic_filter/estimate_motion");
   PointCloud cloud_t_current;
   Isometry3D Identity;
   Identity.setIdentity();
@@ -40,44 +56,103 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
   frame_1.clusters.clear();
   frame_1.neighbours.clear();
   EuclideanClusteringMesh EstimateCluster;
-  EstimateCluster.extract_clusters(frame_1.raw_input,frame_1.clusters,frame_1.neighbours,0.3,100,20);
+  if(cluster_graph_distance > 0)
+    EstimateCluster.extract_clusters_graph(frame_1.raw_input,frame_1.clusters,frame_1.neighbours,cluster_graph_distance,8,20);
+  else
+    EstimateCluster.extract_clusters(frame_1.raw_input,frame_1.clusters,frame_1.neighbours,0.3,100,20);
 
   measure_time start_time = SystemClock::now();
 
-#pragma omp parallel for schedule(dynamic) num_threads(8)
+////Correspondence and position in its cluster of each point, looked up in
+//constant time by the clusters
+  const size_t num_points = frame_1.raw_input->points.size();
+  std::vector <int> match_of_point(num_points,-1);
+  for( size_t j = index_query.size(); j-- > 0; )
+    match_of_point[index_query[j]] = index_match[j];
+  std::vector <int> position_in_cluster(num_points,-1);
+  for( auto &cluster:frame_1.clusters)
+    for( size_t k = 0; k < cluster.size() ; ++k)
+      position_in_cluster[cluster[k]] = k;
+
+////With the warm start a point close to a point of the previous scan moved to
+//this one starts from the motion of that point instead of the odometry
+  std::vector <int> previous_motion;
+  if(motion_warm_start && !frame_1.motion_init.empty())
+  {
+    previous_motion.assign(num_points,-1);
+    PointSearch previous_index;
+    previous_index.setInputCloud(frame_1.cloud_transformed);
+#pragma omp parallel for num_threads(motion_threads)
+    for( size_t k = 0; k < num_points; ++k)
+    {
+      std::vector <int> index(1);
+      std::vector <float> distance(1);
+      if(previous_index.nearestKSearch(frame_1.raw_input->points[k],1,index,distance) > 0 && distance[0] < 0.01 * 0.01)
+        previous_motion[k] = index[0];
+    }
+  }
+
+#pragma omp parallel num_threads(motion_threads)
+ {
+////one optimizer per thread and cluster size, cleared for each cluster, its
+//solver and termination criterion are reused
+  SparseOptimizer small_optimizer, large_optimizer;
+  small_optimizer.setAlgorithm(motionAlgorithm(motion_linear_solver));
+  large_optimizer.setAlgorithm(motionAlgorithm(large_cluster_linear_solver));
+  SparseOptimizerTerminateAction* terminateAction = new SparseOptimizerTerminateAction;
+  terminateAction->setGainThreshold(0.08);
+  terminateAction->setMaxIterations(5);
+  for( SparseOptimizer* each:{&small_optimizer,&large_optimizer})
+  {
+    each->setVerbose(false);
+    each->addPostIterationAction(terminateAction);
+  }
+  std::unordered_set <uint64_t> edges;
 
+#pragma omp for schedule(dynamic)
   for( size_t i = 0; i < frame_1.clusters.size(); ++i)
   {
-    std::vector<int>cluster = frame_1.clusters[i];
+    const std::vector<int> &cluster = frame_1.clusters[i];
+    SparseOptimizer &optimizer = large_cluster_size > 0 && static_cast<int>(cluster.size()) >= large_cluster_size ? large_optimizer : small_optimizer;
     std::vector <int> index_query_filter;
     std::vector <int> index_match_filter;
-    pcl::CorrespondencesPtr initial ( new pcl::Correspondences);
-    int counter = 0;
 
 
 /////Correspondence for each cluster
 
     for( size_t k = 0; k < cluster.size() ; ++k)
     {
-      for( size_t j = 0; j < index_query.size() ; ++j)
+      if(match_of_point[cluster[k]] >= 0)
       {
-        if(cluster[k] == index_query[j])
-        {
-          pcl::Correspondence corr;
-          corr.index_query = counter;
-          corr.index_match = index_match[j];
-          initial->push_back(corr);
-					index_query_filter.push_back(k);
-          index_match_filter.push_back(index_match[j]);
-          counter +=1;
-          break;
-        }
+        index_query_filter.push_back(k);
+        index_match_filter.push_back(match_of_point[cluster[k]]);
       }
     }
   ////if they are less than 3 keypoints, do not opitmize
 
     if(index_query_filter.size() < 3)
       continue;
+
+////A cluster whose correspondences all fit one rigid motion takes the closed
+//form (Umeyama) estimate of it, without optimization
+    if(rigid_cluster_threshold > 0 && index_query_filter.size() >= 10)
+    {
+      Matrix3Xd source(3,index_query_filter.size());
+      Matrix3Xd target(3,index_query_filter.size());
+      for( size_t k = 0; k < index_query_filter.size(); ++k)
+      {
+        source.col(k) = frame_1.raw_input->points[cluster[index_query_filter[k]]].getVector3fMap().cast<double>();
+        target.col(k) = frame_2.raw_input->points[index_match_filter[k]].getVector3fMap().cast<double>();
+      }
+      Isometry3D rigid;
+      rigid.matrix() = umeyama(source,target,false);
+      if(((rigid * source) - target).colwise().norm().maxCoeff() < rigid_cluster_threshold)
+      {
+        for( auto &index:cluster)
+          motion_init_current[index] = rigid;
+        continue;
+      }
+    }
     PointCloud::Ptr kp (new PointCloud);
     PointCloud::Ptr cloud_cluster (new PointCloud);
     PointCloud::Ptr cloud_cluster_d_mean (new PointCloud);
@@ -99,12 +174,7 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
 */
 
 
-    BlockSolverX::LinearSolverType * linearSolver(new LinearSolverCSparse<BlockSolverX::PoseMatrixType>());
-    BlockSolverX* blockSolver(new BlockSolverX(linearSolver));
-    OptimizationAlgorithmLevenberg* optimizationAlgorithm(new OptimizationAlgorithmLevenberg(blockSolver));
-    SparseOptimizer optimizer;
-    optimizer.setVerbose(false);
-    optimizer.setAlgorithm(optimizationAlgorithm);
+    optimizer.clear();
 
 #if 0
 ////Initialize the vertextes of the graph. If the first frame each vertex's
@@ -172,7 +242,10 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
    position_input[2]=pos[2];
    VertexSE3_Vector3D* vertex_test= new VertexSE3_Vector3D;
    vertex_test->setId(k);
-   vertex_test->setEstimate(odometry_diff);
+   if(previous_motion.empty() || previous_motion[cluster[k]] < 0)
+     vertex_test->setEstimate(odometry_diff);
+   else
+     vertex_test->setEstimate(frame_1.motion_init[previous_motion[cluster[k]]]);
    vertex_test->setPosition(position_input);
    optimizer.addVertex(vertex_test);
   }
@@ -194,23 +267,21 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
     correspondence->setInformation(information);
     optimizer.addEdge(correspondence);
   }
-  MatrixXint edge_matrix = MatrixXint::Zero(cloud_cluster->points.size(),cloud_cluster->points.size());
+  edges.clear();
 
-// Connecting neighboring points for binaey edges
+// Connecting neighboring points for binaey edges, once per pair
 
   for ( size_t k = 0; k < cluster.size() ; ++k)
   {
     int check_neighbours = 0;
     for( size_t j = 0; j < frame_1.neighbours[cluster[k]].size() ; ++j)
     {
-      std::vector<int>::iterator it = std::find(cluster.begin() , cluster.end(), frame_1.neighbours[cluster[k]][j]);
-      int pos =  it - cluster.begin();
-      if(pos > cluster.size())
-      {
-        cout << pos << "," << cluster.size() << endl;
-        getchar();
-      }
-      if(edge_matrix(k,pos) == 0)
+      const int neighbour = frame_1.neighbours[cluster[k]][j];
+      const int pos = position_in_cluster[neighbour];
+      if(pos < 0 || cluster[pos] != neighbour)
+        continue;
+      const uint64_t edge_key = static_cast<uint64_t>(std::min<int>(k,pos)) * cluster.size() + std::max<int>(k,pos);
+      if(edges.count(edge_key) == 0)
       {
         check_neighbours+=1;
 		    MatrixXd information=MatrixXd::Identity(6,6);
@@ -229,18 +300,15 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
 		    odometry->setMeasurement(Isometry3D::Identity());
 		    odometry->setInformation(information);
 		    optimizer.addEdge(odometry);
-		    edge_matrix(k,pos)=edge_matrix(pos,k)=1;
+		    edges.insert(edge_key);
      }
     }
 
    }
 
    optimizer.initializeOptimization();
-   SparseOptimizerTerminateAction* terminateAction = 0;
-   terminateAction = new SparseOptimizerTerminateAction;
-   terminateAction->setGainThreshold(0.08);
-   terminateAction->setMaxIterations(5);
-   optimizer.addPostIterationAction(terminateAction);
+   ////the stop flag of the previous cluster does not apply
+   optimizer.setForceStopFlag(0);
    optimizer.optimize(5);
 ////Second round of optimzation
    g2o::HyperGraph::VertexIDMap ver = optimizer.vertices();
@@ -260,6 +328,13 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
     motion_init_current[cluster[v->id()]] = motion;
    }
 
+ }
+  for( SparseOptimizer* each:{&small_optimizer,&large_optimizer})
+  {
+    each->clear();
+    each->removePostIterationAction(terminateAction);
+  }
+  delete terminateAction;
  }
 
   PointCloud::Ptr score(new PointCloud);///used for estimaing score of static points
@@ -269,7 +344,8 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
   PointCloud::Ptr cloud_save(new PointCloud);
   ofstream write_trans;
   ofstream write_intensity_z;
-  if(store_results)
+  const bool store_files = store_results && !frame_log.isOpen();
+  if(store_files)
   {
     ss.str("");
     ss << output_folder << "motion_a" << "_" << frame_1.frame_id << ".csv";
@@ -308,7 +384,13 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
      point_cloud.y = point[1];
      point_cloud.z = point[2];
      cloud_save->points.push_back(point_cloud);
-     if(store_results)
+     if(frame_log.isOpen())
+     {
+       frame_record.saved_points.insert(frame_record.saved_points.end(),{point[0],point[1],point[2]});
+       frame_record.transformed_points.insert(frame_record.transformed_points.end(),{(float)point_final[0],(float)point_final[1],(float)point_final[2]});
+       frame_record.motions.insert(frame_record.motions.end(),motion.data(),motion.data() + 7);
+     }
+     else if(store_results)
        write_trans << motion(0) << "," << motion(1) << "," <<motion(2) << "," << motion(3) << "," << motion(4) << "," << motion(5) << "," << motion[6] << endl;
    }
    counter +=1;
@@ -326,7 +408,9 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
    {
      if(score < 0.05)///if point is static
        cloud_dynamic.points.push_back(cloud_save->points[count_point]);
-     if(store_results)
+     if(frame_log.isOpen())
+       frame_record.scores.push_back(score);
+     else if(store_results)
        write_intensity_z << score << endl;
      count_point += 1;
    }
@@ -334,7 +418,7 @@ void DynamicFilter::EstimateMotion(const std::vector <int> &index_query,const st
  else
    frame_1.prior_dynamic.clear();
 
- if(store_results)
+ if(store_files)
  {
    write_trans.close();
    write_intensity_z.close();
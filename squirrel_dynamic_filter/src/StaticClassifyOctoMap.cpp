@@ -20,211 +20,335 @@
 // LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
-#include "ros/ros.h"
-#include "datatypes_squirrel.h"
-#include <octomap/octomap.h>
-#include <octomap/OcTree.h>
-#include <octomap/octomap.h>
-#include <octomap_msgs/Octomap.h>
+#include "static_classify.h"
 #include <octomap_msgs/conversions.h>
-#include <octomap/ColorOcTree.h>
 #include <octomap/OcTreeNode.h>
-#include <pcl/visualization/pcl_visualizer.h>
-#include <pcl/filters/voxel_grid.h>
-#include <sensor_msgs/PointCloud2.h>
 #include <pcl_conversions/pcl_conversions.h>
-#include "squirrel_dynamic_filter_msgs/ClassifyStaticSrv.h"
-#include "edge_unary.h"
-#include "edge.h"
-#include <tf/transform_broadcaster.h>
 #include <pcl_ros/transforms.h>
-#include <pcl/kdtree/kdtree_flann.h>
+#include <pcl/common/io.h>
+#include "squirrel_3d_mapping/ChangeSetCoding.h"
+#include "g2o/types/slam3d/isometry3d_mappings.h"
+#include <algorithm>
+#include <cmath>
 using namespace octomap;
 using namespace std;
 using namespace Eigen;
 using namespace g2o;
 
-///a service for comparing the input scan with the existing octomap
-class ClassifyStatic
+///Morton code of an octree key, the keys close in space are close in the
+//code
+inline uint64_t MortonCode(const OcTreeKey &key)
 {
-  private:
-    ros::NodeHandle n;
-    ros::ServiceServer service;
-    ros::Publisher pub_static,pub_dynamic;
-    tf::TransformBroadcaster br;
-    tf::Transform transform_map_base_link;
-    ros::Subscriber octomap_sub;
-    ColorOcTree *tree;
-
-    bool is_map;
-  public:
-    string map_filename;
-   // void load_map()
-   // {
-    //  tree = new OcTree(map_filename);
-  //  }
-
-    ClassifyStatic()
-    {
-      is_map = true;
-      octomap_sub = n.subscribe("/octomap_full_color", 10, &ClassifyStatic::msgCallback, this);
-      service = n.advertiseService("classify_static", &ClassifyStatic::ClassifyStaticCallback,this);
-      pub_static = n.advertise<sensor_msgs::PointCloud2>("/kinect/depth/static",10);
-      pub_dynamic = n.advertise<sensor_msgs::PointCloud2>("/kinect/depth/dynamic",10);
-    }
-
-    void msgCallback(const octomap_msgs::OctomapConstPtr &msg)
-    {
-
-      if(is_map)
-        return;
+  uint64_t code = 0;
+  for(unsigned int bit = 0; bit < 16; ++bit)
+    for(unsigned int axis = 0; axis < 3; ++axis)
+      code |= static_cast<uint64_t>((key[axis] >> bit) & 1) << (3 * bit + axis);
+  return code;
+}
 
-      tree = new ColorOcTree(msg->resolution);
+///key of the cell of a point in a grid of the given size, 21 bits per axis
+inline uint64_t CellKey(int x,int y,int z)
+{
+  return (static_cast<uint64_t>(x & 0x1FFFFF) << 42) | (static_cast<uint64_t>(y & 0x1FFFFF) << 21) | static_cast<uint64_t>(z & 0x1FFFFF);
+}
 
+ClassifyStatic::ClassifyStatic(const ros::NodeHandle &nh,const ros::NodeHandle &private_n,bool advertise_service):n(nh),tree(NULL),requests_stop(false)
+{
+  std::string changes_topic;
+  private_n.param("incremental", incremental, false);
+  private_n.param("topic_changes", changes_topic, std::string("changes"));
+  private_n.param("voxel_classification", voxel_classification, false);
+  octomap_sub = n.subscribe("/octomap_full_color", 10, &ClassifyStatic::msgCallback, this);
+  if(incremental)
+    changes_sub = n.subscribe(changes_topic, 10, &ClassifyStatic::changesCallback, this);
+  if(advertise_service)
+    service = n.advertiseService("classify_static", &ClassifyStatic::ClassifyStaticCallback,this);
+  pub_static = n.advertise<sensor_msgs::PointCloud2>("/kinect/depth/static",10);
+  pub_dynamic = n.advertise<sensor_msgs::PointCloud2>("/kinect/depth/dynamic",10);
+}
 
-      std::stringstream datastream;
-      if(msg->data.size() > 0)
-      {
-        octomap::AbstractOcTree* tree_input = tree_input->createTree(msg->id,msg->resolution);
-        datastream.write((const char*) &msg->data[0], msg->data.size());
-        tree_input->readData(datastream);
-        tree = dynamic_cast<octomap::ColorOcTree*>(tree_input);
-        is_map = true;
-      }
+ClassifyStatic::~ClassifyStatic()
+{
+  if(requests_thread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(requests_mutex);
+      requests_stop = true;
+    }
+    requests_not_empty.notify_one();
+    requests_thread.join();
+  }
+  delete tree;
+}
 
+///the message is only kept, it is read by the next request
+void ClassifyStatic::msgCallback(const octomap_msgs::OctomapConstPtr &msg)
+{
+  if(msg->data.empty())
+    return;
+  std::lock_guard<std::mutex> lock(tree_mutex);
+  // the change sets keep the tree up to date, read only a new map
+  if(incremental && tree && fabs(tree->getResolution() - msg->resolution) < 1e-6)
+    return;
+  map_msg = msg;
+}
 
+///called with tree_mutex held
+void ClassifyStatic::readMap()
+{
+  if(!map_msg)
+    return;
+  std::stringstream datastream;
+  octomap::AbstractOcTree* tree_input = octomap::AbstractOcTree::createTree(map_msg->id,map_msg->resolution);
+  datastream.write((const char*) &map_msg->data[0], map_msg->data.size());
+  tree_input->readData(datastream);
+  ColorOcTree *tree_color = dynamic_cast<octomap::ColorOcTree*>(tree_input);
+  if(tree_color)
+  {
+    delete tree;
+    tree = tree_color;
+  }
+  else
+    delete tree_input;
+  map_msg.reset();
+}
 
+///applies the changed leafs of a tracking server's OctomapChangeSet, with
+//the same threshold of the colored map
+void ClassifyStatic::changesCallback(const squirrel_3d_mapping::OctomapChangeSetConstPtr &changes)
+{
+  std::lock_guard<std::mutex> lock(tree_mutex);
+  readMap();
+  if(!tree || fabs(tree->getResolution() - changes->resolution) > 1e-6)
+    return;
+  if(changes->occupancy.size() * 8 < changes->num_changes)
+    return;
+
+  const bool log_odds = changes->log_odds.size() == changes->num_changes;
+  size_t pos = 0;
+  uint64_t key = 0;
+  for(uint32_t i = 0; i < changes->num_changes; i++)
+  {
+    uint64_t delta;
+    if(!squirrel_3d_mapping::readVarint(changes->keys, pos, delta))
+      break;
+    key += delta;
+    OcTreeKey k = squirrel_3d_mapping::linearKeyToKey(key);
+    bool occupied = log_odds ? probability(changes->log_odds[i]) >= 0.9 : (changes->occupancy[i / 8] >> (i % 8)) & 1;
+    if(occupied)
+    {
+      if(log_odds)
+        tree->setNodeValue(k, changes->log_odds[i]);
+      else
+        tree->updateNode(k, true);
     }
-    bool ClassifyStaticCallback(squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Request &req,squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Response &res)
+    else
+      tree->deleteNode(k);
+  }
+}
+bool ClassifyStatic::ClassifyStaticCallback(squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Request &req,squirrel_dynamic_filter_msgs::ClassifyStaticSrv::Response &res)
+{
+  while(ros::ok())
+  {
     {
+      std::lock_guard<std::mutex> lock(tree_mutex);
+      readMap();
+      if(tree)
+        break;
+    }
+    ros::spinOnce();
+  }
+
+  Vector7d odometry;
+  for(int i = 0; i < 7; ++i)
+    odometry[i] = req.odometry[i];
+  PointCloud cloud_input_raw;
+  pcl::fromROSMsg(req.cloud,cloud_input_raw);
+  res.static_points.clear();
+  res.unclassified_points.clear();
+  return classify(cloud_input_raw,odometry,res.static_points,res.unclassified_points);
+}
 
-      is_map = false;
-      while(!is_map)
-        ros::spinOnce();
-
-      Vector7d odometry;
-
-      odometry[0] = req.odometry[0];
-      odometry[1] = req.odometry[1];
-      odometry[2] = req.odometry[2];
-      odometry[3] = req.odometry[3];
-      odometry[4] = req.odometry[4];
-      odometry[5] = req.odometry[5];
-      odometry[6] = req.odometry[6];
-      Isometry3D sensor_to_base_link_trans = g2o::internal::fromVectorQT(odometry);
-      Matrix4f sensor_base_link_trans;
-      sensor_base_link_trans(0,0) = sensor_to_base_link_trans(0,0);
-      sensor_base_link_trans(0,1) = sensor_to_base_link_trans(0,1);
-      sensor_base_link_trans(0,2) = sensor_to_base_link_trans(0,2);
-      sensor_base_link_trans(0,3) = sensor_to_base_link_trans(0,3);
-      sensor_base_link_trans(1,0) = sensor_to_base_link_trans(1,0);
-      sensor_base_link_trans(1,1) = sensor_to_base_link_trans(1,1);
-      sensor_base_link_trans(1,2) = sensor_to_base_link_trans(1,2);
-      sensor_base_link_trans(1,3) = sensor_to_base_link_trans(1,3);
-      sensor_base_link_trans(2,0) = sensor_to_base_link_trans(2,0);
-      sensor_base_link_trans(2,1) = sensor_to_base_link_trans(2,1);
-      sensor_base_link_trans(2,2) = sensor_to_base_link_trans(2,2);
-      sensor_base_link_trans(2,3) = sensor_to_base_link_trans(2,3);
-      sensor_base_link_trans(3,0) = sensor_to_base_link_trans(3,0);
-      sensor_base_link_trans(3,1) = sensor_to_base_link_trans(3,1);
-      sensor_base_link_trans(3,2) = sensor_to_base_link_trans(3,2);
-      sensor_base_link_trans(3,3) = sensor_to_base_link_trans(3,3);
-      PointCloud cloud_input_raw;
-      PointCloud::Ptr cloud_input(new PointCloud);
-
-
-  //OcTree *tree = new OcTree(map_filename);
-
-      pcl::fromROSMsg(req.cloud,cloud_input_raw);
-
-      pcl::transformPointCloud(cloud_input_raw,*cloud_input,sensor_base_link_trans);///Transforming cloud in base_link frame
-
-      PointCloud::Ptr static_cloud(new PointCloud);
-      PointCloud::Ptr dynamic_cloud(new PointCloud);
-
-      pcl::KdTreeFLANN <Point> kdtree;
-
-      kdtree.setInputCloud(cloud_input);
-      res.static_points.clear();
-      res.unclassified_points.clear();
-    ///if a point is in a occupied voxel then its static, otherswise might be new static or dynamic
-      int point_index = 0;
-      std::vector <bool> is_processed(cloud_input->points.size(),false);
-      fprintf(stderr,"inside service\n");
-      for(auto &point:cloud_input->points)
-      {
-        if(is_processed[point_index])
-        {
-          point_index+=1;
-          continue;
-        }
-        OcTreeNode *node = tree->search(point.x,point.y,point.z);
-        if((node) && (tree->isNodeOccupied(node)))
-        {
-          std::vector <int> pointIdxRadiusSearch;
-          std::vector <float> pointRadiusSquaredDistance;
-          if(kdtree.radiusSearch(point,0.2,pointIdxRadiusSearch,pointRadiusSquaredDistance) > 0)
+bool ClassifyStatic::classify(const PointCloud &cloud_input_raw,const Vector7d &odometry,std::vector<int> &static_points,std::vector<int> &unclassified_points)
+{
+  std::lock_guard<std::mutex> lock(tree_mutex);
+  readMap();
+  if(!tree)
+    return false;
+
+  Isometry3D sensor_to_base_link_trans = g2o::internal::fromVectorQT(odometry);
+  Matrix4f sensor_base_link_trans = sensor_to_base_link_trans.matrix().cast<float>();
+  PointCloud::Ptr cloud_input(new PointCloud);
+
+  pcl::transformPointCloud(cloud_input_raw,*cloud_input,sensor_base_link_trans);///Transforming cloud in base_link frame
+
+  PointCloud::Ptr static_cloud(new PointCloud);
+  PointCloud::Ptr dynamic_cloud(new PointCloud);
+
+  static_points.clear();
+  unclassified_points.clear();
+
+  ///the voxels of the points are searched in Morton order of their keys, the
+  //points in the same voxel share one search
+  point_codes.clear();
+  point_keys.resize(cloud_input->points.size());
+  for(size_t i = 0; i < cloud_input->points.size(); ++i)
+  {
+    const Point &point = cloud_input->points[i];
+    if(tree->coordToKeyChecked(point.x,point.y,point.z,point_keys[i]))
+      point_codes.push_back(std::make_pair(MortonCode(point_keys[i]),i));
+  }
+  std::sort(point_codes.begin(),point_codes.end());
+  is_occupied.assign(cloud_input->points.size(),false);
+  for(size_t i = 0; i < point_codes.size(); ++i)
+  {
+    if(i > 0 && point_codes[i].first == point_codes[i - 1].first)
+    {
+      is_occupied[point_codes[i].second] = is_occupied[point_codes[i - 1].second];
+      continue;
+    }
+    OcTreeNode *node = tree->search(point_keys[point_codes[i].second]);
+    is_occupied[point_codes[i].second] = (node) && (tree->isNodeOccupied(node));
+  }
+
+  const float static_radius = 0.2;
+  if(voxel_classification)
+  {
+    cells.clear();
+    cell_occupied.clear();
+    point_cells.resize(cloud_input->points.size());
+    for(size_t i = 0; i < cloud_input->points.size(); ++i)
+    {
+      const Point &point = cloud_input->points[i];
+      const uint64_t key = CellKey(std::floor(point.x / static_radius),std::floor(point.y / static_radius),std::floor(point.z / static_radius));
+      auto it = cells.insert(std::make_pair(key,static_cast<int>(cell_occupied.size())));
+      if(it.second)
+        cell_occupied.push_back(0);
+      point_cells[i] = it.first->second;
+      if(is_occupied[i])
+        cell_occupied[it.first->second] = 1;
+    }
+    ///label of each cell from its neighbourhood, then of its points
+    std::vector <char> cell_static(cell_occupied.size(),0);
+    for(auto &cell:cells)
+    {
+      const int x = cell.first >> 42,y = (cell.first >> 21) & 0x1FFFFF,z = cell.first & 0x1FFFFF;
+      for(int dx = -1; dx <= 1 && !cell_static[cell.second]; ++dx)
+        for(int dy = -1; dy <= 1 && !cell_static[cell.second]; ++dy)
+          for(int dz = -1; dz <= 1; ++dz)
           {
-            for(auto &index:pointIdxRadiusSearch)
+            auto it = cells.find(CellKey(x + dx,y + dy,z + dz));
+            if(it != cells.end() && cell_occupied[it->second])
             {
-              res.static_points.push_back(index);///static
-              is_processed[index] = true;
+              cell_static[cell.second] = 1;
+              break;
             }
-
           }
-
-        }
-        else
-        {
-          is_processed[point_index] = true;
-          res.unclassified_points.push_back(point_index);//new static or dynamic
-        }
-        point_index += 1;
+    }
+    for(size_t i = 0; i < cloud_input->points.size(); ++i)
+    {
+      if(cell_static[point_cells[i]])
+        static_points.push_back(i);///static
+      else
+        unclassified_points.push_back(i);//new static or dynamic
+    }
+  }
+  else
+  {
+    search.setInputCloud(cloud_input);
+  ///if a point is in a occupied voxel then its static, otherswise might be new static or dynamic
+    int point_index = 0;
+    std::vector <bool> is_processed(cloud_input->points.size(),false);
+    for(auto &point:cloud_input->points)
+    {
+      if(is_processed[point_index])
+      {
+        point_index+=1;
+        continue;
       }
+      if(is_occupied[point_index])
+      {
+        if(search.radiusSearch(point,static_radius,point_idx_radius_search,point_radius_squared_distance) > 0)
+        {
+          for(auto &index:point_idx_radius_search)
+          {
+            static_points.push_back(index);///static
+            is_processed[index] = true;
+          }
 
-      delete tree;
-      transform_map_base_link.setOrigin(tf::Vector3(odometry[0],odometry[1],odometry[2]));
-      tf::Quaternion q(odometry[3],odometry[4],odometry[5],odometry[6]);
-      transform_map_base_link.setRotation(q);
-
-      br.sendTransform(tf::StampedTransform(transform_map_base_link, ros::Time::now(), "map", "base_link_static"));//publish the tf corresponding to points
-
-      pcl::copyPointCloud(cloud_input_raw,res.static_points,*static_cloud);//points corresponding to map(static)
-
-      if(res.unclassified_points.size() > 100)
-        pcl::copyPointCloud(cloud_input_raw,res.unclassified_points,*dynamic_cloud);
-      sensor_msgs::PointCloud2 cloud_msg;
-      sensor_msgs::PointCloud2 cloud_msg_2;
+        }
 
+      }
+      else
+      {
+        is_processed[point_index] = true;
+        unclassified_points.push_back(point_index);//new static or dynamic
+      }
+      point_index += 1;
+    }
+  }
 
-      static_cloud->width = static_cloud->points.size();
-      static_cloud->height = 1;
-      dynamic_cloud->width = dynamic_cloud->points.size();
-      dynamic_cloud->height = 1;
+  transform_map_base_link.setOrigin(tf::Vector3(odometry[0],odometry[1],odometry[2]));
+  tf::Quaternion q(odometry[3],odometry[4],odometry[5],odometry[6]);
+  transform_map_base_link.setRotation(q);
 
+  br.sendTransform(tf::StampedTransform(transform_map_base_link, ros::Time::now(), "map", "base_link_static"));//publish the tf corresponding to points
 
+  pcl::copyPointCloud(cloud_input_raw,static_points,*static_cloud);//points corresponding to map(static)
 
-      pcl::toROSMsg(*dynamic_cloud,cloud_msg_2);
-      cloud_msg_2.header.frame_id = "base_link_static";
-      pcl::toROSMsg(*static_cloud,cloud_msg);
-      cloud_msg.header.frame_id = "base_link_static";
-      pub_static.publish(cloud_msg);
-      pub_dynamic.publish(cloud_msg_2);
+  if(unclassified_points.size() > 100)
+    pcl::copyPointCloud(cloud_input_raw,unclassified_points,*dynamic_cloud);
+  sensor_msgs::PointCloud2 cloud_msg;
+  sensor_msgs::PointCloud2 cloud_msg_2;
 
-      return true;
+  static_cloud->width = static_cloud->points.size();
+  static_cloud->height = 1;
+  dynamic_cloud->width = dynamic_cloud->points.size();
+  dynamic_cloud->height = 1;
 
-    }
+  pcl::toROSMsg(*dynamic_cloud,cloud_msg_2);
+  cloud_msg_2.header.frame_id = "base_link_static";
+  pcl::toROSMsg(*static_cloud,cloud_msg);
+  cloud_msg.header.frame_id = "base_link_static";
+  pub_static.publish(cloud_msg);
+  pub_dynamic.publish(cloud_msg_2);
 
-};
+  return true;
+}
 
-int main(int argc,char **argv)
+void ClassifyStatic::classifyAsync(int frame_id,const PointCloud::ConstPtr &cloud,const Vector7d &odometry,const ResultCallback &callback)
 {
-    ros::init(argc, argv, "squirrel_dynamic_filter_static_classify");
-    ClassifyStatic classify;
-    classify.map_filename = argv[1];
-//    classify.load_map();
-    while(ros::ok())
-      ros::spinOnce();
+  Request request;
+  request.frame_id = frame_id;
+  request.cloud = cloud;
+  request.odometry = odometry;
+  request.callback = callback;
+  {
+    std::lock_guard<std::mutex> lock(requests_mutex);
+    if(!requests_thread.joinable())
+      requests_thread = std::thread(&ClassifyStatic::requestsLoop,this);
+    requests.push_back(request);
+  }
+  requests_not_empty.notify_one();
 }
 
-
+void ClassifyStatic::requestsLoop()
+{
+  while(true)
+  {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(requests_mutex);
+      requests_not_empty.wait(lock,[this]{ return requests_stop || !requests.empty(); });
+      if(requests_stop)
+        return;
+      request = requests.front();
+      requests.pop_front();
+    }
+    Result result;
+    result.frame_id = request.frame_id;
+    result.cloud = request.cloud;
+    result.success = classify(*request.cloud,request.odometry,result.static_points,result.unclassified_points);
+    request.callback(result);
+  }
+}
@@ -21,13 +21,11 @@
 // SOFTWARE.
 
 #include "datatypes_squirrel.h"
+#include "TemporalFilter.h"
 #include <pcl/visualization/pcl_visualizer.h>
+#include <pcl/common/io.h>
 #include "edge_unary.h"
 #include "edge.h"
-#include <mlpack/core.hpp>
-#include <mlpack/core/dists/gaussian_distribution.hpp>
-#include <pcl/registration/correspondence_estimation.h>
-#include <pcl/registration/impl/correspondence_estimation.hpp>
 
 
 using namespace std;
@@ -49,21 +47,8 @@ void keyboardEventOccurred (const pcl::visualization::KeyboardEvent &event,
   }
 }
 
-
 int main(int argc,char **argv)
 {
- arma::mat covariance(3,3);
- arma::vec mean(3);
- arma::vec observation(3);
- covariance(0,0) = 1.0; covariance(0,1) = 0.0; covariance(0,2) = 0.0;
- covariance(1,0) = 0.0; covariance(1,1) = 1.0; covariance(1,2) = 0.0;
- covariance(2,0) = 0.0; covariance(2,1) = 0.0; covariance(2,2) = 1.0;
- covariance *= 0.1;
-
- std::vector <float> prior_dynamic;
-
-
-
  int start_frame = atoi(argv[1]);
  int end_frame = atoi(argv[2]);
 
@@ -73,184 +58,36 @@ int main(int argc,char **argv)
 
  PointCloud::Ptr cloud(new PointCloud);
  PointCloud::Ptr cloud_trans(new PointCloud);
+ PointCloud::Ptr cloud_next(new PointCloud);
  IntensityCloud ground;
  std::stringstream ss;
 
- ifstream myfile;
  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer(new pcl::visualization::PCLVisualizer ("3D Viewer"));
 	std::vector < Vector7d > motion_trans;
 
  ss.str("");
 
  ss << folder << "/odometry.csv";
- string line;
-	myfile.open(ss.str());
-	if (myfile.is_open())
- {
-  while ( getline (myfile,line) )
-			{
-
-    Vector7d trans;
-				for(int i = 0 ; i<7;i++)
-				{
-
-					std::size_t found = line.find(",");
-					if(i==0)
-						trans[0] = atof(line.substr(0,found).c_str());
-					if(i==1)
-						trans[1] = atof(line.substr(0,found).c_str());
-					if(i==2)
-						trans[2] = atof(line.substr(0,found).c_str());
-					if(i==3)
-						trans[3] = atof(line.substr(0,found).c_str());
-					if(i==4)
-						trans[4] = atof(line.substr(0,found).c_str());
-					if(i==5)
-						trans[5] = atof(line.substr(0,found).c_str());
-					if(i==6)
-						trans[6] = atof(line.substr(0,found).c_str());
-					string line_new=line.substr(found+1);
-					line=line_new;
-
-
-
-
-
-				}
-
-				motion_trans.push_back(trans);
-
-   }
- }
-
- myfile.close();
+ LoadPoses(ss.str(),motion_trans);
 
  Isometry3D frame_1 = ::g2o::internal::fromVectorQT(motion_trans[start_frame]);
  Isometry3D frame_2 = ::g2o::internal::fromVectorQT(motion_trans[start_frame + 1]);
  Isometry3D odometry = (frame_2.inverse() * frame_1);////odometry from the robot
- mean[0] = odometry(0,3);
- mean[1] = odometry(1,3);
- mean[2] = odometry(2,3);
-
- observation[0] = odometry(0,3);
- observation[1] = odometry(1,3);
- observation[2] = odometry(2,3);
-
- mlpack::distribution::GaussianDistribution dist_max(mean,covariance);
- float max = dist_max.Probability(observation);
-
- ss.str("");
- ss << folder << "cloud_save_robust_a_" << start_frame << ".pcd";
-
- reader.read(ss.str(),*cloud);
-
- prior_dynamic.assign(cloud->points.size(),0.2);
-
-
-
-
- mlpack::distribution::GaussianDistribution dist(mean,covariance);
-
-
- const float prior_static = 0.8;
-
- const float p_s_d = 0.05;
- const float p_s_s = 0.95;
- const float p_d_s = 0.05;
- const float p_d_d = 0.95;
-
-
- int counter = 0;
- ss.str("");
- ss << folder << "motion_a_" << start_frame << ".csv";
+ ///the likelihood of the static points is centered on the first odometry
+ const Vector3d mean = odometry.translation();
 
+ FrameLogReader frame_log;
+ frame_log.open(folder + "frames.dflog");
+ std::vector <Vector7d> motions;
+ std::vector <float> prior_dynamic;
+ std::vector <float> current_belief;
+ const bool has_motions = ReadFrame(frame_log,folder,start_frame,*cloud,motions);
 
- myfile.open(ss.str().c_str());
- if (myfile.is_open())
+ if (has_motions)
  {
-  std::vector <float> current_belief;
-  while ( getline (myfile,line) )
-  {
-   Vector7d trans;
-   for(int i = 0 ; i<7;i++)
-   {
-
-    std::size_t found = line.find(",");
-    if(i==0)
-     trans[0] = atof(line.substr(0,found).c_str());
-    if(i==1)
-     trans[1] = atof(line.substr(0,found).c_str());
-    if(i==2)
-     trans[2] = atof(line.substr(0,found).c_str());
-    if(i==3)
-     trans[3] = atof(line.substr(0,found).c_str());
-    if(i==4)
-     trans[4] = atof(line.substr(0,found).c_str());
-    if(i==5)
-     trans[5] = atof(line.substr(0,found).c_str());
-    if(i==6)
-     trans[6] = atof(line.substr(0,found).c_str());
-    string line_new=line.substr(found+1);
-    line=line_new;
-   }
-
-   Isometry3D estimated_motion = ::g2o::internal::fromVectorQT(trans);
-
-   Vector4f point = cloud->points[counter].getVector4fMap();
-
-   point[3] = 1.0;
-
-   Vector4d point_trans = estimated_motion * point.cast<double>();
-
-   pcl::PointXYZ PCLpoint;
-   PCLpoint.x = point_trans[0];
-   PCLpoint.y = point_trans[1];
-   PCLpoint.z = point_trans[2];
-
-   cloud_trans->points.push_back(PCLpoint);
-
-
-
-   Isometry3D motion_diff = estimated_motion.inverse() * odometry;
-
-   Vector3d trans_motion(motion_diff(0,3),motion_diff(1,3),motion_diff(2,3));
-   observation[0] = motion_diff(0,3);
-   observation[1] = motion_diff(1,3);
-   observation[2] = motion_diff(2,3);
-
-   float posterior_d = (1.0 - dist.Probability(observation)/max)  * ((p_d_d * prior_dynamic[counter]) + (p_d_s * (1.0 - prior_dynamic[counter])));
-   float posterior_s = (dist.Probability(observation)/max) * ((p_s_s * (1.0 - prior_dynamic[counter])) + (p_s_d * prior_dynamic[counter]));
-
-   float probability = posterior_d/(posterior_d + posterior_s);
-   current_belief.push_back(probability);
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-//   cout << trans_motion.lpNorm<2>() << endl;
-//   cout << dist.Probability(observation)/max << "," << probability << endl;
-
-
-//   getchar();
-   counter +=1;
-  }
-
-  prior_dynamic.clear();
-
-  prior_dynamic = current_belief;
-
-  myfile.close();
-
+  temporal_filter::Update(*cloud,motions,odometry,mean,cloud_trans,prior_dynamic,*cloud_next,current_belief);
+  prior_dynamic.swap(current_belief);
+  cloud_trans.swap(cloud_next);
  }
  for(size_t i = start_frame+1; i < end_frame; ++i)
  {
@@ -260,121 +97,23 @@ int main(int argc,char **argv)
   odometry = (frame_2.inverse() * frame_1);////odometry from the robot
 
   cloud->points.clear();
-  ss.str("");
-  ss << folder << "cloud_save_robust_a_" << i << ".pcd";
-  reader.read(ss.str(),*cloud);
+  const bool has_motions = ReadFrame(frame_log,folder,i,*cloud,motions);
 
   IntensityCloud::Ptr cloud_intensity(new IntensityCloud);
 
-  reader.read(ss.str(),*cloud_intensity);
+  pcl::copyPointCloud(*cloud,*cloud_intensity);
   ss.str("");
 
   ss << folder << "ground_a_" << i << ".pcd";
   reader.read(ss.str(),ground);
 
-  pcl::Correspondences all_correspondences;
-  pcl::registration::CorrespondenceEstimation<Point, Point> est;
-  est.setInputSource (cloud);
-  est.setInputTarget (cloud_trans);
-  est.determineCorrespondences (all_correspondences);
-
-
-  cloud_trans->points.clear();
-  counter = 0;
-  ss.str("");
-  ss << folder << "motion_a_" << i << ".csv";
-
-
-  myfile.open(ss.str().c_str());
-  if (myfile.is_open())
+  if (has_motions)
   {
-   std::vector <float> current_belief;
-   while ( getline (myfile,line) )
-   {
-    Vector7d trans;
-    for(int i = 0 ; i<7;i++)
-    {
-
-     std::size_t found = line.find(",");
-     if(i==0)
-      trans[0] = atof(line.substr(0,found).c_str());
-     if(i==1)
-      trans[1] = atof(line.substr(0,found).c_str());
-     if(i==2)
-      trans[2] = atof(line.substr(0,found).c_str());
-     if(i==3)
-      trans[3] = atof(line.substr(0,found).c_str());
-     if(i==4)
-      trans[4] = atof(line.substr(0,found).c_str());
-     if(i==5)
-      trans[5] = atof(line.substr(0,found).c_str());
-     if(i==6)
-      trans[6] = atof(line.substr(0,found).c_str());
-     string line_new=line.substr(found+1);
-     line=line_new;
-    }
-
-    Isometry3D estimated_motion = ::g2o::internal::fromVectorQT(trans);
-
-    Vector4f point = cloud->points[counter].getVector4fMap();
-
-    point[3] = 1.0;
-
-    Vector4d point_trans = estimated_motion * point.cast<double>();
-
-    pcl::PointXYZ PCLpoint;
-    PCLpoint.x = point_trans[0];
-    PCLpoint.y = point_trans[1];
-    PCLpoint.z = point_trans[2];
-
-    cloud_trans->points.push_back(PCLpoint);
-    Isometry3D motion_diff = estimated_motion.inverse() * odometry;
-
-    Vector3d trans_motion(motion_diff(0,3),motion_diff(1,3),motion_diff(2,3));
-    observation[0] = motion_diff(0,3);
-    observation[1] = motion_diff(1,3);
-    observation[2] = motion_diff(2,3);
-
-
-    float prior;
-
-    if(all_correspondences[counter].distance <= 0.1)
-     prior = prior_dynamic[all_correspondences[counter].index_match];
-    else
-     prior = 0.2;
-
-
-
-    float posterior_d = (1.0 - dist.Probability(observation)/max)  * ((p_d_d * prior) + (p_d_s * (1.0 - prior)));
-
-    float posterior_s = (dist.Probability(observation)/max) * ((p_s_s * (1.0 - prior)) + (p_s_d * prior));
-
-
-    float probability = posterior_d/(posterior_d + posterior_s);
-    current_belief.push_back(probability);
-    //current_belief.push_back(posterior_d);
-    if(counter > cloud_intensity->points.size())
-    {
-     cout << counter << "," << cloud_intensity->points.size() << endl;
-     getchar();
-
-    }
-    cloud_intensity->points[counter].intensity = probability;
-   /*
-    if(i == 59)
-    {
-    cout << trans_motion.lpNorm<2>() << endl;
-    cout << dist.Probability(observation)/max << "," << probability << "," << prior << "," << (p_d_d * prior_dynamic[all_correspondences[counter].index_match]) + (p_d_s * (1.0 - prior_dynamic[all_correspondences[counter].index_match])) << "," << ((p_s_s * (1.0 - prior_dynamic[all_correspondences[counter].index_match])) + (p_s_d * prior_dynamic[all_correspondences[counter].index_match])) << "," << posterior_d << "," << posterior_s << endl;
-    getchar();
-    }
-    */
-    counter +=1;
-   }
-   prior_dynamic.clear();
-
-   prior_dynamic = current_belief;
-
-   myfile.close();
+   temporal_filter::Update(*cloud,motions,odometry,mean,cloud_trans,prior_dynamic,*cloud_next,current_belief);
+   for(size_t k = 0; k < current_belief.size(); ++k)
+    cloud_intensity->points[k].intensity = current_belief[k];
+   prior_dynamic.swap(current_belief);
+   cloud_trans.swap(cloud_next);
   }
 
   for(auto &point:ground.points)
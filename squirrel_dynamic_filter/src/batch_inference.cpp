@@ -0,0 +1,142 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "datatypes_squirrel.h"
+#include "TemporalFilter.h"
+#include <omp.h>
+#include <cstdlib>
+#include <future>
+
+///Headless TemporalInference over a range of frames, for re-evaluating a
+//recorded run. The range is split in windows processed in parallel, each one
+//starts overlap frames earlier so that the priors of its first frame have
+//converged, and the next frame of a window is read while the current one is
+//processed. The beliefs of all the frames go to one log, read by
+//remove_dynamic as the scores of the points if it is named frames.dflog.
+//
+//usage: batch_inference start_frame end_frame folder [output] [window]
+//       [overlap] [threads]
+
+using namespace std;
+using namespace g2o;
+
+struct BatchFrame
+{
+ PointCloud::Ptr cloud;
+ std::vector <Vector7d> motions;
+ bool has_motions;
+ BatchFrame():cloud(new PointCloud),has_motions(false) {}
+};
+
+int main(int argc,char **argv)
+{
+ if(argc < 4)
+ {
+  cerr << "usage: " << argv[0] << " start_frame end_frame folder [output] [window] [overlap] [threads]" << endl;
+  return 1;
+ }
+ const int start_frame = atoi(argv[1]);
+ int end_frame = atoi(argv[2]);
+ const string folder = argv[3];
+ const string output = argc > 4 ? argv[4] : folder + "inference.dflog";
+ const int window = argc > 5 ? std::max(atoi(argv[5]),1) : 50;
+ const int overlap = argc > 6 ? std::max(atoi(argv[6]),0) : 10;
+ const int threads = argc > 7 ? std::max(atoi(argv[7]),1) : omp_get_max_threads();
+
+ std::vector <Vector7d> motion_trans;
+ if(!LoadPoses(folder + "/odometry.csv",motion_trans) || static_cast<int>(motion_trans.size()) < start_frame + 2)
+ {
+  cerr << "cannot read the odometry of the frames from " << folder << "/odometry.csv" << endl;
+  return 1;
+ }
+ ///the odometry of a frame needs the pose of the next one
+ end_frame = std::min(end_frame,static_cast<int>(motion_trans.size()) - 1);
+
+ ///as in TemporalInference the likelihood is centered on the first odometry
+ const Isometry3D first_odometry = ::g2o::internal::fromVectorQT(motion_trans[start_frame + 1]).inverse() * ::g2o::internal::fromVectorQT(motion_trans[start_frame]);
+ const Eigen::Vector3d mean = first_odometry.translation();
+
+ FrameLogWriter writer;
+ if(!writer.open(output,4 * threads))
+ {
+  cerr << "cannot write " << output << endl;
+  return 1;
+ }
+
+ const int num_windows = (end_frame - start_frame + window - 1) / window;
+ const measure_time start = SystemClock::now();
+ #pragma omp parallel for schedule(dynamic,1) num_threads(threads)
+ for(int w = 0; w < num_windows; ++w)
+ {
+  const int first_stored = start_frame + w * window;
+  const int last = std::min(first_stored + window,end_frame);
+  const int first = std::max(first_stored - overlap,start_frame);
+
+  ///the reader is only used by the prefetch, one frame at a time
+  FrameLogReader frame_log;
+  frame_log.open(folder + "frames.dflog");
+  auto load = [&frame_log,&folder](int frame_id)
+  {
+   BatchFrame frame;
+   frame.has_motions = ReadFrame(frame_log,folder,frame_id,*frame.cloud,frame.motions);
+   return frame;
+  };
+
+  PointCloud::Ptr previous(new PointCloud);
+  PointCloud::Ptr transformed(new PointCloud);
+  std::vector <float> prior;
+  std::vector <float> belief;
+  std::future<BatchFrame> next = std::async(std::launch::async,load,first);
+  for(int i = first; i < last; ++i)
+  {
+   BatchFrame frame = next.get();
+   if(i + 1 < last)
+    next = std::async(std::launch::async,load,i + 1);
+   if(!frame.has_motions)
+    continue;
+
+   const Isometry3D odometry = ::g2o::internal::fromVectorQT(motion_trans[i + 1]).inverse() * ::g2o::internal::fromVectorQT(motion_trans[i]);
+   temporal_filter::Update(*frame.cloud,frame.motions,odometry,mean,previous,prior,*transformed,belief);
+
+   if(i >= first_stored)
+   {
+    FrameRecord record;
+    record.frame_id = i;
+    Eigen::Map<Vector7d>(record.odometry) = motion_trans[i];
+    AppendPoints(*frame.cloud,record.saved_points);
+    record.motions.reserve(7 * frame.motions.size());
+    for(auto &motion:frame.motions)
+     record.motions.insert(record.motions.end(),motion.data(),motion.data() + 7);
+    AppendPoints(*transformed,record.transformed_points);
+    record.scores = belief;
+    writer.push(record);
+   }
+   prior.swap(belief);
+   previous.swap(transformed);
+  }
+ }
+ writer.close();
+
+ const TimeDiff duration = SystemClock::now() - start;
+ cout << end_frame - start_frame << " frames in " << num_windows << " windows, " << duration.count() << " s" << endl;
+ return 0;
+}
@@ -49,6 +49,21 @@ namespace g2o {
     }
 
 
+  void EdgeICP::linearizeOplus()
+  {
+    const VertexSE3_Vector3D* v1 = static_cast<const VertexSE3_Vector3D*>(_vertices[0]);
+    // the update is applied on the right, T * exp(dt, dq) * p, with the rotation of the compact quaternion dq
+    // linear in 2 * dq at the origin
+    const Matrix3D R = v1->estimate().linear();
+    const Vector3D p = v1->getPosition();
+    Matrix3D p_skew;
+    p_skew <<     0., -p.z(),  p.y(),
+               p.z(),     0., -p.x(),
+              -p.y(),  p.x(),     0.;
+    _jacobianOplusXi.block<3,3>(0,0) = R;
+    _jacobianOplusXi.block<3,3>(0,3).noalias() = -2. * R * p_skew;
+  }
+
   bool EdgeICP::write(std::ostream& os) const
     {
 
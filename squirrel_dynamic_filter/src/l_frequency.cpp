@@ -35,6 +35,7 @@
 #include <pcl/filters/voxel_grid.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include "squirrel_dynamic_filter_msgs/CloudMsg.h"
+#include "std_msgs/Int32.h"
 #include "datatypes_squirrel.h"
 
 ///Receiving the kinect data and sending the data to the dynamic_filter. This is
@@ -59,16 +60,39 @@ class tfPointCloud
     ros::Time start_time;
     squirrel_dynamic_filter_msgs::CloudMsg cloud_msg;
     bool is_verbose;
+    ///With adaptive_rate only the latest cloud is kept, and it is released
+    //when the dynamic filter is ready for the next frame (or after
+    //ready_timeout) and the pose of the robot is in the cache of tf, without
+    //waiting for it. The cloud before the latest is released instead if only
+    //its pose is known.
+    bool adaptive_rate;
+    double ready_timeout;
+    bool is_ready;
+    sensor_msgs::PointCloud2::ConstPtr latest_cloud,previous_cloud;
+    ros::Time released_time;
+    ros::Subscriber latest_sub;
+    ros::Subscriber ready_sub;
+    ros::Timer release_timer;
 	public:
-		tfPointCloud():tf_()
+		tfPointCloud():tf_(),tf_filter_(NULL),is_ready(true)
 		{
+      n_.getParam("DownSamplingRadius",down_sampling_radius);
+      n_.getParam("Verbose",is_verbose);
+      n_.param("AdaptiveRate",adaptive_rate,false);
+      n_.param("ReadyTimeout",ready_timeout,1.0);
+      cloud_msg.odometry.resize(7);
+      if(adaptive_rate)
+      {
+        latest_sub = n_.subscribe("/kinect/depth/points/",1,&tfPointCloud::latestCallback,this);
+        ready_sub = n_.subscribe("/squirrel/dynamic_filter_ready",10,&tfPointCloud::readyCallback,this);
+        release_timer = n_.createTimer(ros::Duration(0.01),&tfPointCloud::releaseCallback,this);
+        publisher = n_.advertise<squirrel_dynamic_filter_msgs::CloudMsg>("/squirrel/cloud_msg",1);///publisher
+        return;
+      }
       cloud_sub_.subscribe(n_, "/kinect/depth/points/",100);///Subscriber
 			tf_filter_ = new tf::MessageFilter<sensor_msgs::PointCloud2> (cloud_sub_, tf_, "base_link", 1);///Filter to synchronize
       tf_filter_->registerCallback(boost::bind(&tfPointCloud::msgCallback, this, _1) );
       publisher = n_.advertise<squirrel_dynamic_filter_msgs::CloudMsg>("/squirrel/cloud_msg",100);///publisher
-      cloud_msg.odometry.resize(7);
-      n_.getParam("DownSamplingRadius",down_sampling_radius);
-      n_.getParam("Verbose",is_verbose);
     }
     void msgCallback(const sensor_msgs::PointCloud2::ConstPtr& sensor_msg)
     {
@@ -84,6 +108,53 @@ class tfPointCloud
       ROS_ERROR("%s,%s",ros::this_node::getName().c_str(),ex.what());
       ros::Duration(1.0).sleep();
       }
+      publishCloud(sensor_msg,transform);
+    }
+
+    void latestCallback(const sensor_msgs::PointCloud2::ConstPtr& sensor_msg)
+    {
+      if(latest_cloud)
+        previous_cloud = latest_cloud;
+      latest_cloud = sensor_msg;
+    }
+
+    void readyCallback(const std_msgs::Int32::ConstPtr& frame_id)
+    {
+      is_ready = true;
+    }
+
+    void releaseCallback(const ros::TimerEvent&)
+    {
+      if(!latest_cloud)
+        return;
+      if(!is_ready && (ros::Time::now() - released_time).toSec() < ready_timeout)
+        return;
+      sensor_msgs::PointCloud2::ConstPtr sensor_msg;
+      if(tf_.canTransform("/map", "/base_link",latest_cloud->header.stamp))
+        sensor_msg = latest_cloud;
+      else if(previous_cloud && tf_.canTransform("/map", "/base_link",previous_cloud->header.stamp))
+        sensor_msg = previous_cloud;
+      else
+        return;
+      tf::StampedTransform transform;
+      try
+      {
+        tf_.lookupTransform("/map", "/base_link",sensor_msg->header.stamp , transform);
+      }
+      catch (tf::TransformException ex){
+        ROS_ERROR("%s,%s",ros::this_node::getName().c_str(),ex.what());
+        return;
+      }
+      if(sensor_msg == latest_cloud)
+        latest_cloud.reset();
+      previous_cloud.reset();
+      is_ready = false;
+      released_time = ros::Time::now();
+      publishCloud(sensor_msg,transform);
+    }
+
+    void publishCloud(const sensor_msgs::PointCloud2::ConstPtr& sensor_msg,const tf::StampedTransform &transform)
+    {
  ///Downampling the cloud
 
 
@@ -36,6 +36,7 @@
 #include <pcl_conversions/pcl_conversions.h>
 #include "squirrel_dynamic_filter_msgs/CloudMsg.h"
 #include "datatypes_squirrel.h"
+#include "PoseIO.h"
 #include "edge_unary.h"
 #include "edge.h"
 #include <tf/transform_broadcaster.h>
@@ -107,39 +108,10 @@ class tfPointCloud
 
       //cerr << ss.str() << endl;
 
-      ifstream myfile(ss.str().c_str());
-      std::string line;
+      std::vector <Vector7d> poses;
       Isometry3D sensor_to_base_link_trans;
-      if (myfile.is_open())
-      {
-        Vector7d trans;
-        while (getline (myfile,line))
-        {
-          for(int i = 0 ; i<7;i++)
-          {
-
-            std::size_t found = line.find(",");
-            if(i==0)
-              trans[0] = atof(line.substr(0,found).c_str());
-            if(i==1)
-              trans[1] = atof(line.substr(0,found).c_str());
-            if(i==2)
-              trans[2] = atof(line.substr(0,found).c_str());
-            if(i==3)
-              trans[3] = atof(line.substr(0,found).c_str());
-            if(i==4)
-              trans[4] = atof(line.substr(0,found).c_str());
-            if(i==5)
-              trans[5] = atof(line.substr(0,found).c_str());
-            if(i==6)
-              trans[6] = atof(line.substr(0,found).c_str());
-            string line_new=line.substr(found+1);
-            line=line_new;
-          }
-        }
-        sensor_to_base_link_trans = g2o::internal::fromVectorQT(trans);
-      }
-      myfile.close();
+      if (LoadPoses(ss.str(),poses) && !poses.empty())
+        sensor_to_base_link_trans = g2o::internal::fromVectorQT(poses.back());
       sensor_base_link_trans(0,0) = sensor_to_base_link_trans(0,0);
       sensor_base_link_trans(0,1) = sensor_to_base_link_trans(0,1);
       sensor_base_link_trans(0,2) = sensor_to_base_link_trans(0,2);
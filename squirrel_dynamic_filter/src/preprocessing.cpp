@@ -24,6 +24,7 @@
 #include "tf/transform_listener.h"
 #include "tf/message_filter.h"
 #include "sensor_msgs/PointCloud2.h"
+#include "std_msgs/Int32.h"
 #include <pcl_conversions/pcl_conversions.h>
 #include "squirrel_dynamic_filter_msgs/CloudMsg.h"
 #include "squirrel_dynamic_filter_msgs/DynamicFilterSrv.h"
@@ -32,10 +33,19 @@
 #include "edge_unary.h"
 #include "edge.h"
 #include "datatypes_squirrel.h"
+#include "PoseIO.h"
+#include "VoxelGridIndex.h"
+#include "static_classify.h"
 #include <pcl/keypoints/uniform_sampling.h>
 #include <pcl_ros/transforms.h>
+#include <squirrel_point_buffer/kernels.h>
+#include <squirrel_point_buffer/pcl_adapters.h>
 #include <pcl/filters/voxel_grid.h>
 #include <tf/transform_broadcaster.h>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <mutex>
 
 using namespace std;
 using namespace Eigen;
@@ -49,6 +59,7 @@ class tfPointCloud
     ros::Publisher  pub;   ///publisher for filtrered cloud
 
     ros::Publisher dynamic_filter_msg_pub;
+    ros::Publisher ready_pub;
     ros::NodeHandle n_;
     int counter;
     squirrel_dynamic_filter_msgs::CloudMsg cloud_msg;
@@ -75,6 +86,61 @@ class tfPointCloud
     tf::TransformBroadcaster br;
     tf::Transform transform_map_base_link;
     ofstream time_write;
+    ///Region of interest: with a positive roi_min_points only the connected
+    //regions (points closer than roi_cluster_radius) of at least that many
+    //points not explained by the map go to the dynamic filter, the points of
+    //the smaller ones are labelled static
+    int roi_min_points;
+    float roi_cluster_radius;
+    ///with in_process_classification the points are classified by a
+    //ClassifyStatic of this process instead of the classify_static service,
+    //with async_classification on its thread: the frames wait in
+    //pending_frames, keyed by their id, and are published in order
+    bool in_process_classification;
+    bool async_classification;
+    struct PendingFrame
+    {
+      Vector7d odometry;
+      PointCloud::Ptr static_cloud;
+      PointCloud::Ptr dynamic_cloud;
+      PointCloud::Ptr ground;
+      PointCloud::ConstPtr not_ground;
+      measure_time start;
+      bool ready;
+    };
+    std::map <int,PendingFrame> pending_frames;
+    std::mutex pending_mutex;
+    ///after the frames, its thread is joined before they are destroyed
+    boost::shared_ptr<ClassifyStatic> classify_static;
+
+    void filterRegions(PointCloud::Ptr &dynamic_cloud,PointCloud &static_cloud)
+    {
+      VoxelGridIndex grid;
+      grid.setInputCloud(dynamic_cloud,roi_cluster_radius);
+      std::vector <char> visited(dynamic_cloud->points.size(),0);
+      std::vector <int> region;
+      PointCloud::Ptr roi_cloud(new PointCloud);
+      for(size_t i = 0; i < dynamic_cloud->points.size(); ++i)
+      {
+        if(visited[i])
+          continue;
+        region.assign(1,i);
+        visited[i] = 1;
+        for(size_t j = 0; j < region.size(); ++j)
+          grid.radiusSearch(dynamic_cloud->points[region[j]],roi_cluster_radius,[&](int index,float)
+          {
+            if(!visited[index])
+            {
+              visited[index] = 1;
+              region.push_back(index);
+            }
+          });
+        PointCloud &target = region.size() >= static_cast<size_t>(roi_min_points) ? *roi_cloud : static_cloud;
+        for(auto &index:region)
+          target.points.push_back(dynamic_cloud->points[index]);
+      }
+      dynamic_cloud = roi_cloud;
+    }
 
   public:
     tfPointCloud():counter(0)
@@ -88,8 +154,15 @@ class tfPointCloud
       n_.getParam("StaticFrontThreshold",static_front_threshold);
       n_.getParam("Verbose",is_verbose);
       n_.getParam("StoreResults",store_results);
+      n_.param("RoiMinPoints",roi_min_points,0);
+      n_.param("RoiClusterRadius",roi_cluster_radius,0.05f);
+      n_.param("InProcessClassification",in_process_classification,false);
+      n_.param("AsyncClassification",async_classification,false);
+      if(in_process_classification)
+        classify_static.reset(new ClassifyStatic(n_,ros::NodeHandle("~static_classify"),false));
       pub = n_.advertise<sensor_msgs::PointCloud2>("/kinect/depth/static_final/",10);//Publising the filtered pointcloud
       dynamic_filter_msg_pub = n_.advertise<squirrel_dynamic_filter_msgs::DynamicFilterMsg>("/squirrel/dynamic_filter_msg",10);//Publising the filtered pointcloud
+      ready_pub = n_.advertise<std_msgs::Int32>("/squirrel/dynamic_filter_ready",10);
       cloud_sub = n_.subscribe("/squirrel/cloud_msg", 100, &tfPointCloud::msgCallback, this);
           ///subscribing to the message sent by l_frequency
       dynamic_srv.request.odometry.resize(7);
@@ -111,46 +184,109 @@ class tfPointCloud
 
           ////The input cloud goes through a preprocessing step which involves
           //estimatimg the static points and potentially dynamic points
+       PendingFrame frame;
+       frame.static_cloud.reset(new PointCloud);///Static
+       frame.dynamic_cloud.reset(new PointCloud);///dynamic
+       frame.ground.reset(new PointCloud);///ground and far away points
+       frame.ready = true;
        PointCloud::Ptr cloud_processed(new PointCloud);
-       PointCloud::Ptr static_cloud(new PointCloud);///Static
-       PointCloud::Ptr dynamic_cloud(new PointCloud);///dynamic
-       PointCloud::Ptr ground(new PointCloud);///ground and far away points
        PointCloud::Ptr not_ground(new PointCloud);///not ground
        std::vector <int> ground_indices;// indices from cloud_processed
        std::vector <int> non_ground_indices;//indices from cloud_processed
        preprocessing(sensor_msg.cloud_msg,cloud_processed,ground_indices,non_ground_indices);//remove ground and far away points
 
-       pcl::copyPointCloud(*cloud_processed,ground_indices,*ground);//ground
-
-       pcl::toROSMsg(*ground,dynamic_filter_msg.ground_cloud);
+       pcl::copyPointCloud(*cloud_processed,ground_indices,*frame.ground);//ground
 
        pcl::copyPointCloud(*cloud_processed,non_ground_indices,*not_ground);//non-ground
        not_ground->width = not_ground->points.size();
        not_ground->height = 1;
+       frame.not_ground = not_ground;
+       for(int i = 0; i < 7; ++i)
+         frame.odometry[i] = sensor_msg.odometry[i];
+       frame.start = SystemClock::now();
+       const int frame_id = counter;
+       counter+=1;
        //cerr << not_ground->width << "," << ground->points.size() << endl;
        //
-       ///call the service to get points which do not belong to the current map
-
-       pcl::toROSMsg(*not_ground,classify_static_srv.request.cloud);
-       classify_static_srv.request.odometry.resize(7);
-       classify_static_srv.request.odometry[0] = sensor_msg.odometry[0];
-       classify_static_srv.request.odometry[1] = sensor_msg.odometry[1];
-       classify_static_srv.request.odometry[2] = sensor_msg.odometry[2];
-       classify_static_srv.request.odometry[3] = sensor_msg.odometry[3];
-       classify_static_srv.request.odometry[4] = sensor_msg.odometry[4];
-       classify_static_srv.request.odometry[5] = sensor_msg.odometry[5];
-       classify_static_srv.request.odometry[6] = sensor_msg.odometry[6];
-       measure_time start = SystemClock::now();
-//       fprintf(stderr,"calling ther service\n");
-
+       ///get the points which do not belong to the current map, from the
+       //service or in process
        if(not_ground->points.size() > 50)
        {
-         if(classify_static_client.call(classify_static_srv))
-          {
-           pcl::copyPointCloud(*not_ground,classify_static_srv.response.static_points,*static_cloud);///to be used for localization
-           pcl::copyPointCloud(*not_ground,classify_static_srv.response.unclassified_points,*dynamic_cloud);
+         if(classify_static && async_classification)
+         {
+           frame.ready = false;
+           {
+             std::lock_guard<std::mutex> lock(pending_mutex);
+             pending_frames[frame_id] = frame;
+           }
+           classify_static->classifyAsync(frame_id,not_ground,frame.odometry,boost::bind(&tfPointCloud::classificationCallback,this,_1));
+           return;
+         }
+         else if(classify_static)
+         {
+           std::vector <int> static_points;
+           std::vector <int> unclassified_points;
+           if(classify_static->classify(*not_ground,frame.odometry,static_points,unclassified_points))
+           {
+             pcl::copyPointCloud(*not_ground,static_points,*frame.static_cloud);///to be used for localization
+             pcl::copyPointCloud(*not_ground,unclassified_points,*frame.dynamic_cloud);
+           }
+         }
+         else
+         {
+           pcl::toROSMsg(*not_ground,classify_static_srv.request.cloud);
+           classify_static_srv.request.odometry.resize(7);
+           for(int i = 0; i < 7; ++i)
+             classify_static_srv.request.odometry[i] = sensor_msg.odometry[i];
+//       fprintf(stderr,"calling ther service\n");
+           if(classify_static_client.call(classify_static_srv))
+           {
+             pcl::copyPointCloud(*not_ground,classify_static_srv.response.static_points,*frame.static_cloud);///to be used for localization
+             pcl::copyPointCloud(*not_ground,classify_static_srv.response.unclassified_points,*frame.dynamic_cloud);
+           }
          }
        }
+       std::lock_guard<std::mutex> lock(pending_mutex);
+       pending_frames[frame_id] = frame;
+       publishFrames();
+    }
+
+    ///result of an asynchronous classification, from the thread of the
+    //classifier
+    void classificationCallback(const ClassifyStatic::Result &result)
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex);
+      auto it = pending_frames.find(result.frame_id);
+      if(it == pending_frames.end())
+        return;
+      if(result.success)
+      {
+        pcl::copyPointCloud(*result.cloud,result.static_points,*it->second.static_cloud);///to be used for localization
+        pcl::copyPointCloud(*result.cloud,result.unclassified_points,*it->second.dynamic_cloud);
+      }
+      it->second.ready = true;
+      publishFrames();
+    }
+
+    ///publishes the classified frames in order, called with pending_mutex
+    //held
+    void publishFrames()
+    {
+      while(!pending_frames.empty() && pending_frames.begin()->second.ready)
+      {
+        publishFrame(pending_frames.begin()->first,pending_frames.begin()->second);
+        pending_frames.erase(pending_frames.begin());
+      }
+    }
+
+    void publishFrame(const int frame_id,PendingFrame &frame)
+    {
+       PointCloud::Ptr &static_cloud = frame.static_cloud;
+       PointCloud::Ptr &dynamic_cloud = frame.dynamic_cloud;
+       PointCloud::Ptr &ground = frame.ground;
+       const PointCloud::ConstPtr &not_ground = frame.not_ground;
+       if(roi_min_points > 0 && !dynamic_cloud->points.empty())
+         filterRegions(dynamic_cloud,*static_cloud);
 
   //     fprintf(stderr,"outside service\n");
        static_cloud->width = static_cloud->points.size();
@@ -164,9 +300,7 @@ class tfPointCloud
        ground->width = ground->points.size();
        ground->height = 1;
 
-
-       not_ground->width = not_ground->points.size();
-       not_ground->height = 1;
+       pcl::toROSMsg(*ground,dynamic_filter_msg.ground_cloud);
 
       pcl::PCDWriter writer;
 
@@ -174,22 +308,22 @@ class tfPointCloud
        if(store_results)
        {
          ss.str("");
-         ss << output_folder << "static_cloud_" << counter << ".pcd";
+         ss << output_folder << "static_cloud_" << frame_id << ".pcd";
 
          if(!static_cloud->points.empty())
            writer.write(ss.str(),*static_cloud,true);
          ss.str("");
-         ss << output_folder << "dynamic_cloud_" << counter << ".pcd";
+         ss << output_folder << "dynamic_cloud_" << frame_id << ".pcd";
 
          if(!dynamic_cloud->points.empty())
            writer.write(ss.str(),*dynamic_cloud,true);
          ss.str("");
-         ss << output_folder << "ground_" << counter << ".pcd";
+         ss << output_folder << "ground_" << frame_id << ".pcd";
 
          if(!ground->points.empty())
            writer.write(ss.str(),*ground,true);
          ss.str("");
-         ss << output_folder << "not_ground_" << counter << ".pcd";
+         ss << output_folder << "not_ground_" << frame_id << ".pcd";
 
          if(!not_ground->points.empty())
            writer.write(ss.str(),*not_ground,true);
@@ -197,32 +331,25 @@ class tfPointCloud
 
 
        measure_time end = SystemClock::now();
-       TimeDiff time_diff = end - start;
+       TimeDiff time_diff = end - frame.start;
        double correspondence_time = time_diff.count();
        time_write << correspondence_time << endl;
 
        //std::cerr << dynamic_cloud->points.size() << endl;
 ///send msg for classifying points as static or dynamic
        pcl::toROSMsg(*dynamic_cloud,dynamic_filter_msg.cloud);
-       dynamic_filter_msg.odometry[0] = sensor_msg.odometry[0];
-       dynamic_filter_msg.odometry[1] = sensor_msg.odometry[1];
-       dynamic_filter_msg.odometry[2] = sensor_msg.odometry[2];
-       dynamic_filter_msg.odometry[3] = sensor_msg.odometry[3];
-       dynamic_filter_msg.odometry[4] = sensor_msg.odometry[4];
-       dynamic_filter_msg.odometry[5] = sensor_msg.odometry[5];
-       dynamic_filter_msg.odometry[6] = sensor_msg.odometry[6];
-       dynamic_filter_msg.frame_id = counter;
+       for(int i = 0; i < 7; ++i)
+         dynamic_filter_msg.odometry[i] = frame.odometry[i];
+       dynamic_filter_msg.frame_id = frame_id;
        if(dynamic_cloud->points.size() > 50)
          dynamic_filter_msg_pub.publish(dynamic_filter_msg);
-//       else
- //       {
-
-
-   //     }
-       counter+=1;
-
-
-
+       else
+       {
+         ///the dynamic filter does not get the frame, ready for the next one
+         std_msgs::Int32 ready;
+         ready.data = frame_id;
+         ready_pub.publish(ready);
+       }
 
        //fprintf(stderr,"%d\n",counter);
 
@@ -235,39 +362,10 @@ class tfPointCloud
         std::stringstream ss;
         ss.str("");
         ss << input_folder << "/params/sensor_to_base_link.csv";
-        ifstream myfile(ss.str().c_str());
-        std::string line;
+        std::vector <Vector7d> poses;
         Isometry3D sensor_to_base_link_trans;
-        if (myfile.is_open())
-        {
-          Vector7d trans;
-          while (getline (myfile,line))
-          {
-            for(int i = 0 ; i<7;i++)
-            {
-
-              std::size_t found = line.find(",");
-              if(i==0)
-                trans[0] = atof(line.substr(0,found).c_str());
-              if(i==1)
-                trans[1] = atof(line.substr(0,found).c_str());
-              if(i==2)
-                trans[2] = atof(line.substr(0,found).c_str());
-              if(i==3)
-                trans[3] = atof(line.substr(0,found).c_str());
-              if(i==4)
-                trans[4] = atof(line.substr(0,found).c_str());
-              if(i==5)
-                trans[5] = atof(line.substr(0,found).c_str());
-              if(i==6)
-                trans[6] = atof(line.substr(0,found).c_str());
-              string line_new=line.substr(found+1);
-              line=line_new;
-            }
-          }
-          sensor_to_base_link_trans = g2o::internal::fromVectorQT(trans);
-        }
-        myfile.close();
+        if (LoadPoses(ss.str(),poses) && !poses.empty())
+          sensor_to_base_link_trans = g2o::internal::fromVectorQT(poses.back());
         sensor_base_link_trans(0,0) = sensor_to_base_link_trans(0,0);
         sensor_base_link_trans(0,1) = sensor_to_base_link_trans(0,1);
         sensor_base_link_trans(0,2) = sensor_to_base_link_trans(0,2);
@@ -287,20 +385,20 @@ class tfPointCloud
 
         load_transform = true;
       }
-      PointCloud cloud;
-      pcl::fromROSMsg(cloud_msg,cloud);
-      PointCloud cloud_nan;
-      PointCloud cloud_trans;
-      for (auto &point:cloud.points)
+      ///removes infinite points, reading the message once
+      squirrel_point_buffer::PointBuffer points;
+      const squirrel_point_buffer::PointCloud2View view(cloud_msg);
+      if(!points.assign(view))
       {
-        if(pcl_isfinite(point.x))
-          cloud_nan.points.push_back(point);
+        PointCloud cloud;
+        pcl::fromROSMsg(cloud_msg,cloud);
+        squirrel_point_buffer::fromPCL(cloud,&points);
       }
 
-    ///removes infinite points
  ///transforming the scan to base_link. z is now upward and x goes forward. All
  //the ground points and far away points are assumned to be static
-      pcl::transformPointCloud(cloud_nan,*cloud_processed,sensor_base_link_trans);
+      squirrel_point_buffer::transform(Eigen::Affine3f(sensor_base_link_trans),&points);
+      squirrel_point_buffer::toPCL(points,cloud_processed.get());
       std::vector <bool> is_ground(cloud_processed->points.size(),false);
       std::vector <int> indices;
       std::vector <int> indices_ground;
@@ -20,6 +20,8 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 #include "datatypes_squirrel.h"
+#include "PoseIO.h"
+#include "FrameLog.h"
 #include <pcl/visualization/pcl_visualizer.h>
 
 bool close_viewer;
@@ -53,64 +55,38 @@ int main(int argc, char** argv)
 
  ifstream myfile;
  boost::shared_ptr<pcl::visualization::PCLVisualizer> viewer(new pcl::visualization::PCLVisualizer ("3D Viewer"));
-	std::vector < std::vector<float> > motion_trans;
+	std::vector < Eigen::Matrix<double,7,1> > motion_trans;
 
  ss.str("");
 
  ss << folder << "/odometry.csv";
 
   string line;
-	myfile.open(ss.str());
-	if (myfile.is_open())
- {
-  while ( getline (myfile,line) )
-			{
-    std::vector<float>trans(7,0.0);
-
-				for(int i = 0 ; i<7;i++)
-				{
-
-					std::size_t found = line.find(",");
-					if(i==0)
-						trans[0] = atof(line.substr(0,found).c_str());
-					if(i==1)
-						trans[1] = atof(line.substr(0,found).c_str());
-					if(i==2)
-						trans[2] = atof(line.substr(0,found).c_str());
-					if(i==3)
-						trans[3] = atof(line.substr(0,found).c_str());
-					if(i==4)
-						trans[4] = atof(line.substr(0,found).c_str());
-					if(i==5)
-						trans[5] = atof(line.substr(0,found).c_str());
-					if(i==6)
-						trans[6] = atof(line.substr(0,found).c_str());
-					string line_new=line.substr(found+1);
-					line=line_new;
-
-
-
-
-
-				}
-
-				motion_trans.push_back(trans);
+ LoadPoses(ss.str(),motion_trans);
 
 
-
-			}
- }
-	myfile.close();
-
+///the points and their scores come from the log of the run if there is one
+ FrameLogReader frame_log;
+ frame_log.open(folder + "frames.dflog");
+ FrameRecord record;
 
  for(size_t i = start_frame; i < end_frame; ++i)
  {
   cloud->points.clear();
   cout << i << endl;
-  ss.str("");
-  ss << folder << "cloud_save_robust_a_" << i << ".pcd";
-
-  reader.read(ss.str(),*cloud);
+  const bool from_log = frame_log.read(i,record);
+  if(from_log)
+  {
+   ToCloud(record.saved_points,*cloud);
+   for(size_t k = 0; k < cloud->points.size() && k < record.scores.size(); ++k)
+    cloud->points[k].intensity = record.scores[k];
+  }
+  else
+  {
+   ss.str("");
+   ss << folder << "cloud_save_robust_a_" << i << ".pcd";
+   reader.read(ss.str(),*cloud);
+  }
   ss.str("");
   ss << folder << "ground_" << i << ".pcd";
 
@@ -119,9 +95,10 @@ int main(int argc, char** argv)
   ss.str("");
   ss << folder << "intensity_z_" << i << ".csv";
 
-  myfile.open(ss.str().c_str());
+  if(!from_log)
+   myfile.open(ss.str().c_str());
   int counter = 0;
-  if (myfile.is_open())
+  if (!from_log && myfile.is_open())
   {
    while ( getline (myfile,line) )
    {
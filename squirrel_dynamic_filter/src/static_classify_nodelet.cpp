@@ -0,0 +1,50 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "static_classify.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <boost/shared_ptr.hpp>
+
+namespace squirrel_dynamic_filter
+{
+
+// serves classify_static in a nodelet manager, the map is received by a
+// multithreaded handle so that it arrives while a request waits for it
+class ClassifyStaticNodelet : public nodelet::Nodelet
+{
+  public:
+    virtual void onInit()
+    {
+      NODELET_DEBUG("Initializing static classification nodelet ...");
+      classify_.reset(new ClassifyStatic(getMTNodeHandle(),getPrivateNodeHandle()));
+    }
+  private:
+    boost::shared_ptr<ClassifyStatic> classify_;
+};
+
+} // namespace
+
+PLUGINLIB_EXPORT_CLASS(squirrel_dynamic_filter::ClassifyStaticNodelet, nodelet::Nodelet);
@@ -0,0 +1,147 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include "datatypes_squirrel.h"
+#include "FeatureSHOT.h"
+#include "FeatureMatching.h"
+#include "DescriptorProjection.h"
+#include <pcl/io/pcd_io.h>
+#include <pcl/keypoints/uniform_sampling.h>
+#include <Eigen/Eigenvalues>
+#include <cstdlib>
+#include <limits>
+
+///Trains the DescriptorProjection of the dynamic filter from recorded clouds:
+//the SHOT descriptors of the clouds are computed as in EstimateFeature, and
+//the projection keeps their first principal components. Reports the variance
+//kept, the memory per descriptor and how often the nearest neighbour of a
+//descriptor is the same in the reduced space.
+//
+//usage: train_descriptor_projection output dimension normal_radius
+//       feature_radius sampling_radius cloud.pcd [cloud.pcd ...]
+
+using namespace std;
+int main(int argc,char **argv)
+{
+ if(argc < 7)
+ {
+  cerr << "usage: " << argv[0] << " output dimension normal_radius feature_radius sampling_radius cloud.pcd [cloud.pcd ...]" << endl;
+  return 1;
+ }
+ const int size = DescriptorProjection::descriptor_size;
+ const int dim = atoi(argv[2]);
+ const float normal_radius = atof(argv[3]);
+ const float feature_radius = atof(argv[4]);
+ const float sampling_radius = atof(argv[5]);
+ if(dim <= 0 || dim > size)
+ {
+  cerr << "the dimension must be in (0," << size << "]" << endl;
+  return 1;
+ }
+
+ std::vector <float> descriptors;
+ pcl::PCDReader reader;
+ FeatureEstimationSHOT FeatureEstimate;
+ for(int i = 6; i < argc; ++i)
+ {
+  PointCloud::Ptr cloud(new PointCloud);
+  if(reader.read(argv[i],*cloud) < 0)
+   continue;
+  pcl::PointCloud <int> sampled_indices;
+  pcl::UniformSampling <Point> uniform_sampling;
+  uniform_sampling.setInputCloud (cloud);
+  uniform_sampling.setRadiusSearch (sampling_radius);
+  uniform_sampling.compute (sampled_indices);
+  PointCloud::Ptr sampled(new PointCloud);
+  pcl::copyPointCloud(*cloud,sampled_indices.points,*sampled);
+
+  SHOTCloud::Ptr feature(new SHOTCloud);
+  std::vector <int> finite_points;
+  FeatureEstimate.estimateFeature(sampled,cloud,normal_radius,feature_radius,feature,finite_points);
+  for(auto &j:finite_points)
+   descriptors.insert(descriptors.end(),feature->points[j].descriptor,feature->points[j].descriptor + size);
+  cout << argv[i] << ": " << finite_points.size() << " descriptors" << endl;
+ }
+ const size_t n = descriptors.size() / size;
+ if(n < 2)
+ {
+  cerr << "not enough descriptors" << endl;
+  return 1;
+ }
+
+///principal components
+ Eigen::Map <const Eigen::Matrix<float,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor> > data(descriptors.data(),n,size);
+ Eigen::VectorXd mean = data.cast<double>().colwise().mean().transpose();
+ Eigen::MatrixXd centered = data.cast<double>().rowwise() - mean.transpose();
+ Eigen::MatrixXd covariance = centered.transpose() * centered / double(n - 1);
+ Eigen::SelfAdjointEigenSolver <Eigen::MatrixXd> solver(covariance);
+ std::vector <float> mean_out(mean.data(),mean.data() + size);
+ std::vector <float> components(dim * size);
+ double kept = 0.0;
+ for(int r = 0; r < dim; ++r)
+ {
+  const int column = size - 1 - r;///eigenvalues are increasing
+  kept += solver.eigenvalues()[column];
+  for(int c = 0; c < size; ++c)
+   components[r * size + c] = solver.eigenvectors()(c,column);
+ }
+ DescriptorProjection projection;
+ projection.set(mean_out,components);
+ if(!projection.save(argv[1]))
+ {
+  cerr << "cannot write " << argv[1] << endl;
+  return 1;
+ }
+
+///accuracy on a subset of the descriptors: nearest neighbour among the others
+//in both spaces
+ const size_t num_query = std::min<size_t>(n,500);
+ const size_t num_target = std::min<size_t>(n,5000);
+ std::vector <float> reduced(n * dim);
+ for(size_t i = 0; i < n; ++i)
+  projection.project(&descriptors[i * size],&reduced[i * dim]);
+ size_t same_neighbour = 0;
+ double distance_error = 0.0;
+ for(size_t q = 0; q < num_query; ++q)
+ {
+  const size_t query = q * (n / num_query);
+  size_t best_full = 0,best_reduced = 0;
+  float min_full = std::numeric_limits<float>::max(),min_reduced = min_full;
+  for(size_t t = 0; t < num_target; ++t)
+  {
+   const size_t target = t * (n / num_target);
+   if(target == query)
+    continue;
+   const float d_full = SquaredDistanceSHOT(&descriptors[query * size],&descriptors[target * size]);
+   const float d_reduced = SquaredDistance(&reduced[query * dim],&reduced[target * dim],dim);
+   distance_error += d_full - d_reduced;
+   if(d_full < min_full) { min_full = d_full; best_full = target; }
+   if(d_reduced < min_reduced) { min_reduced = d_reduced; best_reduced = target; }
+  }
+  same_neighbour += best_full == best_reduced;
+ }
+ cout << "descriptors: " << n << endl;
+ cout << "variance kept: " << kept / covariance.trace() << endl;
+ cout << "bytes per descriptor: " << size * sizeof(float) << " -> " << dim * sizeof(float) << endl;
+ cout << "same nearest neighbour: " << double(same_neighbour) / num_query << endl;
+ cout << "mean squared distance lost: " << distance_error / (num_query * (num_target - 1)) << endl;
+ return 0;
+}
@@ -0,0 +1,116 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016-2017 Ayush Dewan and Wolfram Burgard
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include "edge.h"
+#include "edge_unary.h"
+#include "g2o/core/jacobian_workspace.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+using namespace g2o;
+
+namespace {
+
+// The closed form jacobians are compared with the numeric ones of g2o, as
+// the test_slam3d_jacobian of g2o does for its own edges.
+const double kMaxDifference = 1e-6;
+const int kNumPoses         = 100;
+
+Isometry3D randomIsometry3d() {
+  Vector3D rot_axis_angle = Vector3D::Random();
+  rot_axis_angle += Vector3D::Random();
+  Eigen::AngleAxisd rotation(
+      rot_axis_angle.norm(), rot_axis_angle.normalized());
+  Isometry3D result    = (Isometry3D)rotation.toRotationMatrix();
+  result.translation() = Vector3D::Random();
+  return result;
+}
+
+void expectSameJacobians(
+    JacobianWorkspace& analytic, JacobianWorkspace& numeric, int num_vertices,
+    int size) {
+  for (int i = 0; i < num_vertices; ++i) {
+    const double* a = analytic.workspaceForVertex(i);
+    const double* n = numeric.workspaceForVertex(i);
+    for (int j = 0; j < size; ++j)
+      EXPECT_NEAR(a[j], n[j], kMaxDifference)
+          << "vertex " << i << ", entry " << j;
+  }
+}
+
+}  // namespace
+
+TEST(EdgeJacobians, EdgeICPMatchesNumericDifferentiation) {
+  std::srand(0);
+  VertexSE3_Vector3D v;
+  v.setId(0);
+  EdgeICP e;
+  e.setVertex(0, &v);
+  e.setInformation(EdgeICP::InformationType::Identity());
+  JacobianWorkspace analytic, numeric;
+  numeric.updateSize(&e);
+  numeric.allocate();
+  for (int k = 0; k < kNumPoses; ++k) {
+    v.setEstimate(randomIsometry3d());
+    v.setPosition(Vector3D::Random());
+    e.setMeasurement(Vector3D::Random());
+    // The closed form jacobian, written into the numeric workspace.
+    e.BaseUnaryEdge<3, Vector3D, VertexSE3_Vector3D>::linearizeOplus(numeric);
+    analytic = numeric;
+    // The numeric jacobian, into the same workspace.
+    e.BaseUnaryEdge<3, Vector3D, VertexSE3_Vector3D>::linearizeOplus();
+    expectSameJacobians(analytic, numeric, 1, 3 * 6);
+  }
+}
+
+TEST(EdgeJacobians, EdgeMatchesNumericDifferentiation) {
+  std::srand(0);
+  VertexSE3_Vector3D v1, v2;
+  v1.setId(0);
+  v2.setId(1);
+  Edge e;
+  e.setVertex(0, &v1);
+  e.setVertex(1, &v2);
+  e.setInformation(Edge::InformationType::Identity());
+  JacobianWorkspace analytic, numeric;
+  numeric.updateSize(&e);
+  numeric.allocate();
+  typedef BaseBinaryEdge<6, Isometry3D, VertexSE3_Vector3D, VertexSE3_Vector3D>
+      BinaryEdgeType;
+  for (int k = 0; k < kNumPoses; ++k) {
+    v1.setEstimate(randomIsometry3d());
+    v2.setEstimate(randomIsometry3d());
+    e.setMeasurement(randomIsometry3d());
+    e.BinaryEdgeType::linearizeOplus(numeric);
+    analytic = numeric;
+    e.BinaryEdgeType::linearizeOplus();
+    expectSameJacobians(analytic, numeric, 2, 6 * 6);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
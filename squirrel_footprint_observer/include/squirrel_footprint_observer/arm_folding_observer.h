@@ -19,11 +19,16 @@
 #include <sensor_msgs/JointState.h>
 
 #include <ros/init.h>
+#include <ros/publisher.h>
+#include <ros/service_client.h>
 #include <ros/subscriber.h>
 #include <ros/node_handle.h>
 
-#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace squirrel_footprint_observer {
@@ -35,10 +40,12 @@ constexpr double kJointValueTolerance = 1e-1;
 
 class ArmFoldingObserver {
  public:
-  ArmFoldingObserver() : joint_index_map_(nullptr) {}
-  virtual ~ArmFoldingObserver() {}
+  ArmFoldingObserver();
+  virtual ~ArmFoldingObserver();
 
   void initialize(const std::string& name = "");
+  // Parameters in the namespace name of the handle.
+  void initialize(const ros::NodeHandle& pnh, const std::string& name);
   
   inline bool folded() const { return !plan_with_footprint_; }
 
@@ -50,20 +57,53 @@ class ArmFoldingObserver {
   void jointStatesCallback(
       const sensor_msgs::JointState::ConstPtr& joint_state);
 
-  void toggleFootprintPlanner(bool on_off) const;
+  // Publish the new state and queue it for the reconfigure thread, so that
+  // the joint states are never blocked by the service.
+  void toggleFootprintPlanner(bool on_off);
+  void reconfigureLoop();
+  bool callReconfigure(bool on_off);
+  // Map the reference joints to the indices of the message, again only if
+  // the names of the message change.
+  bool jointIndexMapValid(
+      const std::vector<std::string>& joint_msg_names) const;
   void buildJointIndexMap(const std::vector<std::string>& joint_msg_names);
   
  private:
+  struct ReferenceJoint {
+    std::string name;
+    double value, tolerance;
+  };
+  struct MappedJoint {
+    int index;
+    double value, tolerance;
+  };
+
   bool verbose_;
   std::string joint_states_topic_;
-  std::map<std::string, double> joints_values_;
-
-  bool plan_with_footprint_;
-  std::unique_ptr<std::map<std::string, int>> joint_index_map_;
-
-  std::map<std::string, bool> joints_exists_;
+  std::vector<ReferenceJoint> reference_joints_;
+  // The arm unfolds beyond the tolerance of a joint and folds back within
+  // the tolerances minus the hysteresis.
+  double joint_tolerance_, joint_hysteresis_;
+
+  std::atomic<bool> plan_with_footprint_;
+  bool state_published_;
+  // Published reference joints, with the index in the message and the
+  // reference joint they come from.
+  std::vector<MappedJoint> joint_index_map_;
+  std::vector<int> mapped_references_;
+  size_t joint_msg_size_;
 
   ros::Subscriber joint_states_sub_;
+  ros::Publisher plan_with_footprint_pub_;
+
+  // Persistent client of the reconfigure service of the global planner,
+  // called by the worker thread with the last requested value.
+  std::string reconfigure_service_;
+  ros::ServiceClient reconfigure_client_;
+  std::thread reconfigure_thread_;
+  std::mutex reconfigure_mtx_;
+  std::condition_variable reconfigure_cv_;
+  bool reconfigure_pending_, reconfigure_value_, stop_reconfigure_;
 
   ros::NodeHandle gnh_;
 };
@@ -0,0 +1,96 @@
+// Copyright (C) 2017  Federico Boniardi and Wolfram Burgard
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SQUIRREL_FOOTPRINT_OBSERVER_FOOTPRINT_LIBRARY_H_
+#define SQUIRREL_FOOTPRINT_OBSERVER_FOOTPRINT_LIBRARY_H_
+
+#include "squirrel_footprint_observer/footprint_utils.h"
+#include "squirrel_footprint_observer/geometry_types.h"
+
+#include <iterator>
+#include <limits>
+#include <vector>
+
+namespace squirrel_footprint_observer {
+
+// Canonical footprints the live hull is snapped to, so that the planners
+// see a few identical polygons and reuse what they precomputed for them.
+// A hull snaps to the closest footprint that contains it and is within the
+// threshold in Hausdorff distance, otherwise it is added to the library
+// while there is room for it. The library may start from predefined
+// footprints, e.g. one per arm configuration.
+class FootprintLibrary {
+ public:
+  FootprintLibrary() : threshold_(0.), max_size_(0) {}
+
+  void initialize(
+      const std::vector<std::vector<Point2D>>& footprints, double threshold,
+      int max_size) {
+    footprints_.clear();
+    threshold_ = threshold;
+    max_size_  = max_size;
+    for (const auto& footprint : footprints) {
+      std::vector<Point2D> hull;
+      CGAL::convex_hull_2(
+          footprint.begin(), footprint.end(), std::back_inserter(hull));
+      if (hull.size() >= 3)
+        footprints_.emplace_back(hull);
+    }
+  }
+
+  inline bool enabled() const { return threshold_ > 0.; }
+  inline int size() const { return footprints_.size(); }
+  inline const std::vector<Point2D>& footprint(int id) const {
+    return footprints_[id];
+  }
+
+  // Identifier of the canonical footprint of the hull, -1 if the library is
+  // full and none is close enough.
+  int snap(const std::vector<Point2D>& hull) {
+    constexpr double kContainmentTolerance = 1e-6;
+    int id           = -1;
+    double best_dist = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < size(); ++i) {
+      const auto& footprint = footprints_[i];
+      bool contained        = true;
+      for (const auto& point : hull)
+        if (signedDistance(footprint, point) < -kContainmentTolerance) {
+          contained = false;
+          break;
+        }
+      if (!contained)
+        continue;
+      const double dist = hausdorffDistance(hull, footprint);
+      if (dist <= threshold_ && dist < best_dist) {
+        id        = i;
+        best_dist = dist;
+      }
+    }
+    if (id < 0 && size() < max_size_ && hull.size() >= 3) {
+      footprints_.emplace_back(hull);
+      id = size() - 1;
+    }
+    return id;
+  }
+
+ private:
+  std::vector<std::vector<Point2D>> footprints_;
+  double threshold_;
+  int max_size_;
+};
+
+}  // namespace squirrel_footprint_observer
+
+#endif /* SQUIRREL_FOOTPRINT_OBSERVER_FOOTPRINT_LIBRARY_H_ */
@@ -18,6 +18,7 @@
 
 #include "squirrel_footprint_observer/FootprintObserverConfig.h"
 #include "squirrel_footprint_observer/arm_folding_observer.h"
+#include "squirrel_footprint_observer/footprint_library.h"
 #include "squirrel_footprint_observer/geometry_types.h"
 
 #include <ros/ros.h>
@@ -32,6 +33,7 @@
 #include <squirrel_footprint_observer_msgs/dump_footprint.h>
 #include <squirrel_footprint_observer_msgs/get_footprint.h>
 #include <std_msgs/Bool.h>
+#include <std_msgs/Int32.h>
 #include <visualization_msgs/Marker.h>
 
 #include <memory>
@@ -43,11 +45,16 @@ namespace squirrel_footprint_observer {
 class FootprintObserver {
 public:
   FootprintObserver();
+  // Constructor for the nodelet, which provides its own handle.
+  explicit FootprintObserver(ros::NodeHandle pnh);
   virtual ~FootprintObserver() {}
 
   // Spinner.
   void spin(double hz = 10.);
 
+  // Update and publish the footprint once, the step of the spinner.
+  void update();
+
 private:
   // Reconfigure utilities.
   void reconfigureCallback(FootprintObserverConfig& config, uint32_t level);
@@ -61,8 +68,13 @@ private:
       squirrel_footprint_observer_msgs::dump_footprint::Request &req,
       squirrel_footprint_observer_msgs::dump_footprint::Response &res);
 
-  // Update the footprint.
-  void updateFootprint(const ros::Time& stamp);
+  // Update the footprint from the last joint positions buffered by the
+  // listener, without waiting for the transforms. The hull is recomputed
+  // only if a joint has moved more than joint_position_tolerance.
+  void updateFootprint();
+  bool lookupJointPositions(std::vector<Vector2D>* joint_positions);
+  // Publish the footprint if it changed more than footprint_change_threshold
+  // from the last one published, in Hausdorff distance.
   void publishFootprint(const ros::Time& stamp);
   
   // Mutex getter.
@@ -71,17 +83,28 @@ private:
 private:
   std::unique_ptr<dynamic_reconfigure::Server<FootprintObserverConfig>> dsrv_;
   
-  std::vector<Point2D> base_footprint_;
+  std::vector<Point2D> base_footprint_, base_hull_;
   std::vector<Point2D> joint_footprint_;
+  double joint_radius_;
   std::vector<std::string> joint_chain_;
+  // Joint positions of the current footprint.
+  std::vector<Vector2D> joint_positions_;
+  double joint_position_tolerance_;
 
   bool enabled_;
 
   geometry_msgs::PolygonStamped footprint_;
+  std::vector<Point2D> hull_, published_hull_;
+  bool published_folded_;
+  double footprint_change_threshold_;
+  // The hull is snapped to the canonical footprints of the library, if
+  // enabled, and footprint_id_ is the one published.
+  FootprintLibrary library_;
+  int footprint_id_;
   
   std::unique_ptr<ArmFoldingObserver> arm_folding_observer_;
   
-  ros::Publisher footprint_pub_, footprint_marker_pub_;
+  ros::Publisher footprint_pub_, footprint_id_pub_, footprint_marker_pub_;
   ros::Subscriber enable_sub_;
   ros::ServiceServer footprint_get_srv_, footprint_dump_srv_;
   tf::TransformListener tfl_;
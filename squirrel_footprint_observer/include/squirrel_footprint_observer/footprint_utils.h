@@ -18,8 +18,10 @@
 
 #include "squirrel_footprint_observer/geometry_types.h"
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
+#include <limits>
 #include <vector>
 
 namespace squirrel_footprint_observer {
@@ -37,6 +39,51 @@ void approximatedCircle(double radius, std::vector<Point2D>* polygon) {
   }
 }
 
+// Signed distance of a point from the outline of a counterclockwise convex
+// polygon, positive inside.
+inline double signedDistance(
+    const std::vector<Point2D>& polygon, const Point2D& point) {
+  const int npoints = polygon.size();
+  if (npoints < 3)
+    return -std::numeric_limits<double>::infinity();
+  double inner = std::numeric_limits<double>::infinity();
+  double outer = std::numeric_limits<double>::infinity();
+  bool inside  = true;
+  for (int i = 0; i < npoints; ++i) {
+    const Point2D& a = polygon[i];
+    const Point2D& b = polygon[(i + 1) % npoints];
+    const double ex = b.x() - a.x(), ey = b.y() - a.y();
+    const double px = point.x() - a.x(), py = point.y() - a.y();
+    const double length = std::hypot(ex, ey);
+    if (length <= 0.)
+      continue;
+    // Distance from the line of the edge, and from the edge itself.
+    const double side = (ex * py - ey * px) / length;
+    const double t    = std::min(
+        1., std::max(0., (px * ex + py * ey) / (length * length)));
+    inside = inside && side >= 0.;
+    inner  = std::min(inner, side);
+    outer  = std::min(outer, std::hypot(px - t * ex, py - t * ey));
+  }
+  return inside ? inner : -outer;
+}
+
+// Hausdorff distance between two counterclockwise convex polygons as
+// regions: the largest distance of a vertex of one outside of the other.
+inline double hausdorffDistance(
+    const std::vector<Point2D>& a, const std::vector<Point2D>& b) {
+  if (a.size() < 3 || b.size() < 3)
+    return a.size() == b.size() && a.empty()
+               ? 0.
+               : std::numeric_limits<double>::infinity();
+  double distance = 0.;
+  for (const auto& point : a)
+    distance = std::max(distance, -signedDistance(b, point));
+  for (const auto& point : b)
+    distance = std::max(distance, -signedDistance(a, point));
+  return distance;
+}
+
 }  // namespace squirrel_footprint_observer
 
 #endif /* SQUIRREL_FOOTPRINT_OBSERVER_FOOTPRINT_UTILS_H_ */
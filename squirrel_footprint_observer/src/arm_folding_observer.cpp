@@ -21,22 +21,58 @@
 
 #include <ros/service.h>
 
+#include <std_msgs/Bool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iomanip>
+#include <limits>
 #include <stdexcept>
 #include <utility>
 
 namespace squirrel_footprint_observer {
 
+ArmFoldingObserver::ArmFoldingObserver()
+    : joint_tolerance_(kJointValueTolerance),
+      joint_hysteresis_(0.),
+      plan_with_footprint_(false),
+      state_published_(false),
+      joint_msg_size_(std::numeric_limits<size_t>::max()),
+      reconfigure_pending_(false),
+      reconfigure_value_(false),
+      stop_reconfigure_(false) {}
+
+ArmFoldingObserver::~ArmFoldingObserver() {
+  {
+    std::unique_lock<std::mutex> lock(reconfigure_mtx_);
+    stop_reconfigure_ = true;
+  }
+  reconfigure_cv_.notify_one();
+  if (reconfigure_thread_.joinable())
+    reconfigure_thread_.join();
+}
+
 void ArmFoldingObserver::initialize(const std::string &name) {
-  ros::NodeHandle nh("~/" + name);
+  initialize(ros::NodeHandle("~"), name);
+}
+
+void ArmFoldingObserver::initialize(
+    const ros::NodeHandle &pnh, const std::string &name) {
+  ros::NodeHandle nh(pnh, name);
 
   std::vector<std::string> joint_names;
-  std::vector<double> joint_values;
+  std::vector<double> joint_values, joint_tolerances;
 
   nh.param<bool>("verbose", verbose_, false);
   nh.param<std::string>("joint_states_topic", joint_states_topic_, "/states");
   nh.param<std::vector<std::string>>("joint_names", joint_names, {});
   nh.param<std::vector<double>>("ref_joint_states", joint_values, {});
+  nh.param<double>("joint_tolerance", joint_tolerance_, kJointValueTolerance);
+  nh.param<std::vector<double>>("joint_tolerances", joint_tolerances, {});
+  nh.param<double>("joint_hysteresis", joint_hysteresis_, 0.);
+  nh.param<std::string>("reconfigure_service", reconfigure_service_,
+                        "/move_base/GlobalPlanner/set_parameters");
 
   if (joint_names.size() != joint_values.size()) {
     ROS_ERROR_STREAM_NAMED(
@@ -45,9 +81,31 @@ void ArmFoldingObserver::initialize(const std::string &name) {
     ros::shutdown();
   }
 
+  if (!joint_tolerances.empty() &&
+      joint_tolerances.size() != joint_names.size()) {
+    ROS_ERROR_STREAM_NAMED(
+        "arm_folding_observer",
+        "'joint_names' and 'joint_tolerances' not of the same size.");
+    ros::shutdown();
+  }
+
   // Zip the vectors.
-  for (unsigned int i = 0; i < joint_names.size(); ++i)
-    joints_values_.emplace(joint_names[i], joint_values[i]);
+  const size_t njoints = std::min(joint_names.size(), joint_values.size());
+  for (unsigned int i = 0; i < njoints; ++i)
+    reference_joints_.push_back(
+        {joint_names[i], joint_values[i],
+         i < joint_tolerances.size() ? joint_tolerances[i] : joint_tolerance_});
+
+  // The state is read once, afterwards this observer is the one toggling it.
+  bool plan_with_footprint = false;
+  gnh_.param<bool>("/move_base/GlobalPlanner/plan_with_footprint",
+                   plan_with_footprint, false);
+  plan_with_footprint_ = plan_with_footprint;
+  plan_with_footprint_pub_ =
+      nh.advertise<std_msgs::Bool>("plan_with_footprint", 1, true);
+  if (!reconfigure_service_.empty())
+    reconfigure_thread_ =
+        std::thread(&ArmFoldingObserver::reconfigureLoop, this);
 
   // Subscribe to the joint states.
   joint_states_sub_ = gnh_.subscribe(
@@ -60,35 +118,88 @@ void ArmFoldingObserver::jointStatesCallback(
     ROS_INFO_STREAM_ONCE_NAMED("arm_folding_observer",
                                "Subscribed to '" << joint_states_topic_
                                                  << "'.");
-  if (!joint_index_map_)
+  if (!jointIndexMapValid(joint_state->name))
     buildJointIndexMap(joint_state->name);
 
-  gnh_.getParamCached("/move_base/GlobalPlanner/plan_with_footprint",
-                      plan_with_footprint_);
-
-  const auto &positions = joint_state->position;
+  const double *positions = joint_state->position.data();
+  const int npositions = joint_state->position.size();
 
-  bool plan_with_footprint = false;
-  for (const auto &joint_value : joints_values_) {
-    if (!joints_exists_[joint_value.first])
+  // Largest deviation beyond the tolerance from the folded configuration.
+  double max_excess = -std::numeric_limits<double>::infinity();
+  for (const MappedJoint &joint : joint_index_map_) {
+    if (joint.index >= npositions)
       continue;
+    max_excess = std::max(
+        max_excess,
+        std::abs(joint.value - positions[joint.index]) - joint.tolerance);
+  }
 
-    const std::string &joint_name = joint_value.first;
-    const double joint_ref_value = joint_value.second;
-    const int joint_index = joint_index_map_->at(joint_name);
-    const double joint_cur_value = positions[joint_index];
+  // Hysteresis, so that a joint at the tolerance does not toggle the planner.
+  bool plan_with_footprint = plan_with_footprint_;
+  if (!plan_with_footprint && max_excess > 0.)
+    plan_with_footprint = true;
+  else if (plan_with_footprint && max_excess <= -joint_hysteresis_)
+    plan_with_footprint = false;
 
-    if (std::abs(joint_ref_value - joint_cur_value) > kJointValueTolerance) {
-      plan_with_footprint = true;
-      break;
-    }
+  if (plan_with_footprint != plan_with_footprint_ || !state_published_)
+    toggleFootprintPlanner(plan_with_footprint);
+}
+
+void ArmFoldingObserver::toggleFootprintPlanner(bool on_off) {
+  plan_with_footprint_ = on_off;
+
+  std_msgs::Bool plan_with_footprint_msg;
+  plan_with_footprint_msg.data = on_off;
+  plan_with_footprint_pub_.publish(plan_with_footprint_msg);
+  state_published_ = true;
+
+  if (reconfigure_service_.empty())
+    return;
+  {
+    std::unique_lock<std::mutex> lock(reconfigure_mtx_);
+    reconfigure_pending_ = true;
+    reconfigure_value_ = on_off;
   }
+  reconfigure_cv_.notify_one();
+}
 
-  if (plan_with_footprint != plan_with_footprint_)
-    toggleFootprintPlanner(plan_with_footprint);
+void ArmFoldingObserver::reconfigureLoop() {
+  std::unique_lock<std::mutex> lock(reconfigure_mtx_);
+  while (true) {
+    reconfigure_cv_.wait(
+        lock, [this] { return stop_reconfigure_ || reconfigure_pending_; });
+    if (stop_reconfigure_)
+      return;
+    const bool on_off = reconfigure_value_;
+    reconfigure_pending_ = false;
+
+    lock.unlock();
+    const bool done = callReconfigure(on_off);
+    lock.lock();
+
+    // Retry later, unless a newer value has been requested meanwhile.
+    if (!done) {
+      reconfigure_cv_.wait_for(lock, std::chrono::seconds(1), [this] {
+        return stop_reconfigure_ || reconfigure_pending_;
+      });
+      if (!reconfigure_pending_) {
+        reconfigure_pending_ = true;
+        reconfigure_value_ = on_off;
+      }
+    }
+  }
 }
 
-void ArmFoldingObserver::toggleFootprintPlanner(bool on_off) const {
+bool ArmFoldingObserver::callReconfigure(bool on_off) {
+  // The persistent connection is dropped when the planner restarts.
+  if (!reconfigure_client_.isValid()) {
+    if (!ros::service::waitForService(reconfigure_service_,
+                                      ros::Duration(1.)))
+      return false;
+    reconfigure_client_ = gnh_.serviceClient<dynamic_reconfigure::Reconfigure>(
+        reconfigure_service_, true);
+  }
+
   dynamic_reconfigure::BoolParameter bool_param;
   bool_param.name = "plan_with_footprint";
   bool_param.value = on_off;
@@ -96,40 +207,54 @@ void ArmFoldingObserver::toggleFootprintPlanner(bool on_off) const {
   dynamic_reconfigure::Reconfigure reconfigure;
   reconfigure.request.config.bools.emplace_back(bool_param);
 
-  ros::service::waitForService("/move_base/GlobalPlanner/set_parameters");
-  
-  if (ros::service::call("/move_base/GlobalPlanner/set_parameters",
-                         reconfigure)) {
+  if (reconfigure_client_.call(reconfigure)) {
     ROS_INFO_STREAM_COND_NAMED(verbose_, "arm_folding_observer",
                                "Set 'plan_with_footprint' to " << std::boolalpha
                                                                << on_off);
-  } else {
-    ROS_WARN_STREAM_NAMED("arm_folding_observer",
-                          "Tried to set 'plan_with_footprint' to"
-                              << std::boolalpha << on_off
-                              << ". Didn't work...");
+    return true;
   }
+  ROS_WARN_STREAM_NAMED("arm_folding_observer",
+                        "Tried to set 'plan_with_footprint' to"
+                            << std::boolalpha << on_off
+                            << ". Didn't work...");
+  reconfigure_client_.shutdown();
+  return false;
+}
+
+bool ArmFoldingObserver::jointIndexMapValid(
+    const std::vector<std::string> &joint_msg_names) const {
+  // Publishers keep the order of the names, a few comparisons of short
+  // strings detect a different one.
+  if (joint_msg_names.size() != joint_msg_size_)
+    return false;
+  for (unsigned int i = 0; i < joint_index_map_.size(); ++i)
+    if (joint_msg_names[joint_index_map_[i].index] !=
+        reference_joints_[mapped_references_[i]].name)
+      return false;
+  return true;
 }
 
 void ArmFoldingObserver::buildJointIndexMap(
     const std::vector<std::string> &joint_msg_names) {
-  joint_index_map_.reset(new std::map<std::string, int>);
+  joint_index_map_.clear();
+  mapped_references_.clear();
+  joint_msg_size_ = joint_msg_names.size();
 
   const auto begin = joint_msg_names.begin();
   const auto end = joint_msg_names.end();
 
-  for (const auto &joint_value : joints_values_) {
-    const auto &joint_name = joint_value.first;
+  for (unsigned int i = 0; i < reference_joints_.size(); ++i) {
+    const ReferenceJoint &joint = reference_joints_[i];
 
-    auto it = std::find(begin, end, joint_name);
+    auto it = std::find(begin, end, joint.name);
 
     if (it == end) {
       ROS_WARN_STREAM_NAMED("arm_folding_observer",
-                            joint_name << "does not appear to be published.");
-      joints_exists_.emplace(joint_name, false);
+                            joint.name << " does not appear to be published.");
     } else {
-      joint_index_map_->emplace(joint_name, (int)std::distance(begin, it));
-      joints_exists_.emplace(joint_name, true);
+      joint_index_map_.push_back(
+          {(int)std::distance(begin, it), joint.value, joint.tolerance});
+      mapped_references_.push_back(i);
     }
   }
 }
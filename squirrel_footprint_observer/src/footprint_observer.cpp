@@ -29,11 +29,19 @@
 
 namespace squirrel_footprint_observer {
 
-FootprintObserver::FootprintObserver() : enabled_(true) {
-  const std::string& node_name = ros::this_node::getName();
+FootprintObserver::FootprintObserver()
+    : FootprintObserver(ros::NodeHandle("~")) {}
+
+FootprintObserver::FootprintObserver(ros::NodeHandle pnh)
+    : joint_radius_(0.),
+      joint_position_tolerance_(0.005),
+      enabled_(true),
+      published_folded_(true),
+      footprint_change_threshold_(0.01),
+      footprint_id_(-1) {
+  const std::string& node_name = pnh.getNamespace();
 
   // Initialize the parameter server.
-  ros::NodeHandle pnh("~");
   dsrv_.reset(new dynamic_reconfigure::Server<FootprintObserverConfig>(pnh));
   dsrv_->setCallback(
       boost::bind(&FootprintObserver::reconfigureCallback, this, _1, _2));
@@ -66,13 +74,12 @@ FootprintObserver::FootprintObserver() : enabled_(true) {
 
   // Read the single joint footprint.
   if (pnh.hasParam("joint_radius")) {
-    double joint_radius;
-    pnh.getParam("joint_radius", joint_radius);
-    if (joint_radius <= 0.) {
+    pnh.getParam("joint_radius", joint_radius_);
+    if (joint_radius_ <= 0.) {
       ROS_ERROR_STREAM(node_name << ": Joint radius is not positive.");
       ros::shutdown();
     } else {
-      approximatedCircle<kJointNumPoints>(joint_radius, &joint_footprint_);
+      approximatedCircle<kJointNumPoints>(joint_radius_, &joint_footprint_);
       ROS_INFO_STREAM(
           node_name << ": Joint footprint successfully initialized.");
     }
@@ -87,6 +94,38 @@ FootprintObserver::FootprintObserver() : enabled_(true) {
     }
   }
 
+  pnh.param<double>(
+      "joint_position_tolerance", joint_position_tolerance_,
+      joint_position_tolerance_);
+  pnh.param<double>(
+      "footprint_change_threshold", footprint_change_threshold_,
+      footprint_change_threshold_);
+
+  // Read the library of canonical footprints.
+  double library_threshold;
+  int library_size;
+  pnh.param<double>("library_threshold", library_threshold, 0.);
+  pnh.param<int>("library_size", library_size, 16);
+  std::vector<std::vector<Point2D>> library_footprints;
+  if (pnh.hasParam("footprint_library")) {
+    std::vector<std::string> footprint_strs;
+    pnh.getParam("footprint_library", footprint_strs);
+    for (const auto& footprint_str : footprint_strs) {
+      std::vector<Point2D> footprint;
+      if (parameter_parser::parseFootprintParameter(footprint_str, &footprint))
+        library_footprints.emplace_back(footprint);
+      else
+        ROS_WARN_STREAM(
+            node_name << ": Skipping invalid footprint of the library.");
+    }
+  }
+  library_.initialize(library_footprints, library_threshold, library_size);
+
+  // The hull of the base is the same for every footprint.
+  CGAL::convex_hull_2(
+      base_footprint_.begin(), base_footprint_.end(),
+      std::back_inserter(base_hull_));
+
   // Wait for annoying ROS crap to start up. Apparently no better solution.
   ros::Duration(1.0).sleep();  
 
@@ -97,7 +136,9 @@ FootprintObserver::FootprintObserver() : enabled_(true) {
   // Initialize the footprint services, publisher and subscribers.
   enable_sub_ =
       pnh.subscribe("enable", 1, &FootprintObserver::enableCallback, this);
-  footprint_pub_ = pnh.advertise<geometry_msgs::PolygonStamped>("footprint", 1);
+  footprint_pub_ =
+      pnh.advertise<geometry_msgs::PolygonStamped>("footprint", 1, true);
+  footprint_id_pub_ = pnh.advertise<std_msgs::Int32>("footprint_id", 1, true);
   footprint_marker_pub_ = pnh.advertise<visualization_msgs::Marker>(
       "footprint_folding", 1);
   footprint_get_srv_ = pnh.advertiseService(
@@ -107,25 +148,28 @@ FootprintObserver::FootprintObserver() : enabled_(true) {
 
   // Initialize the arm folding observer.
   arm_folding_observer_.reset(new ArmFoldingObserver);
-  arm_folding_observer_->initialize("arm_folding_observer");
+  arm_folding_observer_->initialize(pnh, "arm_folding_observer");
   
   // Initialization  succesfull.
   ROS_INFO_STREAM(node_name << ": FootprintObserver successfully initialized.");
 }
 
 void FootprintObserver::spin(double hz) {
-  const std::string& node_name = ros::this_node::getName();
   for (ros::Rate lr(hz); ros::ok(); lr.sleep()) {
-    try {
-      ros::spinOnce();
-      if (!enabled_)
-        continue;
-      const ros::Time& now = ros::Time::now();
-      updateFootprint(now);
-      publishFootprint(now);
-    } catch (const std::runtime_error& err) {
-      ROS_ERROR_STREAM(node_name << ": " << err.what());
-    }
+    ros::spinOnce();
+    update();
+  }
+}
+
+void FootprintObserver::update() {
+  if (!enabled_)
+    return;
+  try {
+    updateFootprint();
+    std::unique_lock<std::mutex> lock(update_mtx_);
+    publishFootprint(ros::Time::now());
+  } catch (const std::runtime_error& err) {
+    ROS_ERROR_STREAM(ros::this_node::getName() << ": " << err.what());
   }
 }
 
@@ -168,61 +212,123 @@ bool FootprintObserver::dumpFootprintServiceCallback(
 bool FootprintObserver::getFootprintServiceCallback(
     squirrel_footprint_observer_msgs::get_footprint::Request& req,
     squirrel_footprint_observer_msgs::get_footprint::Response& res) {
+  updateFootprint();
   std::unique_lock<std::mutex> lock(update_mtx_);
-  updateFootprint(ros::Time::now());
   res.footprint = footprint_.polygon;
   return true;
 }
 
-void FootprintObserver::updateFootprint(const ros::Time& stamp) {
+void FootprintObserver::updateFootprint() {
+  // The lookups do not need the lock, the frames are not modified.
+  std::vector<Vector2D> joint_positions;
+  if (!lookupJointPositions(&joint_positions))
+    return;
   std::unique_lock<std::mutex> lock(update_mtx_);
-  const size_t njoints        = joint_chain_.size();
-  const size_t footprint_size = kBaseNumPoints + njoints * kJointNumPoints;
-  std::vector<Point2D> full_footprint;
-  full_footprint.reserve(footprint_size);
-  // Add the downprojected joints to the full footprint.
-  for (size_t i = 0; i < njoints; ++i) {
+  // Keep the footprint if none of the joints has moved.
+  const size_t njoints = joint_chain_.size();
+  if (!footprint_.polygon.points.empty() &&
+      joint_positions_.size() == njoints) {
+    const double tolerance2 =
+        joint_position_tolerance_ * joint_position_tolerance_;
+    bool moved = false;
+    for (size_t i = 0; i < njoints && !moved; ++i)
+      moved = (joint_positions[i] - joint_positions_[i]).squared_length() >
+              tolerance2;
+    if (!moved)
+      return;
+  }
+  joint_positions_.swap(joint_positions);
+  // The hull of the joint circles is the hull of their centers grown by the
+  // circle, the joints whose circle is within the base are skipped.
+  std::vector<Point2D> centers, centers_hull;
+  centers.reserve(njoints);
+  for (const auto& joint_position : joint_positions_) {
+    const Point2D center = CGAL::ORIGIN + joint_position;
+    if (signedDistance(base_hull_, center) < joint_radius_)
+      centers.emplace_back(center);
+  }
+  CGAL::convex_hull_2(
+      centers.begin(), centers.end(), std::back_inserter(centers_hull));
+  // Merge the grown centers with the hull of the base.
+  std::vector<Point2D> full_footprint(base_hull_);
+  full_footprint.reserve(
+      base_hull_.size() + centers_hull.size() * joint_footprint_.size());
+  for (const auto& center : centers_hull)
+    for (const auto& point : joint_footprint_)
+      full_footprint.emplace_back(center + (point - CGAL::ORIGIN));
+  hull_.clear();
+  CGAL::convex_hull_2(
+      full_footprint.begin(), full_footprint.end(), std::back_inserter(hull_));
+  // Replace the hull with its canonical footprint, the live one is kept if
+  // the library is full and none is close enough.
+  if (library_.enabled()) {
+    footprint_id_ = library_.snap(hull_);
+    if (footprint_id_ >= 0)
+      hull_ = library_.footprint(footprint_id_);
+  }
+  // Update the current footprint.
+  footprint_.polygon.points.resize(hull_.size());
+  for (size_t i = 0; i < hull_.size(); ++i) {
+    footprint_.polygon.points[i].x = hull_[i].x();
+    footprint_.polygon.points[i].y = hull_[i].y();
+  }
+}
+
+bool FootprintObserver::lookupJointPositions(
+    std::vector<Vector2D>* joint_positions) {
+  const std::string& base_frame_id = footprint_.header.frame_id;
+  const std::string& node_name     = ros::this_node::getName();
+  // Latest time at which all of the joints are in the buffer.
+  ros::Time common_time;
+  std::string error;
+  for (size_t i = 0; i < joint_chain_.size(); ++i) {
+    ros::Time latest;
+    if (tfl_.getLatestCommonTime(
+            base_frame_id, joint_chain_[i], latest, &error) != tf::NO_ERROR) {
+      ROS_WARN_STREAM_THROTTLE(
+          1., node_name << ": " << error << " Skipping footprint update.");
+      return false;
+    }
+    if (i == 0 || latest < common_time)
+      common_time = latest;
+  }
+  // Batch of lookups at the common time, they do not wait.
+  joint_positions->clear();
+  joint_positions->reserve(joint_chain_.size());
+  for (const auto& joint_frame_id : joint_chain_) {
     tf::StampedTransform tf_base2joint;
-    const std::string& base_frame_id  = footprint_.header.frame_id;
-    const std::string& joint_frame_id = joint_chain_[i];
     try {
-      tfl_.waitForTransform(
-          base_frame_id, joint_frame_id, stamp, ros::Duration(1.0));
       tfl_.lookupTransform(
-          base_frame_id, joint_frame_id, stamp, tf_base2joint);
+          base_frame_id, joint_frame_id, common_time, tf_base2joint);
     } catch (const tf::TransformException& ex) {
-      const std::string& node_name = ros::this_node::getName();
-      ROS_ERROR_STREAM(node_name << ": " << ex.what());
-      ROS_WARN_STREAM(node_name << ": Skipping footprint update.");
-      return;
+      ROS_WARN_STREAM_THROTTLE(
+          1., node_name << ": " << ex.what() << " Skipping footprint update.");
+      return false;
     }
-    // Transform the joint footprint according to the joint position.
-    const double joint_x = tf_base2joint.getOrigin().getX();
-    const double joint_y = tf_base2joint.getOrigin().getY();
-    const Vector2D joint_position(joint_x, joint_y);
-    for (size_t i = 0; i < kJointNumPoints; ++i)
-      full_footprint.emplace_back(joint_footprint_[i] + joint_position);
-  }
-  // Add the base to the full footprint.
-  for (size_t i = 0; i < kBaseNumPoints; ++i)
-    full_footprint.emplace_back(base_footprint_[i]);
-  // Compute convex hull.
-  std::vector<Point2D> ch_footprint;
-  CGAL::convex_hull_2(
-      full_footprint.begin(), full_footprint.end(),
-      std::back_inserter(ch_footprint));
-  // Update the current footprint.
-  footprint_.polygon.points.resize(ch_footprint.size());
-  for (size_t i = 0; i < ch_footprint.size(); ++i) {
-    footprint_.polygon.points[i].x = ch_footprint[i].x();
-    footprint_.polygon.points[i].y = ch_footprint[i].y();
+    joint_positions->emplace_back(
+        tf_base2joint.getOrigin().getX(), tf_base2joint.getOrigin().getY());
   }
+  return true;
 }
 
 void FootprintObserver::publishFootprint(const ros::Time& stamp) {
   if (footprint_.polygon.points.empty())
     return;
 
+  // The topic is latched, the planners reinitialize only on a change.
+  const bool folded = arm_folding_observer_->folded();
+  if (!published_hull_.empty() && folded == published_folded_ &&
+      hausdorffDistance(hull_, published_hull_) <= footprint_change_threshold_)
+    return;
+  published_hull_   = hull_;
+  published_folded_ = folded;
+
+  // The identifier goes first, so that it is known with the polygon.
+  if (library_.enabled()) {
+    std_msgs::Int32 footprint_id_msg;
+    footprint_id_msg.data = footprint_id_;
+    footprint_id_pub_.publish(footprint_id_msg);
+  }
   footprint_.header.stamp = stamp;
   footprint_pub_.publish(footprint_);
   
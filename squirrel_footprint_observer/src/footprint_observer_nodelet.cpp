@@ -0,0 +1,51 @@
+// Copyright (C) 2017  Federico Boniardi and Wolfram Burgard
+// 
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "squirrel_footprint_observer/footprint_observer.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include <memory>
+
+namespace squirrel_footprint_observer {
+
+// Runs the observer in a nodelet manager, the spinner is replaced by a
+// timer on the callback queue of the manager.
+class FootprintObserverNodelet : public nodelet::Nodelet {
+ public:
+  virtual void onInit() override {
+    ros::NodeHandle& pnh = getPrivateNodeHandle();
+    double rate;
+    pnh.param<double>("rate", rate, 10.0);
+    observer_.reset(new FootprintObserver(pnh));
+    timer_ = pnh.createTimer(
+        ros::Duration(1.0 / rate), &FootprintObserverNodelet::timerCallback,
+        this);
+  }
+
+ private:
+  void timerCallback(const ros::TimerEvent&) { observer_->update(); }
+
+ private:
+  std::unique_ptr<FootprintObserver> observer_;
+  ros::Timer timer_;
+};
+
+}  // namespace squirrel_footprint_observer
+
+PLUGINLIB_EXPORT_CLASS(
+    squirrel_footprint_observer::FootprintObserverNodelet, nodelet::Nodelet);
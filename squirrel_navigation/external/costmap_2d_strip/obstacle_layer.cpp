@@ -40,6 +40,9 @@
 #include <costmap_2d/costmap_math.h>
 #include <pluginlib/class_list_macros.h>
 
+#include <algorithm>
+#include <cstring>
+
 using costmap_2d::NO_INFORMATION;
 using costmap_2d::LETHAL_OBSTACLE;
 using costmap_2d::FREE_SPACE;
@@ -51,6 +54,24 @@ using namespace costmap_2d;
 
 namespace squirrel_navigation {
 
+namespace {
+
+// Frees the cells of a beam, the beams raytraced in parallel may cross the same cells.
+class FreeCell
+{
+public:
+  explicit FreeCell(unsigned char* costmap) : costmap_(costmap) {}
+  inline void operator()(unsigned int offset)
+  {
+    __atomic_store_n(costmap_ + offset, FREE_SPACE, __ATOMIC_RELAXED);
+  }
+
+private:
+  unsigned char* costmap_;
+};
+
+}  // namespace
+
 void ObstacleLayer::onInitialize()
 {
   ros::NodeHandle nh("~/" + name_), g_nh;
@@ -73,6 +94,8 @@ void ObstacleLayer::onInitialize()
   double robot_radius;
   nh.param("collision_radius", robot_radius, 0.25);
   sq_robot_radius_ = robot_radius * robot_radius;
+  nh.param("marking_threads", marking_threads_, 0);
+  nh.param("clearing_threads", clearing_threads_, 1);
   
   std::string topics_string;
   // get the topics that we'll subscribe to from the parameter server
@@ -134,6 +157,56 @@ void ObstacleLayer::onInitialize()
       source_node.getParam(raytrace_range_param_name, raytrace_range);
     }
 
+    // laser scans can be kept as they are and marked from their ranges, without the round trip through clouds
+    bool native_scan;
+    source_node.param("native_scan", native_scan, false);
+    if (native_scan && data_type != "LaserScan")
+    {
+      ROS_WARN("obstacle_layer: native_scan option is only applicable to LaserScan observations.");
+      native_scan = false;
+    }
+    else if (native_scan && !nativeScansSupported())
+    {
+      ROS_WARN("obstacle_layer: native_scan option is not supported by %s, the scans are projected to clouds.",
+               name_.c_str());
+      native_scan = false;
+    }
+
+    if (native_scan)
+    {
+      scan_buffers_.push_back(
+          boost::shared_ptr<ScanObservationBuffer>(
+              new ScanObservationBuffer(topic, observation_keep_time, expected_update_rate, min_obstacle_height,
+                                        max_obstacle_height, obstacle_range, raytrace_range, *tf_, global_frame_,
+                                        sensor_frame, inf_is_valid)));
+      if (marking)
+        scan_marking_buffers_.push_back(scan_buffers_.back());
+      if (clearing)
+        scan_clearing_buffers_.push_back(scan_buffers_.back());
+
+      boost::shared_ptr < message_filters::Subscriber<sensor_msgs::LaserScan>
+          > sub(new message_filters::Subscriber<sensor_msgs::LaserScan>(g_nh, topic, 50));
+
+      boost::shared_ptr < tf::MessageFilter<sensor_msgs::LaserScan>
+          > filter(new tf::MessageFilter<sensor_msgs::LaserScan>(*sub, *tf_, global_frame_, 50));
+      filter->registerCallback(
+          boost::bind(&ObstacleLayer::laserScanNativeCallback, this, _1, scan_buffers_.back()));
+
+      observation_subscribers_.push_back(sub);
+      observation_notifiers_.push_back(filter);
+
+      observation_notifiers_.back()->setTolerance(ros::Duration(0.05));
+
+      if (sensor_frame != "")
+      {
+        std::vector < std::string > target_frames;
+        target_frames.push_back(global_frame_);
+        target_frames.push_back(sensor_frame);
+        observation_notifiers_.back()->setTargetFrames(target_frames);
+      }
+      continue;
+    }
+
     ROS_DEBUG("Creating an observation buffer for source %s, topic %s, frame %s", source.c_str(), topic.c_str(),
               sensor_frame.c_str());
 
@@ -315,6 +388,15 @@ void ObstacleLayer::laserScanValidInfCallback(const sensor_msgs::LaserScanConstP
   buffer->unlock();
 }
 
+void ObstacleLayer::laserScanNativeCallback(const sensor_msgs::LaserScanConstPtr& message,
+                                            const boost::shared_ptr<ScanObservationBuffer>& buffer)
+{
+  // buffer the scan, it is shared and not copied
+  buffer->lock();
+  buffer->bufferScan(message);
+  buffer->unlock();
+}
+
 void ObstacleLayer::pointCloudCallback(const sensor_msgs::PointCloudConstPtr& message,
                                                const boost::shared_ptr<ObservationBuffer>& buffer)
 {
@@ -359,70 +441,76 @@ void ObstacleLayer::updateBounds(double robot_x, double robot_y, double robot_ya
   // get the clearing observations
   current = current && getClearingObservations(clearing_observations);
 
+  // get the native scans
+  std::vector<ScanObservation> scan_observations, scan_clearing_observations;
+  current = getScanObservations(scan_marking_buffers_, scan_observations) && current;
+  current = getScanObservations(scan_clearing_buffers_, scan_clearing_observations) && current;
+
   // update the global current status
   current_ = current;
 
+  latest_observation_stamp_ = ros::Time();
+  updateObservationStamp(observations);
+  updateObservationStamp(scan_observations);
+
   // raytrace freespace
   for (unsigned int i = 0; i < clearing_observations.size(); ++i)
   {
     raytraceFreespace(clearing_observations[i], min_x, min_y, max_x, max_y);
   }
+  for (unsigned int i = 0; i < scan_clearing_observations.size(); ++i)
+  {
+    raytraceScan(scan_clearing_observations[i], min_x, min_y, max_x, max_y);
+  }
 
-  // place the new obstacles into a priority queue... each with a priority of zero to begin with
+  // the 2D map has a single layer, the height of the points only rejects them
+  costmap::MarkingGeometry geometry;
+  geometry.robot_x = robot_x;
+  geometry.robot_y = robot_y;
+  geometry.sq_robot_radius = sq_robot_radius_;
+  geometry.max_obstacle_height = max_obstacle_height_;
+  geometry.origin_x = origin_x_;
+  geometry.origin_y = origin_y_;
+  geometry.origin_z = 0.0;
+  geometry.resolution = resolution_;
+  geometry.z_resolution = std::numeric_limits<double>::infinity();
+  geometry.size_x = size_x_;
+  geometry.size_y = size_y_;
+  geometry.size_z = 1;
+
+  // place the new obstacles into the costmap, the stripes of rows are marked in parallel
+  unsigned char* costmap = costmap_;
   for (std::vector<Observation>::const_iterator it = observations.begin(); it != observations.end(); ++it)
   {
-    const Observation& obs = *it;
-
-    const pcl::PointCloud<pcl::PointXYZ>& cloud = *(obs.cloud_);
-
-    double sq_obstacle_range = obs.obstacle_range_ * obs.obstacle_range_;
-
-    for (unsigned int i = 0; i < cloud.points.size(); ++i)
+    markObservation(*it, geometry, [costmap](int, unsigned int index, unsigned int, double)
     {
-      double px = cloud.points[i].x, py = cloud.points[i].y, pz = cloud.points[i].z;
-
-      // if the obstacle is too high or too far away from the robot we won't add it
-      if (pz > max_obstacle_height_)
-      {
-        ROS_DEBUG("The point is too high");
-        continue;
-      }
-
-      // compute the squared distance from the hitpoint to the pointcloud's origin
-      double sq_dist = (px - obs.origin_.x) * (px - obs.origin_.x) + (py - obs.origin_.y) * (py - obs.origin_.y)
-          + (pz - obs.origin_.z) * (pz - obs.origin_.z);
-
-      // if the point is far enough away... we won't consider it
-      if (sq_dist >= sq_obstacle_range)
-      {
-        ROS_DEBUG("The point is too far away");
-        continue;
-      }
-
-      // if the points is inside the robot chassis... we won't consider it
-      double sq_dist_robot = std::pow(px - robot_x, 2) + std::pow(py - robot_y, 2);
-      if (sq_dist_robot <= sq_robot_radius_)
-      {
-        ROS_DEBUG("The point comes from the robot.");
-        continue;
-      }
-      
-      // now we need to compute the map coordinates for the observation
-      unsigned int mx, my;
-      if (!worldToMap(px, py, mx, my))
-      {
-        ROS_DEBUG("Computing map coords failed");
-        continue;
-      }
+      costmap[index] = LETHAL_OBSTACLE;
+      return true;
+    }, min_x, min_y, max_x, max_y);
+  }
+  for (unsigned int i = 0; i < scan_observations.size(); ++i)
+  {
+    markScan(scan_observations[i], robot_x, robot_y, min_x, min_y, max_x, max_y);
+  }
 
-      unsigned int index = getIndex(mx, my);
-      costmap_[index] = LETHAL_OBSTACLE;
+  updateFootprint(robot_x, robot_y, robot_yaw, min_x, min_y, max_x, max_y);
+}
 
-      touch(px, py, min_x, min_y, max_x, max_y);
-    }
+void ObstacleLayer::updateObservationStamp(const std::vector<Observation>& observations)
+{
+  for (unsigned int i = 0; i < observations.size(); ++i)
+  {
+    // pcl stamps are in microseconds
+    ros::Time stamp;
+    stamp.fromNSec(observations[i].cloud_->header.stamp * 1000ull);
+    latest_observation_stamp_ = std::max(latest_observation_stamp_, stamp);
   }
+}
 
-  updateFootprint(robot_x, robot_y, robot_yaw, min_x, min_y, max_x, max_y);
+void ObstacleLayer::updateObservationStamp(const std::vector<ScanObservation>& observations)
+{
+  for (unsigned int i = 0; i < observations.size(); ++i)
+    latest_observation_stamp_ = std::max(latest_observation_stamp_, observations[i].scan_->header.stamp);
 }
 
 void ObstacleLayer::updateFootprint(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y,
@@ -508,12 +596,92 @@ bool ObstacleLayer::getClearingObservations(std::vector<Observation>& clearing_o
   return current;
 }
 
+bool ObstacleLayer::getScanObservations(const std::vector<boost::shared_ptr<ScanObservationBuffer> >& buffers,
+                                        std::vector<ScanObservation>& observations) const
+{
+  bool current = true;
+  for (unsigned int i = 0; i < buffers.size(); ++i)
+  {
+    buffers[i]->lock();
+    buffers[i]->getObservations(observations);
+    current = buffers[i]->isCurrent() && current;
+    buffers[i]->unlock();
+  }
+  return current;
+}
+
+void ObstacleLayer::markScan(const ScanObservation& observation, double robot_x, double robot_y, double* min_x,
+                             double* min_y, double* max_x, double* max_y)
+{
+  // the beams are all at the height of the sensor
+  if (observation.z_ > max_obstacle_height_)
+    return;
+
+  const double sq_obstacle_range = observation.obstacle_range_ * observation.obstacle_range_;
+  for (unsigned int i = 0; i < observation.beams_->size; ++i)
+  {
+    double range, dx, dy;
+    if (!observation.range(i, &range) || range * range >= sq_obstacle_range)
+      continue;
+    observation.direction(i, &dx, &dy);
+    const double wx = observation.x_ + range * dx, wy = observation.y_ + range * dy;
+
+    // the points within the robot are not obstacles
+    const double rx = wx - robot_x, ry = wy - robot_y;
+    if (rx * rx + ry * ry <= sq_robot_radius_)
+      continue;
+
+    unsigned int mx, my;
+    if (!worldToMap(wx, wy, mx, my))
+      continue;
+    costmap_[getIndex(mx, my)] = LETHAL_OBSTACLE;
+    touch(wx, wy, min_x, min_y, max_x, max_y);
+  }
+}
+
+void ObstacleLayer::raytraceScan(const ScanObservation& observation, double* min_x, double* min_y, double* max_x,
+                                 double* max_y)
+{
+  const double ox = observation.x_, oy = observation.y_;
+
+  // get the map coordinates of the origin of the sensor
+  unsigned int x0, y0;
+  if (!worldToMap(ox, oy, x0, y0))
+  {
+    ROS_WARN_THROTTLE(
+        1.0, "The origin for the sensor at (%.2f, %.2f) is out of map bounds. So, the costmap cannot raytrace for it.",
+        ox, oy);
+    return;
+  }
+
+  touch(ox, oy, min_x, min_y, max_x, max_y);
+
+  // the beams only free cells, so they are raytraced in any order; the bounds are reduced over the threads
+  double bounds_min_x = *min_x, bounds_min_y = *min_y, bounds_max_x = *max_x, bounds_max_y = *max_y;
+  const int num_beams = observation.beams_->size;
+#pragma omp parallel for num_threads(clearingThreads()) schedule(static) \
+    reduction(min : bounds_min_x, bounds_min_y) reduction(max : bounds_max_x, bounds_max_y)
+  for (int i = 0; i < num_beams; ++i)
+  {
+    double range, dx, dy;
+    if (!observation.range(i, &range))
+      continue;
+    observation.direction(i, &dx, &dy);
+    raytraceBeam(ox, oy, x0, y0, ox + range * dx, oy + range * dy, observation.raytrace_range_, &bounds_min_x,
+                 &bounds_min_y, &bounds_max_x, &bounds_max_y);
+  }
+  *min_x = bounds_min_x;
+  *min_y = bounds_min_y;
+  *max_x = bounds_max_x;
+  *max_y = bounds_max_y;
+}
+
 void ObstacleLayer::raytraceFreespace(const Observation& clearing_observation, double* min_x, double* min_y,
                                               double* max_x, double* max_y)
 {
   double ox = clearing_observation.origin_.x;
   double oy = clearing_observation.origin_.y;
-  pcl::PointCloud < pcl::PointXYZ > cloud = *(clearing_observation.cloud_);
+  const pcl::PointCloud < pcl::PointXYZ >& cloud = *(clearing_observation.cloud_);
 
   // get the map coordinates of the origin of the sensor
   unsigned int x0, y0;
@@ -525,67 +693,78 @@ void ObstacleLayer::raytraceFreespace(const Observation& clearing_observation, d
     return;
   }
 
-  // we can pre-compute the enpoints of the map outside of the inner loop... we'll need these later
-  double origin_x = origin_x_, origin_y = origin_y_;
-  double map_end_x = origin_x + size_x_ * resolution_;
-  double map_end_y = origin_y + size_y_ * resolution_;
-
-
   touch(ox, oy, min_x, min_y, max_x, max_y);
 
   // for each point in the cloud, we want to trace a line from the origin and clear obstacles along it
-  for (unsigned int i = 0; i < cloud.points.size(); ++i)
+  double bounds_min_x = *min_x, bounds_min_y = *min_y, bounds_max_x = *max_x, bounds_max_y = *max_y;
+  const int num_points = cloud.points.size();
+#pragma omp parallel for num_threads(clearingThreads()) schedule(static) \
+    reduction(min : bounds_min_x, bounds_min_y) reduction(max : bounds_max_x, bounds_max_y)
+  for (int i = 0; i < num_points; ++i)
   {
-    double wx = cloud.points[i].x;
-    double wy = cloud.points[i].y;
+    raytraceBeam(ox, oy, x0, y0, cloud.points[i].x, cloud.points[i].y, clearing_observation.raytrace_range_,
+                 &bounds_min_x, &bounds_min_y, &bounds_max_x, &bounds_max_y);
+  }
+  *min_x = bounds_min_x;
+  *min_y = bounds_min_y;
+  *max_x = bounds_max_x;
+  *max_y = bounds_max_y;
+}
 
-    // now we also need to make sure that the enpoint we're raytracing
-    // to isn't off the costmap and scale if necessary
-    double a = wx - ox;
-    double b = wy - oy;
+void ObstacleLayer::raytraceBeam(double ox, double oy, unsigned int x0, unsigned int y0, double wx, double wy,
+                                 double raytrace_range, double* min_x, double* min_y, double* max_x, double* max_y)
+{
+  // we can pre-compute the enpoints of the map... we'll need these later
+  double origin_x = origin_x_, origin_y = origin_y_;
+  double map_end_x = origin_x + size_x_ * resolution_;
+  double map_end_y = origin_y + size_y_ * resolution_;
 
-    // the minimum value to raytrace from is the origin
-    if (wx < origin_x)
-    {
-      double t = (origin_x - ox) / a;
-      wx = origin_x;
-      wy = oy + b * t;
-    }
-    if (wy < origin_y)
-    {
-      double t = (origin_y - oy) / b;
-      wx = ox + a * t;
-      wy = origin_y;
-    }
+  // now we also need to make sure that the enpoint we're raytracing
+  // to isn't off the costmap and scale if necessary
+  double a = wx - ox;
+  double b = wy - oy;
 
-    // the maximum value to raytrace to is the end of the map
-    if (wx > map_end_x)
-    {
-      double t = (map_end_x - ox) / a;
-      wx = map_end_x - .001;
-      wy = oy + b * t;
-    }
-    if (wy > map_end_y)
-    {
-      double t = (map_end_y - oy) / b;
-      wx = ox + a * t;
-      wy = map_end_y - .001;
-    }
+  // the minimum value to raytrace from is the origin
+  if (wx < origin_x)
+  {
+    double t = (origin_x - ox) / a;
+    wx = origin_x;
+    wy = oy + b * t;
+  }
+  if (wy < origin_y)
+  {
+    double t = (origin_y - oy) / b;
+    wx = ox + a * t;
+    wy = origin_y;
+  }
 
-    // now that the vector is scaled correctly... we'll get the map coordinates of its endpoint
-    unsigned int x1, y1;
+  // the maximum value to raytrace to is the end of the map
+  if (wx > map_end_x)
+  {
+    double t = (map_end_x - ox) / a;
+    wx = map_end_x - .001;
+    wy = oy + b * t;
+  }
+  if (wy > map_end_y)
+  {
+    double t = (map_end_y - oy) / b;
+    wx = ox + a * t;
+    wy = map_end_y - .001;
+  }
 
-    // check for legality just in case
-    if (!worldToMap(wx, wy, x1, y1))
-      continue;
+  // now that the vector is scaled correctly... we'll get the map coordinates of its endpoint
+  unsigned int x1, y1;
 
-    unsigned int cell_raytrace_range = cellDistance(clearing_observation.raytrace_range_);
-    MarkCell marker(costmap_, FREE_SPACE);
-    // and finally... we can execute our trace to clear obstacles along that line
-    raytraceLine(marker, x0, y0, x1, y1, cell_raytrace_range);
+  // check for legality just in case
+  if (!worldToMap(wx, wy, x1, y1))
+    return;
 
-    updateRaytraceBounds(ox, oy, wx, wy, clearing_observation.raytrace_range_, min_x, min_y, max_x, max_y);
-  }
+  unsigned int cell_raytrace_range = cellDistance(raytrace_range);
+  FreeCell marker(costmap_);
+  // and finally... we can execute our trace to clear obstacles along that line
+  raytraceLine(marker, x0, y0, x1, y1, cell_raytrace_range);
+
+  updateRaytraceBounds(ox, oy, wx, wy, raytrace_range, min_x, min_y, max_x, max_y);
 }
 
 void ObstacleLayer::activate()
@@ -602,6 +781,12 @@ void ObstacleLayer::activate()
     if (observation_buffers_[i])
       observation_buffers_[i]->resetLastUpdated();
   }
+
+  for (unsigned int i = 0; i < scan_buffers_.size(); ++i)
+  {
+    if (scan_buffers_[i])
+      scan_buffers_[i]->resetLastUpdated();
+  }
 }
 void ObstacleLayer::deactivate()
 {
@@ -630,6 +815,29 @@ void ObstacleLayer::reset()
     activate();
 }
 
+void ObstacleLayer::clearRow(unsigned int j, unsigned int min_i, unsigned int max_i)
+{
+  memset(costmap_ + getIndex(min_i, j), FREE_SPACE, max_i - min_i);
+}
+
+void ObstacleLayer::updateOrigin(double new_origin_x, double new_origin_y)
+{
+  // project the new origin into the grid, the origin stays grid-aligned
+  int cell_ox = int((new_origin_x - origin_x_) / resolution_);
+  int cell_oy = int((new_origin_y - origin_y_) / resolution_);
+  if (cell_ox == 0 && cell_oy == 0)
+    return;
+
+  shiftMaps(cell_ox, cell_oy);
+  origin_x_ += cell_ox * resolution_;
+  origin_y_ += cell_oy * resolution_;
+}
+
+void ObstacleLayer::shiftMaps(int dx, int dy)
+{
+  costmap::shiftGrid(costmap_, size_x_, size_y_, dx, dy, default_value_);
+}
+
 void ObstacleLayer::resize(unsigned int size_x, unsigned int size_y, double resolution,
                            double origin_x, double origin_y) {
   layered_costmap_->resizeMap(size_x, size_y, resolution, origin_x, origin_y, true);
@@ -56,6 +56,16 @@
 #include <costmap_2d/ObstaclePluginConfig.h>
 #include <costmap_2d/footprint.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <limits>
+
+#include "squirrel_navigation/utils/costmap_utils.h"
+
+#include "scan_observation.h"
+
 namespace squirrel_navigation {
 
 class ObstacleLayer : public costmap_2d::CostmapLayer
@@ -78,6 +88,12 @@ public:
 
   void resize(unsigned int size_x, unsigned int size_y, double resolution, double origin_x, double origin_y);
 
+  /**
+   * @brief  Move the origin of the rolling window, the kept cells are shifted in place and only the exposed ones are
+   * reset
+   */
+  virtual void updateOrigin(double new_origin_x, double new_origin_y);
+
   /**
    * @brief  A callback to handle buffering LaserScan messages
    * @param message The message returned from a message notifier
@@ -94,6 +110,14 @@ public:
   void laserScanValidInfCallback(const sensor_msgs::LaserScanConstPtr& message,
                                  const boost::shared_ptr<costmap_2d::ObservationBuffer>& buffer);
 
+  /**
+   * @brief A callback to buffer LaserScan messages as they are, without projecting them into point clouds
+   * @param message The message returned from a message notifier
+   * @param buffer A pointer to the scan buffer to update
+   */
+  void laserScanNativeCallback(const sensor_msgs::LaserScanConstPtr& message,
+                               const boost::shared_ptr<ScanObservationBuffer>& buffer);
+
   /**
    * @brief  A callback to handle buffering PointCloud messages
    * @param message The message returned from a message notifier
@@ -117,11 +141,21 @@ public:
   // New feature.
   unsigned char* costmap() { return costmap_; }
   bool currentStatus() const { return current_; }
+  // Newest stamp of the observations marked by the last update, zero if none.
+  const ros::Time& latestObservationStamp() const { return latest_observation_stamp_; }
   bool& enabled() { return enabled_; } 
+  // Free the cells [min_i, max_i) of row j.
+  virtual void clearRow(unsigned int j, unsigned int min_i, unsigned int max_i);
   
 protected:
   virtual void setupDynamicReconfigure(ros::NodeHandle& nh);
 
+  /**
+   * @brief  Shift the grids of the layer by (dx, dy) cells for a move of the origin, before origin_x_ and origin_y_
+   * are updated
+   */
+  virtual void shiftMaps(int dx, int dy);
+
   /**
    * @brief  Get the observations used to mark space
    * @param marking_observations A reference to a vector that will be populated with the observations
@@ -147,9 +181,86 @@ protected:
   virtual void raytraceFreespace(const costmap_2d::Observation& clearing_observation, double* min_x, double* min_y,
                                  double* max_x, double* max_y);
 
+  /**
+   * @brief  Clear the cells from the sensor to one end point, clipped to the map and to the raytrace range
+   * @param x0 The map coordinates of the sensor
+   * @param y0
+   */
+  void raytraceBeam(double ox, double oy, unsigned int x0, unsigned int y0, double wx, double wy,
+                    double raytrace_range, double* min_x, double* min_y, double* max_x, double* max_y);
+
+  /**
+   * @brief  Whether the layer marks and clears the native scans, otherwise the scans are projected to clouds
+   */
+  virtual bool nativeScansSupported() const
+  {
+    return true;
+  }
+
+  /**
+   * @brief  Get the scans of the buffers
+   * @return True if all the buffers are current, false otherwise
+   */
+  bool getScanObservations(const std::vector<boost::shared_ptr<ScanObservationBuffer> >& buffers,
+                           std::vector<ScanObservation>& observations) const;
+
+  /**
+   * @brief  Mark the end points of the beams of a scan, straight from its ranges
+   */
+  void markScan(const ScanObservation& observation, double robot_x, double robot_y, double* min_x, double* min_y,
+                double* max_x, double* max_y);
+
+  /**
+   * @brief  Clear freespace along the beams of a scan
+   */
+  void raytraceScan(const ScanObservation& observation, double* min_x, double* min_y, double* max_x,
+                    double* max_y);
+
   void updateRaytraceBounds(double ox, double oy, double wx, double wy, double range, double* min_x, double* min_y,
                             double* max_x, double* max_y);
 
+  /**
+   * @brief  Number of threads used to mark and raytrace the observations
+   */
+  int markingThreads() const
+  {
+#ifdef _OPENMP
+    return marking_threads_ > 0 ? marking_threads_ : omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  /**
+   * @brief  Number of threads raytracing the clearing beams of an observation, 1 keeps the serial path
+   */
+  int clearingThreads() const
+  {
+#ifdef _OPENMP
+    return clearing_threads_ > 0 ? clearing_threads_ : omp_get_max_threads();
+#else
+    return 1;
+#endif
+  }
+
+  /**
+   * @brief  Marks the points of one observation in parallel. The cloud is split in chunks whose cells are computed
+   * concurrently, then each thread marks one stripe of map rows, so mark_cell is called in cloud order for every cell
+   * and never on the same cell from two threads
+   * @param geometry The map geometry, the sensor fields are set from the observation
+   * @param mark_cell Functor bool(int stripe, unsigned int index, unsigned int height, double z), true if the cell
+   * was marked and the bounds have to be touched
+   */
+  /**
+   * @brief  Keep the newest stamp of the marking observations of an update
+   */
+  void updateObservationStamp(const std::vector<costmap_2d::Observation>& observations);
+  void updateObservationStamp(const std::vector<ScanObservation>& observations);
+
+  template <typename MarkCell>
+  void markObservation(const costmap_2d::Observation& obs, costmap::MarkingGeometry geometry, MarkCell mark_cell,
+                       double* min_x, double* min_y, double* max_x, double* max_y);
+
   std::vector<geometry_msgs::Point> transformed_footprint_;
   bool footprint_clearing_enabled_;
   void updateFootprint(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y, 
@@ -166,6 +277,10 @@ protected:
   std::vector<boost::shared_ptr<costmap_2d::ObservationBuffer> > marking_buffers_;  ///< @brief Used to store observation buffers used for marking obstacles
   std::vector<boost::shared_ptr<costmap_2d::ObservationBuffer> > clearing_buffers_;  ///< @brief Used to store observation buffers used for clearing obstacles
 
+  std::vector<boost::shared_ptr<ScanObservationBuffer> > scan_buffers_;  ///< @brief Buffers of the native scans
+  std::vector<boost::shared_ptr<ScanObservationBuffer> > scan_marking_buffers_;
+  std::vector<boost::shared_ptr<ScanObservationBuffer> > scan_clearing_buffers_;
+
   // Used only for testing purposes
   std::vector<costmap_2d::Observation> static_clearing_observations_, static_marking_observations_;
 
@@ -175,11 +290,79 @@ protected:
   int combination_method_;
 
   double sq_robot_radius_;
+
+  int marking_threads_;
+  int clearing_threads_;
+  ros::Time latest_observation_stamp_;
+  std::vector<costmap::MarkingBatch> marking_batches_;  ///< @brief One chunk of the marking cloud per thread
   
 private:
   void reconfigureCB(costmap_2d::ObstaclePluginConfig &config, uint32_t level);
 };
 
+template <typename MarkCell>
+void ObstacleLayer::markObservation(const costmap_2d::Observation& obs, costmap::MarkingGeometry geometry,
+                                    MarkCell mark_cell, double* min_x, double* min_y, double* max_x, double* max_y)
+{
+  const pcl::PointCloud<pcl::PointXYZ>& cloud = *(obs.cloud_);
+  const int num_points = cloud.points.size();
+  if (num_points == 0)
+    return;
+
+  geometry.sensor_x = obs.origin_.x;
+  geometry.sensor_y = obs.origin_.y;
+  geometry.sensor_z = obs.origin_.z;
+  geometry.sq_obstacle_range = obs.obstacle_range_ * obs.obstacle_range_;
+
+  const int num_threads = markingThreads();
+  if ((int)marking_batches_.size() < num_threads)
+    marking_batches_.resize(num_threads);
+
+#pragma omp parallel num_threads(num_threads)
+  {
+#ifdef _OPENMP
+    const int thread = omp_get_thread_num(), team = omp_get_num_threads();
+#else
+    const int thread = 0, team = 1;
+#endif
+    costmap::MarkingBatch& batch = marking_batches_[thread];
+    const int begin = (long)num_points * thread / team;
+    const int end = (long)num_points * (thread + 1) / team;
+    batch.compute(cloud.points.data() + begin, end - begin, geometry);
+    batch.groupByStripes(team, geometry.size_x, geometry.size_y);
+
+#pragma omp barrier
+
+    double lo_x = std::numeric_limits<double>::max(), lo_y = lo_x;
+    double hi_x = -lo_x, hi_y = -lo_x;
+    for (int i = 0; i < team; ++i)
+    {
+      const costmap::MarkingBatch& chunk = marking_batches_[i];
+      const std::vector<int>& stripe = chunk.stripes[thread];
+      for (unsigned int j = 0; j < stripe.size(); ++j)
+      {
+        const int k = stripe[j];
+        if (mark_cell(thread, chunk.cells[k], chunk.heights[k], chunk.z[k]))
+        {
+          lo_x = std::min(lo_x, chunk.x[k]);
+          lo_y = std::min(lo_y, chunk.y[k]);
+          hi_x = std::max(hi_x, chunk.x[k]);
+          hi_y = std::max(hi_y, chunk.y[k]);
+        }
+      }
+    }
+
+    if (lo_x <= hi_x)
+    {
+#pragma omp critical
+      {
+        touch(lo_x, lo_y, min_x, min_y, max_x, max_y);
+        touch(hi_x, hi_y, min_x, min_y, max_x, max_y);
+      }
+    }
+  }
+}
+
 }  // namespace costmap_2d
 
 #endif  // COSTMAP_2D_OBSTACLE_LAYER_H_
@@ -0,0 +1,167 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "scan_observation.h"
+
+#include <cmath>
+
+namespace squirrel_navigation {
+
+ScanObservationBuffer::ScanObservationBuffer(const std::string& topic_name, double observation_keep_time,
+                                             double expected_update_rate, double min_obstacle_height,
+                                             double max_obstacle_height, double obstacle_range,
+                                             double raytrace_range, tf::TransformListener& tf,
+                                             const std::string& global_frame, const std::string& sensor_frame,
+                                             bool inf_is_valid) :
+    tf_(tf), observation_keep_time_(observation_keep_time), expected_update_rate_(expected_update_rate),
+    last_updated_(ros::Time::now()), global_frame_(global_frame), sensor_frame_(sensor_frame),
+    topic_name_(topic_name), min_obstacle_height_(min_obstacle_height), max_obstacle_height_(max_obstacle_height),
+    obstacle_range_(obstacle_range), raytrace_range_(raytrace_range), inf_is_valid_(inf_is_valid)
+{
+}
+
+void ScanObservationBuffer::bufferScan(const sensor_msgs::LaserScanConstPtr& scan)
+{
+  const std::string& frame = sensor_frame_.empty() ? scan->header.frame_id : sensor_frame_;
+  tf::StampedTransform sensor_pose;
+  try
+  {
+    tf_.lookupTransform(global_frame_, frame, scan->header.stamp, sensor_pose);
+  }
+  catch (tf::TransformException& ex)
+  {
+    ROS_ERROR("TF Exception that should never happen for sensor frame: %s, scan frame: %s, %s", frame.c_str(),
+              scan->header.frame_id.c_str(), ex.what());
+    return;
+  }
+
+  // all of the beams are at the height of the sensor, the scan is kept only if it is within the limits
+  const double z = sensor_pose.getOrigin().z();
+  if (z >= min_obstacle_height_ && z <= max_obstacle_height_)
+  {
+    ScanObservation observation;
+    observation.scan_ = scan;
+    observation.beams_ = beamDirections(*scan);
+    observation.x_ = sensor_pose.getOrigin().x();
+    observation.y_ = sensor_pose.getOrigin().y();
+    observation.z_ = z;
+    const double yaw = tf::getYaw(sensor_pose.getRotation());
+    observation.cos_yaw_ = std::cos(yaw);
+    observation.sin_yaw_ = std::sin(yaw);
+    observation.obstacle_range_ = obstacle_range_;
+    observation.raytrace_range_ = raytrace_range_;
+    observation.inf_is_valid_ = inf_is_valid_;
+    observation_list_.push_front(observation);
+  }
+
+  last_updated_ = ros::Time::now();
+  purgeStaleObservations();
+}
+
+boost::shared_ptr<const BeamDirections> ScanObservationBuffer::beamDirections(const sensor_msgs::LaserScan& scan)
+{
+  for (unsigned int i = 0; i < beam_tables_.size(); ++i)
+  {
+    const BeamDirections& beams = *beam_tables_[i];
+    if (beams.angle_min == scan.angle_min && beams.angle_increment == scan.angle_increment &&
+        beams.size == scan.ranges.size())
+      return beam_tables_[i];
+  }
+
+  boost::shared_ptr<BeamDirections> beams(new BeamDirections);
+  beams->angle_min = scan.angle_min;
+  beams->angle_increment = scan.angle_increment;
+  beams->size = scan.ranges.size();
+  beams->cos_angles.resize(beams->size);
+  beams->sin_angles.resize(beams->size);
+  for (unsigned int i = 0; i < beams->size; ++i)
+  {
+    const double angle = scan.angle_min + i * scan.angle_increment;
+    beams->cos_angles[i] = std::cos(angle);
+    beams->sin_angles[i] = std::sin(angle);
+  }
+  beam_tables_.push_back(beams);
+  return beams;
+}
+
+void ScanObservationBuffer::getObservations(std::vector<ScanObservation>& observations)
+{
+  purgeStaleObservations();
+  observations.insert(observations.end(), observation_list_.begin(), observation_list_.end());
+}
+
+void ScanObservationBuffer::purgeStaleObservations()
+{
+  if (observation_list_.empty())
+    return;
+
+  std::list<ScanObservation>::iterator obs_it = observation_list_.begin();
+  // with a keep time of 0 only the newest scan is kept
+  if (observation_keep_time_ == ros::Duration(0.0))
+  {
+    observation_list_.erase(++obs_it, observation_list_.end());
+    return;
+  }
+
+  for (; obs_it != observation_list_.end(); ++obs_it)
+  {
+    if ((last_updated_ - obs_it->scan_->header.stamp) > observation_keep_time_)
+    {
+      observation_list_.erase(obs_it, observation_list_.end());
+      return;
+    }
+  }
+}
+
+bool ScanObservationBuffer::isCurrent() const
+{
+  if (expected_update_rate_ == ros::Duration(0.0))
+    return true;
+
+  const bool current = (ros::Time::now() - last_updated_).toSec() <= expected_update_rate_.toSec();
+  if (!current)
+  {
+    ROS_WARN(
+        "The %s observation buffer has not been updated for %.2f seconds, and it should be updated every %.2f "
+        "seconds.",
+        topic_name_.c_str(), (ros::Time::now() - last_updated_).toSec(), expected_update_rate_.toSec());
+  }
+  return current;
+}
+
+void ScanObservationBuffer::resetLastUpdated()
+{
+  last_updated_ = ros::Time::now();
+}
+
+}  // namespace squirrel_navigation
@@ -0,0 +1,141 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef COSTMAP_2D_SCAN_OBSERVATION_H_
+#define COSTMAP_2D_SCAN_OBSERVATION_H_
+
+#include <ros/ros.h>
+#include <sensor_msgs/LaserScan.h>
+#include <tf/transform_listener.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+
+#include <cmath>
+#include <list>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+
+/**
+ * @brief Directions of the beams of a scan in the frame of the sensor, shared by the scans with the same
+ * configuration
+ */
+struct BeamDirections
+{
+  float angle_min, angle_increment;
+  unsigned int size;
+  std::vector<double> cos_angles, sin_angles;
+};
+
+/**
+ * @brief A laser scan kept as received, with the pose of the sensor in the global frame at its stamp. The scan
+ * plane is assumed to be level, the beams are marked and raytraced in 2D from the polar data without projecting
+ * them to a cloud
+ */
+struct ScanObservation
+{
+  sensor_msgs::LaserScanConstPtr scan_;
+  boost::shared_ptr<const BeamDirections> beams_;
+  double x_, y_, z_, cos_yaw_, sin_yaw_;
+  double obstacle_range_, raytrace_range_;
+  bool inf_is_valid_;
+
+  /**
+   * @brief  Range of beam i, Infs mapped to range_max if they are valid. False if the beam has no valid return
+   */
+  bool range(unsigned int i, double* range) const
+  {
+    float r = scan_->ranges[i];
+    if (inf_is_valid_ && std::isinf(r) && r > 0)
+      r = scan_->range_max - 0.0001;  // a tenth of a millimeter
+    *range = r;
+    return r >= scan_->range_min && r < scan_->range_max;
+  }
+
+  /**
+   * @brief  Direction of beam i in the global frame
+   */
+  void direction(unsigned int i, double* dx, double* dy) const
+  {
+    *dx = cos_yaw_ * beams_->cos_angles[i] - sin_yaw_ * beams_->sin_angles[i];
+    *dy = sin_yaw_ * beams_->cos_angles[i] + cos_yaw_ * beams_->sin_angles[i];
+  }
+};
+
+/**
+ * @brief  Buffer of the scans of a source, with the same keep time, expected update rate and height limits as
+ * costmap_2d::ObservationBuffer
+ */
+class ScanObservationBuffer
+{
+public:
+  ScanObservationBuffer(const std::string& topic_name, double observation_keep_time, double expected_update_rate,
+                        double min_obstacle_height, double max_obstacle_height, double obstacle_range,
+                        double raytrace_range, tf::TransformListener& tf, const std::string& global_frame,
+                        const std::string& sensor_frame, bool inf_is_valid);
+
+  /**
+   * @brief  Buffer a scan, looking up the pose of the sensor once
+   */
+  void bufferScan(const sensor_msgs::LaserScanConstPtr& scan);
+
+  void getObservations(std::vector<ScanObservation>& observations);
+
+  bool isCurrent() const;
+  void resetLastUpdated();
+
+  inline void lock() { lock_.lock(); }
+  inline void unlock() { lock_.unlock(); }
+
+private:
+  boost::shared_ptr<const BeamDirections> beamDirections(const sensor_msgs::LaserScan& scan);
+  void purgeStaleObservations();
+
+  tf::TransformListener& tf_;
+  const ros::Duration observation_keep_time_, expected_update_rate_;
+  ros::Time last_updated_;
+  const std::string global_frame_, sensor_frame_, topic_name_;
+  const double min_obstacle_height_, max_obstacle_height_, obstacle_range_, raytrace_range_;
+  const bool inf_is_valid_;
+  // Newest first.
+  std::list<ScanObservation> observation_list_;
+  // Tables of the scan configurations seen so far, usually one.
+  std::vector<boost::shared_ptr<BeamDirections> > beam_tables_;
+  boost::recursive_mutex lock_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif  // COSTMAP_2D_SCAN_OBSERVATION_H_
@@ -41,6 +41,8 @@
 #include <costmap_2d/costmap_math.h>
 #include <pluginlib/class_list_macros.h>
 
+#include <cstring>
+
 using costmap_2d::NO_INFORMATION;
 using costmap_2d::LETHAL_OBSTACLE;
 using costmap_2d::FREE_SPACE;
@@ -78,6 +80,7 @@ void StaticLayer::onInitialize()
 
   lethal_threshold_ = std::max(std::min(temp_lethal_threshold, 100), 0);
   unknown_cost_value_ = temp_unknown_cost_value;
+  updateValueTable();
 
   // Only resubscribe if topic has changed
   if (map_sub_.getTopic() != ros::names::resolve(map_topic))
@@ -160,6 +163,40 @@ unsigned char StaticLayer::interpretValue(unsigned char value)
   return scale * LETHAL_OBSTACLE;
 }
 
+void StaticLayer::updateValueTable()
+{
+  for (unsigned int value = 0; value < 256; ++value)
+    value_table_[value] = interpretValue(value);
+}
+
+void StaticLayer::translateRows(const signed char* data, unsigned int data_stride, unsigned int min_i,
+                                unsigned int min_j, unsigned int width, unsigned int height)
+{
+  const unsigned char* table = value_table_;
+  unsigned char* costmap = costmap_;
+  const unsigned int size_x = size_x_;
+
+  // the rows are independent, large maps are split among the OpenMP threads
+#pragma omp parallel for schedule(static) if (width * height > 65536)
+  for (int y = 0; y < (int)height; ++y)
+  {
+    const unsigned char* row = reinterpret_cast<const unsigned char*>(data) + y * data_stride;
+    unsigned char* costs = costmap + (min_j + y) * size_x + min_i;
+    for (unsigned int x = 0; x < width; ++x)
+      costs[x] = table[row[x]];
+  }
+}
+
+void StaticLayer::copyRows(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j)
+{
+  if (!enabled_ || max_i <= min_i)
+    return;
+  unsigned char* master = master_grid.getCharMap();
+  const unsigned int span = master_grid.getSizeInCellsX();
+  for (int j = min_j; j < max_j; ++j)
+    memcpy(master + j * span + min_i, costmap_ + j * size_x_ + min_i, max_i - min_i);
+}
+
 void StaticLayer::incomingMap(const nav_msgs::OccupancyGridConstPtr& new_map)
 {
   unsigned int size_x = new_map->info.width, size_y = new_map->info.height;
@@ -186,18 +223,8 @@ void StaticLayer::incomingMap(const nav_msgs::OccupancyGridConstPtr& new_map)
   resizeMap(size_x, size_y, new_map->info.resolution,
             new_map->info.origin.position.x, new_map->info.origin.position.y); 
 
-  unsigned int index = 0;
-
   // initialize the costmap with static data
-  for (unsigned int i = 0; i < size_y; ++i)
-  {
-    for (unsigned int j = 0; j < size_x; ++j)
-    {
-      unsigned char value = new_map->data[index];
-      costmap_[index] = interpretValue(value);
-      ++index;
-    }
-  }
+  translateRows(&new_map->data[0], size_x, 0, 0, size_x, size_y);
   map_frame_ = new_map->header.frame_id;
 
   // we have a new map, update full size of map
@@ -217,16 +244,8 @@ void StaticLayer::incomingMap(const nav_msgs::OccupancyGridConstPtr& new_map)
 
 void StaticLayer::incomingUpdate(const map_msgs::OccupancyGridUpdateConstPtr& update)
 {
-  unsigned int di = 0;
-  for (unsigned int y = 0; y < update->height ; y++)
-  {
-    unsigned int index_base = (update->y + y) * size_x_;
-    for (unsigned int x = 0; x < update->width ; x++)
-    {
-      unsigned int index = index_base + x + update->x;
-      costmap_[index] = interpretValue(update->data[di++]);
-    }
-  }
+  if (update->width > 0 && update->height > 0)
+    translateRows(&update->data[0], update->width, update->x, update->y, update->width, update->height);
   x_ = update->x;
   y_ = update->y;
   width_ = update->width;
@@ -291,7 +310,7 @@ void StaticLayer::updateCosts(costmap_2d::Costmap2D& master_grid, int min_i, int
   {
     // if not rolling, the layered costmap (master_grid) has same coordinates as this layer
     if (!use_maximum_)
-      updateWithTrueOverwrite(master_grid, min_i, min_j, max_i, max_j);
+      copyRows(master_grid, min_i, min_j, max_i, max_j);
     else
       updateWithMax(master_grid, min_i, min_j, max_i, max_j);
   }
@@ -86,6 +86,26 @@ private:
 
   unsigned char interpretValue(unsigned char value);
 
+  /**
+   * @brief  Fill the lookup table of the interpreted values, one entry for each of the occupancy values
+   */
+  void updateValueTable();
+
+  /**
+   * @brief  Translate rows of occupancy values into costs through the lookup table
+   * @param data First value of the first row
+   * @param data_stride Number of values between two rows of the data
+   * @param min_i, min_j First cell of the window written in this layer
+   * @param width, height Size of the window
+   */
+  void translateRows(const signed char* data, unsigned int data_stride, unsigned int min_i, unsigned int min_j,
+                     unsigned int width, unsigned int height);
+
+  /**
+   * @brief  Overwrite the window of the master grid with the costs of this layer, one row at a time
+   */
+  void copyRows(costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i, int max_j);
+
   std::string global_frame_;  ///< @brief The global frame for the costmap
   std::string map_frame_;  /// @brief frame that map is located in
   bool subscribe_to_updates_;
@@ -99,6 +119,7 @@ private:
   ros::Subscriber map_sub_, map_update_sub_;
   
   unsigned char lethal_threshold_, unknown_cost_value_;
+  unsigned char value_table_[256];  ///< @brief Costs of the occupancy values, indexed as unsigned
 
   dynamic_reconfigure::Server<costmap_2d::GenericPluginConfig> *dsrv_;
 };
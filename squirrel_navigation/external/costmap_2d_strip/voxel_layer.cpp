@@ -40,8 +40,6 @@
 #include <pluginlib/class_list_macros.h>
 #include <pcl_conversions/pcl_conversions.h>
 
-#include <set>
-
 #define VOXEL_BITS 16
 
 using costmap_2d::NO_INFORMATION;
@@ -60,7 +58,14 @@ void VoxelLayer::onInitialize()
 
   private_nh.param("publish_voxel_map", publish_voxel_, false);
   if (publish_voxel_)
+  {
     voxel_pub_ = private_nh.advertise < costmap_2d::VoxelGrid > ("voxel_grid", 1);
+    voxel_updates_pub_ = private_nh.advertise < costmap_2d::VoxelGrid > ("voxel_grid_updates", 1);
+  }
+  double voxel_grid_rate;
+  private_nh.param("voxel_grid_rate", voxel_grid_rate, 1.0);
+  voxel_grid_period_ = voxel_grid_rate > 0.0 ? 1.0 / voxel_grid_rate : 0.0;
+  private_nh.param("memory_throttle_factor", memory_throttle_factor_, 5.0);
 
   clearing_endpoints_pub_ = private_nh.advertise<sensor_msgs::PointCloud>("clearing_endpoints", 1);
 }
@@ -109,17 +114,32 @@ void VoxelLayer::reset()
   activate();
 }
 
+void VoxelLayer::clearRow(unsigned int j, unsigned int min_i, unsigned int max_i)
+{
+  ObstacleLayer::clearRow(j, min_i, max_i);
+  for (unsigned int index = getIndex(min_i, j); index < getIndex(max_i, j); ++index)
+    voxel_grid_.clearVoxelColumn(index);
+  expandDirtyWindow(min_i, j, max_i, j + 1);
+}
+
 void VoxelLayer::resetMaps()
 {
   Costmap2D::resetMaps();
   voxel_grid_.reset();
+  published_columns_valid_ = false;
 }
 
 void VoxelLayer::updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x,
                                        double* min_y, double* max_x, double* max_y)
 {
-  if (!floor_indices_.empty())
-    floor_indices_.clear();  
+  // the layer may also be resized by the navigation layer directly
+  if (floor_marks_.numCells() != size_x_ * size_y_)
+  {
+    floor_marks_.resize(size_x_ * size_y_);
+    obstacle_marks_.resize(size_x_ * size_y_);
+  }
+  floor_marks_.clear();
+  obstacle_marks_.clear();
   if (rolling_window_)
     updateOrigin(robot_x - getSizeInMetersX() / 2, robot_y - getSizeInMetersY() / 2);
   if (!enabled_)
@@ -138,6 +158,9 @@ void VoxelLayer::updateBounds(double robot_x, double robot_y, double robot_yaw,
   // update the global current status
   current_ = current;
 
+  latest_observation_stamp_ = ros::Time();
+  updateObservationStamp(observations);
+
   unsigned int erased;
   
   // raytrace freespace
@@ -146,94 +169,187 @@ void VoxelLayer::updateBounds(double robot_x, double robot_y, double robot_yaw,
     raytraceFreespace(clearing_observations[i], min_x, min_y, max_x, max_y);
   }
 
-  std::set<unsigned int> obstacles;
-  
-  // place the new obstacles into a priority queue... each with a priority of zero to begin with
+  costmap::MarkingGeometry geometry;
+  geometry.robot_x = robot_x;
+  geometry.robot_y = robot_y;
+  geometry.sq_robot_radius = sq_robot_radius_;
+  geometry.max_obstacle_height = max_obstacle_height_;
+  geometry.origin_x = origin_x_;
+  geometry.origin_y = origin_y_;
+  geometry.origin_z = origin_z_;
+  geometry.resolution = resolution_;
+  geometry.z_resolution = z_resolution_;
+  geometry.size_x = size_x_;
+  geometry.size_y = size_y_;
+  geometry.size_z = size_z_;
+
+  // the floor cells are collected per stripe, the marks of distinct cells can be stamped concurrently
+  const int num_threads = markingThreads();
+  stripe_floor_cells_.resize(num_threads);
+  for (int i = 0; i < num_threads; ++i)
+    stripe_floor_cells_[i].clear();
+
+  // place the new obstacles into the voxel grid, the stripes of rows are marked in parallel
   for (std::vector<Observation>::const_iterator it = observations.begin(); it != observations.end(); ++it)
   {
-    const Observation& obs = *it;
-
-    const pcl::PointCloud<pcl::PointXYZ>& cloud = *(obs.cloud_);
-
-    double sq_obstacle_range = obs.obstacle_range_ * obs.obstacle_range_;
-    
-    for (unsigned int i = 0; i < cloud.points.size(); ++i)
+    markObservation(*it, geometry, [this](int stripe, unsigned int index, unsigned int mz, double z)
     {
-      // if the obstacle is too high or too far away from the robot we won't add it
-      if (cloud.points[i].z > max_obstacle_height_)
-        continue;
-
-      // compute the squared distance from the hitpoint to the pointcloud's origin
-      double sq_dist = (cloud.points[i].x - obs.origin_.x) * (cloud.points[i].x - obs.origin_.x)
-          + (cloud.points[i].y - obs.origin_.y) * (cloud.points[i].y - obs.origin_.y)
-          + (cloud.points[i].z - obs.origin_.z) * (cloud.points[i].z - obs.origin_.z);
-
-      // if the point is far enough away... we won't consider it
-      if (sq_dist >= sq_obstacle_range)
-        continue;
-
-      // compute the squared 2d distance from the hitpoint to the robot base;
-      double sq_dist_robot = std::pow(cloud.points[i].x - robot_x, 2) + std::pow(cloud.points[i].y - robot_y, 2);
-      if (sq_dist_robot <= sq_robot_radius_)
-        continue;
-      
-      // now we need to compute the map coordinates for the observation
-      unsigned int mx, my, mz;
-      if (cloud.points[i].z < origin_z_)
-      {
-        if (!worldToMap3D(cloud.points[i].x, cloud.points[i].y, origin_z_, mx, my, mz))
-          continue;
-      }
-      else if (!worldToMap3D(cloud.points[i].x, cloud.points[i].y, cloud.points[i].z, mx, my, mz))
-      {
-        continue;
-      }
-
       // mark the cell in the voxel grid and check if we should also mark it in the costmap
-      if (voxel_grid_.markVoxelInMap(mx, my, mz, mark_threshold_))
-      {
-        unsigned int index = getIndex(mx, my);
-        if (cloud.points[i].z > floor_threshold_)
-        {
-          costmap_[index] = LETHAL_OBSTACLE;
-          obstacles.insert(index);
-        }
+      if (!voxel_grid_.markVoxelInMap(index % size_x_, index / size_x_, mz, mark_threshold_))
+        return false;
 
-        if (cloud.points[i].z < floor_threshold_ &&
-            (obstacles.find(index) == obstacles.end()))
-          floor_indices_.insert(index);
-          
-        touch((double)cloud.points[i].x, (double)cloud.points[i].y, min_x, min_y, max_x, max_y);
+      if (z > floor_threshold_)
+      {
+        costmap_[index] = LETHAL_OBSTACLE;
+        obstacle_marks_.mark(index);
       }
-    }
 
-    for (const auto index : floor_indices_)
-      costmap_[index] = FREE_SPACE;
+      if (z < floor_threshold_ && !obstacle_marks_.contains(index) && floor_marks_.mark(index))
+        stripe_floor_cells_[stripe].push_back(index);
+      return true;
+    }, min_x, min_y, max_x, max_y);
   }
 
+  for (int i = 0; i < num_threads; ++i)
+    floor_marks_.append(stripe_floor_cells_[i]);
+
+  // the floor cells are free, also if a later observation marked them
+  for (const auto index : floor_marks_.indices())
+    costmap_[index] = FREE_SPACE;
+
   if (publish_voxel_)
+    publishVoxelGrid(*min_x, *min_y, *max_x, *max_y);
+
+  updateFootprint(robot_x, robot_y, robot_yaw, min_x, min_y, max_x, max_y);
+}
+
+void VoxelLayer::expandDirtyWindow(unsigned int min_i, unsigned int min_j, unsigned int max_i, unsigned int max_j)
+{
+  if (dirty_min_i_ >= dirty_max_i_ || dirty_min_j_ >= dirty_max_j_)
   {
-    costmap_2d::VoxelGrid grid_msg;
-    unsigned int size = voxel_grid_.sizeX() * voxel_grid_.sizeY();
-    grid_msg.size_x = voxel_grid_.sizeX();
-    grid_msg.size_y = voxel_grid_.sizeY();
-    grid_msg.size_z = voxel_grid_.sizeZ();
-    grid_msg.data.resize(size);
-    memcpy(&grid_msg.data[0], voxel_grid_.getData(), size * sizeof(unsigned int));
-
-    grid_msg.origin.x = origin_x_;
-    grid_msg.origin.y = origin_y_;
-    grid_msg.origin.z = origin_z_;
-
-    grid_msg.resolutions.x = resolution_;
-    grid_msg.resolutions.y = resolution_;
-    grid_msg.resolutions.z = z_resolution_;
-    grid_msg.header.frame_id = global_frame_;
-    grid_msg.header.stamp = ros::Time::now();
-    voxel_pub_.publish(grid_msg);
+    dirty_min_i_ = min_i;
+    dirty_min_j_ = min_j;
+    dirty_max_i_ = max_i;
+    dirty_max_j_ = max_j;
+    return;
   }
+  dirty_min_i_ = std::min(dirty_min_i_, min_i);
+  dirty_min_j_ = std::min(dirty_min_j_, min_j);
+  dirty_max_i_ = std::max(dirty_max_i_, max_i);
+  dirty_max_j_ = std::max(dirty_max_j_, max_j);
+}
 
-  updateFootprint(robot_x, robot_y, robot_yaw, min_x, min_y, max_x, max_y);
+size_t VoxelLayer::memoryUsage() const
+{
+  const size_t num_columns = static_cast<size_t>(voxel_grid_.sizeX()) * voxel_grid_.sizeY();
+  return num_columns * sizeof(uint32_t) + static_cast<size_t>(size_x_) * size_y_ +
+         (grid_msg_.data.capacity() + grid_update_msg_.data.capacity() + published_columns_.capacity()) *
+             sizeof(unsigned int);
+}
+
+void VoxelLayer::setMemoryPressure(squirrel_threading::MemoryPressure pressure)
+{
+  if (pressure == squirrel_threading::MemoryPressure::HARD && memory_pressure_ != pressure)
+  {
+    // the next publication after the pressure is released is a whole grid
+    std::vector<unsigned int>().swap(grid_msg_.data);
+    std::vector<unsigned int>().swap(grid_update_msg_.data);
+    std::vector<unsigned int>().swap(published_columns_);
+    published_columns_valid_ = false;
+  }
+  memory_pressure_ = pressure;
+}
+
+void VoxelLayer::publishVoxelGrid(double min_x, double min_y, double max_x, double max_y)
+{
+  if (memory_pressure_ == squirrel_threading::MemoryPressure::HARD)
+    return;
+  const bool throttled = memory_pressure_ == squirrel_threading::MemoryPressure::SOFT;
+  const double period = throttled ? memory_throttle_factor_ * voxel_grid_period_ : voxel_grid_period_;
+  const unsigned int size_x = voxel_grid_.sizeX(), size_y = voxel_grid_.sizeY(), size = size_x * size_y;
+  const unsigned int* data = voxel_grid_.getData();
+  const ros::Time now = ros::Time::now();
+
+  if (min_x <= max_x && min_y <= max_y)
+  {
+    int bounds_min_i, bounds_min_j, bounds_max_i, bounds_max_j;
+    worldToMapEnforceBounds(min_x, min_y, bounds_min_i, bounds_min_j);
+    worldToMapEnforceBounds(max_x, max_y, bounds_max_i, bounds_max_j);
+    expandDirtyWindow(bounds_min_i, bounds_min_j, bounds_max_i + 1, bounds_max_j + 1);
+  }
+
+  grid_msg_.origin.z = grid_update_msg_.origin.z = origin_z_;
+  grid_msg_.resolutions.x = grid_update_msg_.resolutions.x = resolution_;
+  grid_msg_.resolutions.y = grid_update_msg_.resolutions.y = resolution_;
+  grid_msg_.resolutions.z = grid_update_msg_.resolutions.z = z_resolution_;
+  grid_msg_.header.frame_id = grid_update_msg_.header.frame_id = global_frame_;
+
+  // the whole grid, the buffers keep their capacity
+  if (!published_columns_valid_ || published_columns_.size() != size ||
+      (now - last_voxel_grid_).toSec() >= period)
+  {
+    grid_msg_.size_x = size_x;
+    grid_msg_.size_y = size_y;
+    grid_msg_.size_z = voxel_grid_.sizeZ();
+    grid_msg_.data.resize(size);
+    memcpy(&grid_msg_.data[0], data, size * sizeof(unsigned int));
+    grid_msg_.origin.x = origin_x_;
+    grid_msg_.origin.y = origin_y_;
+    grid_msg_.header.stamp = now;
+    voxel_pub_.publish(grid_msg_);
+
+    published_columns_.resize(size);
+    memcpy(&published_columns_[0], data, size * sizeof(unsigned int));
+    published_columns_valid_ = true;
+    last_voxel_grid_ = now;
+    dirty_min_i_ = dirty_max_i_ = dirty_min_j_ = dirty_max_j_ = 0;
+    return;
+  }
+
+  // nobody listens to the updates, or they are throttled, the dirty window grows until the next whole grid
+  if (throttled || voxel_updates_pub_.getNumSubscribers() == 0)
+    return;
+
+  // window of the columns changed within the dirty one
+  const unsigned int dirty_max_i = std::min(dirty_max_i_, size_x), dirty_max_j = std::min(dirty_max_j_, size_y);
+  unsigned int min_i = dirty_max_i, min_j = dirty_max_j, max_i = 0, max_j = 0;
+  for (unsigned int j = dirty_min_j_; j < dirty_max_j; ++j)
+  {
+    const unsigned int* row = data + j * size_x;
+    const unsigned int* published_row = &published_columns_[j * size_x];
+    unsigned int i = dirty_min_i_;
+    while (i < dirty_max_i && row[i] == published_row[i])
+      ++i;
+    if (i == dirty_max_i)
+      continue;
+    unsigned int last_i = dirty_max_i - 1;
+    while (row[last_i] == published_row[last_i])
+      --last_i;
+    min_i = std::min(min_i, i);
+    max_i = std::max(max_i, last_i + 1);
+    min_j = std::min(min_j, j);
+    max_j = j + 1;
+  }
+  dirty_min_i_ = dirty_max_i_ = dirty_min_j_ = dirty_max_j_ = 0;
+  if (min_i >= max_i)
+    return;
+
+  // the changed window, as a voxel grid of its own
+  const unsigned int window_x = max_i - min_i, window_y = max_j - min_j;
+  grid_update_msg_.size_x = window_x;
+  grid_update_msg_.size_y = window_y;
+  grid_update_msg_.size_z = voxel_grid_.sizeZ();
+  grid_update_msg_.data.resize(window_x * window_y);
+  for (unsigned int j = min_j; j < max_j; ++j)
+  {
+    memcpy(&grid_update_msg_.data[(j - min_j) * window_x], data + j * size_x + min_i,
+           window_x * sizeof(unsigned int));
+    memcpy(&published_columns_[j * size_x + min_i], data + j * size_x + min_i, window_x * sizeof(unsigned int));
+  }
+  grid_update_msg_.origin.x = origin_x_ + min_i * resolution_;
+  grid_update_msg_.origin.y = origin_y_ + min_j * resolution_;
+  grid_update_msg_.header.stamp = now;
+  voxel_updates_pub_.publish(grid_update_msg_);
 }
 
 void VoxelLayer::clearNonLethal(double wx, double wy, double w_size_x, double w_size_y, bool clear_no_info)
@@ -318,7 +434,12 @@ void VoxelLayer::raytraceFreespace(const Observation& clearing_observation, doub
   double map_end_x = origin_x_ + getSizeInMetersX();
   double map_end_y = origin_y_ + getSizeInMetersY();
 
-  for (unsigned int i = 0; i < clearing_observation.cloud_->points.size(); ++i)
+  // the end points are clipped in parallel, the lines are cleared in order since they cross each other in the grid
+  const int num_points = clearing_observation.cloud_->points.size();
+  raytrace_targets_.resize(num_points);
+
+#pragma omp parallel for num_threads(markingThreads())
+  for (int i = 0; i < num_points; ++i)
   {
     double wpx = clearing_observation.cloud_->points[i].x;
     double wpy = clearing_observation.cloud_->points[i].y;
@@ -369,30 +490,45 @@ void VoxelLayer::raytraceFreespace(const Observation& clearing_observation, doub
       t = std::min(t, (map_end_y - oy) / b);
     }
 
-    wpx = ox + a * t;
-    wpy = oy + b * t;
-    wpz = oz + c * t;
+    RaytraceTarget& target = raytrace_targets_[i];
+    target.wx = ox + a * t;
+    target.wy = oy + b * t;
+    target.wz = oz + c * t;
+    target.valid = worldToMap3DFloat(target.wx, target.wy, target.wz, target.mx, target.my, target.mz);
+  }
 
-    double point_x, point_y, point_z;
-    if (worldToMap3DFloat(wpx, wpy, wpz, point_x, point_y, point_z))
-    {
-      unsigned int cell_raytrace_range = cellDistance(clearing_observation.raytrace_range_);
+  unsigned int cell_raytrace_range = cellDistance(clearing_observation.raytrace_range_);
+  const int num_threads = clearingThreads();
+  if (num_threads > 1)
+  {
+    ros::WallTime start = ros::WallTime::now();
+    clearVoxelLines(sensor_x, sensor_y, sensor_z, cell_raytrace_range, num_threads);
+    ROS_DEBUG_NAMED("voxel_layer", "Cleared %d lines with %d threads in %.3f ms", num_points, num_threads,
+                    (ros::WallTime::now() - start).toSec() * 1e3);
+  }
 
-      // voxel_grid_.markVoxelLine(sensor_x, sensor_y, sensor_z, point_x, point_y, point_z);
-      voxel_grid_.clearVoxelLineInMap(sensor_x, sensor_y, sensor_z, point_x, point_y, point_z, costmap_,
+  for (int i = 0; i < num_points; ++i)
+  {
+    const RaytraceTarget& target = raytrace_targets_[i];
+    if (!target.valid)
+      continue;
+
+    // voxel_grid_.markVoxelLine(sensor_x, sensor_y, sensor_z, point_x, point_y, point_z);
+    if (num_threads <= 1)
+      voxel_grid_.clearVoxelLineInMap(sensor_x, sensor_y, sensor_z, target.mx, target.my, target.mz, costmap_,
                                       unknown_threshold_, mark_threshold_, FREE_SPACE, NO_INFORMATION,
                                       cell_raytrace_range);
 
-      updateRaytraceBounds(ox, oy, wpx, wpy, clearing_observation.raytrace_range_, min_x, min_y, max_x, max_y);
+    updateRaytraceBounds(ox, oy, target.wx, target.wy, clearing_observation.raytrace_range_, min_x, min_y, max_x,
+                         max_y);
 
-      if (publish_clearing_points)
-      {
-        geometry_msgs::Point32 point;
-        point.x = wpx;
-        point.y = wpy;
-        point.z = wpz;
-        clearing_endpoints_.points.push_back(point);
-      }
+    if (publish_clearing_points)
+    {
+      geometry_msgs::Point32 point;
+      point.x = target.wx;
+      point.y = target.wy;
+      point.z = target.wz;
+      clearing_endpoints_.points.push_back(point);
     }
   }
 
@@ -406,61 +542,76 @@ void VoxelLayer::raytraceFreespace(const Observation& clearing_observation, doub
   }
 }
 
-void VoxelLayer::updateOrigin(double new_origin_x, double new_origin_y)
+namespace {
+
+// Number of lines whose voxels are collected before they are applied, bounds the memory of the collected voxels.
+const int kClearingBatch = 4096;
+
+}  // namespace
+
+void VoxelLayer::clearVoxelLines(double sensor_x, double sensor_y, double sensor_z, unsigned int max_length,
+                                 int num_threads)
 {
-  // project the new origin into the grid
-  int cell_ox, cell_oy;
-  cell_ox = int((new_origin_x - origin_x_) / resolution_);
-  cell_oy = int((new_origin_y - origin_y_) / resolution_);
-
-  // compute the associated world coordinates for the origin cell
-  // beacuase we want to keep things grid-aligned
-  double new_grid_ox, new_grid_oy;
-  new_grid_ox = origin_x_ + cell_ox * resolution_;
-  new_grid_oy = origin_y_ + cell_oy * resolution_;
-
-  // To save casting from unsigned int to int a bunch of times
-  int size_x = size_x_;
-  int size_y = size_y_;
-
-  // we need to compute the overlap of the new and existing windows
-  int lower_left_x, lower_left_y, upper_right_x, upper_right_y;
-  lower_left_x = std::min(std::max(cell_ox, 0), size_x);
-  lower_left_y = std::min(std::max(cell_oy, 0), size_y);
-  upper_right_x = std::min(std::max(cell_ox + size_x, 0), size_x);
-  upper_right_y = std::min(std::max(cell_oy + size_y, 0), size_y);
-
-  unsigned int cell_size_x = upper_right_x - lower_left_x;
-  unsigned int cell_size_y = upper_right_y - lower_left_y;
-
-  // we need a map to store the obstacles in the window temporarily
-  unsigned char* local_map = new unsigned char[cell_size_x * cell_size_y];
-  unsigned int* local_voxel_map = new unsigned int[cell_size_x * cell_size_y];
-  unsigned int* voxel_map = voxel_grid_.getData();
-
-  // copy the local window in the costmap to the local map
-  copyMapRegion(costmap_, lower_left_x, lower_left_y, size_x_, local_map, 0, 0, cell_size_x, cell_size_x, cell_size_y);
-  copyMapRegion(voxel_map, lower_left_x, lower_left_y, size_x_, local_voxel_map, 0, 0, cell_size_x, cell_size_x,
-                cell_size_y);
-
-  // we'll reset our maps to unknown space if appropriate
-  resetMaps();
+  uint32_t* data = voxel_grid_.getData();
+  const int num_targets = raytrace_targets_.size();
+  cleared_voxels_.resize(num_threads * num_threads);
 
-  // update the origin with the appropriate world coordinates
-  origin_x_ = new_grid_ox;
-  origin_y_ = new_grid_oy;
+  for (int begin = 0; begin < num_targets; begin += kClearingBatch)
+  {
+    const int end = std::min(begin + kClearingBatch, num_targets);
 
-  // compute the starting cell location for copying data back in
-  int start_x = lower_left_x - cell_ox;
-  int start_y = lower_left_y - cell_oy;
+#pragma omp parallel num_threads(num_threads)
+    {
+#ifdef _OPENMP
+      const int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+#else
+      const int thread = 0, threads = 1;
+#endif
+      // the thread collects the voxels of its chunk of lines, split by stripe of rows
+      const unsigned int stripe_cells = ((size_y_ + threads - 1) / threads) * size_x_;
+      std::vector<ClearedVoxel>* stripes = &cleared_voxels_[thread * num_threads];
+      for (int s = 0; s < threads; ++s)
+        stripes[s].clear();
+
+      CollectVoxels collect(stripes, stripe_cells);
+      const int chunk = (end - begin + threads - 1) / threads;
+      const int chunk_end = std::min(end, begin + (thread + 1) * chunk);
+      for (int i = begin + thread * chunk; i < chunk_end; ++i)
+      {
+        const RaytraceTarget& target = raytrace_targets_[i];
+        if (target.valid)
+          voxel_grid_.raytraceLine(collect, sensor_x, sensor_y, sensor_z, target.mx, target.my, target.mz,
+                                   max_length);
+      }
+
+#pragma omp barrier
 
-  // now we want to copy the overlapping information back into the map, but in its new location
-  copyMapRegion(local_map, 0, 0, cell_size_x, costmap_, start_x, start_y, size_x_, cell_size_x, cell_size_y);
-  copyMapRegion(local_voxel_map, 0, 0, cell_size_x, voxel_map, start_x, start_y, size_x_, cell_size_x, cell_size_y);
+      // then it clears the voxels of its stripe chunk after chunk, the same updates as voxel_grid::ClearVoxelInMap
+      for (int t = 0; t < threads; ++t)
+      {
+        const std::vector<ClearedVoxel>& voxels = cleared_voxels_[t * num_threads + thread];
+        for (unsigned int k = 0; k < voxels.size(); ++k)
+        {
+          uint32_t* column = data + voxels[k].offset;
+          *column &= ~voxels[k].z_mask;
+          unsigned int unknown_bits = uint16_t(*column >> 16) ^ uint16_t(*column);
+          unsigned int marked_bits = *column >> 16;
+          if (__builtin_popcount(marked_bits) <= (int)mark_threshold_)
+            costmap_[voxels[k].offset] =
+                __builtin_popcount(unknown_bits) <= (int)unknown_threshold_ ? FREE_SPACE : NO_INFORMATION;
+        }
+      }
+    }
+  }
+}
 
-  // make sure to clean up
-  delete[] local_map;
-  delete[] local_voxel_map;
+void VoxelLayer::shiftMaps(int dx, int dy)
+{
+  ObstacleLayer::shiftMaps(dx, dy);
+  // the exposed columns are unknown, as after voxel_grid_.reset()
+  const uint32_t unknown_column = ~((uint32_t)0) >> 16;
+  costmap::shiftGrid(voxel_grid_.getData(), size_x_, size_y_, dx, dy, unknown_column);
+  published_columns_valid_ = false;
 }
 
 }  // namespace costmap_2d
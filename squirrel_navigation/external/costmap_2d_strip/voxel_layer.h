@@ -57,13 +57,18 @@
 #include <costmap_2d/VoxelPluginConfig.h>
 #include <voxel_grid/voxel_grid.h>
 
+#include "squirrel_navigation/utils/costmap_utils.h"
+
+#include <squirrel_threading/memory_budget.h>
+
 namespace squirrel_navigation {
 
 class VoxelLayer : public ObstacleLayer
 {
 public:
   VoxelLayer() :
-      voxel_grid_(0, 0, 0)
+      memory_pressure_(squirrel_threading::MemoryPressure::NONE), memory_throttle_factor_(5.0), voxel_grid_(0, 0, 0),
+      published_columns_valid_(false), dirty_min_i_(0), dirty_min_j_(0), dirty_max_i_(0), dirty_max_j_(0)
   {
     costmap_ = NULL;  // this is the unsigned char* member of parent class's parent class Costmap2D.
   }
@@ -74,41 +79,128 @@ public:
   virtual void updateBounds(double robot_x, double robot_y, double robot_yaw, double* min_x, double* min_y,
                             double* max_x, double* max_y);
 
-  void updateOrigin(double new_origin_x, double new_origin_y);
   bool isDiscretized()
   {
     return true;
   }
   virtual void matchSize();
   virtual void reset();
+  // Free the cells [min_i, max_i) of row j and their voxel columns.
+  virtual void clearRow(unsigned int j, unsigned int min_i, unsigned int max_i);
 
-  const std::set<unsigned int>& floorIndices() const
+  const std::vector<unsigned int>& floorIndices() const
   {
-    return floor_indices_;
+    return floor_marks_.indices();
   }
 
+  /**
+   * @brief  Bytes held by the voxel grid, the costs and the publishing buffers
+   */
+  size_t memoryUsage() const;
+
+  /**
+   * @brief  Under soft memory pressure only the whole voxel grid is published, memory_throttle_factor times less
+   * often, under hard pressure nothing is published and the publishing buffers are released
+   */
+  void setMemoryPressure(squirrel_threading::MemoryPressure pressure);
+
 protected:
   virtual void setupDynamicReconfigure(ros::NodeHandle& nh);
 
   virtual void resetMaps();
 
+  /**
+   * @brief  Shift the voxel columns with the costs, the exposed columns are reset
+   */
+  virtual void shiftMaps(int dx, int dy);
+
+  // The voxel columns are only marked and cleared from clouds.
+  virtual bool nativeScansSupported() const
+  {
+    return false;
+  }
+
 private:
   void reconfigureCB(costmap_2d::VoxelPluginConfig &config, uint32_t level);
   void clearNonLethal(double wx, double wy, double w_size_x, double w_size_y, bool clear_no_info);
   virtual void raytraceFreespace(const costmap_2d::Observation& clearing_observation, double* min_x, double* min_y,
                                  double* max_x, double* max_y);
 
+  /**
+   * @brief  Clear the lines to the valid raytrace targets in parallel, as clearVoxelLineInMap does in target order.
+   * The voxels of each batch of lines are collected concurrently in chunks, then each thread applies the voxels of
+   * one stripe of map rows chunk after chunk, so every column is cleared in the serial order
+   */
+  void clearVoxelLines(double sensor_x, double sensor_y, double sensor_z, unsigned int max_length, int num_threads);
+
+  /**
+   * @brief  Publish the whole voxel grid at most at voxel_grid_rate, and in between the window of the columns
+   * changed since the last publication. The changes are searched within the bounds of the update and the rows
+   * cleared since the last one
+   */
+  void publishVoxelGrid(double min_x, double min_y, double max_x, double max_y);
+  void expandDirtyWindow(unsigned int min_i, unsigned int min_j, unsigned int max_i, unsigned int max_j);
+
   dynamic_reconfigure::Server<costmap_2d::VoxelPluginConfig> *voxel_dsrv_;
 
   bool publish_voxel_;
-  ros::Publisher voxel_pub_;
+  ros::Publisher voxel_pub_, voxel_updates_pub_;
+  double voxel_grid_period_;
+  ros::Time last_voxel_grid_;
+  squirrel_threading::MemoryPressure memory_pressure_;
+  double memory_throttle_factor_;
+  // messages reused across the publications, and the columns as last published
+  costmap_2d::VoxelGrid grid_msg_, grid_update_msg_;
+  std::vector<unsigned int> published_columns_;
+  bool published_columns_valid_;
+  // window of the columns that may have changed since the last publication, max exclusive
+  unsigned int dirty_min_i_, dirty_min_j_, dirty_max_i_, dirty_max_j_;
   voxel_grid::VoxelGrid voxel_grid_;
   double z_resolution_, origin_z_;
   unsigned int unknown_threshold_, mark_threshold_, size_z_;
   ros::Publisher clearing_endpoints_pub_;
   sensor_msgs::PointCloud clearing_endpoints_;
   double floor_threshold_;
-  std::set<unsigned int> floor_indices_;
+  // cells marked by the current update, cleared by advancing their epoch
+  costmap::CellMarks floor_marks_, obstacle_marks_;
+  std::vector<std::vector<unsigned int> > stripe_floor_cells_;
+
+  // clipped end point of a clearing ray, in world and map coordinates
+  struct RaytraceTarget
+  {
+    double wx, wy, wz, mx, my, mz;
+    bool valid;
+  };
+  std::vector<RaytraceTarget> raytrace_targets_;
+
+  // voxel crossed by a clearing line, by column offset and z mask as passed to the voxel grid actions
+  struct ClearedVoxel
+  {
+    unsigned int offset;
+    uint32_t z_mask;
+  };
+  // voxels of the lines of one chunk and one stripe, at chunk * num_threads + stripe
+  std::vector<std::vector<ClearedVoxel> > cleared_voxels_;
+
+  // voxel grid action collecting the voxels of a line into the buffer of the stripe of their row
+  class CollectVoxels
+  {
+  public:
+    CollectVoxels(std::vector<ClearedVoxel>* stripes, unsigned int stripe_cells)
+      : stripes_(stripes), stripe_cells_(stripe_cells)
+    {
+    }
+
+    inline void operator()(unsigned int offset, uint32_t z_mask)
+    {
+      ClearedVoxel voxel = { offset, z_mask };
+      stripes_[offset / stripe_cells_].push_back(voxel);
+    }
+
+  private:
+    std::vector<ClearedVoxel>* stripes_;
+    unsigned int stripe_cells_;
+  };
   
   inline bool worldToMap3DFloat(double wx, double wy, double wz, double& mx, double& my, double& mz)
   {
@@ -0,0 +1,153 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_CONTROLLER_MPC_H_
+#define SQUIRREL_NAVIGATION_CONTROLLER_MPC_H_
+
+#include "squirrel_navigation/ControllerMPCConfig.h"
+#include "squirrel_navigation/utils/controller.h"
+#include "squirrel_navigation/utils/motion_planner.h"
+
+#include <ros/publisher.h>
+#include <ros/time.h>
+
+#include <dynamic_reconfigure/server.h>
+
+#include <geometry_msgs/Pose.h>
+#include <geometry_msgs/Twist.h>
+
+#include <Eigen/Core>
+
+#include <memory>
+#include <string>
+
+namespace squirrel_navigation {
+
+// Model predictive controller on a kinematic model of the base. The inputs
+// are the velocities in robot frame, with zero lateral velocity for a
+// differential drive. The positions are linear in the inputs once the
+// headings are fixed to the ones predicted by the previous solution, so
+// every cycle solves a box/disc constrained QP, warm started by the shifted
+// previous solution.
+class ControllerMPC : public utils::Controller {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    std::string global_frame_id;
+    bool omnidirectional;
+    double prediction_step;
+    double weight_position, weight_heading;
+    double weight_velocity, weight_smoothness;
+    double max_linear_velocity, max_angular_velocity;
+    int max_iterations;
+    bool visualize_topics;
+  };
+
+  // Number of steps of the prediction horizon.
+  static constexpr int kHorizon = 10;
+
+ public:
+  ControllerMPC();
+  ControllerMPC(const Params& params);
+  virtual ~ControllerMPC() {}
+
+  // Reset the controller.
+  void initialize(const std::string& name) override;
+  void reset(const ros::Time& start) override;
+
+  // Reference and constraints over the horizon.
+  void setMotionPlanner(const utils::MotionPlanner* motion_planner) override;
+  void setVelocityLimits(
+      double max_lin_velocity, double max_ang_velocity) override;
+
+  // Compute the first command of the optimal input sequence.
+  void computeCommand(
+      const ros::Time& stamp, const geometry_msgs::Pose& pose,
+      const geometry_msgs::Pose& ref_pose, const geometry_msgs::Twist& vel,
+      const geometry_msgs::Twist& ref_vel,
+      geometry_msgs::Twist* twist) override;
+
+  // Parameters' read/write utilities.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+ private:
+  static constexpr int kInputs = 3 * kHorizon;
+
+  typedef Eigen::Matrix<double, kInputs, kInputs> Hessian;
+  typedef Eigen::Matrix<double, kInputs, 1> Inputs;
+  typedef Eigen::Matrix<double, 3, kHorizon> States;
+
+  // Reconfigure the parameters.
+  void reconfigureCallback(ControllerMPCConfig& config, uint32_t level);
+
+  // Reference states and inputs over the horizon.
+  void sampleReferences(
+      const ros::Time& stamp, const Eigen::Vector3d& x0,
+      const geometry_msgs::Pose& ref_pose, const geometry_msgs::Twist& ref_vel);
+
+  // Condensed QP around the predicted headings, and its solution.
+  void buildProblem(const Eigen::Vector3d& x0);
+  void solveProblem();
+  void projectInputs(Inputs* u) const;
+
+  // Visualize the predicted states.
+  void publishPrediction(
+      const Eigen::Vector3d& x0, const ros::Time& stamp) const;
+
+ private:
+  Params params_;
+  std::unique_ptr<dynamic_reconfigure::Server<ControllerMPCConfig>> dsrv_;
+
+  const utils::MotionPlanner* motion_planner_;
+  double max_lin_velocity_, max_ang_velocity_;
+
+  // Problem data, allocated once with the controller.
+  Hessian H_;
+  Inputs g_, u_, u_ref_;
+  States refs_, ref_twists_;
+  Eigen::Matrix<double, kHorizon, 1> headings_;
+  Eigen::Vector3d last_cmd_;
+  bool warm_start_;
+
+  ros::Publisher prediction_pub_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_CONTROLLER_MPC_H_ */
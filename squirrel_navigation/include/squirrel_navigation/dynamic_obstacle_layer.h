@@ -0,0 +1,122 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_DYNAMIC_OBSTACLE_LAYER_H_
+#define SQUIRREL_NAVIGATION_DYNAMIC_OBSTACLE_LAYER_H_
+
+#include <ros/node_handle.h>
+#include <ros/subscriber.h>
+#include <ros/time.h>
+
+#include <costmap_2d/costmap_2d.h>
+
+#include <squirrel_dynamic_filter/DynamicObjects.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+namespace squirrel_navigation {
+
+// Predicted motion of the moving objects published by squirrel_dynamic_filter.
+// Every object is moved at its velocity over the horizon and a disc of its
+// radius, grown by radius_growth per second, is drawn every time_step. The
+// cost of a disc decreases linearly with its prediction time, from max_cost
+// now to none at the horizon, so the planners keep off the way of the
+// objects but may still cross it. The grid is aligned to the master grid and
+// redrawn at every update, the objects are assumed in the global frame.
+class DynamicObstacleLayer : public costmap_2d::Costmap2D {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    std::string objects_topic;
+    double horizon, time_step;
+    double radius_growth;
+    double max_age;
+    int max_cost;
+  };
+
+ public:
+  DynamicObstacleLayer();
+  DynamicObstacleLayer(const Params& params);
+  virtual ~DynamicObstacleLayer() {}
+
+  // Read the parameters in the namespace of the layer.
+  void initialize(const std::string& name);
+
+  // Subscribe to the objects while enabled.
+  void setEnabled(bool enabled);
+  inline bool enabled() const { return enabled_; }
+
+  // Clear the discs of the last update and draw the ones predicted from
+  // now, realigned to the master grid if it has moved. The bounds are
+  // expanded to both.
+  void updateBounds(
+      const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+      double* max_x, double* max_y);
+
+  unsigned char* costmap() { return costmap_; }
+
+  // Parameters read/write.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ private:
+  // Callback, the latest objects are kept for the next updates.
+  void objectsCallback(
+      const squirrel_dynamic_filter::DynamicObjects::ConstPtr& objects);
+
+  // Raise the cells whose center is within radius of (wx, wy) to cost, the
+  // drawn area is expanded by the disc.
+  void drawDisc(double wx, double wy, double radius, unsigned char cost);
+
+ private:
+  Params params_;
+  std::atomic<bool> enabled_;
+  ros::NodeHandle nh_;
+  ros::Subscriber objects_sub_;
+
+  squirrel_dynamic_filter::DynamicObjects::ConstPtr objects_;
+  std::mutex objects_mtx_;
+
+  // Cells [min, max) drawn by the last update, in world coordinates.
+  bool drawn_;
+  double drawn_min_x_, drawn_min_y_, drawn_max_x_, drawn_max_y_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_DYNAMIC_OBSTACLE_LAYER_H_ */
@@ -0,0 +1,127 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_FOOTPRINT_LAYER_H_
+#define SQUIRREL_NAVIGATION_FOOTPRINT_LAYER_H_
+
+#include "squirrel_navigation/FootprintLayerConfig.h"
+#include "squirrel_navigation/utils/cspace_map.h"
+
+#include <ros/subscriber.h>
+
+#include <dynamic_reconfigure/server.h>
+
+#include <costmap_2d/layer.h>
+
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/PolygonStamped.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+
+// Configuration space of the current footprint: the obstacles of the master
+// grid dilated by the footprint at num_headings headings. Cells where the
+// footprint collides at every heading are marked as inscribed obstacles, so
+// that a Dijkstra search respects the unfolded arm, the others cost
+// partial_cost times the fraction of blocked headings. The layer goes after
+// the obstacles and before the inflation. The footprint is the one of the
+// costmap until one is received on footprint_topic, a new footprint updates
+// the whole grid, otherwise the bounds are expanded by its radius.
+class FootprintLayer : public costmap_2d::Layer {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    std::string footprint_topic;
+    int num_headings;
+    int partial_cost;
+  };
+
+ public:
+  FootprintLayer();
+  FootprintLayer(const Params& params);
+  virtual ~FootprintLayer() {}
+
+  // Initialization function.
+  void onInitialize() override;
+
+  // Update the costmap.
+  void updateBounds(
+      double robot_x, double robot_y, double robot_yaw, double* min_x,
+      double* min_y, double* max_x, double* max_y) override;
+  void updateCosts(
+      costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i,
+      int max_j) override;
+
+  // Follow the size of the master grid and the footprint of the costmap.
+  void matchSize() override;
+  void onFootprintChanged() override;
+  void reset() override;
+
+  // Blocked headings of the cells, read with the costmap locked.
+  inline const costmap::CSpaceMap& cspace() const { return cspace_; }
+
+  // Parameters read/write.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ private:
+  void reconfigureCallback(FootprintLayerConfig& config, uint32_t level);
+  void footprintCallback(
+      const geometry_msgs::PolygonStamped::ConstPtr& footprint);
+
+ private:
+  Params params_;
+  std::unique_ptr<dynamic_reconfigure::Server<FootprintLayerConfig>> dsrv_;
+
+  costmap::CSpaceMap cspace_;
+  // Set when the dilation has to be recomputed over the whole grid.
+  bool full_update_;
+
+  // Last footprint received, rasterized by the next update.
+  std::vector<geometry_msgs::Point> footprint_;
+  bool footprint_received_, footprint_changed_;
+  std::mutex footprint_mtx_;
+
+  ros::Subscriber footprint_sub_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_FOOTPRINT_LAYER_H_ */
@@ -35,6 +35,7 @@
 #define SQUIRREL_NAVIGATION_FOOTPRINT_PLANNER_H_
 
 #include "squirrel_navigation/FootprintPlannerConfig.h"
+#include "squirrel_navigation/utils/footprint_utils.h"
 #include "squirrel_navigation/utils/sbpl_utils.h"
 
 #include <ros/console.h>
@@ -57,9 +58,14 @@
 #include <tf/tf.h>
 #include <tf/transform_listener.h>
 
+#include <squirrel_threading/trace_publisher.h>
+
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace squirrel_navigation {
@@ -74,14 +80,26 @@ class FootprintPlanner : public nav_core::BaseGlobalPlanner {
     bool forward_search;
     double max_planning_time;
     double initial_epsilon;
+    bool anytime_replanning;
+    bool shared_heuristic;
+    double segment_length;
     bool visualize_topics;
+    double footprints_spacing;
     bool verbose;
   };
 
+  // Plan to one of the goals of a batch, the cost is infinite if none has
+  // been found.
+  class Plan {
+   public:
+    std::vector<geometry_msgs::PoseStamped> waypoints;
+    double cost;
+  };
+
  public:
   FootprintPlanner();
   FootprintPlanner(const Params& params);
-  virtual ~FootprintPlanner() {}
+  virtual ~FootprintPlanner();
 
   // Initialize the internal observers.
   virtual void initialize(
@@ -93,6 +111,19 @@ class FootprintPlanner : public nav_core::BaseGlobalPlanner {
       const geometry_msgs::PoseStamped& goal,
       std::vector<geometry_msgs::PoseStamped>& waypoints) override;
 
+  // Plan on the cached distance field of the goal, without footprint.
+  bool makePlanOnDistanceField(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>& waypoints);
+
+  // Plan from the start to each goal, the searches run in parallel on
+  // copies of the environment. True if at least one plan has been found.
+  bool makePlans(
+      const geometry_msgs::PoseStamped& start,
+      const std::vector<geometry_msgs::PoseStamped>& goals,
+      std::vector<Plan>* plans);
+
   // Footprint getter.
   const std::vector<geometry_msgs::Point>& footprint() const;
 
@@ -112,7 +143,39 @@ class FootprintPlanner : public nav_core::BaseGlobalPlanner {
 
   // SBPL related stuff.
   void initializeSBPLPlanner();
+  bool createSBPLEnvironment(
+      std::unique_ptr<sbpl::NavigationEnvironment>* env,
+      std::unique_ptr<sbpl::Planner>* planner);
   void updateSBPLCostmap(const costmap_2d::Costmap2D& costmap);
+  bool pushCosts(
+      const costmap_2d::Costmap2D& costmap, sbpl::NavigationEnvironment* env,
+      sbpl::Planner* planner, std::vector<unsigned char>* snapshot,
+      std::vector<unsigned int>* changed_indices,
+      std::vector<sbpl::Cell>* changed_cells) const;
+  bool planToGoal(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal, sbpl::NavigationEnvironment* env,
+      sbpl::Planner* planner, Plan* plan);
+  bool updateDistanceField(const geometry_msgs::PoseStamped& goal);
+
+  // Two-level planning of long routes: the lattice search runs up to a goal
+  // segment_length along the route of the distance field, which is followed
+  // after it. False if the route is short or the segment is not found.
+  bool makeSegmentedPlan(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>* waypoints);
+  bool splitRoute(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      geometry_msgs::PoseStamped* segment_goal,
+      std::vector<geometry_msgs::PoseStamped>* route_tail);
+
+  // Anytime replanning: the session improves the plan in background until
+  // max_planning_time is spent or the optimal solution is found.
+  void startPlanImprovement();
+  void stopPlanImprovement();
+  void improvePlan();
 
   // Get inflation layer from costmap.
   boost::shared_ptr<costmap_2d::InflationLayer> getInflationLayer(
@@ -130,8 +193,10 @@ class FootprintPlanner : public nav_core::BaseGlobalPlanner {
  private:
   Params params_;
   std::unique_ptr<dynamic_reconfigure::Server<FootprintPlannerConfig>> dsrv_;
+  std::unique_ptr<squirrel_threading::tracing::TracePublisher> trace_publisher_;
 
-  visualization_msgs::Marker footprint_marker_;
+  // One LINE_LIST marker with all of the footprints of the path.
+  visualization_msgs::MarkerArray footprints_msg_;
   std::vector<geometry_msgs::Point> footprint_;
   double inscribed_radius_, circumscribed_radius_;
   costmap_2d::Costmap2DROS* costmap_ros_;
@@ -140,12 +205,40 @@ class FootprintPlanner : public nav_core::BaseGlobalPlanner {
   // sbpl stuff.
   std::unique_ptr<sbpl::NavigationEnvironment> sbpl_env_;
   std::unique_ptr<sbpl::Planner> sbpl_planner_;
+  // Costs pushed to the environment and the cells changed by the last push.
+  std::vector<unsigned char> sbpl_costmap_;
+  std::vector<unsigned int> changed_indices_;
+  std::vector<sbpl::Cell> changed_cells_;
+
+  // Goal distance field, valid for one goal and one version of the costs.
+  costmap::DistanceField distance_field_;
+  unsigned int costmap_version_;
+
+  // Planning session, keyed by the state of the goal.
+  int session_goal_id_;
+
+  // Environments of the last footprints, with the swept cells of the motion
+  // primitives already precomputed. Swapped in when the footprint returns.
+  struct SBPLEnvironment {
+    size_t key;
+    std::unique_ptr<sbpl::NavigationEnvironment> env;
+    std::unique_ptr<sbpl::Planner> planner;
+    std::vector<unsigned char> costmap;
+    int goal_id;
+  };
+  std::deque<SBPLEnvironment> sbpl_cache_;
+  size_t sbpl_key_;
+  int max_cached_footprints_;
+  bool sbpl_cache_invalid_;
+  // Copies of the current environment for the parallel batch searches.
+  std::vector<SBPLEnvironment> batch_environments_;
+  int batch_threads_;
+  std::thread improvement_thread_;
+  std::atomic<bool> stop_improvement_;
 
   ros::Subscriber footprint_sub_;
   ros::Publisher plan_pub_, waypoints_pub_, footprints_pub_;
 
-  int last_nwaypoints_;
-
   std::string motion_primitives_url_;
 
   bool init_;
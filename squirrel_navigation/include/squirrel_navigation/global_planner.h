@@ -35,7 +35,10 @@
 #define SQUIRREL_NAVIGATION_GLOBAL_PLANNER_H_
 
 #include "squirrel_navigation/GlobalPlannerConfig.h"
+#include "squirrel_navigation/footprint_layer.h"
 #include "squirrel_navigation/footprint_planner.h"
+#include "squirrel_navigation/utils/collision_checker.h"
+#include "squirrel_navigation/utils/distance_field.h"
 
 #include <ros/publisher.h>
 #include <ros/subscriber.h>
@@ -52,9 +55,13 @@
 #include <geometry_msgs/PoseStamped.h>
 #include <nav_msgs/Path.h>
 #include <std_msgs/Bool.h>
+#include <visualization_msgs/MarkerArray.h>
 
+#include <array>
+#include <deque>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace squirrel_navigation {
@@ -67,9 +74,21 @@ class GlobalPlanner : public nav_core::BaseGlobalPlanner {
 
     bool plan_with_footprint;
     bool plan_with_constant_heading;
+    bool dijkstra_with_footprint_layer;
     bool visualize_topics;
+    double footprints_spacing;
     double heading;
     bool verbose;
+    int route_cache_size;
+    double route_cache_position_tolerance, route_cache_heading_tolerance;
+    double route_repair_margin, max_repaired_fraction;
+  };
+
+  typedef FootprintPlanner::Plan Plan;
+
+  // Counts of the route cache since the initialization.
+  struct RouteCacheStats {
+    unsigned long hits, repairs, misses, failed_repairs, evictions;
   };
 
  public:
@@ -87,6 +106,21 @@ class GlobalPlanner : public nav_core::BaseGlobalPlanner {
       const geometry_msgs::PoseStamped& goal,
       std::vector<geometry_msgs::PoseStamped>& waypoints) override;
 
+  // Compute the paths from the start to each goal together with their costs,
+  // e.g. to pick the cheapest of several candidate poses. Without footprint
+  // one Dijkstra search from the start serves all of the goals. Costs are
+  // comparable only within a batch.
+  bool makePlans(
+      const geometry_msgs::PoseStamped& start,
+      const std::vector<geometry_msgs::PoseStamped>& goals,
+      std::vector<Plan>* plans);
+
+  inline const RouteCacheStats& routeCacheStats() const {
+    return cache_stats_;
+  }
+  // Drop the cached routes, e.g. when the map changes.
+  void clearRouteCache();
+
   // Parameters read/write utilities.
   inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
@@ -95,6 +129,51 @@ class GlobalPlanner : public nav_core::BaseGlobalPlanner {
  private:
   // Callbacks.
   void reconfigureCallback(GlobalPlannerConfig& config, uint32_t level);
+  void planWithFootprintCallback(const std_msgs::Bool::ConstPtr& msg);
+
+  // Plan from scratch with the planners selected by the parameters.
+  bool computePlan(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>* waypoints);
+
+  // Route cache: the routes are keyed by the start and goal poses quantized
+  // to the tolerances, by the planning mode and by the footprint. A cached
+  // route is checked against the current costmap by a sweep of the
+  // footprint along it and only its blocked segments are replanned.
+  typedef std::array<long, 7> RouteKey;
+  RouteKey routeKey(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal) const;
+  // Take the cached route from start to goal, repaired if needed. False on
+  // a miss or if the repair fails.
+  bool lookupRoute(
+      const RouteKey& key, const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>* waypoints);
+  void storeRoute(
+      const RouteKey& key,
+      const std::vector<geometry_msgs::PoseStamped>& waypoints);
+  // Waypoint ranges [first, last] to replan, their ends are free waypoints
+  // at least route_repair_margin away from the blocked ones.
+  void findBlockedSegments(
+      const std::vector<geometry_msgs::PoseStamped>& waypoints,
+      std::vector<std::pair<int, int>>* segments);
+  // Whether the robot collides at a pose of the current costmap.
+  bool poseBlocked(double x, double y, double yaw) const;
+  void publishRouteCacheStats() const;
+
+  // Set the headings of a 2D path according to the parameters.
+  void setWaypointsHeading(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>* waypoints) const;
+  // Set the headings of a 2D path free in the configuration space of the
+  // footprint layer. False if there are none.
+  bool setWaypointsHeadingInCSpace(
+      const geometry_msgs::PoseStamped& start,
+      const geometry_msgs::PoseStamped& goal,
+      std::vector<geometry_msgs::PoseStamped>* waypoints) const;
   
   // Publishing utilities.
   void publishPlan(
@@ -113,12 +192,30 @@ class GlobalPlanner : public nav_core::BaseGlobalPlanner {
 
   std::unique_ptr<navfn::NavfnROS> dijkstra_planner_;
   std::unique_ptr<FootprintPlanner> footprint_planner_;
+  // Configuration space of the footprint, if the costmap has the layer.
+  boost::shared_ptr<FootprintLayer> footprint_layer_;
+
+  // Cost-to-start field of the batch planning without footprint.
+  costmap::DistanceField batch_field_;
 
-  ros::Publisher plan_pub_, waypoints_pub_, footprints_pub_;
+  struct CachedRoute {
+    RouteKey key;
+    std::vector<geometry_msgs::PoseStamped> waypoints;
+  };
+  // Least recently used first.
+  std::deque<CachedRoute> route_cache_;
+  RouteCacheStats cache_stats_;
+  // Footprint sweep in the lethal cells of the costmap, rebuilt when the
+  // footprint or the resolution change.
+  footprint::CollisionChecker route_checker_;
+  size_t route_checker_key_;
+
+  ros::Publisher plan_pub_, waypoints_pub_, footprints_pub_, route_cache_pub_;
+  // State of the arm published by the arm folding observer.
+  ros::Subscriber plan_with_footprint_sub_;
+  visualization_msgs::MarkerArray footprints_msg_;
   
   bool init_;
-  
-  int last_nwaypoints_;
 
   costmap_2d::Costmap2DROS* costmap_ros_;
 };
@@ -72,8 +72,14 @@ class LinearMotionPlanner : public utils::MotionPlanner {
   };
 
  public:
-  LinearMotionPlanner() : params_(Params::defaultParams()) { init_ = false; }
-  LinearMotionPlanner(const Params& params) : params_(params) { init_ = false; }
+  LinearMotionPlanner()
+      : params_(Params::defaultParams()), heading_waypoint_(0) {
+    init_ = false;
+  }
+  LinearMotionPlanner(const Params& params)
+      : params_(params), heading_waypoint_(0) {
+    init_ = false;
+  }
   virtual ~LinearMotionPlanner() {}
 
   // Create/update a new motion trajectory.
@@ -89,16 +95,19 @@ class LinearMotionPlanner : public utils::MotionPlanner {
   void computeReference(
       const ros::Time& stamp, geometry_msgs::Pose* pose,
       geometry_msgs::Twist* twist) override;
+  void sampleReference(
+      const ros::Time& stamp, geometry_msgs::Pose* pose,
+      geometry_msgs::Twist* twist) const override;
 
   // Get the forward trajectory.
-  std::vector<geometry_msgs::PoseStamped> trajectory() const override;
+  utils::Trajectory::View trajectory() const override;
 
   // Waypoint(s) getters.
-  const std::vector<geometry_msgs::PoseStamped>& waypoints() const override;
+  utils::Trajectory::View waypoints() const override;
 
   // Get start/goal.
-  const geometry_msgs::PoseStamped& start() const;
-  const geometry_msgs::PoseStamped& goal() const;
+  geometry_msgs::PoseStamped start() const;
+  geometry_msgs::PoseStamped goal() const;
 
   // Mutex getter.
   inline std::mutex& mutex() const { return update_mtx_; }
@@ -113,16 +122,15 @@ class LinearMotionPlanner : public utils::MotionPlanner {
   void reconfigureCallback(LinearMotionPlannerConfig& config, uint32_t level);
 
   // Compute next waypoint.
-  std::vector<geometry_msgs::PoseStamped>::const_iterator
-      computeHeadingWaypoint(const ros::Time& stamp) const;
   int computeHeadingWaypointIndex(const ros::Time& stamp) const;
+  int computeReferenceWaypointIndex(double stamp) const;
+  void interpolateReference(
+      int next_waypoint, double stamp, geometry_msgs::Pose* pose,
+      geometry_msgs::Twist* twist) const;
 
-  // Smooth up the planned trajectory.
-  void smoothTrajectory(
-      const std::vector<geometry_msgs::PoseStamped>& waypoints, int begin,
-      int end, std::vector<geometry_msgs::PoseStamped>* smooth_waypoints) const;
-  void smoothTrajectoryInPlace(
-      int begin, int end, std::vector<geometry_msgs::PoseStamped>* waypoints);
+  // Smooth up the planned trajectory and compute the velocity profile.
+  void smoothTrajectoryInPlace(int begin, int end);
+  void computeTimeProfile(int begin);
 
   // Define the velocity profile.
   double computeSafetyVelocity(double linear_delta, double angular_delta) const;
@@ -131,10 +139,14 @@ class LinearMotionPlanner : public utils::MotionPlanner {
   Params params_;
   std::unique_ptr<dynamic_reconfigure::Server<LinearMotionPlannerConfig>> dsrv_;
 
-  std::vector<geometry_msgs::PoseStamped>::const_iterator heading_waypoint_;
-  std::vector<geometry_msgs::PoseStamped> waypoints_;
+  // Index of the heading waypoint and the trajectory.
+  int heading_waypoint_;
+  utils::Trajectory waypoints_;
+  std::string frame_id_;
 
   mutable std::mutex update_mtx_;
+
+  static constexpr int kMaxCursorSteps = 8;
 };
 
 }  // namespace squirrel_navigation
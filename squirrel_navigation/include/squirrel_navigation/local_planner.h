@@ -35,15 +35,21 @@
 #define SQUIRREL_NAVIGATION_LOCAL_PLANNER_H_
 
 #include "squirrel_navigation/LocalPlannerConfig.h"
+#include "squirrel_navigation/controller_mpc.h"
 #include "squirrel_navigation/controller_pid.h"
 #include "squirrel_navigation/linear_motion_planner.h"
+#include "squirrel_navigation/navigation_layer.h"
 #include "squirrel_navigation/safety/scan_observer.h"
+#include "squirrel_navigation/utils/collision_checker.h"
+#include "squirrel_navigation/utils/math_utils.h"
+#include "squirrel_navigation/utils/obstacle_index.h"
+#include <squirrel_threading/thread_policy.h>
 
 #include <ros/console.h>
 #include <ros/publisher.h>
 #include <ros/subscriber.h>
+#include <ros/time.h>
 
-#include <base_local_planner/costmap_model.h>
 #include <costmap_2d/costmap_2d_ros.h>
 #include <nav_core/base_local_planner.h>
 
@@ -56,14 +62,18 @@
 #include <nav_msgs/Odometry.h>
 #include <squirrel_navigation_msgs/BrakeRobot.h>
 #include <std_srvs/Empty.h>
+#include <visualization_msgs/MarkerArray.h>
 
 #include <dynamic_reconfigure/server.h>
 
 #include <tf/tf.h>
 #include <tf/transform_listener.h>
 
+#include <atomic>
+#include <deque>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace squirrel_navigation {
@@ -75,6 +85,7 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
     static Params defaultParams();
 
     std::string odom_topic, footprint_topic;
+    std::string controller;
     double goal_ang_tolerance, goal_lin_tolerance;
     double max_safe_lin_velocity, max_safe_ang_velocity;
     double max_safe_lin_displacement, max_safe_ang_displacement;
@@ -82,21 +93,27 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
     bool collision_based_replanning;
     double replanning_lin_lookahead, replanning_ang_lookahead;
     double replanning_path_length_ratio;
+    bool clearance_based_velocity;
+    double min_safe_lin_velocity, clearance_slowdown_distance;
+    double control_frequency, control_timeout;
     bool visualize_topics;
+    double footprints_spacing;
     bool verbose;
   };
 
  public:
-  LocalPlanner() : params_(Params::defaultParams()), init_(false) {}
-  LocalPlanner(const Params& params) : params_(params), init_(false) {}
-  virtual ~LocalPlanner() {}
+  LocalPlanner();
+  LocalPlanner(const Params& params);
+  virtual ~LocalPlanner();
 
   // Initialization with full map/costmap structure.
   void initialize(
       std::string name, tf::TransformListener* tfl,
       costmap_2d::Costmap2DROS* costmap_ros) override;
 
-  // Compute velocity commands to input in the robot.
+  // Compute velocity commands to input in the robot. With a control
+  // frequency the commands come from the control thread, here the
+  // trajectory is only checked.
   bool computeVelocityCommands(geometry_msgs::Twist& cmd) override;
 
   // Check accomplishment of goal reaching task.
@@ -134,6 +151,10 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
   void odomCallback(const nav_msgs::Odometry::ConstPtr& odom);
   void reconfigureCallback(LocalPlannerConfig& config, uint32_t level);
 
+  // Swap in the collision checker of the current footprint, from the cache
+  // or computed again. The check mutex has to be held.
+  void swapCollisionChecker(double resolution);
+
   bool brakeRobotCallback(
       squirrel_navigation_msgs::BrakeRobot::Request& req,
       squirrel_navigation_msgs::BrakeRobot::Response& res);
@@ -157,19 +178,34 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
       const geometry_msgs::Twist& map_twist,
       geometry_msgs::Twist* robot_twist) const;
   void safeVelocityCommands(
-      const geometry_msgs::Twist& twist,
+      const geometry_msgs::Twist& twist, double clearance,
       geometry_msgs::Twist* safe_twist) const;
+  // Velocity caps, scaled by the speed-limit zones ahead.
+  double maxSafeLinVelocity(double clearance) const;
+  double maxSafeAngVelocity() const;
   
-  // Check if path is collision free.
+  // Check if path is collision free, the lowest velocity scale of the
+  // speed-limit zones on the lookahead is returned with the clearance.
   bool isTrajectorySafe(
-      const std::vector<geometry_msgs::PoseStamped>& waypoints) const;
+      const utils::Trajectory::View& waypoints, double* clearance,
+      double* speed_scale);
+
+  // Distance transform of the local costmap and clearance of the footprint.
+  void updateClearanceIndex();
+  double footprintClearance(unsigned int cell_x, unsigned int cell_y) const;
   bool needReplanning(
-      const std::vector<geometry_msgs::PoseStamped>& old_waypoints,
+      const utils::Trajectory::View& old_waypoints,
       const std::vector<geometry_msgs::PoseStamped>& new_waypoints) const;
 
   // Check if a new goal is input.
   bool newGoal(const geometry_msgs::Pose& pose) const;
 
+  // Control thread, running the controller at the control frequency while
+  // the collision check of computeVelocityCommands is recent and passed.
+  bool checkControlLoop(geometry_msgs::Twist* cmd);
+  void controlLoop();
+  bool controlStep(geometry_msgs::Twist* cmd);
+
  private:
   Params params_;
   std::unique_ptr<dynamic_reconfigure::Server<LocalPlannerConfig>> dsrv_;
@@ -183,9 +219,13 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
 
   geometry_msgs::TwistStamped robot_twist_;
   geometry_msgs::PoseStamped robot_pose_;
+  // Robot pose with the heading resolved, updated with the odometry.
+  math::Pose2D robot_pose_2d_;
   std::unique_ptr<geometry_msgs::Pose> current_goal_;
   std::shared_ptr<tf::TransformListener> tfl_;
   std::shared_ptr<costmap_2d::Costmap2DROS> costmap_ros_;
+  // Speed-limit zones of the costmap, if it has the layer.
+  boost::shared_ptr<NavigationLayer> navigation_layer_;
 
   ros::Publisher ref_pub_, traj_pub_, footprints_pub_, cmd_pub_;
   ros::Subscriber odom_sub_, footprint_sub_;
@@ -193,17 +233,45 @@ class LocalPlanner : public nav_core::BaseLocalPlanner {
 
   std::vector<geometry_msgs::Point> footprint_;
   double inscribed_radius_, circumscribed_radius_;
-  std::unique_ptr<base_local_planner::CostmapModel> costmap_model_;
+  footprint::CollisionChecker collision_checker_;
+  // Collision checkers of the last footprints, keyed by the footprint hash
+  // and swapped in when the footprint returns.
+  struct CachedChecker {
+    size_t key;
+    footprint::CollisionChecker checker;
+  };
+  size_t checker_key_;
+  std::deque<CachedChecker> checker_cache_;
+  int max_cached_footprints_;
+  costmap::ObstacleIndex clearance_index_;
+  double index_origin_x_, index_origin_y_;
 
-  int last_nwaypoints_;
+  visualization_msgs::MarkerArray footprints_msg_;
   
   bool init_;
 
   BaseBrake base_brake_;
 
+  // Control thread, its inputs are guarded by the state mutex. It runs with
+  // the affinity and the priority of its own thread policy.
+  std::thread control_thread_;
+  squirrel_threading::ThreadPolicy control_policy_;
+  std::atomic<bool> stop_control_;
+  bool control_enabled_;
+  double control_clearance_;
+  // Velocity scale of the zones, guarded by the state mutex.
+  double speed_scale_;
+  ros::WallTime last_check_;
+  geometry_msgs::Twist control_cmd_;
+  ros::Publisher cmd_vel_pub_;
+  // Copy of the trajectory for the collision check outside the state mutex.
+  utils::Trajectory trajectory_snapshot_;
+
   static constexpr double kShortPathsReplanningTolerance = 0.2;
   
   mutable std::mutex state_mtx_;
+  // Footprint, collision checker and clearance index.
+  mutable std::mutex check_mtx_;
 };
 
 }  // namespace squirrel_navigation
@@ -36,6 +36,7 @@
 
 #include "squirrel_navigation/NavigationLayerConfig.h"
 
+#include <ros/publisher.h>
 #include <ros/service.h>
 
 #include <dynamic_reconfigure/server.h>
@@ -46,12 +47,25 @@
 #include <costmap_2d_strip/static_layer.h>
 #include <costmap_2d_strip/voxel_layer.h>
 
+#include <geometry_msgs/Polygon.h>
+#include <std_msgs/Header.h>
+
 #include <squirrel_navigation_msgs/ClearCostmapRegion.h>
 #include <squirrel_navigation_msgs/GetObstaclesMap.h>
 #include <squirrel_navigation_msgs/GetPathClearance.h>
 
+#include "squirrel_navigation/dynamic_obstacle_layer.h"
+#include "squirrel_navigation/projected_map_layer.h"
+#include "squirrel_navigation/zones_layer.h"
+#include "squirrel_navigation/utils/obstacle_index.h"
+#include "squirrel_navigation/utils/worker_thread.h"
+
+#include <squirrel_threading/memory_budget_publisher.h>
+#include <squirrel_threading/trace_publisher.h>
+
 #include <memory>
 #include <mutex>
+#include <vector>
 
 namespace squirrel_navigation {
 
@@ -61,12 +75,26 @@ class NavigationLayer : public costmap_2d::CostmapLayer {
    public:
     static Params defaultParams();
 
-    bool use_kinect, use_laser_scan;
+    bool use_kinect, use_laser_scan, use_octomap, use_dynamic_obstacles;
+    bool use_zones;
+    bool parallel_updates;
   };
 
  public:
-  NavigationLayer() : params_(Params::defaultParams()) {}
-  NavigationLayer(const Params& params) : params_(params) {}
+  NavigationLayer()
+      : params_(Params::defaultParams()),
+        merge_octomap_(false),
+        merge_dynamic_(false),
+        merge_zones_(false),
+        index_origin_x_(0.),
+        index_origin_y_(0.) {}
+  NavigationLayer(const Params& params)
+      : params_(params),
+        merge_octomap_(false),
+        merge_dynamic_(false),
+        merge_zones_(false),
+        index_origin_x_(0.),
+        index_origin_y_(0.) {}
   virtual ~NavigationLayer() {}
 
   // Initialization function.
@@ -85,6 +113,12 @@ class NavigationLayer : public costmap_2d::CostmapLayer {
   void deactivate();
   void reset();
 
+  // Velocity scale of the speed-limit zones in a cell of the master grid, 1
+  // without zones.
+  inline double speedScale(unsigned int mx, unsigned int my) const {
+    return merge_zones_ ? zones_layer_.speedScale(mx, my) : 1.;
+  }
+
   // Whether the map is discrete or not.
   inline bool isDiscretized() { return true; }
 
@@ -109,30 +143,78 @@ class NavigationLayer : public costmap_2d::CostmapLayer {
       squirrel_navigation_msgs::GetPathClearance::Request& req,
       squirrel_navigation_msgs::GetPathClearance::Response& res);
 
-  // Compute the obstacle map.
+  // Compute the obstacle map from the obstacle index.
   size_t getObstaclesMap(
       std::vector<bool>* obstacles_indicator,
       std::vector<geometry_msgs::Point32>* obstacles_positions) const;
 
-  // Costs update and utilities.
-  void resetMasterCostmapLocally(
-      costmap_2d::Costmap2D& master_grid, unsigned int stride, int min_i,
-      int min_j, int max_i, int max_j);
+  // Clear the queued regions from the obstacle layers, the bounds are
+  // expanded to merge them into the master grid.
+  void clearPendingRegions(
+      double* min_x, double* min_y, double* max_x, double* max_y);
+
+  // Costs update: fused maximum of the layers into the master grid, the
+  // octomap, dynamic obstacle and zones costs are null if the layers are not
+  // used.
   void mergeCostmaps(
       unsigned char* laser_costmap, unsigned char* kinect_costmap,
-      unsigned char* static_costmap, unsigned int stride, int min_i, int min_j,
-      int max_i, int max_j);
+      unsigned char* octomap_costmap, unsigned char* dynamic_costmap,
+      unsigned char* zones_costmap, unsigned char* static_costmap,
+      unsigned char* master_costmap, unsigned int stride, int min_i,
+      int min_j, int max_i, int max_j);
+
+  // Forward a change of the memory pressure to the depth camera layer.
+  void updateMemoryPressure();
+
+  // Report the bytes of the layers and the obstacle index to the budget.
+  void reportMemoryUsage();
+
+  // Refresh the obstacle index within the updated bounds of the master grid.
+  void updateObstacleIndex(
+      const costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i,
+      int max_j);
 
  private:
   Params params_;
   std::unique_ptr<dynamic_reconfigure::Server<NavigationLayerConfig>> dsrv_;
+  std::unique_ptr<squirrel_threading::tracing::TracePublisher> trace_publisher_;
+
+  // Share of the process memory budget held by the layers and the index, the
+  // depth camera layer degrades its voxel grid under pressure.
+  std::unique_ptr<squirrel_threading::MemoryBudgetPublisher> memory_publisher_;
+  std::unique_ptr<squirrel_threading::MemoryBudget::Account> memory_account_;
+  squirrel_threading::MemoryPressure memory_pressure_;
 
   squirrel_navigation::ObstacleLayer laser_layer_;
   squirrel_navigation::VoxelLayer kinect_layer_;
   squirrel_navigation::StaticLayer static_layer_;
+  ProjectedMapLayer octomap_layer_;
+  bool merge_octomap_;
+  DynamicObstacleLayer dynamic_layer_;
+  bool merge_dynamic_;
+  ZonesLayer zones_layer_;
+  bool merge_zones_;
+
+  // Runs the laser layer update while the kinect layer updates in the
+  // calling thread.
+  utils::WorkerThread laser_worker_;
+
+  // Row of the depth camera costs merged with the octomap ones.
+  std::vector<unsigned char> merge_row_;
+
+  // Regions to clear at the next update, in world coordinates.
+  std::vector<geometry_msgs::Polygon> pending_regions_;
+  std::mutex clear_mtx_;
 
   ros::ServiceServer clear_costmap_srv_, obstacles_map_srv_,
       path_clearance_srv_;
+  // Stamp of the newest observation merged by each update, for the latency
+  // benchmark, published only with subscribers.
+  ros::Publisher observation_stamp_pub_;
+
+  // Nearest lethal cell of every cell of the master grid.
+  costmap::ObstacleIndex obstacle_index_;
+  double index_origin_x_, index_origin_y_;
 
   mutable std::mutex update_mtx_;
 };
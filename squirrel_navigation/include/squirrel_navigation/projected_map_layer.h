@@ -0,0 +1,124 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_PROJECTED_MAP_LAYER_H_
+#define SQUIRREL_NAVIGATION_PROJECTED_MAP_LAYER_H_
+
+#include <ros/node_handle.h>
+#include <ros/subscriber.h>
+
+#include <costmap_2d/costmap_2d.h>
+
+#include <map_msgs/OccupancyGridUpdate.h>
+#include <nav_msgs/OccupancyGrid.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+
+// Obstacles of the 3D map projected on the ground plane, as published by
+// squirrel_3d_mapping's OctomapServerMultilayer: full occupancy grids and
+// incremental patches on <map_topic>_updates. The grid is aligned to the
+// master grid and holds only lethal or free cells. The messages are taken
+// by shared pointer, when the mapping runs as a nodelet in the same process
+// they are not serialized. The map is assumed in the global frame.
+class ProjectedMapLayer : public costmap_2d::Costmap2D {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    std::string map_topic;
+    bool subscribe_to_updates;
+    int occupied_threshold;
+  };
+
+ public:
+  ProjectedMapLayer();
+  ProjectedMapLayer(const Params& params);
+  virtual ~ProjectedMapLayer() {}
+
+  // Read the parameters in the namespace of the layer.
+  void initialize(const std::string& name);
+
+  // Subscribe to the maps while enabled, the publisher sends a full map to
+  // new subscribers.
+  void setEnabled(bool enabled);
+  inline bool enabled() const { return enabled_; }
+
+  // Write the maps received since the last update into the grid, realigned
+  // to the master grid if it has moved. The bounds are expanded to the
+  // updated area.
+  void updateBounds(
+      const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+      double* max_x, double* max_y);
+
+  unsigned char* costmap() { return costmap_; }
+
+  // Parameters read/write.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ private:
+  // Callbacks, the messages are queued for the next update.
+  void mapCallback(const nav_msgs::OccupancyGrid::ConstPtr& map);
+  void mapUpdateCallback(const map_msgs::OccupancyGridUpdate::ConstPtr& update);
+
+  // Write the source cells [x0, x1) x [y0, y1) into the grid.
+  void render(int x0, int y0, int x1, int y1);
+
+ private:
+  Params params_;
+  std::atomic<bool> enabled_;
+  ros::NodeHandle nh_;
+  ros::Subscriber map_sub_, map_update_sub_;
+
+  // Received messages, a full map drops the patches queued before it.
+  nav_msgs::OccupancyGrid::ConstPtr pending_map_;
+  std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> pending_updates_;
+  std::mutex pending_mtx_;
+
+  // Last map with the patches applied, to realign when the grid moves.
+  nav_msgs::MapMetaData source_info_;
+  std::vector<int8_t> source_;
+  std::vector<int> source_columns_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_PROJECTED_MAP_LAYER_H_ */
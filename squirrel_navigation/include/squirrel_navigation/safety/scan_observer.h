@@ -50,9 +50,14 @@
 
 #include <dynamic_reconfigure/server.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace squirrel_navigation {
 namespace safety {
@@ -67,6 +72,7 @@ class ScanObserver : public Observer {
     std::string scan_topic;
     double max_safety_rangevel;
     double unsafe_range;
+    double diagnostics_rate;
     bool verbose;
     // Scan parameters.
     double scan_angle_increment;
@@ -75,14 +81,14 @@ class ScanObserver : public Observer {
   };
 
  public:
-  ScanObserver() : params_(Params::defaultParams()) { init_ = false; }
-  ScanObserver(const Params& params) : params_(params) { init_ = false; }
-  virtual ~ScanObserver() {}
+  ScanObserver();
+  ScanObserver(const Params& params);
+  virtual ~ScanObserver();
 
   // Initialize the internal observer.
   void initialize(const std::string& name);
 
-  // Query safety of the current scan.
+  // Query safety of the current scan, without locking.
   bool safe() const override;
 
   // Parameter read/write utilities.
@@ -104,7 +110,10 @@ class ScanObserver : public Observer {
   // Update the internal state.
   void updateState(const std::vector<float>& ranges, const ros::Time& stamp);
 
-  // Publish visualization markers.
+  // Publish visualization markers and the safety log, decimated in
+  // background on a snapshot of the state.
+  void publishDiagnostics();
+  bool unsafeBeam(int i) const;
   geometry_msgs::Pose computeMarkerPose(int i) const;
   double computeMarkerArrowLength(int i) const;
   void publishMarkers(const ros::Time& stamp) const;
@@ -117,6 +126,20 @@ class ScanObserver : public Observer {
   utils::AlphaBetaFilter ab_filter_;
 
   std::vector<float> ranges_, rangevelocities_;
+  ros::Time stamp_;
+
+  // Unsafe beams of the last scan, one bit per beam, and their number.
+  std::vector<uint64_t> unsafe_beams_;
+  std::atomic<int> num_unsafe_beams_;
+
+  // Snapshot of the state owned by the diagnostics thread.
+  std::vector<float> pub_ranges_, pub_rangevelocities_;
+  std::vector<uint64_t> pub_unsafe_beams_;
+  bool state_changed_;
+  std::thread publisher_thread_;
+  std::atomic<bool> stop_publisher_;
+  std::mutex publisher_mtx_;
+  std::condition_variable publisher_cv_;
 
   ros::Subscriber scan_sub_;
   ros::Publisher rangevels_pub_, safety_log_pub_;
@@ -0,0 +1,142 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_SAFETY_TIME_TO_COLLISION_OBSERVER_H_
+#define SQUIRREL_NAVIGATION_SAFETY_TIME_TO_COLLISION_OBSERVER_H_
+
+#include "squirrel_navigation/TimeToCollisionObserverConfig.h"
+#include "squirrel_navigation/safety/observer.h"
+#include "squirrel_navigation/utils/alpha_beta_filter.h"
+
+#include <ros/console.h>
+#include <ros/subscriber.h>
+
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/PolygonStamped.h>
+#include <geometry_msgs/Twist.h>
+#include <nav_msgs/Odometry.h>
+#include <sensor_msgs/LaserScan.h>
+
+#include <tf/transform_listener.h>
+
+#include <dynamic_reconfigure/server.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace safety {
+
+// Flags the beams whose obstacle would reach the footprint within
+// min_time_to_collision. The footprint distance along each beam is
+// precomputed, the closing rate is the largest between the filtered range
+// velocity and the motion of the footprint boundary along the beam.
+class TimeToCollisionObserver : public Observer {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    bool enabled;
+    std::string scan_topic, odom_topic, footprint_topic;
+    double min_time_to_collision;
+    double min_clearance;
+    bool verbose;
+  };
+
+ public:
+  TimeToCollisionObserver();
+  TimeToCollisionObserver(const Params& params);
+  virtual ~TimeToCollisionObserver() {}
+
+  // Initialize the internal observer.
+  void initialize(const std::string& name);
+
+  // Query safety of the current scan, without locking.
+  bool safe() const override;
+
+  // Parameter read/write utilities.
+  inline const Params& params() const { return params_; }
+  inline void setParams(const Params& params) { params_ = params; }
+  inline Params& params() { return params_; }
+
+ public:
+  static const std::string tag;
+
+ private:
+  // Callbacks.
+  void reconfigureCallback(
+      TimeToCollisionObserverConfig& config, uint32_t level);
+  void laserScanCallback(const sensor_msgs::LaserScan::ConstPtr& scan);
+  void odomCallback(const nav_msgs::Odometry::ConstPtr& odom);
+  void footprintCallback(
+      const geometry_msgs::PolygonStamped::ConstPtr& footprint);
+
+  // Beam directions and footprint boundary in robot frame.
+  bool updateBeams(const sensor_msgs::LaserScan& scan);
+
+ private:
+  Params params_;
+  std::unique_ptr<dynamic_reconfigure::Server<TimeToCollisionObserverConfig>>
+      dsrv_;
+
+  utils::AlphaBetaFilter ab_filter_;
+  std::vector<float> ranges_, rangevelocities_;
+
+  // Per beam: direction, footprint boundary point and its distance from the
+  // sensor, valid for the footprint and the scan angles below.
+  std::vector<float> beam_dx_, beam_dy_, boundary_x_, boundary_y_;
+  std::vector<float> boundary_distances_;
+  float scan_angle_min_, scan_angle_increment_;
+  bool beams_valid_;
+
+  std::vector<geometry_msgs::Point> footprint_;
+  std::string robot_frame_id_;
+  size_t footprint_key_;
+  geometry_msgs::Twist twist_;
+
+  std::atomic<int> num_unsafe_beams_;
+
+  std::unique_ptr<tf::TransformListener> tfl_;
+  ros::Subscriber scan_sub_, odom_sub_, footprint_sub_;
+
+  mutable std::mutex mtx_;
+};
+
+}  // namespace safety
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_SAFETY_TIME_TO_COLLISION_OBSERVER_H_ */
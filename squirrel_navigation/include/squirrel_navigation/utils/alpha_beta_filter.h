@@ -43,7 +43,9 @@
 #include <Eigen/Core>
 
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace squirrel_navigation {
 namespace utils {
@@ -73,6 +75,15 @@ class AlphaBetaFilter {
   Eigen::MatrixXf operator()(
       const std::vector<float>& x, const ros::Time& stamp);
 
+  // Apply the filter in place on caller-owned buffers of stateDimension()
+  // values, with a single pass over the measurements. Non-finite
+  // measurements are read as zero. The first call initializes the buffers.
+  void update(
+      const std::vector<float>& z, const ros::Time& stamp, float* x, float* v);
+
+  // Forget the state, the next update initializes it again.
+  void reset();
+
   // Parameter read/write utilities.
   inline const Params& params() const { return params_; }
   inline void setParams(const Params& params) { params_ = params; }
@@ -81,18 +92,16 @@ class AlphaBetaFilter {
  private:
   class State {
    public:
-    State(const Eigen::VectorXf& x0, const Eigen::VectorXf& v0, double t0);
+    State(const Eigen::VectorXf& x0, const Eigen::VectorXf& v0);
     State(const State& state) = default;
 
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
     Eigen::VectorXf x, v;
-    double t;
   };
 
  private:
   void reconfigureCallback(AlphaBetaFilterConfig& config, uint32_t level);
-  Eigen::VectorXf stdVectorToEigenVector(const std::vector<float>& x) const;
 
  private:
   Params params_;
@@ -100,6 +109,8 @@ class AlphaBetaFilter {
 
   size_t dim_;
   std::unique_ptr<State> state_;
+  bool has_state_;
+  double last_stamp_;
 
   bool init_;
 };
@@ -0,0 +1,102 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_COLLISION_CHECKER_H_
+#define SQUIRREL_NAVIGATION_UTILS_COLLISION_CHECKER_H_
+
+#include <geometry_msgs/Point.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace footprint {
+
+// Footprint collision checks against the lethal cells of a costmap. The
+// outline of the footprint is rasterized once per discretized heading, as
+// base_local_planner::CostmapModel does per query, and a pose is tested by
+// AND-ing the rows of its mask with a bitmap of the lethal and unknown
+// cells, 64 cells at a time.
+class CollisionChecker {
+ public:
+  static constexpr int kDefaultHeadings = 64;
+
+  CollisionChecker()
+      : nheadings_(0),
+        resolution_(0.),
+        size_x_(0),
+        size_y_(0),
+        words_per_row_(0) {}
+
+  // Precompute the masks of a footprint, without a polygon only the center
+  // cell is checked.
+  void setFootprint(
+      const std::vector<geometry_msgs::Point>& footprint, double resolution,
+      int nheadings = kDefaultHeadings);
+  inline double resolution() const { return resolution_; }
+
+  // Rebuild the bitmap of the lethal cells.
+  void updateCosts(const unsigned char* costs, int size_x, int size_y);
+
+  // Whether the footprint centered in a cell collides or leaves the map.
+  bool collides(int cell_x, int cell_y, double yaw) const;
+
+ private:
+  // Footprint cells of one heading, rows of 64-bit words starting at the
+  // offset (min_x, min_y) from the center cell.
+  struct Mask {
+    int min_x, min_y, width, height, words;
+    std::vector<uint64_t> bits;
+  };
+
+  // The 64 bitmap cells of a row starting at column x.
+  inline uint64_t bitmapWord(const uint64_t* row, int x) const {
+    const int word = x >> 6, shift = x & 63;
+    return shift ? (row[word] >> shift) | (row[word + 1] << (64 - shift))
+                 : row[word];
+  }
+
+  std::vector<Mask> masks_;
+  int nheadings_;
+  double resolution_;
+
+  // Lethal cells, each row padded with a word so that unaligned reads stay
+  // in the row.
+  std::vector<uint64_t> bitmap_;
+  int size_x_, size_y_, words_per_row_;
+};
+
+}  // namespace footprint
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_COLLISION_CHECKER_H_ */
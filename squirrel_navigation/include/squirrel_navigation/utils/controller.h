@@ -34,6 +34,8 @@
 #ifndef SQUIRREL_NAVIGATION_UTILS_CONTROLLER_H_
 #define SQUIRREL_NAVIGATION_UTILS_CONTROLLER_H_
 
+#include "squirrel_navigation/utils/motion_planner.h"
+
 #include <ros/time.h>
 
 #include <geometry_msgs/Pose.h>
@@ -56,6 +58,12 @@ class Controller {
       const geometry_msgs::Pose& ref_pose, const geometry_msgs::Twist& vel,
       const geometry_msgs::Twist& ref_vel, geometry_msgs::Twist* twist) = 0;
 
+  // Optional inputs of predictive controllers: the motion planner to sample
+  // the reference over the horizon and the current velocity bounds.
+  virtual void setMotionPlanner(const MotionPlanner* motion_planner) {}
+  virtual void setVelocityLimits(
+      double max_lin_velocity, double max_ang_velocity) {}
+
  protected:
   bool init_;
 };
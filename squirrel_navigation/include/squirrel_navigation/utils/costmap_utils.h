@@ -0,0 +1,340 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_COSTMAP_UTILS_H_
+#define SQUIRREL_NAVIGATION_UTILS_COSTMAP_UTILS_H_
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace squirrel_navigation {
+namespace costmap {
+
+// Merges a row of three layers into the master grid: the maximum cost of
+// the three, cells unknown in any of them are free. The vector width is
+// chosen at compile time (AVX2, SSE2 or NEON), the tail is scalar.
+inline void mergeCostsRow(
+    const unsigned char* first, const unsigned char* second,
+    const unsigned char* third, unsigned char* out, size_t size) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i unknown32 = _mm256_set1_epi8(costmap_2d::NO_INFORMATION);
+  const __m256i free32    = _mm256_set1_epi8(costmap_2d::FREE_SPACE);
+  for (; i + 32 <= size; i += 32) {
+    __m256i cost = _mm256_max_epu8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(second + i)));
+    cost = _mm256_max_epu8(
+        cost, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(third + i)));
+    const __m256i mask = _mm256_cmpeq_epi8(cost, unknown32);
+    cost = _mm256_or_si256(
+        _mm256_and_si256(mask, free32), _mm256_andnot_si256(mask, cost));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), cost);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i unknown16 = _mm_set1_epi8(costmap_2d::NO_INFORMATION);
+  const __m128i free16    = _mm_set1_epi8(costmap_2d::FREE_SPACE);
+  for (; i + 16 <= size; i += 16) {
+    __m128i cost = _mm_max_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(second + i)));
+    cost = _mm_max_epu8(
+        cost, _mm_loadu_si128(reinterpret_cast<const __m128i*>(third + i)));
+    const __m128i mask = _mm_cmpeq_epi8(cost, unknown16);
+    cost =
+        _mm_or_si128(_mm_and_si128(mask, free16), _mm_andnot_si128(mask, cost));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), cost);
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  const uint8x16_t unknown16 = vdupq_n_u8(costmap_2d::NO_INFORMATION);
+  const uint8x16_t free16    = vdupq_n_u8(costmap_2d::FREE_SPACE);
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t cost = vmaxq_u8(vld1q_u8(first + i), vld1q_u8(second + i));
+    cost            = vmaxq_u8(cost, vld1q_u8(third + i));
+    cost            = vbslq_u8(vceqq_u8(cost, unknown16), free16, cost);
+    vst1q_u8(out + i, cost);
+  }
+#endif
+  for (; i < size; ++i) {
+    const unsigned char cost =
+        std::max(std::max(first[i], second[i]), third[i]);
+    out[i] =
+        (cost == costmap_2d::NO_INFORMATION) ? costmap_2d::FREE_SPACE : cost;
+  }
+}
+
+// Element-wise maximum of two rows of costs, vectorized by the compiler.
+inline void maxCostsRow(
+    const unsigned char* first, const unsigned char* second,
+    unsigned char* out, size_t size) {
+  for (size_t i = 0; i < size; ++i)
+    out[i] = std::max(first[i], second[i]);
+}
+
+// Appends to changed the cells where costs differs from snapshot and copies
+// them into snapshot. Unchanged blocks are skipped with a vector compare.
+inline void diffCosts(
+    const unsigned char* costs, unsigned char* snapshot, size_t size,
+    std::vector<unsigned int>* changed) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= size; i += 32) {
+    const __m256i a = _mm256_loadu_si256((const __m256i*)(costs + i));
+    const __m256i b = _mm256_loadu_si256((const __m256i*)(snapshot + i));
+    unsigned int mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    if (!mask)
+      continue;
+    _mm256_storeu_si256((__m256i*)(snapshot + i), a);
+    for (; mask; mask &= mask - 1)
+      changed->push_back(i + __builtin_ctz(mask));
+  }
+#elif defined(__SSE2__)
+  for (; i + 16 <= size; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)(costs + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(snapshot + i));
+    unsigned int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+    if (!mask)
+      continue;
+    _mm_storeu_si128((__m128i*)(snapshot + i), a);
+    for (; mask; mask &= mask - 1)
+      changed->push_back(i + __builtin_ctz(mask));
+  }
+#endif
+  for (; i < size; ++i)
+    if (costs[i] != snapshot[i]) {
+      snapshot[i] = costs[i];
+      changed->push_back(i);
+    }
+}
+
+// Moves the cells of a row-major grid in place for an origin shift of
+// (dx, dy) cells: cell (x, y) takes the old (x + dx, y + dy), the exposed
+// cells are set to value. One memmove per kept row, nothing is allocated.
+template <typename T>
+void shiftGrid(T* grid, int size_x, int size_y, int dx, int dy, T value) {
+  if (std::abs(dx) >= size_x || std::abs(dy) >= size_y) {
+    std::fill(grid, grid + size_x * size_y, value);
+    return;
+  }
+  const int width = size_x - std::abs(dx);
+  const int src_x = std::max(dx, 0), dst_x = std::max(-dx, 0);
+  // The rows are visited so that no source row is overwritten before use.
+  for (int k = 0; k < size_y; ++k) {
+    const int y     = dy >= 0 ? k : size_y - 1 - k;
+    const int src_y = y + dy;
+    T* row          = grid + y * size_x;
+    if (src_y < 0 || src_y >= size_y) {
+      std::fill(row, row + size_x, value);
+      continue;
+    }
+    if (dx != 0 || dy != 0)
+      memmove(row + dst_x, grid + src_y * size_x + src_x, width * sizeof(T));
+    std::fill(row, row + dst_x, value);
+    std::fill(row + dst_x + width, row + size_x, value);
+  }
+}
+
+// Set of costmap cells marked since the last clear. A stamp per cell makes
+// insertion and lookup O(1), clearing only advances the epoch of the stamps.
+class CellMarks {
+ public:
+  CellMarks() : epoch_(1) {}
+
+  // Number of cells of the map.
+  inline size_t numCells() const { return stamps_.size(); }
+  inline void resize(size_t num_cells) {
+    stamps_.assign(num_cells, 0);
+    indices_.clear();
+    epoch_ = 1;
+  }
+
+  inline void clear() {
+    indices_.clear();
+    if (++epoch_ == 0) {
+      std::fill(stamps_.begin(), stamps_.end(), 0);
+      epoch_ = 1;
+    }
+  }
+
+  inline bool contains(unsigned int index) const {
+    return stamps_[index] == epoch_;
+  }
+  // Returns false if the cell was already marked.
+  inline bool insert(unsigned int index) {
+    if (stamps_[index] == epoch_)
+      return false;
+    stamps_[index] = epoch_;
+    indices_.push_back(index);
+    return true;
+  }
+
+  // Stamps the cell without recording it, concurrent calls are safe for
+  // distinct cells. The marked cells are recorded later with append().
+  inline bool mark(unsigned int index) {
+    if (stamps_[index] == epoch_)
+      return false;
+    stamps_[index] = epoch_;
+    return true;
+  }
+  inline void append(const std::vector<unsigned int>& indices) {
+    indices_.insert(indices_.end(), indices.begin(), indices.end());
+  }
+
+  // Marked cells in insertion order.
+  inline const std::vector<unsigned int>& indices() const { return indices_; }
+  inline bool empty() const { return indices_.empty(); }
+
+ private:
+  std::vector<uint32_t> stamps_;
+  std::vector<unsigned int> indices_;
+  uint32_t epoch_;
+};
+
+// Rejection tests and world to map conversion of marking points. Points
+// below the map are projected on its floor, a 2D map has a single layer of
+// infinite height.
+struct MarkingGeometry {
+  double sensor_x, sensor_y, sensor_z, sq_obstacle_range;
+  double robot_x, robot_y, sq_robot_radius, max_obstacle_height;
+  double origin_x, origin_y, origin_z, resolution, z_resolution;
+  int size_x, size_y, size_z;
+};
+
+// Cells hit by a chunk of marking points. The coordinates are copied into
+// structure of arrays, so that the rejection tests and the conversion to map
+// coordinates vectorize. Rejected points get the cell -1.
+struct MarkingBatch {
+  std::vector<double> x, y, z;
+  std::vector<int> cells, heights;
+  // Accepted points grouped by stripes of map rows.
+  std::vector<std::vector<int>> stripes;
+
+  template <typename PointT>
+  void compute(const PointT* points, int size, const MarkingGeometry& g) {
+    x.resize(size);
+    y.resize(size);
+    z.resize(size);
+    cells.resize(size);
+    heights.resize(size);
+    for (int i = 0; i < size; ++i) {
+      x[i] = points[i].x;
+      y[i] = points[i].y;
+      z[i] = points[i].z;
+    }
+    const double *px = x.data(), *py = y.data(), *pz = z.data();
+    int *pcells = cells.data(), *pheights = heights.data();
+#pragma omp simd
+    for (int i = 0; i < size; ++i) {
+      const double dx = px[i] - g.sensor_x, dy = py[i] - g.sensor_y,
+                   dz = pz[i] - g.sensor_z;
+      const double rx = px[i] - g.robot_x, ry = py[i] - g.robot_y;
+      const double cx = (px[i] - g.origin_x) / g.resolution;
+      const double cy = (py[i] - g.origin_y) / g.resolution;
+      const double cz = std::max(pz[i] - g.origin_z, 0.0) / g.z_resolution;
+      const bool keep = !(pz[i] > g.max_obstacle_height) &&
+                        !(dx * dx + dy * dy + dz * dz >= g.sq_obstacle_range) &&
+                        !(rx * rx + ry * ry <= g.sq_robot_radius) &&
+                        cx >= 0.0 && cy >= 0.0 && cx < g.size_x &&
+                        cy < g.size_y && cz < g.size_z;
+      pcells[i] = keep ? static_cast<int>(cy) * g.size_x + static_cast<int>(cx)
+                       : -1;
+      pheights[i] = keep ? static_cast<int>(cz) : 0;
+    }
+  }
+
+  // Stripes of rows hold disjoint cells, so they can be marked concurrently.
+  void groupByStripes(int num_stripes, int size_x, int size_y) {
+    stripes.resize(num_stripes);
+    for (auto& stripe : stripes)
+      stripe.clear();
+    const int size = cells.size();
+    for (int i = 0; i < size; ++i)
+      if (cells[i] >= 0)
+        stripes[(cells[i] / size_x) * num_stripes / size_y].push_back(i);
+  }
+};
+
+// Scanline fill of a polygon given by its vertices in (fractional) map
+// cells: calls span(j, min_i, max_i) for the cells of row j whose center
+// lies inside, max_i exclusive. Rows and columns are clipped to the grid.
+template <typename SpanFunction>
+void forEachPolygonSpan(
+    const std::vector<double>& xs, const std::vector<double>& ys, int size_x,
+    int size_y, SpanFunction span) {
+  const int nvertices = xs.size();
+  if (nvertices < 3)
+    return;
+  const auto range_y = std::minmax_element(ys.begin(), ys.end());
+  const int min_j = std::max(0, (int)std::ceil(*range_y.first - 0.5));
+  const int max_j = std::min(size_y, (int)std::floor(*range_y.second + 0.5));
+  std::vector<double> crossings;
+  crossings.reserve(nvertices);
+  for (int j = min_j; j < max_j; ++j) {
+    // Crossings of the edges with the row through the cell centers.
+    const double yc = j + 0.5;
+    crossings.clear();
+    for (int k = 0; k < nvertices; ++k) {
+      const int l = (k + 1) % nvertices;
+      if ((ys[k] <= yc) != (ys[l] <= yc))
+        crossings.push_back(
+            xs[k] + (yc - ys[k]) * (xs[l] - xs[k]) / (ys[l] - ys[k]));
+    }
+    std::sort(crossings.begin(), crossings.end());
+    for (size_t k = 0; k + 1 < crossings.size(); k += 2) {
+      const int min_i = std::max(0, (int)std::ceil(crossings[k] - 0.5));
+      const int max_i =
+          std::min(size_x, (int)std::floor(crossings[k + 1] - 0.5) + 1);
+      if (min_i < max_i)
+        span(j, min_i, max_i);
+    }
+  }
+}
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_COSTMAP_UTILS_H_ */
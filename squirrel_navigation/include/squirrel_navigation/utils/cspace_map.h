@@ -0,0 +1,116 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_CSPACE_MAP_H_
+#define SQUIRREL_NAVIGATION_UTILS_CSPACE_MAP_H_
+
+#include <geometry_msgs/Point.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+// Obstacles of a grid dilated by the footprint at K discrete headings: bit k
+// of the mask of a cell is set if the footprint centered on the cell with
+// heading 2 pi k / K covers a lethal cell. The footprint is rasterized once
+// per heading, the cells it covers at every heading are stamped once per
+// obstacle and the others once per heading.
+class CSpaceMap {
+ public:
+  static constexpr int kMaxHeadings = 32;
+
+  CSpaceMap() : size_x_(0), size_y_(0), nheadings_(0), radius_(0), all_(0) {}
+
+  // Rasterize the footprint at nheadings headings, at most kMaxHeadings. The
+  // masks are valid again after an update of the whole grid.
+  void setFootprint(
+      const std::vector<geometry_msgs::Point>& footprint, double resolution,
+      int nheadings);
+
+  // Clears the masks for a grid of the given size.
+  void resize(int size_x, int size_y);
+  inline int sizeX() const { return size_x_; }
+  inline int sizeY() const { return size_y_; }
+
+  // Recompute the masks of the cells [min_i, max_i) x [min_j, max_j) from
+  // the lethal cells of costs, up to radius() cells outside of the window.
+  void update(
+      const unsigned char* costs, int min_i, int min_j, int max_i, int max_j);
+
+  inline int nheadings() const { return nheadings_; }
+  // Distance in cells from the center of the farthest cell of the footprint.
+  inline int radius() const { return radius_; }
+
+  // Blocked headings of a cell.
+  inline uint32_t mask(int index) const { return masks_[index]; }
+  inline bool isBlocked(int index) const { return masks_[index] == all_; }
+  inline bool isBlocked(int index, int heading) const {
+    return (masks_[index] >> heading) & 1u;
+  }
+
+  // Conversions between yaws and discrete headings.
+  int headingIndex(double yaw) const;
+  double heading(int index) const;
+
+  // Free headings along a path of cells, from the heading of the start to
+  // the one of the goal, as close as possible to the preferred yaw of each
+  // cell and changing by at most one step between consecutive cells. The
+  // start cell is not checked. False if there is no such sequence.
+  bool assignHeadings(
+      const std::vector<int>& cells, const std::vector<double>& yaws,
+      int start_heading, int goal_heading, std::vector<int>* headings) const;
+
+ private:
+  struct Offset {
+    int dx, dy;
+  };
+
+  void stamp(
+      const std::vector<Offset>& kernel, uint32_t bits, int ox, int oy,
+      int min_i, int min_j, int max_i, int max_j);
+
+ private:
+  int size_x_, size_y_, nheadings_, radius_;
+  uint32_t all_;
+  // Cells covered at every heading and at each of the other headings.
+  std::vector<Offset> common_;
+  std::vector<std::vector<Offset>> kernels_;
+  std::vector<uint32_t> masks_;
+};
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_CSPACE_MAP_H_ */
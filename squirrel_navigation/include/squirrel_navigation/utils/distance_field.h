@@ -0,0 +1,83 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_DISTANCE_FIELD_H_
+#define SQUIRREL_NAVIGATION_UTILS_DISTANCE_FIELD_H_
+
+#include <limits>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+// Cost-to-goal of every cell of a costmap, computed with a Dijkstra search
+// from the goal over 8-connected cells. A step costs (cost + 1) times its
+// length in mm, the cost being the maximum over the cells it touches, as
+// in the SBPL 2D heuristic search. Cells with a cost of at least
+// obstacle_cost are not traversable.
+class DistanceField {
+ public:
+  static constexpr int kUnreachable = std::numeric_limits<int>::max();
+
+  DistanceField() : size_x_(0), size_y_(0), goal_(-1), version_(0) {}
+
+  // Compute the field for a goal cell and store the version of the costs.
+  void compute(
+      const unsigned char* costs, int size_x, int size_y, double resolution,
+      int goal, unsigned char obstacle_cost, unsigned int version);
+
+  // Whether the field was computed for the goal and the costs version.
+  inline bool isValid(int goal, unsigned int version) const {
+    return goal_ >= 0 && goal == goal_ && version == version_;
+  }
+
+  inline int sizeX() const { return size_x_; }
+  inline int sizeY() const { return size_y_; }
+  inline int goal() const { return goal_; }
+
+  // Cost-to-goal in mm, kUnreachable if the goal cannot be reached.
+  inline int cost(int index) const { return costs_[index]; }
+
+  // Cells of the steepest descent from start to the goal.
+  bool descend(int start, std::vector<int>* cells) const;
+
+ private:
+  int size_x_, size_y_, goal_;
+  unsigned int version_;
+  std::vector<int> costs_;
+};
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_DISTANCE_FIELD_H_ */
@@ -35,7 +35,12 @@
 #define SQUIRREL_NAVIGATION_FOOTPRINT_UTILS_H_
 
 #include <geometry_msgs/Point.h>
+#include <geometry_msgs/Pose.h>
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <initializer_list>
 #include <vector>
 
 namespace squirrel_navigation {
@@ -53,6 +58,84 @@ inline std::vector<geometry_msgs::Point> closedPolygon(
   return output;
 }
 
+// Hash of a footprint with the vertices rounded to resolution, so that
+// footprints closer than it usually get the same hash.
+inline size_t hash(
+    const std::vector<geometry_msgs::Point>& footprint,
+    double resolution = 0.01, size_t seed = 0) {
+  seed ^= footprint.size();
+  for (const auto& point : footprint)
+    for (const double coordinate : {point.x, point.y}) {
+      const long value = std::lround(coordinate / resolution);
+      seed ^= std::hash<long>()(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+  return seed;
+}
+
+// Distance from (ox, oy) to the boundary of the footprint along the unit
+// direction (dx, dy): the farthest crossing of the ray with the outline, zero
+// if the ray misses it.
+inline double rayDistance(
+    const std::vector<geometry_msgs::Point>& footprint, double ox, double oy,
+    double dx, double dy) {
+  const int npoints = footprint.size();
+  double distance   = 0.;
+  for (int i = 0; i < npoints; ++i) {
+    const geometry_msgs::Point& a = footprint[i];
+    const geometry_msgs::Point& b = footprint[(i + 1) % npoints];
+    const double ex = b.x - a.x, ey = b.y - a.y;
+    const double den = dx * ey - dy * ex;
+    if (std::abs(den) < 1e-12)
+      continue;
+    // Solve o + t * d = a + s * e.
+    const double ax = a.x - ox, ay = a.y - oy;
+    const double t  = (ax * ey - ay * ex) / den;
+    const double s  = (ax * dy - ay * dx) / den;
+    if (t >= 0. && s >= 0. && s <= 1.)
+      distance = std::max(distance, t);
+  }
+  return distance;
+}
+
+// Appends to points the outline of the footprint at the poses pose_at(i),
+// i < nposes, as segments of a LINE_LIST marker. A pose closer than spacing
+// along the path to the last drawn one is skipped, the last one is drawn.
+template <typename PoseAt>
+inline void appendOutlines(
+    const std::vector<geometry_msgs::Point>& footprint, int nposes,
+    PoseAt pose_at, double spacing, std::vector<geometry_msgs::Point>* points) {
+  const int nvertices = footprint.size();
+  if (nvertices < 2 || nposes <= 0)
+    return;
+  points->reserve(points->size() + 2 * nvertices * nposes);
+  std::vector<geometry_msgs::Point> outline(nvertices);
+  double distance = 0., x = 0., y = 0.;
+  for (int i = 0; i < nposes; ++i) {
+    const geometry_msgs::Pose& pose = pose_at(i);
+    if (i > 0)
+      distance += std::hypot(pose.position.x - x, pose.position.y - y);
+    x = pose.position.x;
+    y = pose.position.y;
+    if (i > 0 && i < nposes - 1 && distance < spacing)
+      continue;
+    distance = 0.;
+    // Rotate the footprint once per pose.
+    const geometry_msgs::Quaternion& q = pose.orientation;
+    const double yaw = std::atan2(
+        2. * (q.w * q.z + q.x * q.y), 1. - 2. * (q.y * q.y + q.z * q.z));
+    const double c = std::cos(yaw), s = std::sin(yaw);
+    for (int k = 0; k < nvertices; ++k) {
+      outline[k].x = c * footprint[k].x - s * footprint[k].y + pose.position.x;
+      outline[k].y = s * footprint[k].x + c * footprint[k].y + pose.position.y;
+      outline[k].z = 0.;
+    }
+    for (int k = 0; k < nvertices; ++k) {
+      points->emplace_back(outline[k]);
+      points->emplace_back(outline[(k + 1) % nvertices]);
+    }
+  }
+}
+
 }  // namespace footprint
 }  // namespace squirrel_navigation
 
@@ -51,11 +51,72 @@
 namespace squirrel_navigation {
 namespace math {
 
+// 2D pose with the heading and its cosine and sine resolved once, so that
+// the inner loops on it are free of trigonometric functions.
+struct Pose2D {
+  double x, y, yaw;
+  double c, s;
+};
+
+// 2D twist, in the frame of the pose it comes with.
+struct Twist2D {
+  double vx, vy, wz;
+};
+
+// Conversions, to be done once at the boundary of the loops.
+inline Pose2D toPose2D(double x, double y, double yaw) {
+  return Pose2D{x, y, yaw, std::cos(yaw), std::sin(yaw)};
+}
+
+inline Pose2D toPose2D(const geometry_msgs::Pose& pose) {
+  return toPose2D(
+      pose.position.x, pose.position.y, tf::getYaw(pose.orientation));
+}
+
+inline Twist2D toTwist2D(const geometry_msgs::Twist& twist) {
+  return Twist2D{twist.linear.x, twist.linear.y, twist.angular.z};
+}
+
+inline geometry_msgs::Pose toPoseMsg(const Pose2D& pose) {
+  geometry_msgs::Pose msg;
+  msg.position.x  = pose.x;
+  msg.position.y  = pose.y;
+  msg.orientation = tf::createQuaternionMsgFromYaw(pose.yaw);
+  return msg;
+}
+
+inline geometry_msgs::Twist toTwistMsg(const Twist2D& twist) {
+  geometry_msgs::Twist msg;
+  msg.linear.x  = twist.vx;
+  msg.linear.y  = twist.vy;
+  msg.angular.z = twist.wz;
+  return msg;
+}
+
 // SE2 transforms.
+inline geometry_msgs::Point applyTransform2D(
+    const Pose2D& tf_pose, const geometry_msgs::Point& point) {
+  geometry_msgs::Point output;
+  output.x = tf_pose.c * point.x - tf_pose.s * point.y + tf_pose.x;
+  output.y = tf_pose.s * point.x + tf_pose.c * point.y + tf_pose.y;
+  return output;
+}
+
+// Rotation of a twist into the frame of the pose and back.
+inline Twist2D rotateTwist2D(const Pose2D& frame, const Twist2D& twist) {
+  return Twist2D{frame.c * twist.vx - frame.s * twist.vy,
+                 frame.s * twist.vx + frame.c * twist.vy, twist.wz};
+}
+
+inline Twist2D unrotateTwist2D(const Pose2D& frame, const Twist2D& twist) {
+  return Twist2D{frame.c * twist.vx + frame.s * twist.vy,
+                 -frame.s * twist.vx + frame.c * twist.vy, twist.wz};
+}
+
 inline geometry_msgs::Point applyTransform2D(
     const geometry_msgs::Pose& tf_pose, const geometry_msgs::Point& point) {
-  const double c = std::cos(tf::getYaw(tf_pose.orientation));
-  const double s = std::sin(tf::getYaw(tf_pose.orientation));
+  const double yaw = tf::getYaw(tf_pose.orientation);
+  const double c = std::cos(yaw), s = std::sin(yaw);
   geometry_msgs::Point output;
   output.x = c * point.x - s * point.y + tf_pose.position.x;
   output.y = s * point.x + c * point.y + tf_pose.position.y;
@@ -93,6 +154,26 @@ inline double delta(
     return t2.angular.z - t1.angular.z;
 }
 
+template <int N>
+inline double delta(const Pose2D& q1, const Pose2D& q2) {
+  if (N < 1)
+    return q2.x - q1.x;
+  else if (N == 1)
+    return q2.y - q1.y;
+  else
+    return angles::normalize_angle(q2.yaw - q1.yaw);
+}
+
+template <int N>
+inline double delta(const Twist2D& t1, const Twist2D& t2) {
+  if (N < 1)
+    return t2.vx - t1.vx;
+  else if (N == 1)
+    return t2.vy - t1.vy;
+  else
+    return t2.wz - t1.wz;
+}
+
 // Linear distance in 2D.
 inline double linearDistance2D(
     const geometry_msgs::Point32& p1, const geometry_msgs::Point32& p2) {
@@ -125,6 +206,10 @@ inline double linearDistance2D(
   return linearDistance2D(q1.pose, q2.pose);
 }
 
+inline double linearDistance2D(const Pose2D& q1, const Pose2D& q2) {
+  return std::hypot(q1.x - q2.x, q1.y - q2.y);
+}
+
 // Yaw distance.
 inline double angularDistanceYaw(
     const geometry_msgs::Quaternion& q1, const geometry_msgs::Quaternion& q2) {
@@ -142,6 +227,10 @@ inline double angularDistanceYaw(
   return angularDistanceYaw(q1.pose, q2.pose);
 }
 
+inline double angularDistanceYaw(const Pose2D& q1, const Pose2D& q2) {
+  return std::abs(angles::normalize_angle(q1.yaw - q2.yaw));
+}
+
 // Linear interpolation
 inline geometry_msgs::Point linearInterpolation2D(
     const geometry_msgs::Point& p1, const geometry_msgs::Point& p2,
@@ -186,6 +275,10 @@ inline geometry_msgs::Quaternion slerpYaw(
   return slerpYaw(q1.pose, q2.pose, alpha);
 }
 
+inline double slerpYaw(const Pose2D& q1, const Pose2D& q2, double alpha) {
+  return angles::normalize_angle(q1.yaw + alpha * delta<2>(q1, q2));
+}
+
 inline double pathLength(const std::vector<geometry_msgs::Point>& waypoints) {
   double length = 0.;
   for (unsigned int i = 1; i < waypoints.size(); ++i)
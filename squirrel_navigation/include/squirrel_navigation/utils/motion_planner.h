@@ -34,6 +34,8 @@
 #ifndef SQUIRREL_NAVIGATION_UTILS_MOTION_PLANNER_H_
 #define SQUIRREL_NAVIGATION_UTILS_MOTION_PLANNER_H_
 
+#include "squirrel_navigation/utils/trajectory.h"
+
 #include <ros/time.h>
 
 #include <geometry_msgs/Pose.h>
@@ -63,9 +65,15 @@ class MotionPlanner {
       const ros::Time& ref_stamp, geometry_msgs::Pose* ref_pose,
       geometry_msgs::Twist* ef_twist) = 0;
 
-  virtual const std::vector<geometry_msgs::PoseStamped>& waypoints() const = 0;
+  // Reference at an arbitrary stamp, without moving the trajectory starter.
+  virtual void sampleReference(
+      const ros::Time& ref_stamp, geometry_msgs::Pose* ref_pose,
+      geometry_msgs::Twist* ref_twist) const = 0;
+
+  // Read-only views, valid until the next reset or update.
+  virtual Trajectory::View waypoints() const = 0;
 
-  virtual std::vector<geometry_msgs::PoseStamped> trajectory() const = 0;
+  virtual Trajectory::View trajectory() const = 0;
 
  protected:
   bool init_;
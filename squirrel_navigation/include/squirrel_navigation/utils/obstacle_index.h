@@ -0,0 +1,121 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_OBSTACLE_INDEX_H_
+#define SQUIRREL_NAVIGATION_UTILS_OBSTACLE_INDEX_H_
+
+#include <cstddef>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+// Nearest obstacle of every cell of a grid, kept up to date with the dynamic
+// brushfire of Lau et al., "Improved updating of Euclidean distance maps and
+// Voronoi diagrams" (IROS 2010). After a change only the cells whose nearest
+// obstacle changed are visited.
+class ObstacleIndex {
+ public:
+  ObstacleIndex() : size_x_(0), size_y_(0) {}
+
+  // Clears the index for a grid of the given size.
+  void resize(int size_x, int size_y);
+  inline int sizeX() const { return size_x_; }
+  inline int sizeY() const { return size_y_; }
+
+  // Add or remove an obstacle, the distances change with update().
+  void setObstacle(int index);
+  void removeObstacle(int index);
+  inline void setCell(int index, bool obstacle) {
+    if (obstacle)
+      setObstacle(index);
+    else
+      removeObstacle(index);
+  }
+
+  // Propagates the changes since the last update.
+  void update();
+
+  // Occupancy of the cells and list of the obstacle cells.
+  inline bool isObstacle(int index) const { return occupancy_[index]; }
+  inline const std::vector<unsigned char>& occupancy() const {
+    return occupancy_;
+  }
+  inline const std::vector<int>& obstacles() const { return obstacles_; }
+
+  // Nearest obstacle of a cell, -1 if the grid has no obstacles.
+  inline int nearestObstacle(int index) const {
+    return cells_[index].obstacle;
+  }
+  // Squared distance in cells to the nearest obstacle.
+  inline int squaredDistance(int index) const { return cells_[index].sqdist; }
+
+  // Bytes held by the index.
+  inline size_t memoryUsage() const {
+    return cells_.capacity() * sizeof(Cell) + occupancy_.capacity() +
+           (obstacles_.capacity() + slots_.capacity()) * sizeof(int);
+  }
+
+ private:
+  struct Cell {
+    int obstacle, sqdist;
+    bool raise, queued;
+  };
+
+  void raise(int index);
+  void lower(int index);
+  inline void push(int sqdist, int index) {
+    cells_[index].queued = true;
+    open_.emplace(sqdist, index);
+  }
+
+ private:
+  int size_x_, size_y_;
+  std::vector<Cell> cells_;
+  std::vector<unsigned char> occupancy_;
+  // Obstacle cells and their position in the list, for O(1) removal.
+  std::vector<int> obstacles_, slots_;
+
+  std::priority_queue<
+      std::pair<int, int>, std::vector<std::pair<int, int>>,
+      std::greater<std::pair<int, int>>>
+      open_;
+};
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_OBSTACLE_INDEX_H_ */
@@ -34,18 +34,59 @@
 #ifndef SQUIRREL_NAVIGATION_UTILS_SBPL_UTILS_H_
 #define SQUIRREL_NAVIGATION_UTILS_SBPL_UTILS_H_
 
+#include "squirrel_navigation/utils/distance_field.h"
+
 #include <sbpl/headers.h>
 
 #include <geometry_msgs/Point.h>
 #include <geometry_msgs/Quaternion.h>
 
+#include <algorithm>
+#include <vector>
+
 namespace squirrel_navigation {
 namespace sbpl {
 
-typedef EnvironmentNAVXYTHETALAT NavigationEnvironment;
+// Lattice environment whose goal heuristic can be read from a shared
+// distance field instead of the internal 2D search of SBPL.
+class NavigationEnvironment : public EnvironmentNAVXYTHETALAT {
+ public:
+  NavigationEnvironment() : distance_field_(nullptr) {}
+  virtual ~NavigationEnvironment() {}
+
+  // The field has to be computed from the goal of the environment.
+  inline void setDistanceField(const costmap::DistanceField* distance_field) {
+    distance_field_ = distance_field;
+  }
+
+  void EnsureHeuristicsUpdated(bool goal_heuristics) override {
+    if (!distance_field_ || !goal_heuristics)
+      EnvironmentNAVXYTHETALAT::EnsureHeuristicsUpdated(goal_heuristics);
+  }
+
+  int GetGoalHeuristic(int state_id) override {
+    if (!distance_field_)
+      return EnvironmentNAVXYTHETALAT::GetGoalHeuristic(state_id);
+    const EnvNAVXYTHETALATHashEntry_t* entry = StateID2CoordTable[state_id];
+    const int h2d = distance_field_->cost(
+        entry->Y * distance_field_->sizeX() + entry->X);
+    if (h2d == costmap::DistanceField::kUnreachable)
+      return INFINITECOST;
+    const int heuclid = (int)(NAVXYTHETALAT_COSTMULT_MTOMM *
+                              EuclideanDistance_m(
+                                  entry->X, entry->Y, EnvNAVXYTHETALATCfg.EndX_c,
+                                  EnvNAVXYTHETALATCfg.EndY_c));
+    return (int)(std::max(h2d, heuclid) /
+                 EnvNAVXYTHETALATCfg.nominalvel_mpersecs);
+  }
+
+ private:
+  const costmap::DistanceField* distance_field_;
+};
 
 typedef SBPLPlanner Planner;
 typedef ARAPlanner ARAstar;
+typedef ADPlanner ADstar;
 
 typedef sbpl_2Dpt_t Point;
 
@@ -53,6 +94,34 @@ typedef SBPL_Exception Exception;
 
 typedef EnvNAVXYTHETALAT3Dpt_t Pose;
 
+typedef nav2dcell_t Cell;
+
+// States whose edges are affected by the changed cells, as queried by the
+// incremental planners on costs_changed().
+class ChangedCellsQuery : public StateChangeQuery {
+ public:
+  ChangedCellsQuery(
+      NavigationEnvironment* env, const std::vector<Cell>& changed_cells)
+      : env_(env), changed_cells_(changed_cells) {}
+  virtual ~ChangedCellsQuery() {}
+
+  std::vector<int> const* getPredecessors() const override {
+    if (preds_.empty() && !changed_cells_.empty())
+      env_->GetPredsofChangedEdges(&changed_cells_, &preds_);
+    return &preds_;
+  }
+  std::vector<int> const* getSuccessors() const override {
+    if (succs_.empty() && !changed_cells_.empty())
+      env_->GetSuccsofChangedEdges(&changed_cells_, &succs_);
+    return &succs_;
+  }
+
+ private:
+  NavigationEnvironment* env_;
+  const std::vector<Cell>& changed_cells_;
+  mutable std::vector<int> preds_, succs_;
+};
+
 inline std::vector<Point> footprint(
     const std::vector<geometry_msgs::Point>& ros_footprint) {
   std::vector<Point> sbpl_footprint;
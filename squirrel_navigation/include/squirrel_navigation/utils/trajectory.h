@@ -0,0 +1,151 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_UTILS_TRAJECTORY_H_
+#define SQUIRREL_NAVIGATION_UTILS_TRAJECTORY_H_
+
+#include <geometry_msgs/Pose.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace utils {
+
+// Time-stamped 2D poses of a motion trajectory, stored as structure of
+// arrays in a ring buffer. Dropping the passed waypoints and truncating the
+// tail are O(1), so that splicing a replan in does not allocate once the
+// capacity has grown to the trajectory size. The arc length up to each
+// waypoint is kept too, so that path lengths are O(1), as well as the
+// velocity of the segment ending at each waypoint.
+class Trajectory {
+ public:
+  // Read-only range of waypoints, invalidated by any change of the
+  // trajectory.
+  class View {
+   public:
+    View() : trajectory_(nullptr), begin_(0), size_(0) {}
+    View(const Trajectory* trajectory, unsigned int begin, unsigned int end)
+        : trajectory_(trajectory), begin_(begin), size_(end - begin) {}
+
+    inline unsigned int size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+
+    inline double x(unsigned int i) const { return trajectory_->x(begin_ + i); }
+    inline double y(unsigned int i) const { return trajectory_->y(begin_ + i); }
+    inline double yaw(unsigned int i) const {
+      return trajectory_->yaw(begin_ + i);
+    }
+    inline double t(unsigned int i) const { return trajectory_->t(begin_ + i); }
+    inline geometry_msgs::Pose pose(unsigned int i) const {
+      return trajectory_->pose(begin_ + i);
+    }
+
+    // Length of the 2D path between two waypoints and of the whole view.
+    inline double distance(unsigned int i, unsigned int j) const {
+      return trajectory_->s(begin_ + j) - trajectory_->s(begin_ + i);
+    }
+    inline double length() const {
+      return size_ > 1 ? distance(0, size_ - 1) : 0.;
+    }
+
+   private:
+    const Trajectory* trajectory_;
+    unsigned int begin_, size_;
+  };
+
+ public:
+  Trajectory() : head_(0), size_(0) {}
+
+  inline unsigned int size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+  inline unsigned int capacity() const { return x_.size(); }
+
+  // Grows the buffer to hold at least capacity waypoints.
+  void reserve(unsigned int capacity);
+
+  // Waypoint accessors.
+  inline double x(unsigned int i) const { return x_[slot(i)]; }
+  inline double y(unsigned int i) const { return y_[slot(i)]; }
+  inline double yaw(unsigned int i) const { return yaw_[slot(i)]; }
+  inline double t(unsigned int i) const { return t_[slot(i)]; }
+  inline double s(unsigned int i) const { return s_[slot(i)]; }
+  inline double vx(unsigned int i) const { return vx_[slot(i)]; }
+  inline double vy(unsigned int i) const { return vy_[slot(i)]; }
+  inline double wz(unsigned int i) const { return wz_[slot(i)]; }
+  inline double& x(unsigned int i) { return x_[slot(i)]; }
+  inline double& y(unsigned int i) { return y_[slot(i)]; }
+  inline double& yaw(unsigned int i) { return yaw_[slot(i)]; }
+  inline double& t(unsigned int i) { return t_[slot(i)]; }
+  inline double& vx(unsigned int i) { return vx_[slot(i)]; }
+  inline double& vy(unsigned int i) { return vy_[slot(i)]; }
+  inline double& wz(unsigned int i) { return wz_[slot(i)]; }
+  geometry_msgs::Pose pose(unsigned int i) const;
+
+  // Modifiers.
+  inline void clear() { head_ = size_ = 0; }
+  void pushBack(double x, double y, double yaw, double t);
+  void pushBack(const geometry_msgs::Pose& pose, double t);
+  inline void popFront(unsigned int n) {
+    n     = std::min(n, size_);
+    head_ = size_ > n ? slot(n) : 0;
+    size_ -= n;
+  }
+  inline void truncate(unsigned int n) { size_ = std::min(n, size_); }
+
+  // Recompute the arc lengths from a waypoint on, after moving waypoints.
+  void updateLengths(unsigned int begin);
+
+  // Index of the first waypoint stamped after t, size() if there is none.
+  unsigned int upperBound(double t) const;
+
+  // Views on the waypoints [begin, end) and on the whole trajectory.
+  inline View view(unsigned int begin, unsigned int end) const {
+    return View(this, begin, end);
+  }
+  inline View view() const { return View(this, 0, size_); }
+
+ private:
+  // The capacity is a power of two.
+  inline unsigned int slot(unsigned int i) const {
+    return (head_ + i) & (x_.size() - 1);
+  }
+
+  std::vector<double> x_, y_, yaw_, t_, s_, vx_, vy_, wz_;
+  unsigned int head_, size_;
+};
+
+}  // namespace utils
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_UTILS_TRAJECTORY_H_ */
@@ -0,0 +1,139 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_NAVIGATION_ZONES_LAYER_H_
+#define SQUIRREL_NAVIGATION_ZONES_LAYER_H_
+
+#include <ros/node_handle.h>
+#include <ros/service_server.h>
+
+#include <costmap_2d/costmap_2d.h>
+
+#include <geometry_msgs/Point.h>
+#include <std_srvs/Trigger.h>
+
+#include <XmlRpcValue.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+
+// Keep-out and speed-limit zones, polygons in the global frame read from the
+// 'zones' parameter of the layer and read again by the reloadZones service.
+// The keep-out zones are lethal in the grid, the speed-limit ones scale the
+// velocity caps of the LocalPlanner. The polygons are rasterized with a
+// scanline fill into a grid aligned to the master grid; after a reload only
+// the bounding boxes of the zones that changed are rasterized again.
+class ZonesLayer : public costmap_2d::Costmap2D {
+ public:
+  struct Zone {
+    enum Type { KEEP_OUT, SPEED_LIMIT };
+
+    bool operator==(const Zone& other) const;
+    bool operator!=(const Zone& other) const { return !(*this == other); }
+
+    Type type;
+    double speed_scale;
+    std::vector<geometry_msgs::Point> polygon;
+  };
+  typedef std::map<std::string, Zone> Zones;
+
+ public:
+  ZonesLayer();
+  virtual ~ZonesLayer() {}
+
+  // Read the zones and advertise the reload service in the namespace of the
+  // layer.
+  void initialize(const std::string& name);
+
+  inline void setEnabled(bool enabled) { enabled_ = enabled; }
+  inline bool enabled() const { return enabled_; }
+
+  // Rasterize the zones changed since the last update, or all of them if
+  // the master grid has moved. The bounds are expanded to the rasterized
+  // area.
+  void updateBounds(
+      const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+      double* max_x, double* max_y);
+
+  unsigned char* costmap() { return costmap_; }
+
+  // Scale of the velocity caps in a cell, 1 outside of the speed-limit
+  // zones and of the grid.
+  inline double speedScale(unsigned int mx, unsigned int my) const {
+    return mx < size_x_ && my < size_y_ && !speed_.empty()
+               ? speed_[my * size_x_ + mx] / 255.
+               : 1.;
+  }
+
+ private:
+  // Cells [x0, x1) x [y0, y1) of the grid.
+  struct Box {
+    int x0, y0, x1, y1;
+  };
+
+  // Parse the zones of a parameter, the malformed ones are skipped.
+  bool loadZones(const ros::NodeHandle& pnh, Zones* zones) const;
+  bool parseZone(XmlRpc::XmlRpcValue& value, std::string* id, Zone* zone) const;
+
+  bool reloadZonesCallback(
+      std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
+
+  // Bounding box of a zone, clipped to the grid.
+  Box boundingBox(const Zone& zone) const;
+  // Rasterize all of the zones within a box.
+  void render(const Box& box);
+
+ private:
+  std::string name_;
+  std::atomic<bool> enabled_;
+  ros::ServiceServer reload_srv_;
+
+  // Rasterized zones and the ones loaded since the last update.
+  Zones zones_;
+  std::unique_ptr<Zones> pending_zones_;
+  std::mutex pending_mtx_;
+
+  // Velocity scale of every cell, 255 for no limit.
+  std::vector<unsigned char> speed_;
+  std::vector<double> xs_, ys_;
+};
+
+}  // namespace squirrel_navigation
+
+#endif /* SQUIRREL_NAVIGATION_ZONES_LAYER_H_ */
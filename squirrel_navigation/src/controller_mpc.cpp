@@ -0,0 +1,336 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/controller_mpc.h"
+
+#include <ros/console.h>
+#include <ros/node_handle.h>
+
+#include <geometry_msgs/PoseStamped.h>
+#include <nav_msgs/Path.h>
+
+#include <tf/tf.h>
+
+#include <angles/angles.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+namespace squirrel_navigation {
+
+namespace {
+
+// Increment of the state when the input u is applied for dt seconds with
+// the robot at heading yaw.
+inline Eigen::Matrix3d inputMatrix(double yaw, double dt) {
+  const double c = std::cos(yaw), s = std::sin(yaw);
+  Eigen::Matrix3d G;
+  G << dt * c, -dt * s, 0., dt * s, dt * c, 0., 0., 0., dt;
+  return G;
+}
+
+}  // namespace
+
+ControllerMPC::ControllerMPC()
+    : params_(Params::defaultParams()),
+      motion_planner_(nullptr),
+      max_lin_velocity_(std::numeric_limits<double>::infinity()),
+      max_ang_velocity_(std::numeric_limits<double>::infinity()),
+      warm_start_(false) {
+  init_ = false;
+  last_cmd_.setZero();
+}
+
+ControllerMPC::ControllerMPC(const Params& params)
+    : params_(params),
+      motion_planner_(nullptr),
+      max_lin_velocity_(std::numeric_limits<double>::infinity()),
+      max_ang_velocity_(std::numeric_limits<double>::infinity()),
+      warm_start_(false) {
+  init_ = false;
+  last_cmd_.setZero();
+}
+
+void ControllerMPC::initialize(const std::string& name) {
+  if (init_)
+    return;
+  // Initialize the parameter server.
+  ros::NodeHandle pnh("~/" + name);
+  dsrv_.reset(new dynamic_reconfigure::Server<ControllerMPCConfig>(pnh));
+  dsrv_->setCallback(
+      boost::bind(&ControllerMPC::reconfigureCallback, this, _1, _2));
+  // Publish the predicted states.
+  prediction_pub_ = pnh.advertise<nav_msgs::Path>("prediction", 1);
+  // Initialization successful.
+  init_ = true;
+  ROS_INFO_STREAM(
+      "squirrel_navigation/ControllerMPC: initialization successful.");
+}
+
+void ControllerMPC::reset(const ros::Time& start) {
+  warm_start_ = false;
+  last_cmd_.setZero();
+}
+
+void ControllerMPC::setMotionPlanner(
+    const utils::MotionPlanner* motion_planner) {
+  motion_planner_ = motion_planner;
+}
+
+void ControllerMPC::setVelocityLimits(
+    double max_lin_velocity, double max_ang_velocity) {
+  max_lin_velocity_ = max_lin_velocity;
+  max_ang_velocity_ = max_ang_velocity;
+}
+
+void ControllerMPC::computeCommand(
+    const ros::Time& stamp, const geometry_msgs::Pose& pose,
+    const geometry_msgs::Pose& ref_pose, const geometry_msgs::Twist& vel,
+    const geometry_msgs::Twist& ref_vel, geometry_msgs::Twist* twist) {
+  const double dt = params_.prediction_step;
+  const Eigen::Vector3d x0(
+      pose.position.x, pose.position.y, tf::getYaw(pose.orientation));
+  sampleReferences(stamp, x0, ref_pose, ref_vel);
+  // Warm start from the previous solution shifted by one step, otherwise
+  // turn as the reference does.
+  if (warm_start_) {
+    u_.head<kInputs - 3>() = u_.tail<kInputs - 3>().eval();
+  } else {
+    for (int k = 0; k < kHorizon; ++k)
+      u_.segment<3>(3 * k) << 0., 0., ref_twists_(2, k);
+  }
+  // Predicted headings, where the model is linearized.
+  headings_(0) = x0(2);
+  for (int k = 1; k < kHorizon; ++k)
+    headings_(k) = headings_(k - 1) + dt * u_(3 * (k - 1) + 2);
+  // Reference inputs in robot frame.
+  for (int k = 0; k < kHorizon; ++k) {
+    const double c = std::cos(headings_(k)), s = std::sin(headings_(k));
+    const double vx = ref_twists_(0, k), vy = ref_twists_(1, k);
+    u_ref_(3 * k)     = c * vx + s * vy;
+    u_ref_(3 * k + 1) = params_.omnidirectional ? -s * vx + c * vy : 0.;
+    u_ref_(3 * k + 2) = ref_twists_(2, k);
+  }
+  if (!warm_start_)
+    u_ = u_ref_;
+  projectInputs(&u_);
+  // Solve and apply the first input.
+  buildProblem(x0);
+  solveProblem();
+  warm_start_ = true;
+  last_cmd_   = u_.head<3>();
+  const double c = std::cos(x0(2)), s = std::sin(x0(2));
+  twist->linear.x  = c * u_(0) - s * u_(1);
+  twist->linear.y  = s * u_(0) + c * u_(1);
+  twist->linear.z  = 0.;
+  twist->angular.x = twist->angular.y = 0.;
+  twist->angular.z = u_(2);
+  // Visualize the prediction.
+  publishPrediction(x0, stamp);
+}
+
+void ControllerMPC::sampleReferences(
+    const ros::Time& stamp, const Eigen::Vector3d& x0,
+    const geometry_msgs::Pose& ref_pose, const geometry_msgs::Twist& ref_vel) {
+  const double dt = params_.prediction_step;
+  double last_yaw = x0(2);
+  for (int k = 0; k < kHorizon; ++k) {
+    geometry_msgs::Pose pose;
+    geometry_msgs::Twist twist;
+    if (motion_planner_) {
+      motion_planner_->sampleReference(
+          stamp + ros::Duration((k + 1) * dt), &pose, &twist);
+    } else {
+      // Without a trajectory, extrapolate the current reference.
+      const double t   = (k + 1) * dt;
+      const double yaw = tf::getYaw(ref_pose.orientation);
+      pose.position.x  = ref_pose.position.x + t * ref_vel.linear.x;
+      pose.position.y  = ref_pose.position.y + t * ref_vel.linear.y;
+      pose.orientation =
+          tf::createQuaternionMsgFromYaw(yaw + t * ref_vel.angular.z);
+      twist = ref_vel;
+    }
+    // Unwrap the headings around the current one.
+    const double yaw =
+        last_yaw +
+        angles::normalize_angle(tf::getYaw(pose.orientation) - last_yaw);
+    refs_.col(k) << pose.position.x, pose.position.y, yaw;
+    ref_twists_.col(k) << twist.linear.x, twist.linear.y, twist.angular.z;
+    last_yaw = yaw;
+  }
+}
+
+void ControllerMPC::buildProblem(const Eigen::Vector3d& x0) {
+  const double dt = params_.prediction_step;
+  const Eigen::Vector3d Q(
+      params_.weight_position, params_.weight_position, params_.weight_heading);
+  const double R = params_.weight_velocity;
+  const double S = params_.weight_smoothness;
+  // The state k + 1 is x0 plus the increments of the inputs 0, ..., k, so
+  // the cost of the states couples the inputs i and j in N - max(i, j)
+  // terms, each with the same weight.
+  Eigen::Matrix<double, 3, kInputs> QG;
+  for (int j = 0; j < kHorizon; ++j)
+    QG.block<3, 3>(0, 3 * j) =
+        Q.asDiagonal() * inputMatrix(headings_(j), dt);
+  Eigen::Vector3d residual = Eigen::Vector3d::Zero();
+  for (int i = kHorizon - 1; i >= 0; --i) {
+    const Eigen::Matrix3d G = inputMatrix(headings_(i), dt);
+    for (int j = 0; j <= i; ++j) {
+      const Eigen::Matrix3d Hij =
+          (kHorizon - i) * G.transpose() * QG.block<3, 3>(0, 3 * j);
+      H_.block<3, 3>(3 * i, 3 * j) = Hij;
+      H_.block<3, 3>(3 * j, 3 * i) = Hij.transpose();
+    }
+    // Sum of the offsets of the states after the input i.
+    residual += x0 - refs_.col(i);
+    g_.segment<3>(3 * i) =
+        G.transpose() * Q.asDiagonal() * residual -
+        R * u_ref_.segment<3>(3 * i);
+  }
+  // Tracking of the reference inputs and smoothness of the sequence,
+  // starting from the last applied command.
+  for (int k = 0; k < kHorizon; ++k) {
+    const double smoothness = k < kHorizon - 1 ? 2. * S : S;
+    H_.block<3, 3>(3 * k, 3 * k).diagonal().array() += R + smoothness;
+    if (k > 0) {
+      H_.block<3, 3>(3 * k, 3 * (k - 1)).diagonal().array() -= S;
+      H_.block<3, 3>(3 * (k - 1), 3 * k).diagonal().array() -= S;
+    }
+  }
+  g_.head<3>() -= S * last_cmd_;
+}
+
+void ControllerMPC::solveProblem() {
+  // Accelerated projected gradient, the step is bounded by the largest
+  // eigenvalue of the hessian via Gershgorin circles.
+  const double lipschitz = H_.cwiseAbs().rowwise().sum().maxCoeff();
+  if (lipschitz <= 0.)
+    return;
+  const double step = 1. / lipschitz;
+  Inputs y = u_, u_next;
+  double t = 1.;
+  for (int i = 0; i < params_.max_iterations; ++i) {
+    u_next.noalias() = y - step * (H_ * y + g_);
+    projectInputs(&u_next);
+    const double t_next = 0.5 * (1. + std::sqrt(1. + 4. * t * t));
+    y = u_next + ((t - 1.) / t_next) * (u_next - u_);
+    const double change = (u_next - u_).cwiseAbs().maxCoeff();
+    u_ = u_next;
+    t  = t_next;
+    if (change < 1e-6)
+      break;
+  }
+}
+
+void ControllerMPC::projectInputs(Inputs* u) const {
+  const double max_lin =
+      std::min(params_.max_linear_velocity, max_lin_velocity_);
+  const double max_ang =
+      std::min(params_.max_angular_velocity, max_ang_velocity_);
+  for (int k = 0; k < kHorizon; ++k) {
+    double& vx = (*u)(3 * k);
+    double& vy = (*u)(3 * k + 1);
+    double& wz = (*u)(3 * k + 2);
+    if (params_.omnidirectional) {
+      const double magnitude = std::hypot(vx, vy);
+      if (magnitude > max_lin) {
+        vx *= max_lin / magnitude;
+        vy *= max_lin / magnitude;
+      }
+    } else {
+      vx = std::max(-max_lin, std::min(vx, max_lin));
+      vy = 0.;
+    }
+    wz = std::max(-max_ang, std::min(wz, max_ang));
+  }
+}
+
+void ControllerMPC::publishPrediction(
+    const Eigen::Vector3d& x0, const ros::Time& stamp) const {
+  if (!params_.visualize_topics || prediction_pub_.getNumSubscribers() == 0)
+    return;
+  nav_msgs::Path path;
+  path.header.frame_id = params_.global_frame_id;
+  path.header.stamp    = stamp;
+  path.poses.resize(kHorizon + 1);
+  Eigen::Vector3d x = x0;
+  for (int k = 0; k <= kHorizon; ++k) {
+    geometry_msgs::PoseStamped& pose = path.poses[k];
+    pose.header                      = path.header;
+    pose.pose.position.x             = x(0);
+    pose.pose.position.y             = x(1);
+    pose.pose.orientation            = tf::createQuaternionMsgFromYaw(x(2));
+    if (k < kHorizon)
+      x += inputMatrix(headings_(k), params_.prediction_step) *
+           u_.segment<3>(3 * k);
+  }
+  prediction_pub_.publish(path);
+}
+
+void ControllerMPC::reconfigureCallback(
+    ControllerMPCConfig& config, uint32_t level) {
+  params_.global_frame_id      = config.global_frame_id;
+  params_.omnidirectional      = config.omnidirectional;
+  params_.prediction_step      = config.prediction_step;
+  params_.weight_position      = config.weight_position;
+  params_.weight_heading       = config.weight_heading;
+  params_.weight_velocity      = config.weight_velocity;
+  params_.weight_smoothness    = config.weight_smoothness;
+  params_.max_linear_velocity  = config.max_linear_velocity;
+  params_.max_angular_velocity = config.max_angular_velocity;
+  params_.max_iterations       = config.max_iterations;
+  params_.visualize_topics     = config.visualize_topics;
+  // The shifted solution does not match the new model.
+  warm_start_ = false;
+}
+
+ControllerMPC::Params ControllerMPC::Params::defaultParams() {
+  Params params;
+  params.global_frame_id      = "/map";
+  params.omnidirectional      = true;
+  params.prediction_step      = 0.1;
+  params.weight_position      = 10.0;
+  params.weight_heading       = 5.0;
+  params.weight_velocity      = 0.5;
+  params.weight_smoothness    = 0.1;
+  params.max_linear_velocity  = 0.8;
+  params.max_angular_velocity = 1.0;
+  params.max_iterations       = 50;
+  params.visualize_topics     = true;
+  return params;
+}
+
+}  // namespace squirrel_navigation
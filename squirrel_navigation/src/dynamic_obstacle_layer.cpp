@@ -0,0 +1,208 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/dynamic_obstacle_layer.h"
+
+#include <ros/console.h>
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_navigation {
+
+DynamicObstacleLayer::DynamicObstacleLayer()
+    : params_(Params::defaultParams()), enabled_(false), drawn_(false) {}
+
+DynamicObstacleLayer::DynamicObstacleLayer(const Params& params)
+    : params_(params), enabled_(false), drawn_(false) {}
+
+void DynamicObstacleLayer::initialize(const std::string& name) {
+  ros::NodeHandle pnh("~/" + name);
+  pnh.param<std::string>(
+      "objects_topic", params_.objects_topic, params_.objects_topic);
+  pnh.param<double>("horizon", params_.horizon, params_.horizon);
+  pnh.param<double>("time_step", params_.time_step, params_.time_step);
+  pnh.param<double>(
+      "radius_growth", params_.radius_growth, params_.radius_growth);
+  pnh.param<double>("max_age", params_.max_age, params_.max_age);
+  pnh.param<int>("max_cost", params_.max_cost, params_.max_cost);
+  params_.max_cost = std::min<int>(
+      std::max(params_.max_cost, 1), costmap_2d::INSCRIBED_INFLATED_OBSTACLE);
+  default_value_ = costmap_2d::FREE_SPACE;
+}
+
+void DynamicObstacleLayer::setEnabled(bool enabled) {
+  if (enabled == enabled_)
+    return;
+  enabled_ = enabled;
+  if (!enabled) {
+    objects_sub_.shutdown();
+    std::unique_lock<std::mutex> lock(objects_mtx_);
+    objects_.reset();
+    return;
+  }
+  objects_sub_ = nh_.subscribe(
+      params_.objects_topic, 1, &DynamicObstacleLayer::objectsCallback, this);
+  ROS_INFO_STREAM(
+      "squirrel_navigation/DynamicObstacleLayer: Subscribed to "
+      << params_.objects_topic << ".");
+}
+
+void DynamicObstacleLayer::updateBounds(
+    const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+    double* max_x, double* max_y) {
+  squirrel_dynamic_filter::DynamicObjects::ConstPtr objects;
+  {
+    std::unique_lock<std::mutex> lock(objects_mtx_);
+    objects = objects_;
+  }
+  // A moved grid is cleared entirely, otherwise only the last discs.
+  const bool aligned = size_x_ == master_grid.getSizeInCellsX() &&
+                       size_y_ == master_grid.getSizeInCellsY() &&
+                       resolution_ == master_grid.getResolution() &&
+                       origin_x_ == master_grid.getOriginX() &&
+                       origin_y_ == master_grid.getOriginY();
+  if (!aligned) {
+    resizeMap(
+        master_grid.getSizeInCellsX(), master_grid.getSizeInCellsY(),
+        master_grid.getResolution(), master_grid.getOriginX(),
+        master_grid.getOriginY());
+    resetMaps();
+  }
+  if (drawn_) {
+    if (aligned) {
+      int x0, y0, x1, y1;
+      worldToMapEnforceBounds(drawn_min_x_, drawn_min_y_, x0, y0);
+      worldToMapEnforceBounds(drawn_max_x_, drawn_max_y_, x1, y1);
+      resetMap(x0, y0, x1 + 1, y1 + 1);
+    }
+    *min_x = std::min(*min_x, drawn_min_x_);
+    *min_y = std::min(*min_y, drawn_min_y_);
+    *max_x = std::max(*max_x, drawn_max_x_);
+    *max_y = std::max(*max_y, drawn_max_y_);
+    drawn_ = false;
+  }
+  if (!objects || objects->objects.empty())
+    return;
+  const double age = (ros::Time::now() - objects->header.stamp).toSec();
+  if (age > params_.max_age)
+    return;
+  // Discs along the predicted paths, from now to the horizon.
+  const double time_step = std::max(params_.time_step, 1e-2);
+  for (const auto& object : objects->objects) {
+    for (double t = 0.; t <= params_.horizon + 1e-6; t += time_step) {
+      const double dt = std::max(age, 0.) + t;
+      const double weight =
+          params_.horizon > 0. ? 1. - t / params_.horizon : 1.;
+      const unsigned char cost = static_cast<unsigned char>(
+          std::max(1., std::round(params_.max_cost * weight)));
+      drawDisc(
+          object.x + object.vx * dt, object.y + object.vy * dt,
+          object.radius + params_.radius_growth * t, cost);
+    }
+  }
+  if (drawn_) {
+    *min_x = std::min(*min_x, drawn_min_x_);
+    *min_y = std::min(*min_y, drawn_min_y_);
+    *max_x = std::max(*max_x, drawn_max_x_);
+    *max_y = std::max(*max_y, drawn_max_y_);
+  }
+}
+
+void DynamicObstacleLayer::drawDisc(
+    double wx, double wy, double radius, unsigned char cost) {
+  if (radius <= 0. || resolution_ <= 0.)
+    return;
+  // Cells whose centers may be inside of the disc.
+  auto cell = [this](double w, double origin, int size) {
+    const int c = std::floor((w - origin) / resolution_);
+    return std::min(std::max(c, 0), size);
+  };
+  const int min_i = cell(wx - radius, origin_x_, size_x_);
+  const int max_i = cell(wx + radius, origin_x_, size_x_ - 1) + 1;
+  const int min_j = cell(wy - radius, origin_y_, size_y_);
+  const int max_j = cell(wy + radius, origin_y_, size_y_ - 1) + 1;
+  if (max_i <= min_i || max_j <= min_j || min_i >= static_cast<int>(size_x_) ||
+      min_j >= static_cast<int>(size_y_))
+    return;
+  const double squared_radius = radius * radius;
+  bool marked = false;
+  for (int j = min_j; j < max_j; ++j) {
+    const double dy = origin_y_ + (j + 0.5) * resolution_ - wy;
+    unsigned char* row = costmap_ + j * size_x_;
+    for (int i = min_i; i < max_i; ++i) {
+      const double dx = origin_x_ + (i + 0.5) * resolution_ - wx;
+      if (dx * dx + dy * dy > squared_radius)
+        continue;
+      row[i]  = std::max(row[i], cost);
+      marked = true;
+    }
+  }
+  if (!marked)
+    return;
+  const double x0 = origin_x_ + min_i * resolution_;
+  const double y0 = origin_y_ + min_j * resolution_;
+  const double x1 = origin_x_ + max_i * resolution_;
+  const double y1 = origin_y_ + max_j * resolution_;
+  if (!drawn_) {
+    drawn_min_x_ = x0, drawn_min_y_ = y0;
+    drawn_max_x_ = x1, drawn_max_y_ = y1;
+    drawn_       = true;
+    return;
+  }
+  drawn_min_x_ = std::min(drawn_min_x_, x0);
+  drawn_min_y_ = std::min(drawn_min_y_, y0);
+  drawn_max_x_ = std::max(drawn_max_x_, x1);
+  drawn_max_y_ = std::max(drawn_max_y_, y1);
+}
+
+void DynamicObstacleLayer::objectsCallback(
+    const squirrel_dynamic_filter::DynamicObjects::ConstPtr& objects) {
+  std::unique_lock<std::mutex> lock(objects_mtx_);
+  objects_ = objects;
+}
+
+DynamicObstacleLayer::Params DynamicObstacleLayer::Params::defaultParams() {
+  Params params;
+  params.objects_topic = "/squirrel/dynamic_objects";
+  params.horizon       = 2.;
+  params.time_step     = 0.25;
+  params.radius_growth = 0.1;
+  params.max_age       = 1.;
+  params.max_cost      = 200;
+  return params;
+}
+
+}  // namespace squirrel_navigation
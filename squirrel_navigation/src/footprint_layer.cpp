@@ -0,0 +1,219 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/footprint_layer.h"
+
+#include <ros/console.h>
+#include <ros/node_handle.h>
+
+#include <costmap_2d/cost_values.h>
+#include <costmap_2d/footprint.h>
+#include <costmap_2d/layered_costmap.h>
+
+#include <pluginlib/class_list_macros.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+
+PLUGINLIB_EXPORT_CLASS(squirrel_navigation::FootprintLayer, costmap_2d::Layer);
+
+namespace squirrel_navigation {
+
+FootprintLayer::FootprintLayer()
+    : params_(Params::defaultParams()),
+      full_update_(true),
+      footprint_received_(false),
+      footprint_changed_(false) {}
+
+FootprintLayer::FootprintLayer(const Params& params)
+    : params_(params),
+      full_update_(true),
+      footprint_received_(false),
+      footprint_changed_(false) {}
+
+void FootprintLayer::onInitialize() {
+  ros::NodeHandle pnh("~/" + name_), nh;
+  pnh.param<std::string>(
+      "footprint_topic", params_.footprint_topic, params_.footprint_topic);
+  dsrv_.reset(new dynamic_reconfigure::Server<FootprintLayerConfig>(pnh));
+  dsrv_->setCallback(
+      boost::bind(&FootprintLayer::reconfigureCallback, this, _1, _2));
+  footprint_sub_ = nh.subscribe(
+      params_.footprint_topic, 1, &FootprintLayer::footprintCallback, this);
+  // Start from the footprint of the costmap.
+  onFootprintChanged();
+  matchSize();
+  current_ = true;
+  ROS_INFO("squirrel_navigation/FootprintLayer: Initializations successful.");
+}
+
+void FootprintLayer::updateBounds(
+    double robot_x, double robot_y, double robot_yaw, double* min_x,
+    double* min_y, double* max_x, double* max_y) {
+  if (!enabled_)
+    return;
+  const costmap_2d::Costmap2D& master = *layered_costmap_->getCostmap();
+  {
+    std::unique_lock<std::mutex> lock(footprint_mtx_);
+    if (footprint_changed_) {
+      cspace_.setFootprint(
+          footprint_, master.getResolution(), params_.num_headings);
+      footprint_changed_ = false;
+      full_update_       = true;
+    }
+  }
+  if (full_update_) {
+    *min_x = std::min(*min_x, master.getOriginX());
+    *min_y = std::min(*min_y, master.getOriginY());
+    *max_x = std::max(
+        *max_x, master.getOriginX() +
+                    master.getSizeInCellsX() * master.getResolution());
+    *max_y = std::max(
+        *max_y, master.getOriginY() +
+                    master.getSizeInCellsY() * master.getResolution());
+    return;
+  }
+  // An obstacle changes the cells within the footprint radius.
+  if (*min_x > *max_x || *min_y > *max_y)
+    return;
+  const double margin = cspace_.radius() * master.getResolution();
+  *min_x -= margin;
+  *min_y -= margin;
+  *max_x += margin;
+  *max_y += margin;
+}
+
+void FootprintLayer::updateCosts(
+    costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i,
+    int max_j) {
+  if (!enabled_ || cspace_.nheadings() == 0)
+    return;
+  if (cspace_.sizeX() != (int)master_grid.getSizeInCellsX() ||
+      cspace_.sizeY() != (int)master_grid.getSizeInCellsY())
+    matchSize();
+  unsigned char* costs = master_grid.getCharMap();
+  cspace_.update(costs, min_i, min_j, max_i, max_j);
+  full_update_ = false;
+  // Cells in collision with the footprint at every heading are obstacles.
+  const int nheadings    = cspace_.nheadings();
+  const int partial_cost = params_.partial_cost;
+  const int size_x       = cspace_.sizeX();
+  min_i                  = std::max(min_i, 0);
+  min_j                  = std::max(min_j, 0);
+  max_i                  = std::min(max_i, size_x);
+  max_j                  = std::min(max_j, cspace_.sizeY());
+  for (int j = min_j; j < max_j; ++j)
+    for (int i = min_i; i < max_i; ++i) {
+      const int index = j * size_x + i;
+      if (costs[index] == costmap_2d::LETHAL_OBSTACLE ||
+          cspace_.mask(index) == 0)
+        continue;
+      unsigned char cost = costmap_2d::INSCRIBED_INFLATED_OBSTACLE;
+      if (!cspace_.isBlocked(index)) {
+        if (partial_cost <= 0)
+          continue;
+        const int nblocked =
+            std::bitset<costmap::CSpaceMap::kMaxHeadings>(cspace_.mask(index))
+                .count();
+        cost = partial_cost * nblocked / nheadings;
+      }
+      // Unknown cells stay unknown.
+      if (costs[index] != costmap_2d::NO_INFORMATION)
+        costs[index] = std::max(costs[index], cost);
+    }
+}
+
+void FootprintLayer::matchSize() {
+  const costmap_2d::Costmap2D& master = *layered_costmap_->getCostmap();
+  cspace_.resize(master.getSizeInCellsX(), master.getSizeInCellsY());
+  full_update_ = true;
+}
+
+void FootprintLayer::onFootprintChanged() {
+  std::unique_lock<std::mutex> lock(footprint_mtx_);
+  if (footprint_received_)
+    return;
+  footprint_         = layered_costmap_->getFootprint();
+  footprint_changed_ = true;
+}
+
+void FootprintLayer::reset() {
+  const costmap_2d::Costmap2D& master = *layered_costmap_->getCostmap();
+  cspace_.resize(master.getSizeInCellsX(), master.getSizeInCellsY());
+  full_update_ = true;
+  current_     = true;
+}
+
+void FootprintLayer::reconfigureCallback(
+    FootprintLayerConfig& config, uint32_t level) {
+  std::unique_lock<std::mutex> lock(footprint_mtx_);
+  // The footprint is rasterized again at the new headings, and a disabled
+  // layer is out of date when enabled again.
+  if (config.num_headings != params_.num_headings ||
+      (config.enabled && !enabled_))
+    footprint_changed_ = true;
+  enabled_             = config.enabled;
+  params_.num_headings = config.num_headings;
+  params_.partial_cost = config.partial_cost;
+}
+
+void FootprintLayer::footprintCallback(
+    const geometry_msgs::PolygonStamped::ConstPtr& footprint) {
+  ROS_INFO_STREAM_ONCE(
+      "squirrel_navigation/FootprintLayer: Subscribed to the footprint.");
+  std::vector<geometry_msgs::Point> points =
+      costmap_2d::toPointVector(footprint->polygon);
+  std::unique_lock<std::mutex> lock(footprint_mtx_);
+  footprint_received_ = true;
+  // The observer republishes the same footprint.
+  bool changed = points.size() != footprint_.size();
+  for (unsigned int i = 0; !changed && i < points.size(); ++i)
+    changed = std::hypot(
+                  points[i].x - footprint_[i].x,
+                  points[i].y - footprint_[i].y) > 0.01;
+  if (!changed)
+    return;
+  footprint_.swap(points);
+  footprint_changed_ = true;
+}
+
+FootprintLayer::Params FootprintLayer::Params::defaultParams() {
+  Params params;
+  params.footprint_topic = "/squirrel_footprint_observer/footprint";
+  params.num_headings    = 16;
+  params.partial_cost    = 0;
+  return params;
+}
+
+}  // namespace squirrel_navigation
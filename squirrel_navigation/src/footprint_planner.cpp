@@ -32,6 +32,7 @@
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "squirrel_navigation/footprint_planner.h"
+#include "squirrel_navigation/utils/costmap_utils.h"
 #include "squirrel_navigation/utils/math_utils.h"
 
 #include <ros/init.h>
@@ -49,7 +50,9 @@
 
 #include <boost/filesystem.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <sstream>
 #include <thread>
 
@@ -64,18 +67,32 @@ FootprintPlanner::FootprintPlanner()
       init_(false),
       inflation_layer_(nullptr),
       footprint_changed_(true),
-      last_nwaypoints_(-1),
       inscribed_radius_(0.),
-      circumscribed_radius_(0.) {}
+      circumscribed_radius_(0.),
+      costmap_version_(0),
+      session_goal_id_(-1),
+      sbpl_key_(0),
+      max_cached_footprints_(4),
+      sbpl_cache_invalid_(false),
+      batch_threads_(4),
+      stop_improvement_(false) {}
 
 FootprintPlanner::FootprintPlanner(const Params& params)
     : params_(params),
       init_(false),
       inflation_layer_(nullptr),
       footprint_changed_(true),
-      last_nwaypoints_(-1),
       inscribed_radius_(0.),
-      circumscribed_radius_(0.) {}
+      circumscribed_radius_(0.),
+      costmap_version_(0),
+      session_goal_id_(-1),
+      sbpl_key_(0),
+      max_cached_footprints_(4),
+      sbpl_cache_invalid_(false),
+      batch_threads_(4),
+      stop_improvement_(false) {}
+
+FootprintPlanner::~FootprintPlanner() { stopPlanImprovement(); }
 
 void FootprintPlanner::initialize(
     std::string name, costmap_2d::Costmap2DROS* costmap_ros) {
@@ -83,12 +100,15 @@ void FootprintPlanner::initialize(
     return;
   // Initialize the parameter server.
   ros::NodeHandle pnh("~/" + name), nh;
+  trace_publisher_.reset(new squirrel_threading::tracing::TracePublisher(pnh));
   dsrv_.reset(new dynamic_reconfigure::Server<FootprintPlannerConfig>(pnh));
   dsrv_->setCallback(
       boost::bind(&FootprintPlanner::reconfigureCallback, this, _1, _2));
   pnh.param<std::string>(
       "motion_primitives_filename", motion_primitives_url_,
       "motion_primitives.mprim");
+  pnh.param("max_cached_footprints", max_cached_footprints_, 4);
+  pnh.param("batch_threads", batch_threads_, 4);
   if (!boost::filesystem::exists(motion_primitives_url_))
     ROS_ERROR_STREAM(
         "squirrel_navigation/FootprintPlanner: The file '"
@@ -117,12 +137,20 @@ bool FootprintPlanner::makePlan(
     const geometry_msgs::PoseStamped& start,
     const geometry_msgs::PoseStamped& goal,
     std::vector<geometry_msgs::PoseStamped>& waypoints) {
+  // The planner is not reentrant, stop improving the previous plan.
+  stopPlanImprovement();
   std::unique_lock<std::mutex> lock(footprint_mtx_);
   if (sbpl_need_reinitialization_)
     initializeSBPLPlanner();
   // Update the costmap.
   costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
   updateSBPLCostmap(*costmap);
+  // Long routes are planned in segments, short ones to the goal.
+  if (params_.segment_length > 0. &&
+      makeSegmentedPlan(start, goal, &waypoints)) {
+    publishPath(waypoints, ros::Time::now());
+    return true;
+  }
   // Set starting pose.
   try {
     const double start_x = start.pose.position.x - costmap->getOriginX();
@@ -149,26 +177,45 @@ bool FootprintPlanner::makePlan(
     const double goal_a = tf::getYaw(goal.pose.orientation);
     // Set the starting state.
     const int ret = sbpl_env_->SetGoal(goal_x, goal_y, goal_a);
-    if (ret <= 0 || sbpl_planner_->set_goal(ret) == 0) {
+    // The same goal continues the session and reuses the search.
+    const bool same_goal =
+        params_.anytime_replanning && ret > 0 && ret == session_goal_id_;
+    if (!same_goal && (ret <= 0 || sbpl_planner_->set_goal(ret) == 0)) {
       ROS_ERROR_STREAM(
           "squirrel_navigation::FootprintPlanner: Unable to set the goal.");
+      session_goal_id_ = -1;
       return false;
     }
+    session_goal_id_ = ret;
   } catch (sbpl::Exception* ex) {
+    session_goal_id_ = -1;
     ROS_ERROR_STREAM(
         "squirrel_navigation::FootprintPlanner: Something went wrong while "
         "setting the goal. "
         << ex->what());
     return false;
   }
+  // The shared distance field replaces the 2D heuristic of SBPL for a
+  // forward search.
+  const bool shared_heuristic = params_.shared_heuristic &&
+                                params_.forward_search &&
+                                !params_.anytime_replanning;
+  sbpl_env_->setDistanceField(
+      shared_heuristic && updateDistanceField(goal) ? &distance_field_
+                                                    : nullptr);
   // Compute the plan.
   int solution_cost, ret;
   std::vector<int> solution_states_ids;
   std::vector<sbpl::Pose> sbpl_waypoints;
   try {
+    // A session returns the first solution, it is improved afterwards.
+    sbpl_planner_->set_search_mode(params_.anytime_replanning);
     sbpl_planner_->set_initialsolution_eps(params_.initial_epsilon);
-    ret = sbpl_planner_->replan(
-        params_.max_planning_time, &solution_states_ids, &solution_cost);
+    {
+      SQUIRREL_TRACE_SCOPE("footprint_planner/replan");
+      ret = sbpl_planner_->replan(
+          params_.max_planning_time, &solution_states_ids, &solution_cost);
+    }
     sbpl_env_->ConvertStateIDPathintoXYThetaPath(
         &solution_states_ids, &sbpl_waypoints);
   } catch (sbpl::Exception* ex) {
@@ -192,21 +239,175 @@ bool FootprintPlanner::makePlan(
           "squirrel_navigation/FootprintPlanner: Found a collision free path "
           "with "
           << waypoints.size() << " waypoints.");
+    if (params_.anytime_replanning)
+      startPlanImprovement();
     return true;
   }
   return false;
 }
 
+bool FootprintPlanner::makePlanOnDistanceField(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>& waypoints) {
+  stopPlanImprovement();
+  std::unique_lock<std::mutex> lock(footprint_mtx_);
+  if (sbpl_need_reinitialization_)
+    initializeSBPLPlanner();
+  costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  updateSBPLCostmap(*costmap);
+  // Descend the field from the start cell.
+  unsigned int mx, my;
+  std::vector<int> cells;
+  if (!costmap->worldToMap(
+          start.pose.position.x, start.pose.position.y, mx, my) ||
+      !updateDistanceField(goal) ||
+      !distance_field_.descend(costmap->getIndex(mx, my), &cells))
+    return false;
+  // Convert the cells, the orientations are left to the caller.
+  waypoints.clear();
+  waypoints.reserve(cells.size());
+  geometry_msgs::PoseStamped pose;
+  pose.header.frame_id  = costmap_ros_->getGlobalFrameID();
+  pose.pose.orientation = tf::createQuaternionMsgFromYaw(0.);
+  for (const int cell : cells) {
+    costmap->indexToCells(cell, mx, my);
+    costmap->mapToWorld(mx, my, pose.pose.position.x, pose.pose.position.y);
+    waypoints.emplace_back(pose);
+  }
+  return true;
+}
+
+bool FootprintPlanner::makePlans(
+    const geometry_msgs::PoseStamped& start,
+    const std::vector<geometry_msgs::PoseStamped>& goals,
+    std::vector<Plan>* plans) {
+  stopPlanImprovement();
+  std::unique_lock<std::mutex> lock(footprint_mtx_);
+  if (sbpl_need_reinitialization_)
+    initializeSBPLPlanner();
+  costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  updateSBPLCostmap(*costmap);
+  Plan no_plan;
+  no_plan.cost = std::numeric_limits<double>::infinity();
+  plans->assign(goals.size(), no_plan);
+  if (goals.empty())
+    return false;
+  // The copies of the environment are valid for the current footprint.
+  if (!batch_environments_.empty() &&
+      batch_environments_.front().key != sbpl_key_)
+    batch_environments_.clear();
+  const int nthreads = std::max(1, std::min<int>(batch_threads_, goals.size()));
+  while ((int)batch_environments_.size() < nthreads - 1) {
+    SBPLEnvironment environment;
+    environment.key     = sbpl_key_;
+    environment.goal_id = -1;
+    if (!createSBPLEnvironment(&environment.env, &environment.planner))
+      break;
+    batch_environments_.push_back(std::move(environment));
+  }
+  const int nworkers = std::min<int>(nthreads, batch_environments_.size() + 1);
+  // The batch ends the planning session, and the distance field is valid
+  // only for the goal it has been computed for.
+  session_goal_id_ = -1;
+  sbpl_env_->setDistanceField(nullptr);
+  // The first worker searches on the current environment, the others on
+  // their copies, which are brought up to date first. Worker k takes the
+  // goals k, k + nworkers, ...
+  auto search = [&](int worker) {
+    sbpl::NavigationEnvironment* env = sbpl_env_.get();
+    sbpl::Planner* planner           = sbpl_planner_.get();
+    if (worker > 0) {
+      SBPLEnvironment& environment = batch_environments_[worker - 1];
+      std::vector<unsigned int> changed_indices;
+      std::vector<sbpl::Cell> changed_cells;
+      pushCosts(
+          *costmap, environment.env.get(), environment.planner.get(),
+          &environment.costmap, &changed_indices, &changed_cells);
+      env     = environment.env.get();
+      planner = environment.planner.get();
+    }
+    for (int i = worker; i < (int)goals.size(); i += nworkers)
+      planToGoal(start, goals[i], env, planner, &(*plans)[i]);
+  };
+  std::vector<std::thread> workers;
+  for (int k = 1; k < nworkers; ++k)
+    workers.emplace_back(search, k);
+  search(0);
+  for (auto& worker : workers)
+    worker.join();
+  const int nplans = std::count_if(
+      plans->begin(), plans->end(),
+      [](const Plan& plan) { return std::isfinite(plan.cost); });
+  if (params_.verbose)
+    ROS_INFO_STREAM(
+        "squirrel_navigation/FootprintPlanner: Found "
+        << nplans << " of " << goals.size() << " plans.");
+  return nplans > 0;
+}
+
+bool FootprintPlanner::planToGoal(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal, sbpl::NavigationEnvironment* env,
+    sbpl::Planner* planner, Plan* plan) {
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  int solution_cost, ret;
+  std::vector<int> solution_states_ids;
+  std::vector<sbpl::Pose> sbpl_waypoints;
+  try {
+    const int start_id = env->SetStart(
+        start.pose.position.x - costmap->getOriginX(),
+        start.pose.position.y - costmap->getOriginY(),
+        tf::getYaw(start.pose.orientation));
+    const int goal_id = env->SetGoal(
+        goal.pose.position.x - costmap->getOriginX(),
+        goal.pose.position.y - costmap->getOriginY(),
+        tf::getYaw(goal.pose.orientation));
+    if (start_id <= 0 || goal_id <= 0 || planner->set_start(start_id) == 0 ||
+        planner->set_goal(goal_id) == 0)
+      return false;
+    planner->set_search_mode(false);
+    planner->set_initialsolution_eps(params_.initial_epsilon);
+    {
+      SQUIRREL_TRACE_SCOPE("footprint_planner/replan_to_goal");
+      ret = planner->replan(
+          params_.max_planning_time, &solution_states_ids, &solution_cost);
+    }
+    if (ret)
+      env->ConvertStateIDPathintoXYThetaPath(
+          &solution_states_ids, &sbpl_waypoints);
+  } catch (sbpl::Exception* ex) {
+    ROS_ERROR_STREAM(
+        "squirrel_navigation/FootprintPlanner: Something went wrong while "
+        "planning to a goal of the batch. "
+        << ex->what());
+    return false;
+  }
+  if (!ret)
+    return false;
+  convertSBPLStatesToWayPoints(sbpl_waypoints, &plan->waypoints);
+  plan->cost = solution_cost;
+  return true;
+}
+
 void FootprintPlanner::reconfigureCallback(
     FootprintPlannerConfig& config, uint32_t level) {
   params_.footprint_topic   = config.footprint_topic;
   params_.max_planning_time = config.max_planning_time;
   params_.initial_epsilon   = config.initial_epsilon;
+  params_.shared_heuristic  = config.shared_heuristic;
+  params_.segment_length    = config.segment_length;
   params_.visualize_topics  = config.visualize_topics;
+  params_.footprints_spacing = config.footprints_spacing;
   params_.verbose           = config.verbose;
-  if (params_.forward_search != config.forward_search) {
-    params_.forward_search = config.forward_search;
-    footprint_changed_     = true;
+  // The cached planners have the old search configuration.
+  if (params_.anytime_replanning != config.anytime_replanning ||
+      params_.forward_search != config.forward_search) {
+    params_.anytime_replanning  = config.anytime_replanning;
+    params_.forward_search      = config.forward_search;
+    footprint_changed_          = true;
+    sbpl_need_reinitialization_ = true;
+    sbpl_cache_invalid_         = true;
   }
 }
 
@@ -240,16 +441,69 @@ void FootprintPlanner::footprintCallback(
   footprint_                  = costmap_2d::toPointVector(footprint->polygon);
   costmap_2d::calculateMinAndMaxDistances(
       footprint_, inscribed_radius_, circumscribed_radius_);
-  // Update the marker.
-  footprint_marker_.points = footprint_;
 }
 
 void FootprintPlanner::initializeSBPLPlanner() {
-  sbpl_env_.reset(new sbpl::NavigationEnvironment);
   // The global costmap;
   costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  if (sbpl_cache_invalid_) {
+    sbpl_cache_.clear();
+    batch_environments_.clear();
+    sbpl_planner_.reset();
+    sbpl_env_.reset();
+    sbpl_cache_invalid_ = false;
+  }
+  // Environments are valid for one footprint and one map size.
+  const size_t key = footprint::hash(
+      footprint_, 0.01,
+      costmap->getSizeInCellsX() * 92821 + costmap->getSizeInCellsY());
+  if (sbpl_env_ && key == sbpl_key_) {
+    sbpl_need_reinitialization_ = false;
+    return;
+  }
+  // Park the current environment.
+  if (sbpl_env_ && max_cached_footprints_ > 0) {
+    SBPLEnvironment parked{sbpl_key_, std::move(sbpl_env_),
+                           std::move(sbpl_planner_), std::move(sbpl_costmap_),
+                           session_goal_id_};
+    sbpl_cache_.push_back(std::move(parked));
+    if ((int)sbpl_cache_.size() > max_cached_footprints_)
+      sbpl_cache_.pop_front();
+  }
+  sbpl_key_ = key;
+  // Swap in a cached environment, the costs changed meanwhile are pushed by
+  // the next update.
+  for (auto it = sbpl_cache_.begin(); it != sbpl_cache_.end(); ++it)
+    if (it->key == key) {
+      sbpl_env_                   = std::move(it->env);
+      sbpl_planner_               = std::move(it->planner);
+      sbpl_costmap_               = std::move(it->costmap);
+      session_goal_id_            = it->goal_id;
+      sbpl_need_reinitialization_ = false;
+      sbpl_cache_.erase(it);
+      if (params_.verbose)
+        ROS_INFO_STREAM(
+            "squirrel_navigation/FootprintPlanner: Reusing the environment of "
+            "a cached footprint.");
+      return;
+    }
+  createSBPLEnvironment(&sbpl_env_, &sbpl_planner_);
+  session_goal_id_ = -1;
+  // The environment starts with free cells, all of the costs are pushed.
+  sbpl_costmap_.assign(
+      costmap->getSizeInCellsX() * costmap->getSizeInCellsY(),
+      costmap_2d::FREE_SPACE);
+  // Initialization guard.
+  sbpl_need_reinitialization_ = false;
+}
+
+bool FootprintPlanner::createSBPLEnvironment(
+    std::unique_ptr<sbpl::NavigationEnvironment>* env,
+    std::unique_ptr<sbpl::Planner>* planner) {
+  costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  env->reset(new sbpl::NavigationEnvironment);
   // Set inscribed radius cost parameter.
-  if (!sbpl_env_->SetEnvParameter(
+  if (!(*env)->SetEnvParameter(
           "cost_inscribed_thresh", costmap_2d::INSCRIBED_INFLATED_OBSTACLE)) {
     ROS_ERROR_STREAM(
         "squirrel_navigation/FootprintPlanner: Unable to set "
@@ -258,7 +512,7 @@ void FootprintPlanner::initializeSBPLPlanner() {
   }
   // Set circumscibed radius cost parameter.
   if (inflation_layer_ &&
-      !sbpl_env_->SetEnvParameter(
+      !(*env)->SetEnvParameter(
           "cost_possibly_circumscribed_thresh",
           inflation_layer_->computeCost(
               circumscribed_radius_ / costmap->getResolution()))) {
@@ -271,7 +525,7 @@ void FootprintPlanner::initializeSBPLPlanner() {
   // Initialize the environment.
   bool initialization_status = false;
   try {
-    initialization_status = sbpl_env_->InitializeEnv(
+    initialization_status = (*env)->InitializeEnv(
         costmap->getSizeInCellsX(), costmap->getSizeInCellsY(), nullptr, 0., 0.,
         0., 0., 0., 0., 0., 0., 0., sbpl::footprint(footprint_),
         costmap_ros_->getCostmap()->getResolution(), 1.0, 1.0,
@@ -289,19 +543,201 @@ void FootprintPlanner::initializeSBPLPlanner() {
     ROS_ERROR_STREAM(
         "squirrel_navigation/FootprintPlanner: Initialization failed.");
     ros::shutdown();
+    return false;
   }
-  // Initialize the planner.
-  sbpl_planner_.reset(
-      new sbpl::ARAstar(sbpl_env_.get(), params_.forward_search));
-  sbpl_planner_->set_search_mode(false);
-  // Initialization guard.
-  sbpl_need_reinitialization_ = false;
+  // Initialize the planner. AD* searches backwards, so that the start can
+  // move within the same session.
+  if (params_.anytime_replanning)
+    planner->reset(new sbpl::ADstar(env->get(), false));
+  else
+    planner->reset(new sbpl::ARAstar(env->get(), params_.forward_search));
+  (*planner)->set_search_mode(false);
+  return true;
 }
 
 void FootprintPlanner::updateSBPLCostmap(const costmap_2d::Costmap2D& costmap) {
-  for (unsigned int i = 0; i < costmap.getSizeInCellsX(); ++i)
-    for (unsigned int j = 0; j < costmap.getSizeInCellsY(); ++j)
-      sbpl_env_->UpdateCost(i, j, costmap.getCost(i, j));
+  if (pushCosts(
+          costmap, sbpl_env_.get(), sbpl_planner_.get(), &sbpl_costmap_,
+          &changed_indices_, &changed_cells_))
+    ++costmap_version_;
+}
+
+bool FootprintPlanner::pushCosts(
+    const costmap_2d::Costmap2D& costmap, sbpl::NavigationEnvironment* env,
+    sbpl::Planner* planner, std::vector<unsigned char>* snapshot,
+    std::vector<unsigned int>* changed_indices,
+    std::vector<sbpl::Cell>* changed_cells) const {
+  const unsigned int size_x = costmap.getSizeInCellsX();
+  const unsigned int size   = size_x * costmap.getSizeInCellsY();
+  // A new environment starts with free cells.
+  if (snapshot->size() != size)
+    snapshot->assign(size, costmap_2d::FREE_SPACE);
+  // Push only the cells changed since the last plan.
+  changed_indices->clear();
+  costmap::diffCosts(
+      costmap.getCharMap(), snapshot->data(), size, changed_indices);
+  changed_cells->resize(changed_indices->size());
+  for (unsigned int i = 0; i < changed_indices->size(); ++i) {
+    sbpl::Cell& cell = (*changed_cells)[i];
+    cell.x           = (*changed_indices)[i] % size_x;
+    cell.y           = (*changed_indices)[i] / size_x;
+    env->UpdateCost(cell.x, cell.y, (*snapshot)[(*changed_indices)[i]]);
+  }
+  // Let the planner update the states affected by the changes.
+  if (changed_cells->empty())
+    return false;
+  sbpl::ChangedCellsQuery query(env, *changed_cells);
+  planner->costs_changed(query);
+  return true;
+}
+
+void FootprintPlanner::startPlanImprovement() {
+  stop_improvement_    = false;
+  improvement_thread_ = std::thread(&FootprintPlanner::improvePlan, this);
+}
+
+void FootprintPlanner::stopPlanImprovement() {
+  stop_improvement_ = true;
+  if (improvement_thread_.joinable())
+    improvement_thread_.join();
+}
+
+void FootprintPlanner::improvePlan() {
+  // Short slices, so that a new request waits little.
+  const double slice = 0.05;
+  const ros::WallTime deadline =
+      ros::WallTime::now() + ros::WallDuration(params_.max_planning_time);
+  while (!stop_improvement_ && ros::WallTime::now() < deadline) {
+    std::unique_lock<std::mutex> lock(footprint_mtx_);
+    if (sbpl_need_reinitialization_ || sbpl_planner_->get_solution_eps() <= 1.)
+      return;
+    int solution_cost;
+    std::vector<int> solution_states_ids;
+    std::vector<sbpl::Pose> sbpl_waypoints;
+    try {
+      sbpl_planner_->set_search_mode(false);
+      SQUIRREL_TRACE_SCOPE("footprint_planner/improve_plan");
+      if (!sbpl_planner_->replan(slice, &solution_states_ids, &solution_cost))
+        return;
+      sbpl_env_->ConvertStateIDPathintoXYThetaPath(
+          &solution_states_ids, &sbpl_waypoints);
+    } catch (sbpl::Exception* ex) {
+      ROS_ERROR_STREAM(
+          "squirrel_navigation/FootprintPlanner: Something went wrong while "
+          "improving the plan. "
+          << ex->what());
+      return;
+    }
+    std::vector<geometry_msgs::PoseStamped> waypoints;
+    convertSBPLStatesToWayPoints(sbpl_waypoints, &waypoints);
+    publishPath(waypoints, ros::Time::now());
+  }
+}
+
+bool FootprintPlanner::updateDistanceField(
+    const geometry_msgs::PoseStamped& goal) {
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  unsigned int mx, my;
+  if (!costmap->worldToMap(goal.pose.position.x, goal.pose.position.y, mx, my))
+    return false;
+  // Computed once per goal and version of the costs pushed to SBPL.
+  const int goal_index = costmap->getIndex(mx, my);
+  if (!distance_field_.isValid(goal_index, costmap_version_))
+    distance_field_.compute(
+        sbpl_costmap_.data(), costmap->getSizeInCellsX(),
+        costmap->getSizeInCellsY(), costmap->getResolution(), goal_index,
+        costmap_2d::INSCRIBED_INFLATED_OBSTACLE, costmap_version_);
+  return distance_field_.cost(goal_index) !=
+         costmap::DistanceField::kUnreachable;
+}
+
+bool FootprintPlanner::makeSegmentedPlan(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) {
+  geometry_msgs::PoseStamped segment_goal;
+  std::vector<geometry_msgs::PoseStamped> route_tail;
+  if (!splitRoute(start, goal, &segment_goal, &route_tail))
+    return false;
+  // The segment ends the planning session, its heuristic is the one of SBPL,
+  // bounded by the length of the segment.
+  session_goal_id_ = -1;
+  sbpl_env_->setDistanceField(nullptr);
+  Plan plan;
+  if (!planToGoal(
+          start, segment_goal, sbpl_env_.get(), sbpl_planner_.get(), &plan)) {
+    if (params_.verbose)
+      ROS_WARN_STREAM(
+          "squirrel_navigation/FootprintPlanner: Unable to plan the segment, "
+          "planning to the goal.");
+    return false;
+  }
+  waypoints->swap(plan.waypoints);
+  waypoints->insert(waypoints->end(), route_tail.begin(), route_tail.end());
+  if (params_.verbose)
+    ROS_INFO_STREAM(
+        "squirrel_navigation/FootprintPlanner: Found a segment of "
+        << waypoints->size() - route_tail.size() << " waypoints, followed by "
+        << route_tail.size() << " waypoints of the route.");
+  return true;
+}
+
+bool FootprintPlanner::splitRoute(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    geometry_msgs::PoseStamped* segment_goal,
+    std::vector<geometry_msgs::PoseStamped>* route_tail) {
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  unsigned int mx, my;
+  std::vector<int> cells;
+  if (!costmap->worldToMap(
+          start.pose.position.x, start.pose.position.y, mx, my) ||
+      !updateDistanceField(goal) ||
+      !distance_field_.descend(costmap->getIndex(mx, my), &cells))
+    return false;
+  const int ncells = cells.size();
+  std::vector<double> xs(ncells), ys(ncells);
+  for (int i = 0; i < ncells; ++i) {
+    costmap->indexToCells(cells[i], mx, my);
+    costmap->mapToWorld(mx, my, xs[i], ys[i]);
+  }
+  // Cut the route at the segment length, a short remainder is planned with
+  // the segment.
+  int cut       = 0;
+  double length = 0.;
+  while (cut < ncells - 1 && length < params_.segment_length) {
+    length += std::hypot(xs[cut + 1] - xs[cut], ys[cut + 1] - ys[cut]);
+    ++cut;
+  }
+  double remainder = 0.;
+  for (int i = cut; i < ncells - 1; ++i)
+    remainder += std::hypot(xs[i + 1] - xs[i], ys[i + 1] - ys[i]);
+  if (remainder < 0.5 * params_.segment_length)
+    return false;
+  // The headings follow the route, over a few cells to smooth the grid.
+  const int span = std::max(1, (int)(0.25 / costmap->getResolution()));
+  auto heading   = [&](int i) {
+    const int prev = std::max(0, i - span);
+    const int next = std::min(ncells - 1, i + span);
+    return std::atan2(ys[next] - ys[prev], xs[next] - xs[prev]);
+  };
+  segment_goal->header          = goal.header;
+  segment_goal->pose.position.x = xs[cut];
+  segment_goal->pose.position.y = ys[cut];
+  segment_goal->pose.orientation =
+      tf::createQuaternionMsgFromYaw(heading(cut));
+  route_tail->clear();
+  route_tail->reserve(ncells - cut);
+  geometry_msgs::PoseStamped pose;
+  pose.header = goal.header;
+  for (int i = cut + 1; i < ncells - 1; ++i) {
+    pose.pose.position.x  = xs[i];
+    pose.pose.position.y  = ys[i];
+    pose.pose.orientation = tf::createQuaternionMsgFromYaw(heading(i));
+    route_tail->emplace_back(pose);
+  }
+  route_tail->emplace_back(goal);
+  return true;
 }
 
 boost::shared_ptr<costmap_2d::InflationLayer>
@@ -315,14 +751,17 @@ boost::shared_ptr<costmap_2d::InflationLayer>
 }
 
 void FootprintPlanner::initializeFootprintMarker() {
-  footprint_marker_.ns   = ros::this_node::getNamespace() + "FootprintPlanner";
-  footprint_marker_.type = visualization_msgs::Marker::LINE_STRIP;
-  footprint_marker_.action  = visualization_msgs::Marker::MODIFY;
-  footprint_marker_.scale.x = 0.0025;
-  footprint_marker_.color.r = 0.35;
-  footprint_marker_.color.g = 0.35;
-  footprint_marker_.color.b = 0.35;
-  footprint_marker_.color.a = 1.0;
+  footprints_msg_.markers.resize(1);
+  auto& marker   = footprints_msg_.markers.front();
+  marker.ns      = ros::this_node::getNamespace() + "FootprintPlanner";
+  marker.id      = 0;
+  marker.type    = visualization_msgs::Marker::LINE_LIST;
+  marker.pose.orientation.w = 1.0;
+  marker.scale.x            = 0.0025;
+  marker.color.r            = 0.35;
+  marker.color.g            = 0.35;
+  marker.color.b            = 0.35;
+  marker.color.a            = 1.0;
 }
 
 void FootprintPlanner::publishPath(
@@ -346,40 +785,44 @@ void FootprintPlanner::publishPath(
   for (const auto& waypoint : waypoints)
     pose_array.poses.emplace_back(waypoint.pose);
   waypoints_pub_.publish(pose_array);
-  // Publish the footprints.
-  visualization_msgs::MarkerArray footprints_array;
-  footprints_array.markers.reserve(std::max(nwaypoints, last_nwaypoints_));
-  for (int i = 0; i < nwaypoints; ++i) {
-    footprint_marker_.header = header;
-    footprint_marker_.id     = i;
-    footprint_marker_.pose   = waypoints[i].pose;
-    footprints_array.markers.emplace_back(footprint_marker_);
-  }
-  // Clear last waypoints.
-  for (int i = nwaypoints; i < last_nwaypoints_; ++i) {
-    visualization_msgs::Marker delete_marker;
-    delete_marker.ns     = ros::this_node::getNamespace() + "FootprintPlanner";
-    delete_marker.id     = i;
-    delete_marker.action = visualization_msgs::Marker::DELETE;
-    footprints_array.markers.emplace_back(delete_marker);
-  }
-  last_nwaypoints_ = nwaypoints;
-  footprints_pub_.publish(footprints_array);
+  // Publish the footprints, all in one marker whose buffer is reused.
+  if (footprints_pub_.getNumSubscribers() == 0)
+    return;
+  auto& marker  = footprints_msg_.markers.front();
+  marker.header = header;
+  marker.action = waypoints.empty() ? visualization_msgs::Marker::DELETE
+                                    : visualization_msgs::Marker::MODIFY;
+  marker.points.clear();
+  footprint::appendOutlines(
+      footprint_, nwaypoints,
+      [&waypoints](int i) -> const geometry_msgs::Pose& {
+        return waypoints[i].pose;
+      },
+      params_.footprints_spacing, &marker.points);
+  footprints_pub_.publish(footprints_msg_);
 }
 
 void FootprintPlanner::convertSBPLStatesToWayPoints(
     const std::vector<sbpl::Pose>& sbpl_states,
     std::vector<geometry_msgs::PoseStamped>* waypoints) {
   costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
-  // Fill the waypoints.
+  const double origin_x = costmap->getOriginX();
+  const double origin_y = costmap->getOriginY();
+  // Fill the waypoints. The headings are discretized and consecutive states
+  // mostly share them, so the quaternion is only recomputed on a change.
+  geometry_msgs::PoseStamped pose;
+  pose.header.frame_id  = costmap_ros_->getGlobalFrameID();
+  double theta          = 0.;
+  pose.pose.orientation = tf::createQuaternionMsgFromYaw(theta);
   waypoints->clear();
   waypoints->reserve(sbpl_states.size());
   for (const auto& sbpl_state : sbpl_states) {
-    geometry_msgs::PoseStamped pose;
-    pose.header.frame_id  = costmap_ros_->getGlobalFrameID();
-    pose.pose.position.x  = sbpl_state.x + costmap->getOriginX();
-    pose.pose.position.y  = sbpl_state.y + costmap->getOriginY();
-    pose.pose.orientation = tf::createQuaternionMsgFromYaw(sbpl_state.theta);
+    if (sbpl_state.theta != theta) {
+      theta                 = sbpl_state.theta;
+      pose.pose.orientation = tf::createQuaternionMsgFromYaw(theta);
+    }
+    pose.pose.position.x = sbpl_state.x + origin_x;
+    pose.pose.position.y = sbpl_state.y + origin_y;
     waypoints->emplace_back(pose);
   }
 }
@@ -390,7 +833,11 @@ FootprintPlanner::Params FootprintPlanner::Params::defaultParams() {
   params.forward_search    = true;
   params.max_planning_time = 0.2;
   params.initial_epsilon   = 0.05;
+  params.anytime_replanning = false;
+  params.shared_heuristic   = false;
+  params.segment_length     = 0.0;
   params.visualize_topics  = true;
+  params.footprints_spacing = 0.0;
   params.verbose           = false;
   return params;
 }
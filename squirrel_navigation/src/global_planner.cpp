@@ -35,12 +35,22 @@
 #include "squirrel_navigation/utils/footprint_utils.h"
 #include "squirrel_navigation/utils/math_utils.h"
 
+#include <diagnostic_msgs/DiagnosticStatus.h>
 #include <geometry_msgs/PoseArray.h>
 #include <nav_msgs/Path.h>
 #include <visualization_msgs/MarkerArray.h>
 
+#include <costmap_2d/cost_values.h>
+
 #include <pluginlib/class_list_macros.h>
 
+#include <angles/angles.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
 PLUGINLIB_DECLARE_CLASS(
     squirrel_navigation, GlobalPlanner, squirrel_navigation::GlobalPlanner,
     nav_core::BaseGlobalPlanner);
@@ -48,10 +58,17 @@ PLUGINLIB_DECLARE_CLASS(
 namespace squirrel_navigation {
 
 GlobalPlanner::GlobalPlanner()
-    : params_(Params::defaultParams()), init_(false), last_nwaypoints_(-1) {}
+    : params_(Params::defaultParams()),
+      cache_stats_(),
+      route_checker_key_(0),
+      init_(false) {
+  footprints_msg_.markers.resize(1);
+}
 
 GlobalPlanner::GlobalPlanner(const Params& params)
-    : params_(params), init_(false), last_nwaypoints_(-1) {}
+    : params_(params), cache_stats_(), route_checker_key_(0), init_(false) {
+  footprints_msg_.markers.resize(1);
+}
 
 void GlobalPlanner::initialize(
     std::string name, costmap_2d::Costmap2DROS* costmap_ros) {
@@ -69,11 +86,24 @@ void GlobalPlanner::initialize(
   dijkstra_planner_->initialize(name + "/Dijkstra", costmap_ros);
   footprint_planner_.reset(new FootprintPlanner);
   footprint_planner_->initialize(name + "/ARAstar", costmap_ros);
+  for (const auto& layer : *costmap_ros->getLayeredCostmap()->getPlugins())
+    if (auto footprint_layer =
+            boost::dynamic_pointer_cast<FootprintLayer>(layer))
+      footprint_layer_ = footprint_layer;
   // Initialize publishers and subscribers.
   plan_pub_      = pnh.advertise<nav_msgs::Path>("plan", 1);
   waypoints_pub_ = pnh.advertise<geometry_msgs::PoseArray>("waypoints", 1);
   footprints_pub_ =
       pnh.advertise<visualization_msgs::MarkerArray>("footprints", 1);
+  route_cache_pub_ =
+      pnh.advertise<diagnostic_msgs::DiagnosticStatus>("route_cache", 1, true);
+  std::string plan_with_footprint_topic;
+  pnh.param<std::string>(
+      "plan_with_footprint_topic", plan_with_footprint_topic, "");
+  if (!plan_with_footprint_topic.empty())
+    plan_with_footprint_sub_ = nh.subscribe(
+        plan_with_footprint_topic, 1, &GlobalPlanner::planWithFootprintCallback,
+        this);
   // Initialization successful.
   init_ = true;
   ROS_INFO_STREAM(
@@ -84,32 +114,22 @@ bool GlobalPlanner::makePlan(
     const geometry_msgs::PoseStamped& start,
     const geometry_msgs::PoseStamped& goal,
     std::vector<geometry_msgs::PoseStamped>& waypoints) {
-  // Compute a collision free path.
+  // Reuse the route of a previous request with the same start and goal,
+  // otherwise compute a collision free path.
+  const bool use_cache = params_.route_cache_size > 0;
+  RouteKey key;
   bool plan_found = false;
-  if (params_.plan_with_footprint) {
-    plan_found = footprint_planner_->makePlan(start, goal, waypoints);
-    if (params_.verbose && params_.plan_with_constant_heading)
-      ROS_WARN_STREAM(
-          "squirrel_navigation/GlobalPlanner: Planning with constant heading "
-          "is possible only for circular footprints. Disable "
-          "'plan_with_footprint' parameters.");
-  } else if (plan_found = dijkstra_planner_->makePlan(start, goal, waypoints)) {
-    waypoints.front() = start;
-    for (int i = 1; i < (int)waypoints.size() - 1; ++i) {
-      if (params_.plan_with_constant_heading) {
-        waypoints[i].pose.orientation =
-            tf::createQuaternionMsgFromYaw(params_.heading);
-      } else {
-        const auto& prev_waypoint = waypoints[i - 1].pose;
-        const auto& next_waypoint = waypoints[i + 1].pose;
-        const double dx = math::delta<0>(prev_waypoint, next_waypoint);
-        const double dy = math::delta<1>(prev_waypoint, next_waypoint);
-        waypoints[i].pose.orientation =
-            tf::createQuaternionMsgFromYaw(std::atan2(dy, dx));
-      }
-    }
-    waypoints.back() = goal;
+  if (use_cache) {
+    key        = routeKey(start, goal);
+    plan_found = lookupRoute(key, start, goal, &waypoints);
+  }
+  if (!plan_found) {
+    plan_found = computePlan(start, goal, &waypoints);
+    if (plan_found && use_cache)
+      storeRoute(key, waypoints);
   }
+  if (use_cache)
+    publishRouteCacheStats();
 
   // Print info.
   if (params_.verbose) {
@@ -137,13 +157,401 @@ bool GlobalPlanner::makePlan(
   return plan_found;
 }
 
+bool GlobalPlanner::computePlan(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) {
+  bool plan_found = false;
+  if (params_.plan_with_footprint) {
+    // Dijkstra on the configuration space of the footprint layer, the
+    // lattice planner is the fallback.
+    plan_found = params_.dijkstra_with_footprint_layer && footprint_layer_ &&
+                 dijkstra_planner_->makePlan(start, goal, *waypoints) &&
+                 setWaypointsHeadingInCSpace(start, goal, waypoints);
+    if (!plan_found)
+      plan_found = footprint_planner_->makePlan(start, goal, *waypoints);
+    if (params_.verbose && params_.plan_with_constant_heading)
+      ROS_WARN_STREAM(
+          "squirrel_navigation/GlobalPlanner: Planning with constant heading "
+          "is possible only for circular footprints. Disable "
+          "'plan_with_footprint' parameters.");
+  } else if (  // The reusable distance field of the footprint planner.
+      (footprint_planner_->params().shared_heuristic &&
+       footprint_planner_->makePlanOnDistanceField(
+           start, goal, *waypoints)) ||
+      dijkstra_planner_->makePlan(start, goal, *waypoints)) {
+    plan_found = true;
+    setWaypointsHeading(start, goal, waypoints);
+  }
+  return plan_found;
+}
+
+void GlobalPlanner::clearRouteCache() {
+  route_cache_.clear();
+  publishRouteCacheStats();
+}
+
+GlobalPlanner::RouteKey GlobalPlanner::routeKey(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal) const {
+  const double tolerance =
+      std::max(params_.route_cache_position_tolerance, 1e-3);
+  const long nheadings = std::max(
+      1l, std::lround(
+              2. * M_PI /
+              std::max(params_.route_cache_heading_tolerance, 1e-3)));
+  // Without footprint the headings of the ends do not change the route.
+  auto heading = [this, nheadings](const geometry_msgs::Pose& pose) -> long {
+    if (!params_.plan_with_footprint)
+      return 0;
+    const long h =
+        std::lround(tf::getYaw(pose.orientation) * nheadings / (2. * M_PI)) %
+        nheadings;
+    return h < 0 ? h + nheadings : h;
+  };
+  const long footprint =
+      params_.plan_with_footprint
+          ? static_cast<long>(footprint::hash(footprint_planner_->footprint()))
+          : 0;
+  return {{std::lround(start.pose.position.x / tolerance),
+           std::lround(start.pose.position.y / tolerance), heading(start.pose),
+           std::lround(goal.pose.position.x / tolerance),
+           std::lround(goal.pose.position.y / tolerance), heading(goal.pose),
+           footprint}};
+}
+
+bool GlobalPlanner::lookupRoute(
+    const RouteKey& key, const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) {
+  auto it = std::find_if(
+      route_cache_.begin(), route_cache_.end(),
+      [&key](const CachedRoute& route) { return route.key == key; });
+  if (it == route_cache_.end()) {
+    ++cache_stats_.misses;
+    return false;
+  }
+  // The route leaves the cache, it returns as the most recently used.
+  CachedRoute route = std::move(*it);
+  route_cache_.erase(it);
+  auto& route_waypoints   = route.waypoints;
+  route_waypoints.front() = start;
+  route_waypoints.back()  = goal;
+  std::vector<std::pair<int, int>> segments;
+  findBlockedSegments(route_waypoints, &segments);
+  if (segments.empty()) {
+    ++cache_stats_.hits;
+  } else {
+    // Replanning most of the route costs as much as a new plan.
+    int nreplanned = 0;
+    for (const auto& segment : segments)
+      nreplanned += segment.second - segment.first;
+    if (nreplanned > params_.max_repaired_fraction * route_waypoints.size()) {
+      ++cache_stats_.failed_repairs;
+      return false;
+    }
+    // Back to front, the indices of the earlier segments stay valid.
+    std::vector<geometry_msgs::PoseStamped> replanned;
+    for (auto segment = segments.rbegin(); segment != segments.rend();
+         ++segment) {
+      if (!computePlan(
+              route_waypoints[segment->first], route_waypoints[segment->second],
+              &replanned) ||
+          replanned.size() < 2) {
+        ++cache_stats_.failed_repairs;
+        if (params_.verbose)
+          ROS_INFO_STREAM(
+              "squirrel_navigation/GlobalPlanner: Could not repair the cached "
+              "route, planning from scratch.");
+        return false;
+      }
+      route_waypoints.erase(
+          route_waypoints.begin() + segment->first,
+          route_waypoints.begin() + segment->second + 1);
+      route_waypoints.insert(
+          route_waypoints.begin() + segment->first, replanned.begin(),
+          replanned.end());
+    }
+    ++cache_stats_.repairs;
+  }
+  if (params_.verbose)
+    ROS_INFO_STREAM(
+        "squirrel_navigation/GlobalPlanner: Reusing a cached route, "
+        << segments.size() << " segments replanned.");
+  *waypoints = route_waypoints;
+  route_cache_.emplace_back(std::move(route));
+  return true;
+}
+
+void GlobalPlanner::storeRoute(
+    const RouteKey& key,
+    const std::vector<geometry_msgs::PoseStamped>& waypoints) {
+  route_cache_.push_back({key, waypoints});
+  while ((int)route_cache_.size() > params_.route_cache_size) {
+    route_cache_.pop_front();
+    ++cache_stats_.evictions;
+  }
+}
+
+void GlobalPlanner::findBlockedSegments(
+    const std::vector<geometry_msgs::PoseStamped>& waypoints,
+    std::vector<std::pair<int, int>>* segments) {
+  segments->clear();
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  if (params_.plan_with_footprint) {
+    const auto& footprint    = footprint_planner_->footprint();
+    const size_t checker_key = footprint::hash(footprint);
+    const double resolution  = costmap->getResolution();
+    if (checker_key != route_checker_key_ ||
+        route_checker_.resolution() != resolution) {
+      route_checker_.setFootprint(footprint, resolution);
+      route_checker_key_ = checker_key;
+    }
+    route_checker_.updateCosts(
+        costmap->getCharMap(), costmap->getSizeInCellsX(),
+        costmap->getSizeInCellsY());
+  }
+  // A waypoint is blocked if the robot collides on it or on the way to the
+  // next one, swept one cell at a time. The robot is already on the start.
+  const int nwaypoints = waypoints.size();
+  const double step    = costmap->getResolution();
+  std::vector<bool> blocked(nwaypoints, false);
+  std::vector<double> length(nwaypoints, 0.);
+  for (int i = 0; i < nwaypoints; ++i) {
+    const auto& pose = waypoints[i].pose;
+    const double yaw = tf::getYaw(pose.orientation);
+    if (i > 0)
+      blocked[i] = poseBlocked(pose.position.x, pose.position.y, yaw);
+    if (i == nwaypoints - 1)
+      break;
+    const auto& next_pose = waypoints[i + 1].pose;
+    const double dx       = math::delta<0>(pose, next_pose);
+    const double dy       = math::delta<1>(pose, next_pose);
+    const double dyaw =
+        angles::normalize_angle(tf::getYaw(next_pose.orientation) - yaw);
+    const double distance = std::hypot(dx, dy);
+    length[i + 1]         = length[i] + distance;
+    const int nsteps      = std::ceil(distance / step);
+    for (int k = 1; k < nsteps && !blocked[i]; ++k) {
+      const double t = static_cast<double>(k) / nsteps;
+      blocked[i]     = poseBlocked(
+          pose.position.x + t * dx, pose.position.y + t * dy, yaw + t * dyaw);
+    }
+  }
+  // Runs of blocked waypoints, extended to free waypoints beyond the margin.
+  const double margin = params_.route_repair_margin;
+  for (int i = 0; i < nwaypoints;) {
+    if (!blocked[i]) {
+      ++i;
+      continue;
+    }
+    const int blocked_first = i;
+    int first = i, last = i;
+    while (last + 1 < nwaypoints && blocked[last + 1])
+      ++last;
+    i = last + 1;
+    while (first > 0 &&
+           (blocked[first] || length[blocked_first] - length[first] < margin))
+      --first;
+    int end = std::min(last + 1, nwaypoints - 1);
+    while (end < nwaypoints - 1 &&
+           (blocked[end] || length[end] - length[last] < margin))
+      ++end;
+    if (!segments->empty() && first <= segments->back().second)
+      segments->back().second = end;
+    else
+      segments->emplace_back(first, end);
+  }
+}
+
+bool GlobalPlanner::poseBlocked(double x, double y, double yaw) const {
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  unsigned int mx, my;
+  if (!costmap->worldToMap(x, y, mx, my))
+    return true;
+  if (params_.plan_with_footprint)
+    return route_checker_.collides(mx, my, yaw);
+  // Without footprint the inflated costs stand for the robot.
+  const unsigned char cost = costmap->getCost(mx, my);
+  return cost >= costmap_2d::INSCRIBED_INFLATED_OBSTACLE &&
+         cost != costmap_2d::NO_INFORMATION;
+}
+
+void GlobalPlanner::publishRouteCacheStats() const {
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level   = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name    = ros::this_node::getName() + "/GlobalPlanner/route_cache";
+  status.message = std::to_string(route_cache_.size()) + " cached routes";
+  auto add_value = [&status](const std::string& key, unsigned long value) {
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key   = key;
+    key_value.value = std::to_string(value);
+    status.values.emplace_back(key_value);
+  };
+  add_value("hits", cache_stats_.hits);
+  add_value("repairs", cache_stats_.repairs);
+  add_value("misses", cache_stats_.misses);
+  add_value("failed_repairs", cache_stats_.failed_repairs);
+  add_value("evictions", cache_stats_.evictions);
+  route_cache_pub_.publish(status);
+}
+
+bool GlobalPlanner::makePlans(
+    const geometry_msgs::PoseStamped& start,
+    const std::vector<geometry_msgs::PoseStamped>& goals,
+    std::vector<Plan>* plans) {
+  if (params_.plan_with_footprint)
+    return footprint_planner_->makePlans(start, goals, plans);
+  Plan no_plan;
+  no_plan.cost = std::numeric_limits<double>::infinity();
+  plans->assign(goals.size(), no_plan);
+  // One search from the start gives the cost of every goal, the paths are
+  // descended from the goals.
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  unsigned int mx, my;
+  if (!costmap->worldToMap(
+          start.pose.position.x, start.pose.position.y, mx, my))
+    return false;
+  batch_field_.compute(
+      costmap->getCharMap(), costmap->getSizeInCellsX(),
+      costmap->getSizeInCellsY(), costmap->getResolution(),
+      costmap->getIndex(mx, my), costmap_2d::INSCRIBED_INFLATED_OBSTACLE, 0);
+  int nplans = 0;
+  std::vector<int> cells;
+  for (unsigned int i = 0; i < goals.size(); ++i) {
+    const auto& goal = goals[i];
+    if (!costmap->worldToMap(
+            goal.pose.position.x, goal.pose.position.y, mx, my))
+      continue;
+    const int goal_index = costmap->getIndex(mx, my);
+    if (batch_field_.cost(goal_index) == costmap::DistanceField::kUnreachable ||
+        !batch_field_.descend(goal_index, &cells))
+      continue;
+    // The descent runs from the goal to the start.
+    auto& waypoints = (*plans)[i].waypoints;
+    waypoints.resize(cells.size());
+    for (unsigned int j = 0; j < cells.size(); ++j) {
+      auto& pose           = waypoints[cells.size() - 1 - j];
+      pose.header.frame_id = costmap_ros_->getGlobalFrameID();
+      costmap->indexToCells(cells[j], mx, my);
+      costmap->mapToWorld(mx, my, pose.pose.position.x, pose.pose.position.y);
+    }
+    setWaypointsHeading(start, goal, &waypoints);
+    (*plans)[i].cost = batch_field_.cost(goal_index);
+    ++nplans;
+  }
+  if (params_.verbose)
+    ROS_INFO_STREAM(
+        "squirrel_navigation/GlobalPlanner: Found "
+        << nplans << " of " << goals.size() << " plans.");
+  return nplans > 0;
+}
+
 void GlobalPlanner::reconfigureCallback(
     GlobalPlannerConfig& config, uint32_t level) {
-  params_.plan_with_footprint        = config.plan_with_footprint;
-  params_.plan_with_constant_heading = config.plan_with_constant_heading;
-  params_.heading                    = config.heading;
-  params_.verbose                    = config.verbose;
-  params_.visualize_topics           = config.visualize_topics;
+  // The cached routes were planned with the previous settings.
+  if (config.plan_with_constant_heading != params_.plan_with_constant_heading ||
+      config.dijkstra_with_footprint_layer !=
+          params_.dijkstra_with_footprint_layer ||
+      config.heading != params_.heading ||
+      config.route_cache_position_tolerance !=
+          params_.route_cache_position_tolerance ||
+      config.route_cache_heading_tolerance !=
+          params_.route_cache_heading_tolerance)
+    route_cache_.clear();
+  params_.plan_with_footprint           = config.plan_with_footprint;
+  params_.plan_with_constant_heading    = config.plan_with_constant_heading;
+  params_.dijkstra_with_footprint_layer = config.dijkstra_with_footprint_layer;
+  params_.heading                       = config.heading;
+  params_.verbose                       = config.verbose;
+  params_.visualize_topics              = config.visualize_topics;
+  params_.footprints_spacing            = config.footprints_spacing;
+  params_.route_cache_size              = config.route_cache_size;
+  params_.route_cache_position_tolerance =
+      config.route_cache_position_tolerance;
+  params_.route_cache_heading_tolerance = config.route_cache_heading_tolerance;
+  params_.route_repair_margin           = config.route_repair_margin;
+  params_.max_repaired_fraction         = config.max_repaired_fraction;
+  while ((int)route_cache_.size() > params_.route_cache_size)
+    route_cache_.pop_front();
+}
+
+void GlobalPlanner::planWithFootprintCallback(
+    const std_msgs::Bool::ConstPtr& msg) {
+  if (params_.verbose && msg->data != params_.plan_with_footprint)
+    ROS_INFO_STREAM(
+        "squirrel_navigation/GlobalPlanner: Set 'plan_with_footprint' to "
+        << std::boolalpha << (bool)msg->data << ".");
+  params_.plan_with_footprint = msg->data;
+}
+
+void GlobalPlanner::setWaypointsHeading(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) const {
+  if (waypoints->empty())
+    return;
+  waypoints->front() = start;
+  for (int i = 1; i < (int)waypoints->size() - 1; ++i) {
+    auto& waypoint = (*waypoints)[i].pose;
+    if (params_.plan_with_constant_heading) {
+      waypoint.orientation = tf::createQuaternionMsgFromYaw(params_.heading);
+    } else {
+      const auto& prev_waypoint = (*waypoints)[i - 1].pose;
+      const auto& next_waypoint = (*waypoints)[i + 1].pose;
+      const double dx = math::delta<0>(prev_waypoint, next_waypoint);
+      const double dy = math::delta<1>(prev_waypoint, next_waypoint);
+      waypoint.orientation =
+          tf::createQuaternionMsgFromYaw(std::atan2(dy, dx));
+    }
+  }
+  waypoints->back() = goal;
+}
+
+bool GlobalPlanner::setWaypointsHeadingInCSpace(
+    const geometry_msgs::PoseStamped& start,
+    const geometry_msgs::PoseStamped& goal,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) const {
+  // The costmap is locked while planning, the layer is not updated.
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  const costmap::CSpaceMap& cspace     = footprint_layer_->cspace();
+  const int nwaypoints                 = waypoints->size();
+  if (nwaypoints < 2 || cspace.nheadings() == 0 ||
+      cspace.sizeX() != (int)costmap->getSizeInCellsX() ||
+      cspace.sizeY() != (int)costmap->getSizeInCellsY())
+    return false;
+  // Cells of the waypoints and headings of the path.
+  std::vector<int> cells(nwaypoints);
+  std::vector<double> yaws(nwaypoints);
+  for (int i = 0; i < nwaypoints; ++i) {
+    const auto& pose = (*waypoints)[i].pose;
+    unsigned int mx, my;
+    if (!costmap->worldToMap(pose.position.x, pose.position.y, mx, my))
+      return false;
+    cells[i]                  = costmap->getIndex(mx, my);
+    const auto& prev_waypoint = (*waypoints)[std::max(i - 1, 0)].pose;
+    const auto& next_waypoint =
+        (*waypoints)[std::min(i + 1, nwaypoints - 1)].pose;
+    yaws[i] = std::atan2(
+        math::delta<1>(prev_waypoint, next_waypoint),
+        math::delta<0>(prev_waypoint, next_waypoint));
+  }
+  std::vector<int> headings;
+  if (!cspace.assignHeadings(
+          cells, yaws, cspace.headingIndex(tf::getYaw(start.pose.orientation)),
+          cspace.headingIndex(tf::getYaw(goal.pose.orientation)), &headings)) {
+    if (params_.verbose)
+      ROS_INFO_STREAM(
+          "squirrel_navigation/GlobalPlanner: No free headings along the "
+          "Dijkstra path, planning with the footprint.");
+    return false;
+  }
+  waypoints->front() = start;
+  for (int i = 1; i < nwaypoints - 1; ++i)
+    (*waypoints)[i].pose.orientation =
+        tf::createQuaternionMsgFromYaw(cspace.heading(headings[i]));
+  waypoints->back() = goal;
+  return true;
 }
 
 void GlobalPlanner::publishPlan(
@@ -175,51 +583,48 @@ void GlobalPlanner::publishWaypoints(
 void GlobalPlanner::publishFootprints(
     const std::vector<geometry_msgs::PoseStamped>& waypoints,
     const ros::Time& stamp) {
-  if (!params_.visualize_topics)
+  if (!params_.visualize_topics || footprints_pub_.getNumSubscribers() == 0)
     return;
-  // Number of waypoints and footprint marker.
-  const int nwaypoints = waypoints.size();
-  const auto& footprint =
-      footprint::closedPolygon(footprint_planner_->footprint());
-  // Create the visualization marker.
-  visualization_msgs::MarkerArray marker_array_msg;
-  marker_array_msg.markers.reserve(std::max(nwaypoints, last_nwaypoints_));
-  for (int i = 0; i < nwaypoints; ++i) {
-    visualization_msgs::Marker marker;
-    marker.header.stamp    = stamp;
-    marker.header.frame_id = costmap_ros_->getGlobalFrameID();
-    marker.ns              = ros::this_node::getNamespace() + "GlobalPlanner";
-    marker.id              = i;
-    marker.type            = visualization_msgs::Marker::LINE_STRIP;
-    marker.action          = visualization_msgs::Marker::MODIFY;
-    marker.pose            = waypoints[i].pose;
-    marker.scale.x         = 0.0025;
-    marker.color.r         = 0.0;
-    marker.color.g         = 0.0;
-    marker.color.b         = 0.0;
-    marker.color.a         = 0.7;
-    marker.points          = footprint;
-    marker_array_msg.markers.emplace_back(marker);
-  }
-  // Delete the old ones.
-  for (int i = nwaypoints; i < last_nwaypoints_; ++i) {
-    visualization_msgs::Marker delete_marker;
-    delete_marker.ns     = ros::this_node::getNamespace() + "GlobalPlanner";
-    delete_marker.id     = i;
-    delete_marker.action = visualization_msgs::Marker::DELETE;
-    marker_array_msg.markers.emplace_back(delete_marker);
-  }
-  last_nwaypoints_ = nwaypoints;
-  footprints_pub_.publish(marker_array_msg);
+  // All the footprints go in one marker, its buffer is reused.
+  auto& marker           = footprints_msg_.markers.front();
+  marker.header.stamp    = stamp;
+  marker.header.frame_id = costmap_ros_->getGlobalFrameID();
+  marker.ns              = ros::this_node::getNamespace() + "GlobalPlanner";
+  marker.id              = 0;
+  marker.type            = visualization_msgs::Marker::LINE_LIST;
+  marker.action          = waypoints.empty()
+                               ? visualization_msgs::Marker::DELETE
+                               : visualization_msgs::Marker::MODIFY;
+  marker.pose.orientation.w = 1.0;
+  marker.scale.x            = 0.0025;
+  marker.color.r            = 0.0;
+  marker.color.g            = 0.0;
+  marker.color.b            = 0.0;
+  marker.color.a            = 0.7;
+  marker.points.clear();
+  footprint::appendOutlines(
+      footprint_planner_->footprint(), waypoints.size(),
+      [&waypoints](int i) -> const geometry_msgs::Pose& {
+        return waypoints[i].pose;
+      },
+      params_.footprints_spacing, &marker.points);
+  footprints_pub_.publish(footprints_msg_);
 }
 
 GlobalPlanner::Params GlobalPlanner::Params::defaultParams() {
   Params params;
-  params.plan_with_footprint        = false;
-  params.plan_with_constant_heading = false;
-  params.heading                    = 0.0;
-  params.visualize_topics           = true;
-  params.verbose                    = false;
+  params.plan_with_footprint            = false;
+  params.plan_with_constant_heading     = false;
+  params.dijkstra_with_footprint_layer  = false;
+  params.heading                        = 0.0;
+  params.visualize_topics               = true;
+  params.footprints_spacing             = 0.0;
+  params.verbose                        = false;
+  params.route_cache_size               = 32;
+  params.route_cache_position_tolerance = 0.1;
+  params.route_cache_heading_tolerance  = 0.2;
+  params.route_repair_margin            = 0.5;
+  params.max_repaired_fraction          = 0.5;
   return params;
 }
 
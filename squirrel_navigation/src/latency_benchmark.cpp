@@ -0,0 +1,461 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+
+// End-to-end latency of the navigation stack, from a sensor frame to the
+// first velocity command that reacts to it. The node relays the laser scans
+// or the depth clouds of a bag to the stack and periodically injects a
+// synthetic obstacle in front of the sensor. The stages of the stack are
+// probed on topics whose header carries the stamp of the frame they were
+// computed from, e.g. the output of the pointcloud filter or the
+// observation_stamp topic of the navigation layer: the latency of a stage is
+// the wall time from the injection to its first message stamped at or after
+// the injected frame. The latency of the commands is the wall time to the
+// first cmd_vel that slows the robot down. At the end the distributions of
+// all the stages are printed, written to a csv file and compared with the
+// ones of a baseline run.
+//
+// Usage: see launch/latency_benchmark.launch and README.md.
+
+#include <ros/ros.h>
+#include <ros/serialization.h>
+
+#include <topic_tools/shape_shifter.h>
+
+#include <geometry_msgs/Twist.h>
+#include <sensor_msgs/LaserScan.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace benchmark {
+
+// Latency samples of one stage, in milliseconds.
+class Samples {
+ public:
+  inline void push(double latency) { samples_.push_back(latency); }
+  inline void miss() { ++num_missed_; }
+
+  size_t size() const { return samples_.size(); }
+  const std::vector<double>& samples() const { return samples_; }
+
+  // Percentile p of the samples, zero if there are none.
+  double percentile(double p) const {
+    if (samples_.empty())
+      return 0.;
+    std::vector<double> sorted = samples_;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min<size_t>(sorted.size() - 1, p * sorted.size())];
+  }
+
+  double mean() const {
+    double sum = 0.;
+    for (const double sample : samples_)
+      sum += sample;
+    return samples_.empty() ? 0. : sum / samples_.size();
+  }
+
+  void print(const std::string& name) const {
+    if (samples_.empty()) {
+      std::printf("%-22s %8s %8zu\n", name.c_str(), "-", num_missed_);
+      return;
+    }
+    std::printf(
+        "%-22s %8zu %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name.c_str(),
+        samples_.size(), num_missed_, mean(), percentile(0.5),
+        percentile(0.9), percentile(0.99), percentile(1.));
+  }
+
+ private:
+  std::vector<double> samples_;
+  size_t num_missed_ = 0;
+};
+
+class LatencyBenchmark {
+ public:
+  class Params {
+   public:
+    static Params defaultParams();
+
+    std::string sensor;
+    double warmup_time, period, obstacle_duration, timeout;
+    double obstacle_distance, obstacle_width;
+    double velocity_drop;
+    int num_injections;
+    std::string output_file, baseline_file;
+    double regression_tolerance;
+  };
+
+ public:
+  LatencyBenchmark();
+  virtual ~LatencyBenchmark() {}
+
+  // Print and save the distributions, once.
+  void finish();
+
+ private:
+  // The obstacle injected at a frame and the stage latencies it produced.
+  struct Injection {
+    ros::Time stamp;
+    ros::WallTime wall_time;
+    double reference_speed;
+    std::map<std::string, double> latencies;
+  };
+
+  void scanCallback(const sensor_msgs::LaserScan::ConstPtr& scan);
+  void cloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud);
+  void probeCallback(
+      const std::string& stage,
+      const topic_tools::ShapeShifter::ConstPtr& msg);
+  void cmdVelCallback(const geometry_msgs::Twist::ConstPtr& cmd);
+
+  // Whether the frame gets the obstacle, a new injection starts at the first
+  // frame of a period.
+  bool injectFrame(const ros::Time& stamp);
+  // Close the current injection once all its stages are in or timed out.
+  void updateInjection(const ros::WallTime& now);
+  void recordStage(const std::string& stage, const ros::WallTime& now);
+
+  bool readBaseline(std::map<std::string, Samples>* baseline) const;
+
+  Params params_;
+  ros::Subscriber sensor_sub_, cmd_vel_sub_;
+  ros::Publisher sensor_pub_;
+  std::vector<std::string> stages_;
+  std::vector<ros::Subscriber> probe_subs_;
+
+  ros::WallTime start_time_, last_injection_time_;
+  std::unique_ptr<Injection> injection_;
+  double last_speed_;
+  int num_injections_;
+  std::map<std::string, Samples> samples_;
+  std::vector<Injection> injections_;
+  bool finished_;
+};
+
+LatencyBenchmark::Params LatencyBenchmark::Params::defaultParams() {
+  Params params;
+  params.sensor               = "scan";
+  params.warmup_time          = 10.;
+  params.period               = 8.;
+  params.obstacle_duration    = 2.;
+  params.timeout              = 2.;
+  params.obstacle_distance    = 0.6;
+  params.obstacle_width       = 0.4;
+  params.velocity_drop        = 0.05;
+  params.num_injections       = 20;
+  params.output_file          = "";
+  params.baseline_file        = "";
+  params.regression_tolerance = 0.2;
+  return params;
+}
+
+LatencyBenchmark::LatencyBenchmark()
+    : params_(Params::defaultParams()),
+      last_speed_(0.),
+      num_injections_(0),
+      finished_(false) {
+  ros::NodeHandle pnh("~"), nh;
+  pnh.param("sensor", params_.sensor, params_.sensor);
+  pnh.param("warmup_time", params_.warmup_time, params_.warmup_time);
+  pnh.param("period", params_.period, params_.period);
+  pnh.param(
+      "obstacle_duration", params_.obstacle_duration,
+      params_.obstacle_duration);
+  pnh.param("timeout", params_.timeout, params_.timeout);
+  pnh.param(
+      "obstacle_distance", params_.obstacle_distance,
+      params_.obstacle_distance);
+  pnh.param("obstacle_width", params_.obstacle_width, params_.obstacle_width);
+  pnh.param("velocity_drop", params_.velocity_drop, params_.velocity_drop);
+  pnh.param("num_injections", params_.num_injections, params_.num_injections);
+  pnh.param("output_file", params_.output_file, params_.output_file);
+  pnh.param("baseline_file", params_.baseline_file, params_.baseline_file);
+  pnh.param(
+      "regression_tolerance", params_.regression_tolerance,
+      params_.regression_tolerance);
+  // Relay of the sensor of the bag, remapped by the launch file.
+  if (params_.sensor == "cloud") {
+    sensor_pub_ = nh.advertise<sensor_msgs::PointCloud2>("sensor_out", 1);
+    sensor_sub_ = nh.subscribe(
+        "sensor_in", 1, &LatencyBenchmark::cloudCallback, this);
+  } else {
+    params_.sensor = "scan";
+    sensor_pub_    = nh.advertise<sensor_msgs::LaserScan>("sensor_out", 1);
+    sensor_sub_    = nh.subscribe(
+        "sensor_in", 1, &LatencyBenchmark::scanCallback, this);
+  }
+  cmd_vel_sub_ = nh.subscribe(
+      "cmd_vel", 1, &LatencyBenchmark::cmdVelCallback, this);
+  // Stages, in the order of the pipeline.
+  std::vector<std::string> stages;
+  pnh.getParam("stages", stages);
+  for (const std::string& stage : stages) {
+    std::string topic;
+    if (!pnh.getParam("stage_topics/" + stage, topic)) {
+      ROS_WARN_STREAM(
+          "squirrel_navigation/LatencyBenchmark: No topic for the stage "
+          << stage << ".");
+      continue;
+    }
+    stages_.push_back(stage);
+    probe_subs_.push_back(nh.subscribe<topic_tools::ShapeShifter>(
+        topic, 10,
+        boost::bind(&LatencyBenchmark::probeCallback, this, stage, _1)));
+  }
+  stages_.push_back("command");
+  start_time_ = last_injection_time_ = ros::WallTime::now();
+  ROS_INFO_STREAM(
+      "squirrel_navigation/LatencyBenchmark: injecting "
+      << params_.num_injections << " obstacles in the " << params_.sensor
+      << " frames.");
+}
+
+bool LatencyBenchmark::injectFrame(const ros::Time& stamp) {
+  const ros::WallTime now = ros::WallTime::now();
+  updateInjection(now);
+  if (injection_)
+    return (now - injection_->wall_time).toSec() < params_.obstacle_duration;
+  if (num_injections_ >= params_.num_injections ||
+      (now - start_time_).toSec() < params_.warmup_time ||
+      (now - last_injection_time_).toSec() < params_.period)
+    return false;
+  injection_.reset(new Injection);
+  injection_->stamp           = stamp;
+  injection_->wall_time       = now;
+  injection_->reference_speed = last_speed_;
+  last_injection_time_        = now;
+  ++num_injections_;
+  return true;
+}
+
+void LatencyBenchmark::updateInjection(const ros::WallTime& now) {
+  if (!injection_)
+    return;
+  const bool complete = injection_->latencies.size() == stages_.size();
+  if (!complete && (now - injection_->wall_time).toSec() <
+                       params_.obstacle_duration + params_.timeout)
+    return;
+  for (const std::string& stage : stages_)
+    if (injection_->latencies.count(stage) == 0)
+      samples_[stage].miss();
+  injections_.push_back(*injection_);
+  injection_.reset();
+  if (num_injections_ >= params_.num_injections) {
+    finish();
+    ros::shutdown();
+  }
+}
+
+void LatencyBenchmark::recordStage(
+    const std::string& stage, const ros::WallTime& now) {
+  if (!injection_ || injection_->latencies.count(stage) > 0)
+    return;
+  const double latency = (now - injection_->wall_time).toSec() * 1e3;
+  injection_->latencies[stage] = latency;
+  samples_[stage].push(latency);
+}
+
+void LatencyBenchmark::scanCallback(
+    const sensor_msgs::LaserScan::ConstPtr& scan) {
+  if (!injectFrame(scan->header.stamp)) {
+    sensor_pub_.publish(scan);
+    return;
+  }
+  // A wall across the sensor axis, at the obstacle distance.
+  sensor_msgs::LaserScan::Ptr out(new sensor_msgs::LaserScan(*scan));
+  const double half_angle =
+      std::atan2(0.5 * params_.obstacle_width, params_.obstacle_distance);
+  for (size_t i = 0; i < out->ranges.size(); ++i) {
+    const double angle = out->angle_min + i * out->angle_increment;
+    if (std::abs(angle) > half_angle)
+      continue;
+    const float range = params_.obstacle_distance / std::cos(angle);
+    if (!(out->ranges[i] < range))
+      out->ranges[i] = range;
+  }
+  sensor_pub_.publish(out);
+}
+
+void LatencyBenchmark::cloudCallback(
+    const sensor_msgs::PointCloud2::ConstPtr& cloud) {
+  if (!injectFrame(cloud->header.stamp)) {
+    sensor_pub_.publish(cloud);
+    return;
+  }
+  // The points of the cloud and a square patch across the optical axis (z),
+  // at the obstacle distance.
+  const double spacing  = 0.02;
+  const int patch_cells = std::max(1, int(params_.obstacle_width / spacing));
+  sensor_msgs::PointCloud2::Ptr out(new sensor_msgs::PointCloud2);
+  out->header = cloud->header;
+  sensor_msgs::PointCloud2Modifier modifier(*out);
+  modifier.setPointCloud2FieldsByString(1, "xyz");
+  modifier.resize(cloud->width * cloud->height + patch_cells * patch_cells);
+  sensor_msgs::PointCloud2Iterator<float> out_x(*out, "x"), out_y(*out, "y"),
+      out_z(*out, "z");
+  sensor_msgs::PointCloud2ConstIterator<float> in_x(*cloud, "x"),
+      in_y(*cloud, "y"), in_z(*cloud, "z");
+  for (; in_x != in_x.end();
+       ++in_x, ++in_y, ++in_z, ++out_x, ++out_y, ++out_z) {
+    *out_x = *in_x;
+    *out_y = *in_y;
+    *out_z = *in_z;
+  }
+  for (int i = 0; i < patch_cells; ++i)
+    for (int j = 0; j < patch_cells; ++j, ++out_x, ++out_y, ++out_z) {
+      *out_x = (i + 0.5) * spacing - 0.5 * params_.obstacle_width;
+      *out_y = (j + 0.5) * spacing - 0.5 * params_.obstacle_width;
+      *out_z = params_.obstacle_distance;
+    }
+  sensor_pub_.publish(out);
+}
+
+void LatencyBenchmark::probeCallback(
+    const std::string& stage, const topic_tools::ShapeShifter::ConstPtr& msg) {
+  const ros::WallTime now = ros::WallTime::now();
+  if (!injection_)
+    return;
+  // The stamp of the header leading the message, after its sequence number.
+  std::vector<uint8_t> buffer(msg->size());
+  ros::serialization::OStream stream(buffer.data(), buffer.size());
+  msg->write(stream);
+  if (buffer.size() < 12)
+    return;
+  uint32_t sec, nsec;
+  std::memcpy(&sec, &buffer[4], sizeof(sec));
+  std::memcpy(&nsec, &buffer[8], sizeof(nsec));
+  if (ros::Time(sec, nsec) >= injection_->stamp)
+    recordStage(stage, now);
+}
+
+void LatencyBenchmark::cmdVelCallback(
+    const geometry_msgs::Twist::ConstPtr& cmd) {
+  const ros::WallTime now = ros::WallTime::now();
+  const double speed      = std::abs(cmd->linear.x);
+  // The robot has to be moving when the obstacle appears.
+  if (injection_ && injection_->reference_speed > params_.velocity_drop &&
+      speed <= injection_->reference_speed - params_.velocity_drop)
+    recordStage("command", now);
+  if (!injection_)
+    last_speed_ = speed;
+  updateInjection(now);
+}
+
+bool LatencyBenchmark::readBaseline(
+    std::map<std::string, Samples>* baseline) const {
+  std::ifstream file(params_.baseline_file);
+  if (!file)
+    return false;
+  std::string line;
+  std::getline(file, line);  // Column names.
+  while (std::getline(file, line)) {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::istringstream fields(line);
+    int injection;
+    std::string stage;
+    double latency;
+    if (fields >> injection >> stage >> latency)
+      (*baseline)[stage].push(latency);
+  }
+  return true;
+}
+
+void LatencyBenchmark::finish() {
+  if (finished_)
+    return;
+  finished_ = true;
+  std::printf(
+      "\n%zu injections, latencies from the injected frame [ms]\n",
+      injections_.size());
+  std::printf(
+      "%-22s %8s %8s %10s %10s %10s %10s %10s\n", "stage", "samples", "missed",
+      "mean", "median", "p90", "p99", "max");
+  for (const std::string& stage : stages_)
+    samples_[stage].print(stage);
+  if (!params_.output_file.empty()) {
+    std::ofstream file(params_.output_file);
+    file << "injection,stage,latency_ms\n";
+    for (size_t i = 0; i < injections_.size(); ++i)
+      for (const auto& latency : injections_[i].latencies)
+        file << i << "," << latency.first << "," << latency.second << "\n";
+    if (!file)
+      ROS_ERROR_STREAM(
+          "squirrel_navigation/LatencyBenchmark: Unable to write "
+          << params_.output_file << ".");
+  }
+  if (params_.baseline_file.empty())
+    return;
+  std::map<std::string, Samples> baseline;
+  if (!readBaseline(&baseline)) {
+    ROS_ERROR_STREAM(
+        "squirrel_navigation/LatencyBenchmark: Unable to read the baseline "
+        << params_.baseline_file << ".");
+    return;
+  }
+  // A stage regresses if its median or its 90th percentile grows beyond the
+  // tolerance.
+  std::printf("\nchange from %s\n", params_.baseline_file.c_str());
+  for (const std::string& stage : stages_) {
+    const Samples& current = samples_[stage];
+    const Samples& base    = baseline[stage];
+    if (current.size() == 0 || base.size() == 0)
+      continue;
+    const double median_change =
+        current.percentile(0.5) / base.percentile(0.5) - 1.;
+    const double p90_change =
+        current.percentile(0.9) / base.percentile(0.9) - 1.;
+    const bool regression = median_change > params_.regression_tolerance ||
+                            p90_change > params_.regression_tolerance;
+    std::printf(
+        "%-22s median %+7.1f%% p90 %+7.1f%%%s\n", stage.c_str(),
+        1e2 * median_change, 1e2 * p90_change,
+        regression ? "  REGRESSION" : "");
+  }
+}
+
+}  // namespace benchmark
+}  // namespace squirrel_navigation
+
+int main(int argc, char** argv) {
+  ros::init(argc, argv, "latency_benchmark");
+  squirrel_navigation::benchmark::LatencyBenchmark benchmark;
+  ros::spin();
+  benchmark.finish();
+  return 0;
+}
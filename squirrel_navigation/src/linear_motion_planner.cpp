@@ -62,17 +62,17 @@ void LinearMotionPlanner::reset(
     const ros::Time& start) {
   if (waypoints.size() < 2)
     return;
+  // Copy the poses in the compact trajectory.
+  frame_id_ = waypoints.front().header.frame_id;
+  waypoints_.clear();
+  waypoints_.reserve(waypoints.size());
+  for (const auto& waypoint : waypoints)
+    waypoints_.pushBack(waypoint.pose, 0.);
+  heading_waypoint_ = 0;
   // Create the velocity profile.
-  smoothTrajectory(waypoints, 0, waypoints.size(), &waypoints_);
-  waypoints_[0].header.stamp = start;
-  for (unsigned int i = 1; i < waypoints_.size(); ++i) {
-    const double dl = math::linearDistance2D(waypoints_[i], waypoints_[i - 1]);
-    const double da =
-        math::angularDistanceYaw(waypoints_[i], waypoints_[i - 1]);
-    const double dt = computeSafetyVelocity(dl, da);
-    waypoints_[i].header.stamp =
-        waypoints_[i - 1].header.stamp + ros::Duration(dt);
-  }
+  smoothTrajectoryInPlace(0, waypoints_.size());
+  waypoints_.t(0) = start.toSec();
+  computeTimeProfile(1);
 }
 
 void LinearMotionPlanner::update(
@@ -80,77 +80,73 @@ void LinearMotionPlanner::update(
     const ros::Time& stamp) {
   std::unique_lock<std::mutex> lock(update_mtx_);
   // Update the trajectory with new waypoints.
-  const int head_waypoint_index = computeHeadingWaypointIndex(stamp);
+  int head_waypoint_index = computeHeadingWaypointIndex(stamp);
   if (head_waypoint_index + params_.waypoints_heading_lookahead >=
       (int)waypoints_.size() - 1)
     return;
   if ((int)waypoints.size() - 1 < params_.waypoints_heading_lookahead)
     return;
-  // Merge the new trajectory in to the new one.
-  const int last_waypoint_index = std::max(0, head_waypoint_index - 1);
-  waypoints_.erase(
-      waypoints_.begin() + head_waypoint_index + 1, waypoints_.end());
-  waypoints_.insert(
-      waypoints_.end(), waypoints.begin() + params_.waypoints_heading_lookahead,
-      waypoints.end());
-  smoothTrajectoryInPlace(head_waypoint_index, waypoints_.size(), &waypoints_);
-  // Recompute the velocity profiles.
-  for (unsigned int i = head_waypoint_index; i < waypoints_.size(); ++i) {
-    const double dl = math::linearDistance2D(waypoints_[i], waypoints_[i - 1]);
-    const double da =
-        math::angularDistanceYaw(waypoints_[i], waypoints_[i - 1]);
-    const double dt = computeSafetyVelocity(dl, da);
-    waypoints_[i].header.stamp =
-        waypoints_[i - 1].header.stamp + ros::Duration(dt);
+  // Drop the waypoints already passed but the last one.
+  if (head_waypoint_index > 1) {
+    const int npassed = head_waypoint_index - 1;
+    waypoints_.popFront(npassed);
+    head_waypoint_index = 1;
+    heading_waypoint_   = std::max(0, heading_waypoint_ - npassed);
   }
+  // Splice the new trajectory in after the heading waypoint.
+  waypoints_.truncate(head_waypoint_index + 1);
+  for (unsigned int i = params_.waypoints_heading_lookahead;
+       i < waypoints.size(); ++i)
+    waypoints_.pushBack(waypoints[i].pose, 0.);
+  heading_waypoint_ = std::min<int>(heading_waypoint_, waypoints_.size() - 1);
+  smoothTrajectoryInPlace(head_waypoint_index, waypoints_.size());
+  // Recompute the velocity profiles.
+  computeTimeProfile(head_waypoint_index);
 }
 
 void LinearMotionPlanner::computeReference(
     const ros::Time& ref_stamp, geometry_msgs::Pose* ref_pose,
     geometry_msgs::Twist* ref_twist) {
   std::unique_lock<std::mutex> lock(update_mtx_);
-  const ros::Time& stamp   = ref_stamp + ros::Duration(params_.lookahead);
-  const auto next_waypoint = computeHeadingWaypoint(stamp);
-  const auto last_waypoint = std::prev(next_waypoint);
-  const geometry_msgs::Pose& last_pose = last_waypoint->pose;
-  const geometry_msgs::Pose& head_pose = next_waypoint->pose;
-  const ros::Time& last_stamp          = last_waypoint->header.stamp;
-  const ros::Time& head_stamp          = next_waypoint->header.stamp;
+  const double stamp = (ref_stamp + ros::Duration(params_.lookahead)).toSec();
+  const int next_waypoint = computeReferenceWaypointIndex(stamp);
   // Update the trajectory starter.
   heading_waypoint_ = next_waypoint;
-  // Constant linear profile for velocity.
-  const double delta_stamp = head_stamp.toSec() - last_stamp.toSec();
-  ref_twist->linear.x      = math::delta<0>(last_pose, head_pose) / delta_stamp;
-  ref_twist->linear.y      = math::delta<1>(last_pose, head_pose) / delta_stamp;
-  ref_twist->angular.z     = math::delta<2>(last_pose, head_pose) / delta_stamp;
-  // Interpolate waypoints for the reference pose.
-  const double alpha = (stamp.toSec() - last_stamp.toSec()) / delta_stamp;
-  const double inter = std::min(alpha, 1.);
-  ref_pose->position = math::linearInterpolation2D(last_pose, head_pose, inter);
-  ref_pose->orientation = math::slerpYaw(last_pose, head_pose, inter);
+  interpolateReference(next_waypoint, stamp, ref_pose, ref_twist);
 }
 
-const std::vector<geometry_msgs::PoseStamped>& LinearMotionPlanner::waypoints()
-    const {
-  return waypoints_;
+void LinearMotionPlanner::sampleReference(
+    const ros::Time& ref_stamp, geometry_msgs::Pose* ref_pose,
+    geometry_msgs::Twist* ref_twist) const {
+  std::unique_lock<std::mutex> lock(update_mtx_);
+  const double stamp = (ref_stamp + ros::Duration(params_.lookahead)).toSec();
+  const int next_waypoint = computeReferenceWaypointIndex(stamp);
+  interpolateReference(next_waypoint, stamp, ref_pose, ref_twist);
 }
 
-std::vector<geometry_msgs::PoseStamped> LinearMotionPlanner::trajectory()
-    const {
-  std::vector<geometry_msgs::PoseStamped> trajectory;
-  trajectory.reserve(waypoints_.size());
-  for (auto it = heading_waypoint_; it != waypoints_.end(); ++it)
-    trajectory.emplace_back(*it);
-  trajectory.shrink_to_fit();
-  return trajectory;
+utils::Trajectory::View LinearMotionPlanner::waypoints() const {
+  return waypoints_.view();
 }
 
-const geometry_msgs::PoseStamped& LinearMotionPlanner::start() const {
-  return waypoints_.front();
+utils::Trajectory::View LinearMotionPlanner::trajectory() const {
+  return waypoints_.view(heading_waypoint_, waypoints_.size());
 }
 
-const geometry_msgs::PoseStamped& LinearMotionPlanner::goal() const {
-  return waypoints_.back();
+geometry_msgs::PoseStamped LinearMotionPlanner::start() const {
+  geometry_msgs::PoseStamped start;
+  start.header.frame_id = frame_id_;
+  start.header.stamp    = ros::Time(waypoints_.t(0));
+  start.pose            = waypoints_.pose(0);
+  return start;
+}
+
+geometry_msgs::PoseStamped LinearMotionPlanner::goal() const {
+  const int last = waypoints_.size() - 1;
+  geometry_msgs::PoseStamped goal;
+  goal.header.frame_id = frame_id_;
+  goal.header.stamp    = ros::Time(waypoints_.t(last));
+  goal.pose            = waypoints_.pose(last);
+  return goal;
 }
 
 void LinearMotionPlanner::reconfigureCallback(
@@ -171,54 +167,74 @@ double LinearMotionPlanner::computeSafetyVelocity(
   return params_.time_scaler * std::max(lin_time, ang_time);
 }
 
-std::vector<geometry_msgs::PoseStamped>::const_iterator
-    LinearMotionPlanner::computeHeadingWaypoint(const ros::Time& stamp) const {
-  geometry_msgs::PoseStamped query_pose;
-  query_pose.header.stamp         = stamp;
-  const auto heading_waypoint_ptr = std::upper_bound(
-      waypoints_.begin(), waypoints_.end(), query_pose,
-      [](const geometry_msgs::PoseStamped& lhs,
-         const geometry_msgs::PoseStamped& rhs) {
-        return lhs.header.stamp.toSec() < rhs.header.stamp.toSec();
-      });
-  return heading_waypoint_ptr != waypoints_.end()
-             ? heading_waypoint_ptr
-             : std::prev(heading_waypoint_ptr);
-}
-
 int LinearMotionPlanner::computeHeadingWaypointIndex(
     const ros::Time& stamp) const {
-  return std::distance(waypoints_.begin(), computeHeadingWaypoint(stamp));
+  const int index = waypoints_.upperBound(stamp.toSec());
+  return std::min<int>(index, waypoints_.size() - 1);
 }
 
-void LinearMotionPlanner::smoothTrajectory(
-    const std::vector<geometry_msgs::PoseStamped>& waypoints, int begin,
-    int end, std::vector<geometry_msgs::PoseStamped>* smooth_waypoints) const {
-  smooth_waypoints->clear();
-  if (waypoints.empty())
-    return;
-  smooth_waypoints->reserve(end - begin);
-  smooth_waypoints->emplace_back(waypoints.front());
-  for (int i = begin + 1; i < end - 1; ++i) {
-    geometry_msgs::PoseStamped waypoint;
-    waypoint.pose.position = math::linearInterpolation2D(
-        smooth_waypoints->at(i - 1), waypoints[i], params_.linear_smoother);
-    waypoint.pose.orientation = math::slerpYaw(
-        smooth_waypoints->at(i - 1), waypoints[i], params_.angular_smoother);
-    smooth_waypoints->emplace_back(waypoint);
+int LinearMotionPlanner::computeReferenceWaypointIndex(double stamp) const {
+  // The reference time moves forward, so the waypoint is usually close to
+  // the last heading waypoint. Otherwise fall back to the binary search.
+  const int last = waypoints_.size() - 1;
+  int index      = heading_waypoint_;
+  if (index >= 1 && index <= last && waypoints_.t(index - 1) <= stamp) {
+    for (int step = 0; step < kMaxCursorSteps; ++step) {
+      if (index == last || waypoints_.t(index) > stamp)
+        return index;
+      ++index;
+    }
   }
-  smooth_waypoints->emplace_back(waypoints.back());
+  return std::max(1, computeHeadingWaypointIndex(ros::Time(stamp)));
+}
+
+void LinearMotionPlanner::interpolateReference(
+    int next_waypoint, double stamp, geometry_msgs::Pose* ref_pose,
+    geometry_msgs::Twist* ref_twist) const {
+  const int last_waypoint = next_waypoint - 1;
+  // Constant linear profile for velocity, precomputed per segment.
+  ref_twist->linear.x  = waypoints_.vx(next_waypoint);
+  ref_twist->linear.y  = waypoints_.vy(next_waypoint);
+  ref_twist->angular.z = waypoints_.wz(next_waypoint);
+  // Interpolate waypoints for the reference pose.
+  const double last_stamp = waypoints_.t(last_waypoint);
+  const double head_stamp = waypoints_.t(next_waypoint);
+  const double dt         = std::min(stamp, head_stamp) - last_stamp;
+  const double x          = waypoints_.x(last_waypoint);
+  const double y          = waypoints_.y(last_waypoint);
+  const double a          = waypoints_.yaw(last_waypoint);
+  ref_pose->position.x    = x + dt * ref_twist->linear.x;
+  ref_pose->position.y    = y + dt * ref_twist->linear.y;
+  ref_pose->position.z    = 0.;
+  ref_pose->orientation   = tf::createQuaternionMsgFromYaw(
+      angles::normalize_angle(a + dt * ref_twist->angular.z));
 }
 
-void LinearMotionPlanner::smoothTrajectoryInPlace(
-    int begin, int end, std::vector<geometry_msgs::PoseStamped>* waypoints) {
+void LinearMotionPlanner::smoothTrajectoryInPlace(int begin, int end) {
   for (int i = begin + 1; i < end - 1; ++i) {
-    geometry_msgs::PoseStamped waypoint;
-    waypoint.pose.position = math::linearInterpolation2D(
-        waypoints->at(i - 1), waypoints->at(i), params_.linear_smoother);
-    waypoint.pose.orientation = math::slerpYaw(
-        waypoints->at(i - 1), waypoints->at(i), params_.angular_smoother);
-    waypoints->at(i) = waypoint;
+    const double x = waypoints_.x(i - 1), y = waypoints_.y(i - 1);
+    const double a = waypoints_.yaw(i - 1);
+    waypoints_.x(i) = x + params_.linear_smoother * (waypoints_.x(i) - x);
+    waypoints_.y(i) = y + params_.linear_smoother * (waypoints_.y(i) - y);
+    waypoints_.yaw(i) = angles::normalize_angle(
+        a + params_.angular_smoother *
+                angles::normalize_angle(waypoints_.yaw(i) - a));
+  }
+}
+
+void LinearMotionPlanner::computeTimeProfile(int begin) {
+  waypoints_.updateLengths(begin);
+  for (int i = std::max(1, begin); i < (int)waypoints_.size(); ++i) {
+    const double dl = waypoints_.s(i) - waypoints_.s(i - 1);
+    const double da =
+        angles::normalize_angle(waypoints_.yaw(i) - waypoints_.yaw(i - 1));
+    const double dt = computeSafetyVelocity(dl, std::abs(da));
+    waypoints_.t(i) = waypoints_.t(i - 1) + dt;
+    // Velocity of the segment ending at the waypoint.
+    const double rate = dt > 0. ? 1. / dt : 0.;
+    waypoints_.vx(i)  = rate * (waypoints_.x(i) - waypoints_.x(i - 1));
+    waypoints_.vy(i)  = rate * (waypoints_.y(i) - waypoints_.y(i - 1));
+    waypoints_.wz(i)  = rate * da;
   }
 }
 
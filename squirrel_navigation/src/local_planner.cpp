@@ -34,6 +34,7 @@
 #include "squirrel_navigation/local_planner.h"
 #include "squirrel_navigation/safety/arm_skin_observer.h"
 #include "squirrel_navigation/safety/scan_observer.h"
+#include "squirrel_navigation/safety/time_to_collision_observer.h"
 #include "squirrel_navigation/utils/footprint_utils.h"
 #include "squirrel_navigation/utils/math_utils.h"
 
@@ -49,6 +50,8 @@
 
 #include <tf/tf.h>
 
+#include <cmath>
+#include <limits>
 #include <thread>
 
 PLUGINLIB_DECLARE_CLASS(
@@ -57,6 +60,42 @@ PLUGINLIB_DECLARE_CLASS(
 
 namespace squirrel_navigation {
 
+LocalPlanner::LocalPlanner()
+    : params_(Params::defaultParams()),
+      init_(false),
+      inscribed_radius_(0.),
+      circumscribed_radius_(0.),
+      checker_key_(0),
+      max_cached_footprints_(4),
+      index_origin_x_(0.),
+      index_origin_y_(0.),
+      robot_pose_2d_(math::toPose2D(0., 0., 0.)),
+      stop_control_(false),
+      control_enabled_(false),
+      control_clearance_(std::numeric_limits<double>::infinity()),
+      speed_scale_(1.) {}
+
+LocalPlanner::LocalPlanner(const Params& params)
+    : params_(params),
+      init_(false),
+      inscribed_radius_(0.),
+      circumscribed_radius_(0.),
+      checker_key_(0),
+      max_cached_footprints_(4),
+      index_origin_x_(0.),
+      index_origin_y_(0.),
+      robot_pose_2d_(math::toPose2D(0., 0., 0.)),
+      stop_control_(false),
+      control_enabled_(false),
+      control_clearance_(std::numeric_limits<double>::infinity()),
+      speed_scale_(1.) {}
+
+LocalPlanner::~LocalPlanner() {
+  stop_control_ = true;
+  if (control_thread_.joinable())
+    control_thread_.join();
+}
+
 void LocalPlanner::initialize(
     std::string name, tf::TransformListener* tfl,
     costmap_2d::Costmap2DROS* costmap_ros) {
@@ -67,15 +106,26 @@ void LocalPlanner::initialize(
   dsrv_.reset(new dynamic_reconfigure::Server<LocalPlannerConfig>(pnh));
   dsrv_->setCallback(
       boost::bind(&LocalPlanner::reconfigureCallback, this, _1, _2));
-  // Initlialize controller and motion planner, by now only PID and linear.
-  controller_.reset(new ControllerPID);
-  controller_->initialize(name + "/ControllerPID");
+  // Initlialize controller and motion planner, by now only linear motion.
+  pnh.param("controller", params_.controller, params_.controller);
+  if (params_.controller == "ControllerMPC") {
+    controller_.reset(new ControllerMPC);
+  } else {
+    params_.controller = "ControllerPID";
+    controller_.reset(new ControllerPID);
+  }
+  controller_->initialize(name + "/" + params_.controller);
   motion_planner_.reset(new LinearMotionPlanner);
   motion_planner_->initialize(name + "/LinearMotionPlanner");
+  controller_->setMotionPlanner(motion_planner_.get());
   // Initialize/reset internal observers.
   tfl_.reset(tfl);
   costmap_ros_.reset(costmap_ros);
   current_goal_.reset(nullptr);
+  for (const auto& layer : *costmap_ros->getLayeredCostmap()->getPlugins())
+    if (auto navigation_layer =
+            boost::dynamic_pointer_cast<NavigationLayer>(layer))
+      navigation_layer_ = navigation_layer;
   // Initialize the safety observers.
   if (pnh.hasParam("safety_observers")) {
     pnh.getParam("safety_observers", params_.safety_observers);
@@ -91,11 +141,21 @@ void LocalPlanner::initialize(
         safety_observers_.emplace_back(arm_observer);
         arm_observer->initialize(name + "/" + safety::ArmSkinObserver::tag);
       }
+      if (std::string(safety_observer_tag) ==
+          safety::TimeToCollisionObserver::tag) {
+        safety::TimeToCollisionObserver* ttc_observer =
+            new safety::TimeToCollisionObserver;
+        safety_observers_.emplace_back(ttc_observer);
+        ttc_observer->initialize(
+            name + "/" + safety::TimeToCollisionObserver::tag);
+      }
     }
   }
-  // Initialize the collision detector and replanning stamp.
-  costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
-  costmap_model_.reset(new base_local_planner::CostmapModel(*costmap));
+  // Initialize the collision detector.
+  pnh.param("max_cached_footprints", max_cached_footprints_, 4);
+  checker_key_ = footprint::hash(footprint_);
+  collision_checker_.setFootprint(
+      footprint_, costmap_ros_->getCostmap()->getResolution());
   // Initialize publishers, subscriber and services.
   cmd_pub_ =
       pnh.advertise<visualization_msgs::MarkerArray>("cmd_navigation", 1);
@@ -111,14 +171,29 @@ void LocalPlanner::initialize(
       "brakeRobot", &LocalPlanner::brakeRobotCallback, this);
   unbrake_srv_ = pnh.advertiseService(
       "unbrakeRobot", &LocalPlanner::unbrakeRobotCallback, this);
+  // The control thread publishes the commands itself, move_base only gets
+  // the last one.
+  pnh.param(
+      "control_frequency", params_.control_frequency,
+      params_.control_frequency);
+  pnh.param(
+      "control_timeout", params_.control_timeout, params_.control_timeout);
+  if (params_.control_frequency > 0.) {
+    control_policy_ = squirrel_threading::ThreadPolicy::fromParams(pnh);
+    cmd_vel_pub_    = nh.advertise<geometry_msgs::Twist>("cmd_vel", 1);
+    control_thread_ = std::thread(&LocalPlanner::controlLoop, this);
+  }
   // Initialization successful.
-  last_nwaypoints_ = -1;
-  init_            = true;
+  footprints_msg_.markers.resize(1);
+  init_ = true;
   ROS_INFO_STREAM(
       "squirrel_navigation/LocalPlanner: initialization successful.");
 }
 
 bool LocalPlanner::computeVelocityCommands(geometry_msgs::Twist& cmd) {
+  if (params_.control_frequency > 0.)
+    return checkControlLoop(&cmd);
+
   std::unique_lock<std::mutex> lock(state_mtx_);
   // Safety stop.
   cmd.linear.x = cmd.linear.y = cmd.angular.z = 0.0;
@@ -138,9 +213,10 @@ bool LocalPlanner::computeVelocityCommands(geometry_msgs::Twist& cmd) {
   geometry_msgs::Twist ref_twist;
   motion_planner_->computeReference(stamp, &ref_pose, &ref_twist);
   publishReference(ref_pose, stamp);
-  if (math::linearDistance2D(robot_pose_.pose, ref_pose) >
+  const math::Pose2D ref_pose_2d = math::toPose2D(ref_pose);
+  if (math::linearDistance2D(robot_pose_2d_, ref_pose_2d) >
           params_.max_safe_lin_displacement ||
-      math::angularDistanceYaw(robot_pose_.pose, ref_pose) >
+      math::angularDistanceYaw(robot_pose_2d_, ref_pose_2d) >
           params_.max_safe_ang_displacement) {
     ROS_WARN_STREAM(
         "squirrel_navigation/LocalPlanner: The robot is too far from the "
@@ -149,12 +225,21 @@ bool LocalPlanner::computeVelocityCommands(geometry_msgs::Twist& cmd) {
     return false;
   }
 
-  const auto& trajectory = motion_planner_->trajectory();
-  if (!isTrajectorySafe(trajectory))
+  // Clearance of the forward trajectory, infinite if not needed.
+  double clearance   = std::numeric_limits<double>::infinity();
+  double speed_scale = 1.;
+  if (params_.clearance_based_velocity)
+    updateClearanceIndex();
+  if (!isTrajectorySafe(
+          motion_planner_->trajectory(), &clearance, &speed_scale))
     return false;
+  speed_scale_ = speed_scale;
 
-  // Compute the commands via PID controller in map frame.
+  // Compute the commands in map frame, predictive controllers plan within
+  // the velocity bounds of the clearance and of the zones.
   geometry_msgs::Twist map_cmd;
+  controller_->setVelocityLimits(
+      maxSafeLinVelocity(clearance), maxSafeAngVelocity());
   controller_->computeCommand(
       stamp, robot_pose_.pose, ref_pose, robot_twist_.twist, ref_twist,
       &map_cmd);
@@ -164,7 +249,7 @@ bool LocalPlanner::computeVelocityCommands(geometry_msgs::Twist& cmd) {
   twistToRobotFrame(map_cmd, &robot_cmd);
 
   // Threshold the twist according to safety parameters.
-  safeVelocityCommands(robot_cmd, &cmd);
+  safeVelocityCommands(robot_cmd, clearance, &cmd);
 
   // Publish the command.
   publishTwist(robot_pose_, cmd);
@@ -172,6 +257,7 @@ bool LocalPlanner::computeVelocityCommands(geometry_msgs::Twist& cmd) {
 }
 
 bool LocalPlanner::isGoalReached() {
+  std::unique_lock<std::mutex> lock(state_mtx_);
   if (!current_goal_)
     return false;
   if (math::linearDistance2D(robot_pose_.pose, *current_goal_) <=
@@ -179,6 +265,7 @@ bool LocalPlanner::isGoalReached() {
       math::angularDistanceYaw(robot_pose_.pose, *current_goal_) <=
           params_.goal_ang_tolerance) {
     current_goal_.reset(nullptr);
+    control_enabled_ = false;
     if (params_.verbose)
       ROS_INFO_STREAM("squirrel_navigation/LocalPlanner: Goal reached.");
     return true;
@@ -192,6 +279,7 @@ bool LocalPlanner::setPlan(
   if (waypoints.empty())
     return false;
 
+  std::unique_lock<std::mutex> lock(state_mtx_);
   const ros::Time& stamp = robot_pose_.header.stamp;
   if (newGoal(waypoints.back().pose)) {
     current_goal_.reset(new geometry_msgs::Pose(waypoints.back().pose));
@@ -226,26 +314,53 @@ void LocalPlanner::footprintCallback(
   }
   // If footprint changed update the internal values.
   if (footprint_changed) {
+    std::unique_lock<std::mutex> lock(state_mtx_);
+    std::unique_lock<std::mutex> check_lock(check_mtx_);
     footprint_ = costmap_2d::toPointVector(msg->polygon);
     costmap_2d::calculateMinAndMaxDistances(
         footprint_, inscribed_radius_, circumscribed_radius_);
+    swapCollisionChecker(costmap_ros_->getCostmap()->getResolution());
   }
 }
 
+void LocalPlanner::swapCollisionChecker(double resolution) {
+  const size_t key = footprint::hash(footprint_);
+  if (key == checker_key_ && collision_checker_.resolution() == resolution)
+    return;
+  // Park the current checker and look for the one of the new footprint.
+  if (max_cached_footprints_ > 0) {
+    checker_cache_.push_back({checker_key_, std::move(collision_checker_)});
+    if ((int)checker_cache_.size() > max_cached_footprints_)
+      checker_cache_.pop_front();
+  }
+  checker_key_ = key;
+  for (auto it = checker_cache_.begin(); it != checker_cache_.end(); ++it)
+    if (it->key == key && it->checker.resolution() == resolution) {
+      collision_checker_ = std::move(it->checker);
+      checker_cache_.erase(it);
+      return;
+    }
+  collision_checker_ = footprint::CollisionChecker();
+  collision_checker_.setFootprint(footprint_, resolution);
+}
+
 void LocalPlanner::odomCallback(const nav_msgs::Odometry::ConstPtr& odom) {
   ROS_INFO_STREAM_ONCE(
       "squirrel_localizer/LocalPlanner: Subscribed to odometry.");
-  // Update the internal state.
-  std::unique_lock<std::mutex> lock(state_mtx_);
+  // Update the internal state, the transform is waited for without holding
+  // the state.
   const std::string& map_frame_id = costmap_ros_->getGlobalFrameID();
   try {
-    geometry_msgs::PoseStamped odom_robot_pose;
+    geometry_msgs::PoseStamped odom_robot_pose, robot_pose;
     odom_robot_pose.header = odom->header;
     odom_robot_pose.pose   = odom->pose.pose;
     tfl_->waitForTransform(
         map_frame_id, odom->header.frame_id, odom->header.stamp,
         ros::Duration(0.5));
-    tfl_->transformPose(map_frame_id, odom_robot_pose, robot_pose_);
+    tfl_->transformPose(map_frame_id, odom_robot_pose, robot_pose);
+    std::unique_lock<std::mutex> lock(state_mtx_);
+    robot_pose_    = robot_pose;
+    robot_pose_2d_ = math::toPose2D(robot_pose.pose);
     twistToGlobalFrame(odom->twist.twist, &robot_twist_.twist);
   } catch (const tf::TransformException& ex) {
     ROS_ERROR_STREAM("squirrel_navigation/LocalPlanner: " << ex.what());
@@ -261,6 +376,9 @@ void LocalPlanner::reconfigureCallback(
   params_.replanning_lin_lookahead     = config.replanning_lin_lookahead;
   params_.replanning_ang_lookahead     = config.replanning_ang_lookahead;
   params_.replanning_path_length_ratio = config.replanning_path_length_ratio;
+  params_.clearance_based_velocity     = config.clearance_based_velocity;
+  params_.min_safe_lin_velocity        = config.min_safe_lin_velocity;
+  params_.clearance_slowdown_distance  = config.clearance_slowdown_distance;
   params_.goal_lin_tolerance           = config.goal_lin_tolerance;
   params_.goal_ang_tolerance           = config.goal_ang_tolerance;
   params_.max_safe_lin_velocity        = config.max_safe_lin_velocity;
@@ -268,18 +386,21 @@ void LocalPlanner::reconfigureCallback(
   params_.max_safe_lin_displacement    = config.max_safe_lin_displacement;
   params_.max_safe_ang_displacement    = config.max_safe_ang_displacement;
   params_.visualize_topics             = config.visualize_topics;
+  params_.footprints_spacing           = config.footprints_spacing;
   params_.verbose                      = config.verbose;
 }
 
 bool LocalPlanner::brakeRobotCallback(
     squirrel_navigation_msgs::BrakeRobot::Request& req,
     squirrel_navigation_msgs::BrakeRobot::Response& res) {
+  std::unique_lock<std::mutex> lock(state_mtx_);
   base_brake_.enable(req.seconds);
   return true;
 }
 
 bool LocalPlanner::unbrakeRobotCallback(
     std_srvs::Empty::Request& req, std_srvs::Empty::Response& res) {
+  std::unique_lock<std::mutex> lock(state_mtx_);
   base_brake_.disable();
   return true;
 }
@@ -309,56 +430,43 @@ void LocalPlanner::publishReference(
 void LocalPlanner::publishTrajectory(const ros::Time& stamp) const {
   if (!params_.visualize_topics)
     return;
-  const auto& waypoints =
-      static_cast<const LinearMotionPlanner*>(motion_planner_.get())
-          ->waypoints();
+  const auto waypoints = motion_planner_->waypoints();
   // Create the trajectory message.
   geometry_msgs::PoseArray trajectory;
   trajectory.header.frame_id = costmap_ros_->getGlobalFrameID();
   trajectory.header.stamp    = stamp;
   trajectory.poses.reserve(waypoints.size());
-  for (const auto& waypoint : waypoints)
-    trajectory.poses.emplace_back(waypoint.pose);
+  for (unsigned int i = 0; i < waypoints.size(); ++i)
+    trajectory.poses.emplace_back(waypoints.pose(i));
   traj_pub_.publish(trajectory);
 }
 
 void LocalPlanner::publishFootprints(const ros::Time& stamp) {
-  if (!params_.visualize_topics)
+  if (!params_.visualize_topics || footprints_pub_.getNumSubscribers() == 0)
     return;
-  // Number of waypoints.
-  const auto& waypoints = motion_planner_->waypoints();
-  const int nwaypoints  = waypoints.size();
-  const auto& footprint = footprint::closedPolygon(footprint_);
-  // Create the visualization marker.
-  visualization_msgs::MarkerArray marker_array_msg;
-  marker_array_msg.markers.reserve(std::max(nwaypoints, last_nwaypoints_));
-  for (int i = 0; i < nwaypoints; ++i) {
-    visualization_msgs::Marker marker;
-    marker.header.stamp    = stamp;
-    marker.header.frame_id = costmap_ros_->getGlobalFrameID();
-    marker.ns              = ros::this_node::getNamespace() + "LocalPlanner";
-    marker.id              = i;
-    marker.type            = visualization_msgs::Marker::LINE_STRIP;
-    marker.action          = visualization_msgs::Marker::MODIFY;
-    marker.pose            = waypoints[i].pose;
-    marker.scale.x         = 0.0025;
-    marker.color.r         = 0.0;
-    marker.color.g         = 0.0;
-    marker.color.b         = 0.0;
-    marker.color.a         = 0.7;
-    marker.points          = footprint;
-    marker_array_msg.markers.emplace_back(marker);
-  }
-  // Delete the old ones.
-  for (int i = nwaypoints; i < last_nwaypoints_; ++i) {
-    visualization_msgs::Marker delete_marker;
-    delete_marker.ns     = ros::this_node::getNamespace() + "LocalPlanner";
-    delete_marker.id     = i;
-    delete_marker.action = visualization_msgs::Marker::DELETE;
-    marker_array_msg.markers.emplace_back(delete_marker);
-  }
-  last_nwaypoints_ = nwaypoints;
-  footprints_pub_.publish(marker_array_msg);
+  const auto waypoints = motion_planner_->waypoints();
+  // All the footprints go in one marker, its buffer is reused.
+  auto& marker           = footprints_msg_.markers.front();
+  marker.header.stamp    = stamp;
+  marker.header.frame_id = costmap_ros_->getGlobalFrameID();
+  marker.ns              = ros::this_node::getNamespace() + "LocalPlanner";
+  marker.id              = 0;
+  marker.type            = visualization_msgs::Marker::LINE_LIST;
+  marker.action          = waypoints.empty()
+                               ? visualization_msgs::Marker::DELETE
+                               : visualization_msgs::Marker::MODIFY;
+  marker.pose.orientation.w = 1.0;
+  marker.scale.x            = 0.0025;
+  marker.color.r            = 0.0;
+  marker.color.g            = 0.0;
+  marker.color.b            = 0.0;
+  marker.color.a            = 0.7;
+  marker.points.clear();
+  footprint::appendOutlines(
+      footprint_, waypoints.size(),
+      [&waypoints](int i) { return waypoints.pose(i); },
+      params_.footprints_spacing, &marker.points);
+  footprints_pub_.publish(footprints_msg_);
 }
 
 void LocalPlanner::publishTwist(
@@ -415,64 +523,90 @@ void LocalPlanner::publishTwist(
 void LocalPlanner::twistToGlobalFrame(
     const geometry_msgs::Twist& robot_twist,
     geometry_msgs::Twist* map_twist) const {
-  const double robot_yaw = tf::getYaw(robot_pose_.pose.orientation);
-  // Transform the twist.
-  const double c = std::cos(robot_yaw), s = std::sin(robot_yaw);
-  map_twist->linear.x  = c * robot_twist.linear.x - s * robot_twist.linear.y;
-  map_twist->linear.y  = s * robot_twist.linear.x + s * robot_twist.linear.y;
-  map_twist->angular.z = robot_twist.angular.z;
+  *map_twist = math::toTwistMsg(
+      math::rotateTwist2D(robot_pose_2d_, math::toTwist2D(robot_twist)));
 }
 
 void LocalPlanner::twistToRobotFrame(
     const geometry_msgs::Twist& map_twist,
     geometry_msgs::Twist* robot_twist) const {
-  const double robot_yaw = tf::getYaw(robot_pose_.pose.orientation);
-  // Transform the twist.
-  const double c = std::cos(-robot_yaw), s = std::sin(-robot_yaw);
-  robot_twist->linear.x  = c * map_twist.linear.x - s * map_twist.linear.y;
-  robot_twist->linear.y  = s * map_twist.linear.x + c * map_twist.linear.y;
-  robot_twist->angular.z = map_twist.angular.z;
+  *robot_twist = math::toTwistMsg(
+      math::unrotateTwist2D(robot_pose_2d_, math::toTwist2D(map_twist)));
+}
+
+double LocalPlanner::maxSafeAngVelocity() const {
+  return speed_scale_ * params_.max_safe_ang_velocity;
+}
+
+double LocalPlanner::maxSafeLinVelocity(double clearance) const {
+  // The linear velocity drops towards its minimum close to the obstacles.
+  double max_lin_velocity = params_.max_safe_lin_velocity;
+  if (params_.clearance_based_velocity &&
+      params_.clearance_slowdown_distance > 0.) {
+    const double ratio =
+        std::min(1., clearance / params_.clearance_slowdown_distance);
+    max_lin_velocity = std::min(
+        max_lin_velocity,
+        params_.min_safe_lin_velocity +
+            ratio * (max_lin_velocity - params_.min_safe_lin_velocity));
+  }
+  return speed_scale_ * max_lin_velocity;
 }
 
 void LocalPlanner::safeVelocityCommands(
-    const geometry_msgs::Twist& twist, geometry_msgs::Twist* safe_twist) const {
-  *safe_twist = twist;
+    const geometry_msgs::Twist& twist, double clearance,
+    geometry_msgs::Twist* safe_twist) const {
+  *safe_twist                   = twist;
+  const double max_lin_velocity = maxSafeLinVelocity(clearance);
   // Rescaling the linear twist.
   const double twist_lin_magnitude = std::hypot(twist.linear.x, twist.linear.y);
-  if (twist_lin_magnitude > params_.max_safe_lin_velocity) {
+  if (twist_lin_magnitude > max_lin_velocity) {
     safe_twist->linear.x =
-        params_.max_safe_lin_velocity * twist.linear.x / twist_lin_magnitude;
+        max_lin_velocity * twist.linear.x / twist_lin_magnitude;
     safe_twist->linear.y =
-        params_.max_safe_lin_velocity * twist.linear.y / twist_lin_magnitude;
+        max_lin_velocity * twist.linear.y / twist_lin_magnitude;
   }
   // Rescaling the angular twist.
+  const double max_ang_velocity    = maxSafeAngVelocity();
   const double twist_ang_magnitude = std::abs(twist.angular.z);
-  if (twist_ang_magnitude > params_.max_safe_ang_velocity)
-    safe_twist->angular.z =
-        std::copysign(params_.max_safe_ang_velocity, twist.angular.z);
+  if (twist_ang_magnitude > max_ang_velocity)
+    safe_twist->angular.z = std::copysign(max_ang_velocity, twist.angular.z);
 }
 
 bool LocalPlanner::isTrajectorySafe(
-    const std::vector<geometry_msgs::PoseStamped>& trajectory) const {
+    const utils::Trajectory::View& trajectory, double* clearance,
+    double* speed_scale) {
   double cum_lin_lookahead = 0.0, cum_ang_lookahead = 0.0;
 
+  // The lethal cells of the current costmap.
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  if (collision_checker_.resolution() != costmap->getResolution())
+    collision_checker_.setFootprint(footprint_, costmap->getResolution());
+  collision_checker_.updateCosts(
+      costmap->getCharMap(), costmap->getSizeInCellsX(),
+      costmap->getSizeInCellsY());
+
   const int nwaypoints = trajectory.size();
   for (int i = 0; i < nwaypoints; ++i) {
-    const auto& curr_waypoint = trajectory[i].pose;
-    // Compute the cost of the current waypoint.
-    const double x             = curr_waypoint.position.x;
-    const double y             = curr_waypoint.position.y;
-    const double a             = tf::getYaw(curr_waypoint.orientation);
-    const double waypoint_cost = costmap_model_->footprintCost(
-        x, y, a, footprint_, inscribed_radius_, circumscribed_radius_);
-    if (waypoint_cost < 0. || waypoint_cost >= costmap_2d::LETHAL_OBSTACLE)
+    // Check the footprint on the current waypoint.
+    const double x = trajectory.x(i);
+    const double y = trajectory.y(i);
+    const double a = trajectory.yaw(i);
+    unsigned int cell_x, cell_y;
+    if (!costmap->worldToMap(x, y, cell_x, cell_y) ||
+        collision_checker_.collides(cell_x, cell_y, a))
       return false;
+    if (params_.clearance_based_velocity)
+      *clearance = std::min(*clearance, footprintClearance(cell_x, cell_y));
+    if (navigation_layer_)
+      *speed_scale =
+          std::min(*speed_scale, navigation_layer_->speedScale(cell_x, cell_y));
     
     // Update the lookahead.
-    if (i < trajectory.size() - 1) {
-      const auto& next_waypoint = trajectory[i + 1].pose;
-      const double dl = math::linearDistance2D(curr_waypoint, next_waypoint);
-      const double da = math::angularDistanceYaw(curr_waypoint, next_waypoint);
+    if (i < nwaypoints - 1) {
+      const double dl = trajectory.distance(i, i + 1);
+      const double da =
+          std::abs(angles::normalize_angle(trajectory.yaw(i + 1) - a));
       if ((cum_lin_lookahead += dl) >= params_.replanning_lin_lookahead ||
           (cum_ang_lookahead += da) >= params_.replanning_ang_lookahead)
         return true;
@@ -482,17 +616,65 @@ bool LocalPlanner::isTrajectorySafe(
   return true;
 }
 
+void LocalPlanner::updateClearanceIndex() {
+  const costmap_2d::Costmap2D* costmap = costmap_ros_->getCostmap();
+  const int size_x = costmap->getSizeInCellsX();
+  const int size_y = costmap->getSizeInCellsY();
+  // A new size or origin of the rolling window moves the cells, the index is
+  // rebuilt.
+  if (size_x != clearance_index_.sizeX() ||
+      size_y != clearance_index_.sizeY() ||
+      costmap->getOriginX() != index_origin_x_ ||
+      costmap->getOriginY() != index_origin_y_) {
+    clearance_index_.resize(size_x, size_y);
+    index_origin_x_ = costmap->getOriginX();
+    index_origin_y_ = costmap->getOriginY();
+  }
+  // Only the changed obstacles are propagated.
+  const unsigned char* costs = costmap->getCharMap();
+  for (int index = 0; index < size_x * size_y; ++index)
+    clearance_index_.setCell(
+        index, costs[index] == costmap_2d::LETHAL_OBSTACLE);
+  clearance_index_.update();
+}
+
+double LocalPlanner::footprintClearance(
+    unsigned int cell_x, unsigned int cell_y) const {
+  const int index = cell_y * clearance_index_.sizeX() + cell_x;
+  if (clearance_index_.nearestObstacle(index) < 0)
+    return std::numeric_limits<double>::infinity();
+  // The footprint lies within the circumscribed radius, which bounds its
+  // distance from the obstacle from below. Within the inscribed radius the
+  // footprint collides.
+  const double distance = std::sqrt(clearance_index_.squaredDistance(index)) *
+                          costmap_ros_->getCostmap()->getResolution();
+  if (distance <= inscribed_radius_)
+    return 0.;
+  return std::max(0., distance - circumscribed_radius_);
+}
+
 bool LocalPlanner::needReplanning(
-    const std::vector<geometry_msgs::PoseStamped>& old_waypoints,
+    const utils::Trajectory::View& old_waypoints,
     const std::vector<geometry_msgs::PoseStamped>& new_waypoints) const {
-  const double old_length = math::pathLength(old_waypoints);
-  const double new_length = math::pathLength(new_waypoints);
+  // The remaining length comes from the arc lengths of the trajectory.
+  const double old_length = old_waypoints.length();
 
   if (old_length <= kShortPathsReplanningTolerance)
     return false;
   
-  const bool current_trajectory_suboptimal =
-      (new_length <= params_.replanning_path_length_ratio * old_length);
+  // The new path is summed up only until it exceeds the accepted length.
+  const double max_new_length =
+      params_.replanning_path_length_ratio * old_length;
+  bool current_trajectory_suboptimal = true;
+  double new_length                  = 0.;
+  for (unsigned int i = 1; i < new_waypoints.size(); ++i) {
+    new_length +=
+        math::linearDistance2D(new_waypoints[i - 1], new_waypoints[i]);
+    if (new_length > max_new_length) {
+      current_trajectory_suboptimal = false;
+      break;
+    }
+  }
   // const bool need_replanning =
   //     current_trajectory_suboptimal || !isTrajectorySafe(old_waypoints);
 
@@ -513,6 +695,119 @@ bool LocalPlanner::newGoal(const geometry_msgs::Pose& pose) const {
   return new_position || new_orientation;
 }
 
+bool LocalPlanner::checkControlLoop(geometry_msgs::Twist* cmd) {
+  cmd->linear.x = cmd->linear.y = cmd->angular.z = 0.0;
+  {
+    std::unique_lock<std::mutex> lock(state_mtx_);
+    // Check if the robot is braked, the control thread is braked as well.
+    if (base_brake_.spin(cmd))
+      return true;
+
+    // Check the scan observer.
+    for (const auto& safety_observer : safety_observers_)
+      if (!safety_observer->safe()) {
+        control_enabled_ = false;
+        return false;
+      }
+
+    // The reference is sampled, the control thread moves the trajectory.
+    const ros::Time& stamp = robot_pose_.header.stamp;
+    geometry_msgs::Pose ref_pose;
+    geometry_msgs::Twist ref_twist;
+    motion_planner_->sampleReference(stamp, &ref_pose, &ref_twist);
+    publishReference(ref_pose, stamp);
+    const math::Pose2D ref_pose_2d = math::toPose2D(ref_pose);
+    if (math::linearDistance2D(robot_pose_2d_, ref_pose_2d) >
+            params_.max_safe_lin_displacement ||
+        math::angularDistanceYaw(robot_pose_2d_, ref_pose_2d) >
+            params_.max_safe_ang_displacement) {
+      ROS_WARN_STREAM(
+          "squirrel_navigation/LocalPlanner: The robot is too far from the "
+          "planned trajectory. Replanning requested.");
+      current_goal_.reset(nullptr);
+      control_enabled_ = false;
+      return false;
+    }
+
+    // Snapshot of the forward trajectory.
+    const auto trajectory = motion_planner_->trajectory();
+    trajectory_snapshot_.clear();
+    trajectory_snapshot_.reserve(trajectory.size());
+    for (unsigned int i = 0; i < trajectory.size(); ++i)
+      trajectory_snapshot_.pushBack(
+          trajectory.x(i), trajectory.y(i), trajectory.yaw(i),
+          trajectory.t(i));
+  }
+
+  // The collision check does not stall the control thread.
+  double clearance   = std::numeric_limits<double>::infinity();
+  double speed_scale = 1.;
+  bool safe;
+  {
+    std::unique_lock<std::mutex> check_lock(check_mtx_);
+    if (params_.clearance_based_velocity)
+      updateClearanceIndex();
+    safe = isTrajectorySafe(
+        trajectory_snapshot_.view(), &clearance, &speed_scale);
+  }
+
+  // Enable the control thread and hand over the last command.
+  std::unique_lock<std::mutex> lock(state_mtx_);
+  control_enabled_ = safe;
+  if (!safe)
+    return false;
+  control_clearance_ = clearance;
+  speed_scale_       = speed_scale;
+  last_check_        = ros::WallTime::now();
+  *cmd               = control_cmd_;
+  publishTwist(robot_pose_, *cmd);
+  return true;
+}
+
+void LocalPlanner::controlLoop() {
+  control_policy_.applyToCurrentThread();
+  ros::WallRate rate(params_.control_frequency);
+  bool active = false;
+  while (!stop_control_) {
+    geometry_msgs::Twist cmd;
+    const bool enabled = controlStep(&cmd);
+    // Once disabled the robot is stopped once, then move_base takes over.
+    if (enabled || active)
+      cmd_vel_pub_.publish(cmd);
+    active = enabled;
+    rate.sleep();
+  }
+}
+
+bool LocalPlanner::controlStep(geometry_msgs::Twist* cmd) {
+  cmd->linear.x = cmd->linear.y = cmd->angular.z = 0.0;
+  std::unique_lock<std::mutex> lock(state_mtx_);
+  // The last collision check has to be recent.
+  if (!control_enabled_ ||
+      (ros::WallTime::now() - last_check_).toSec() > params_.control_timeout ||
+      base_brake_.spin(cmd)) {
+    control_cmd_ = *cmd;
+    return false;
+  }
+
+  // Compute the commands in map frame from the latest odometry.
+  const ros::Time stamp = ros::Time::now();
+  geometry_msgs::Pose ref_pose;
+  geometry_msgs::Twist ref_twist, map_cmd, robot_cmd;
+  motion_planner_->computeReference(stamp, &ref_pose, &ref_twist);
+  controller_->setVelocityLimits(
+      maxSafeLinVelocity(control_clearance_), maxSafeAngVelocity());
+  controller_->computeCommand(
+      stamp, robot_pose_.pose, ref_pose, robot_twist_.twist, ref_twist,
+      &map_cmd);
+
+  // Transform the commands in robot frame and threshold them.
+  twistToRobotFrame(map_cmd, &robot_cmd);
+  safeVelocityCommands(robot_cmd, control_clearance_, cmd);
+  control_cmd_ = *cmd;
+  return true;
+}
+
 bool LocalPlanner::BaseBrake::spin(geometry_msgs::Twist* cmd) {
   cmd->linear.x = cmd->linear.y = cmd->angular.z = 0.0;
   if (!enable_stamp_)
@@ -538,6 +833,7 @@ LocalPlanner::Params LocalPlanner::Params::defaultParams() {
   Params params;
   params.odom_topic                 = "/odom";
   params.footprint_topic            = "/squirrel_footprint_observer/footprint";
+  params.controller                 = "ControllerPID";
   params.collision_based_replanning = true;
   params.replanning_lin_lookahead   = 1.0;
   params.replanning_ang_lookahead   = 1.0;
@@ -548,9 +844,15 @@ LocalPlanner::Params LocalPlanner::Params::defaultParams() {
   params.max_safe_ang_velocity        = 0.7;
   params.max_safe_lin_displacement    = 0.5;
   params.max_safe_ang_displacement    = 1.0;
+  params.clearance_based_velocity     = false;
+  params.min_safe_lin_velocity        = 0.1;
+  params.clearance_slowdown_distance  = 0.5;
+  params.control_frequency            = 0.0;
+  params.control_timeout              = 0.5;
   params.safety_observers = {ScanObserver::tag, ArmSkinObserver::tag};
-  params.visualize_topics = true;
-  params.verbose          = false;
+  params.visualize_topics   = true;
+  params.footprints_spacing = 0.0;
+  params.verbose            = false;
   return params;
 }
 
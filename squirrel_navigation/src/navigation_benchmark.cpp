@@ -0,0 +1,499 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+// Micro-benchmark of the hot paths of the navigation stack, without
+// move_base: the footprint planning on SBPL, the distance field, the costmap
+// merge and the updates of the collision checker and of the clearance index,
+// and the control loop of LinearMotionPlanner and ControllerPID with the
+// collision check of its trajectory. A map of squirrel_navigation/maps is
+// loaded, random collision free start/goal pairs are planned and obstacles
+// are injected along the plans, as the local costmap would see them.
+//
+// Usage: navigation_benchmark <map.yaml> <motion_primitives.mprim>
+//                             [runs] [seed] [max_planning_time]
+
+#include "squirrel_navigation/controller_pid.h"
+#include "squirrel_navigation/footprint_planner.h"
+#include "squirrel_navigation/linear_motion_planner.h"
+#include "squirrel_navigation/utils/collision_checker.h"
+#include "squirrel_navigation/utils/costmap_utils.h"
+#include "squirrel_navigation/utils/distance_field.h"
+#include "squirrel_navigation/utils/obstacle_index.h"
+#include "squirrel_navigation/utils/sbpl_utils.h"
+
+#include <ros/time.h>
+
+#include <costmap_2d/cost_values.h>
+
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <geometry_msgs/Twist.h>
+
+#include <tf/tf.h>
+
+#include <angles/angles.h>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace squirrel_navigation {
+namespace benchmark {
+
+// Latency samples of one stage, in milliseconds.
+class Samples {
+ public:
+  inline void push(const ros::WallTime& start) {
+    samples_.emplace_back((ros::WallTime::now() - start).toSec() * 1e3);
+  }
+
+  void print(const std::string& name) const {
+    if (samples_.empty()) {
+      std::printf("%-22s %8s\n", name.c_str(), "-");
+      return;
+    }
+    std::vector<double> sorted = samples_;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.;
+    for (const double sample : sorted)
+      sum += sample;
+    std::printf(
+        "%-22s %8zu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name.c_str(),
+        sorted.size(), sum / sorted.size(), percentile(sorted, 0.5),
+        percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back());
+  }
+
+ private:
+  static double percentile(const std::vector<double>& sorted, double p) {
+    const size_t index = std::min<size_t>(sorted.size() - 1, p * sorted.size());
+    return sorted[index];
+  }
+
+  std::vector<double> samples_;
+};
+
+// Costmap of a map_server map, with free, lethal and unknown cells.
+class Map {
+ public:
+  bool load(const std::string& yaml_url);
+
+  std::vector<unsigned char> costs;
+  // Free cells to sample the poses from, the maps are mostly unknown.
+  std::vector<int> free_cells;
+  int size_x, size_y;
+  double resolution, origin_x, origin_y;
+};
+
+bool Map::load(const std::string& yaml_url) {
+  std::ifstream yaml(yaml_url);
+  if (!yaml)
+    return false;
+  // The map_server description, one key per line.
+  std::string image, line;
+  int negate = 0;
+  double occupied_thresh = 0.65, free_thresh = 0.196;
+  resolution = origin_x = origin_y = 0.;
+  while (std::getline(yaml, line)) {
+    std::replace(line.begin(), line.end(), ',', ' ');
+    std::replace(line.begin(), line.end(), '[', ' ');
+    std::istringstream fields(line);
+    std::string key;
+    fields >> key;
+    if (key == "image:")
+      fields >> image;
+    else if (key == "resolution:")
+      fields >> resolution;
+    else if (key == "origin:")
+      fields >> origin_x >> origin_y;
+    else if (key == "negate:")
+      fields >> negate;
+    else if (key == "occupied_thresh:")
+      fields >> occupied_thresh;
+    else if (key == "free_thresh:")
+      fields >> free_thresh;
+  }
+  if (image.empty() || resolution <= 0.)
+    return false;
+  boost::filesystem::path image_path(image);
+  if (image_path.is_relative())
+    image_path = boost::filesystem::path(yaml_url).parent_path() / image_path;
+  // Binary PGM, the comments are skipped.
+  std::ifstream pgm(image_path.string(), std::ios::binary);
+  std::string magic;
+  pgm >> magic;
+  if (magic != "P5")
+    return false;
+  int header[3], nheader = 0;
+  while (nheader < 3 && pgm >> std::ws) {
+    if (pgm.peek() == '#') {
+      std::getline(pgm, line);
+      continue;
+    }
+    pgm >> header[nheader++];
+  }
+  pgm.get();
+  size_x = header[0];
+  size_y = header[1];
+  std::vector<unsigned char> pixels(size_x * size_y);
+  if (!pgm.read((char*)pixels.data(), pixels.size()))
+    return false;
+  // The first row of the image is the top of the map.
+  costs.resize(size_x * size_y);
+  free_cells.clear();
+  for (int y = 0; y < size_y; ++y)
+    for (int x = 0; x < size_x; ++x) {
+      const double value = pixels[(size_y - 1 - y) * size_x + x] / 255.;
+      const double occupancy = negate ? value : 1. - value;
+      unsigned char& cost    = costs[y * size_x + x];
+      if (occupancy > occupied_thresh)
+        cost = costmap_2d::LETHAL_OBSTACLE;
+      else if (occupancy < free_thresh) {
+        cost = costmap_2d::FREE_SPACE;
+        free_cells.push_back(y * size_x + x);
+      } else
+        cost = costmap_2d::NO_INFORMATION;
+    }
+  return true;
+}
+
+// Circular footprint of the robot, as in costmap_common_params.yaml.
+std::vector<geometry_msgs::Point> robotFootprint(double radius) {
+  const int nvertices = 16;
+  std::vector<geometry_msgs::Point> footprint(nvertices);
+  for (int i = 0; i < nvertices; ++i) {
+    footprint[i].x = radius * std::cos(2. * M_PI * i / nvertices);
+    footprint[i].y = radius * std::sin(2. * M_PI * i / nvertices);
+  }
+  return footprint;
+}
+
+// Random collision free pose of the robot, in map coordinates.
+bool randomPose(
+    const Map& map, const footprint::CollisionChecker& checker,
+    std::mt19937* rng, geometry_msgs::Pose* pose) {
+  if (map.free_cells.empty())
+    return false;
+  std::uniform_int_distribution<int> cell(0, map.free_cells.size() - 1);
+  std::uniform_real_distribution<double> heading(-M_PI, M_PI);
+  for (int trial = 0; trial < 10000; ++trial) {
+    const int index = map.free_cells[cell(*rng)];
+    const int x = index % map.size_x, y = index / map.size_x;
+    const double yaw = heading(*rng);
+    if (checker.collides(x, y, yaw))
+      continue;
+    pose->position.x  = map.origin_x + (x + 0.5) * map.resolution;
+    pose->position.y  = map.origin_y + (y + 0.5) * map.resolution;
+    pose->orientation = tf::createQuaternionMsgFromYaw(yaw);
+    return true;
+  }
+  return false;
+}
+
+// Same update of the planner costs as FootprintPlanner::pushCosts.
+void pushCosts(
+    const std::vector<unsigned char>& costs, int size_x,
+    sbpl::NavigationEnvironment* env, sbpl::Planner* planner,
+    std::vector<unsigned char>* snapshot) {
+  std::vector<unsigned int> changed_indices;
+  costmap::diffCosts(
+      costs.data(), snapshot->data(), costs.size(), &changed_indices);
+  std::vector<sbpl::Cell> changed_cells(changed_indices.size());
+  for (unsigned int i = 0; i < changed_indices.size(); ++i) {
+    changed_cells[i].x = changed_indices[i] % size_x;
+    changed_cells[i].y = changed_indices[i] / size_x;
+    env->UpdateCost(
+        changed_cells[i].x, changed_cells[i].y,
+        (*snapshot)[changed_indices[i]]);
+  }
+  if (changed_cells.empty())
+    return;
+  sbpl::ChangedCellsQuery query(env, changed_cells);
+  planner->costs_changed(query);
+}
+
+// Plan with the same calls as FootprintPlanner::planToGoal.
+bool plan(
+    const Map& map, const geometry_msgs::Pose& start,
+    const geometry_msgs::Pose& goal, const FootprintPlanner::Params& params,
+    sbpl::NavigationEnvironment* env, sbpl::Planner* planner,
+    std::vector<geometry_msgs::PoseStamped>* waypoints) {
+  std::vector<int> solution_states_ids;
+  std::vector<sbpl::Pose> sbpl_waypoints;
+  int solution_cost;
+  try {
+    const int start_id = env->SetStart(
+        start.position.x - map.origin_x, start.position.y - map.origin_y,
+        tf::getYaw(start.orientation));
+    const int goal_id = env->SetGoal(
+        goal.position.x - map.origin_x, goal.position.y - map.origin_y,
+        tf::getYaw(goal.orientation));
+    if (start_id <= 0 || goal_id <= 0 || planner->set_start(start_id) == 0 ||
+        planner->set_goal(goal_id) == 0)
+      return false;
+    planner->set_search_mode(false);
+    planner->set_initialsolution_eps(params.initial_epsilon);
+    if (!planner->replan(
+            params.max_planning_time, &solution_states_ids, &solution_cost))
+      return false;
+    env->ConvertStateIDPathintoXYThetaPath(
+        &solution_states_ids, &sbpl_waypoints);
+  } catch (sbpl::Exception* ex) {
+    return false;
+  }
+  waypoints->clear();
+  for (const auto& sbpl_waypoint : sbpl_waypoints) {
+    geometry_msgs::PoseStamped waypoint;
+    waypoint.pose.position.x  = sbpl_waypoint.x + map.origin_x;
+    waypoint.pose.position.y  = sbpl_waypoint.y + map.origin_y;
+    waypoint.pose.orientation = tf::createQuaternionMsgFromYaw(
+        sbpl_waypoint.theta);
+    waypoints->emplace_back(waypoint);
+  }
+  return waypoints->size() >= 2;
+}
+
+// Lethal disc in the obstacle layer.
+void injectObstacle(
+    const Map& map, double x, double y, double radius,
+    std::vector<unsigned char>* obstacles) {
+  const int cx = (x - map.origin_x) / map.resolution;
+  const int cy = (y - map.origin_y) / map.resolution;
+  const int r  = std::ceil(radius / map.resolution);
+  for (int dy = -r; dy <= r; ++dy)
+    for (int dx = -r; dx <= r; ++dx)
+      if (dx * dx + dy * dy <= r * r && cx + dx >= 0 && cy + dy >= 0 &&
+          cx + dx < map.size_x && cy + dy < map.size_y)
+        (*obstacles)[(cy + dy) * map.size_x + cx + dx] =
+            costmap_2d::LETHAL_OBSTACLE;
+}
+
+// Same check as LocalPlanner::isTrajectorySafe, up to the lookahead.
+bool isTrajectorySafe(
+    const Map& map, const footprint::CollisionChecker& checker,
+    const utils::Trajectory::View& trajectory, double lookahead) {
+  double cum_lookahead = 0.;
+  for (unsigned int i = 0; i < trajectory.size(); ++i) {
+    const int x = (trajectory.x(i) - map.origin_x) / map.resolution;
+    const int y = (trajectory.y(i) - map.origin_y) / map.resolution;
+    if (checker.collides(x, y, trajectory.yaw(i)))
+      return false;
+    if (i + 1 < trajectory.size() &&
+        (cum_lookahead += trajectory.distance(i, i + 1)) >= lookahead)
+      break;
+  }
+  return true;
+}
+
+int run(int argc, char** argv) {
+  if (argc < 3) {
+    std::fprintf(
+        stderr,
+        "Usage: %s <map.yaml> <motion_primitives.mprim> [runs] [seed] "
+        "[max_planning_time]\n",
+        argv[0]);
+    return 1;
+  }
+  // Search parameters of the footprint planner.
+  FootprintPlanner::Params params = FootprintPlanner::Params::defaultParams();
+  const int nruns         = argc > 3 ? std::atoi(argv[3]) : 100;
+  const unsigned int seed = argc > 4 ? std::atoi(argv[4]) : 0;
+  if (argc > 5)
+    params.max_planning_time = std::atof(argv[5]);
+  std::mt19937 rng(seed);
+
+  // The static map, the obstacle layer and the master grid.
+  Map map;
+  if (!map.load(argv[1])) {
+    std::fprintf(stderr, "Unable to load the map %s.\n", argv[1]);
+    return 1;
+  }
+  const int size = map.size_x * map.size_y;
+  std::vector<unsigned char> obstacles(size, costmap_2d::FREE_SPACE);
+  std::vector<unsigned char> master = map.costs;
+  const auto footprint = robotFootprint(0.28);
+  footprint::CollisionChecker checker;
+  checker.setFootprint(footprint, map.resolution);
+  checker.updateCosts(master.data(), map.size_x, map.size_y);
+  costmap::ObstacleIndex clearance_index;
+  clearance_index.resize(map.size_x, map.size_y);
+
+  // The planner, on free cells until the first push of the costs.
+  sbpl::NavigationEnvironment env;
+  env.SetEnvParameter(
+      "cost_inscribed_thresh", costmap_2d::INSCRIBED_INFLATED_OBSTACLE);
+  try {
+    if (!env.InitializeEnv(
+            map.size_x, map.size_y, nullptr, 0., 0., 0., 0., 0., 0., 0., 0.,
+            0., sbpl::footprint(footprint), map.resolution, 1.0, 1.0,
+            costmap_2d::LETHAL_OBSTACLE, argv[2])) {
+      std::fprintf(stderr, "Unable to initialize the SBPL environment.\n");
+      return 1;
+    }
+  } catch (sbpl::Exception* ex) {
+    std::fprintf(stderr, "SBPL: %s\n", ex->what());
+    return 1;
+  }
+  sbpl::ARAstar planner(&env, params.forward_search);
+  std::vector<unsigned char> snapshot(size, costmap_2d::FREE_SPACE);
+  pushCosts(master, map.size_x, &env, &planner, &snapshot);
+
+  // Motion planner and controller, without visualization.
+  ControllerPID::Params controller_params =
+      ControllerPID::Params::defaultParams();
+  controller_params.visualize_topics = false;
+  LinearMotionPlanner motion_planner(
+      LinearMotionPlanner::Params::defaultParams());
+  ControllerPID controller(controller_params);
+
+  Samples planning, replanning, distance_field, costmap_update, cost_push,
+      control_step, trajectory_check;
+  int nplans = 0, nreplans = 0;
+  costmap::DistanceField field;
+  std::uniform_real_distribution<double> obstacle_radius(0.1, 0.4);
+  for (int run = 0; run < nruns; ++run) {
+    geometry_msgs::Pose start, goal;
+    if (!randomPose(map, checker, &rng, &start) ||
+        !randomPose(map, checker, &rng, &goal))
+      break;
+
+    // Heuristic field of the goal, as with shared_heuristic.
+    const int goal_x = (goal.position.x - map.origin_x) / map.resolution;
+    const int goal_y = (goal.position.y - map.origin_y) / map.resolution;
+    ros::WallTime stamp = ros::WallTime::now();
+    field.compute(
+        master.data(), map.size_x, map.size_y, map.resolution,
+        goal_y * map.size_x + goal_x, costmap_2d::LETHAL_OBSTACLE, run);
+    distance_field.push(stamp);
+
+    // Plan on the static map.
+    std::vector<geometry_msgs::PoseStamped> waypoints;
+    stamp = ros::WallTime::now();
+    const bool found =
+        plan(map, start, goal, params, &env, &planner, &waypoints);
+    planning.push(stamp);
+    if (!found)
+      continue;
+    ++nplans;
+
+    // Obstacle in the middle of the path, merged as the navigation layer
+    // does, then pushed to the collision checker and the clearance index.
+    const auto& blocked = waypoints[waypoints.size() / 2].pose.position;
+    injectObstacle(map, blocked.x, blocked.y, obstacle_radius(rng), &obstacles);
+    stamp = ros::WallTime::now();
+    for (int y = 0; y < map.size_y; ++y)
+      costmap::maxCostsRow(
+          map.costs.data() + y * map.size_x,
+          obstacles.data() + y * map.size_x, master.data() + y * map.size_x,
+          map.size_x);
+    checker.updateCosts(master.data(), map.size_x, map.size_y);
+    for (int index = 0; index < size; ++index)
+      clearance_index.setCell(
+          index, master[index] == costmap_2d::LETHAL_OBSTACLE);
+    clearance_index.update();
+    costmap_update.push(stamp);
+    stamp = ros::WallTime::now();
+    pushCosts(master, map.size_x, &env, &planner, &snapshot);
+    cost_push.push(stamp);
+
+    // Replan around the obstacle, then follow the plan at 100Hz.
+    std::vector<geometry_msgs::PoseStamped> new_waypoints;
+    stamp = ros::WallTime::now();
+    if (plan(map, start, goal, params, &env, &planner, &new_waypoints)) {
+      replanning.push(stamp);
+      ++nreplans;
+      waypoints.swap(new_waypoints);
+    }
+    const double dt = 0.01;
+    motion_planner.reset(waypoints, ros::Time(dt));
+    controller.reset(ros::Time(dt));
+    geometry_msgs::Pose pose = waypoints.front().pose;
+    geometry_msgs::Twist twist;
+    for (int tick = 2; tick < 6000; ++tick) {
+      const ros::Time now(tick * dt);
+      geometry_msgs::Pose ref_pose;
+      geometry_msgs::Twist ref_twist, cmd;
+      stamp = ros::WallTime::now();
+      motion_planner.computeReference(now, &ref_pose, &ref_twist);
+      controller.computeCommand(now, pose, ref_pose, twist, ref_twist, &cmd);
+      control_step.push(stamp);
+      stamp = ros::WallTime::now();
+      isTrajectorySafe(map, checker, motion_planner.trajectory(), 1.0);
+      trajectory_check.push(stamp);
+      // Holonomic kinematics in the map frame.
+      const double yaw = tf::getYaw(pose.orientation) + dt * cmd.angular.z;
+      pose.position.x += dt * cmd.linear.x;
+      pose.position.y += dt * cmd.linear.y;
+      pose.orientation = tf::createQuaternionMsgFromYaw(yaw);
+      twist            = cmd;
+      if (motion_planner.trajectory().size() <= 1)
+        break;
+    }
+
+    // The obstacle is cleared for the next run.
+    std::fill(obstacles.begin(), obstacles.end(), costmap_2d::FREE_SPACE);
+    master = map.costs;
+    checker.updateCosts(master.data(), map.size_x, map.size_y);
+    pushCosts(master, map.size_x, &env, &planner, &snapshot);
+  }
+
+  std::printf(
+      "%s: %dx%d cells, %d runs, %d plans, %d replans\n", argv[1], map.size_x,
+      map.size_y, nruns, nplans, nreplans);
+  std::printf(
+      "%-22s %8s %10s %10s %10s %10s %10s\n", "stage [ms]", "samples", "mean",
+      "p50", "p90", "p99", "max");
+  planning.print("planning");
+  replanning.print("replanning");
+  distance_field.print("distance field");
+  costmap_update.print("costmap update");
+  cost_push.print("planner cost push");
+  control_step.print("control step");
+  trajectory_check.print("trajectory check");
+  return 0;
+}
+
+}  // namespace benchmark
+}  // namespace squirrel_navigation
+
+int main(int argc, char** argv) {
+  ros::Time::init();
+  return squirrel_navigation::benchmark::run(argc, argv);
+}
@@ -32,10 +32,13 @@
 // OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "squirrel_navigation/navigation_layer.h"
+#include "squirrel_navigation/utils/costmap_utils.h"
 
 #include <pluginlib/class_list_macros.h>
 
+#include <algorithm>
 #include <thread>
+#include <utility>
 #include <vector>
 
 PLUGINLIB_EXPORT_CLASS(squirrel_navigation::NavigationLayer, costmap_2d::Layer);
@@ -45,6 +48,17 @@ namespace squirrel_navigation {
 void NavigationLayer::onInitialize() {
   // Initialize paramter server
   ros::NodeHandle pnh("~/" + name_);
+  trace_publisher_.reset(new squirrel_threading::tracing::TracePublisher(pnh));
+  memory_publisher_.reset(new squirrel_threading::MemoryBudgetPublisher(pnh));
+  memory_account_.reset(new squirrel_threading::MemoryBudget::Account(
+      ros::this_node::getName() + "/" + name_));
+  memory_pressure_ = squirrel_threading::MemoryPressure::NONE;
+  observation_stamp_pub_ =
+      pnh.advertise<std_msgs::Header>("observation_stamp", 1);
+  // The octomap layer is enabled by the parameter server.
+  octomap_layer_.initialize(name_ + "/OctomapLayer");
+  dynamic_layer_.initialize(name_ + "/DynamicObstacleLayer");
+  zones_layer_.initialize(name_ + "/ZonesLayer");
   dsrv_.reset(new dynamic_reconfigure::Server<NavigationLayerConfig>(pnh));
   dsrv_->setCallback(
       boost::bind(&NavigationLayer::reconfigureCallback, this, _1, _2));
@@ -72,23 +86,50 @@ void NavigationLayer::onInitialize() {
 void NavigationLayer::updateBounds(
     double robot_x, double robot_y, double robot_yaw, double* min_x,
     double* min_y, double* max_x, double* max_y) {
-  // Get bounds for laser.
+  // Get bounds for laser, concurrently to the kinect when requested: the
+  // layers own their buffers and grids.
+  const bool parallel_updates = params_.parallel_updates;
   double laser_min_x, laser_min_y, laser_max_x, laser_max_y;
-  laser_layer_.updateBounds(
-      robot_x, robot_y, robot_yaw, &laser_min_x, &laser_min_y, &laser_max_x,
-      &laser_max_y);
-  current_ = current_ && laser_layer_.currentStatus();
+  auto update_laser_bounds = [&]() {
+    laser_layer_.updateBounds(
+        robot_x, robot_y, robot_yaw, &laser_min_x, &laser_min_y, &laser_max_x,
+        &laser_max_y);
+  };
+  if (parallel_updates)
+    laser_worker_.run(update_laser_bounds);
+  else
+    update_laser_bounds();
+  // Degrade the voxel grid on the pressure of the memory budget.
+  updateMemoryPressure();
   // Get bounds for kinect.
   double kinect_min_x, kinect_min_y, kinect_max_x, kinect_max_y;
   kinect_layer_.updateBounds(
       robot_x, robot_y, robot_yaw, &kinect_min_x, &kinect_min_y, &kinect_max_x,
       &kinect_max_y);
-  current_ = current_ && laser_layer_.currentStatus();
+  if (parallel_updates)
+    laser_worker_.wait();
+  current_ = current_ && laser_layer_.currentStatus() &&
+             kinect_layer_.currentStatus();
   // Get the boundaries.
   *min_x = std::min(laser_min_x, kinect_min_x);
   *min_y = std::min(laser_min_y, kinect_min_y);
   *max_x = std::max(laser_max_x, kinect_max_x);
   *max_y = std::max(laser_max_y, kinect_max_y);
+  // The octomap grid is merged only if aligned by this update.
+  merge_octomap_ = octomap_layer_.enabled();
+  if (merge_octomap_)
+    octomap_layer_.updateBounds(
+        *layered_costmap_->getCostmap(), min_x, min_y, max_x, max_y);
+  merge_dynamic_ = dynamic_layer_.enabled();
+  if (merge_dynamic_)
+    dynamic_layer_.updateBounds(
+        *layered_costmap_->getCostmap(), min_x, min_y, max_x, max_y);
+  merge_zones_ = zones_layer_.enabled();
+  if (merge_zones_)
+    zones_layer_.updateBounds(
+        *layered_costmap_->getCostmap(), min_x, min_y, max_x, max_y);
+  clearPendingRegions(min_x, min_y, max_x, max_y);
+  reportMemoryUsage();
 }
 
 void NavigationLayer::updateCosts(
@@ -97,13 +138,29 @@ void NavigationLayer::updateCosts(
   unsigned char* laser_costmap  = laser_layer_.costmap();
   unsigned char* kinect_costmap = kinect_layer_.costmap();
   unsigned char* static_costmap = static_layer_.costmap();
-  // Merge the two costmaps.
+  unsigned char* octomap_costmap =
+      merge_octomap_ ? octomap_layer_.costmap() : nullptr;
+  unsigned char* dynamic_costmap =
+      merge_dynamic_ ? dynamic_layer_.costmap() : nullptr;
+  unsigned char* zones_costmap =
+      merge_zones_ ? zones_layer_.costmap() : nullptr;
+  // Merge the costmaps straight into the master grid.
   const unsigned int stride = master_grid.getSizeInCellsX();
   mergeCostmaps(
-      laser_costmap, kinect_costmap, static_costmap, stride, min_i, min_j,
-      max_i, max_j);
-  resetMasterCostmapLocally(master_grid, stride, min_i, min_j, max_i, max_j);
-  updateWithOverwrite(master_grid, min_i, min_j, max_i, max_j);
+      laser_costmap, kinect_costmap, octomap_costmap, dynamic_costmap,
+      zones_costmap, static_costmap, master_grid.getCharMap(), stride, min_i,
+      min_j, max_i, max_j);
+  if (observation_stamp_pub_.getNumSubscribers() > 0) {
+    std_msgs::Header header;
+    header.stamp = std::max(
+        laser_layer_.latestObservationStamp(),
+        kinect_layer_.latestObservationStamp());
+    header.frame_id = layered_costmap_->getGlobalFrameID();
+    observation_stamp_pub_.publish(header);
+  }
+  // Keep the obstacle index in sync with the merged costs.
+  std::unique_lock<std::mutex> lock(update_mtx_);
+  updateObstacleIndex(master_grid, min_i, min_j, max_i, max_j);
 }
 
 void NavigationLayer::activate() {
@@ -130,33 +187,24 @@ void NavigationLayer::reset() {
 
 void NavigationLayer::reconfigureCallback(
     NavigationLayerConfig& config, uint32_t level) {
-  kinect_layer_.enabled() = config.use_kinect;
-  laser_layer_.enabled()  = config.use_laser_scan;
+  kinect_layer_.enabled()  = config.use_kinect;
+  laser_layer_.enabled()   = config.use_laser_scan;
+  octomap_layer_.setEnabled(config.use_octomap);
+  dynamic_layer_.setEnabled(config.use_dynamic_obstacles);
+  zones_layer_.setEnabled(config.use_zones);
+  params_.parallel_updates = config.parallel_updates;
 }
 
 bool NavigationLayer::clearCostmapRegionCallback(
     squirrel_navigation_msgs::ClearCostmapRegion::Request& req,
     squirrel_navigation_msgs::ClearCostmapRegion::Response& res) {
-  // Wait for costmap to be disabled.
-  req.sleep.sleep();
-  if (kinect_layer_.enabled() || laser_layer_.enabled())
+  // The region is cleared from the layers by the next update, so the
+  // service returns immediately and the observations already in the
+  // layers do not mark it again.
+  if (req.region.points.size() < 3)
     return false;
-  // Getting clearing bounding box.
-  const int inf = std::numeric_limits<double>::max();
-  int min_i = inf, min_j = inf, max_i = -inf, max_j = -inf;
-  for (const auto& point : req.region.points) {
-    int p_i, p_j;
-    worldToMapEnforceBounds(point.x, point.y, p_i, p_j);
-    min_i = std::min(min_i, p_i);
-    min_j = std::min(min_j, p_j);
-    max_i = std::max(max_i, p_i);
-    max_j = std::max(max_j, p_j);
-  }
-  // Clear the master grid.
-  costmap_2d::Costmap2D* master_costmap = layered_costmap_->getCostmap();
-  for (int i = min_i; i < max_i; ++i)
-    for (int j = min_j; j < max_j; ++j)
-      master_costmap->setCost(i, j, costmap_2d::FREE_SPACE);
+  std::unique_lock<std::mutex> lock(clear_mtx_);
+  pending_regions_.emplace_back(req.region);
   return true;
 }
 
@@ -165,14 +213,11 @@ bool NavigationLayer::getObstaclesMapCallback(
     squirrel_navigation_msgs::GetObstaclesMap::Response& res) {
   std::vector<bool> obstacles_indicator;
   std::vector<geometry_msgs::Point32> obstacles_positions;
-  const int nobstacles =
-      getObstaclesMap(&obstacles_indicator, &obstacles_positions);
-  res.obstacles_indicator.resize(nobstacles);
-  res.obstacles_positions.resize(nobstacles);
-  for (int i = 0; i < nobstacles; ++i) {
+  getObstaclesMap(&obstacles_indicator, &obstacles_positions);
+  res.obstacles_indicator.resize(obstacles_indicator.size());
+  for (size_t i = 0; i < obstacles_indicator.size(); ++i)
     res.obstacles_indicator[i] = obstacles_indicator[i];
-    res.obstacles_positions[i] = obstacles_positions[i];
-  }
+  res.obstacles_positions = std::move(obstacles_positions);
   // Set the map origin.
   const costmap_2d::Costmap2D* master_costmap = layered_costmap_->getCostmap();
   res.map_origin.x                            = master_costmap->getOriginX();
@@ -184,28 +229,45 @@ bool NavigationLayer::getObstaclesMapCallback(
 bool NavigationLayer::getPathClearanceCallback(
     squirrel_navigation_msgs::GetPathClearance::Request& req,
     squirrel_navigation_msgs::GetPathClearance::Response& res) {
-  std::vector<bool> obstacles_indicator;
-  std::vector<geometry_msgs::Point32> obstacles_positions;
-  getObstaclesMap(&obstacles_indicator, &obstacles_positions);
+  std::unique_lock<std::mutex> lock(update_mtx_);
+  const costmap_2d::Costmap2D* master_costmap = layered_costmap_->getCostmap();
+  const int size_x = master_costmap->getSizeInCellsX();
+  const int size_y = master_costmap->getSizeInCellsY();
+  const bool index_valid =
+      obstacle_index_.sizeX() == size_x && obstacle_index_.sizeY() == size_y;
+  const std::vector<int>& obstacles = obstacle_index_.obstacles();
   // Resize the storage.
   const int nwaypoints = req.plan.poses.size();
-  res.proximity_map.reserve(nwaypoints);
+  res.proximity_map.resize(nwaypoints);
   res.proximities.resize(nwaypoints);
-  geometry_msgs::Point32 closest_obstacle;
   // Get the proximity informations.
   res.clearance = std::numeric_limits<double>::max();
   for (int i = 0; i < nwaypoints; ++i) {
     const auto& waypoint = req.plan.poses[i];
-    // Get the clearance of the waypoint.
-    res.proximities[i] = std::numeric_limits<double>::max();
-    for (int o = 0; o < obstacles_positions.size(); ++o) {
-      const double dist = std::hypot(
-          waypoint.pose.position.x - obstacles_positions[o].x,
-          waypoint.pose.position.y - obstacles_positions[o].y);
+    const double wx = waypoint.pose.position.x, wy = waypoint.pose.position.y;
+    // Distance to an obstacle cell.
+    auto closer = [&](int obstacle) {
+      double ox, oy;
+      master_costmap->mapToWorld(obstacle % size_x, obstacle / size_x, ox, oy);
+      const double dist = std::hypot(wx - ox, wy - oy);
       if (dist < res.proximities[i]) {
-        res.proximities[i]   = dist;
-        res.proximity_map[i] = obstacles_positions[o];
+        res.proximities[i]     = dist;
+        res.proximity_map[i].x = ox;
+        res.proximity_map[i].y = oy;
+        res.proximity_map[i].z = 0.;
       }
+    };
+    // Get the clearance of the waypoint, a lookup inside of the map.
+    res.proximities[i] = std::numeric_limits<double>::max();
+    unsigned int mx, my;
+    if (index_valid && master_costmap->worldToMap(wx, wy, mx, my)) {
+      const int obstacle =
+          obstacle_index_.nearestObstacle(master_costmap->getIndex(mx, my));
+      if (obstacle >= 0)
+        closer(obstacle);
+    } else if (index_valid) {
+      for (const int obstacle : obstacles)
+        closer(obstacle);
     }
     // Update the proximity map.
     if (res.proximities[i] < res.clearance) {
@@ -220,65 +282,173 @@ size_t NavigationLayer::getObstaclesMap(
     std::vector<bool>* obstacles_indicator,
     std::vector<geometry_msgs::Point32>* obstacles_positions) const {
   std::unique_lock<std::mutex> lock(update_mtx_);
-  // Costmap size.
   const costmap_2d::Costmap2D* master_costmap = layered_costmap_->getCostmap();
-  const size_t size_x = master_costmap->getSizeInCellsX();
-  const size_t size_y = master_costmap->getSizeInCellsY();
-  // Storage.
-  obstacles_indicator->resize(size_x * size_y);
-  obstacles_positions->reserve(size_x * size_y);
+  // Occupancy of every cell.
+  const std::vector<unsigned char>& occupancy = obstacle_index_.occupancy();
+  obstacles_indicator->assign(occupancy.begin(), occupancy.end());
+  // Positions of the obstacles.
+  const std::vector<int>& obstacles = obstacle_index_.obstacles();
+  const int size_x                  = obstacle_index_.sizeX();
+  obstacles_positions->clear();
+  obstacles_positions->reserve(obstacles.size());
   geometry_msgs::Point32 point;
-  // Check for obstacles.
-  size_t nobstacles = 0;
   double px, py;
-  for (size_t x = 0; x < size_x; ++x)
-    for (size_t y = 0; y < size_y; ++y) {
-      const unsigned int index       = master_costmap->getIndex(x, y);
-      obstacles_indicator->at(index) = false;
-      if (master_costmap->getCost(x, y) == costmap_2d::FREE_SPACE) {
-        obstacles_indicator->at(index) = true;
-        master_costmap->mapToWorld(x, y, px, py);
-        obstacles_positions->emplace_back(point);
-        nobstacles++;
-      }
+  for (const int index : obstacles) {
+    master_costmap->mapToWorld(index % size_x, index / size_x, px, py);
+    point.x = px;
+    point.y = py;
+    obstacles_positions->emplace_back(point);
+  }
+  return obstacles.size();
+}
+
+void NavigationLayer::updateObstacleIndex(
+    const costmap_2d::Costmap2D& master_grid, int min_i, int min_j, int max_i,
+    int max_j) {
+  const int size_x = master_grid.getSizeInCellsX();
+  const int size_y = master_grid.getSizeInCellsY();
+  // A new size or origin moves the cells, the index is rebuilt.
+  if (size_x != obstacle_index_.sizeX() || size_y != obstacle_index_.sizeY() ||
+      master_grid.getOriginX() != index_origin_x_ ||
+      master_grid.getOriginY() != index_origin_y_) {
+    obstacle_index_.resize(size_x, size_y);
+    index_origin_x_ = master_grid.getOriginX();
+    index_origin_y_ = master_grid.getOriginY();
+    min_i = min_j = 0;
+    max_i         = size_x;
+    max_j         = size_y;
+  }
+  const unsigned char* costs = master_grid.getCharMap();
+  for (int j = std::max(min_j, 0); j < std::min(max_j, size_y); ++j)
+    for (int i = std::max(min_i, 0); i < std::min(max_i, size_x); ++i) {
+      const int index = j * size_x + i;
+      obstacle_index_.setCell(
+          index, costs[index] == costmap_2d::LETHAL_OBSTACLE);
     }
-  return nobstacles;
+  obstacle_index_.update();
 }
 
-void NavigationLayer::resetMasterCostmapLocally(
-    costmap_2d::Costmap2D& master_grid, unsigned int stride, int min_i,
-    int min_j, int max_i, int max_j) {
-  unsigned char* master_costmap = master_grid.getCharMap();
-  for (int j = min_j; j < max_j; ++j) {
-    unsigned int it = stride * j + min_i;
-    for (int i = min_i; i < max_i; ++i) {
-      master_costmap[it] = costmap_2d::FREE_SPACE;
-      it++;
+void NavigationLayer::updateMemoryPressure() {
+  const squirrel_threading::MemoryPressure pressure =
+      memory_account_->pressure();
+  if (pressure == memory_pressure_)
+    return;
+  kinect_layer_.setMemoryPressure(pressure);
+  switch (pressure) {
+    case squirrel_threading::MemoryPressure::SOFT:
+      memory_account_->recordAction("throttled the voxel grid");
+      break;
+    case squirrel_threading::MemoryPressure::HARD:
+      memory_account_->recordAction("stopped the voxel grid");
+      break;
+    default:
+      memory_account_->recordAction("restored the voxel grid");
+      break;
+  }
+  memory_pressure_ = pressure;
+}
+
+void NavigationLayer::reportMemoryUsage() {
+  const costmap_2d::Costmap2D* master_grid = layered_costmap_->getCostmap();
+  const size_t num_cells = static_cast<size_t>(master_grid->getSizeInCellsX()) *
+                           master_grid->getSizeInCellsY();
+  // Costs of the laser, the static and the merged layers, the depth camera
+  // one accounts for itself.
+  const size_t num_grids =
+      2 + (merge_octomap_ ? 1 : 0) + (merge_dynamic_ ? 1 : 0) +
+      (merge_zones_ ? 1 : 0);
+  size_t index_bytes;
+  {
+    std::unique_lock<std::mutex> lock(update_mtx_);
+    index_bytes = obstacle_index_.memoryUsage();
+  }
+  memory_account_->report(
+      num_grids * num_cells + kinect_layer_.memoryUsage() + index_bytes);
+}
+
+void NavigationLayer::clearPendingRegions(
+    double* min_x, double* min_y, double* max_x, double* max_y) {
+  std::vector<geometry_msgs::Polygon> regions;
+  {
+    std::unique_lock<std::mutex> lock(clear_mtx_);
+    regions.swap(pending_regions_);
+  }
+  if (regions.empty())
+    return;
+  // Laser and kinect layers share the size and origin of the master grid.
+  const double origin_x   = laser_layer_.getOriginX();
+  const double origin_y   = laser_layer_.getOriginY();
+  const double resolution = laser_layer_.getResolution();
+  const int size_x        = laser_layer_.getSizeInCellsX();
+  const int size_y        = laser_layer_.getSizeInCellsY();
+  std::vector<double> xs, ys;
+  for (const auto& region : regions) {
+    xs.clear();
+    ys.clear();
+    for (const auto& point : region.points) {
+      xs.push_back((point.x - origin_x) / resolution);
+      ys.push_back((point.y - origin_y) / resolution);
+      *min_x = std::min<double>(*min_x, point.x);
+      *min_y = std::min<double>(*min_y, point.y);
+      *max_x = std::max<double>(*max_x, point.x);
+      *max_y = std::max<double>(*max_y, point.y);
     }
+    // Row-wise clear of the cells inside of the polygon.
+    costmap::forEachPolygonSpan(
+        xs, ys, size_x, size_y, [this](int j, int min_i, int max_i) {
+          laser_layer_.clearRow(j, min_i, max_i);
+          kinect_layer_.clearRow(j, min_i, max_i);
+        });
   }
 }
 
 void NavigationLayer::mergeCostmaps(
     unsigned char* laser_costmap, unsigned char* kinect_costmap,
-    unsigned char* static_costmap, unsigned int stride, int min_i, int min_j,
+    unsigned char* octomap_costmap, unsigned char* dynamic_costmap,
+    unsigned char* zones_costmap, unsigned char* static_costmap,
+    unsigned char* master_costmap, unsigned int stride, int min_i, int min_j,
     int max_i, int max_j) {
-  const std::set<unsigned int>& floor_indices = kinect_layer_.floorIndices();
-  for (const auto index : floor_indices)
-    costmap_[index] = laser_costmap[index] = costmap_2d::FREE_SPACE;
+  SQUIRREL_TRACE_SCOPE("navigation_layer/merge_costmaps");
+  for (const auto index : kinect_layer_.floorIndices())
+    laser_costmap[index] = costmap_2d::FREE_SPACE;
+  if (max_i <= min_i)
+    return;
+  // Cells unknown in any layer are free in the master grid. The octomap
+  // costs are merged into a row of the depth camera ones first, the
+  // predicted dynamic obstacles and the keep-out zones are raised on top of
+  // the merged costs.
+  const size_t size = max_i - min_i;
+  if (octomap_costmap)
+    merge_row_.resize(size);
   for (int j = min_j; j < max_j; ++j) {
-    unsigned int it = stride * j + min_i;
-    for (int i = min_i; i < max_i; ++i) {
-      costmap_[it] = std::max(laser_costmap[it], kinect_costmap[it]);
-      costmap_[it] = std::max(static_costmap[it], costmap_[it]);
-      it++;
+    const unsigned int it = stride * j + min_i;
+    const unsigned char* second = kinect_costmap + it;
+    if (octomap_costmap) {
+      costmap::maxCostsRow(
+          second, octomap_costmap + it, merge_row_.data(), size);
+      second = merge_row_.data();
     }
+    costmap::mergeCostsRow(
+        laser_costmap + it, second, static_costmap + it, master_costmap + it,
+        size);
+    if (dynamic_costmap)
+      costmap::maxCostsRow(
+          master_costmap + it, dynamic_costmap + it, master_costmap + it,
+          size);
+    if (zones_costmap)
+      costmap::maxCostsRow(
+          master_costmap + it, zones_costmap + it, master_costmap + it, size);
   }
 }
 
 NavigationLayer::Params NavigationLayer::Params::defaultParams() {
   Params params;
-  params.use_kinect     = true;
-  params.use_laser_scan = true;
+  params.use_kinect            = true;
+  params.use_laser_scan        = true;
+  params.use_octomap           = false;
+  params.use_dynamic_obstacles = false;
+  params.use_zones             = false;
+  params.parallel_updates      = false;
   return params;
 }
 
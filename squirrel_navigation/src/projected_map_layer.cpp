@@ -0,0 +1,215 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/projected_map_layer.h"
+
+#include <ros/console.h>
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace squirrel_navigation {
+
+ProjectedMapLayer::ProjectedMapLayer()
+    : params_(Params::defaultParams()), enabled_(false) {}
+
+ProjectedMapLayer::ProjectedMapLayer(const Params& params)
+    : params_(params), enabled_(false) {}
+
+void ProjectedMapLayer::initialize(const std::string& name) {
+  ros::NodeHandle pnh("~/" + name);
+  pnh.param<std::string>("map_topic", params_.map_topic, params_.map_topic);
+  pnh.param<bool>(
+      "subscribe_to_updates", params_.subscribe_to_updates,
+      params_.subscribe_to_updates);
+  pnh.param<int>(
+      "occupied_threshold", params_.occupied_threshold,
+      params_.occupied_threshold);
+  default_value_ = costmap_2d::FREE_SPACE;
+}
+
+void ProjectedMapLayer::setEnabled(bool enabled) {
+  if (enabled == enabled_)
+    return;
+  enabled_ = enabled;
+  if (!enabled) {
+    map_sub_.shutdown();
+    map_update_sub_.shutdown();
+    return;
+  }
+  map_sub_ = nh_.subscribe(
+      params_.map_topic, 1, &ProjectedMapLayer::mapCallback, this);
+  if (params_.subscribe_to_updates)
+    map_update_sub_ = nh_.subscribe(
+        params_.map_topic + "_updates", 10,
+        &ProjectedMapLayer::mapUpdateCallback, this);
+  ROS_INFO_STREAM(
+      "squirrel_navigation/ProjectedMapLayer: Subscribed to "
+      << params_.map_topic << ".");
+}
+
+void ProjectedMapLayer::updateBounds(
+    const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+    double* max_x, double* max_y) {
+  nav_msgs::OccupancyGrid::ConstPtr map;
+  std::vector<map_msgs::OccupancyGridUpdate::ConstPtr> updates;
+  {
+    std::unique_lock<std::mutex> lock(pending_mtx_);
+    map.swap(pending_map_);
+    updates.swap(pending_updates_);
+  }
+  // A new map or a moved grid is written from scratch.
+  const bool aligned = size_x_ == master_grid.getSizeInCellsX() &&
+                       size_y_ == master_grid.getSizeInCellsY() &&
+                       resolution_ == master_grid.getResolution() &&
+                       origin_x_ == master_grid.getOriginX() &&
+                       origin_y_ == master_grid.getOriginY();
+  if (!aligned)
+    resizeMap(
+        master_grid.getSizeInCellsX(), master_grid.getSizeInCellsY(),
+        master_grid.getResolution(), master_grid.getOriginX(),
+        master_grid.getOriginY());
+  if (map) {
+    source_info_ = map->info;
+    source_.assign(map->data.begin(), map->data.end());
+  }
+  if (!aligned || map) {
+    resetMaps();
+    render(0, 0, source_info_.width, source_info_.height);
+    // The previous obstacles may be anywhere in the grid.
+    *min_x = std::min(*min_x, origin_x_);
+    *min_y = std::min(*min_y, origin_y_);
+    *max_x = std::max(*max_x, origin_x_ + size_x_ * resolution_);
+    *max_y = std::max(*max_y, origin_y_ + size_y_ * resolution_);
+  }
+  // Patches of the source map.
+  const int width  = source_info_.width;
+  const int height = source_info_.height;
+  for (const auto& update : updates) {
+    const int x0 = update->x, y0 = update->y;
+    const int w = update->width, h = update->height;
+    const int x1 = x0 + w, y1 = y0 + h;
+    if (x1 > width || y1 > height ||
+        update->data.size() < static_cast<size_t>(w * h)) {
+      ROS_WARN_STREAM_THROTTLE(
+          1., "squirrel_navigation/ProjectedMapLayer: Skipping an update "
+              "outside of the map "
+                  << params_.map_topic << ".");
+      continue;
+    }
+    for (int j = 0; j < h; ++j)
+      std::copy_n(
+          update->data.begin() + j * w, w,
+          source_.begin() + (y0 + j) * width + x0);
+    render(x0, y0, x1, y1);
+    const double res = source_info_.resolution;
+    const double ox  = source_info_.origin.position.x;
+    const double oy  = source_info_.origin.position.y;
+    *min_x           = std::min(*min_x, ox + x0 * res);
+    *min_y           = std::min(*min_y, oy + y0 * res);
+    *max_x           = std::max(*max_x, ox + x1 * res);
+    *max_y           = std::max(*max_y, oy + y1 * res);
+  }
+}
+
+void ProjectedMapLayer::render(int x0, int y0, int x1, int y1) {
+  const double res = source_info_.resolution;
+  if (x1 <= x0 || y1 <= y0 || res <= 0.)
+    return;
+  const double ox = source_info_.origin.position.x;
+  const double oy = source_info_.origin.position.y;
+  // Cells of the grid whose centers fall inside of the source cells.
+  auto first_cell = [this](double w, double origin, int size) {
+    const double cell = std::ceil((w - origin) / resolution_ - 0.5);
+    return static_cast<int>(std::min<double>(std::max(cell, 0.), size));
+  };
+  const int min_i = first_cell(ox + x0 * res, origin_x_, size_x_);
+  const int max_i = first_cell(ox + x1 * res, origin_x_, size_x_);
+  const int min_j = first_cell(oy + y0 * res, origin_y_, size_y_);
+  const int max_j = first_cell(oy + y1 * res, origin_y_, size_y_);
+  if (max_i <= min_i || max_j <= min_j)
+    return;
+  // Source column of every column of the grid.
+  auto source_cell = [res](double w, double origin, int lo, int hi) {
+    const int cell = std::floor((w - origin) / res);
+    return std::min(std::max(cell, lo), hi - 1);
+  };
+  source_columns_.resize(max_i - min_i);
+  for (int i = min_i; i < max_i; ++i)
+    source_columns_[i - min_i] =
+        source_cell(origin_x_ + (i + 0.5) * resolution_, ox, x0, x1);
+  const int width = source_info_.width;
+  for (int j = min_j; j < max_j; ++j) {
+    const int8_t* source_row =
+        source_.data() +
+        width * source_cell(origin_y_ + (j + 0.5) * resolution_, oy, y0, y1);
+    unsigned char* row = costmap_ + j * size_x_;
+    for (int i = min_i; i < max_i; ++i)
+      row[i] = source_row[source_columns_[i - min_i]] >=
+                       params_.occupied_threshold
+                   ? costmap_2d::LETHAL_OBSTACLE
+                   : costmap_2d::FREE_SPACE;
+  }
+}
+
+void ProjectedMapLayer::mapCallback(
+    const nav_msgs::OccupancyGrid::ConstPtr& map) {
+  if (map->data.size() < map->info.width * map->info.height) {
+    ROS_WARN_STREAM_THROTTLE(
+        1., "squirrel_navigation/ProjectedMapLayer: Malformed map on "
+                << params_.map_topic << ", skipping it.");
+    return;
+  }
+  std::unique_lock<std::mutex> lock(pending_mtx_);
+  pending_map_ = map;
+  pending_updates_.clear();
+}
+
+void ProjectedMapLayer::mapUpdateCallback(
+    const map_msgs::OccupancyGridUpdate::ConstPtr& update) {
+  std::unique_lock<std::mutex> lock(pending_mtx_);
+  pending_updates_.emplace_back(update);
+}
+
+ProjectedMapLayer::Params ProjectedMapLayer::Params::defaultParams() {
+  Params params;
+  params.map_topic            = "projected_base_map";
+  params.subscribe_to_updates = true;
+  params.occupied_threshold   = 100;
+  return params;
+}
+
+}  // namespace squirrel_navigation
@@ -40,6 +40,8 @@
 
 #include <tf/tf.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <thread>
 
@@ -48,6 +50,32 @@ namespace safety {
 
 const std::string ScanObserver::tag = "ScanSafetyObserver";
 
+ScanObserver::ScanObserver()
+    : params_(Params::defaultParams()),
+      num_unsafe_beams_(0),
+      state_changed_(false),
+      stop_publisher_(false) {
+  init_ = false;
+}
+
+ScanObserver::ScanObserver(const Params& params)
+    : params_(params),
+      num_unsafe_beams_(0),
+      state_changed_(false),
+      stop_publisher_(false) {
+  init_ = false;
+}
+
+ScanObserver::~ScanObserver() {
+  {
+    std::unique_lock<std::mutex> lock(publisher_mtx_);
+    stop_publisher_ = true;
+  }
+  publisher_cv_.notify_all();
+  if (publisher_thread_.joinable())
+    publisher_thread_.join();
+}
+
 void ScanObserver::initialize(const std::string& name) {
   if (init_)
     return;
@@ -66,6 +94,7 @@ void ScanObserver::initialize(const std::string& name) {
   safety_log_pub_ =
       pnh.advertise<squirrel_navigation_msgs::ScanSafetyObservation>(
           "scan_safety_log", 1);
+  publisher_thread_ = std::thread(&ScanObserver::publishDiagnostics, this);
   // Initialization successful.
   init_ = true;
   ROS_INFO_STREAM(
@@ -73,16 +102,13 @@ void ScanObserver::initialize(const std::string& name) {
 }
 
 bool ScanObserver::safe() const {
-  std::unique_lock<std::mutex> lock(mtx_);
-  for (int i = 0; i < ab_filter_.stateDimension(); ++i)
-    if (!safeCheck(i)) {
-      if (params_.verbose)
-        ROS_WARN_STREAM(
-            "squirrel_navigation::safety::ScanObserver: Unsafe scan,"
-            "someone's approaching the robot?.");
-      return false || !params_.enabled;
-    }
-  return true || !params_.enabled;
+  if (!params_.enabled || num_unsafe_beams_.load() == 0)
+    return true;
+  if (params_.verbose)
+    ROS_WARN_STREAM(
+        "squirrel_navigation::safety::ScanObserver: Unsafe scan,"
+        "someone's approaching the robot?.");
+  return false;
 }
 
 bool ScanObserver::safeCheck(int i) const {
@@ -99,6 +125,7 @@ void ScanObserver::reconfigureCallback(
   params_.scan_topic          = config.scan_topic;
   params_.max_safety_rangevel = config.max_safety_rangevel;
   params_.unsafe_range        = config.unsafe_range;
+  params_.diagnostics_rate    = config.diagnostics_rate;
   params_.verbose             = config.verbose;
 }
 
@@ -117,43 +144,90 @@ void ScanObserver::laserScanCallback(
 void ScanObserver::updateState(
     const std::vector<float>& ranges, const ros::Time& stamp) {
   std::unique_lock<std::mutex> lock(mtx_);
-  // Update the dimension of the filter (only once).
-  static const int nranges = ranges.size();
-  ab_filter_.setStateDimension(nranges);
-  // Compute the velocities.
-  const Eigen::MatrixXf& state = ab_filter_(ranges, stamp);
-  ranges_.resize(nranges);
-  rangevelocities_.resize(nranges);
-  for (int i = 0; i < nranges; ++i) {
-    ranges_[i]          = state(i, 0);
-    rangevelocities_[i] = state(i, 1);
+  // Restart the filter when the scanner changes.
+  const int nranges = ranges.size();
+  if (ab_filter_.stateDimension() != nranges) {
+    ab_filter_.setStateDimension(nranges);
+    ab_filter_.reset();
+    ranges_.resize(nranges);
+    rangevelocities_.resize(nranges);
+    unsafe_beams_.resize((nranges + 63) / 64);
   }
-  publishMarkers(stamp);
-  publishMessage(stamp);
+  // Compute the velocities in place.
+  ab_filter_.update(ranges, stamp, ranges_.data(), rangevelocities_.data());
+  // Aggregate the unsafe beams, safe() only reads their number.
+  std::fill(unsafe_beams_.begin(), unsafe_beams_.end(), 0);
+  int num_unsafe_beams = 0;
+  for (int i = 0; i < nranges; ++i)
+    if (!safeCheck(i)) {
+      unsafe_beams_[i >> 6] |= uint64_t(1) << (i & 63);
+      ++num_unsafe_beams;
+    }
+  num_unsafe_beams_ = num_unsafe_beams;
+  stamp_            = stamp;
+  state_changed_    = true;
+}
+
+void ScanObserver::publishDiagnostics() {
+  std::unique_lock<std::mutex> publisher_lock(publisher_mtx_);
+  while (!stop_publisher_) {
+    const double rate   = params_.diagnostics_rate;
+    const double period = rate > 0. ? 1. / rate : 1.;
+    publisher_cv_.wait_for(
+        publisher_lock, std::chrono::duration<double>(period),
+        [this] { return stop_publisher_.load(); });
+    if (stop_publisher_ || rate <= 0.)
+      continue;
+    const bool markers = rangevels_pub_.getNumSubscribers() > 0;
+    const bool message = safety_log_pub_.getNumSubscribers() > 0;
+    if (!markers && !message)
+      continue;
+    // Copy the last state, the messages are built outside the lock.
+    ros::Time stamp;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      if (!state_changed_)
+        continue;
+      pub_ranges_          = ranges_;
+      pub_rangevelocities_ = rangevelocities_;
+      pub_unsafe_beams_    = unsafe_beams_;
+      stamp                = stamp_;
+      state_changed_       = false;
+    }
+    if (markers)
+      publishMarkers(stamp);
+    if (message)
+      publishMessage(stamp);
+  }
+}
+
+bool ScanObserver::unsafeBeam(int i) const {
+  return (pub_unsafe_beams_[i >> 6] >> (i & 63)) & 1;
 }
 
 geometry_msgs::Pose ScanObserver::computeMarkerPose(int i) const {
-  const double vel_dir = rangevelocities_[i] >= 0. ? 0. : -M_PI;
+  const double vel_dir = pub_rangevelocities_[i] >= 0. ? 0. : -M_PI;
   const double angle =
       params_.scan_angle_min + i * params_.scan_angle_increment;
   // Computing the pose.
   geometry_msgs::Pose marker_pose;
-  marker_pose.position.x  = ranges_[i] * std::cos(angle);
-  marker_pose.position.y  = ranges_[i] * std::sin(angle);
+  marker_pose.position.x  = pub_ranges_[i] * std::cos(angle);
+  marker_pose.position.y  = pub_ranges_[i] * std::sin(angle);
   marker_pose.position.z  = 0.0;
   marker_pose.orientation = tf::createQuaternionMsgFromYaw(angle + vel_dir);
   return marker_pose;
 }
 
 double ScanObserver::computeMarkerArrowLength(int i) const {
-  const double length = 0.5 * std::abs(rangevelocities_[i]);
+  const double length = 0.5 * std::abs(pub_rangevelocities_[i]);
   return std::max(length, 1e-3);
 }
 
 void ScanObserver::publishMarkers(const ros::Time& stamp) const {
   visualization_msgs::MarkerArray marker_array;
-  marker_array.markers.reserve(ab_filter_.stateDimension());
-  for (int i = 0; i < ab_filter_.stateDimension(); ++i) {
+  const int nranges = pub_ranges_.size();
+  marker_array.markers.reserve(nranges);
+  for (int i = 0; i < nranges; ++i) {
     visualization_msgs::Marker marker;
     marker.id              = i;
     marker.header.stamp    = stamp;
@@ -165,8 +239,8 @@ void ScanObserver::publishMarkers(const ros::Time& stamp) const {
     marker.scale.x         = computeMarkerArrowLength(i);
     marker.scale.y         = 0.1;
     marker.scale.z         = 0.1;
-    marker.color.r         = safeCheck(i);
-    marker.color.g         = !safeCheck(i);
+    marker.color.r         = !unsafeBeam(i);
+    marker.color.g         = unsafeBeam(i);
     marker.color.b         = 0.0;
     marker.color.a         = 0.5;
     marker_array.markers.emplace_back(marker);
@@ -179,13 +253,13 @@ void ScanObserver::publishMessage(const ros::Time& stamp) const {
   safety_log.header.stamp    = stamp;
   safety_log.header.frame_id = params_.scan_frame_id;
   safety_log.is_safe         = true;
-  safety_log.safe_readings.resize(ranges_.size());
-  for (int i = 0; i < (int)ranges_.size(); ++i) {
-    safety_log.safe_readings[i] = safeCheck(i);
+  safety_log.safe_readings.resize(pub_ranges_.size());
+  for (int i = 0; i < (int)pub_ranges_.size(); ++i) {
+    safety_log.safe_readings[i] = !unsafeBeam(i);
     if (!safety_log.safe_readings[i])
       safety_log.is_safe = false;
   }
-  safety_log.range_velocities          = rangevelocities_;
+  safety_log.range_velocities          = pub_rangevelocities_;
   safety_log.max_safety_range_velocity = params_.max_safety_rangevel;
   safety_log.unsafe_range              = params_.unsafe_range;
   safety_log_pub_.publish(safety_log);
@@ -197,6 +271,7 @@ ScanObserver::Params ScanObserver::Params::defaultParams() {
   params.scan_topic          = "/scan";
   params.max_safety_rangevel = 0.5;
   params.unsafe_range        = 0.75;
+  params.diagnostics_rate    = 2.0;
   params.verbose             = false;
   return params;
 }
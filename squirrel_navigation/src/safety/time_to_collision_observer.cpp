@@ -0,0 +1,253 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/safety/time_to_collision_observer.h"
+#include "squirrel_navigation/utils/footprint_utils.h"
+
+#include <ros/node_handle.h>
+
+#include <tf/tf.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace squirrel_navigation {
+namespace safety {
+
+const std::string TimeToCollisionObserver::tag = "TimeToCollisionObserver";
+
+TimeToCollisionObserver::TimeToCollisionObserver()
+    : params_(Params::defaultParams()),
+      scan_angle_min_(0.),
+      scan_angle_increment_(0.),
+      beams_valid_(false),
+      footprint_key_(0),
+      num_unsafe_beams_(0) {
+  init_ = false;
+}
+
+TimeToCollisionObserver::TimeToCollisionObserver(const Params& params)
+    : params_(params),
+      scan_angle_min_(0.),
+      scan_angle_increment_(0.),
+      beams_valid_(false),
+      footprint_key_(0),
+      num_unsafe_beams_(0) {
+  init_ = false;
+}
+
+void TimeToCollisionObserver::initialize(const std::string& name) {
+  if (init_)
+    return;
+  // Initialize the parameter server.
+  ros::NodeHandle pnh("~/" + name), nh;
+  dsrv_.reset(
+      new dynamic_reconfigure::Server<TimeToCollisionObserverConfig>(pnh));
+  dsrv_->setCallback(boost::bind(
+      &TimeToCollisionObserver::reconfigureCallback, this, _1, _2));
+  // Initialize the alpha/beta-filter of the ranges.
+  ab_filter_.initialize(name + "/ab_filter");
+  tfl_.reset(new tf::TransformListener);
+  // Subscribers.
+  scan_sub_ = nh.subscribe(
+      params_.scan_topic, 1, &TimeToCollisionObserver::laserScanCallback,
+      this);
+  odom_sub_ = nh.subscribe(
+      params_.odom_topic, 1, &TimeToCollisionObserver::odomCallback, this);
+  footprint_sub_ = nh.subscribe(
+      params_.footprint_topic, 1, &TimeToCollisionObserver::footprintCallback,
+      this);
+  // Initialization successful.
+  init_ = true;
+  ROS_INFO_STREAM(
+      "squirrel_navigation::safety::TimeToCollisionObserver: Initialization "
+      "successful.");
+}
+
+bool TimeToCollisionObserver::safe() const {
+  if (!params_.enabled || num_unsafe_beams_.load() == 0)
+    return true;
+  if (params_.verbose)
+    ROS_WARN_STREAM(
+        "squirrel_navigation::safety::TimeToCollisionObserver: Obstacle "
+        "within the minimum time to collision.");
+  return false;
+}
+
+void TimeToCollisionObserver::reconfigureCallback(
+    TimeToCollisionObserverConfig& config, uint32_t level) {
+  params_.enabled               = config.enabled;
+  params_.scan_topic            = config.scan_topic;
+  params_.odom_topic            = config.odom_topic;
+  params_.footprint_topic       = config.footprint_topic;
+  params_.min_time_to_collision = config.min_time_to_collision;
+  params_.min_clearance         = config.min_clearance;
+  params_.verbose               = config.verbose;
+}
+
+void TimeToCollisionObserver::laserScanCallback(
+    const sensor_msgs::LaserScan::ConstPtr& scan) {
+  ROS_INFO_STREAM_ONCE(
+      "squirrel_navigation::safety::TimeToCollisionObserver: Subscribed to "
+      "LaserScan.");
+  std::unique_lock<std::mutex> lock(mtx_);
+  // Restart the filter when the scanner changes.
+  const int nranges = scan->ranges.size();
+  if (ab_filter_.stateDimension() != nranges) {
+    ab_filter_.setStateDimension(nranges);
+    ab_filter_.reset();
+    ranges_.resize(nranges);
+    rangevelocities_.resize(nranges);
+  }
+  ab_filter_.update(
+      scan->ranges, scan->header.stamp, ranges_.data(),
+      rangevelocities_.data());
+  // Nothing to check against without footprint or sensor pose.
+  if (!updateBeams(*scan)) {
+    num_unsafe_beams_ = 0;
+    return;
+  }
+  // Velocity of the footprint boundary along each beam, from the twist of
+  // the robot, and time to collision in one pass. A beam is unsafe when
+  // clearance < min_time_to_collision * closing rate.
+  const float vx = twist_.linear.x, vy = twist_.linear.y;
+  const float wz = twist_.angular.z;
+  const float min_ttc       = params_.min_time_to_collision;
+  const float min_clearance = params_.min_clearance;
+  const float range_min     = scan->range_min;
+  const float zmax          = std::numeric_limits<float>::max();
+  const float *pz = scan->ranges.data(), *pv = rangevelocities_.data();
+  const float *pdx = beam_dx_.data(), *pdy = beam_dy_.data();
+  const float *px = boundary_x_.data(), *py = boundary_y_.data();
+  const float* pd = boundary_distances_.data();
+  int num_unsafe_beams = 0;
+#pragma omp simd reduction(+ : num_unsafe_beams)
+  for (int i = 0; i < nranges; ++i) {
+    const bool valid = std::abs(pz[i]) <= zmax && pz[i] >= range_min;
+    const float clearance = pz[i] - pd[i];
+    const float ego = (vx - wz * py[i]) * pdx[i] + (vy + wz * px[i]) * pdy[i];
+    const float closing = std::max(-pv[i], ego);
+    const bool unsafe =
+        valid &&
+        (clearance <= min_clearance || clearance < min_ttc * closing);
+    num_unsafe_beams += unsafe;
+  }
+  num_unsafe_beams_ = num_unsafe_beams;
+}
+
+void TimeToCollisionObserver::odomCallback(
+    const nav_msgs::Odometry::ConstPtr& odom) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  twist_ = odom->twist.twist;
+}
+
+void TimeToCollisionObserver::footprintCallback(
+    const geometry_msgs::PolygonStamped::ConstPtr& msg) {
+  std::vector<geometry_msgs::Point> footprint;
+  footprint.reserve(msg->polygon.points.size());
+  for (const auto& point : msg->polygon.points) {
+    geometry_msgs::Point vertex;
+    vertex.x = point.x;
+    vertex.y = point.y;
+    vertex.z = 0.;
+    footprint.emplace_back(vertex);
+  }
+  const size_t key = footprint::hash(footprint);
+  std::unique_lock<std::mutex> lock(mtx_);
+  robot_frame_id_ = msg->header.frame_id;
+  if (key == footprint_key_ && !footprint_.empty())
+    return;
+  footprint_     = footprint;
+  footprint_key_ = key;
+  beams_valid_   = false;
+}
+
+bool TimeToCollisionObserver::updateBeams(const sensor_msgs::LaserScan& scan) {
+  const int nranges = scan.ranges.size();
+  if (beams_valid_ && (int)beam_dx_.size() == nranges &&
+      scan_angle_min_ == scan.angle_min &&
+      scan_angle_increment_ == scan.angle_increment)
+    return true;
+  if (footprint_.size() < 3)
+    return false;
+  // Pose of the sensor in robot frame.
+  tf::StampedTransform transform;
+  try {
+    tfl_->lookupTransform(
+        robot_frame_id_, scan.header.frame_id, ros::Time(0), transform);
+  } catch (const tf::TransformException& e) {
+    ROS_WARN_STREAM_THROTTLE(
+        1.0, "squirrel_navigation::safety::TimeToCollisionObserver: "
+                 << e.what());
+    return false;
+  }
+  const double ox  = transform.getOrigin().x();
+  const double oy  = transform.getOrigin().y();
+  const double yaw = tf::getYaw(transform.getRotation());
+  beam_dx_.resize(nranges);
+  beam_dy_.resize(nranges);
+  boundary_x_.resize(nranges);
+  boundary_y_.resize(nranges);
+  boundary_distances_.resize(nranges);
+  for (int i = 0; i < nranges; ++i) {
+    const double angle = yaw + scan.angle_min + i * scan.angle_increment;
+    const double dx = std::cos(angle), dy = std::sin(angle);
+    const double d  = footprint::rayDistance(footprint_, ox, oy, dx, dy);
+    beam_dx_[i]            = dx;
+    beam_dy_[i]            = dy;
+    boundary_x_[i]         = ox + d * dx;
+    boundary_y_[i]         = oy + d * dy;
+    boundary_distances_[i] = d;
+  }
+  scan_angle_min_       = scan.angle_min;
+  scan_angle_increment_ = scan.angle_increment;
+  beams_valid_          = true;
+  return true;
+}
+
+TimeToCollisionObserver::Params
+TimeToCollisionObserver::Params::defaultParams() {
+  Params params;
+  params.enabled               = true;
+  params.scan_topic            = "/scan";
+  params.odom_topic            = "/odom";
+  params.footprint_topic       = "/squirrel_footprint_observer/footprint";
+  params.min_time_to_collision = 1.0;
+  params.min_clearance         = 0.05;
+  params.verbose               = false;
+  return params;
+}
+
+}  // namespace safety
+}  // namespace squirrel_navigation
@@ -35,15 +35,26 @@
 
 #include <cassert>
 #include <cmath>
+#include <limits>
 
 namespace squirrel_navigation {
 namespace utils {
 
 AlphaBetaFilter::AlphaBetaFilter()
-    : params_(Params::defaultParams()), state_(nullptr), init_(false) {}
+    : params_(Params::defaultParams()),
+      dim_(0),
+      state_(nullptr),
+      has_state_(false),
+      last_stamp_(0.),
+      init_(false) {}
 
 AlphaBetaFilter::AlphaBetaFilter(const Params& params)
-    : params_(params), state_(nullptr), init_(false) {}
+    : params_(params),
+      dim_(0),
+      state_(nullptr),
+      has_state_(false),
+      last_stamp_(0.),
+      init_(false) {}
 
 void AlphaBetaFilter::initialize(const std::string& name) {
   if (init_)
@@ -57,40 +68,65 @@ void AlphaBetaFilter::initialize(const std::string& name) {
 
 Eigen::MatrixXf AlphaBetaFilter::operator()(
     const std::vector<float>& x, const ros::Time& stamp) {
-  assert(dim_ == x.size());
-  if (!state_) {
-    state_.reset(new State(
-        stdVectorToEigenVector(x), Eigen::VectorXf::Zero(dim_), stamp.toSec()));
-  } else {
-    const double dt          = stamp.toSec() - state_->t;
-    const Eigen::VectorXf xp = state_->x + dt * state_->v;
-    const Eigen::VectorXf rc = stdVectorToEigenVector(x) - xp;
-    // Update the state.
-    state_->x = xp + params_.alpha * rc;
-    state_->v = state_->v + (params_.beta / dt) * rc;
-    state_->t = stamp.toSec();
+  if (!state_ || state_->x.size() != (int)dim_) {
+    state_.reset(
+        new State(Eigen::VectorXf::Zero(dim_), Eigen::VectorXf::Zero(dim_)));
+    has_state_ = false;
   }
+  update(x, stamp, state_->x.data(), state_->v.data());
   Eigen::MatrixXf output(dim_, 2);
   output.col(0) = state_->x;
   output.col(1) = state_->v;
   return output;
 }
 
+void AlphaBetaFilter::update(
+    const std::vector<float>& z, const ros::Time& stamp, float* x, float* v) {
+  assert(dim_ == z.size());
+  const int n      = dim_;
+  const float* pz  = z.data();
+  const float zmax = std::numeric_limits<float>::max();
+  if (!has_state_) {
+#pragma omp simd
+    for (int i = 0; i < n; ++i) {
+      x[i] = std::abs(pz[i]) <= zmax ? pz[i] : 0.f;
+      v[i] = 0.f;
+    }
+    has_state_  = true;
+    last_stamp_ = stamp.toSec();
+    return;
+  }
+  // Measurements with the same stamp carry no velocity information.
+  const double dt = stamp.toSec() - last_stamp_;
+  if (dt <= 0.)
+    return;
+  const float fdt   = dt;
+  const float alpha = params_.alpha;
+  const float beta  = params_.beta / dt;
+  // Predict, correct and update both buffers in the same pass. The range
+  // comparison is false for NaN and infinity and keeps the loop branchless.
+#pragma omp simd
+  for (int i = 0; i < n; ++i) {
+    const float zi = std::abs(pz[i]) <= zmax ? pz[i] : 0.f;
+    const float xp = x[i] + fdt * v[i];
+    const float rc = zi - xp;
+    x[i]           = xp + alpha * rc;
+    v[i] += beta * rc;
+  }
+  last_stamp_ = stamp.toSec();
+}
+
+void AlphaBetaFilter::reset() {
+  state_.reset(nullptr);
+  has_state_ = false;
+}
+
 void AlphaBetaFilter::reconfigureCallback(
     AlphaBetaFilterConfig& config, uint32_t level) {
   params_.alpha = config.alpha;
   params_.beta  = config.beta;
 }
 
-Eigen::VectorXf AlphaBetaFilter::stdVectorToEigenVector(
-    const std::vector<float>& x) const {
-  const int n = x.size();
-  Eigen::VectorXf out(n);
-  for (int i = 0; i < n; ++i)
-    out(i)   = std::isfinite(x[i]) ? x[i] : 0.0;
-  return out;
-}
-
 AlphaBetaFilter::Params AlphaBetaFilter::Params::defaultParams() {
   Params params;
   params.alpha = 0.1;
@@ -99,8 +135,8 @@ AlphaBetaFilter::Params AlphaBetaFilter::Params::defaultParams() {
 }
 
 AlphaBetaFilter::State::State(
-    const Eigen::VectorXf& x0, const Eigen::VectorXf& v0, double t0)
-    : x(x0), v(v0), t(t0) {}
+    const Eigen::VectorXf& x0, const Eigen::VectorXf& v0)
+    : x(x0), v(v0) {}
 
 }  // namespace utils
 }  // namespace squirrel_navigation
@@ -0,0 +1,147 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/utils/collision_checker.h"
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace squirrel_navigation {
+namespace footprint {
+
+void CollisionChecker::setFootprint(
+    const std::vector<geometry_msgs::Point>& footprint, double resolution,
+    int nheadings) {
+  nheadings_  = nheadings;
+  resolution_ = resolution;
+  masks_.assign(nheadings_, Mask());
+  std::vector<std::pair<int, int>> cells;
+  for (int h = 0; h < nheadings_; ++h) {
+    // Rasterize the edges of the rotated polygon with Bresenham lines.
+    const double yaw = 2. * M_PI * h / nheadings_;
+    const double c = std::cos(yaw), s = std::sin(yaw);
+    cells.clear();
+    if (footprint.size() < 3)
+      cells.emplace_back(0, 0);
+    else
+      for (unsigned int i = 0; i < footprint.size(); ++i) {
+        const auto& p = footprint[i];
+        const auto& q = footprint[(i + 1) % footprint.size()];
+        int x0 = std::floor(0.5 + (c * p.x - s * p.y) / resolution_);
+        int y0 = std::floor(0.5 + (s * p.x + c * p.y) / resolution_);
+        const int x1 = std::floor(0.5 + (c * q.x - s * q.y) / resolution_);
+        const int y1 = std::floor(0.5 + (s * q.x + c * q.y) / resolution_);
+        const int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+        const int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+        int error = dx + dy;
+        while (true) {
+          cells.emplace_back(x0, y0);
+          if (x0 == x1 && y0 == y1)
+            break;
+          const int error2 = 2 * error;
+          if (error2 >= dy) {
+            error += dy;
+            x0 += sx;
+          }
+          if (error2 <= dx) {
+            error += dx;
+            y0 += sy;
+          }
+        }
+      }
+    // Pack the cells in rows of words.
+    Mask& mask = masks_[h];
+    int max_x = cells.front().first, max_y = cells.front().second;
+    mask.min_x = max_x;
+    mask.min_y = max_y;
+    for (const auto& cell : cells) {
+      mask.min_x = std::min(mask.min_x, cell.first);
+      mask.min_y = std::min(mask.min_y, cell.second);
+      max_x      = std::max(max_x, cell.first);
+      max_y      = std::max(max_y, cell.second);
+    }
+    mask.width  = max_x - mask.min_x + 1;
+    mask.height = max_y - mask.min_y + 1;
+    mask.words  = (mask.width + 63) / 64;
+    mask.bits.assign(mask.height * mask.words, 0);
+    for (const auto& cell : cells) {
+      const int x = cell.first - mask.min_x, y = cell.second - mask.min_y;
+      mask.bits[y * mask.words + (x >> 6)] |= uint64_t(1) << (x & 63);
+    }
+  }
+}
+
+void CollisionChecker::updateCosts(
+    const unsigned char* costs, int size_x, int size_y) {
+  size_x_        = size_x;
+  size_y_        = size_y;
+  words_per_row_ = (size_x_ + 63) / 64 + 1;
+  bitmap_.assign(size_y_ * words_per_row_, 0);
+  for (int y = 0; y < size_y_; ++y) {
+    const unsigned char* row = costs + y * size_x_;
+    uint64_t* bits           = bitmap_.data() + y * words_per_row_;
+    for (int x = 0; x < size_x_; ++x) {
+      const bool lethal = row[x] == costmap_2d::LETHAL_OBSTACLE ||
+                          row[x] == costmap_2d::NO_INFORMATION;
+      bits[x >> 6] |= uint64_t(lethal) << (x & 63);
+    }
+  }
+}
+
+bool CollisionChecker::collides(int cell_x, int cell_y, double yaw) const {
+  if (masks_.empty())
+    return false;
+  int h = std::lround(yaw * nheadings_ / (2. * M_PI)) % nheadings_;
+  if (h < 0)
+    h += nheadings_;
+  const Mask& mask = masks_[h];
+  const int x0 = cell_x + mask.min_x, y0 = cell_y + mask.min_y;
+  // A footprint leaving the map is not safe.
+  if (x0 < 0 || y0 < 0 || x0 + mask.width > size_x_ ||
+      y0 + mask.height > size_y_)
+    return true;
+  uint64_t hits = 0;
+  for (int y = 0; y < mask.height; ++y) {
+    const uint64_t* row  = bitmap_.data() + (y0 + y) * words_per_row_;
+    const uint64_t* bits = mask.bits.data() + y * mask.words;
+    for (int w = 0; w < mask.words; ++w)
+      hits |= bitmapWord(row, x0 + 64 * w) & bits[w];
+  }
+  return hits != 0;
+}
+
+}  // namespace footprint
+}  // namespace squirrel_navigation
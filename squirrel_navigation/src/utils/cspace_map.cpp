@@ -0,0 +1,220 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/utils/cspace_map.h"
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+constexpr int CSpaceMap::kMaxHeadings;
+
+namespace {
+
+// Whether the point is inside the polygon or closer than margin to its
+// outline.
+bool covers(
+    const std::vector<geometry_msgs::Point>& polygon, double x, double y,
+    double margin) {
+  const int npoints = polygon.size();
+  bool inside       = false;
+  for (int i = 0, j = npoints - 1; i < npoints; j = i++) {
+    const geometry_msgs::Point& a = polygon[i];
+    const geometry_msgs::Point& b = polygon[j];
+    if ((a.y > y) != (b.y > y) &&
+        x < (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x)
+      inside = !inside;
+    // Distance to the edge.
+    const double ex = b.x - a.x, ey = b.y - a.y;
+    const double length2 = ex * ex + ey * ey;
+    const double t =
+        length2 > 0.
+            ? std::min(
+                  1., std::max(0., ((x - a.x) * ex + (y - a.y) * ey) / length2))
+            : 0.;
+    if (std::hypot(a.x + t * ex - x, a.y + t * ey - y) <= margin)
+      return true;
+  }
+  return inside;
+}
+
+}  // namespace
+
+void CSpaceMap::setFootprint(
+    const std::vector<geometry_msgs::Point>& footprint, double resolution,
+    int nheadings) {
+  nheadings_ = std::min(std::max(nheadings, 1), kMaxHeadings);
+  all_ = nheadings_ == 32 ? ~0u : (1u << nheadings_) - 1u;
+  common_.clear();
+  kernels_.assign(nheadings_, {});
+  double max_distance = 0.;
+  for (const auto& point : footprint)
+    max_distance = std::max(max_distance, std::hypot(point.x, point.y));
+  radius_ = std::ceil(max_distance / resolution) + 1;
+  if (footprint.size() < 3)
+    return;
+  // Headings covering each cell of the window of the footprint.
+  const int width = 2 * radius_ + 1;
+  std::vector<uint32_t> covered(width * width, 0);
+  std::vector<geometry_msgs::Point> rotated(footprint.size());
+  for (int k = 0; k < nheadings_; ++k) {
+    const double c = std::cos(heading(k)), s = std::sin(heading(k));
+    for (unsigned int i = 0; i < footprint.size(); ++i) {
+      rotated[i].x = c * footprint[i].x - s * footprint[i].y;
+      rotated[i].y = s * footprint[i].x + c * footprint[i].y;
+    }
+    // A cell is covered if the outline passes through its center's
+    // neighborhood, so thin parts of the footprint are not missed.
+    for (int dy = -radius_; dy <= radius_; ++dy)
+      for (int dx = -radius_; dx <= radius_; ++dx)
+        if (covers(rotated, dx * resolution, dy * resolution, 0.5 * resolution))
+          covered[(dy + radius_) * width + dx + radius_] |= 1u << k;
+  }
+  for (int dy = -radius_; dy <= radius_; ++dy)
+    for (int dx = -radius_; dx <= radius_; ++dx) {
+      const uint32_t bits = covered[(dy + radius_) * width + dx + radius_];
+      if (bits == all_) {
+        common_.push_back({dx, dy});
+        continue;
+      }
+      for (int k = 0; k < nheadings_; ++k)
+        if ((bits >> k) & 1u)
+          kernels_[k].push_back({dx, dy});
+    }
+}
+
+void CSpaceMap::resize(int size_x, int size_y) {
+  size_x_ = size_x;
+  size_y_ = size_y;
+  masks_.assign(size_x * size_y, 0);
+}
+
+void CSpaceMap::update(
+    const unsigned char* costs, int min_i, int min_j, int max_i, int max_j) {
+  min_i = std::max(min_i, 0);
+  min_j = std::max(min_j, 0);
+  max_i = std::min(max_i, size_x_);
+  max_j = std::min(max_j, size_y_);
+  if (nheadings_ == 0 || min_i >= max_i || min_j >= max_j)
+    return;
+  for (int j = min_j; j < max_j; ++j)
+    std::fill_n(masks_.begin() + j * size_x_ + min_i, max_i - min_i, 0);
+  // Obstacles whose footprint reaches into the window.
+  const int x0 = std::max(min_i - radius_, 0);
+  const int y0 = std::max(min_j - radius_, 0);
+  const int x1 = std::min(max_i + radius_, size_x_);
+  const int y1 = std::min(max_j + radius_, size_y_);
+  for (int oy = y0; oy < y1; ++oy) {
+    const unsigned char* row = costs + oy * size_x_;
+    for (int ox = x0; ox < x1; ++ox) {
+      if (row[ox] != costmap_2d::LETHAL_OBSTACLE)
+        continue;
+      stamp(common_, all_, ox, oy, min_i, min_j, max_i, max_j);
+      for (int k = 0; k < nheadings_; ++k)
+        stamp(kernels_[k], 1u << k, ox, oy, min_i, min_j, max_i, max_j);
+    }
+  }
+}
+
+void CSpaceMap::stamp(
+    const std::vector<Offset>& kernel, uint32_t bits, int ox, int oy,
+    int min_i, int min_j, int max_i, int max_j) {
+  // The footprint centered on (ox - dx, oy - dy) covers the obstacle.
+  for (const Offset& offset : kernel) {
+    const int x = ox - offset.dx, y = oy - offset.dy;
+    if (x >= min_i && x < max_i && y >= min_j && y < max_j)
+      masks_[y * size_x_ + x] |= bits;
+  }
+}
+
+int CSpaceMap::headingIndex(double yaw) const {
+  if (nheadings_ == 0)
+    return 0;
+  const double step = 2. * M_PI / nheadings_;
+  const int index   = std::lround(yaw / step) % nheadings_;
+  return index < 0 ? index + nheadings_ : index;
+}
+
+double CSpaceMap::heading(int index) const {
+  return nheadings_ > 0 ? 2. * M_PI * index / nheadings_ : 0.;
+}
+
+bool CSpaceMap::assignHeadings(
+    const std::vector<int>& cells, const std::vector<double>& yaws,
+    int start_heading, int goal_heading, std::vector<int>* headings) const {
+  headings->clear();
+  const int ncells = cells.size();
+  const int k      = nheadings_;
+  if (ncells == 0 || k == 0 || yaws.size() != cells.size())
+    return false;
+  // Dynamic programming over the cells, a step of heading costs as much as
+  // a quarter step of deviation from the preferred yaw.
+  const int kInfinity = std::numeric_limits<int>::max();
+  const double step   = 2. * M_PI / k;
+  std::vector<int> costs(ncells * k, kInfinity), parents(ncells * k, -1);
+  costs[start_heading] = 0;
+  for (int i = 1; i < ncells; ++i)
+    for (int h = 0; h < k; ++h) {
+      if (isBlocked(cells[i], h))
+        continue;
+      const int deviation = std::lround(
+          4. * std::abs(std::remainder(heading(h) - yaws[i], 2. * M_PI)) /
+          step);
+      int& cost = costs[i * k + h];
+      for (int dh = -1; dh <= 1; ++dh) {
+        const int parent = (h + dh + k) % k;
+        const int prev   = costs[(i - 1) * k + parent];
+        if (prev == kInfinity || prev + deviation + (dh != 0) >= cost)
+          continue;
+        cost               = prev + deviation + (dh != 0);
+        parents[i * k + h] = parent;
+      }
+    }
+  if (costs[(ncells - 1) * k + goal_heading] == kInfinity)
+    return false;
+  headings->resize(ncells);
+  int h = goal_heading;
+  for (int i = ncells - 1; i >= 0; --i) {
+    (*headings)[i] = h;
+    h              = parents[i * k + h];
+  }
+  return true;
+}
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
@@ -0,0 +1,117 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/utils/distance_field.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+constexpr int DistanceField::kUnreachable;
+
+void DistanceField::compute(
+    const unsigned char* costs, int size_x, int size_y, double resolution,
+    int goal, unsigned char obstacle_cost, unsigned int version) {
+  size_x_  = size_x;
+  size_y_  = size_y;
+  goal_    = goal;
+  version_ = version;
+  costs_.assign(size_x * size_y, kUnreachable);
+  if (goal < 0 || goal >= size_x * size_y || costs[goal] >= obstacle_cost)
+    return;
+  // Step lengths in mm.
+  const int straight = std::lround(1000. * resolution);
+  const int diagonal = std::lround(1000. * resolution * std::sqrt(2.));
+  typedef std::pair<int, int> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+  costs_[goal] = 0;
+  open.emplace(0, goal);
+  while (!open.empty()) {
+    const int g = open.top().first, index = open.top().second;
+    open.pop();
+    if (g > costs_[index])
+      continue;
+    const int x = index % size_x, y = index / size_x;
+    for (int dy = -1; dy <= 1; ++dy)
+      for (int dx = -1; dx <= 1; ++dx) {
+        const int nx = x + dx, ny = y + dy;
+        if ((!dx && !dy) || nx < 0 || ny < 0 || nx >= size_x || ny >= size_y)
+          continue;
+        const int n = ny * size_x + nx;
+        int cost    = std::max(costs[index], costs[n]);
+        // Diagonal steps also touch the two side cells.
+        if (dx && dy)
+          cost = std::max(
+              cost, std::max<int>(
+                        costs[y * size_x + nx], costs[ny * size_x + x]));
+        if (cost >= obstacle_cost)
+          continue;
+        const int ng = g + (cost + 1) * (dx && dy ? diagonal : straight);
+        if (ng < costs_[n]) {
+          costs_[n] = ng;
+          open.emplace(ng, n);
+        }
+      }
+  }
+}
+
+bool DistanceField::descend(int start, std::vector<int>* cells) const {
+  cells->clear();
+  if (start < 0 || start >= size_x_ * size_y_ || costs_[start] == kUnreachable)
+    return false;
+  int index = start;
+  cells->push_back(index);
+  while (index != goal_) {
+    const int x = index % size_x_, y = index / size_x_;
+    int next = index;
+    for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, size_y_ - 1); ++ny)
+      for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, size_x_ - 1);
+           ++nx)
+        if (costs_[ny * size_x_ + nx] < costs_[next])
+          next = ny * size_x_ + nx;
+    // The costs strictly decrease towards the goal.
+    if (next == index)
+      return false;
+    index = next;
+    cells->push_back(index);
+  }
+  return true;
+}
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
@@ -0,0 +1,150 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/utils/obstacle_index.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace squirrel_navigation {
+namespace costmap {
+
+namespace {
+
+const int kMaxSqDist = std::numeric_limits<int>::max();
+
+}  // namespace
+
+void ObstacleIndex::resize(int size_x, int size_y) {
+  size_x_ = size_x;
+  size_y_ = size_y;
+  cells_.assign(size_x * size_y, Cell{-1, kMaxSqDist, false, false});
+  occupancy_.assign(size_x * size_y, 0);
+  slots_.assign(size_x * size_y, -1);
+  obstacles_.clear();
+  open_ = decltype(open_)();
+}
+
+void ObstacleIndex::setObstacle(int index) {
+  if (occupancy_[index])
+    return;
+  occupancy_[index] = 1;
+  slots_[index]     = obstacles_.size();
+  obstacles_.push_back(index);
+  Cell& cell    = cells_[index];
+  cell.obstacle = index;
+  cell.sqdist   = 0;
+  cell.raise    = false;
+  push(0, index);
+}
+
+void ObstacleIndex::removeObstacle(int index) {
+  if (!occupancy_[index])
+    return;
+  occupancy_[index]            = 0;
+  obstacles_[slots_[index]]    = obstacles_.back();
+  slots_[obstacles_.back()]    = slots_[index];
+  obstacles_.pop_back();
+  slots_[index]                = -1;
+  Cell& cell    = cells_[index];
+  cell.obstacle = -1;
+  cell.sqdist   = kMaxSqDist;
+  cell.raise    = true;
+  push(0, index);
+}
+
+void ObstacleIndex::update() {
+  while (!open_.empty()) {
+    const int index = open_.top().second;
+    open_.pop();
+    Cell& cell = cells_[index];
+    // Processed already with a lower priority.
+    if (!cell.queued)
+      continue;
+    cell.queued = false;
+    if (cell.raise)
+      raise(index);
+    else if (cell.obstacle >= 0 && occupancy_[cell.obstacle])
+      lower(index);
+  }
+}
+
+void ObstacleIndex::raise(int index) {
+  const int x = index % size_x_, y = index / size_x_;
+  for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, size_y_ - 1); ++ny)
+    for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, size_x_ - 1);
+         ++nx) {
+      const int n        = ny * size_x_ + nx;
+      Cell& neighbor     = cells_[n];
+      if (n == index || neighbor.obstacle < 0 || neighbor.raise)
+        continue;
+      // The neighbor lost its obstacle, it has to be raised as well.
+      if (!occupancy_[neighbor.obstacle]) {
+        push(neighbor.sqdist, n);
+        neighbor.raise    = true;
+        neighbor.obstacle = -1;
+        neighbor.sqdist   = kMaxSqDist;
+      } else if (!neighbor.queued) {
+        push(neighbor.sqdist, n);
+      }
+    }
+  cells_[index].raise = false;
+}
+
+void ObstacleIndex::lower(int index) {
+  const int x = index % size_x_, y = index / size_x_;
+  const int obstacle = cells_[index].obstacle;
+  const int ox = obstacle % size_x_, oy = obstacle / size_x_;
+  for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, size_y_ - 1); ++ny)
+    for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, size_x_ - 1);
+         ++nx) {
+      const int n    = ny * size_x_ + nx;
+      Cell& neighbor = cells_[n];
+      if (n == index || neighbor.raise)
+        continue;
+      const int sqdist = (nx - ox) * (nx - ox) + (ny - oy) * (ny - oy);
+      // Ties overwrite neighbors whose obstacle was removed.
+      const bool overwrite =
+          sqdist < neighbor.sqdist ||
+          (sqdist == neighbor.sqdist &&
+           (neighbor.obstacle < 0 || !occupancy_[neighbor.obstacle]));
+      if (overwrite) {
+        neighbor.obstacle = obstacle;
+        neighbor.sqdist   = sqdist;
+        push(sqdist, n);
+      }
+    }
+}
+
+}  // namespace costmap
+}  // namespace squirrel_navigation
@@ -0,0 +1,110 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/utils/trajectory.h"
+
+#include <tf/tf.h>
+
+#include <cmath>
+#include <initializer_list>
+
+namespace squirrel_navigation {
+namespace utils {
+
+void Trajectory::reserve(unsigned int capacity) {
+  if (capacity <= x_.size())
+    return;
+  unsigned int new_capacity = 16;
+  while (new_capacity < capacity)
+    new_capacity *= 2;
+  // Unroll the ring while moving to the larger buffers.
+  const unsigned int mask = x_.size() - 1;
+  for (std::vector<double>* column :
+       {&x_, &y_, &yaw_, &t_, &s_, &vx_, &vy_, &wz_}) {
+    std::vector<double> buffer(new_capacity);
+    for (unsigned int i = 0; i < size_; ++i)
+      buffer[i] = (*column)[(head_ + i) & mask];
+    column->swap(buffer);
+  }
+  head_ = 0;
+}
+
+void Trajectory::pushBack(double x, double y, double yaw, double t) {
+  if (size_ == x_.size())
+    reserve(size_ + 1);
+  const double s =
+      size_ > 0 ? this->s(size_ - 1) +
+                      std::hypot(x - this->x(size_ - 1), y - this->y(size_ - 1))
+                : 0.;
+  const unsigned int i = slot(size_++);
+  x_[i]                = x;
+  y_[i]                = y;
+  yaw_[i]              = yaw;
+  t_[i]                = t;
+  s_[i]                = s;
+  vx_[i] = vy_[i] = wz_[i] = 0.;
+}
+
+void Trajectory::pushBack(const geometry_msgs::Pose& pose, double t) {
+  pushBack(pose.position.x, pose.position.y, tf::getYaw(pose.orientation), t);
+}
+
+void Trajectory::updateLengths(unsigned int begin) {
+  for (unsigned int i = std::max(begin, 1u); i < size_; ++i)
+    s_[slot(i)] = s(i - 1) + std::hypot(x(i) - x(i - 1), y(i) - y(i - 1));
+}
+
+geometry_msgs::Pose Trajectory::pose(unsigned int i) const {
+  geometry_msgs::Pose pose;
+  pose.position.x  = x(i);
+  pose.position.y  = y(i);
+  pose.orientation = tf::createQuaternionMsgFromYaw(yaw(i));
+  return pose;
+}
+
+unsigned int Trajectory::upperBound(double t) const {
+  unsigned int first = 0, count = size_;
+  while (count > 0) {
+    const unsigned int step = count / 2;
+    if (this->t(first + step) <= t) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+}  // namespace utils
+}  // namespace squirrel_navigation
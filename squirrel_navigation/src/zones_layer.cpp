@@ -0,0 +1,262 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in
+//   the documentation and/or other materials provided with the
+//   distribution.
+//
+// * Neither the name of the University of Freiburg nor the names of
+//   its contributors may be used to endorse or promote products
+//   derived from this software without specific prior written
+//   permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+// FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+// COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+// STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+// OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_navigation/zones_layer.h"
+#include "squirrel_navigation/utils/costmap_utils.h"
+
+#include <ros/console.h>
+
+#include <costmap_2d/cost_values.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_navigation {
+
+bool ZonesLayer::Zone::operator==(const Zone& other) const {
+  if (type != other.type || speed_scale != other.speed_scale ||
+      polygon.size() != other.polygon.size())
+    return false;
+  for (unsigned int i = 0; i < polygon.size(); ++i)
+    if (polygon[i].x != other.polygon[i].x ||
+        polygon[i].y != other.polygon[i].y)
+      return false;
+  return true;
+}
+
+ZonesLayer::ZonesLayer() : enabled_(false) {}
+
+void ZonesLayer::initialize(const std::string& name) {
+  name_ = name;
+  ros::NodeHandle pnh("~/" + name_);
+  pending_zones_.reset(new Zones);
+  loadZones(pnh, pending_zones_.get());
+  reload_srv_ = pnh.advertiseService(
+      "reloadZones", &ZonesLayer::reloadZonesCallback, this);
+  default_value_ = costmap_2d::FREE_SPACE;
+}
+
+void ZonesLayer::updateBounds(
+    const costmap_2d::Costmap2D& master_grid, double* min_x, double* min_y,
+    double* max_x, double* max_y) {
+  std::unique_ptr<Zones> zones;
+  {
+    std::unique_lock<std::mutex> lock(pending_mtx_);
+    zones.swap(pending_zones_);
+  }
+  // A moved grid is rasterized from scratch.
+  const bool aligned = size_x_ == master_grid.getSizeInCellsX() &&
+                       size_y_ == master_grid.getSizeInCellsY() &&
+                       resolution_ == master_grid.getResolution() &&
+                       origin_x_ == master_grid.getOriginX() &&
+                       origin_y_ == master_grid.getOriginY();
+  if (!aligned) {
+    resizeMap(
+        master_grid.getSizeInCellsX(), master_grid.getSizeInCellsY(),
+        master_grid.getResolution(), master_grid.getOriginX(),
+        master_grid.getOriginY());
+    speed_.assign(size_x_ * size_y_, 255);
+  }
+  // Boxes of the zones removed, added or changed, before and after.
+  std::vector<Box> boxes;
+  if (zones) {
+    for (const auto& zone : zones_) {
+      const auto it = zones->find(zone.first);
+      if (it == zones->end() || it->second != zone.second)
+        boxes.emplace_back(boundingBox(zone.second));
+    }
+    for (const auto& zone : *zones) {
+      const auto it = zones_.find(zone.first);
+      if (it == zones_.end() || it->second != zone.second)
+        boxes.emplace_back(boundingBox(zone.second));
+    }
+    zones_.swap(*zones);
+  }
+  if (!aligned)
+    boxes.assign(1, Box{0, 0, (int)size_x_, (int)size_y_});
+  for (const auto& box : boxes) {
+    if (box.x1 <= box.x0 || box.y1 <= box.y0)
+      continue;
+    render(box);
+    *min_x = std::min(*min_x, origin_x_ + box.x0 * resolution_);
+    *min_y = std::min(*min_y, origin_y_ + box.y0 * resolution_);
+    *max_x = std::max(*max_x, origin_x_ + box.x1 * resolution_);
+    *max_y = std::max(*max_y, origin_y_ + box.y1 * resolution_);
+  }
+}
+
+bool ZonesLayer::loadZones(const ros::NodeHandle& pnh, Zones* zones) const {
+  zones->clear();
+  XmlRpc::XmlRpcValue value;
+  if (!pnh.getParam("zones", value))
+    return true;
+  if (value.getType() != XmlRpc::XmlRpcValue::TypeArray) {
+    ROS_WARN_STREAM(
+        "squirrel_navigation/ZonesLayer: " << pnh.getNamespace()
+                                           << "/zones is not a list.");
+    return false;
+  }
+  for (int i = 0; i < value.size(); ++i) {
+    std::string id;
+    Zone zone;
+    if (!parseZone(value[i], &id, &zone))
+      ROS_WARN_STREAM(
+          "squirrel_navigation/ZonesLayer: Skipping the malformed zone "
+          << i << ".");
+    else if (!zones->emplace(id, zone).second)
+      ROS_WARN_STREAM(
+          "squirrel_navigation/ZonesLayer: Skipping the duplicate zone '"
+          << id << "'.");
+  }
+  return true;
+}
+
+bool ZonesLayer::parseZone(
+    XmlRpc::XmlRpcValue& value, std::string* id, Zone* zone) const {
+  // Numbers may be written as integers.
+  auto to_double = [](XmlRpc::XmlRpcValue& number, double* out) {
+    if (number.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+      *out = static_cast<double>(number);
+    else if (number.getType() == XmlRpc::XmlRpcValue::TypeInt)
+      *out = static_cast<int>(number);
+    else
+      return false;
+    return true;
+  };
+  if (value.getType() != XmlRpc::XmlRpcValue::TypeStruct ||
+      !value.hasMember("id") || !value.hasMember("type") ||
+      !value.hasMember("polygon") ||
+      value["id"].getType() != XmlRpc::XmlRpcValue::TypeString ||
+      value["type"].getType() != XmlRpc::XmlRpcValue::TypeString)
+    return false;
+  *id                    = static_cast<std::string&>(value["id"]);
+  const std::string type = static_cast<std::string&>(value["type"]);
+  if (type == "keep_out") {
+    zone->type        = Zone::KEEP_OUT;
+    zone->speed_scale = 0.;
+  } else if (type == "speed_limit") {
+    zone->type = Zone::SPEED_LIMIT;
+    if (!value.hasMember("speed_scale") ||
+        !to_double(value["speed_scale"], &zone->speed_scale) ||
+        zone->speed_scale <= 0. || zone->speed_scale > 1.)
+      return false;
+  } else {
+    return false;
+  }
+  XmlRpc::XmlRpcValue& polygon = value["polygon"];
+  if (polygon.getType() != XmlRpc::XmlRpcValue::TypeArray ||
+      polygon.size() < 3)
+    return false;
+  zone->polygon.resize(polygon.size());
+  for (int i = 0; i < polygon.size(); ++i) {
+    XmlRpc::XmlRpcValue& vertex = polygon[i];
+    if (vertex.getType() != XmlRpc::XmlRpcValue::TypeArray ||
+        vertex.size() != 2 || !to_double(vertex[0], &zone->polygon[i].x) ||
+        !to_double(vertex[1], &zone->polygon[i].y))
+      return false;
+    zone->polygon[i].z = 0.;
+  }
+  return true;
+}
+
+bool ZonesLayer::reloadZonesCallback(
+    std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res) {
+  std::unique_ptr<Zones> zones(new Zones);
+  res.success = loadZones(ros::NodeHandle("~/" + name_), zones.get());
+  res.message = std::to_string(zones->size()) + " zones loaded.";
+  if (res.success) {
+    // Rasterized by the next update.
+    std::unique_lock<std::mutex> lock(pending_mtx_);
+    pending_zones_.swap(zones);
+  }
+  return true;
+}
+
+ZonesLayer::Box ZonesLayer::boundingBox(const Zone& zone) const {
+  if (zone.polygon.empty() || resolution_ <= 0.)
+    return Box{0, 0, 0, 0};
+  double min_x = zone.polygon.front().x, max_x = min_x;
+  double min_y = zone.polygon.front().y, max_y = min_y;
+  for (const auto& point : zone.polygon) {
+    min_x = std::min(min_x, point.x);
+    max_x = std::max(max_x, point.x);
+    min_y = std::min(min_y, point.y);
+    max_y = std::max(max_y, point.y);
+  }
+  auto cell = [this](double w, double origin, int offset, int size) {
+    const int c = std::floor((w - origin) / resolution_) + offset;
+    return std::min(std::max(c, 0), size);
+  };
+  return Box{cell(min_x, origin_x_, 0, size_x_),
+             cell(min_y, origin_y_, 0, size_y_),
+             cell(max_x, origin_x_, 1, size_x_),
+             cell(max_y, origin_y_, 1, size_y_)};
+}
+
+void ZonesLayer::render(const Box& box) {
+  const int width = box.x1 - box.x0, height = box.y1 - box.y0;
+  for (int j = box.y0; j < box.y1; ++j) {
+    std::fill_n(costmap_ + j * size_x_ + box.x0, width, costmap_2d::FREE_SPACE);
+    std::fill_n(speed_.begin() + j * size_x_ + box.x0, width, 255);
+  }
+  // Overlapping zones: keep-out wins, the lowest speed limit applies.
+  for (const auto& entry : zones_) {
+    const Zone& zone = entry.second;
+    const Box bounds = boundingBox(zone);
+    if (bounds.x1 <= box.x0 || bounds.x0 >= box.x1 || bounds.y1 <= box.y0 ||
+        bounds.y0 >= box.y1)
+      continue;
+    // Vertices in cells of the box.
+    const int nvertices = zone.polygon.size();
+    xs_.resize(nvertices);
+    ys_.resize(nvertices);
+    for (int k = 0; k < nvertices; ++k) {
+      xs_[k] = (zone.polygon[k].x - origin_x_) / resolution_ - box.x0;
+      ys_[k] = (zone.polygon[k].y - origin_y_) / resolution_ - box.y0;
+    }
+    const unsigned char speed = std::lround(255. * zone.speed_scale);
+    costmap::forEachPolygonSpan(
+        xs_, ys_, width, height, [&](int j, int min_i, int max_i) {
+          const int offset = (box.y0 + j) * size_x_ + box.x0;
+          if (zone.type == Zone::KEEP_OUT)
+            std::fill(
+                costmap_ + offset + min_i, costmap_ + offset + max_i,
+                costmap_2d::LETHAL_OBSTACLE);
+          else
+            for (int i = min_i; i < max_i; ++i)
+              speed_[offset + i] = std::min(speed_[offset + i], speed);
+        });
+  }
+}
+
+}  // namespace squirrel_navigation
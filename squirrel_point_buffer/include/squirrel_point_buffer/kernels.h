@@ -0,0 +1,80 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_POINT_BUFFER_KERNELS_H_
+#define SQUIRREL_POINT_BUFFER_KERNELS_H_
+
+#include "squirrel_point_buffer/point_buffer.h"
+
+#include <Eigen/Geometry>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace squirrel_point_buffer {
+
+// Kernels on the arrays of the buffers. The loops run over the coordinates
+// without branches, so that the compiler vectorizes them.
+
+// Rigid transformation of the points, in place or into another buffer with
+// the same channels.
+void transform(const Eigen::Affine3f& transform, PointBuffer* points);
+void transform(
+    const Eigen::Affine3f& transform, const PointBuffer& points_in,
+    PointBuffer* points_out);
+
+// Keep the points within [min, max] on every axis, or on one of them, bounds
+// included. Non finite points are removed as well. Returns the points kept.
+size_t crop(
+    const Eigen::Vector3f& min, const Eigen::Vector3f& max,
+    PointBuffer* points);
+size_t cropAxis(int axis, float min, float max, PointBuffer* points);
+
+// Voxel downsampling, the points of a voxel are replaced by their centroid
+// and the channels by their mean, as pcl::VoxelGrid does. The keys have 21
+// bits per axis and wrap around, so there is no limit on the extent of the
+// cloud. The buffers keep their capacity across the frames.
+class VoxelGrid {
+ public:
+  VoxelGrid() : inv_leaf_size_(Eigen::Vector3f::Constant(20.f)) {}
+
+  void setLeafSize(float x, float y, float z);
+
+  // points_out may not be points_in. Its channels are replaced by exactly
+  // the ones of points_in, in the same order.
+  void filter(const PointBuffer& points_in, PointBuffer* points_out);
+
+ private:
+  Eigen::Vector3f inv_leaf_size_;
+  std::vector<std::pair<uint64_t, uint32_t>> keys_;
+};
+
+}  // namespace squirrel_point_buffer
+
+#endif /* SQUIRREL_POINT_BUFFER_KERNELS_H_ */
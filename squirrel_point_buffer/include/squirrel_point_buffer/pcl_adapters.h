@@ -0,0 +1,50 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_POINT_BUFFER_PCL_ADAPTERS_H_
+#define SQUIRREL_POINT_BUFFER_PCL_ADAPTERS_H_
+
+#include "squirrel_point_buffer/point_buffer.h"
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+namespace squirrel_point_buffer {
+
+// Conversions for the code that still uses PCL, e.g. the segmentation or the
+// octomap insertion. Only the coordinates are converted.
+
+// The cloud is unorganized and dense, its header is left untouched.
+void toPCL(const PointBuffer& points, pcl::PointCloud<pcl::PointXYZ>* cloud);
+
+// Non finite points are skipped.
+void fromPCL(const pcl::PointCloud<pcl::PointXYZ>& cloud, PointBuffer* points);
+
+}  // namespace squirrel_point_buffer
+
+#endif /* SQUIRREL_POINT_BUFFER_PCL_ADAPTERS_H_ */
@@ -0,0 +1,151 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_POINT_BUFFER_POINT_BUFFER_H_
+#define SQUIRREL_POINT_BUFFER_POINT_BUFFER_H_
+
+#include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Header.h>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace squirrel_point_buffer {
+
+// Coordinates and channels are stored aligned, so that the kernels can be
+// vectorized.
+typedef std::vector<float, Eigen::aligned_allocator<float>> FloatArray;
+
+// Layout of the float fields of a cloud, read in place from the buffer of
+// the message, which has to outlive the view.
+class PointCloud2View {
+ public:
+  explicit PointCloud2View(const sensor_msgs::PointCloud2& msg);
+
+  // False if the cloud has no float x, y, z fields or it is big endian.
+  bool valid() const { return valid_; }
+
+  size_t height() const { return height_; }
+  size_t width() const { return width_; }
+  size_t size() const { return height_ * width_; }
+
+  // Offset of a float field in a point, -1 if there is none.
+  int fieldOffset(const std::string& name) const;
+
+  // First byte of the point of a row and a column.
+  inline const uint8_t* point(size_t row, size_t col) const {
+    return data_ + row * row_step_ + col * point_step_;
+  }
+  inline int offset(int axis) const { return offsets_[axis]; }
+
+  // Float at an offset of a point, unaligned.
+  static inline float read(const uint8_t* point, int offset) {
+    float value;
+    std::memcpy(&value, point + offset, sizeof(float));
+    return value;
+  }
+
+ private:
+  const sensor_msgs::PointCloud2& msg_;
+  const uint8_t* data_;
+  size_t height_, width_, point_step_, row_step_;
+  int offsets_[3];
+  bool valid_;
+};
+
+// Structure of arrays cloud: x, y and z are contiguous arrays, plus optional
+// named channels (e.g. intensity) with one value per point.
+class PointBuffer {
+ public:
+  PointBuffer() {}
+
+  size_t size() const { return x_.size(); }
+  bool empty() const { return x_.empty(); }
+  // The channels are kept, empty.
+  void clear();
+  // Remove the points and the channels.
+  void reset();
+  void reserve(size_t n);
+  // New points are zero, as their channels.
+  void resize(size_t n);
+  void swap(PointBuffer& other);
+
+  // The channels of the point are zero.
+  void push_back(float x, float y, float z);
+
+  float* x() { return x_.data(); }
+  float* y() { return y_.data(); }
+  float* z() { return z_.data(); }
+  const float* x() const { return x_.data(); }
+  const float* y() const { return y_.data(); }
+  const float* z() const { return z_.data(); }
+  // Coordinate array of an axis, 0 to 2.
+  float* axis(int a) { return a == 0 ? x() : (a == 1 ? y() : z()); }
+  const float* axis(int a) const { return a == 0 ? x() : (a == 1 ? y() : z()); }
+
+  // Add a channel, zero for the current points, or get the index of the one
+  // with the same name.
+  int addChannel(const std::string& name);
+  // Index of a channel, -1 if there is none.
+  int channelIndex(const std::string& name) const;
+  int numChannels() const { return static_cast<int>(channels_.size()); }
+  const std::string& channelName(int c) const { return channel_names_[c]; }
+  float* channel(int c) { return channels_[c].data(); }
+  const float* channel(int c) const { return channels_[c].data(); }
+
+  // Copy the points of a cloud, skipping the ones with non finite
+  // coordinates, with the float channels requested that the cloud has. This
+  // is the only copy of the points on ingest. False if the view is invalid.
+  bool assign(
+      const PointCloud2View& view,
+      const std::vector<std::string>& channels = std::vector<std::string>());
+
+  // Keep the points whose flag is set, in order. Returns the points kept.
+  size_t compact(const std::vector<uint8_t>& keep);
+
+ private:
+  FloatArray x_, y_, z_;
+  std::vector<std::string> channel_names_;
+  std::vector<FloatArray> channels_;
+};
+
+// Write the points, and their channels, as an unorganized cloud of packed
+// float fields.
+void toPointCloud2(
+    const PointBuffer& points, const std_msgs::Header& header,
+    sensor_msgs::PointCloud2* msg);
+
+}  // namespace squirrel_point_buffer
+
+#endif /* SQUIRREL_POINT_BUFFER_POINT_BUFFER_H_ */
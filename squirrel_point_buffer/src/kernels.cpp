@@ -0,0 +1,153 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_point_buffer/kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_point_buffer {
+
+namespace {
+
+void transformArrays(
+    const Eigen::Affine3f& transform, size_t n, const float* __restrict x_in,
+    const float* __restrict y_in, const float* __restrict z_in,
+    float* __restrict x_out, float* __restrict y_out,
+    float* __restrict z_out) {
+  const Eigen::Matrix3f r = transform.linear();
+  const Eigen::Vector3f t = transform.translation();
+  for (size_t i = 0; i < n; ++i) {
+    const float x = x_in[i], y = y_in[i], z = z_in[i];
+    x_out[i]      = r(0, 0) * x + r(0, 1) * y + r(0, 2) * z + t(0);
+    y_out[i]      = r(1, 0) * x + r(1, 1) * y + r(1, 2) * z + t(1);
+    z_out[i]      = r(2, 0) * x + r(2, 1) * y + r(2, 2) * z + t(2);
+  }
+}
+
+// 21 bits per axis, the cell indices wrap around.
+inline uint64_t voxelKey(float x, float y, float z) {
+  const uint64_t mask = (uint64_t(1) << 21) - 1;
+  return ((static_cast<uint64_t>(static_cast<int64_t>(std::floor(x))) & mask)
+          << 42) |
+         ((static_cast<uint64_t>(static_cast<int64_t>(std::floor(y))) & mask)
+          << 21) |
+         (static_cast<uint64_t>(static_cast<int64_t>(std::floor(z))) & mask);
+}
+
+}  // namespace
+
+void transform(const Eigen::Affine3f& transform, PointBuffer* points) {
+  transformArrays(
+      transform, points->size(), points->x(), points->y(), points->z(),
+      points->x(), points->y(), points->z());
+}
+
+void transform(
+    const Eigen::Affine3f& transform, const PointBuffer& points_in,
+    PointBuffer* points_out) {
+  if (points_out == &points_in)
+    return squirrel_point_buffer::transform(transform, points_out);
+  *points_out = points_in;
+  squirrel_point_buffer::transform(transform, points_out);
+}
+
+size_t crop(
+    const Eigen::Vector3f& min, const Eigen::Vector3f& max,
+    PointBuffer* points) {
+  const size_t n          = points->size();
+  const float* __restrict x = points->x();
+  const float* __restrict y = points->y();
+  const float* __restrict z = points->z();
+  std::vector<uint8_t> keep(n);
+  // Comparisons with NaN are false, so they are dropped.
+  for (size_t i = 0; i < n; ++i)
+    keep[i] = (x[i] >= min(0)) & (x[i] <= max(0)) & (y[i] >= min(1)) &
+              (y[i] <= max(1)) & (z[i] >= min(2)) & (z[i] <= max(2));
+  return points->compact(keep);
+}
+
+size_t cropAxis(int axis, float min, float max, PointBuffer* points) {
+  const size_t n          = points->size();
+  const float* __restrict v = points->axis(axis);
+  const float* __restrict x = points->x();
+  const float* __restrict y = points->y();
+  const float* __restrict z = points->z();
+  std::vector<uint8_t> keep(n);
+  for (size_t i = 0; i < n; ++i)
+    keep[i] = (v[i] >= min) & (v[i] <= max) & std::isfinite(x[i]) &
+              std::isfinite(y[i]) & std::isfinite(z[i]);
+  return points->compact(keep);
+}
+
+void VoxelGrid::setLeafSize(float x, float y, float z) {
+  inv_leaf_size_ = Eigen::Vector3f(1.f / x, 1.f / y, 1.f / z);
+}
+
+void VoxelGrid::filter(const PointBuffer& points_in, PointBuffer* points_out) {
+  const size_t n = points_in.size();
+  const float* x = points_in.x();
+  const float* y = points_in.y();
+  const float* z = points_in.z();
+  keys_.clear();
+  keys_.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+    if (std::isfinite(x[i]) && std::isfinite(y[i]) && std::isfinite(z[i]))
+      keys_.emplace_back(
+          voxelKey(
+              x[i] * inv_leaf_size_(0), y[i] * inv_leaf_size_(1),
+              z[i] * inv_leaf_size_(2)),
+          i);
+  std::sort(keys_.begin(), keys_.end());
+  // Same channels as the input, in its order, whatever points_out had.
+  points_out->reset();
+  const int nchannels = points_in.numChannels();
+  for (int c = 0; c < nchannels; ++c)
+    points_out->addChannel(points_in.channelName(c));
+  std::vector<double> sums(3 + nchannels);
+  for (size_t begin = 0, end = 0; begin < keys_.size(); begin = end) {
+    std::fill(sums.begin(), sums.end(), 0.);
+    const uint64_t key = keys_[begin].first;
+    for (end = begin; end < keys_.size() && keys_[end].first == key; ++end) {
+      const uint32_t i = keys_[end].second;
+      sums[0] += x[i];
+      sums[1] += y[i];
+      sums[2] += z[i];
+      for (int c = 0; c < nchannels; ++c)
+        sums[3 + c] += points_in.channel(c)[i];
+    }
+    const double inv_count = 1. / (end - begin);
+    points_out->push_back(
+        sums[0] * inv_count, sums[1] * inv_count, sums[2] * inv_count);
+    const size_t k = points_out->size() - 1;
+    for (int c = 0; c < nchannels; ++c)
+      points_out->channel(c)[k] = sums[3 + c] * inv_count;
+  }
+}
+
+}  // namespace squirrel_point_buffer
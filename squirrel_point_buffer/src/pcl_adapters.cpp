@@ -0,0 +1,60 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_point_buffer/pcl_adapters.h"
+
+#include <cmath>
+
+namespace squirrel_point_buffer {
+
+void toPCL(const PointBuffer& points, pcl::PointCloud<pcl::PointXYZ>* cloud) {
+  const size_t n = points.size();
+  const float* x = points.x();
+  const float* y = points.y();
+  const float* z = points.z();
+  cloud->points.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    pcl::PointXYZ& p = cloud->points[i];
+    p.x              = x[i];
+    p.y              = y[i];
+    p.z              = z[i];
+  }
+  cloud->width    = n;
+  cloud->height   = 1;
+  cloud->is_dense = true;
+}
+
+void fromPCL(const pcl::PointCloud<pcl::PointXYZ>& cloud, PointBuffer* points) {
+  points->clear();
+  points->reserve(cloud.points.size());
+  for (const auto& p : cloud.points)
+    if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))
+      points->push_back(p.x, p.y, p.z);
+}
+
+}  // namespace squirrel_point_buffer
@@ -0,0 +1,207 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_point_buffer/point_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace squirrel_point_buffer {
+
+PointCloud2View::PointCloud2View(const sensor_msgs::PointCloud2& msg)
+    : msg_(msg),
+      data_(msg.data.data()),
+      height_(msg.height),
+      width_(msg.width),
+      point_step_(msg.point_step),
+      row_step_(msg.row_step),
+      valid_(false) {
+  const char* names[3] = {"x", "y", "z"};
+  for (int a = 0; a < 3; ++a)
+    offsets_[a] = fieldOffset(names[a]);
+  valid_ = offsets_[0] >= 0 && offsets_[1] >= 0 && offsets_[2] >= 0 &&
+           !msg.is_bigendian && row_step_ >= width_ * point_step_ &&
+           msg.data.size() >= height_ * row_step_;
+}
+
+int PointCloud2View::fieldOffset(const std::string& name) const {
+  for (const auto& field : msg_.fields)
+    if (field.name == name &&
+        field.datatype == sensor_msgs::PointField::FLOAT32 &&
+        field.offset + sizeof(float) <= msg_.point_step)
+      return field.offset;
+  return -1;
+}
+
+void PointBuffer::clear() {
+  x_.clear();
+  y_.clear();
+  z_.clear();
+  for (auto& channel : channels_)
+    channel.clear();
+}
+
+void PointBuffer::reset() {
+  channel_names_.clear();
+  channels_.clear();
+  clear();
+}
+
+void PointBuffer::reserve(size_t n) {
+  x_.reserve(n);
+  y_.reserve(n);
+  z_.reserve(n);
+  for (auto& channel : channels_)
+    channel.reserve(n);
+}
+
+void PointBuffer::resize(size_t n) {
+  x_.resize(n, 0.f);
+  y_.resize(n, 0.f);
+  z_.resize(n, 0.f);
+  for (auto& channel : channels_)
+    channel.resize(n, 0.f);
+}
+
+void PointBuffer::swap(PointBuffer& other) {
+  x_.swap(other.x_);
+  y_.swap(other.y_);
+  z_.swap(other.z_);
+  channel_names_.swap(other.channel_names_);
+  channels_.swap(other.channels_);
+}
+
+void PointBuffer::push_back(float x, float y, float z) {
+  x_.push_back(x);
+  y_.push_back(y);
+  z_.push_back(z);
+  for (auto& channel : channels_)
+    channel.push_back(0.f);
+}
+
+int PointBuffer::addChannel(const std::string& name) {
+  const int c = channelIndex(name);
+  if (c >= 0)
+    return c;
+  channel_names_.push_back(name);
+  channels_.push_back(FloatArray(size(), 0.f));
+  return numChannels() - 1;
+}
+
+int PointBuffer::channelIndex(const std::string& name) const {
+  const auto it =
+      std::find(channel_names_.begin(), channel_names_.end(), name);
+  return it == channel_names_.end() ? -1 : it - channel_names_.begin();
+}
+
+bool PointBuffer::assign(
+    const PointCloud2View& view, const std::vector<std::string>& channels) {
+  reset();
+  if (!view.valid())
+    return false;
+  std::vector<int> channel_offsets;
+  for (const auto& name : channels) {
+    const int offset = view.fieldOffset(name);
+    if (offset < 0 || channelIndex(name) >= 0)
+      continue;
+    addChannel(name);
+    channel_offsets.push_back(offset);
+  }
+  // Sized for all the points and shrunk to the finite ones, so that the
+  // loop does not check the capacity.
+  const size_t max_points = view.size();
+  resize(max_points);
+  const int ox = view.offset(0), oy = view.offset(1), oz = view.offset(2);
+  size_t n = 0;
+  for (size_t r = 0; r < view.height(); ++r)
+    for (size_t c = 0; c < view.width(); ++c) {
+      const uint8_t* point = view.point(r, c);
+      const float x        = PointCloud2View::read(point, ox);
+      const float y        = PointCloud2View::read(point, oy);
+      const float z        = PointCloud2View::read(point, oz);
+      if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+        continue;
+      x_[n] = x;
+      y_[n] = y;
+      z_[n] = z;
+      for (size_t k = 0; k < channel_offsets.size(); ++k)
+        channels_[k][n] = PointCloud2View::read(point, channel_offsets[k]);
+      ++n;
+    }
+  resize(n);
+  return true;
+}
+
+size_t PointBuffer::compact(const std::vector<uint8_t>& keep) {
+  const size_t n = std::min(keep.size(), size());
+  size_t m       = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!keep[i])
+      continue;
+    x_[m] = x_[i];
+    y_[m] = y_[i];
+    z_[m] = z_[i];
+    for (auto& channel : channels_)
+      channel[m] = channel[i];
+    ++m;
+  }
+  resize(m);
+  return m;
+}
+
+void toPointCloud2(
+    const PointBuffer& points, const std_msgs::Header& header,
+    sensor_msgs::PointCloud2* msg) {
+  const size_t nfields = 3 + points.numChannels();
+  const size_t n       = points.size();
+  msg->header          = header;
+  msg->height          = 1;
+  msg->width           = n;
+  msg->is_bigendian    = false;
+  msg->is_dense        = true;
+  msg->point_step      = nfields * sizeof(float);
+  msg->row_step        = n * msg->point_step;
+  msg->fields.resize(nfields);
+  std::vector<const float*> sources(nfields);
+  for (size_t f = 0; f < nfields; ++f) {
+    sensor_msgs::PointField& field = msg->fields[f];
+    field.name     = f < 3 ? std::string(1, "xyz"[f])
+                           : points.channelName(f - 3);
+    field.offset   = f * sizeof(float);
+    field.datatype = sensor_msgs::PointField::FLOAT32;
+    field.count    = 1;
+    sources[f]     = f < 3 ? points.axis(f) : points.channel(f - 3);
+  }
+  msg->data.resize(msg->row_step);
+  float* data = reinterpret_cast<float*>(msg->data.data());
+  for (size_t i = 0; i < n; ++i)
+    for (size_t f = 0; f < nfields; ++f)
+      data[i * nfields + f] = sources[f][i];
+}
+
+}  // namespace squirrel_point_buffer
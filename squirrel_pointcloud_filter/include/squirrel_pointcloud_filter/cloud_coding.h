@@ -0,0 +1,66 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_POINTCLOUD_FILTER_CLOUD_CODING_H_
+#define SQUIRREL_POINTCLOUD_FILTER_CLOUD_CODING_H_
+
+#include "squirrel_pointcloud_filter/CompressedPointCloud.h"
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace squirrel_pointcloud_filter {
+
+// Compression of x,y,z clouds for the links with low bandwidth. The points
+// are quantized on a grid, with at most half a step of error per axis, and
+// the sorted keys of their cells are delta coded as varints. On voxelized
+// clouds a point takes about two bytes instead of sixteen.
+
+// Sorted keys of the cells of the finite points on the grid, with 21 bits
+// per axis. False if the cloud has no float xyz fields.
+bool cloudKeys(
+    const sensor_msgs::PointCloud2& cloud, const std::array<double, 3>& steps,
+    std::vector<uint64_t>* keys);
+
+// Encode the finite points of the cloud. False if it has no float xyz
+// fields.
+bool encodeCloud(
+    const sensor_msgs::PointCloud2& cloud, const std::array<double, 3>& steps,
+    CompressedPointCloud* compressed, std::vector<uint64_t>* keys_buffer);
+
+// Decode into an unorganized x,y,z cloud. False if the data is truncated.
+bool decodeCloud(
+    const CompressedPointCloud& compressed, sensor_msgs::PointCloud2* cloud);
+
+}  // namespace squirrel_pointcloud_filter
+
+#endif /* SQUIRREL_POINTCLOUD_FILTER_CLOUD_CODING_H_ */
@@ -0,0 +1,105 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_POINTCLOUD_FILTER_FILTER_PIPELINE_H_
+#define SQUIRREL_POINTCLOUD_FILTER_FILTER_PIPELINE_H_
+
+#include "squirrel_pointcloud_filter/outlier_filter.h"
+#include "squirrel_pointcloud_filter/voxel_filter.h"
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <XmlRpcValue.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace squirrel_pointcloud_filter {
+
+// Filter stages declared as a list in the parameters, e.g.
+//   stages:
+//     - {type: range, min: 0.3, max: 4.0}
+//     - {type: crop, min: [-2.0, -2.0, -1.0], max: [2.0, 2.0, 2.0]}
+//     - {type: voxel, resolution: [0.02, 0.02, 0.02]}
+//     - {type: outlier, radius: 0.05, min_neighbors: 2}
+// The point-wise stages (range, crop, and the NaN points) are applied in the
+// sweep that reads the message; voxel and outlier then run in their order on
+// the points left.
+class FilterPipeline {
+ public:
+  struct Stage {
+    enum Type { RANGE, CROP, VOXEL, OUTLIER };
+    Type type;
+    // Range from the sensor.
+    double min_range, max_range;
+    // Box in the frame of the cloud.
+    std::array<double, 3> min_xyz, max_xyz;
+    // Voxel sizes, the ones of the filter if not given.
+    bool has_resolutions;
+    std::array<double, 3> resolutions;
+    // Radius outlier removal.
+    double radius;
+    int min_neighbors;
+  };
+
+ public:
+  FilterPipeline() {}
+
+  // Parse the list of stages. False, with the reason, if it is malformed.
+  bool configure(const XmlRpc::XmlRpcValue& stages, std::string* error);
+
+  inline bool empty() const { return stages_.empty(); }
+
+  // Names of the stages in their order, comma separated.
+  std::string description() const;
+
+  // Run the stages, the output is an unorganized x,y,z cloud. False if the
+  // cloud has no float xyz fields.
+  bool apply(
+      const sensor_msgs::PointCloud2& msg_in,
+      const std::array<double, 3>& default_resolutions,
+      sensor_msgs::PointCloud2* msg_out);
+
+ private:
+  bool acceptPoint(const pcl::PointXYZ& point) const;
+
+  std::vector<Stage> stages_;
+  VoxelFilter voxel_filter_;
+  OutlierFilter outlier_filter_;
+  // Buffers reused across the frames.
+  pcl::PointCloud<pcl::PointXYZ> points_, filtered_points_;
+};
+
+}  // namespace squirrel_pointcloud_filter
+
+#endif /* SQUIRREL_POINTCLOUD_FILTER_FILTER_PIPELINE_H_ */
@@ -0,0 +1,101 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_POINTCLOUD_FILTER_OUTLIER_FILTER_H_
+#define SQUIRREL_POINTCLOUD_FILTER_OUTLIER_FILTER_H_
+
+#include <sensor_msgs/PointCloud2.h>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace squirrel_pointcloud_filter {
+
+// Radius outlier removal: a point is kept if at least min_neighbors other
+// points are within radius. The points of unorganized clouds are bucketed,
+// by an open addressing hash and a counting sort, in cells as large as the
+// radius, so that the neighbours are in the 27 cells around each point and
+// no KD-tree is built. Organized clouds are searched in a window of pixels
+// around each point instead.
+class OutlierFilter {
+ public:
+  OutlierFilter();
+
+  void setRadius(double radius);
+  void setMinNeighbors(int min_neighbors);
+  // Half size of the window of pixels searched in organized clouds, with 0
+  // they are treated as the unorganized ones.
+  void setImageWindow(int image_window);
+
+  // Inliers of the cloud, NaN points are skipped.
+  void filter(
+      const pcl::PointCloud<pcl::PointXYZ>& cloud_in,
+      pcl::PointCloud<pcl::PointXYZ>* cloud_out);
+
+  // Inliers of the message. Organized clouds keep their layout and fields,
+  // with the outliers set to NaN; the unorganized ones become x,y,z clouds.
+  // False if the cloud has no float xyz fields.
+  bool filter(
+      const sensor_msgs::PointCloud2& msg_in,
+      sensor_msgs::PointCloud2* msg_out);
+
+ private:
+  struct Cell {
+    uint64_t key;
+    uint32_t stamp;
+    int begin, count;
+  };
+
+  // Marks the inliers of points_.
+  void classifyPoints();
+  void classifyPixels(int width, int height);
+  void resetCells(size_t max_cells);
+  size_t insertCell(uint64_t key);
+  int findCell(uint64_t key) const;
+
+  float radius_;
+  int min_neighbors_;
+  int image_window_;
+  std::vector<pcl::PointXYZ> points_;
+  std::vector<uint8_t> inliers_;
+  // Cells valid if their stamp is the one of the current cloud.
+  std::vector<Cell> cells_;
+  std::vector<size_t> used_cells_, point_cells_;
+  std::vector<int> order_;
+  uint32_t stamp_;
+  size_t mask_;
+};
+
+}  // namespace squirrel_pointcloud_filter
+
+#endif /* SQUIRREL_POINTCLOUD_FILTER_OUTLIER_FILTER_H_ */
@@ -30,10 +30,17 @@
 #define SQUIRREL_POINTCLOUD_FILTER_POINTCLOUD_FILTER_H_
 
 #include "squirrel_pointcloud_filter/PointCloudFilterConfig.h"
+#include "squirrel_pointcloud_filter/cloud_coding.h"
+#include "squirrel_pointcloud_filter/filter_pipeline.h"
+#include "squirrel_pointcloud_filter/outlier_filter.h"
+#include "squirrel_pointcloud_filter/voxel_filter.h"
+
+#include <squirrel_point_buffer/kernels.h>
 
 #include <ros/ros.h>
 
 #include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Float64.h>
 
 #include <dynamic_reconfigure/server.h>
 
@@ -63,40 +70,102 @@ class PointCloudFilter {
     double update_rate;
     std::array<double, 3> resolutions_xyz;
     double ground_threshold;
+    int organized_stride;
+    bool hash_voxel_filter;
+    int voxel_filter_stripes;
+    bool event_driven;
+    double max_frame_rate;
+    double outlier_radius;
+    int outlier_min_neighbors, outlier_image_window;
+    bool compressed_outputs;
+    double compression_step;
+    bool skip_static_frames;
+    double static_translation, static_rotation;
+    double static_change_ratio, static_max_interval;
   };
 
  public:
-  PointCloudFilter() : params_(Params::defaultParams()) { initialize(); }
-  PointCloudFilter(const Params& params) : params_(params) { initialize(); }
+  PointCloudFilter() : params_(Params::defaultParams()) {
+    initialize(ros::NodeHandle(), ros::NodeHandle("~"));
+  }
+  PointCloudFilter(const Params& params) : params_(params) {
+    initialize(ros::NodeHandle(), ros::NodeHandle("~"));
+  }
+  // Constructor for the nodelet, which provides its own handles.
+  PointCloudFilter(const ros::NodeHandle& nh, const ros::NodeHandle& pnh)
+      : params_(Params::defaultParams()) {
+    initialize(nh, pnh);
+  }
   virtual ~PointCloudFilter() {}
 
-  // Spinner.
+  // Spinner. If event_driven, the clouds are processed as soon as they
+  // arrive instead of at update_rate.
   void spin();
 
  private:
   // Initialize.
-  void initialize();
+  void initialize(ros::NodeHandle gnh, ros::NodeHandle pnh);
 
   // Callbacks.
   void reconfigureCallback(PointCloudFilterConfig& config, uint32_t level);
   void pointCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& msg_in);
 
-  // Filter the ground.
-  void segmentGround(
-      const pcl::PointCloud<pcl::PointXYZ>& cloud,
-      pcl::PointCloud<pcl::PointXYZ>* ground,
-      pcl::PointCloud<pcl::PointXYZ>* nonground) const;
+  // Downsample an organized cloud by taking one pixel every stride on rows
+  // and columns, without NaN, straight from the buffer of the message. The
+  // output is an unorganized xyz cloud as the one of the voxel filter. False
+  // if the cloud has no float xyz fields.
+  bool decimateOrganizedCloud(
+      const sensor_msgs::PointCloud2& msg_in, int stride,
+      sensor_msgs::PointCloud2* msg_out) const;
+
+  // Transform the points to the global frame and split them at
+  // ground_threshold in one pass, writing the outputs directly. False if the
+  // cloud has no float xyz fields.
+  bool segmentGround(
+      const sensor_msgs::PointCloud2& cloud, const Eigen::Matrix4f& transform,
+      sensor_msgs::PointCloud2* ground,
+      sensor_msgs::PointCloud2* nonground) const;
+
+  // True if, since the last frame not skipped, the sensor has moved less
+  // than static_translation and static_rotation, less than a
+  // static_change_ratio of the voxels of the cloud have appeared or
+  // disappeared, and less than static_max_interval has passed.
+  bool isStaticFrame(const sensor_msgs::PointCloud2& cloud);
+
+  // Publish the cloud, and its compressed version if enabled and someone is
+  // listening.
+  void publishCloud(
+      const sensor_msgs::PointCloud2::Ptr& cloud, const ros::Publisher& pub,
+      const ros::Publisher& compressed_pub);
 
  private:
   Params params_;
   std::unique_ptr<dynamic_reconfigure::Server<PointCloudFilterConfig>> dsrv_;
 
   ros::Publisher voxel_pcl_pub_, ground_pcl_pub_, nonground_pcl_pub_;
+  ros::Publisher latency_pub_;
+  ros::Publisher voxel_compressed_pub_, ground_compressed_pub_,
+      nonground_compressed_pub_;
   ros::Subscriber pcl_sub_;
 
   tf::TransformListener tfl_;
-  
-  std::unique_ptr<pcl::VoxelGrid<pcl::PointXYZ>> voxel_filter_;
+  // Stamp of the last cloud processed, to cap the frame rate.
+  ros::Time last_stamp_;
+
+  // Buffers of the input and the voxelized points, reused across frames.
+  squirrel_point_buffer::PointBuffer points_, voxelized_points_;
+  squirrel_point_buffer::VoxelGrid voxel_filter_;
+  VoxelFilter hash_voxel_filter_;
+  OutlierFilter outlier_filter_;
+  std::vector<uint64_t> compression_keys_;
+
+  // Reference of the static frames, the last one published.
+  tf::Transform static_reference_pose_;
+  ros::Time static_reference_stamp_;
+  std::string static_reference_frame_id_;
+  std::vector<uint64_t> static_reference_voxels_, current_voxels_;
+  // Stages of ~stages, replacing the voxel filter when not empty.
+  FilterPipeline pipeline_;
 };
 
 }  // namespace squirrel_pointcloud_filter
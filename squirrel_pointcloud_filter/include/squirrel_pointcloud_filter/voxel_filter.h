@@ -0,0 +1,101 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_POINTCLOUD_FILTER_VOXEL_FILTER_H_
+#define SQUIRREL_POINTCLOUD_FILTER_VOXEL_FILTER_H_
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace squirrel_pointcloud_filter {
+
+// Voxel downsampling through an open addressing hash of the voxel keys with
+// the running sums of their points, in one pass over the cloud, instead of
+// sorting the points as pcl::VoxelGrid does. The keys have 21 bits per axis
+// and wrap around, so there is no limit on the extent of the cloud. With
+// more stripes the cloud is split in slabs along x, hashed in parallel. The
+// tables keep their capacity across the frames.
+class VoxelFilter {
+ public:
+  VoxelFilter();
+
+  // Voxel sizes, one per axis.
+  void setResolutions(const std::array<double, 3>& resolutions);
+  // Number of slabs hashed in parallel.
+  void setNumStripes(int num_stripes);
+
+  // Centroids of the occupied voxels, NaN points are skipped.
+  void filter(
+      const pcl::PointCloud<pcl::PointXYZ>& cloud_in,
+      pcl::PointCloud<pcl::PointXYZ>* cloud_out);
+
+ private:
+  struct Voxel {
+    uint64_t key;
+    uint32_t stamp;
+    uint32_t count;
+    float x, y, z;
+  };
+
+  // Slots are valid if their stamp is the one of the current frame, so the
+  // table is not cleared between frames.
+  class Table {
+   public:
+    Table() : stamp_(0), mask_(0) {}
+    void reset(size_t max_voxels);
+    void add(uint64_t key, const pcl::PointXYZ& point);
+    void centroids(pcl::PointCloud<pcl::PointXYZ>::VectorType* points) const;
+
+   private:
+    std::vector<Voxel> slots_;
+    std::vector<uint32_t> used_;
+    uint32_t stamp_;
+    size_t mask_;
+  };
+
+  void hashStripe(
+      const pcl::PointCloud<pcl::PointXYZ>& cloud_in, int stripe);
+
+  std::array<float, 3> inv_resolutions_;
+  int num_stripes_;
+  std::vector<Table> tables_;
+  // Voxel keys and x indices of the points, and the points of each stripe,
+  // consecutive.
+  std::vector<uint64_t> keys_;
+  std::vector<int> cells_x_, order_, stripe_begin_;
+};
+
+}  // namespace squirrel_pointcloud_filter
+
+#endif /* SQUIRREL_POINTCLOUD_FILTER_VOXEL_FILTER_H_ */
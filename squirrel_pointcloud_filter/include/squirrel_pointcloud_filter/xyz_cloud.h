@@ -0,0 +1,94 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_POINTCLOUD_FILTER_XYZ_CLOUD_H_
+#define SQUIRREL_POINTCLOUD_FILTER_XYZ_CLOUD_H_
+
+#include <sensor_msgs/PointCloud2.h>
+#include <std_msgs/Header.h>
+
+#include <cstring>
+
+namespace squirrel_pointcloud_filter {
+
+// Reading and writing x,y,z clouds directly on the buffers of the messages.
+
+// Offsets of the float x,y,z fields of a cloud. False if it has none or it
+// is big endian.
+inline bool xyzOffsets(const sensor_msgs::PointCloud2& msg, int offsets[3]) {
+  const char* names[3] = {"x", "y", "z"};
+  offsets[0] = offsets[1] = offsets[2] = -1;
+  for (const auto& field : msg.fields)
+    for (int i = 0; i < 3; ++i)
+      if (field.name == names[i] &&
+          field.datatype == sensor_msgs::PointField::FLOAT32 &&
+          field.offset + sizeof(float) <= msg.point_step)
+        offsets[i] = field.offset;
+  return offsets[0] >= 0 && offsets[1] >= 0 && offsets[2] >= 0 &&
+         !msg.is_bigendian;
+}
+
+// Unorganized x,y,z cloud with the layout of pcl::PointXYZ, the padding
+// float included, with room for max_points.
+const size_t kXYZPointStep = 4 * sizeof(float);
+inline void initializeXYZCloud(
+    const std_msgs::Header& header, size_t max_points,
+    sensor_msgs::PointCloud2* msg) {
+  const char* names[3] = {"x", "y", "z"};
+  msg->header       = header;
+  msg->height       = 1;
+  msg->width        = 0;
+  msg->is_bigendian = false;
+  msg->is_dense     = true;
+  msg->point_step   = kXYZPointStep;
+  msg->row_step     = 0;
+  msg->fields.resize(3);
+  for (int i = 0; i < 3; ++i) {
+    msg->fields[i].name     = names[i];
+    msg->fields[i].offset   = i * sizeof(float);
+    msg->fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+    msg->fields[i].count    = 1;
+  }
+  msg->data.resize(max_points * kXYZPointStep);
+}
+
+inline void pushXYZ(const float xyz[4], sensor_msgs::PointCloud2* msg) {
+  std::memcpy(&msg->data[msg->width * kXYZPointStep], xyz, kXYZPointStep);
+  ++msg->width;
+}
+
+// Shrinks the data to the points written, without reallocating.
+inline void finalizeXYZCloud(sensor_msgs::PointCloud2* msg) {
+  msg->data.resize(msg->width * kXYZPointStep);
+  msg->row_step = msg->width * kXYZPointStep;
+}
+
+}  // namespace squirrel_pointcloud_filter
+
+#endif /* SQUIRREL_POINTCLOUD_FILTER_XYZ_CLOUD_H_ */
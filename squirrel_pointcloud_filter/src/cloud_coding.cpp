@@ -0,0 +1,151 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/cloud_coding.h"
+#include "squirrel_pointcloud_filter/xyz_cloud.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace squirrel_pointcloud_filter {
+
+namespace {
+
+const int kKeyBits      = 21;
+const int64_t kKeyBias  = int64_t(1) << (kKeyBits - 1);
+const uint64_t kKeyMask = (uint64_t(1) << kKeyBits) - 1;
+
+inline void appendVarint(uint64_t value, std::vector<uint8_t>* buffer) {
+  while (value >= 0x80) {
+    buffer->push_back(uint8_t(value) | 0x80);
+    value >>= 7;
+  }
+  buffer->push_back(uint8_t(value));
+}
+
+inline bool readVarint(
+    const std::vector<uint8_t>& buffer, size_t* pos, uint64_t* value) {
+  *value = 0;
+  for (unsigned shift = 0; *pos < buffer.size() && shift < 64; shift += 7) {
+    const uint8_t byte = buffer[(*pos)++];
+    *value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool cloudKeys(
+    const sensor_msgs::PointCloud2& cloud, const std::array<double, 3>& steps,
+    std::vector<uint64_t>* keys) {
+  int offsets[3];
+  if (!xyzOffsets(cloud, offsets))
+    return false;
+  float inv_steps[3];
+  for (int i = 0; i < 3; ++i)
+    inv_steps[i] = 1.0 / steps[i];
+  // Out of range indices wrap around.
+  keys->clear();
+  keys->reserve(cloud.width * cloud.height);
+  for (unsigned int row = 0; row < cloud.height; ++row) {
+    if ((row + 1) * static_cast<size_t>(cloud.row_step) > cloud.data.size())
+      break;
+    const uint8_t* row_data = &cloud.data[row * cloud.row_step];
+    for (unsigned int col = 0; col < cloud.width; ++col) {
+      const uint8_t* point_data = row_data + col * cloud.point_step;
+      float xyz[3];
+      for (int i = 0; i < 3; ++i)
+        std::memcpy(&xyz[i], point_data + offsets[i], sizeof(float));
+      if (!std::isfinite(xyz[0]) || !std::isfinite(xyz[1]) ||
+          !std::isfinite(xyz[2]))
+        continue;
+      uint64_t key = 0;
+      for (int i = 0; i < 3; ++i) {
+        const int64_t index = std::lround(xyz[i] * inv_steps[i]) + kKeyBias;
+        key = (key << kKeyBits) | (static_cast<uint64_t>(index) & kKeyMask);
+      }
+      keys->push_back(key);
+    }
+  }
+  std::sort(keys->begin(), keys->end());
+  return true;
+}
+
+bool encodeCloud(
+    const sensor_msgs::PointCloud2& cloud, const std::array<double, 3>& steps,
+    CompressedPointCloud* compressed, std::vector<uint64_t>* keys_buffer) {
+  if (!cloudKeys(cloud, steps, keys_buffer))
+    return false;
+  const auto& keys = *keys_buffer;
+  compressed->header = cloud.header;
+  std::copy(steps.begin(), steps.end(), compressed->steps.begin());
+  compressed->num_points = keys.size();
+  compressed->keys.clear();
+  compressed->keys.reserve(2 * keys.size());
+  uint64_t previous_key = 0;
+  for (const auto key : keys) {
+    appendVarint(key - previous_key, &compressed->keys);
+    previous_key = key;
+  }
+  return true;
+}
+
+bool decodeCloud(
+    const CompressedPointCloud& compressed, sensor_msgs::PointCloud2* cloud) {
+  // Each key takes at least one byte.
+  if (compressed.num_points > compressed.keys.size())
+    return false;
+  initializeXYZCloud(compressed.header, compressed.num_points, cloud);
+  size_t pos   = 0;
+  uint64_t key = 0;
+  bool valid   = true;
+  for (uint32_t i = 0; i < compressed.num_points; ++i) {
+    uint64_t delta;
+    if (!readVarint(compressed.keys, &pos, &delta)) {
+      valid = false;
+      break;
+    }
+    key += delta;
+    float xyz[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int k = 0; k < 3; ++k) {
+      const int64_t index =
+          static_cast<int64_t>((key >> ((2 - k) * kKeyBits)) & kKeyMask) -
+          kKeyBias;
+      xyz[k] = index * compressed.steps[k];
+    }
+    pushXYZ(xyz, cloud);
+  }
+  finalizeXYZCloud(cloud);
+  return valid;
+}
+
+}  // namespace squirrel_pointcloud_filter
@@ -0,0 +1,69 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/cloud_coding.h"
+
+#include <ros/ros.h>
+
+#include <cstdlib>
+
+// Restores the compressed clouds as unorganized x,y,z clouds.
+class CloudDecoder {
+ public:
+  CloudDecoder() {
+    ros::NodeHandle nh;
+    compressed_sub_ = nh.subscribe(
+        "compressed_cloud_in", 1, &CloudDecoder::compressedCallback, this);
+    cloud_pub_ = nh.advertise<sensor_msgs::PointCloud2>("cloud_out", 1);
+  }
+
+ private:
+  void compressedCallback(
+      const squirrel_pointcloud_filter::CompressedPointCloud::ConstPtr&
+          compressed) {
+    sensor_msgs::PointCloud2::Ptr cloud(new sensor_msgs::PointCloud2);
+    if (squirrel_pointcloud_filter::decodeCloud(*compressed, cloud.get()))
+      cloud_pub_.publish(cloud);
+    else
+      ROS_WARN_STREAM_THROTTLE(
+          1.0, ros::this_node::getName() << ": Truncated compressed cloud.");
+  }
+
+  ros::Subscriber compressed_sub_;
+  ros::Publisher cloud_pub_;
+};
+
+int main(int argc, char* argv[]) {
+  ros::init(argc, argv, "compressed_cloud_decoder_node");
+
+  CloudDecoder decoder;
+  ros::spin();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/cloud_coding.h"
+
+#include <ros/ros.h>
+
+#include <array>
+#include <cstdlib>
+#include <vector>
+
+// Compresses any x,y,z cloud, e.g. the ones of the octomap server, for the
+// consumers on the other side of a slow link.
+class CloudEncoder {
+ public:
+  CloudEncoder() {
+    ros::NodeHandle nh, pnh("~");
+    double step;
+    pnh.param("quantization_step", step, 0.0125);
+    steps_.fill(step);
+    cloud_sub_ =
+        nh.subscribe("cloud_in", 1, &CloudEncoder::cloudCallback, this);
+    compressed_pub_ =
+        nh.advertise<squirrel_pointcloud_filter::CompressedPointCloud>(
+            "compressed_cloud_out", 1);
+  }
+
+ private:
+  void cloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud) {
+    if (compressed_pub_.getNumSubscribers() == 0)
+      return;
+    squirrel_pointcloud_filter::CompressedPointCloud::Ptr compressed(
+        new squirrel_pointcloud_filter::CompressedPointCloud);
+    if (squirrel_pointcloud_filter::encodeCloud(
+            *cloud, steps_, compressed.get(), &keys_))
+      compressed_pub_.publish(compressed);
+    else
+      ROS_WARN_STREAM_THROTTLE(
+          1.0, ros::this_node::getName() << ": The cloud has no xyz fields.");
+  }
+
+  std::array<double, 3> steps_;
+  std::vector<uint64_t> keys_;
+  ros::Subscriber cloud_sub_;
+  ros::Publisher compressed_pub_;
+};
+
+int main(int argc, char* argv[]) {
+  ros::init(argc, argv, "compressed_cloud_encoder_node");
+
+  CloudEncoder encoder;
+  ros::spin();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/filter_pipeline.h"
+#include "squirrel_pointcloud_filter/xyz_cloud.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace squirrel_pointcloud_filter {
+
+namespace {
+
+bool toDouble(const XmlRpc::XmlRpcValue& value, double* number) {
+  if (value.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+    *number = static_cast<double>(const_cast<XmlRpc::XmlRpcValue&>(value));
+  else if (value.getType() == XmlRpc::XmlRpcValue::TypeInt)
+    *number = static_cast<int>(const_cast<XmlRpc::XmlRpcValue&>(value));
+  else
+    return false;
+  return true;
+}
+
+bool readDouble(
+    XmlRpc::XmlRpcValue& stage, const std::string& name, double* number) {
+  return stage.hasMember(name) && toDouble(stage[name], number);
+}
+
+bool readVector3(
+    XmlRpc::XmlRpcValue& stage, const std::string& name,
+    std::array<double, 3>* vector) {
+  if (!stage.hasMember(name) ||
+      stage[name].getType() != XmlRpc::XmlRpcValue::TypeArray ||
+      stage[name].size() != 3)
+    return false;
+  for (int i = 0; i < 3; ++i)
+    if (!toDouble(stage[name][i], &(*vector)[i]))
+      return false;
+  return true;
+}
+
+}  // namespace
+
+bool FilterPipeline::configure(
+    const XmlRpc::XmlRpcValue& stages_param, std::string* error) {
+  stages_.clear();
+  XmlRpc::XmlRpcValue stages = stages_param;
+  if (stages.getType() != XmlRpc::XmlRpcValue::TypeArray) {
+    *error = "the stages are not a list";
+    return false;
+  }
+  for (int i = 0; i < stages.size(); ++i) {
+    XmlRpc::XmlRpcValue& param = stages[i];
+    if (param.getType() != XmlRpc::XmlRpcValue::TypeStruct ||
+        !param.hasMember("type") ||
+        param["type"].getType() != XmlRpc::XmlRpcValue::TypeString) {
+      *error = "stage " + std::to_string(i) + " has no type";
+      return false;
+    }
+    const std::string type = static_cast<std::string>(param["type"]);
+    Stage stage;
+    stage.min_range = 0.0;
+    stage.max_range = std::numeric_limits<double>::infinity();
+    stage.min_xyz.fill(-std::numeric_limits<double>::infinity());
+    stage.max_xyz.fill(std::numeric_limits<double>::infinity());
+    stage.has_resolutions = false;
+    stage.radius          = 0.05;
+    stage.min_neighbors   = 1;
+    if (type == "nan") {
+      // The NaN points are always skipped.
+      continue;
+    } else if (type == "range") {
+      stage.type = Stage::RANGE;
+      readDouble(param, "min", &stage.min_range);
+      readDouble(param, "max", &stage.max_range);
+    } else if (type == "crop") {
+      stage.type = Stage::CROP;
+      readVector3(param, "min", &stage.min_xyz);
+      readVector3(param, "max", &stage.max_xyz);
+    } else if (type == "voxel") {
+      stage.type            = Stage::VOXEL;
+      stage.has_resolutions =
+          readVector3(param, "resolution", &stage.resolutions);
+    } else if (type == "outlier") {
+      stage.type = Stage::OUTLIER;
+      readDouble(param, "radius", &stage.radius);
+      double min_neighbors = stage.min_neighbors;
+      readDouble(param, "min_neighbors", &min_neighbors);
+      stage.min_neighbors = min_neighbors;
+      if (stage.radius <= 0.0) {
+        *error = "stage " + std::to_string(i) + " has no positive radius";
+        return false;
+      }
+    } else {
+      *error = "stage " + std::to_string(i) + " has unknown type " + type;
+      return false;
+    }
+    stages_.emplace_back(stage);
+  }
+  return true;
+}
+
+std::string FilterPipeline::description() const {
+  const char* names[4] = {"range", "crop", "voxel", "outlier"};
+  std::string description;
+  for (const auto& stage : stages_)
+    description += (description.empty() ? "" : ",") +
+                   std::string(names[stage.type]);
+  return description;
+}
+
+bool FilterPipeline::acceptPoint(const pcl::PointXYZ& point) const {
+  for (const auto& stage : stages_) {
+    if (stage.type == Stage::RANGE) {
+      const double range = std::sqrt(
+          point.x * point.x + point.y * point.y + point.z * point.z);
+      if (range < stage.min_range || range > stage.max_range)
+        return false;
+    } else if (stage.type == Stage::CROP) {
+      if (point.x < stage.min_xyz[0] || point.x > stage.max_xyz[0] ||
+          point.y < stage.min_xyz[1] || point.y > stage.max_xyz[1] ||
+          point.z < stage.min_xyz[2] || point.z > stage.max_xyz[2])
+        return false;
+    }
+  }
+  return true;
+}
+
+bool FilterPipeline::apply(
+    const sensor_msgs::PointCloud2& msg_in,
+    const std::array<double, 3>& default_resolutions,
+    sensor_msgs::PointCloud2* msg_out) {
+  int offsets[3];
+  if (!xyzOffsets(msg_in, offsets))
+    return false;
+  // Point-wise stages, in the sweep over the message.
+  points_.points.clear();
+  points_.points.reserve(msg_in.width * msg_in.height);
+  for (unsigned int row = 0; row < msg_in.height; ++row) {
+    if ((row + 1) * static_cast<size_t>(msg_in.row_step) > msg_in.data.size())
+      break;
+    const uint8_t* row_data = &msg_in.data[row * msg_in.row_step];
+    for (unsigned int col = 0; col < msg_in.width; ++col) {
+      const uint8_t* point_data = row_data + col * msg_in.point_step;
+      pcl::PointXYZ point;
+      std::memcpy(&point.x, point_data + offsets[0], sizeof(float));
+      std::memcpy(&point.y, point_data + offsets[1], sizeof(float));
+      std::memcpy(&point.z, point_data + offsets[2], sizeof(float));
+      if (std::isfinite(point.x) && std::isfinite(point.y) &&
+          std::isfinite(point.z) && acceptPoint(point))
+        points_.points.push_back(point);
+    }
+  }
+  // Stages on the whole cloud.
+  for (const auto& stage : stages_) {
+    if (stage.type == Stage::VOXEL) {
+      voxel_filter_.setResolutions(
+          stage.has_resolutions ? stage.resolutions : default_resolutions);
+      voxel_filter_.filter(points_, &filtered_points_);
+      points_.points.swap(filtered_points_.points);
+    } else if (stage.type == Stage::OUTLIER) {
+      outlier_filter_.setRadius(stage.radius);
+      outlier_filter_.setMinNeighbors(stage.min_neighbors);
+      outlier_filter_.filter(points_, &filtered_points_);
+      points_.points.swap(filtered_points_.points);
+    }
+  }
+  initializeXYZCloud(msg_in.header, points_.points.size(), msg_out);
+  for (const auto& point : points_.points) {
+    const float xyz[4] = {point.x, point.y, point.z, 0.0f};
+    pushXYZ(xyz, msg_out);
+  }
+  finalizeXYZCloud(msg_out);
+  return true;
+}
+
+}  // namespace squirrel_pointcloud_filter
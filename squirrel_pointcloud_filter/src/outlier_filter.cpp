@@ -0,0 +1,257 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/outlier_filter.h"
+#include "squirrel_pointcloud_filter/xyz_cloud.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace squirrel_pointcloud_filter {
+
+namespace {
+
+inline uint64_t cellKey(int x, int y, int z) {
+  return (static_cast<uint64_t>(x & 0x1FFFFF) << 42) |
+         (static_cast<uint64_t>(y & 0x1FFFFF) << 21) |
+         static_cast<uint64_t>(z & 0x1FFFFF);
+}
+
+inline bool isFinite(const pcl::PointXYZ& point) {
+  return std::isfinite(point.x) && std::isfinite(point.y) &&
+         std::isfinite(point.z);
+}
+
+inline float squaredDistance(const pcl::PointXYZ& a, const pcl::PointXYZ& b) {
+  const float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+  return dx * dx + dy * dy + dz * dz;
+}
+
+}  // namespace
+
+OutlierFilter::OutlierFilter()
+    : radius_(0.05), min_neighbors_(2), image_window_(2), stamp_(0), mask_(0) {}
+
+void OutlierFilter::setRadius(double radius) { radius_ = radius; }
+
+void OutlierFilter::setMinNeighbors(int min_neighbors) {
+  min_neighbors_ = std::max(min_neighbors, 0);
+}
+
+void OutlierFilter::setImageWindow(int image_window) {
+  image_window_ = std::max(image_window, 0);
+}
+
+void OutlierFilter::filter(
+    const pcl::PointCloud<pcl::PointXYZ>& cloud_in,
+    pcl::PointCloud<pcl::PointXYZ>* cloud_out) {
+  points_.clear();
+  for (const auto& point : cloud_in.points)
+    if (isFinite(point))
+      points_.push_back(point);
+  classifyPoints();
+  cloud_out->header = cloud_in.header;
+  cloud_out->points.clear();
+  for (size_t i = 0; i < points_.size(); ++i)
+    if (inliers_[i])
+      cloud_out->points.push_back(points_[i]);
+  cloud_out->width    = cloud_out->points.size();
+  cloud_out->height   = 1;
+  cloud_out->is_dense = true;
+}
+
+bool OutlierFilter::filter(
+    const sensor_msgs::PointCloud2& msg_in, sensor_msgs::PointCloud2* msg_out) {
+  int offsets[3];
+  if (!xyzOffsets(msg_in, offsets))
+    return false;
+  const bool organized = msg_in.height > 1 && image_window_ > 0;
+  // Read the points, NaN included for the organized clouds to keep the
+  // indices of the pixels.
+  points_.clear();
+  points_.reserve(msg_in.width * msg_in.height);
+  unsigned int rows = 0;
+  for (; rows < msg_in.height; ++rows) {
+    if ((rows + 1) * static_cast<size_t>(msg_in.row_step) > msg_in.data.size())
+      break;
+    const uint8_t* row_data = &msg_in.data[rows * msg_in.row_step];
+    for (unsigned int col = 0; col < msg_in.width; ++col) {
+      const uint8_t* point_data = row_data + col * msg_in.point_step;
+      pcl::PointXYZ point;
+      std::memcpy(&point.x, point_data + offsets[0], sizeof(float));
+      std::memcpy(&point.y, point_data + offsets[1], sizeof(float));
+      std::memcpy(&point.z, point_data + offsets[2], sizeof(float));
+      if (organized || isFinite(point))
+        points_.push_back(point);
+    }
+  }
+  if (organized) {
+    classifyPixels(msg_in.width, rows);
+    *msg_out          = msg_in;
+    msg_out->is_dense = false;
+    const float nan   = std::numeric_limits<float>::quiet_NaN();
+    for (size_t i = 0; i < points_.size(); ++i) {
+      if (inliers_[i] || !isFinite(points_[i]))
+        continue;
+      uint8_t* point_data = &msg_out->data[0] +
+                            (i / msg_in.width) * msg_in.row_step +
+                            (i % msg_in.width) * msg_in.point_step;
+      for (int k = 0; k < 3; ++k)
+        std::memcpy(point_data + offsets[k], &nan, sizeof(float));
+    }
+    return true;
+  }
+  classifyPoints();
+  initializeXYZCloud(msg_in.header, points_.size(), msg_out);
+  for (size_t i = 0; i < points_.size(); ++i)
+    if (inliers_[i]) {
+      const float xyz[4] = {points_[i].x, points_[i].y, points_[i].z, 0.0f};
+      pushXYZ(xyz, msg_out);
+    }
+  finalizeXYZCloud(msg_out);
+  return true;
+}
+
+void OutlierFilter::classifyPoints() {
+  const int npoints          = points_.size();
+  const float inv_radius     = 1.0f / radius_;
+  const float squared_radius = radius_ * radius_;
+  auto cell_of               = [inv_radius](float coordinate) {
+    return static_cast<int>(std::floor(coordinate * inv_radius));
+  };
+  // Count the points of the cells, then sort them by cell.
+  resetCells(npoints);
+  point_cells_.resize(npoints);
+  for (int i = 0; i < npoints; ++i) {
+    const auto& point = points_[i];
+    point_cells_[i]   = insertCell(
+        cellKey(cell_of(point.x), cell_of(point.y), cell_of(point.z)));
+    ++cells_[point_cells_[i]].count;
+  }
+  int begin = 0;
+  for (const auto index : used_cells_) {
+    cells_[index].begin = begin;
+    begin += cells_[index].count;
+    cells_[index].count = 0;
+  }
+  order_.resize(npoints);
+  for (int i = 0; i < npoints; ++i) {
+    Cell& cell                        = cells_[point_cells_[i]];
+    order_[cell.begin + cell.count++] = i;
+  }
+  // Neighbours in the 27 cells around each point.
+  inliers_.assign(npoints, 0);
+  for (int i = 0; i < npoints; ++i) {
+    const auto& point = points_[i];
+    const int x = cell_of(point.x), y = cell_of(point.y), z = cell_of(point.z);
+    int neighbors = -1;  // The point itself.
+    for (int dx = -1; dx <= 1 && neighbors < min_neighbors_; ++dx)
+      for (int dy = -1; dy <= 1 && neighbors < min_neighbors_; ++dy)
+        for (int dz = -1; dz <= 1 && neighbors < min_neighbors_; ++dz) {
+          const int index = findCell(cellKey(x + dx, y + dy, z + dz));
+          if (index < 0)
+            continue;
+          const Cell& cell = cells_[index];
+          for (int j = cell.begin;
+               j < cell.begin + cell.count && neighbors < min_neighbors_; ++j)
+            if (squaredDistance(points_[order_[j]], point) <= squared_radius)
+              ++neighbors;
+        }
+    inliers_[i] = neighbors >= min_neighbors_;
+  }
+}
+
+void OutlierFilter::classifyPixels(int width, int height) {
+  const float squared_radius = radius_ * radius_;
+  inliers_.assign(points_.size(), 0);
+  for (int row = 0; row < height; ++row)
+    for (int col = 0; col < width; ++col) {
+      const auto& point = points_[row * width + col];
+      if (!isFinite(point))
+        continue;
+      int neighbors = -1;  // The point itself.
+      const int min_row = std::max(row - image_window_, 0);
+      const int max_row = std::min(row + image_window_, height - 1);
+      const int min_col = std::max(col - image_window_, 0);
+      const int max_col = std::min(col + image_window_, width - 1);
+      for (int r = min_row; r <= max_row && neighbors < min_neighbors_; ++r)
+        for (int c = min_col; c <= max_col && neighbors < min_neighbors_; ++c)
+          // NaN compares false.
+          if (squaredDistance(points_[r * width + c], point) <= squared_radius)
+            ++neighbors;
+      inliers_[row * width + col] = neighbors >= min_neighbors_;
+    }
+}
+
+void OutlierFilter::resetCells(size_t max_cells) {
+  // At most half full.
+  size_t capacity = 16;
+  while (capacity < 2 * max_cells)
+    capacity *= 2;
+  used_cells_.clear();
+  if (capacity > cells_.size()) {
+    cells_.assign(capacity, Cell());
+    for (auto& cell : cells_)
+      cell.stamp = 0;
+    stamp_ = 1;
+  } else if (++stamp_ == 0) {
+    for (auto& cell : cells_)
+      cell.stamp = 0;
+    stamp_ = 1;
+  }
+  mask_ = cells_.size() - 1;
+}
+
+size_t OutlierFilter::insertCell(uint64_t key) {
+  size_t index = ((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask_;
+  while (cells_[index].stamp == stamp_ && cells_[index].key != key)
+    index = (index + 1) & mask_;
+  Cell& cell = cells_[index];
+  if (cell.stamp != stamp_) {
+    cell.key   = key;
+    cell.stamp = stamp_;
+    cell.count = 0;
+    used_cells_.push_back(index);
+  }
+  return index;
+}
+
+int OutlierFilter::findCell(uint64_t key) const {
+  size_t index = ((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask_;
+  while (cells_[index].stamp == stamp_) {
+    if (cells_[index].key == key)
+      return index;
+    index = (index + 1) & mask_;
+  }
+  return -1;
+}
+
+}  // namespace squirrel_pointcloud_filter
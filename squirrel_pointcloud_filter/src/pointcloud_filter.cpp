@@ -27,7 +27,13 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "squirrel_pointcloud_filter/pointcloud_filter.h"
+#include "squirrel_pointcloud_filter/xyz_cloud.h"
 
+#include <squirrel_point_buffer/pcl_adapters.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -35,6 +41,14 @@
 namespace squirrel_pointcloud_filter {
 
 void PointCloudFilter::spin() {
+  if (params_.event_driven) {
+    // The callbacks run serialized in the thread of the spinner, whenever a
+    // cloud is received.
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
+    ros::waitForShutdown();
+    return;
+  }
   for (ros::Rate lr(params_.update_rate); ros::ok(); lr.sleep())
     try {
       ros::spinOnce();
@@ -44,8 +58,7 @@ void PointCloudFilter::spin() {
     }
 }
 
-void PointCloudFilter::initialize() {
-  ros::NodeHandle pnh("~"), gnh;
+void PointCloudFilter::initialize(ros::NodeHandle gnh, ros::NodeHandle pnh) {
   // Initialize the parameter server.
   dsrv_.reset(new dynamic_reconfigure::Server<PointCloudFilterConfig>(pnh));
   dsrv_->setCallback(
@@ -59,6 +72,28 @@ void PointCloudFilter::initialize() {
       pnh.advertise<sensor_msgs::PointCloud2>("/ground_cloud_out", 1);
   nonground_pcl_pub_ =
       pnh.advertise<sensor_msgs::PointCloud2>("/nonground_cloud_out", 1);
+  voxel_compressed_pub_ = pnh.advertise<CompressedPointCloud>(
+      "/voxelized_cloud_out_compressed", 1);
+  ground_compressed_pub_ = pnh.advertise<CompressedPointCloud>(
+      "/ground_cloud_out_compressed", 1);
+  nonground_compressed_pub_ = pnh.advertise<CompressedPointCloud>(
+      "/nonground_cloud_out_compressed", 1);
+  latency_pub_ = pnh.advertise<std_msgs::Float64>("processing_latency", 1);
+  // Filter stages, if declared. The stages applied to the voxelized cloud are
+  // advertised so that the consumers can skip them.
+  XmlRpc::XmlRpcValue stages;
+  if (pnh.getParam("stages", stages)) {
+    std::string error;
+    if (pipeline_.configure(stages, &error)) {
+      pnh.setParam("stages_applied", pipeline_.description());
+      ROS_INFO_STREAM(
+          ros::this_node::getName() << ": Filter stages "
+                                    << pipeline_.description() << ".");
+    } else {
+      ROS_ERROR_STREAM(
+          ros::this_node::getName() << ": Invalid stages, " << error << ".");
+    }
+  }
   // Wait for ros crap to boot.
   ros::Duration(0.5).sleep();
 }
@@ -75,80 +110,265 @@ void PointCloudFilter::reconfigureCallback(
   params_.resolutions_xyz[1]     = config.resolution_y;
   params_.resolutions_xyz[2]     = config.resolution_z;
   params_.ground_threshold       = config.ground_threshold;
+  params_.organized_stride       = config.organized_stride;
+  params_.hash_voxel_filter      = config.hash_voxel_filter;
+  params_.voxel_filter_stripes   = config.voxel_filter_stripes;
+  params_.event_driven           = config.event_driven;
+  params_.max_frame_rate         = config.max_frame_rate_hz;
+  params_.outlier_radius         = config.outlier_radius;
+  params_.outlier_min_neighbors  = config.outlier_min_neighbors;
+  params_.outlier_image_window   = config.outlier_image_window;
+  params_.compressed_outputs     = config.compressed_outputs;
+  params_.compression_step       = config.compression_step;
+  params_.skip_static_frames     = config.skip_static_frames;
+  params_.static_translation     = config.static_translation;
+  params_.static_rotation        = config.static_rotation;
+  params_.static_change_ratio    = config.static_change_ratio;
+  params_.static_max_interval    = config.static_max_interval;
 }
 
 void PointCloudFilter::pointCloudCallback(
     const sensor_msgs::PointCloud2::ConstPtr& msg_in) {
   ROS_INFO_STREAM_ONCE(
       ros::this_node::getName() << ": Subscribing to the pointcloud.");
-  // Input pointcloud.
-  pcl::PointCloud<pcl::PointXYZ>::Ptr pointcloud_raw(
-      new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::fromROSMsg(*msg_in, *pointcloud_raw);
-  // Filter NaN if needed.
-  if (!params_.nanfree) {
-    std::vector<int> nan_filter;
-    pcl::removeNaNFromPointCloud(*pointcloud_raw, *pointcloud_raw, nan_filter);
+  // Cap the frame rate on the stamps of the clouds, a stamp back in time
+  // (e.g. a bag restarted) is always accepted.
+  const ros::Time& stamp = msg_in->header.stamp;
+  if (params_.max_frame_rate > 0.0 && !last_stamp_.isZero() &&
+      stamp >= last_stamp_ &&
+      (stamp - last_stamp_).toSec() < 1.0 / params_.max_frame_rate)
+    return;
+  last_stamp_ = stamp;
+  // Remove the outliers once, all of the outputs are made of the inliers.
+  sensor_msgs::PointCloud2 inliers_msg;
+  const sensor_msgs::PointCloud2* input = msg_in.get();
+  if (params_.outlier_radius > 0.0) {
+    outlier_filter_.setRadius(params_.outlier_radius);
+    outlier_filter_.setMinNeighbors(params_.outlier_min_neighbors);
+    outlier_filter_.setImageWindow(params_.outlier_image_window);
+    if (outlier_filter_.filter(*msg_in, &inliers_msg))
+      input = &inliers_msg;
   }
-  // Apply voxel filter.
-  pcl::PointCloud<pcl::PointXYZ>::Ptr voxelized_pointcloud(
-      new pcl::PointCloud<pcl::PointXYZ>);
-  if (params_.do_voxel_filter) {
-    voxel_filter_.reset(new pcl::VoxelGrid<pcl::PointXYZ>);
-    voxel_filter_->setInputCloud(pointcloud_raw);
-    voxel_filter_->setLeafSize(
-        params_.resolutions_xyz[0], params_.resolutions_xyz[1],
-        params_.resolutions_xyz[2]);
-    voxel_filter_->filter(*voxelized_pointcloud);
-    // Publish the filtered pointcloud.
-    sensor_msgs::PointCloud2 voxelized_pointcloud_msg;
-    voxelized_pointcloud_msg.header = msg_in->header;
-    pcl::toROSMsg(*voxelized_pointcloud, voxelized_pointcloud_msg);
-    voxel_pcl_pub_.publish(voxelized_pointcloud_msg);
+  // Apply the filter stages, or the voxel filter. Published by pointer to be
+  // handed over without copies to nodelets in the same manager.
+  sensor_msgs::PointCloud2::Ptr voxelized_pointcloud_msg(
+      new sensor_msgs::PointCloud2);
+  const bool pipelined =
+      !pipeline_.empty() &&
+      pipeline_.apply(
+          *input, params_.resolutions_xyz, voxelized_pointcloud_msg.get());
+  if (!pipelined && params_.do_voxel_filter) {
+    // Organized input, the downsampling works on the buffer of the message.
+    const bool decimated =
+        params_.organized_stride > 0 && input->height > 1 &&
+        decimateOrganizedCloud(
+            *input, params_.organized_stride, voxelized_pointcloud_msg.get());
+    if (!decimated) {
+      // Input pointcloud, copied once without its NaN points.
+      const squirrel_point_buffer::PointCloud2View view(*input);
+      if (!points_.assign(view)) {
+        pcl::PointCloud<pcl::PointXYZ> pointcloud_raw;
+        pcl::fromROSMsg(*input, pointcloud_raw);
+        squirrel_point_buffer::fromPCL(pointcloud_raw, &points_);
+      }
+      if (params_.hash_voxel_filter) {
+        pcl::PointCloud<pcl::PointXYZ> pointcloud_raw, voxelized_pointcloud;
+        squirrel_point_buffer::toPCL(points_, &pointcloud_raw);
+        hash_voxel_filter_.setResolutions(params_.resolutions_xyz);
+        hash_voxel_filter_.setNumStripes(params_.voxel_filter_stripes);
+        hash_voxel_filter_.filter(pointcloud_raw, &voxelized_pointcloud);
+        voxelized_pointcloud_msg->header = input->header;
+        pcl::toROSMsg(voxelized_pointcloud, *voxelized_pointcloud_msg);
+      } else {
+        voxel_filter_.setLeafSize(
+            params_.resolutions_xyz[0], params_.resolutions_xyz[1],
+            params_.resolutions_xyz[2]);
+        voxel_filter_.filter(points_, &voxelized_points_);
+        squirrel_point_buffer::toPointCloud2(
+            voxelized_points_, input->header, voxelized_pointcloud_msg.get());
+      }
+    }
   }
-  // Apply ground filter.
+  const bool voxelized = pipelined || params_.do_voxel_filter;
+  // Drop the frame if neither the sensor nor the scene have changed.
+  if (params_.skip_static_frames &&
+      isStaticFrame(voxelized ? *voxelized_pointcloud_msg : *input))
+    return;
+  if (voxelized)
+    publishCloud(
+        voxelized_pointcloud_msg, voxel_pcl_pub_, voxel_compressed_pub_);
+  // Apply ground filter, straight from the message to the outputs.
   if (params_.do_ground_segmentation) {
-    pcl::PointCloud<pcl::PointXYZ> tf_pointcloud, ground_pointcloud,
-        nonground_pointcloud;
-    if (params_.ground_filter_voxelized && params_.do_voxel_filter)
-      pcl_ros::transformPointCloud<pcl::PointXYZ>(
-          params_.global_frame_id, *voxelized_pointcloud, tf_pointcloud, tfl_);
-    else
-      pcl_ros::transformPointCloud<pcl::PointXYZ>(
-          params_.global_frame_id, *pointcloud_raw, tf_pointcloud, tfl_);
-    // Segment the pointcloud.
-    segmentGround(tf_pointcloud, &ground_pointcloud, &nonground_pointcloud);
-    // Publish the ground pointcloud.
-    sensor_msgs::PointCloud2 ground_pointcloud_msg;
-    ground_pointcloud_msg.header.frame_id = params_.global_frame_id;
-    ground_pointcloud_msg.header.stamp    = msg_in->header.stamp;
-    pcl::toROSMsg(ground_pointcloud, ground_pointcloud_msg);
-    ground_pcl_pub_.publish(ground_pointcloud_msg);
-    // Publish the nonground pointcloud.
-    sensor_msgs::PointCloud2 nonground_pointcloud_msg;
-    nonground_pointcloud_msg.header.frame_id = params_.global_frame_id;
-    nonground_pointcloud_msg.header.stamp    = msg_in->header.stamp;
-    pcl::toROSMsg(nonground_pointcloud, nonground_pointcloud_msg);
-    nonground_pcl_pub_.publish(nonground_pointcloud_msg);
+    const sensor_msgs::PointCloud2& cloud =
+        params_.ground_filter_voxelized && voxelized
+            ? *voxelized_pointcloud_msg
+            : *input;
+    tf::StampedTransform transform;
+    try {
+      tfl_.lookupTransform(
+          params_.global_frame_id, cloud.header.frame_id, cloud.header.stamp,
+          transform);
+    } catch (const tf::TransformException& ex) {
+      ROS_ERROR_STREAM(ros::this_node::getName() << ": " << ex.what());
+      return;
+    }
+    Eigen::Matrix4f cloud_to_global;
+    pcl_ros::transformAsMatrix(transform, cloud_to_global);
+    sensor_msgs::PointCloud2::Ptr ground_pointcloud_msg(
+        new sensor_msgs::PointCloud2);
+    sensor_msgs::PointCloud2::Ptr nonground_pointcloud_msg(
+        new sensor_msgs::PointCloud2);
+    if (!segmentGround(
+            cloud, cloud_to_global, ground_pointcloud_msg.get(),
+            nonground_pointcloud_msg.get()))
+      return;
+    // Publish the ground and nonground pointclouds.
+    publishCloud(
+        ground_pointcloud_msg, ground_pcl_pub_, ground_compressed_pub_);
+    publishCloud(
+        nonground_pointcloud_msg, nonground_pcl_pub_,
+        nonground_compressed_pub_);
   }
+  // Time from the acquisition of the cloud to the outputs.
+  std_msgs::Float64 latency_msg;
+  latency_msg.data = (ros::Time::now() - stamp).toSec();
+  latency_pub_.publish(latency_msg);
 }
 
-void PointCloudFilter::segmentGround(
-    const pcl::PointCloud<pcl::PointXYZ>& cloud,
-    pcl::PointCloud<pcl::PointXYZ>* ground,
-    pcl::PointCloud<pcl::PointXYZ>* nonground) const {
-  const int npoints = cloud.points.size();
-  ground->header = nonground->header = cloud.header;
-  ground->points.reserve(npoints);
-  nonground->points.reserve(npoints);
-  for (const auto& point : cloud.points) {
-    if (std::abs(point.z) <= params_.ground_threshold)
-      ground->points.emplace_back(point);
-    else if (point.z > params_.ground_threshold)
-      nonground->points.emplace_back(point);
+bool PointCloudFilter::isStaticFrame(const sensor_msgs::PointCloud2& cloud) {
+  tf::StampedTransform sensor_pose;
+  try {
+    tfl_.lookupTransform(
+        params_.global_frame_id, cloud.header.frame_id, cloud.header.stamp,
+        sensor_pose);
+  } catch (const tf::TransformException&) {
+    return false;
+  }
+  if (!cloudKeys(cloud, params_.resolutions_xyz, &current_voxels_))
+    return false;
+  current_voxels_.erase(
+      std::unique(current_voxels_.begin(), current_voxels_.end()),
+      current_voxels_.end());
+  // Motion of the sensor and voxels changed since the last frame published,
+  // not the previous one, so that slow drifts add up.
+  if (!static_reference_stamp_.isZero() &&
+      cloud.header.frame_id == static_reference_frame_id_ &&
+      cloud.header.stamp >= static_reference_stamp_ &&
+      (cloud.header.stamp - static_reference_stamp_).toSec() <
+          params_.static_max_interval) {
+    const tf::Transform motion =
+        static_reference_pose_.inverseTimes(sensor_pose);
+    const double angle = motion.getRotation().getAngle();
+    size_t changed = 0;
+    auto previous  = static_reference_voxels_.begin();
+    auto current   = current_voxels_.begin();
+    while (previous != static_reference_voxels_.end() &&
+           current != current_voxels_.end()) {
+      if (*previous == *current) {
+        ++previous;
+        ++current;
+      } else {
+        ++changed;
+        ++(*previous < *current ? previous : current);
+      }
+    }
+    changed += (static_reference_voxels_.end() - previous) +
+               (current_voxels_.end() - current);
+    const size_t nvoxels =
+        std::max(static_reference_voxels_.size(), current_voxels_.size());
+    if (motion.getOrigin().length() <= params_.static_translation &&
+        std::min(angle, 2.0 * M_PI - angle) <= params_.static_rotation &&
+        changed <= params_.static_change_ratio * nvoxels)
+      return true;
+  }
+  static_reference_pose_     = sensor_pose;
+  static_reference_stamp_    = cloud.header.stamp;
+  static_reference_frame_id_ = cloud.header.frame_id;
+  static_reference_voxels_.swap(current_voxels_);
+  return false;
+}
+
+void PointCloudFilter::publishCloud(
+    const sensor_msgs::PointCloud2::Ptr& cloud, const ros::Publisher& pub,
+    const ros::Publisher& compressed_pub) {
+  pub.publish(cloud);
+  if (!params_.compressed_outputs || compressed_pub.getNumSubscribers() == 0)
+    return;
+  // The error is bounded by half of the quantization step.
+  std::array<double, 3> steps;
+  for (int i = 0; i < 3; ++i)
+    steps[i] = params_.compression_step * params_.resolutions_xyz[i];
+  CompressedPointCloud::Ptr compressed(new CompressedPointCloud);
+  if (encodeCloud(*cloud, steps, compressed.get(), &compression_keys_))
+    compressed_pub.publish(compressed);
+}
+
+bool PointCloudFilter::decimateOrganizedCloud(
+    const sensor_msgs::PointCloud2& msg_in, int stride,
+    sensor_msgs::PointCloud2* msg_out) const {
+  int offsets[3];
+  if (!xyzOffsets(msg_in, offsets))
+    return false;
+  const size_t max_points =
+      ((msg_in.height + stride - 1) / stride) *
+      ((msg_in.width + stride - 1) / stride);
+  initializeXYZCloud(msg_in.header, max_points, msg_out);
+  for (unsigned int row = 0; row < msg_in.height; row += stride) {
+    if ((row + 1) * static_cast<size_t>(msg_in.row_step) > msg_in.data.size())
+      break;
+    const uint8_t* row_data = &msg_in.data[row * msg_in.row_step];
+    for (unsigned int col = 0; col < msg_in.width; col += stride) {
+      const uint8_t* point_data = row_data + col * msg_in.point_step;
+      float xyz[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (int i = 0; i < 3; ++i)
+        std::memcpy(&xyz[i], point_data + offsets[i], sizeof(float));
+      if (std::isfinite(xyz[0]) && std::isfinite(xyz[1]) &&
+          std::isfinite(xyz[2]))
+        pushXYZ(xyz, msg_out);
+    }
+  }
+  finalizeXYZCloud(msg_out);
+  return true;
+}
+
+bool PointCloudFilter::segmentGround(
+    const sensor_msgs::PointCloud2& cloud, const Eigen::Matrix4f& transform,
+    sensor_msgs::PointCloud2* ground,
+    sensor_msgs::PointCloud2* nonground) const {
+  int offsets[3];
+  if (!xyzOffsets(cloud, offsets))
+    return false;
+  const size_t npoints = cloud.width * cloud.height;
+  std_msgs::Header header = cloud.header;
+  header.frame_id         = params_.global_frame_id;
+  initializeXYZCloud(header, npoints, ground);
+  initializeXYZCloud(header, npoints, nonground);
+  const Eigen::Matrix3f rotation    = transform.topLeftCorner<3, 3>();
+  const Eigen::Vector3f translation = transform.topRightCorner<3, 1>();
+  const float threshold             = params_.ground_threshold;
+  for (unsigned int row = 0; row < cloud.height; ++row) {
+    if ((row + 1) * static_cast<size_t>(cloud.row_step) > cloud.data.size())
+      break;
+    const uint8_t* row_data = &cloud.data[row * cloud.row_step];
+    for (unsigned int col = 0; col < cloud.width; ++col) {
+      const uint8_t* point_data = row_data + col * cloud.point_step;
+      Eigen::Vector3f point;
+      for (int i = 0; i < 3; ++i)
+        std::memcpy(&point[i], point_data + offsets[i], sizeof(float));
+      if (!point.allFinite())
+        continue;
+      const Eigen::Vector3f point_global = rotation * point + translation;
+      const float xyz[4] = {point_global[0], point_global[1],
+                            point_global[2], 0.0f};
+      if (std::abs(xyz[2]) <= threshold)
+        pushXYZ(xyz, ground);
+      else if (xyz[2] > threshold)
+        pushXYZ(xyz, nonground);
+    }
   }
-  ground->points.shrink_to_fit();
-  nonground->points.shrink_to_fit();
+  finalizeXYZCloud(ground);
+  finalizeXYZCloud(nonground);
+  return true;
 }
 
 PointCloudFilter::Params PointCloudFilter::Params::defaultParams() {
@@ -159,6 +379,21 @@ PointCloudFilter::Params PointCloudFilter::Params::defaultParams() {
   params.do_ground_segmentation  = false;
   params.ground_filter_voxelized = false;
   params.ground_threshold        = 0.05;
+  params.organized_stride        = 0;
+  params.hash_voxel_filter       = false;
+  params.voxel_filter_stripes    = 1;
+  params.event_driven            = false;
+  params.max_frame_rate          = 0.0;
+  params.outlier_radius          = 0.0;
+  params.outlier_min_neighbors   = 2;
+  params.outlier_image_window    = 2;
+  params.compressed_outputs      = false;
+  params.compression_step        = 0.5;
+  params.skip_static_frames      = false;
+  params.static_translation      = 0.01;
+  params.static_rotation         = 0.01;
+  params.static_change_ratio     = 0.02;
+  params.static_max_interval     = 1.0;
   params.update_rate             = 10.0;
   params.global_frame_id         = "/map";
   return params;
@@ -0,0 +1,181 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_pointcloud_filter/voxel_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace squirrel_pointcloud_filter {
+
+namespace {
+
+inline uint64_t voxelKey(int x, int y, int z) {
+  return (static_cast<uint64_t>(x & 0x1FFFFF) << 42) |
+         (static_cast<uint64_t>(y & 0x1FFFFF) << 21) |
+         static_cast<uint64_t>(z & 0x1FFFFF);
+}
+
+}  // namespace
+
+VoxelFilter::VoxelFilter() : num_stripes_(1) {
+  setResolutions({0.05, 0.05, 0.05});
+}
+
+void VoxelFilter::setResolutions(const std::array<double, 3>& resolutions) {
+  for (int i = 0; i < 3; ++i)
+    inv_resolutions_[i] = 1.0 / resolutions[i];
+}
+
+void VoxelFilter::setNumStripes(int num_stripes) {
+  num_stripes_ = std::max(num_stripes, 1);
+}
+
+void VoxelFilter::filter(
+    const pcl::PointCloud<pcl::PointXYZ>& cloud_in,
+    pcl::PointCloud<pcl::PointXYZ>* cloud_out) {
+  const int npoints = cloud_in.points.size();
+  keys_.resize(npoints);
+  cells_x_.resize(npoints);
+  int min_x = std::numeric_limits<int>::max();
+  int max_x = std::numeric_limits<int>::min();
+  for (int i = 0; i < npoints; ++i) {
+    const auto& point = cloud_in.points[i];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y) ||
+        !std::isfinite(point.z)) {
+      cells_x_[i] = std::numeric_limits<int>::min();
+      continue;
+    }
+    const int x = std::floor(point.x * inv_resolutions_[0]);
+    const int y = std::floor(point.y * inv_resolutions_[1]);
+    const int z = std::floor(point.z * inv_resolutions_[2]);
+    keys_[i]    = voxelKey(x, y, z);
+    cells_x_[i] = x;
+    min_x       = std::min(min_x, x);
+    max_x       = std::max(max_x, x);
+  }
+  // Counting sort of the points by slab, the slabs split the range of the
+  // voxel indices along x.
+  const int num_stripes = min_x <= max_x ? num_stripes_ : 1;
+  const int64_t range   = min_x <= max_x ? int64_t(max_x) - min_x + 1 : 1;
+  auto stripe           = [&](int x) {
+    return static_cast<int>((int64_t(x) - min_x) * num_stripes / range);
+  };
+  stripe_begin_.assign(num_stripes + 1, 0);
+  for (int i = 0; i < npoints; ++i)
+    if (cells_x_[i] != std::numeric_limits<int>::min())
+      ++stripe_begin_[stripe(cells_x_[i]) + 1];
+  for (int s = 0; s < num_stripes; ++s)
+    stripe_begin_[s + 1] += stripe_begin_[s];
+  order_.resize(stripe_begin_[num_stripes]);
+  std::vector<int> next(stripe_begin_.begin(), stripe_begin_.end() - 1);
+  for (int i = 0; i < npoints; ++i)
+    if (cells_x_[i] != std::numeric_limits<int>::min())
+      order_[next[stripe(cells_x_[i])]++] = i;
+  // Hash the slabs, the first one in this thread.
+  if (tables_.size() < static_cast<size_t>(num_stripes))
+    tables_.resize(num_stripes);
+  std::vector<std::thread> threads;
+  for (int s = 1; s < num_stripes; ++s)
+    threads.emplace_back(&VoxelFilter::hashStripe, this, std::cref(cloud_in), s);
+  hashStripe(cloud_in, 0);
+  for (auto& thread : threads)
+    thread.join();
+  // Collect the centroids.
+  cloud_out->header = cloud_in.header;
+  cloud_out->points.clear();
+  for (int s = 0; s < num_stripes; ++s)
+    tables_[s].centroids(&cloud_out->points);
+  cloud_out->width    = cloud_out->points.size();
+  cloud_out->height   = 1;
+  cloud_out->is_dense = true;
+}
+
+void VoxelFilter::hashStripe(
+    const pcl::PointCloud<pcl::PointXYZ>& cloud_in, int stripe) {
+  Table& table = tables_[stripe];
+  table.reset(stripe_begin_[stripe + 1] - stripe_begin_[stripe]);
+  for (int i = stripe_begin_[stripe]; i < stripe_begin_[stripe + 1]; ++i)
+    table.add(keys_[order_[i]], cloud_in.points[order_[i]]);
+}
+
+void VoxelFilter::Table::reset(size_t max_voxels) {
+  // At most half full.
+  size_t capacity = 16;
+  while (capacity < 2 * max_voxels)
+    capacity *= 2;
+  used_.clear();
+  if (capacity > slots_.size()) {
+    slots_.assign(capacity, Voxel());
+    for (auto& slot : slots_)
+      slot.stamp = 0;
+    stamp_ = 1;
+  } else if (++stamp_ == 0) {
+    for (auto& slot : slots_)
+      slot.stamp = 0;
+    stamp_ = 1;
+  }
+  mask_ = slots_.size() - 1;
+}
+
+void VoxelFilter::Table::add(uint64_t key, const pcl::PointXYZ& point) {
+  size_t index = ((key * 0x9E3779B97F4A7C15ULL) >> 20) & mask_;
+  while (slots_[index].stamp == stamp_ && slots_[index].key != key)
+    index = (index + 1) & mask_;
+  Voxel& voxel = slots_[index];
+  if (voxel.stamp != stamp_) {
+    voxel.key   = key;
+    voxel.stamp = stamp_;
+    voxel.count = 0;
+    voxel.x = voxel.y = voxel.z = 0.0f;
+    used_.push_back(index);
+  }
+  ++voxel.count;
+  voxel.x += point.x;
+  voxel.y += point.y;
+  voxel.z += point.z;
+}
+
+void VoxelFilter::Table::centroids(
+    pcl::PointCloud<pcl::PointXYZ>::VectorType* points) const {
+  points->reserve(points->size() + used_.size());
+  for (const auto index : used_) {
+    const Voxel& voxel = slots_[index];
+    const float inv_count = 1.0f / voxel.count;
+    pcl::PointXYZ point;
+    point.x = voxel.x * inv_count;
+    point.y = voxel.y * inv_count;
+    point.z = voxel.z * inv_count;
+    points->push_back(point);
+  }
+}
+
+}  // namespace squirrel_pointcloud_filter
@@ -0,0 +1,144 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_THREADING_MEMORY_BUDGET_H_
+#define SQUIRREL_THREADING_MEMORY_BUDGET_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_threading {
+
+// How hard the components of a process have to save memory:
+//   NONE  within the soft limit.
+//   SOFT  above soft_ratio of the budget, the components drop what they can
+//         rebuild (publishing buffers, queued frames).
+//   HARD  above the budget, or the system has less than min_available bytes
+//         left, the components drop parts of their maps.
+enum class MemoryPressure { NONE = 0, SOFT = 1, HARD = 2 };
+
+const char* toString(MemoryPressure pressure);
+
+// Memory accounting of the maps held by a process. Every component reports
+// the bytes it holds into its own account, the budget compares their sum,
+// and the memory the system has left, with its limits. The components read
+// the pressure and degrade in their own threads, so the budget never calls
+// into them.
+class MemoryBudget {
+ public:
+  // Usage and degradation steps of an account, for the diagnostics.
+  struct Entry {
+    std::string name;
+    size_t bytes;
+    size_t num_actions;
+    std::string last_action;
+  };
+
+  // Reported by a component, unregistered when destroyed.
+  class Account {
+   public:
+    explicit Account(
+        const std::string& name, MemoryBudget& budget = MemoryBudget::global());
+    ~Account();
+
+    Account(const Account&) = delete;
+    Account& operator=(const Account&) = delete;
+
+    // Set the bytes held by the component, the pressure is updated.
+    void report(size_t bytes);
+    size_t bytes() const;
+
+    MemoryPressure pressure() const { return budget_.pressure(); }
+
+    // Count a degradation step of the component, e.g. "pruned 1200 nodes".
+    void recordAction(const std::string& action);
+
+   private:
+    struct Record;
+    MemoryBudget& budget_;
+    std::shared_ptr<Record> record_;
+
+    friend class MemoryBudget;
+  };
+
+ public:
+  // The budget of the process.
+  static MemoryBudget& global();
+
+  MemoryBudget();
+
+  // Limits in bytes, 0 for none. The first call configures the budget, the
+  // later ones are ignored (e.g. several plugins of move_base), unless force.
+  // Returns true if the limits were set.
+  bool setLimits(
+      size_t budget, double soft_ratio, size_t min_available,
+      bool force = false);
+
+  size_t budget() const { return budget_; }
+  double softRatio() const { return soft_ratio_; }
+  size_t minAvailable() const { return min_available_; }
+
+  // Sum of the accounts.
+  size_t usage() const;
+  MemoryPressure pressure() const {
+    return static_cast<MemoryPressure>(pressure_.load());
+  }
+
+  // Read the memory the system has left (MemAvailable of /proc/meminfo) and
+  // update the pressure. Called periodically by the MemoryBudgetPublisher.
+  void update();
+  // Bytes left on the system at the last update, 0 if unknown.
+  size_t available() const { return available_.load(); }
+  // Resident memory of the process, 0 if unknown.
+  static size_t residentBytes();
+
+  std::vector<Entry> entries() const;
+
+ private:
+  void evaluate();
+  void add(const std::shared_ptr<Account::Record>& record);
+  void remove(const std::shared_ptr<Account::Record>& record);
+
+  std::atomic<size_t> budget_;
+  std::atomic<double> soft_ratio_;
+  std::atomic<size_t> min_available_;
+  std::atomic<bool> configured_;
+  std::atomic<size_t> available_;
+  std::atomic<int> pressure_;
+
+  mutable std::mutex mtx_;
+  std::vector<std::shared_ptr<Account::Record>> records_;
+};
+
+}  // namespace squirrel_threading
+
+#endif /* SQUIRREL_THREADING_MEMORY_BUDGET_H_ */
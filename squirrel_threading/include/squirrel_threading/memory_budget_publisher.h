@@ -0,0 +1,165 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef SQUIRREL_THREADING_MEMORY_BUDGET_PUBLISHER_H_
+#define SQUIRREL_THREADING_MEMORY_BUDGET_PUBLISHER_H_
+
+#include "squirrel_threading/memory_budget.h"
+
+#include <ros/console.h>
+#include <ros/node_handle.h>
+#include <ros/publisher.h>
+#include <ros/this_node.h>
+#include <ros/wall_timer.h>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace squirrel_threading {
+
+// Configures the memory budget of the process and publishes its usage and
+// the degradation steps of the components on /diagnostics. The parameters
+// are read from the node handle:
+//   memory/budget_mb         bytes the accounts of the process may hold, in
+//                            MB, 0 for no limit (0).
+//   memory/soft_ratio        fraction of the budget above which the pressure
+//                            is soft (0.8).
+//   memory/min_available_mb  free memory of the system below which the
+//                            pressure is hard, in MB, 0 to ignore it (0).
+//   memory/publish_rate      rate of the updates and the diagnostics, in Hz
+//                            (1.0).
+// Several publishers may be created in a process, the first one configures
+// the budget and publishes the diagnostics.
+class MemoryBudgetPublisher {
+ public:
+  explicit MemoryBudgetPublisher(const ros::NodeHandle& nh)
+      : publishing_(false) {
+    ros::NodeHandle mnh(nh, "memory");
+    double budget_mb, soft_ratio, min_available_mb, publish_rate;
+    mnh.param<double>("budget_mb", budget_mb, 0.);
+    mnh.param<double>("soft_ratio", soft_ratio, 0.8);
+    mnh.param<double>("min_available_mb", min_available_mb, 0.);
+    mnh.param<double>("publish_rate", publish_rate, 1.);
+    MemoryBudget& budget = MemoryBudget::global();
+    if (!budget.setLimits(
+            static_cast<size_t>(std::max(budget_mb, 0.) * 1e6), soft_ratio,
+            static_cast<size_t>(std::max(min_available_mb, 0.) * 1e6)))
+      return;
+    if (budget_mb > 0. || min_available_mb > 0.)
+      ROS_INFO_STREAM(
+          ros::this_node::getName()
+          << ": Memory budget of " << budget_mb << " MB, at least "
+          << min_available_mb << " MB left on the system.");
+    if (publish_rate > 0. && !publisherActive().exchange(true)) {
+      publishing_ = true;
+      ros::NodeHandle root_nh;
+      diagnostics_pub_ = root_nh.advertise<diagnostic_msgs::DiagnosticArray>(
+          "/diagnostics", 1);
+      timer_ = root_nh.createWallTimer(
+          ros::WallDuration(1. / publish_rate), &MemoryBudgetPublisher::publish,
+          this);
+    }
+  }
+
+  virtual ~MemoryBudgetPublisher() {
+    timer_.stop();
+    if (publishing_)
+      publisherActive() = false;
+  }
+
+ private:
+  static std::atomic<bool>& publisherActive() {
+    static std::atomic<bool> active(false);
+    return active;
+  }
+
+  static std::string megabytes(size_t bytes) {
+    std::ostringstream value;
+    value << std::fixed << std::setprecision(1) << bytes / 1e6 << " MB";
+    return value.str();
+  }
+
+  static void add(
+      const std::string& key, const std::string& value,
+      diagnostic_msgs::DiagnosticStatus* status) {
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key   = key;
+    key_value.value = value;
+    status->values.push_back(key_value);
+  }
+
+  void publish(const ros::WallTimerEvent&) {
+    MemoryBudget& budget = MemoryBudget::global();
+    budget.update();
+    const MemoryPressure pressure = budget.pressure();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name        = ros::this_node::getName() + ": memory budget";
+    status.hardware_id = ros::this_node::getName();
+    status.level       = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message     = "OK";
+    if (pressure == MemoryPressure::SOFT) {
+      status.level   = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message = "Close to the memory budget, degrading";
+    } else if (pressure == MemoryPressure::HARD) {
+      status.level   = diagnostic_msgs::DiagnosticStatus::ERROR;
+      status.message = "Out of the memory budget, degrading";
+    }
+    add("pressure", toString(pressure), &status);
+    add("usage", megabytes(budget.usage()), &status);
+    add("budget",
+        budget.budget() > 0 ? megabytes(budget.budget()) : "unlimited",
+        &status);
+    add("resident", megabytes(MemoryBudget::residentBytes()), &status);
+    add("system available", megabytes(budget.available()), &status);
+    for (const MemoryBudget::Entry& entry : budget.entries()) {
+      std::ostringstream value;
+      value << megabytes(entry.bytes);
+      if (entry.num_actions > 0)
+        value << ", " << entry.num_actions << " actions (last: "
+              << entry.last_action << ")";
+      add(entry.name, value.str(), &status);
+    }
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+    diagnostics_pub_.publish(msg);
+  }
+
+  bool publishing_;
+  ros::Publisher diagnostics_pub_;
+  ros::WallTimer timer_;
+};
+
+}  // namespace squirrel_threading
+
+#endif /* SQUIRREL_THREADING_MEMORY_BUDGET_PUBLISHER_H_ */
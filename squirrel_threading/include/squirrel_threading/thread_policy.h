@@ -0,0 +1,75 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_THREADING_THREAD_POLICY_H_
+#define SQUIRREL_THREADING_THREAD_POLICY_H_
+
+#include <ros/node_handle.h>
+
+#include <string>
+#include <vector>
+
+namespace squirrel_threading {
+
+// How the threads of a node are sized and scheduled. The policy is read from
+// the private parameters of the node:
+//   ~threads/num_threads  workers of the shared pool and OpenMP threads,
+//                         0 for one per hardware thread.
+//   ~threads/cpus         CPUs the threads are pinned to, empty for any.
+//   ~threads/priority     SCHED_FIFO priority (1-99), 0 for the default
+//                         time sharing scheduling.
+class ThreadPolicy {
+ public:
+  static ThreadPolicy defaultPolicy();
+  static ThreadPolicy fromParams(const ros::NodeHandle& nh);
+
+  // Pin the calling thread and set its scheduling. The threads it creates
+  // afterwards inherit both. Returns false when the system refuses it, e.g.
+  // SCHED_FIFO without CAP_SYS_NICE, and the thread is left as it is.
+  bool applyToCurrentThread() const;
+
+  std::string toString() const;
+
+  int num_threads;
+  std::vector<int> cpus;
+  int priority;
+};
+
+// Read the policy of the node and configure the calling thread, the OpenMP
+// threads and the shared pool with it. Call it at the start of the node,
+// before any thread is spawned, so that all of them follow the policy.
+// Returns the policy in use.
+ThreadPolicy configureThreads(const ros::NodeHandle& nh);
+
+// The policy the process is configured with.
+ThreadPolicy currentPolicy();
+
+}  // namespace squirrel_threading
+
+#endif /* SQUIRREL_THREADING_THREAD_POLICY_H_ */
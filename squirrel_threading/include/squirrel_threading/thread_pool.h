@@ -0,0 +1,100 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_THREADING_THREAD_POOL_H_
+#define SQUIRREL_THREADING_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace squirrel_threading {
+
+// Work stealing pool of worker threads. Every worker has its own queue of
+// tasks: it runs the newest of its own tasks first, and when it has none
+// it steals the oldest task of another worker. Tasks submitted by a worker
+// are pushed on its own queue, the ones submitted from other threads are
+// dealt round robin.
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+  // Body of a parallel loop, called on the subrange [begin, end).
+  typedef std::function<void(int, int)> RangeTask;
+
+ public:
+  // With num_threads <= 0 there is one worker per hardware thread. Every
+  // worker runs on_start before its first task.
+  explicit ThreadPool(int num_threads = 0, const Task& on_start = Task());
+  virtual ~ThreadPool();
+
+  // Pool shared by all the loops of the process, sized and pinned by the
+  // thread policy of the node (see thread_policy.h).
+  static ThreadPool& global();
+
+  // Run a task asynchronously.
+  void submit(Task task);
+
+  // Run body on chunks of grain iterations of [begin, end), and return
+  // when all of them are done. The calling thread works on the chunks as
+  // well, so it is safe to call it from a task of the pool.
+  void parallelFor(int begin, int end, int grain, const RangeTask& body);
+
+  // Wait until all the submitted tasks are done.
+  void wait();
+
+  int size() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  struct Worker {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+
+  void run(int id, const Task& on_start);
+  bool pop(int id, Task* task);
+  bool steal(int id, Task* task);
+
+  std::vector<std::unique_ptr<Worker>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mtx_;
+  std::condition_variable wake_up_, done_;
+  std::atomic<int> num_queued_, num_pending_;
+  std::atomic<unsigned int> next_queue_;
+  bool stop_;
+};
+
+}  // namespace squirrel_threading
+
+#endif /* SQUIRREL_THREADING_THREAD_POOL_H_ */
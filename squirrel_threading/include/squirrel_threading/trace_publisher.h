@@ -0,0 +1,151 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_THREADING_TRACE_PUBLISHER_H_
+#define SQUIRREL_THREADING_TRACE_PUBLISHER_H_
+
+#include "squirrel_threading/tracing.h"
+
+#include <ros/console.h>
+#include <ros/node_handle.h>
+#include <ros/publisher.h>
+#include <ros/this_node.h>
+#include <ros/wall_timer.h>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace squirrel_threading {
+namespace tracing {
+
+// Enables the tracer of the process and publishes the percentiles of its
+// stages on /diagnostics. The parameters are read from the node handle:
+//   tracing/enabled       trace the stages (false).
+//   tracing/publish_rate  rate of the diagnostics, in Hz (1.0).
+//   tracing/window_size   latest samples of a stage the percentiles are
+//                         computed on (512).
+//   tracing/trace_file    Chrome trace file the events are streamed to, none
+//                         when empty ("").
+// Several publishers may be created in a process, e.g. by the plugins of
+// move_base or in a nodelet manager, the first enabled one publishes all the
+// stages.
+class TracePublisher {
+ public:
+  explicit TracePublisher(const ros::NodeHandle& nh)
+      : publishing_(false), trace_open_(false) {
+    ros::NodeHandle tnh(nh, "tracing");
+    bool enabled;
+    double publish_rate;
+    int window_size;
+    std::string trace_file;
+    tnh.param<bool>("enabled", enabled, false);
+    tnh.param<double>("publish_rate", publish_rate, 1.0);
+    tnh.param<int>("window_size", window_size, 512);
+    tnh.param<std::string>("trace_file", trace_file, "");
+    if (!enabled)
+      return;
+    Tracer& tracer = Tracer::instance();
+    tracer.setWindowSize(window_size);
+    if (!trace_file.empty()) {
+      trace_open_ = tracer.openTrace(trace_file);
+      if (!trace_open_)
+        ROS_WARN_STREAM("squirrel_threading: Unable to open the trace file "
+                        << trace_file << ".");
+    }
+    tracer.setEnabled(true);
+    if (publish_rate > 0. && !publisherActive().exchange(true)) {
+      publishing_ = true;
+      ros::NodeHandle root_nh;
+      diagnostics_pub_ = root_nh.advertise<diagnostic_msgs::DiagnosticArray>(
+          "/diagnostics", 1);
+      timer_ = root_nh.createWallTimer(
+          ros::WallDuration(1. / publish_rate), &TracePublisher::publish, this);
+    }
+  }
+
+  virtual ~TracePublisher() {
+    timer_.stop();
+    if (publishing_)
+      publisherActive() = false;
+    if (trace_open_) {
+      Tracer::instance().collect();
+      Tracer::instance().closeTrace();
+    }
+  }
+
+ private:
+  static std::atomic<bool>& publisherActive() {
+    static std::atomic<bool> active(false);
+    return active;
+  }
+
+  void publish(const ros::WallTimerEvent&) {
+    Tracer& tracer = Tracer::instance();
+    const std::vector<Tracer::Summary> summaries = tracer.collect();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name        = ros::this_node::getName() + ": stage timings";
+    status.hardware_id = ros::this_node::getName();
+    status.level       = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message     = "OK";
+    for (const Tracer::Summary& summary : summaries) {
+      std::ostringstream value;
+      value << std::fixed << std::setprecision(2) << "p50 " << 1e3 * summary.p50
+            << " p95 " << 1e3 * summary.p95 << " p99 " << 1e3 * summary.p99
+            << " max " << 1e3 * summary.max << " ms (n=" << summary.count
+            << ")";
+      diagnostic_msgs::KeyValue key_value;
+      key_value.key   = summary.name;
+      key_value.value = value.str();
+      status.values.push_back(key_value);
+    }
+    const size_t num_dropped = tracer.numDropped();
+    if (num_dropped > 0) {
+      status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+      status.message =
+          std::to_string(num_dropped) + " events dropped on full buffers";
+    }
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+    diagnostics_pub_.publish(msg);
+  }
+
+  bool publishing_, trace_open_;
+  ros::Publisher diagnostics_pub_;
+  ros::WallTimer timer_;
+};
+
+}  // namespace tracing
+}  // namespace squirrel_threading
+
+#endif /* SQUIRREL_THREADING_TRACE_PUBLISHER_H_ */
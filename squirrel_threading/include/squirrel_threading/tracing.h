@@ -0,0 +1,302 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#ifndef SQUIRREL_THREADING_TRACING_H_
+#define SQUIRREL_THREADING_TRACING_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace squirrel_threading {
+namespace tracing {
+
+typedef std::chrono::steady_clock Clock;
+
+// One timed execution of a stage. The stage name has to be a string literal,
+// or outlive the tracer.
+struct Event {
+  const char* stage;
+  int64_t start_ns, end_ns;
+};
+
+// Events of a single thread. The owner thread is the only writer and the
+// tracer the only reader, so the buffer is lock free. When it is full the
+// new events are dropped until the tracer drains it.
+class EventBuffer {
+ public:
+  static constexpr size_t kCapacity = 4096;
+
+  explicit EventBuffer(int thread_id)
+      : thread_id_(thread_id), head_(0), tail_(0), num_dropped_(0) {}
+
+  void push(const Event& event) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= kCapacity) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events_[head % kCapacity] = event;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  template <typename Function>
+  void drain(Function&& f) {
+    const size_t head = head_.load(std::memory_order_acquire);
+    size_t tail       = tail_.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail)
+      f(events_[tail % kCapacity]);
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  int threadId() const { return thread_id_; }
+  size_t takeNumDropped() { return num_dropped_.exchange(0); }
+
+ private:
+  const int thread_id_;
+  Event events_[kCapacity];
+  std::atomic<size_t> head_, tail_;
+  std::atomic<size_t> num_dropped_;
+};
+
+// Tracer of the process. The stages are timed by scopes into the buffers of
+// their threads, and collect() aggregates them into percentiles over a
+// window of the latest samples of every stage, and streams them as complete
+// events to a Chrome trace file (chrome://tracing, ui.perfetto.dev) when one
+// is open. Tracing is disabled until enabled, a disabled scope costs a load.
+class Tracer {
+ public:
+  struct Summary {
+    std::string name;
+    size_t count;                     // total number of samples
+    double mean, p50, p95, p99, max;  // over the window, in seconds
+  };
+
+ public:
+  static Tracer& instance() {
+    static Tracer* tracer = new Tracer;
+    return *tracer;
+  }
+
+  void setEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  void setWindowSize(size_t window_size) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    window_size_ = std::max<size_t>(1, window_size);
+  }
+
+  // Start streaming the events to filename. Returns false on error.
+  bool openTrace(const std::string& filename) {
+    std::unique_lock<std::mutex> lock(mtx_);
+    if (trace_.is_open())
+      closeTraceLocked();
+    trace_.open(filename.c_str());
+    num_trace_events_ = 0;
+    if (!trace_)
+      return false;
+    trace_ << "[\n";
+    return true;
+  }
+
+  void closeTrace() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    closeTraceLocked();
+  }
+
+  void record(
+      const char* stage, Clock::time_point start, Clock::time_point end) {
+    threadBuffer().push({stage, toNanoseconds(start), toNanoseconds(end)});
+  }
+
+  // Drain the buffers of all threads and return the summaries of all the
+  // stages, in order of first appearance.
+  std::vector<Summary> collect() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    for (auto it = buffers_.begin(); it != buffers_.end();) {
+      // The buffers of the threads that are gone are released once drained.
+      // Checked before draining, the thread may still push until it exits.
+      const bool released = it->use_count() == 1;
+      EventBuffer& buffer = **it;
+      buffer.drain([this, &buffer](const Event& event) {
+        addSample(buffer.threadId(), event);
+      });
+      num_dropped_ += buffer.takeNumDropped();
+      if (released)
+        it = buffers_.erase(it);
+      else
+        ++it;
+    }
+    if (trace_.is_open())
+      trace_.flush();
+    std::vector<Summary> summaries;
+    for (const std::string& name : order_)
+      summaries.push_back(summarize(name, stages_.at(name)));
+    return summaries;
+  }
+
+  // Events dropped on full buffers since the start.
+  size_t numDropped() const {
+    std::unique_lock<std::mutex> lock(mtx_);
+    return num_dropped_;
+  }
+
+ private:
+  struct Stage {
+    Stage() : count(0), next(0) {}
+    size_t count, next;
+    std::vector<double> window;
+  };
+
+  Tracer()
+      : enabled_(false),
+        epoch_(Clock::now()),
+        window_size_(512),
+        next_thread_id_(0),
+        num_trace_events_(0),
+        num_dropped_(0) {}
+
+  EventBuffer& threadBuffer() {
+    static thread_local std::shared_ptr<EventBuffer> buffer;
+    if (!buffer) {
+      std::unique_lock<std::mutex> lock(mtx_);
+      buffer = std::make_shared<EventBuffer>(next_thread_id_++);
+      buffers_.push_back(buffer);
+    }
+    return *buffer;
+  }
+
+  int64_t toNanoseconds(Clock::time_point time) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch_)
+        .count();
+  }
+
+  void addSample(int thread_id, const Event& event) {
+    auto it = stages_.find(event.stage);
+    if (it == stages_.end()) {
+      it = stages_.insert(std::make_pair(std::string(event.stage), Stage()))
+               .first;
+      order_.push_back(it->first);
+    }
+    Stage& stage          = it->second;
+    const double duration = 1e-9 * (event.end_ns - event.start_ns);
+    if (stage.window.size() < window_size_)
+      stage.window.push_back(duration);
+    else
+      stage.window[stage.next % stage.window.size()] = duration;
+    ++stage.next;
+    ++stage.count;
+    if (trace_.is_open()) {
+      trace_ << (num_trace_events_++ > 0 ? ",\n" : "") << "{\"name\":\""
+             << event.stage << "\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+             << thread_id << ",\"ts\":" << 1e-3 * event.start_ns
+             << ",\"dur\":" << 1e-3 * (event.end_ns - event.start_ns) << "}";
+    }
+  }
+
+  static Summary summarize(const std::string& name, const Stage& stage) {
+    Summary summary;
+    summary.name  = name;
+    summary.count = stage.count;
+    summary.mean = summary.p50 = summary.p95 = summary.p99 = summary.max = 0.;
+    if (stage.window.empty())
+      return summary;
+    std::vector<double> sorted = stage.window;
+    std::sort(sorted.begin(), sorted.end());
+    const auto percentile = [&sorted](double p) {
+      return sorted[std::min<size_t>(sorted.size() - 1, p * sorted.size())];
+    };
+    for (double sample : sorted)
+      summary.mean += sample;
+    summary.mean /= sorted.size();
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = sorted.back();
+    return summary;
+  }
+
+  void closeTraceLocked() {
+    if (!trace_.is_open())
+      return;
+    trace_ << "\n]\n";
+    trace_.close();
+  }
+
+  std::atomic<bool> enabled_;
+  const Clock::time_point epoch_;
+  size_t window_size_;
+  int next_thread_id_;
+  std::vector<std::shared_ptr<EventBuffer>> buffers_;
+  std::map<std::string, Stage> stages_;
+  std::vector<std::string> order_;
+  std::ofstream trace_;
+  size_t num_trace_events_, num_dropped_;
+  mutable std::mutex mtx_;
+};
+
+// Times the lifetime of the scope as one execution of a stage.
+class Scope {
+ public:
+  explicit Scope(const char* stage)
+      : stage_(Tracer::instance().enabled() ? stage : nullptr) {
+    if (stage_)
+      start_ = Clock::now();
+  }
+  ~Scope() {
+    if (stage_)
+      Tracer::instance().record(stage_, start_, Clock::now());
+  }
+
+ private:
+  const char* stage_;
+  Clock::time_point start_;
+};
+
+}  // namespace tracing
+}  // namespace squirrel_threading
+
+#define SQUIRREL_TRACE_CONCAT_(a, b) a##b
+#define SQUIRREL_TRACE_CONCAT(a, b) SQUIRREL_TRACE_CONCAT_(a, b)
+
+// Trace the rest of the enclosing scope as the stage name.
+#define SQUIRREL_TRACE_SCOPE(name)                           \
+  ::squirrel_threading::tracing::Scope SQUIRREL_TRACE_CONCAT( \
+      squirrel_trace_scope_, __LINE__)(name)
+
+#endif /* SQUIRREL_THREADING_TRACING_H_ */
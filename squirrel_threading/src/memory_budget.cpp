@@ -0,0 +1,177 @@
+// Copyright (c) 2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "squirrel_threading/memory_budget.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace squirrel_threading {
+
+struct MemoryBudget::Account::Record {
+  explicit Record(const std::string& name)
+      : name(name), bytes(0), num_actions(0) {}
+
+  const std::string name;
+  std::atomic<size_t> bytes;
+  // Guarded by the mutex of the budget.
+  size_t num_actions;
+  std::string last_action;
+};
+
+const char* toString(MemoryPressure pressure) {
+  switch (pressure) {
+    case MemoryPressure::NONE:
+      return "none";
+    case MemoryPressure::SOFT:
+      return "soft";
+    case MemoryPressure::HARD:
+      return "hard";
+  }
+  return "unknown";
+}
+
+MemoryBudget::Account::Account(const std::string& name, MemoryBudget& budget)
+    : budget_(budget), record_(new Record(name)) {
+  budget_.add(record_);
+}
+
+MemoryBudget::Account::~Account() { budget_.remove(record_); }
+
+void MemoryBudget::Account::report(size_t bytes) {
+  if (record_->bytes.exchange(bytes) != bytes)
+    budget_.evaluate();
+}
+
+size_t MemoryBudget::Account::bytes() const { return record_->bytes.load(); }
+
+void MemoryBudget::Account::recordAction(const std::string& action) {
+  std::unique_lock<std::mutex> lock(budget_.mtx_);
+  ++record_->num_actions;
+  record_->last_action = action;
+}
+
+MemoryBudget& MemoryBudget::global() {
+  static MemoryBudget* budget = new MemoryBudget;
+  return *budget;
+}
+
+MemoryBudget::MemoryBudget()
+    : budget_(0),
+      soft_ratio_(0.8),
+      min_available_(0),
+      configured_(false),
+      available_(0),
+      pressure_(static_cast<int>(MemoryPressure::NONE)) {}
+
+bool MemoryBudget::setLimits(
+    size_t budget, double soft_ratio, size_t min_available, bool force) {
+  if (configured_.exchange(true) && !force)
+    return false;
+  budget_        = budget;
+  soft_ratio_    = std::min(std::max(soft_ratio, 0.), 1.);
+  min_available_ = min_available;
+  evaluate();
+  return true;
+}
+
+size_t MemoryBudget::usage() const {
+  std::unique_lock<std::mutex> lock(mtx_);
+  size_t bytes = 0;
+  for (const auto& record : records_)
+    bytes += record->bytes.load();
+  return bytes;
+}
+
+void MemoryBudget::update() {
+  size_t available = 0;
+  std::ifstream meminfo("/proc/meminfo");
+  std::string line;
+  while (std::getline(meminfo, line))
+    if (line.compare(0, 13, "MemAvailable:") == 0) {
+      std::istringstream value(line.substr(13));
+      size_t kb;
+      if (value >> kb)
+        available = kb * 1024;
+      break;
+    }
+  available_ = available;
+  evaluate();
+}
+
+size_t MemoryBudget::residentBytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t size, resident;
+  if (!(statm >> size >> resident))
+    return 0;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+std::vector<MemoryBudget::Entry> MemoryBudget::entries() const {
+  std::unique_lock<std::mutex> lock(mtx_);
+  std::vector<Entry> entries;
+  entries.reserve(records_.size());
+  for (const auto& record : records_)
+    entries.push_back(
+        {record->name, record->bytes.load(), record->num_actions,
+         record->last_action});
+  return entries;
+}
+
+void MemoryBudget::evaluate() {
+  const size_t bytes         = usage();
+  const size_t budget        = budget_;
+  const size_t min_available = min_available_;
+  const size_t available     = available_;
+  MemoryPressure pressure    = MemoryPressure::NONE;
+  if ((budget > 0 && bytes > budget) ||
+      (min_available > 0 && available > 0 && available < min_available))
+    pressure = MemoryPressure::HARD;
+  else if (budget > 0 && bytes > soft_ratio_ * budget)
+    pressure = MemoryPressure::SOFT;
+  pressure_ = static_cast<int>(pressure);
+}
+
+void MemoryBudget::add(const std::shared_ptr<Account::Record>& record) {
+  std::unique_lock<std::mutex> lock(mtx_);
+  records_.push_back(record);
+}
+
+void MemoryBudget::remove(const std::shared_ptr<Account::Record>& record) {
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    records_.erase(
+        std::remove(records_.begin(), records_.end(), record), records_.end());
+  }
+  evaluate();
+}
+
+}  // namespace squirrel_threading
@@ -0,0 +1,147 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_threading/thread_policy.h"
+#include "squirrel_threading/thread_pool.h"
+
+#include <ros/console.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+
+namespace squirrel_threading {
+
+namespace {
+
+std::mutex policy_mtx;
+ThreadPolicy policy = ThreadPolicy::defaultPolicy();
+bool pool_created   = false;
+
+}  // namespace
+
+ThreadPolicy ThreadPolicy::defaultPolicy() {
+  ThreadPolicy policy;
+  policy.num_threads = 0;
+  policy.priority    = 0;
+  return policy;
+}
+
+ThreadPolicy ThreadPolicy::fromParams(const ros::NodeHandle& nh) {
+  ThreadPolicy policy = defaultPolicy();
+  nh.param<int>("threads/num_threads", policy.num_threads, 0);
+  nh.param<std::vector<int>>("threads/cpus", policy.cpus, std::vector<int>());
+  nh.param<int>("threads/priority", policy.priority, 0);
+  return policy;
+}
+
+bool ThreadPolicy::applyToCurrentThread() const {
+  bool success = true;
+  if (!cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus)
+      if (cpu >= 0 && cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+      ROS_WARN_STREAM("squirrel_threading: Unable to pin the thread to the "
+                      "CPUs " << toString() << ".");
+      success = false;
+    }
+  }
+  if (priority > 0) {
+    sched_param param;
+    param.sched_priority =
+        std::min(priority, sched_get_priority_max(SCHED_FIFO));
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+      ROS_WARN_STREAM("squirrel_threading: Unable to set the SCHED_FIFO "
+                      "priority " << priority << " (missing CAP_SYS_NICE?).");
+      success = false;
+    }
+  }
+  return success;
+}
+
+std::string ThreadPolicy::toString() const {
+  std::ostringstream ss;
+  ss << "threads: " << num_threads << ", cpus: [";
+  for (size_t i = 0; i < cpus.size(); ++i)
+    ss << (i > 0 ? ", " : "") << cpus[i];
+  ss << "], priority: " << priority;
+  return ss.str();
+}
+
+ThreadPolicy configureThreads(const ros::NodeHandle& nh) {
+  const ThreadPolicy new_policy = ThreadPolicy::fromParams(nh);
+  {
+    std::unique_lock<std::mutex> lock(policy_mtx);
+    if (pool_created)
+      ROS_WARN("squirrel_threading: The shared pool is already running, its "
+               "size is not changed.");
+    policy = new_policy;
+  }
+  new_policy.applyToCurrentThread();
+#ifdef _OPENMP
+  if (new_policy.num_threads > 0)
+    omp_set_num_threads(new_policy.num_threads);
+#endif
+  ROS_INFO_STREAM("squirrel_threading: " << new_policy.toString() << ".");
+  return new_policy;
+}
+
+ThreadPolicy currentPolicy() {
+  std::unique_lock<std::mutex> lock(policy_mtx);
+  return policy;
+}
+
+// The pool is never destroyed, so that it outlives the static objects that
+// may still use it at exit.
+ThreadPool& ThreadPool::global() {
+  static ThreadPool* pool = []() {
+    ThreadPolicy pool_policy;
+    {
+      std::unique_lock<std::mutex> lock(policy_mtx);
+      pool_policy  = policy;
+      pool_created = true;
+    }
+    return new ThreadPool(pool_policy.num_threads, [pool_policy]() {
+      pool_policy.applyToCurrentThread();
+    });
+  }();
+  return *pool;
+}
+
+}  // namespace squirrel_threading
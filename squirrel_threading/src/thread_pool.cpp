@@ -0,0 +1,172 @@
+// Copyright (c) 2016-2017, Federico Boniardi and Wolfram Burgard
+// All rights reserved.
+// 
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+// 
+// * Redistributions of source code must retain the above copyright notice, this
+//   list of conditions and the following disclaimer.
+// 
+// * Redistributions in binary form must reproduce the above copyright notice,
+//   this list of conditions and the following disclaimer in the documentation
+//   and/or other materials provided with the distribution.
+// 
+// * Neither the name of the University of Freiburg nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#include "squirrel_threading/thread_pool.h"
+
+#include <algorithm>
+
+namespace squirrel_threading {
+
+namespace {
+
+// Pool and queue of the calling thread, when it is a worker.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local int current_id = -1;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads, const Task& on_start)
+    : num_queued_(0), num_pending_(0), next_queue_(0), stop_(false) {
+  if (num_threads <= 0)
+    num_threads = std::max<int>(1, std::thread::hardware_concurrency());
+  for (int i = 0; i < num_threads; ++i)
+    queues_.emplace_back(new Worker);
+  for (int i = 0; i < num_threads; ++i)
+    workers_.emplace_back(&ThreadPool::run, this, i, on_start);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  wake_up_.notify_all();
+  for (auto& worker : workers_)
+    worker.join();
+}
+
+void ThreadPool::submit(Task task) {
+  const int id = current_pool == this
+                     ? current_id
+                     : next_queue_.fetch_add(1) % queues_.size();
+  ++num_pending_;
+  {
+    std::unique_lock<std::mutex> lock(queues_[id]->mtx);
+    queues_[id]->tasks.push_back(std::move(task));
+  }
+  ++num_queued_;
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+  }
+  wake_up_.notify_one();
+}
+
+void ThreadPool::parallelFor(
+    int begin, int end, int grain, const RangeTask& body) {
+  if (end <= begin)
+    return;
+  grain                = std::max(1, grain);
+  const int num_chunks = (end - begin + grain - 1) / grain;
+  if (num_chunks == 1) {
+    body(begin, end);
+    return;
+  }
+  // The chunks are handed out by a shared counter, the helpers that start
+  // after all of them are taken return right away.
+  struct Loop {
+    std::atomic<int> next_chunk, num_left;
+    std::mutex mtx;
+    std::condition_variable done;
+  };
+  auto loop = std::make_shared<Loop>();
+  loop->next_chunk = 0;
+  loop->num_left   = num_chunks;
+  auto work        = [=, &body]() {
+    for (int chunk = loop->next_chunk++; chunk < num_chunks;
+         chunk     = loop->next_chunk++) {
+      const int chunk_begin = begin + chunk * grain;
+      body(chunk_begin, std::min(end, chunk_begin + grain));
+      if (--loop->num_left == 0) {
+        std::unique_lock<std::mutex> lock(loop->mtx);
+        loop->done.notify_all();
+      }
+    }
+  };
+  const int num_helpers = std::min(num_chunks, size() + 1) - 1;
+  for (int i = 0; i < num_helpers; ++i)
+    submit(work);
+  work();
+  std::unique_lock<std::mutex> lock(loop->mtx);
+  loop->done.wait(lock, [&loop]() { return loop->num_left == 0; });
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mtx_);
+  done_.wait(lock, [this]() { return num_pending_ == 0; });
+}
+
+void ThreadPool::run(int id, const Task& on_start) {
+  current_pool = this;
+  current_id   = id;
+  if (on_start)
+    on_start();
+  for (;;) {
+    Task task;
+    if (pop(id, &task) || steal(id, &task)) {
+      task();
+      if (--num_pending_ == 0) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        done_.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mtx_);
+    wake_up_.wait(lock, [this]() { return stop_ || num_queued_ > 0; });
+    if (stop_ && num_queued_ == 0)
+      return;
+  }
+}
+
+bool ThreadPool::pop(int id, Task* task) {
+  Worker& worker = *queues_[id];
+  std::unique_lock<std::mutex> lock(worker.mtx);
+  if (worker.tasks.empty())
+    return false;
+  *task = std::move(worker.tasks.back());
+  worker.tasks.pop_back();
+  --num_queued_;
+  return true;
+}
+
+bool ThreadPool::steal(int id, Task* task) {
+  const int num_queues = static_cast<int>(queues_.size());
+  for (int i = 1; i < num_queues; ++i) {
+    Worker& victim = *queues_[(id + i) % num_queues];
+    std::unique_lock<std::mutex> lock(victim.mtx);
+    if (victim.tasks.empty())
+      continue;
+    *task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    --num_queued_;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace squirrel_threading